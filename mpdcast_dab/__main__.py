@@ -67,6 +67,56 @@ def get_args() -> dict[str, Any]:
   parser.add_argument('-c', '--conf', help= 'MPD config file to use.', default='/etc/mpd.conf')
   parser.add_argument('--disable-dabserver', help= 'Disable DAB server functionality', action='store_true')
   parser.add_argument('--disable-mpdcast', help= 'Disable MPD Cast functionality', action='store_true')
+  parser.add_argument('--aac-passthrough', help= 'Serve the broadcast HE-AAC (LATM framed) '
+                      'instead of decoding it to PCM', action='store_true')
+  parser.add_argument('--wideband', help= 'Receive two adjacent DAB blocks per device', action='store_true')
+  parser.add_argument('--eti-input', help= 'CHANNEL:SOURCE receive the ensemble of the channel from an ETI stream '
+                      '(tcp://HOST:PORT, http://HOST:PORT/PATH) or file instead of a dongle, may be repeated',
+                      action='append', default=[])
+  parser.add_argument('--fft-planner', help= 'FFTW planning effort. measure and patient are faster, '
+                      'but take long on the first start unless a wisdom file is used',
+                      choices=['estimate', 'measure', 'patient'], default='estimate')
+  parser.add_argument('--fft-wisdom', help= 'FFTW wisdom file to load and update', default='')
+  parser.add_argument('--dsp-kernels', help= 'Instruction set of the signal processing kernels, '
+                      'auto picks the best one the CPU supports',
+                      choices=['auto', 'scalar', 'sse4', 'avx2', 'neon'], default='auto')
+  parser.add_argument('--demodulator-threads', help= 'Threads per device for OFDM demodulation', type=int, default=1)
+  parser.add_argument('--stream-symbols', help= 'Demodulate every OFDM symbol as soon as it is received, '
+                      'for almost a frame less latency', action='store_true')
+  parser.add_argument('--load-governor', help= 'Give up TII, diagnostics, SNR updates, background slideshows '
+                      'and warm standby, in this order, while the decoder does not keep up', action='store_true')
+  parser.add_argument('--idle-fic-interval', help= 'While no service is subscribed, demodulate only every Nth frame '
+                      'for the FIC and keep just the synchronisation on the others, 0 to always demodulate all',
+                      type=int, default=0)
+  parser.add_argument('--scan-prescan', help= 'Rank the channels by their spectrum before the scan, '
+                      'scanning the likely ones first and skipping the empty ones', action='store_true')
+  parser.add_argument('--memory-budget', help= 'Megabytes each device may allocate for its receive buffers, '
+                      'smaller rings and fewer standby services are used to stay within it, 0 for no limit',
+                      type=int, default=0)
+  parser.add_argument('--packed-softbits', help= 'Keep the soft bits of the subchannels packed into 4 bits, '
+                      'for half the memory of the de-interleavers at a negligible loss', action='store_true')
+  parser.add_argument('--aac-decoder', help= 'Library decoding the DAB+ audio, auto compares the compiled in ones '
+                      'on the first seconds of every audio format and keeps the faster one',
+                      choices=['auto', 'faad2', 'fdk-aac'], default='auto')
+  parser.add_argument('--usb-transfers', help= 'USB transfers of the rtl-sdr dongles: default, low-latency, '
+                      'robust for busy hosts, or <count>x<bytes>', default='default')
+  parser.add_argument('--usb-zero-copy', help= 'Receive the USB transfers of the rtl-sdr dongles straight into '
+                      'the sample buffer, one at a time', action='store_true')
+  parser.add_argument('--lock-memory', help= 'Lock the sample, frame and subchannel buffers into memory, '
+                      'prefaulted, optionally on huge pages, so the real-time threads take no page faults',
+                      choices=['off', 'lock', 'hugepages'], default='off')
+  parser.add_argument('--warm-standby', help= 'Number of recently unsubscribed services of the channel '
+                      'to keep synchronised for fast switching back to them', type=int, default=0)
+  parser.add_argument('--ensemble-cache', help= 'Directory to keep the ensemble of each received channel in, '
+                      'for starting playback before the channel data is received again', default='')
+  parser.add_argument('--thread-config', help= 'STAGE:CPUS[:RTPRIO[:NICE]] CPU affinity and scheduling of a pipeline '
+                      'stage (input, agc, sync, ofdm, demodulator, audio, tii, output), may be repeated',
+                      action='append', default=[])
+  parser.add_argument('--native-stream-port', help= 'Serve the audio streams natively on this port '
+                      'instead of through the web server, 0 to disable', type=int, default=0)
+  parser.add_argument('--decode-ensemble', help= 'Permanently decode all services of the given channel', default='')
+  parser.add_argument('--ensemble-passthrough', help= 'Comma separated services of the decoded ensemble '
+                      'to keep as AAC instead of PCM', default='')
   parser.add_argument('-v', '--verbose', help= 'Enable verbose output', action='store_true')
   return vars(parser.parse_args())
 
@@ -94,7 +144,25 @@ def prepare_dab(options: dict[str, Any], web_app: web.Application, prefix: str)
     logger.warning('Failed to load DAB+ library')
     logger.warning(str(WELLIO_IMPORT_ERROR))
     return None
-  dab_server = DabServer()
+  dab_server = DabServer(decode=not options['aac_passthrough'], wideband=options['wideband'],
+                         eti_input=options['eti_input'],
+                         fft_planner=options['fft_planner'], fft_wisdom=options['fft_wisdom'],
+                         dsp_kernels=options['dsp_kernels'],
+                         demodulator_threads=options['demodulator_threads'],
+                         native_stream_port=options['native_stream_port'],
+                         warm_standby=options['warm_standby'],
+                         ensemble_cache=options['ensemble_cache'],
+                         thread_config=options['thread_config'],
+                         stream_symbols=options['stream_symbols'],
+                         load_governor=options['load_governor'],
+                         scan_prescan=options['scan_prescan'],
+                         memory_budget=options['memory_budget'] << 20,
+                         lock_memory=options['lock_memory'],
+                         idle_fic_interval=options['idle_fic_interval'],
+                         packed_softbits=options['packed_softbits'],
+                         aac_decoder=options['aac_decoder'],
+                         usb_transfers=options['usb_transfers'],
+                         usb_zero_copy=options['usb_zero_copy'])
   if not dab_server.initialize():
     return None
   web_app.add_routes(dab_server.get_routes(prefix))
@@ -139,6 +207,11 @@ def main(run_from_local: bool = False) -> None:
   if mpd_caster:
     loop.run_until_complete(mpd_caster.start())
 
+  if dab_server and options['decode_ensemble']:
+    passthrough = {name.strip() for name in options['ensemble_passthrough'].split(',') if name.strip()}
+    if not loop.run_until_complete(dab_server.decode_ensemble(options['decode_ensemble'], passthrough)):
+      logger.error('Could not decode the ensemble of channel %s', options['decode_ensemble'])
+
   logger.info('Succesfully initialized MpdCast DAB')
   # prepare the main loop
   async def mainloop() -> None:
@@ -18,7 +18,7 @@ class ServiceEventPass():
   async def on_frame_errors(self, frame_errors: int) -> None:
     pass
 
-  async def on_new_audio(self, audio_data: bytes, sample_rate: int, mode: str) -> None:
+  async def on_new_audio(self, audio_data: memoryview, sample_rate: int, mode: str) -> None:
     pass
 
   async def on_rs_errors(self, uncorrected_errors: int, num_corrected_errors: int) -> None:
@@ -30,7 +30,7 @@ class ServiceEventPass():
   async def on_new_dynamic_label(self, label: str) -> None:
     pass
 
-  async def on_mot(self, data: bytes, mime_type: str, name: str) -> None:
+  async def on_mot(self, data: memoryview, mime_type: str, name: str, slide_id: str) -> None:
     pass
 
 class ChannelEventPass():
@@ -55,6 +55,15 @@ class ChannelEventPass():
   async def on_set_ensemble_label(self, label: str) -> None:
     pass
 
+  async def on_service_label(self, service_id: int, label: str) -> None:
+    pass
+
+  async def on_service_components_complete(self, service_id: int) -> None:
+    pass
+
+  async def on_ensemble_complete(self, ensemble_id: int) -> None:
+    pass
+
   async def on_datetime_update(self, timestamp: int) -> None:
     pass
 
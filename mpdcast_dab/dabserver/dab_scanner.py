@@ -12,10 +12,14 @@
 # You should have received a copy of the GNU General Public License
 # along with this program. If not, see <https://www.gnu.org/licenses/>.
 
+
 """DAB Scanner to find all DAB radio services and generate a playlist."""
 
 import asyncio
+import collections
+import json
 import logging
+import os
 import typing
 
 import yarl
@@ -31,50 +35,170 @@ UiStatus = typing.TypedDict('UiStatus', {'scanner_status': str,
                                          'progress': int,
                                          'progress_text': str})
 
-class DabScanner(ChannelEventHandler, ChannelEventPass):
-  SERVICE_DISCOVERY_TIMEOUT = 10
+# What a scan found on a channel: the EId, the CRCs of the static FIBs and the services
+Signature = typing.TypedDict('Signature', {'eid': int, 'crcs': list[int], 'services': dict[str, str]})
+
+ChannelServices = dict[int, dict[str, str]]
+
+class ChannelScan(ChannelEventHandler, ChannelEventPass):
+  """Receives the events of one device while it scans a channel"""
 
   def __init__(self, device: DabDevice) -> None:
     ChannelEventHandler.__init__(self)
-    self._dab_device: DabDevice = device
-    self._is_signal: bool | None = None
+    self.device:   DabDevice       = device
+    self.is_signal: bool | None    = None
+    self.services: ChannelServices = {}
+
+    # internal update notification events
+    self.signal_presence_event   = asyncio.Event()
+    self.ensemble_complete_event = asyncio.Event()
+
+  def reset(self) -> None:
+    self.is_signal = None
+    self.services  = {}
+    self.ensemble_complete_event.clear()
+
+  async def on_service_detected(self, service_id: int) -> None:
+    if not service_id in self.services.keys():
+      ensemble = self.device.get_ensemble()
+      details = ensemble.service(service_id) if ensemble else None
+      if details and details.is_audio:
+        self.services[service_id] = {}
+
+  async def on_ensemble_complete(self, ensemble_id: int) -> None:
+    self.ensemble_complete_event.set()
+
+  async def on_signal_presence(self, is_signal: bool) -> None:
+    self.is_signal = is_signal
+    self.signal_presence_event.set()
+    self.signal_presence_event.clear()
+
+class DabScanner():
+  SERVICE_DISCOVERY_TIMEOUT = 10
+  PROBE_TIMEOUT_MS = 500
+  # a channel known from a previous scan is taken as unchanged once its EId,
+  # exactly its audio services and this many CRCs of its static FIBs were
+  # received again, usually within the first frames
+  SIGNATURE_MIN_MATCHES = 2
+  SIGNATURE_TIMEOUT = 1.0
+  SIGNATURE_POLL_INTERVAL = 0.1
+  # the spectrum pre-scan: a channel is scanned if its in-band power exceeds
+  # the one at its edges by this much more than on an empty channel of the
+  # tuner. Below the flatness, the power is in a few carriers instead.
+  PRESCAN_TIMEOUT_MS = 100
+  PRESCAN_MIN_SCORE_DB = 3.0
+  PRESCAN_MIN_FLATNESS = 0.5
+  # the empty channels are the ones with the lowest contrast. With fewer
+  # measured channels, or a higher contrast at the percentile, which happens
+  # in a densely occupied band, the flat noise floor of an empty channel is
+  # assumed instead, up to the ripple of the tuner
+  PRESCAN_BASELINE_PERCENTILE = 0.2
+  PRESCAN_BASELINE_MIN_CHANNELS = 5
+  PRESCAN_MAX_BASELINE_DB = 1.5
+
+  def __init__(self, devices: list[DabDevice], signature_file: str = '', prescan: bool = False) -> None:
+    self._dab_devices: list[DabDevice] = self._one_per_tuner(devices)
+    self._prescan = prescan
     self._scanner_task: asyncio.Task | None = None
+    self._active_channels: list[str] = []
     self._all_channel_names = all_channel_names()
-    self.scan_results: dict[str, dict[int, dict[str, str]]] = {}
+    self._signature_file = signature_file
+    self._signatures: dict[str, Signature] = self._load_signatures()
+    self._verified_channels = 0
+    # queues of the results() iterators, None ends them
+    self._listeners: list[asyncio.Queue] = []
+    self.scan_results: dict[str, ChannelServices] = {}
     self.ui_status: UiStatus = {'scanner_status': '&nbsp;', 
                                 'download_ready': False,
                                 'is_scan_active': False,
                                 'progress': 0,
                                 'progress_text': '&nbsp;'}
 
-    # internal update notification event
-    self._signal_presence_event = asyncio.Event()
+  @staticmethod
+  def _one_per_tuner(devices: list[DabDevice]) -> list[DabDevice]:
+    # the channels of a wideband device cannot tune apart from each other
+    tuners: dict[str, DabDevice] = {}
+    for device in devices:
+      name = device.device_name
+      if name.startswith('wideband:'):
+        name = name.split(':', 2)[2]
+      tuners.setdefault(name, device)
+    return list(tuners.values())
+
+  def _load_signatures(self) -> dict[str, Signature]:
+    if not self._signature_file:
+      return {}
+    try:
+      with open(self._signature_file, encoding='utf-8') as file:
+        return json.load(file)
+    except FileNotFoundError:
+      return {}
+    except (OSError, ValueError) as error:
+      logger.warning('Ignoring the scan signatures in %s: %s', self._signature_file, error)
+      return {}
+
+  def _save_signatures(self) -> None:
+    if not self._signature_file:
+      return
+    try:
+      with open(self._signature_file + '.tmp', 'w', encoding='utf-8') as file:
+        json.dump(self._signatures, file)
+      os.replace(self._signature_file + '.tmp', self._signature_file)
+    except OSError as error:
+      logger.warning('Could not save the scan signatures to %s: %s', self._signature_file, error)
 
   async def start_scan(self) -> dict:
     if self._scanner_task:
       self.ui_status['scanner_status']      = 'Scan in progress. No new scan possible.'
-    elif not self._dab_device.lock.acquire(blocking=False):
+      return { }
+    devices = [device for device in self._dab_devices if device.lock.acquire(blocking=False)]
+    if not devices:
       self.ui_status['scanner_status']      = 'DAB device is locked. No scan possible.'
     else:
-      self._scanner_task = asyncio.create_task(self._run_scan())
+      # cleared before results() can be asked for the new scan
+      self.scan_results = {}
+      self._verified_channels = 0
+      self.ui_status['download_ready'] = False
+      self._scanner_task = asyncio.create_task(self._run_scan(devices))
       self.ui_status['scanner_status']      = 'Scan started succesfully'
     return { }
 
   def get_playlist(self, base_url: yarl.URL) -> str:
     playlist = '#EXTM3U\n'
-    for channel_name, channel_details in self.scan_results.items():
-      for service_details in channel_details.values():
+    # in band order, the channels complete in any order
+    for channel_name in self._all_channel_names:
+      for service_details in self.scan_results.get(channel_name, {}).values():
         if 'name' in service_details:
           stream_url = base_url / channel_name / service_details['name']
           playlist+= '#EXTINF:-1,' + service_details['name'] + '\n'
           playlist+= str(stream_url) + '\n'
     return playlist
 
+  async def results(self) -> typing.AsyncIterator[typing.Tuple[str, ChannelServices]]:
+    """The channels scanned so far, then each one as it completes, until the scan ends"""
+    queue: asyncio.Queue = asyncio.Queue()
+    for channel, services in self.scan_results.items():
+      queue.put_nowait((channel, services))
+    if self._scanner_task:
+      self._listeners.append(queue)
+    else:
+      queue.put_nowait(None)
+    try:
+      while (result := await queue.get()) is not None:
+        yield result
+    finally:
+      if queue in self._listeners:
+        self._listeners.remove(queue)
+
+  def _publish(self, result: typing.Tuple[str, ChannelServices] | None) -> None:
+    for queue in self._listeners:
+      queue.put_nowait(result)
+
   def status(self) -> UiStatus:
     if self._scanner_task:
       self.ui_status['is_scan_active'] = True
       number_of_channels  = len(self._all_channel_names)
-      scanned_channels    = max (0, len(self.scan_results.keys()) - 1)
+      scanned_channels    = len(self.scan_results.keys())
       progress            = int(100.0 * scanned_channels / number_of_channels)
       discovered_services = 0
       self.ui_status['progress'] = progress
@@ -85,8 +209,10 @@ class DabScanner(ChannelEventHandler, ChannelEventPass):
       self.ui_status['progress_text'] = str(progress) + '% (' + str(scanned_channels)
       self.ui_status['progress_text']+= ' of ' + str(number_of_channels) + ' channels)'
       self.ui_status['progress_text']+= ' Found ' + str(discovered_services) + ' radio services.'
+      if self._verified_channels:
+        self.ui_status['progress_text']+= ' ' + str(self._verified_channels) + ' channels unchanged.'
       self.ui_status['scanner_status'] = 'Scan in progress. Currently scanning channel '
-      self.ui_status['scanner_status']+= self._dab_device.get_channel() + '.'
+      self.ui_status['scanner_status']+= ', '.join(self._active_channels) + '.'
     else:
       self.ui_status['progress_text'] = '&nbsp;'
       self.ui_status['progress'] = 0
@@ -98,49 +224,149 @@ class DabScanner(ChannelEventHandler, ChannelEventPass):
       self._scanner_task.cancel()
     return { }
 
-  async def _run_scan(self) -> None:
-    service_count = 0
+  def _service_count(self) -> int:
+    return sum(len(services) for services in self.scan_results.values())
+
+  async def _run_scan(self, devices: list[DabDevice]) -> None:
     try:
-      self.scan_results = {}
-      self.ui_status['download_ready'] = False
-      for channel in self._all_channel_names:
-        self.scan_results[channel] = {}
-        # tune to the channel
-        self._dab_device.set_channel(channel, self, True)
-        await self._signal_presence_event.wait()
-        if self._is_signal:
-          # wait for service detection
-          await asyncio.sleep(DabScanner.SERVICE_DISCOVERY_TIMEOUT)
-
-          # collect service names
-          for service_id in self.scan_results[channel].keys():
-            name = self._dab_device.get_service_name(service_id).rstrip()
-            self.scan_results[channel][service_id]['name'] = name
-            service_count+= 1
-
-        self._dab_device.reset_channel()
+      # every tuner takes the next channel nobody scanned yet
+      if self._prescan:
+        pending = collections.deque(await self._prescan_candidates(devices))
+      else:
+        pending = collections.deque(self._all_channel_names)
+      logger.debug('Scanning with %d tuner(s), %d channels known', len(devices), len(self._signatures))
+      await asyncio.gather(*(self._scan_channels(ChannelScan(device), pending) for device in devices))
     except asyncio.CancelledError:
-      self._dab_device.reset_channel()
-      self.ui_status['scanner_status'] = 'Scan stopped. Found ' + str(service_count) + ' radio services.'
+      self.ui_status['scanner_status'] = 'Scan stopped. Found ' + str(self._service_count()) + ' radio services.'
       raise
     finally:
-      # scan finished. release the DAB device and remove strong reference to running task
-      self._dab_device.lock.release()
+      # scan finished. release the DAB devices and remove strong reference to running task
+      for device in devices:
+        device.lock.release()
       self._scanner_task = None
-      self.ui_status['download_ready'] = bool(service_count > 0)
+      self._active_channels = []
+      self._save_signatures()
+      self._publish(None)
+      self.ui_status['download_ready'] = bool(self._service_count() > 0)
 
-    self.ui_status['scanner_status'] = 'Scan finished. Found ' + str(service_count) + ' radio services.'
+    self.ui_status['scanner_status'] = 'Scan finished. Found ' + str(self._service_count()) + ' radio services.'
 
-  async def on_service_detected(self, service_id: int) -> None:
-    current_channel = list(self.scan_results.keys())[-1]
-    if not service_id in self.scan_results[current_channel].keys():
-      if self._dab_device.is_audio_service(service_id):
-        self.scan_results[current_channel][service_id] = {}
+  async def _prescan_candidates(self, devices: list[DabDevice]) -> list[str]:
+    """The channels worth a scan, the most promising first. The others are done already."""
+    loop = asyncio.get_running_loop()
+    # each tuner measures a contiguous part of the band
+    count = len(self._all_channel_names)
+    parts = [self._all_channel_names[index * count // len(devices):(index + 1) * count // len(devices)]
+             for index in range(len(devices))]
+    measurements = await asyncio.gather(*(loop.run_in_executor(None, device.prescan_channels,
+                                                               part, DabScanner.PRESCAN_TIMEOUT_MS)
+                                          for device, part in zip(devices, parts)))
 
-  async def on_signal_presence(self, is_signal: bool) -> None:
-    self._is_signal = is_signal
-    self._signal_presence_event.set()
-    self._signal_presence_event.clear()
+    scores: dict[str, float] = {}
+    for measured in measurements:
+      if measured:
+        scores.update(self._prescan_scores(measured))
+
+    candidates = []
+    for channel in self._all_channel_names:
+      # a channel that could not be measured is scanned anyway, a known one verified
+      if scores.get(channel, DabScanner.PRESCAN_MIN_SCORE_DB) >= DabScanner.PRESCAN_MIN_SCORE_DB or channel in self._signatures:
+        candidates.append(channel)
+      else:
+        self.scan_results[channel] = {}
+        self._publish((channel, {}))
+    candidates.sort(key=lambda channel: scores.get(channel, 0.0), reverse=True)
+    logger.debug('Pre-scan: %d of %d channels left, %s', len(candidates), count,
+                 ', '.join(f'{channel} {scores.get(channel, 0.0):.1f} dB' for channel in candidates))
+    return candidates
+
+  @staticmethod
+  def _prescan_scores(measured: list[tuple[str, float, float, float]]) -> dict[str, float]:
+    """The contrast of each channel of a tuner above that of its empty channels."""
+    contrasts = sorted(in_band - edge for _, in_band, edge, _ in measured)
+    baseline = 0.0
+    if len(contrasts) >= DabScanner.PRESCAN_BASELINE_MIN_CHANNELS:
+      baseline = contrasts[int(len(contrasts) * DabScanner.PRESCAN_BASELINE_PERCENTILE)]
+    baseline = min(baseline, DabScanner.PRESCAN_MAX_BASELINE_DB)
+    return {channel: in_band - edge - baseline if flatness >= DabScanner.PRESCAN_MIN_FLATNESS else 0.0
+            for channel, in_band, edge, flatness in measured}
+
+  async def _scan_channels(self, scan: ChannelScan, pending: collections.deque) -> None:
+    while pending:
+      channel = pending.popleft()
+      self._active_channels.append(channel)
+      try:
+        services = await self._scan_channel(scan, channel)
+      finally:
+        self._active_channels.remove(channel)
+        # queued behind a set_channel_async the cancellation left running
+        await scan.device.reset_channel_async()
+      self.scan_results[channel] = services
+      self._publish((channel, services))
+
+  async def _scan_channel(self, scan: ChannelScan, channel: str) -> ChannelServices:
+    loop = asyncio.get_running_loop()
+    # skip channels without a DAB signal before setting up the full receiver
+    if not await loop.run_in_executor(None, scan.device.probe_channel,
+                                      channel, DabScanner.PROBE_TIMEOUT_MS):
+      logger.debug('No DAB signal on channel %s', channel)
+      self._signatures.pop(channel, None)
+      return {}
+
+    # tune to the channel
+    scan.reset()
+    if not await scan.device.set_channel_async(channel, scan, True):
+      return {}
+    await scan.signal_presence_event.wait()
+    if not scan.is_signal:
+      self._signatures.pop(channel, None)
+      return {}
+
+    known = self._signatures.get(channel)
+    if known and await self._verify_signature(scan, known):
+      logger.debug('Ensemble of channel %s unchanged', channel)
+      self._verified_channels+= 1
+      return {int(service_id): {'name': name} for service_id, name in known['services'].items()}
+
+    # wait for service detection, usually the backend reports the complete ensemble much earlier
+    try:
+      await asyncio.wait_for(scan.ensemble_complete_event.wait(), DabScanner.SERVICE_DISCOVERY_TIMEOUT)
+    except asyncio.TimeoutError:
+      logger.debug('Ensemble of channel %s incomplete after %d s', channel, DabScanner.SERVICE_DISCOVERY_TIMEOUT)
+
+    # collect service names
+    services: ChannelServices = {}
+    ensemble = scan.device.get_ensemble()
+    for service_id in list(scan.services.keys()):
+      details = ensemble.service(service_id) if ensemble else None
+      services[service_id] = {'name': details.label.rstrip() if details else ''}
+
+    signature = scan.device.get_fib_signature()
+    if signature and services:
+      ensemble_id, crcs = signature
+      self._signatures[channel] = {'eid': ensemble_id, 'crcs': crcs,
+                                   'services': {str(service_id): details['name']
+                                                for service_id, details in services.items()}}
+    else:
+      self._signatures.pop(channel, None)
+    return services
+
+  async def _verify_signature(self, scan: ChannelScan, known: Signature) -> bool:
+    loop = asyncio.get_running_loop()
+    deadline = loop.time() + DabScanner.SIGNATURE_TIMEOUT
+    known_crcs = set(known['crcs'])
+    known_services = {int(service_id) for service_id in known['services']}
+    while True:
+      signature = scan.device.get_fib_signature()
+      if signature:
+        ensemble_id, crcs = signature
+        # a reconfiguration can keep some of the FIBs, but not the service set
+        if (ensemble_id == known['eid'] and set(scan.services.keys()) == known_services
+            and len(known_crcs.intersection(crcs)) >= DabScanner.SIGNATURE_MIN_MATCHES):
+          return True
+      if loop.time() >= deadline:
+        return False
+      await asyncio.sleep(DabScanner.SIGNATURE_POLL_INTERVAL)
 
   async def stop(self) -> None:
     if self._scanner_task:
@@ -17,24 +17,86 @@
 import asyncio
 import json
 import logging
+import os
 import typing
+import urllib.parse
 from aiohttp import web
 
 from .radio_controller import RadioController
 from .dab_scanner import DabScanner
-from .service_controller import UnsubscribedError
-from .welle_io import DabDevice
+from .service_controller import ServiceController, UnsubscribedError
+from .welle_io import DabDevice, StreamServer, available_devices, configure_aac_decoder, configure_dsp_kernels, configure_fft_planner, configure_memory, configure_thread, render_metrics
 
 logger = logging.getLogger(__name__)
 
 class DabServer():
 
-  def __init__(self, decode: bool = True) -> None:
+  def __init__(self, decode: bool = True, wideband: bool = False, eti_input: list[str] | None = None,
+               fft_planner: str = 'estimate', fft_wisdom: str = '', dsp_kernels: str = 'auto',
+               demodulator_threads: int = 1, native_stream_port: int = 0,
+               warm_standby: int = 0, ensemble_cache: str = '',
+               thread_config: list[str] | None = None, stream_symbols: bool = False,
+               load_governor: bool = False, scan_prescan: bool = False,
+               memory_budget: int = 0, lock_memory: str = 'off',
+               idle_fic_interval: int = 0, packed_softbits: bool = False,
+               aac_decoder: str = 'auto', usb_transfers: str = 'default',
+               usb_zero_copy: bool = False) -> None:
+    # must happen before the first receiver creates its FFT plans
+    configure_fft_planner(fft_planner, fft_wisdom)
+    configure_dsp_kernels(dsp_kernels)
+    configure_aac_decoder(aac_decoder)
+    # and before the devices allocate their sample buffers
+    configure_memory(lock_memory)
+    for spec in thread_config or []:
+      self._configure_thread(spec)
+    if ensemble_cache:
+      os.makedirs(ensemble_cache, exist_ok = True)
+    # the signatures of the scanned channels, to verify them instead of scanning them again
+    self._scan_signatures:      str                    = os.path.join(ensemble_cache, 'scan.json') if ensemble_cache else ''
+    self._scan_prescan:         bool                   = scan_prescan
     self._radio_controller_obj: RadioController | None = None
     self._scanner_obj:          DabScanner      | None = None
     self._shutdown_in_progress: bool                   = False
-    self._dab_device:           DabDevice              = DabDevice(decode_audio = decode)
+    # one device per connected dongle, or the first working one if none could be enumerated
+    device_names = available_devices() or ['auto']
+    if eti_input:
+      # or one per ETI source instead, each of them carrying one channel
+      device_names = [f'eti:{source}' for source in eti_input]
+    elif wideband:
+      # each device captures two adjacent blocks, decoded independently
+      device_names = [f'wideband:{index}:{name}' for name in device_names for index in range(2)]
+    self._dab_devices:          list[DabDevice]        = [DabDevice(name, decode_audio = decode,
+                                                                    demodulator_threads = demodulator_threads,
+                                                                    warm_standby = warm_standby,
+                                                                    ensemble_cache_dir = ensemble_cache,
+                                                                    stream_symbols = stream_symbols,
+                                                                    load_governor = load_governor,
+                                                                    memory_budget = memory_budget,
+                                                                    idle_fic_interval = idle_fic_interval,
+                                                                    packed_softbits = packed_softbits,
+                                                                    usb_transfers = usb_transfers,
+                                                                    usb_zero_copy = usb_zero_copy)
+                                                          for name in device_names]
     self._audio_mimetype:       str                    = 'wav' if decode else 'aac'
+    # the audio streams are served natively on this port, if set
+    self._native_stream_port:   int                    = native_stream_port
+    self._stream_server:        StreamServer    | None = None
+    # path of the native stream -> channel and service
+    self._native_streams:       dict[str, tuple[str, str]] = {}
+
+  @staticmethod
+  def _configure_thread(spec: str) -> None:
+    # STAGE:CPUS[:RTPRIO[:NICE]], CPUS like 2 or 0,2-3, may be empty
+    parts = spec.split(':')
+    if len(parts) < 2 or len(parts) > 4:
+      raise ValueError(f'Invalid thread configuration: {spec}')
+    cpus: list[int] = []
+    for cpu_range in filter(None, parts[1].split(',')):
+      first, _, last = cpu_range.partition('-')
+      cpus.extend(range(int(first), int(last or first) + 1))
+    realtime_priority = int(parts[2]) if len(parts) > 2 and parts[2] else 0
+    nice = int(parts[3]) if len(parts) > 3 and parts[3] else 0
+    configure_thread(parts[0], cpus, realtime_priority = realtime_priority, nice = nice)
 
   def _radio_controller(self) -> RadioController:
     if not self._radio_controller_obj:
@@ -47,18 +109,30 @@ class DabServer():
     return self._scanner_obj
 
   def initialize(self) -> bool:
-    if not self._dab_device.initialize():
+    self._dab_devices = [device for device in self._dab_devices if device.initialize()]
+    if not self._dab_devices:
       logger.warning('No DAB device available. DAB server will be disabled.')
       return False
+    logger.info('Using %d DAB device(s): %s', len(self._dab_devices),
+                ', '.join(device.device_name for device in self._dab_devices))
 
-    self._radio_controller_obj = RadioController(self._dab_device)
-    self._scanner_obj          = DabScanner(self._dab_device)
+    self._radio_controller_obj = RadioController(self._dab_devices)
+    self._scanner_obj          = DabScanner(self._dab_devices, self._scan_signatures, self._scan_prescan)
+
+    if self._native_stream_port:
+      stream_server = StreamServer(self._native_stream_port, self._on_native_stream_idle)
+      if stream_server.start():
+        self._stream_server = stream_server
+      else:
+        logger.error('Could not start the native stream server, streaming via the web server')
     return True
 
   def get_routes(self, prefix: str) -> typing.List[web.AbstractRouteDef]:
     return [web.get(r'', self.webui(prefix)),
             web.get('/DAB.m3u8', self.get_scanner_playlist),
             web.get('/get_scanner_details', self.get_scanner_details),
+            web.get('/get_scanner_results', self.get_scanner_results),
+            web.get('/metrics', self.get_metrics),
             web.post('/start_scan', self.start_scan),
             web.post('/stop_scan', self.stop_scan),
             web.get(r'/stream/{channel:[0-9]{1,2}[A-Z]}/{service:.+}', self.get_audio),
@@ -83,12 +157,35 @@ class DabServer():
     resp = self._scanner().status()
     return web.Response(body = json.dumps(resp), content_type = 'application/json')
 
+  # one JSON line per scanned channel, as the channels complete
+  async def get_scanner_results(self, request: web.Request) -> web.StreamResponse:
+    resp = web.StreamResponse(headers={'Content-Type': 'application/x-ndjson', 'Cache-Control': 'no-cache'})
+    await resp.prepare(request)
+    async for channel, services in self._scanner().results():
+      result = {'channel': channel,
+                'services': [{'sid': service_id, 'name': details.get('name', '')}
+                             for service_id, details in services.items()]}
+      await resp.write(json.dumps(result).encode() + b'\n')
+    await resp.write_eof()
+    return resp
+
+  async def get_metrics(self, request: web.Request) -> web.Response:
+    # on the event loop, so the devices cannot be retuned meanwhile
+    return web.Response(body = render_metrics(self._dab_devices),
+                        headers = {'Content-Type': 'application/openmetrics-text; version=1.0.0; charset=utf-8'})
+
+  async def decode_ensemble(self, channel: str, passthrough: set[str]) -> bool:
+    return await self._radio_controller().decode_ensemble(channel, passthrough)
+
   async def stop(self) -> None:
     self._shutdown_in_progress = True
+    if self._stream_server:
+      self._stream_server.stop()
     self._radio_controller().stop()
     await self._scanner().stop()
-    self._dab_device.reset_channel()
-    self._dab_device.close_device()
+    for device in self._dab_devices:
+      device.reset_channel()
+      device.close_device()
 
   # is_float should only be true if the audio data is in 32-bit floating-point format.
   def _wav_header(self, is_float: bool, channels: int, bit_rate: int, sample_rate: int) -> bytes:
@@ -123,7 +220,8 @@ class DabServer():
         image = await controller.new_picture()
         return web.Response(body = image['data'],
                             content_type = image['type'],
-                            headers={'Cache-Control': 'no-cache', 'Connection': 'Close'})
+                            headers={'Cache-Control': 'no-cache', 'Connection': 'Close',
+                                     'ETag': '"' + image['id'] + '"'})
       except UnsubscribedError as exc:
         raise web.HTTPBadRequest() from exc
     else:
@@ -152,9 +250,13 @@ class DabServer():
     logger.debug('get_current_image: channel: %s service: %s', channel, service)
     controller = self._radio_controller().get_service_controller(service)
     if (controller and len(controller.data.picture['data']) > 0):
+      # carousels repeat their slides, which the clients then still have
+      etag = '"' + controller.data.picture['id'] + '"'
+      if request.headers.get('If-None-Match') == etag:
+        return web.Response(status = 304, headers={'ETag': etag, 'Connection': 'Close'})
       return web.Response(body = controller.data.picture['data'],
                           content_type = controller.data.picture['type'],
-                          headers={'Cache-Control': 'no-cache', 'Connection': 'Close'})
+                          headers={'Cache-Control': 'no-cache', 'Connection': 'Close', 'ETag': etag})
     # no data found
     raise web.HTTPNotFound()
 
@@ -188,6 +290,9 @@ class DabServer():
       # In case of a switch, the unsubscribe will have been processed until then
       await asyncio.sleep(0.5)
 
+    if self._stream_server:
+      return await self._redirect_to_native_stream(request, channel, service)
+
     service_controller = await self._radio_controller().subscribe_service(channel, service)
     if not service_controller:
       raise web.HTTPServiceUnavailable()
@@ -201,23 +306,28 @@ class DabServer():
         headers={'Content-Type': 'audio/' + self._audio_mimetype,'Cache-Control': 'no-cache', 'Connection': 'Close'})
       await response.prepare(request)
 
-      # prepend the wav header to the initial response
-      next_audio_frame, audio = await service_controller.new_audio()
+      # prepend the wav header to the initial response, followed by the pre-roll
+      next_audio_frame, audio = await service_controller.recent_audio()
       if self._audio_mimetype == 'wav':
-        header = self._wav_header(False, 2, 16, service_controller.data.sample_rate)
+        is_float = service_controller.float_audio
+        header = self._wav_header(is_float, 2, 32 if is_float else 16, service_controller.data.sample_rate)
       else:
         header = b''
 
-      await response.write(header + audio)
+      if header:
+        await response.write(header)
+      for frame in audio:
+        await response.write(frame)
 
       while True:
         next_audio_frame, audio = await service_controller.new_audio(next_audio_frame)
-        await response.write(audio)
+        for frame in audio:
+          await response.write(frame)
     except (asyncio.exceptions.CancelledError,
             asyncio.exceptions.TimeoutError,
             ConnectionResetError):
       # user cancelled the stream, so unsubscribe
-      self._radio_controller().unsubscribe_service(service)
+      self._radio_controller().unsubscribe_service(service, channel)
       return response
     except UnsubscribedError:
       return response
@@ -225,6 +335,34 @@ class DabServer():
     # Make sure above that this line remains unreachable
     raise web.HTTPInternalServerError()
 
+  # The native stream server sends the audio directly from the decoder buffers.
+  # All clients of a service share one subscription, which ends once the stream is idle.
+  async def _redirect_to_native_stream(self, request: web.Request, channel: str, service: str) -> web.StreamResponse:
+    assert self._stream_server
+    path = f'/{channel}/{urllib.parse.quote(service)}'
+    if path not in self._native_streams:
+      service_controller = await self._radio_controller().subscribe_service(channel, service)
+      if not service_controller:
+        raise web.HTTPServiceUnavailable()
+      service_controller.publish_stream(self._stream_server, path, self._audio_mimetype == 'wav',
+                                        preroll_ms = ServiceController.PREROLL_MS)
+      self._native_streams[path] = (channel, service)
+
+    location = request.url.with_port(self._native_stream_port).with_path(path, encoded=True).with_query(None)
+    raise web.HTTPTemporaryRedirect(location)
+
+  def _on_native_stream_idle(self, path: str) -> None:
+    if path not in self._native_streams:
+      return
+    channel, service = self._native_streams.pop(path)
+    logger.info('native stream of %s is idle', service)
+    if self._stream_server:
+      self._stream_server.remove_stream(path)
+    controller = self._radio_controller().get_service_controller(service)
+    if controller:
+      controller.unpublish_stream()
+    self._radio_controller().unsubscribe_service(service, channel)
+
   def webui(self, prefix: str) -> typing.Callable:
     async def get_webui(request: web.Request) -> web.FileResponse:
       return web.FileResponse(prefix + '/webui/index.htm')
@@ -0,0 +1,91 @@
+# Copyright (C) 2024 Lamarqe
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License
+# as published by the Free Software Foundation, version 3.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty
+# of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+
+"""Client of the control socket of the native dabd receiver daemon"""
+
+import asyncio
+import json
+import logging
+import typing
+
+logger = logging.getLogger(__name__)
+
+class DabdError(Exception):
+  """A command the daemon refused"""
+
+class DabdClient:
+  """Issues the line commands of dabd, see src/dabd/dabd.cpp, one at a time"""
+
+  def __init__(self, control_socket: str = '/run/dabd/control'):
+    self._path = control_socket
+    self._reader: typing.Optional[asyncio.StreamReader] = None
+    self._writer: typing.Optional[asyncio.StreamWriter] = None
+    self._lock = asyncio.Lock()
+
+  async def connect(self) -> None:
+    self._reader, self._writer = await asyncio.open_unix_connection(self._path)
+
+  async def close(self) -> None:
+    if self._writer:
+      self._writer.close()
+      await self._writer.wait_closed()
+      self._reader = self._writer = None
+
+  async def request(self, command: str) -> dict:
+    async with self._lock:
+      if not self._writer:
+        await self.connect()
+      self._writer.write(command.encode() + b'\n')
+      await self._writer.drain()
+      line = await self._reader.readline()
+    if not line:
+      await self.close()
+      raise ConnectionError('dabd closed the control connection')
+    response = json.loads(line)
+    if not response.pop('ok', False):
+      raise DabdError(response.get('error', command))
+    return response
+
+  async def scan(self) -> list[str]:
+    return (await self.request('scan'))['channels']
+
+  async def tune(self, channel: str) -> None:
+    await self.request('tune ' + channel)
+
+  async def stop(self) -> None:
+    await self.request('stop')
+
+  async def services(self) -> dict:
+    return await self.request('services')
+
+  async def subscribe(self, sid: int) -> str:
+    """Returns the HTTP path of the audio of the service"""
+    return (await self.request(f'subscribe {sid:x}'))['path']
+
+  async def unsubscribe(self, sid: int) -> None:
+    await self.request(f'unsubscribe {sid:x}')
+
+  async def label(self, sid: int) -> str:
+    return (await self.request(f'label {sid:x}'))['label']
+
+  async def stats(self) -> dict:
+    return await self.request('stats')
+
+  async def record(self, path: str) -> None:
+    """Records the raw samples of the device into the file on the dabd host"""
+    await self.request('record ' + path)
+
+  async def stop_recording(self) -> None:
+    await self.request('record stop')
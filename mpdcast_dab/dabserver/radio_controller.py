@@ -17,6 +17,7 @@
 import asyncio
 import logging
 import dataclasses
+import typing
 
 from .service_controller import ServiceController
 from .dab_callbacks import ChannelEventPass
@@ -24,7 +25,8 @@ from .welle_io import DabDevice, ChannelEventHandler
 
 logger = logging.getLogger(__name__)
 
-class RadioController(ChannelEventHandler, ChannelEventPass):
+class TunerController(ChannelEventHandler, ChannelEventPass):
+  """Manages the channel and the service subscriptions of a single DAB device"""
 
   @dataclasses.dataclass
   class Service:
@@ -36,67 +38,130 @@ class RadioController(ChannelEventHandler, ChannelEventPass):
     name:               str = ''
     ensemble_label:     str | None = None
 
+  @dataclasses.dataclass
+  class EnsembleData:
+    # services delivered as encoded AAC instead of PCM
+    passthrough:   set[str]            = dataclasses.field(default_factory=set)
+    service_tasks: list[asyncio.Task]  = dataclasses.field(default_factory=list)
+    stats_task:    asyncio.Task | None = None
+    subscribed:    set[int]            = dataclasses.field(default_factory=set)
+
   SERVICE_DISCOVERY_TIMEOUT = 10
   CHANNEL_RESET_DELAY       = 5
+  ENSEMBLE_STATS_INTERVAL   = 60
 
   def __init__(self, device: DabDevice) -> None:
     ChannelEventHandler.__init__(self)
     self._dab_device:         DabDevice                          = device
-    self._services:           dict[int, RadioController.Service] = {}
-    self._channel:            RadioController.ChannelData        = self.ChannelData()
+    self._services:           dict[int, TunerController.Service] = {}
+    self._channel:            TunerController.ChannelData        = self.ChannelData()
     self._channel_reset_task: asyncio.Task | None                = None
     # lock to prevent parallel initialization from concurrent requests
     self._subscription_lock:  asyncio.Lock                       = asyncio.Lock()
+    # set while all services of the channel are decoded
+    self._ensemble:           TunerController.EnsembleData | None = None
+    # set whenever the backend reports new service data
+    self._service_update:     asyncio.Event                      = asyncio.Event()
+
+  @property
+  def channel_name(self) -> str:
+    return self._channel.name
 
   async def on_service_detected(self, service_id: int) -> None:
     if not service_id in self._services:
       self._services[service_id] = self.Service()
+      if self._ensemble:
+        self._start_ensemble_subscription(service_id)
+    self._service_update.set()
 
   async def on_set_ensemble_label(self, label: str) -> None:
     self._channel.ensemble_label = label
 
+  async def on_service_label(self, service_id: int, label: str) -> None:
+    service = self._services.get(service_id)
+    if service:
+      service.name = label.rstrip()
+      self._service_update.set()
+
+  async def on_service_components_complete(self, service_id: int) -> None:
+    self._service_update.set()
+
+  async def on_ensemble_complete(self, ensemble_id: int) -> None:
+    logger.debug('ensemble %04x of channel %s is complete', ensemble_id, self._channel.name)
+    self._service_update.set()
+
+  @staticmethod
+  async def _device_call(future: asyncio.Future, on_cancel: typing.Callable[[typing.Any], None]) -> typing.Any:
+    # The device completes an operation even if the request gets cancelled meanwhile.
+    # Wait for it anyway, so on_cancel can roll back its result before the cancellation is passed on.
+    try:
+      return await asyncio.shield(future)
+    except asyncio.CancelledError:
+      while not future.done():
+        try:
+          await asyncio.wait([future])
+        except asyncio.CancelledError:
+          pass
+      if not future.exception():
+        on_cancel(future.result())
+      raise
+
+  async def _wait_for_service_update(self, ready: typing.Callable[[], bool]) -> bool:
+    # re-check whenever the backend reported new service data, until the timeout
+    loop = asyncio.get_running_loop()
+    deadline = loop.time() + TunerController.SERVICE_DISCOVERY_TIMEOUT
+    while not ready():
+      remaining = deadline - loop.time()
+      if remaining <= 0:
+        return False
+      self._service_update.clear()
+      try:
+        await asyncio.wait_for(self._service_update.wait(), remaining)
+      except asyncio.TimeoutError:
+        pass
+    return True
+
   def _fill_service_id(self, lookup_name: str) -> int | None:
+    # one snapshot for all services, instead of a native call per service
+    ensemble = None
     for service_id, service in self._services.items():
       if not service.name or len(service.name) == 0:
-        service.name = self._dab_device.get_service_name(service_id).rstrip()
+        if ensemble is None:
+          ensemble = self._dab_device.get_ensemble()
+        # None if the service was only preloaded and turned out to be outdated
+        details = ensemble.service(service_id) if ensemble else None
+        service.name = details.label.rstrip() if details else ''
       if service.name == lookup_name:
         return service_id
     # Not found
     return None
 
   async def _wait_for_channel(self, service_name: str) -> int | None:
-    # initial check, as we might already have an active subscription for the service
-    service_id = self._fill_service_id(service_name)
-    if service_id:
-      return service_id
-
-    # wait the defined time for the service discovery
-    # and check every 0.5 seconds if it was succesful
-    for _ in range(2 * RadioController.SERVICE_DISCOVERY_TIMEOUT):
-      await asyncio.sleep(0.5)
-      service_id = self._fill_service_id(service_name)
-      if service_id:
-        return service_id
-    # Not found
-    return None
+    # returns at once if there already is an active subscription for the service
+    await self._wait_for_service_update(lambda: self._fill_service_id(service_name) is not None)
+    return self._fill_service_id(service_name)
 
   # returns controller in case the subscription suceeded, otherwise None
   async def subscribe_service(self, channel: str, service_name: str) -> ServiceController | None:
     async with self._subscription_lock:
-      if not self._tune_channel(channel):
+      if not await self._tune_channel(channel):
         return None
       return await self._subscribe_for_service_in_current_channel(service_name)
 
-  def _tune_channel(self, channel: str) -> bool:
+  async def tune_channel(self, channel: str) -> bool:
+    async with self._subscription_lock:
+      return await self._tune_channel(channel)
+
+  async def _tune_channel(self, channel: str) -> bool:
     # first check, if there is a delayed channel reset pending
     if self._channel_reset_task:
-      # we have an active channel, check if we can reuse it
-      if self._channel.name != channel:
-        # no, we cant. reset channel immediately, so we can select a new one afterwards
-        self._reset_channel()
-      # we either reuse the channel or we resetted it. In both cases: Cancel the delayed reset
+      # we either reuse the channel or switch the idle receiver to the new one. In both cases: Cancel the delayed reset
       self._channel_reset_task.cancel()
       self._channel_reset_task = None
+      # we have an active channel, check if we can reuse it
+      if self._channel.name != channel:
+        # no, we cant. retune the receiver, which is much faster than setting up a new one
+        return await self._retune_channel(channel)
 
     # If there is a channel active, check if its the correct one
     if self._channel.name:
@@ -109,12 +174,21 @@ class RadioController(ChannelEventHandler, ChannelEventPass):
     if not self._dab_device.lock.acquire(blocking=False):
       logger.error('DAB device is locked. No playback possible.')
       return False
-    if not self._dab_device.set_channel(channel, self):
+    # the event loop keeps serving the other requests while the receiver is set up
+    tuned = await self._device_call(self._dab_device.set_channel_async(channel, self),
+                                    lambda tuned: self._channel_tuned(channel, tuned, True))
+    return self._channel_tuned(channel, tuned, False)
+
+  def _channel_tuned(self, channel: str, tuned: bool, cancelled: bool) -> bool:
+    if not tuned:
       logger.error("could not set the device channel.")
       self._dab_device.lock.release()
       return False
     # success!
     self._channel.name = channel
+    if cancelled:
+      # nobody is going to subscribe, reset it later unless another request takes the channel
+      self._cleanup_channel()
     return True
 
   async def _subscribe_for_service_in_current_channel(self, service_name: str) -> ServiceController | None:
@@ -143,16 +217,26 @@ class RadioController(ChannelEventHandler, ChannelEventPass):
       # First time subscription to the service. Set up the controller and register it.
       service_controller = ServiceController()
       self._services[service_id].controller = service_controller
-      if not self._dab_device.subscribe_service(service_controller, service_id):
+      subscribed = await self._device_call(self._dab_device.subscribe_service_async(service_controller, service_id),
+                                           lambda _: self._drop_subscription(service_id))
+      if not subscribed:
         self._cleanup_channel()
         logger.error('Subscription to selected service failed')
         return None
 
+    # a listener, even if the ensemble decoding subscribed the service first
+    self._dab_device.set_foreground(service_controller, True)
     # increase the counter of active subscriptions for the selected service
     service_controller.subscribers += 1
     logger.debug('subscribers: %d', service_controller.subscribers)
     return service_controller
 
+  def _drop_subscription(self, service_id: int) -> None:
+    # the request is gone before the subscription completed
+    self._services[service_id].controller = None
+    self._dab_device.unsubscribe_service(service_id)
+    self._cleanup_channel()
+
   def unsubscribe_service(self, service_name: str) -> None:
     for service_id, service in self._services.items():
       if service.name == service_name:
@@ -176,12 +260,18 @@ class RadioController(ChannelEventHandler, ChannelEventPass):
     logger.debug('subscribers: %d', service_controller.subscribers)
     if service_controller.subscribers == 0:
       self._dab_device.unsubscribe_service(service_id)
+      if self._dab_device.warm_standby:
+        # the subchannel keeps decoding in standby, stop it once that timed out
+        asyncio.get_running_loop().call_later(self._dab_device.warm_standby_timeout_s + 1,
+                                              self._dab_device.expire_standby)
       service_controller.release_waiters()
       self._services[service_id].controller = None
       self._cleanup_channel()
 
   def _cleanup_channel(self) -> None:
-    # only reset when there is no service subscription
+    # only reset when there is no service subscription and the ensemble is not decoded
+    if self._ensemble:
+      return
     for service in self._services.values():
       if service.controller:
         return
@@ -189,19 +279,35 @@ class RadioController(ChannelEventHandler, ChannelEventPass):
     self._channel_reset_task = asyncio.get_running_loop().create_task(self._reset_channel_later())
 
   async def _reset_channel_later(self) -> None:
-    await asyncio.sleep(RadioController.CHANNEL_RESET_DELAY)
-    # the reset job did not get cancelled. So do it now
-    self._reset_channel()
-    self._channel_reset_task = None
+    await asyncio.sleep(TunerController.CHANNEL_RESET_DELAY)
+    # the reset job did not get cancelled. So do it now, no tuning in between
+    async with self._subscription_lock:
+      self._channel_reset_task = None
+      assert not next((srv for srv in self._services.values() if srv.controller is not None), None)
+      await self._device_call(self._dab_device.reset_channel_async(), lambda _: self._channel_reset())
+      self._channel_reset()
+
+  async def _retune_channel(self, channel: str) -> bool:
+    assert not next((srv for srv in self._services.values() if srv.controller is not None), None)
+    self._services.clear()
+    self._channel = self.ChannelData()
+    # the device stays locked by this controller
+    tuned = await self._device_call(self._dab_device.retune_async(channel, self),
+                                    lambda tuned: self._channel_tuned(channel, tuned, True))
+    return self._channel_tuned(channel, tuned, False)
 
   def _reset_channel(self) -> None:
     assert not next((srv for srv in self._services.values() if srv.controller is not None), None)
     self._dab_device.reset_channel()
+    self._channel_reset()
+
+  def _channel_reset(self) -> None:
     self._channel.name = ''
     self._services.clear()
     self._dab_device.lock.release()
 
   def stop(self) -> None:
+    self.stop_ensemble()
     active_sids = list(self._services.keys())
     for service_id in active_sids:
       self._unsubscribe(service_id)
@@ -211,7 +317,156 @@ class RadioController(ChannelEventHandler, ChannelEventPass):
       self._channel_reset_task.cancel()
       self._channel_reset_task = None
 
+  # Decode every DAB+ service of the channel, including the ones the FIC announces later.
+  # The subchannels share the worker pool of the backend, so no thread per service is needed.
+  async def decode_ensemble(self, channel: str, passthrough: set[str] | None = None) -> bool:
+    async with self._subscription_lock:
+      if self._ensemble or not await self._tune_channel(channel):
+        return False
+      self._ensemble = self.EnsembleData(passthrough = passthrough or set())
+      for service_id in list(self._services.keys()):
+        self._start_ensemble_subscription(service_id)
+      self._ensemble.stats_task = asyncio.get_running_loop().create_task(self._log_ensemble_stats())
+      logger.info('decoding all services of channel %s', channel)
+      return True
+
+  def _is_audio_service(self, service_id: int) -> bool:
+    ensemble = self._dab_device.get_ensemble()
+    details = ensemble.service(service_id) if ensemble else None
+    return bool(details and details.is_audio)
+
+  def _start_ensemble_subscription(self, service_id: int) -> None:
+    assert self._ensemble
+    task = asyncio.get_running_loop().create_task(self._subscribe_ensemble_service(service_id))
+    self._ensemble.service_tasks.append(task)
+    task.add_done_callback(self._ensemble.service_tasks.remove)
+
+  async def _subscribe_ensemble_service(self, service_id: int) -> None:
+    # A service might be announced before its components. Wait until it turns out to be a DAB+ service
+    if not await self._wait_for_service_update(lambda: self._is_audio_service(service_id)):
+      return
+
+    ensemble = self._ensemble
+    service = self._services.get(service_id)
+    if not ensemble or not service:
+      return
+    if not service.name:
+      snapshot = self._dab_device.get_ensemble()
+      details = snapshot.service(service_id) if snapshot else None
+      service.name = details.label.rstrip() if details else ''
+
+    service_controller = service.controller
+    if not service_controller:
+      service_controller = ServiceController()
+      # nobody looks at the slides, they are given up first under load
+      service_controller.foreground = False
+      service.controller = service_controller
+      decode_audio = service.name not in ensemble.passthrough
+      if not self._dab_device.subscribe_service(service_controller, service_id, decode_audio = decode_audio):
+        service.controller = None
+        logger.error('Ensemble subscription to service %s failed', service.name)
+        return
+    # the ensemble holds one subscription of its own
+    service_controller.subscribers += 1
+    ensemble.subscribed.add(service_id)
+    logger.debug('ensemble: decoding %s', service.name)
+
+  async def _log_ensemble_stats(self) -> None:
+    last_bytes = self._dab_device.get_decoded_bytes()
+    while True:
+      await asyncio.sleep(TunerController.ENSEMBLE_STATS_INTERVAL)
+      decoded_bytes = self._dab_device.get_decoded_bytes()
+      kbits = (decoded_bytes - last_bytes) * 8 / 1000 / TunerController.ENSEMBLE_STATS_INTERVAL
+      last_bytes = decoded_bytes
+      services = len(self._ensemble.subscribed) if self._ensemble else 0
+      logger.info('ensemble %s: %d services, %.1f kbit/s decoded', self._channel.name, services, kbits)
+
+  def stop_ensemble(self) -> None:
+    ensemble = self._ensemble
+    if not ensemble:
+      return
+    self._ensemble = None
+    for task in list(ensemble.service_tasks):
+      task.cancel()
+    if ensemble.stats_task:
+      ensemble.stats_task.cancel()
+    for service_id in ensemble.subscribed:
+      self._unsubscribe(service_id)
+    # in case no service was found at all
+    if not self._channel_reset_task and not ensemble.subscribed:
+      self._cleanup_channel()
+
   def can_subscribe(self, new_channel: str) -> bool:
     return ((not self._channel.name) or            # either there is no active channel
             (self._channel.name == new_channel) or # OR target and current channel are the same
             bool(self._channel_reset_task))            # OR a delayed reset is pending
+
+
+class RadioController():
+  """Distributes the subscriptions over a pool of DAB devices, one channel per device"""
+
+  def __init__(self, devices: list[DabDevice]) -> None:
+    self._tuners:    list[TunerController] = [TunerController(device) for device in devices]
+    # lock to prevent concurrent requests from picking the same idle device
+    self._pool_lock: asyncio.Lock          = asyncio.Lock()
+
+  def _candidate_tuners(self, channel: str) -> list[TunerController]:
+    # prefer a device which already receives the channel
+    for tuner in self._tuners:
+      if tuner.channel_name == channel:
+        return [tuner]
+    # then the idle devices
+    candidates = [tuner for tuner in self._tuners if not tuner.channel_name]
+    # finally the devices which are only waiting for their delayed reset
+    candidates += [tuner for tuner in self._tuners if tuner.channel_name and tuner.can_subscribe(channel)]
+    return candidates
+
+  # returns controller in case the subscription suceeded, otherwise None
+  async def subscribe_service(self, channel: str, service_name: str) -> ServiceController | None:
+    async with self._pool_lock:
+      candidates = self._candidate_tuners(channel)
+      if not candidates:
+        logger.warning('all DAB devices are busy with other channels')
+        return None
+      # tune while holding the pool lock, so the device is taken for the channel.
+      # A channel of a wideband device can only tune close to its sibling channels,
+      # so try the next device if it fails
+      tuner = await self._tune_first(candidates, channel)
+      if not tuner:
+        return None
+    return await tuner.subscribe_service(channel, service_name)
+
+  @staticmethod
+  async def _tune_first(candidates: list[TunerController], channel: str) -> TunerController | None:
+    for tuner in candidates:
+      if await tuner.tune_channel(channel):
+        return tuner
+    return None
+
+  async def decode_ensemble(self, channel: str, passthrough: set[str] | None = None) -> bool:
+    async with self._pool_lock:
+      candidates = self._candidate_tuners(channel)
+      tuner = await self._tune_first(candidates, channel)
+      if not tuner:
+        logger.warning('no DAB device available to decode channel %s', channel)
+        return False
+    return await tuner.decode_ensemble(channel, passthrough)
+
+  def unsubscribe_service(self, service_name: str, channel: str | None = None) -> None:
+    for tuner in self._tuners:
+      if channel is None or tuner.channel_name == channel:
+        tuner.unsubscribe_service(service_name)
+
+  def get_service_controller(self, service_name: str) -> ServiceController | None:
+    for tuner in self._tuners:
+      controller = tuner.get_service_controller(service_name)
+      if controller:
+        return controller
+    return None
+
+  def stop(self) -> None:
+    for tuner in self._tuners:
+      tuner.stop()
+
+  def can_subscribe(self, new_channel: str) -> bool:
+    return any(tuner.can_subscribe(new_channel) for tuner in self._tuners)
@@ -24,7 +24,8 @@ from .welle_io import ServiceEventHandler
 
 logger = logging.getLogger(__name__)
 
-Picture = typing.TypedDict('Picture', {'type': str, 'data': bytes, 'name': str})
+# id is the content hash, the same slide always has the same id
+Picture = typing.TypedDict('Picture', {'type': str, 'data': memoryview, 'name': str, 'id': str})
 
 class UnsubscribedError(Exception):
   pass
@@ -40,6 +41,11 @@ class ServiceData():
     self.mode:        str     = ''
 
 class ServiceController(ServiceEventHandler, ServiceEventPass):
+  # the decoder delivers the audio in chunks of this duration instead of single frames
+  AUDIO_CHUNK_MS = 100
+  # recent audio sent at once to new listeners of a running service
+  PREROLL_MS     = 2000
+
   @dataclasses.dataclass
   class ServiceEvents():
     def __init__(self) -> None:
@@ -50,14 +56,16 @@ class ServiceController(ServiceEventHandler, ServiceEventPass):
 
   @dataclasses.dataclass
   class AudioBuffer():
-    BUFFER_SIZE = 10
+    BUFFER_SIZE = 20
     def __init__(self) -> None:
       self.next_frame  = 0
-      self.data        = [b''] * ServiceController.AudioBuffer.BUFFER_SIZE
+      # memoryviews of the native buffers, which are recycled once released here
+      self.data        = [memoryview(b'')] * ServiceController.AudioBuffer.BUFFER_SIZE
       self.data_lock   = asyncio.Lock()
 
   def __init__(self) -> None:
     ServiceEventHandler.__init__(self)
+    self.audio_chunk_ms      = ServiceController.AUDIO_CHUNK_MS
     self.subscribers         = 0
     self.data                = ServiceData()
     self._audio_buffer       = self.AudioBuffer()
@@ -65,7 +73,7 @@ class ServiceController(ServiceEventHandler, ServiceEventPass):
     self._delete_in_progress = False
 
   # notification routines for user applications
-  async def new_audio(self, start_frame: int =0) -> typing.Tuple[int, bytes]:
+  async def new_audio(self, start_frame: int =0) -> typing.Tuple[int, list[memoryview]]:
     if start_frame == self._audio_buffer.next_frame:
       await self._events.audio.wait()
       if self._delete_in_progress:
@@ -75,8 +83,19 @@ class ServiceController(ServiceEventHandler, ServiceEventPass):
         ret_list = self._audio_buffer.data[start_frame:self._audio_buffer.next_frame]
       else:
         ret_list = self._audio_buffer.data[start_frame:] + self._audio_buffer.data[:self._audio_buffer.next_frame]
-      audio_out = b''.join(ret_list)
-      return self._audio_buffer.next_frame, audio_out
+      # the frames are handed out as they are, without joining them into a copy
+      return self._audio_buffer.next_frame, ret_list
+
+  # the buffered audio, oldest first. Waits for the first audio of a new subscription
+  async def recent_audio(self) -> typing.Tuple[int, list[memoryview]]:
+    async with self._audio_buffer.data_lock:
+      next_frame = self._audio_buffer.next_frame
+      frames = self._audio_buffer.data[next_frame:] + self._audio_buffer.data[:next_frame]
+    preroll_frames = max(1, ServiceController.PREROLL_MS // ServiceController.AUDIO_CHUNK_MS)
+    frames = [frame for frame in frames if frame.nbytes][-preroll_frames:]
+    if frames:
+      return next_frame, frames
+    return await self.new_audio(next_frame)
 
   async def new_picture(self) -> Picture:
     logger.debug('waiting for new picture')
@@ -100,7 +119,7 @@ class ServiceController(ServiceEventHandler, ServiceEventPass):
     self._events.picture.set()
     self._events.label.set()
 
-  async def on_new_audio(self, audio_data: bytes, sample_rate: int, mode: str) -> None:
+  async def on_new_audio(self, audio_data: memoryview, sample_rate: int, mode: str) -> None:
     self.data.sample_rate = sample_rate
     self.data.mode = mode
     async with self._audio_buffer.data_lock:
@@ -116,8 +135,9 @@ class ServiceController(ServiceEventHandler, ServiceEventPass):
       self._events.label.set()
       self._events.label.clear()
 
-  async def on_mot(self, data: bytes, mime_type: str, name: str) -> None:
-    self.data.picture = {'type': mime_type, 'data': data, 'name': name}
+  # only called for a slide other than the current one
+  async def on_mot(self, data: memoryview, mime_type: str, name: str, slide_id: str) -> None:
+    self.data.picture = {'type': mime_type, 'data': data, 'name': name, 'id': slide_id}
     if not self._delete_in_progress:
       self._events.picture.set()
       self._events.picture.clear()
@@ -0,0 +1,169 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "channel-probe.h"
+#include "various/fft.h"
+
+ChannelProbe::ChannelProbe(InputInterface& input, const DABParams& params) :
+    input(input),
+    params(params)
+{
+    // Leave a margin for the ramps at both ends of the null symbol
+    nullBlocks = std::max(params.T_null / blockSize - 4, 1);
+    blockEnergy.resize(nullBlocks);
+}
+
+bool ChannelProbe::readBlocks(std::vector<DSPCOMPLEX>& buffer,
+        std::chrono::steady_clock::time_point deadline)
+{
+    const int32_t wanted = buffer.size();
+    int32_t available = input.getSamplesToRead();
+    while (available < wanted) {
+        if (not input.is_ok() or std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        available = input.waitForSamples(wanted, std::chrono::milliseconds(20));
+    }
+
+    return input.getSamples(buffer.data(), wanted) == wanted;
+}
+
+bool ChannelProbe::signalPresent(std::chrono::milliseconds timeout)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    std::vector<DSPCOMPLEX> buffer(settleSamples);
+    if (not readBlocks(buffer, deadline)) {
+        return false;
+    }
+
+    // The mean is only trusted after a few null symbol lengths
+    const int32_t minBlocks = 4 * nullBlocks;
+    // After that, a frame plus a null symbol always holds a complete
+    // null symbol
+    const int32_t totalBlocks = minBlocks + (params.T_F + params.T_null) / blockSize;
+
+    buffer.resize(blockSize * 16);
+    double energySum = 0;
+    float windowSum = 0;
+    int32_t blocks = 0;
+
+    while (blocks < totalBlocks) {
+        if (not readBlocks(buffer, deadline)) {
+            return false;
+        }
+
+        for (size_t b = 0; b < buffer.size(); b += blockSize) {
+            float energy = 0;
+            for (int32_t i = 0; i < blockSize; i++) {
+                energy += norm(buffer[b + i]);
+            }
+
+            const int32_t slot = blocks % nullBlocks;
+            windowSum += energy - blockEnergy[slot];
+            blockEnergy[slot] = energy;
+            energySum += energy;
+            blocks++;
+
+            if (blocks >= minBlocks and
+                    windowSum < nullDepth * nullBlocks * (energySum / blocks)) {
+                std::clog << "ChannelProbe: null symbol found after " <<
+                    blocks * blockSize * 1000 / INPUT_RATE << " ms" << std::endl;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool ChannelProbe::measureSpectrum(SpectrumOccupancy& result, std::chrono::milliseconds timeout)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    std::vector<DSPCOMPLEX> buffer(settleSamples);
+    if (not readBlocks(buffer, deadline)) {
+        return false;
+    }
+
+    const int32_t size = params.T_u;
+    buffer.resize(size);
+    fft::Forward fft(size);
+    DSPCOMPLEX *spectrum = fft.getVector();
+
+    std::vector<float> window(size);
+    for (int32_t i = 0; i < size; i++) {
+        window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / size);
+    }
+
+    std::vector<float> power(size, 0);
+    for (int32_t n = 0; n < spectrumAverages; n++) {
+        if (not readBlocks(buffer, deadline)) {
+            return false;
+        }
+        for (int32_t i = 0; i < size; i++) {
+            spectrum[i] = buffer[i] * window[i];
+        }
+        fft.do_FFT();
+        for (int32_t i = 0; i < size; i++) {
+            power[i] += norm(spectrum[i]);
+        }
+    }
+
+    // Both sides of the carrier, bin k is k * INPUT_RATE / size Hz off it
+    const float binKHz = (float)INPUT_RATE / size / 1000;
+    auto bandPower = [&](int32_t fromKHz, int32_t toKHz, int32_t& bins) {
+        double sum = 0;
+        bins = 0;
+        for (int32_t k = ceilf(fromKHz / binKHz); k * binKHz <= toKHz and k < size / 2; k++) {
+            sum += power[k] + power[size - k];
+            bins += 2;
+        }
+        return sum;
+    };
+
+    int32_t inBins, edgeBins;
+    const double inBand = bandPower(inBandFromKHz, inBandToKHz, inBins);
+    const double edge = bandPower(edgeFromKHz, edgeToKHz, edgeBins);
+    const float floor = 1e-20f;
+    result.inBandDb = 10 * log10f(std::max<float>(inBand / inBins, floor));
+    result.edgeDb = 10 * log10f(std::max<float>(edge / edgeBins, floor));
+
+    // Over sub-bands, single bins scatter too much even when averaged
+    double logSum = 0, sum = 0;
+    const int32_t bandKHz = (inBandToKHz - inBandFromKHz) / flatnessBands;
+    for (int32_t b = 0; b < flatnessBands; b++) {
+        int32_t bins;
+        const double p = std::max<double>(
+                bandPower(inBandFromKHz + b * bandKHz, inBandFromKHz + (b + 1) * bandKHz, bins) / bins, floor);
+        logSum += log(p);
+        sum += p;
+    }
+    result.flatness = exp(logSum / flatnessBands) / (sum / flatnessBands);
+    return true;
+}
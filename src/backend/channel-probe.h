@@ -0,0 +1,101 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CHANNEL_PROBE_H
+#define CHANNEL_PROBE_H
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "dab-constants.h"
+#include "radio-controller.h"
+
+/* Quick check for the presence of a DAB signal on the tuned channel,
+ * used by band scans before a full RadioReceiver is set up.
+ *
+ * Every DAB frame starts with a null symbol, during which the transmitter
+ * is (almost) silent. The probe looks for a dip of the signal envelope
+ * that lasts as long as a null symbol. Stationary noise never shows such
+ * a dip, so an empty channel is rejected after one frame duration and a
+ * channel carrying DAB is accepted as soon as its null symbol was seen.
+ *
+ * measureSpectrum() is the cheaper pre-scan: a DAB block fills 1.536 MHz
+ * of the 2.048 MHz capture with a flat top and steep edges, noise and
+ * narrowband carriers do not. It only needs a few milliseconds of
+ * samples, so a whole band is ranked in the time the null symbol search
+ * takes for a few channels.
+ */
+struct SpectrumOccupancy {
+    // Mean power inside the block and in the gaps next to it, in dB
+    float inBandDb = 0;
+    float edgeDb = 0;
+    // Geometric over arithmetic mean of the in-band power, about 1 for
+    // the OFDM block or white noise, far less for a few carriers
+    float flatness = 0;
+};
+
+class ChannelProbe
+{
+    public:
+        ChannelProbe(InputInterface& input, const DABParams& params);
+        ChannelProbe(const ChannelProbe&) = delete;
+        ChannelProbe& operator=(const ChannelProbe&) = delete;
+
+        /* The input has to be tuned and started already. Returns true if
+         * a null symbol was found, false if none was found within one
+         * frame, or if the input did not deliver samples within timeout. */
+        bool signalPresent(std::chrono::milliseconds timeout);
+
+        /* The input has to be tuned and started already. Returns false
+         * if the input did not deliver the samples within timeout. */
+        bool measureSpectrum(SpectrumOccupancy& result, std::chrono::milliseconds timeout);
+
+    private:
+        // Samples skipped to let the tuner and its AGC settle
+        static const int32_t settleSamples = INPUT_RATE / 100;
+        static const int32_t blockSize = 64;
+        // The envelope has to drop below this fraction of its mean
+        static constexpr float nullDepth = 0.5;
+        // Transforms averaged for the spectrum, and its bands in kHz
+        static const int32_t spectrumAverages = 16;
+        static const int32_t inBandFromKHz = 16;   // clear of the DC spur
+        static const int32_t inBandToKHz = 720;
+        static const int32_t edgeFromKHz = 800;
+        static const int32_t edgeToKHz = 920;      // below the next block
+        // Sub-bands for the flatness, each of them on both sides
+        static const int32_t flatnessBands = 16;
+
+        bool readBlocks(std::vector<DSPCOMPLEX>& buffer,
+                std::chrono::steady_clock::time_point deadline);
+
+        InputInterface& input;
+        const DABParams& params;
+
+        // Energy of the last nullBlocks blocks
+        std::vector<float> blockEnergy;
+        int32_t nullBlocks;
+};
+
+#endif // CHANNEL_PROBE_H
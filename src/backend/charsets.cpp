@@ -23,6 +23,7 @@
  */
 #include "charsets.h"
 #include <cstdint>
+#include <cstring>
 #include <locale>
 #include <codecvt>
 /**
@@ -96,6 +97,72 @@ int main(){
 
 #endif
 
+/**
+ * The same table as UTF-8 fragments, so that EBU Latin strings
+ * are converted by plain byte copies.
+ */
+struct Utf8Fragment {
+    char bytes[3];
+    uint8_t len;
+};
+
+static const struct EbuLatinToUtf8 {
+    Utf8Fragment table[256];
+    // Characters mapping to themselves, the ASCII fast path
+    bool identity[256];
+
+    EbuLatinToUtf8()
+    {
+        for (int i = 0; i < 256; i++) {
+            // All code points of the table are in the BMP
+            const unsigned short c = ebuLatinToUcs2[i];
+            Utf8Fragment& f = table[i];
+            if (c < 0x80) {
+                f.bytes[0] = (char)c;
+                f.len = 1;
+            }
+            else if (c < 0x800) {
+                f.bytes[0] = (char)(0xC0 | (c >> 6));
+                f.bytes[1] = (char)(0x80 | (c & 0x3F));
+                f.len = 2;
+            }
+            else {
+                f.bytes[0] = (char)(0xE0 | (c >> 12));
+                f.bytes[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+                f.bytes[2] = (char)(0x80 | (c & 0x3F));
+                f.len = 3;
+            }
+            identity[i] = (c == i);
+        }
+    }
+} ebuLatinToUtf8;
+
+static std::string ebuLatinToUtf8String(const uint8_t* buf, size_t num_bytes)
+{
+    std::string s;
+    s.reserve(num_bytes);
+
+    size_t i = 0;
+    while (i < num_bytes) {
+        // Copy runs of ASCII characters at once
+        size_t run = i;
+        while (run < num_bytes and ebuLatinToUtf8.identity[buf[run]]) {
+            run++;
+        }
+        if (run > i) {
+            s.append(reinterpret_cast<const char*>(buf + i), run - i);
+            i = run;
+            continue;
+        }
+
+        const Utf8Fragment& f = ebuLatinToUtf8.table[buf[i]];
+        s.append(f.bytes, f.len);
+        i++;
+    }
+
+    return s;
+}
+
 std::string toUtf8StringUsingCharset(const void* buffer,
         CharacterSet charset, size_t num_bytes)
 {
@@ -139,24 +206,13 @@ std::string toUtf8StringUsingCharset(const void* buffer,
         case CharacterSet::EbuLatin:
         default:
             {
-                std::u16string s;
                 const uint8_t* buf = reinterpret_cast<const uint8_t*>(buffer);
 
-                std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> utf8conv;
-
                 if (num_bytes == 0) {
-                    while (*buf) {
-                        s += ebuLatinToUcs2[*buf];
-                        buf++;
-                    }
-                }
-                else {
-                    for (size_t i = 0; i < num_bytes; i++) {
-                        s += ebuLatinToUcs2[buf[i]];
-                    }
+                    num_bytes = strlen(reinterpret_cast<const char*>(buf));
                 }
 
-                return utf8conv.to_bytes(s);
+                return ebuLatinToUtf8String(buf, num_bytes);
             }
     }
 }
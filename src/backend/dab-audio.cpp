@@ -22,18 +22,20 @@
  *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <algorithm>
 #include <iostream>
+#include <thread>
 #include <vector>
 #include "dab-constants.h"
 #include "dab-audio.h"
 #include "decoder_adapter.h"
 #include "eep-protection.h"
 #include "uep-protection.h"
+#include "softbit-packing.h"
 #include "profiling.h"
 
-//  As an experiment a version of the backend is created
-//  that will be running in a separate thread. Might be
-//  useful for multicore processors.
+//  The subchannels are decoded on the threads of the shared
+//  WorkerPool, one task per subchannel.
 //
 //  Interleaving is - for reasons of simplicity - done
 //  inline rather than through a special class-object
@@ -42,6 +44,20 @@
 //       15, 7, 11, 3, 13, 5, 9, 1, 14, 6, 10, 2, 12, 4, 8, 0};
 //
 //
+//  Room for the CIFs queued while the subchannel waits for a worker,
+//  16 by default, and the one the worker is reading.
+//  The 2 MB of the largest ring are only needed for the largest
+//  subchannels, when decoding a whole ensemble they add up.
+static uint32_t ringBufferSize(int16_t fragmentSize, int16_t queuedFragments)
+{
+    const uint32_t fragments = std::max<int16_t>(queuedFragments, 1) + 1;
+    uint32_t size = 1;
+    while (size < fragments * fragmentSize) {
+        size *= 2;
+    }
+    return size;
+}
+
 //  fragmentsize == Length * CUSize
 DabAudio::DabAudio(
         AudioServiceComponentType dabModus,
@@ -50,18 +66,28 @@ DabAudio::DabAudio(
         ProtectionSettings protection,
         ProgrammeHandlerInterface& phi,
         const std::string& dumpFileName,
-        bool decodeAudio) :
+        bool decodeAudio,
+        OverflowPolicy overflow,
+        DecoderCounters& counters,
+        bool packSoftbits) :
     myProgrammeHandler(phi),
-    mscBuffer(64 * 32768),
+    packed(packSoftbits),
+    fragmentBytes(packSoftbits ? packedsoftbits::bytes(fragmentSize) : fragmentSize),
+    overflow(overflow),
+    tapLogicalFrames(phi.wantsLogicalFrames()),
+    counters(counters),
+    workerPool(WorkerPool::shared()),
+    mscBuffer(ringBufferSize(fragmentBytes, overflow.queuedFragments)),
     dumpFileName(dumpFileName)
 {
     this->dabModus         = dabModus;
     this->fragmentSize     = fragmentSize;
     this->bitRate          = bitRate;
 
-    outV.resize(bitRate * 24);
-    for (int i = 0; i < 16; i ++) {
-        interleaveData[i].resize(fragmentSize);
+    outV.resize(bitRate * 24 / 8);
+    interleaveData.resize(16 * fragmentBytes);
+    if (packed) {
+        packBuffer.resize(fragmentBytes);
     }
 
     using std::make_unique;
@@ -80,87 +106,291 @@ DabAudio::DabAudio(
             myProgrammeHandler, bitRate, dabModus, dumpFileName, decodeAudio);
 
     running = true;
-    ourThread = std::thread(&DabAudio::run, this);
 }
 
 DabAudio::~DabAudio()
 {
     running = false;
+    workerPool.cancel(*this);
+}
 
-    if (ourThread.joinable()) {
-        mscDataAvailable.notify_all();
-        ourThread.join();
+//  Called from the OFDM decoder thread. Unless the policy says so,
+//  a decoder that cannot keep up never delays the demodulation of the
+//  other subchannels, its CIFs are dropped instead.
+int32_t DabAudio::process(const softbit_t *v, int16_t cnt, const LatencyStamp& stamp)
+{
+    if (not packed) {
+        return enqueue(v, cnt, fragmentSize, stamp);
     }
+
+    packedsoftbits::pack(v, cnt, packBuffer.data());
+    const int16_t bytes = packedsoftbits::bytes(cnt);
+    return enqueue(reinterpret_cast<const softbit_t*>(packBuffer.data()), bytes, fragmentBytes, stamp) ? cnt : 0;
 }
 
-int32_t DabAudio::process(const softbit_t *v, int16_t cnt)
+//  Called from the thread reading the ETI. The frames take the place
+//  of the CIFs in the mscBuffer, they are much smaller.
+int32_t DabAudio::processFrame(const uint8_t *frame, int16_t len)
 {
-    int32_t fr;
+    if (len != (int16_t)outV.size()) {
+        return 0;
+    }
+    frameInput = true;
+    return enqueue(reinterpret_cast<const softbit_t*>(frame), len, len, LatencyStamp());
+}
 
-    if (mscBuffer.GetRingBufferWriteAvailable () < cnt)
-        fprintf (stderr, "dab-concurrent: buffer full\n");
+int32_t DabAudio::enqueue(const softbit_t *v, int16_t cnt, int16_t unit, const LatencyStamp& stamp)
+{
+    using namespace std::chrono;
+
+    if (mscBuffer.GetRingBufferWriteAvailable() < cnt) {
+        switch (overflow.mode) {
+            case OverflowPolicy::Mode::DropOldest:
+                // The worker holds the fragment in front of the skipped
+                // ones only until it is scattered into the rows
+                mscBuffer.makeRoom(cnt, unit, overflow.blockTimeout, [this] {
+                    {
+                        std::lock_guard<std::mutex> lock(stampMutex);
+                        if (not fragmentStamps.empty()) fragmentStamps.pop_front();
+                    }
+#if defined(WITH_PROFILING)
+                    {
+                        std::lock_guard<std::mutex> lock(flowMutex);
+                        if (not fragmentFlows.empty()) fragmentFlows.pop_front();
+                    }
+#endif
+                    dropFragment();
+                });
+                break;
+            case OverflowPolicy::Mode::Block:
+                {
+                    const auto deadline = steady_clock::now() + overflow.blockTimeout;
+                    while (running and
+                            mscBuffer.GetRingBufferWriteAvailable() < cnt and
+                            steady_clock::now() < deadline) {
+                        std::this_thread::sleep_for(microseconds(100));
+                    }
+                }
+                break;
+            case OverflowPolicy::Mode::DropNewest:
+                break;
+        }
 
-    while ((fr = mscBuffer.GetRingBufferWriteAvailable ()) <= cnt) {
-        if (!running)
+        if (mscBuffer.GetRingBufferWriteAvailable() < cnt) {
+            dropFragment();
             return 0;
-        std::this_thread::sleep_for(std::chrono::microseconds(1));
+        }
+    }
+    else {
+        overflowing = false;
     }
 
+    {
+        // Queued first, the worker may take the fragment right away
+        std::lock_guard<std::mutex> lock(stampMutex);
+        fragmentStamps.push_back(stamp);
+    }
+#if defined(WITH_PROFILING)
+    {
+        std::lock_guard<std::mutex> lock(flowMutex);
+        fragmentFlows.push_back(get_profiler().next_flow_id());
+        PROFILE_FLOW_BEGIN(CIF, fragmentFlows.back());
+    }
+#endif
     mscBuffer.putDataIntoBuffer(v, cnt);
-    mscDataAvailable.notify_all();
-    return fr;
+    const int32_t fill = mscBuffer.GetRingBufferReadAvailable();
+    if (fill > maxBufferFill.load(std::memory_order_relaxed)) {
+        maxBufferFill.store(fill, std::memory_order_relaxed);
+    }
+    workerPool.schedule(*this);
+    return cnt;
+}
+
+void DabAudio::dropFragment()
+{
+    if (not overflowing) {
+        std::clog << "DabAudio: decoder overrun, dropping CIFs" << std::endl;
+        overflowing = true;
+    }
+    droppedFragments++;
+    counters.droppedFragments++;
+    resync = true;
+}
+
+uint64_t DabAudio::getDroppedFragments() const
+{
+    return droppedFragments;
+}
+
+void DabAudio::getBufferStats(SubchannelStats& stats)
+{
+    stats.bufferFill = mscBuffer.GetRingBufferReadAvailable();
+    stats.bufferSize = mscBuffer.GetBufferSize();
+    stats.maxBufferFill = maxBufferFill.load(std::memory_order_relaxed);
+    stats.droppedFragments = droppedFragments;
+    stats.memoryBytes = getMemoryBytes();
+}
+
+size_t DabAudio::getMemoryBytes() const
+{
+    return mscBuffer.GetBufferSize() * sizeof(softbit_t) +
+        interleaveData.size() * sizeof(softbit_t) +
+        outV.size();
+}
+
+void DabAudio::setStandby(bool standby)
+{
+    if (our_dabProcessor) {
+        our_dabProcessor->setStandby(standby);
+    }
+}
+
+void DabAudio::setSlideshow(bool enabled)
+{
+    if (our_dabProcessor) {
+        our_dabProcessor->setSlideshow(enabled);
+    }
 }
 
 const int16_t interleaveMap[] = {0,8,4,12,2,10,6,14,1,9,5,13,3,11,7,15};
 
-void DabAudio::run()
+//  Softbit i of a fragment is delayed by 16 - interleaveMap[i & 017]
+//  CIFs. Instead of gathering the logical frame from the 16 last
+//  fragments, every fragment is scattered into the rows of the frames
+//  it contributes to when it comes in. The row of the current CIF is
+//  then complete, and is deconvolved where it is, before the current
+//  fragment overwrites it with the softbits delayed by 16 CIFs.
+//
+//  Runs on a worker of the pool, until all complete fragments in the
+//  mscBuffer are consumed. The fragments are claimed, as process()
+//  may discard the oldest ones at the same time, and released once
+//  they are scattered into the de-interleaver.
+void DabAudio::runTask()
 {
-    int16_t i;
-    int16_t countforInterleaver = 0;
-    int16_t interleaverIndex    = 0;
-    std::vector<softbit_t> data(fragmentSize);
-    std::vector<softbit_t> tempX(fragmentSize);
+    int32_t rowOffset[16];
 
     while (running) {
-        std::unique_lock<std::mutex> lock(ourMutex);
-        while (running && mscBuffer.GetRingBufferReadAvailable() <= fragmentSize) {
-            mscDataAvailable.wait(lock);
+        PROFILE(DAGetMSCData);
+        if (resync.exchange(false)) {
+            countforInterleaver = 0;
         }
-        if (!running)
+
+        const bool framesQueued = frameInput;
+        const auto fragment = mscBuffer.claimRead(framesQueued ? outV.size() : fragmentBytes);
+        if (fragment.size() == 0) {
             break;
+        }
+        LatencyStamp stamp;
+        {
+            std::lock_guard<std::mutex> lock(stampMutex);
+            if (not fragmentStamps.empty()) {
+                stamp = fragmentStamps.front();
+                fragmentStamps.pop_front();
+            }
+        }
+#if defined(WITH_PROFILING)
+        {
+            std::lock_guard<std::mutex> lock(flowMutex);
+            if (not fragmentFlows.empty()) {
+                PROFILE_FLOW_END(CIF, fragmentFlows.front());
+                fragmentFlows.pop_front();
+            }
+        }
+#endif
 
-        // mscBuffer is threadsafe to access, no need to keep the lock
-        lock.unlock();
+        if (framesQueued) {
+            std::copy(fragment.data1, fragment.data1 + fragment.size1, outV.begin());
+            std::copy(fragment.data2, fragment.data2 + (fragment.size() - fragment.size1),
+                    outV.begin() + fragment.size1);
+            mscBuffer.releaseRead();
+            decodeFrame(stamp);
+            continue;
+        }
 
-        PROFILE(DAGetMSCData);
-        mscBuffer.getDataFromBuffer(data.data(), fragmentSize);
+        //  only deconvolve when de-interleaver is filled
+        const bool frameComplete = countforInterleaver > 15;
+        if (frameComplete) {
+            PROFILE(DADeconvolve);
+            if (packed) {
+                protectionHandler->deconvolvePacked(
+                        reinterpret_cast<const uint8_t*>(&interleaveData[interleaverIndex * fragmentBytes]),
+                        fragmentSize, outV.data());
+            }
+            else {
+                protectionHandler->deconvolve(
+                        &interleaveData[interleaverIndex * fragmentSize],
+                        fragmentSize, outV.data());
+            }
+        }
+        else {
+            countforInterleaver ++;
+        }
 
         PROFILE(DADeinterleave);
-        for (i = 0; i < fragmentSize; i ++) {
-            tempX[i] = interleaveData[(interleaverIndex +
-                    interleaveMap[i & 017]) & 017][i];
-            interleaveData[interleaverIndex][i] = data[i];
+        for (int16_t j = 0; j < 16; j ++) {
+            rowOffset[j] = ((interleaverIndex - interleaveMap[j]) & 017) * fragmentBytes;
         }
+
+        // The newest fragment goes straight from the ring into the rows
+        softbit_t *rows = interleaveData.data();
+        if (packed) {
+            scatterPacked(fragment, reinterpret_cast<uint8_t*>(rows), rowOffset);
+        }
+        else {
+            for (int32_t i = 0; i < fragment.size1; i ++) {
+                rows[rowOffset[i & 017] + i] = fragment.data1[i];
+            }
+            for (int32_t i = fragment.size1; i < fragment.size(); i ++) {
+                rows[rowOffset[i & 017] + i] = fragment.data2[i - fragment.size1];
+            }
+        }
+        mscBuffer.releaseRead();
         interleaverIndex = (interleaverIndex + 1) & 0x0F;
+        // The frame deconvolved above was completed by the previous fragment
+        const LatencyStamp frameStamp = interleavedStamp;
+        interleavedStamp = stamp;
 
-        //  only continue when de-interleaver is filled
-        if (countforInterleaver <= 15) {
-            countforInterleaver ++;
+        if (not frameComplete) {
             continue;
         }
 
-        PROFILE(DADeconvolve);
-        protectionHandler->deconvolve(tempX.data(), fragmentSize, outV.data());
-
         PROFILE(DADispersal);
         // and the inline energy dispersal
         energyDispersal.dedisperse(outV);
+        decodeFrame(frameStamp);
+    }
+}
 
-        if (our_dabProcessor) {
-            PROFILE(DADecode);
-            our_dabProcessor->addtoFrame(outV.data());
-        }
-        PROFILE(DADone);
+//  As the scatter of runTask, for packed softbits. Softbit i stays in
+//  byte i / 2 of its row, the two of a byte go to different rows.
+void DabAudio::scatterPacked(const RingBufferSpans<softbit_t>& fragment,
+        uint8_t *rows, const int32_t *rowOffset) const
+{
+    for (int32_t j = 0; j < fragment.size(); j ++) {
+        const uint8_t pair = (uint8_t)fragment[j];
+        uint8_t *low = rows + rowOffset[(2 * j) & 017] + j;
+        uint8_t *high = rows + rowOffset[(2 * j + 1) & 017] + j;
+        *low = (*low & 0xF0) | (pair & 0x0F);
+        *high = (*high & 0x0F) | (pair & 0xF0);
+    }
+}
+
+//  The logical frame in outV is complete
+void DabAudio::decodeFrame(LatencyStamp stamp)
+{
+    if (stamp.valid()) {
+        stamp.deinterleavedNs = LatencyStamp::now();
+    }
+
+    if (tapLogicalFrames) {
+        myProgrammeHandler.onLogicalFrame(outV.data(), outV.size());
+    }
+
+    if (our_dabProcessor) {
+        PROFILE(DADecode);
+        our_dabProcessor->addtoFrame(outV.data(), stamp);
     }
+    counters.decodedBytes += outV.size();
+    PROFILE(DADone);
 }
 
@@ -29,18 +29,21 @@
 #include <memory>
 #include <atomic>
 #include <vector>
-#include <thread>
-#include <mutex>
-#include <condition_variable>
 #include <cstdio>
+#include <deque>
+#include <mutex>
 #include "ringbuffer.h"
+#include "locked-memory.h"
 #include "energy_dispersal.h"
 #include "radio-controller.h"
+#include "worker-pool.h"
 
 class DabProcessor;
 class Protection;
 
-class DabAudio : public DabVirtual
+// The subchannel is decoded by a task on the shared WorkerPool, which
+// is scheduled whenever process() adds a CIF.
+class DabAudio : public DabVirtual, private WorkerPool::Task
 {
     public:
         DabAudio(AudioServiceComponentType dabModus,
@@ -49,33 +52,78 @@ class DabAudio : public DabVirtual
                   ProtectionSettings protection,
                   ProgrammeHandlerInterface& phi,
                   const std::string& dumpFileName,
-                  bool decodeAudio);
+                  bool decodeAudio,
+                  OverflowPolicy overflow,
+                  DecoderCounters& counters,
+                  bool packSoftbits = false);
         virtual ~DabAudio(void);
         DabAudio(const DabAudio&) = delete;
         DabAudio& operator=(const DabAudio&) = delete;
 
-        int32_t process(const softbit_t *v, int16_t cnt);
+        int32_t process(const softbit_t *v, int16_t cnt, const LatencyStamp& stamp) override;
+        // Skips the de-interleaver and the Viterbi decoder, the frames
+        // of an ETI stream are not dispersed either
+        int32_t processFrame(const uint8_t *frame, int16_t len) override;
+        uint64_t getDroppedFragments(void) const override;
+        void getBufferStats(SubchannelStats& stats) override;
+        size_t getMemoryBytes(void) const override;
+        void setStandby(bool standby) override;
+        void setSlideshow(bool enabled) override;
 
     protected:
         ProgrammeHandlerInterface& myProgrammeHandler;
 
     private:
-        void    run(void);
+        void    runTask(void) override;
+        // Queues cnt softbits, dropping in units of unit when full
+        int32_t enqueue(const softbit_t *v, int16_t cnt, int16_t unit, const LatencyStamp& stamp);
+        void    dropFragment(void);
+        void    decodeFrame(LatencyStamp stamp);
+        void    scatterPacked(const RingBufferSpans<softbit_t>& fragment,
+                        uint8_t *rows, const int32_t *rowOffset) const;
         std::atomic<bool> running;
         AudioServiceComponentType dabModus;
         int16_t fragmentSize;
+        // The mscBuffer and the de-interleaver hold the softbits packed,
+        // see packedsoftbits, a fragment then takes fragmentBytes
+        const bool packed;
+        int16_t fragmentBytes;
+        std::vector<uint8_t> packBuffer;
         int16_t bitRate;
+        const OverflowPolicy overflow;
+        const bool tapLogicalFrames;
+        DecoderCounters& counters;
+        std::atomic<uint64_t> droppedFragments = ATOMIC_VAR_INIT(0);
+        std::atomic<int32_t> maxBufferFill = ATOMIC_VAR_INIT(0);
+        // Set by process() when a CIF was lost, the worker then refills
+        // the de-interleaver instead of decoding frames with a gap.
+        std::atomic<bool> resync = ATOMIC_VAR_INIT(false);
+        // The mscBuffer holds logical frames of processFrame() instead
+        std::atomic<bool> frameInput = ATOMIC_VAR_INIT(false);
+        bool overflowing = false;
         std::vector<uint8_t> outV;
-        std::vector<softbit_t> interleaveData[16];
+        // The time de-interleaver, 16 rows of fragmentBytes. Row n collects the softbits of the logical frame that is
+        // complete in CIF n (mod 16), see DabAudio::run.
+        std::vector<softbit_t, lockedmemory::Allocator<softbit_t>> interleaveData;
+        int16_t countforInterleaver = 0;
+        int16_t interleaverIndex    = 0;
+        // Of the fragment scattered last, the newest in the next frame
+        LatencyStamp interleavedStamp;
         EnergyDispersal energyDispersal;
 
-        std::condition_variable  mscDataAvailable;
-        std::mutex               ourMutex;
-        std::thread              ourThread;
+        WorkerPool& workerPool;
 
         std::unique_ptr<Protection> protectionHandler;
         std::unique_ptr<DabProcessor> our_dabProcessor;
         RingBuffer<softbit_t> mscBuffer;
+        // The stamps of the fragments in the mscBuffer
+        std::mutex stampMutex;
+        std::deque<LatencyStamp> fragmentStamps;
+#if defined(WITH_PROFILING)
+        // The trace flow ids of the fragments in the mscBuffer
+        std::mutex flowMutex;
+        std::deque<uint64_t> fragmentFlows;
+#endif
 
         const std::string dumpFileName;
 };
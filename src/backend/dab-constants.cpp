@@ -27,6 +27,7 @@
  */
 
 #include "dab-constants.h"
+#include "mode-i.h"
 #include <iostream>
 #include <exception>
 #include <sstream>
@@ -180,14 +181,14 @@ void DABParams::setMode(int mode)
     {
         case 1:
             dabMode = 1;
-            L = 76;
-            K = 1536;
-            T_F = 196608;
-            T_null = 2656;
-            T_s = 2552;
-            T_u = 2048;
-            guardLength = 504;
-            carrierDiff = 1000;
+            L = modeI::L;
+            K = modeI::K;
+            T_F = modeI::T_F;
+            T_null = modeI::T_null;
+            T_s = modeI::T_s;
+            T_u = modeI::T_u;
+            guardLength = modeI::guardLength;
+            carrierDiff = modeI::carrierDiff;
             break;
 
         case 2:
@@ -35,6 +35,7 @@
 #define __DAB_CONSTANTS
 
 #include "charsets.h"
+#include <chrono>
 #include <complex>
 #include <limits>
 #include <map>
@@ -192,4 +193,20 @@ struct Subchannel {
     inline bool valid() const { return subChId != -1; }
 };
 
+// What the demodulator does with a CIF when the decoder of a subchannel
+// has no room for it
+struct OverflowPolicy {
+    enum class Mode {
+        DropOldest, // make room by discarding the oldest queued CIF
+        DropNewest, // discard the new CIF
+        Block,      // wait up to blockTimeout for room, then drop the new CIF
+    };
+
+    Mode mode = Mode::DropOldest;
+    std::chrono::milliseconds blockTimeout = std::chrono::milliseconds(24);
+    // CIFs (24 ms each) that may wait for the decoder before the policy
+    // applies, the soft bit ring is sized for them
+    int16_t queuedFragments = 16;
+};
+
 #endif
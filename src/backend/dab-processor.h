@@ -25,13 +25,19 @@
 
 #include    <stdint.h>
 #include    <stdio.h>
+#include    "latency-trace.h"
 
 //  virtual class, just for providing a common base
 //  for the real decoder classes
 class DabProcessor {
     public:
         virtual ~DabProcessor() = default;
-        virtual void addtoFrame(uint8_t *) = 0;
+        // One logical frame of 24 * bitRate bits, packed into bytes, and
+        // the stamp of the newest CIF it was de-interleaved from
+        virtual void addtoFrame(uint8_t *, const LatencyStamp&) = 0;
+        // Keep in sync with the subchannel, without decoding the audio
+        virtual void setStandby(bool) {}
+        virtual void setSlideshow(bool) {}
 };
 
 #endif
@@ -22,15 +22,71 @@
 #ifndef _DAB_VIRTUAL
 #define _DAB_VIRTUAL
 
+#include <atomic>
 #include <cstdint>
 #include "dab-constants.h"
+#include "latency-trace.h"
 
 #define CUSize  (4 * 16)
 
+// Totals over all subchannels of a MscHandler
+struct DecoderCounters {
+    std::atomic<uint64_t> decodedBytes = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> droppedFragments = ATOMIC_VAR_INIT(0);
+};
+
+// Health of the decoding of one subchannel
+struct SubchannelStats {
+    int16_t subChId = -1;
+    bool standby = false;
+
+    // Soft bits waiting for the decoder, and the room for them
+    int32_t bufferFill = 0;
+    int32_t bufferSize = 0;
+    int32_t maxBufferFill = 0;
+    uint64_t droppedFragments = 0;
+    // Bytes of the buffers sized by the subchannel, see getMemoryBytes
+    size_t memoryBytes = 0;
+
+    // DAB+ only, from the callbacks of the decoder
+    uint64_t superframes = 0;
+    uint64_t rsCorrectedErrors = 0;
+    uint64_t rsUncorrectableSuperframes = 0;
+    uint64_t audioUnitErrors = 0;   // AUs with a CRC error
+    uint64_t aacFrames = 0;
+    uint64_t aacErrors = 0;         // frames the AAC decoder failed on
+
+    // The handlers beyond the first, see MscHandler::addSubchannel
+    size_t observers = 0;
+    uint64_t observerDroppedEvents = 0;
+
+    // From the capture of the samples to the decoded audio, while a
+    // handler is attached. Without the handoff and total hops.
+    LatencyTrace::Snapshot latency;
+};
+
 class DabVirtual {
     public:
         virtual ~DabVirtual() {}
-        virtual int32_t process(const softbit_t *v, int16_t cnt) = 0;
+        // stamp is the one of the last sample of the CIF
+        virtual int32_t process(const softbit_t *v, int16_t cnt, const LatencyStamp& stamp) = 0;
+        // A logical frame decoded elsewhere, e.g. taken from an ETI
+        // stream, instead of the CIFs of process()
+        virtual int32_t processFrame(const uint8_t *frame, int16_t len) {
+            (void)frame; (void)len; return 0; }
+        // CIFs dropped because the decoder could not keep up
+        virtual uint64_t getDroppedFragments(void) const { return 0; }
+        // Fills the buffer fields and droppedFragments
+        virtual void getBufferStats(SubchannelStats& stats) {
+            stats.droppedFragments = getDroppedFragments();
+            stats.memoryBytes = getMemoryBytes(); }
+        // The soft bit ring, the de-interleaver and the frame buffers,
+        // which grow with the bitrate of the subchannel
+        virtual size_t getMemoryBytes(void) const { return 0; }
+        // A decoder in standby stays synchronised, but delivers nothing
+        virtual void setStandby(bool) {}
+        // Decode the MOT slideshow of the PAD, on by default
+        virtual void setSlideshow(bool) {}
 };
 #endif
 
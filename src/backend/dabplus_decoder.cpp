@@ -17,19 +17,33 @@
  */
 
 #include "dabplus_decoder.h"
+#include "dsp-kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 
 // --- SuperframeFilter -----------------------------------------------------------------
 SuperframeFilter::SuperframeFilter(SubchannelSinkObserver* observer, bool decode_audio, bool enable_float32) : SubchannelSink(observer, "aac") {
 	this->decode_audio = decode_audio;
 	this->enable_float32 = enable_float32;
+	standby = false;
 
 	aac_dec = nullptr;
+	aac_trial = nullptr;
+	trial_aus = 0;
 
 	frame_len = 0;
 	frame_count = 0;
 	sync_frames = 0;
 
+	frame_first = 0;
+	sf_locked = false;
+	hunt_windows = 0;
+
 	sf_raw = nullptr;
 	sf = nullptr;
 	sf_len = 0;
@@ -44,6 +58,7 @@ SuperframeFilter::~SuperframeFilter() {
 	delete[] sf_raw;
 	delete[] sf;
 	delete aac_dec;
+	delete aac_trial;
 }
 
 void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
@@ -70,26 +85,44 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 		sf = new uint8_t[sf_len];
 	}
 
+	// store the frame in the ring, replacing the oldest one if full
+	int slot;
 	if(frame_count == 5) {
-		// shift previous frames
-		for(int i = 0; i < 4; i++)
-			memcpy(sf_raw + i * frame_len, sf_raw + (i + 1) * frame_len, frame_len);
+		slot = frame_first;
+		frame_first = (frame_first + 1) % 5;
 	} else {
+		slot = (frame_first + frame_count) % 5;
 		frame_count++;
 	}
-
-	// copy frame
-	memcpy(sf_raw + (frame_count - 1) * frame_len, data, frame_len);
+	memcpy(sf_raw + slot * frame_len, data, frame_len);
+	frame_fire_ok[slot] = CheckFireCode(data);
 
 	if(frame_count < 5)
 		return;
 
+	/*	Without sync, every frame is the potential start of a Superframe.
+	 *	Only the windows whose first frame has a valid Fire code as received
+	 *	are RS decoded. As the Fire code itself may need the RS correction,
+	 *	the windows of every other Superframe are all tried.
+	 */
+	if(!sf_locked) {
+		const bool try_window = frame_fire_ok[frame_first] || hunt_windows >= 5;
+		hunt_windows = (hunt_windows + 1) % 10;
+		if(!try_window) {
+			if(sync_frames == 0)
+				fprintf(stderr, "SuperframeFilter: Superframe sync started...\n");
+			sync_frames++;
+			return;
+		}
+	}
+
 
 	int total_corr_count;
 	bool uncorr_errors;
 
-	// append RS coding on copy
-	memcpy(sf, sf_raw, sf_len);
+	// append RS coding on copy, in the order of the frames
+	for(int i = 0; i < 5; i++)
+		memcpy(sf + i * frame_len, sf_raw + ((frame_first + i) % 5) * frame_len, frame_len);
 	rs_dec.DecodeSuperframe(sf, sf_len, total_corr_count, uncorr_errors);
 
 	// forward statistics if errors present
@@ -101,6 +134,7 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 		if(sync_frames == 0)
 			fprintf(stderr, "SuperframeFilter: Superframe sync started...\n");
 		sync_frames++;
+		sf_locked = false;
 		return;
 	}
 
@@ -109,6 +143,12 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 		sync_frames = 0;
 	}
 
+	// the next Superframe starts with the next frame
+	sf_locked = true;
+	hunt_windows = 0;
+	frame_count = 0;
+	frame_first = 0;
+
 
 	// check announced format
 	if(!sf_format_set || sf_format_raw != sf[2]) {
@@ -118,6 +158,10 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 		ProcessFormat();
 	}
 
+	// only the sync is kept up in standby
+	if(standby)
+		return;
+
 	// decode frames
 	for(int i = 0; i < num_aus; i++) {
 		uint8_t *au_data = sf + au_start[i];
@@ -131,14 +175,13 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 		}
 
 		au_len -= 2;
-		if(aac_dec)
+		if(aac_trial)
+			DecodeTrial(au_data, au_len);
+		else if(aac_dec)
 			aac_dec->DecodeFrame(au_data, au_len);
 		CheckForPAD(au_data, au_len);
 		ProcessUntouchedStream(au_data, au_len);
 	}
-
-	// ensure getting a complete new Superframe
-	frame_count = 0;
 }
 
 
@@ -168,17 +211,21 @@ void SuperframeFilter::CheckForPAD(const uint8_t *data, size_t len) {
 }
 
 
-bool SuperframeFilter::CheckSync() {
+bool SuperframeFilter::CheckFireCode(const uint8_t *data) {
 	// abort, if au_start is kind of zero (prevent sync on complete zero array)
-	if(sf[3] == 0x00 && sf[4] == 0x00)
+	if(data[3] == 0x00 && data[4] == 0x00)
 		return false;
 
 	// TODO: use fire code for error correction
 
+	uint16_t crc_stored = data[0] << 8 | data[1];
+	uint16_t crc_calced = CalcCRC::CalcCRC_FIRE_CODE.Calc(data + 2, 9);
+	return crc_stored == crc_calced;
+}
+
+bool SuperframeFilter::CheckSync() {
 	// try to sync on fire code
-	uint16_t crc_stored = sf[0] << 8 | sf[1];
-	uint16_t crc_calced = CalcCRC::CalcCRC_FIRE_CODE.Calc(sf + 2, 9);
-	if(crc_stored != crc_calced)
+	if(!CheckFireCode(sf))
 		return false;
 
 
@@ -244,15 +291,88 @@ void SuperframeFilter::ProcessFormat() {
 
 	if(decode_audio) {
 		delete aac_dec;
-#ifdef DABLIN_AAC_FAAD2
-		aac_dec = new AACDecoderFAAD2(observer, sf_format, enable_float32);
-#endif
-#ifdef DABLIN_AAC_FDKAAC
-		aac_dec = new AACDecoderFDKAAC(observer, sf_format);
-#endif
+		delete aac_trial;
+		aac_dec = nullptr;
+		aac_trial = nullptr;
+
+		AACBackend backend = AACDecoder::SelectBackend(sf_format_raw);
+		if(backend == AACBackend::Auto) {
+			aac_dec = AACDecoder::Create(AACBackend::FAAD2, observer, sf_format, enable_float32);
+			aac_dec->Attach(&trial_capture[0]);
+			aac_trial = AACDecoder::Create(AACBackend::FDKAAC, &trial_capture[1], sf_format, enable_float32);
+			trial_aus = 0;
+			trial_time[0] = trial_time[1] = std::chrono::nanoseconds::zero();
+		} else {
+			aac_dec = AACDecoder::Create(backend, observer, sf_format, enable_float32);
+		}
 	}
 }
 
+void SuperframeFilter::DecodeTrial(uint8_t *data, size_t len) {
+	// the first AUs also measure the setup of the decoders
+	const int warmup_aus = 10;
+	const int measured_aus = 150;
+	using clock = std::chrono::steady_clock;
+
+	const clock::time_point start = clock::now();
+	aac_dec->DecodeFrame(data, len);
+	const clock::time_point middle = clock::now();
+	try {
+		aac_trial->DecodeFrame(data, len);
+	} catch(const std::runtime_error& e) {
+		// keep what is heard already
+		fprintf(stderr, "SuperframeFilter: %s, AAC decoder trial aborted\n", e.what());
+		AACDecoder::SetTrialResult(sf_format_raw, AACBackend::FAAD2);
+		delete aac_trial;
+		aac_trial = nullptr;
+		trial_capture[0].Forward(observer);
+		trial_capture[1].Forward(nullptr);
+		aac_dec->Attach(observer);
+		return;
+	}
+	const clock::time_point end = clock::now();
+
+	// the audio is delivered from FAAD2, outside of the timing
+	trial_capture[0].Forward(observer);
+	trial_capture[1].Forward(nullptr);
+
+	if(++trial_aus <= warmup_aus)
+		return;
+	trial_time[0] += middle - start;
+	trial_time[1] += end - middle;
+	if(trial_aus < warmup_aus + measured_aus)
+		return;
+
+	const bool fdkaac_faster = trial_time[1] < trial_time[0];
+	fprintf(stderr, "SuperframeFilter: AAC decoding takes %.1f us/AU with FAAD2, %.1f us/AU with FDK-AAC, using %s\n",
+			trial_time[0].count() / 1e3 / measured_aus, trial_time[1].count() / 1e3 / measured_aus,
+			fdkaac_faster ? "FDK-AAC" : "FAAD2");
+	AACDecoder::SetTrialResult(sf_format_raw, fdkaac_faster ? AACBackend::FDKAAC : AACBackend::FAAD2);
+
+	if(fdkaac_faster) {
+		// the trial decoder is in sync with the stream, it takes over seamlessly
+		delete aac_dec;
+		aac_dec = aac_trial;
+	} else {
+		delete aac_trial;
+	}
+	aac_dec->Attach(observer);
+	aac_trial = nullptr;
+}
+
+
+// --- AUCapture -----------------------------------------------------------------
+void AUCapture::Forward(SubchannelSinkObserver *observer) {
+	if(observer) {
+		if(has_error)
+			observer->ACCFrameError(error);
+		if(!audio.empty())
+			observer->PutAudio(audio.data(), audio.size());
+	}
+	audio.clear();
+	has_error = false;
+}
+
 
 void SuperframeFilter::ProcessUntouchedStream(const uint8_t *data, size_t len) {
 	std::lock_guard<std::mutex> lock(uscs_mutex);
@@ -307,16 +427,153 @@ void SuperframeFilter::ProcessUntouchedStream(const uint8_t *data, size_t len) {
 	// catch up on LATM frame len
 	au_bw.WriteAudioMuxLengthBytes();
 
-	const std::vector<uint8_t> latm_data = au_bw.GetData();
-	ForwardUntouchedStream(&latm_data[0], latm_data.size(), sf_format.GetAULengthMs());
+	// forwarded straight from the writer, the consumers copy what they keep
+	const std::vector<uint8_t>& latm_data = au_bw.GetData();
+	ForwardUntouchedStream(latm_data.data(), latm_data.size(), sf_format.GetAULengthMs());
 }
 
 
 // --- RSDecoder -----------------------------------------------------------------
+/*	Error free RS packets are detected by their syndromes, before running the
+ *	full decoder. The syndromes S_k = c(alpha^k), k = 0..9, of all interleaved
+ *	packets are computed with Horner's scheme in one pass over the superframe,
+ *	row by row, so the packets are the (contiguous) lanes. The multiplication
+ *	with alpha^k is done on nibbles: x * a = lo[x & 15] ^ hi[x >> 4].
+ *	The prepended zero padding of the shortened code does not change the
+ *	syndromes.
+ */
+static uint8_t gf_mul(uint8_t a, uint8_t b) {
+	uint8_t result = 0;
+	while(b) {
+		if(b & 1)
+			result ^= a;
+		a = (a << 1) ^ (a & 0x80 ? 0x1D : 0);	// 0x11D
+		b >>= 1;
+	}
+	return result;
+}
+
+static void syndromes_scalar(const RSDecoder::RootTables& tables, const uint8_t *sf, int packets, int first, uint8_t *nonzero) {
+	for(int i = first; i < packets; i++) {
+		uint8_t s[10] = {};
+		for(int pos = 0; pos < 120; pos++) {
+			const uint8_t d = sf[pos * packets + i];
+			for(int k = 0; k < 10; k++)
+				s[k] = tables.lo[k][s[k] & 0x0F] ^ tables.hi[k][s[k] >> 4] ^ d;
+		}
+
+		uint8_t any = 0;
+		for(int k = 0; k < 10; k++)
+			any |= s[k];
+		nonzero[i] = any;
+	}
+}
+
+static void syndromes_generic(const RSDecoder::RootTables& tables, const uint8_t *sf, int packets, uint8_t *nonzero) {
+	syndromes_scalar(tables, sf, packets, 0, nonzero);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("ssse3")))
+static void syndromes_SSSE3(const RSDecoder::RootTables& tables, const uint8_t *sf, int packets, uint8_t *nonzero) {
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	__m128i lo[10], hi[10];
+	for(int k = 0; k < 10; k++) {
+		lo[k] = _mm_loadu_si128((const __m128i*) tables.lo[k]);
+		hi[k] = _mm_loadu_si128((const __m128i*) tables.hi[k]);
+	}
+
+	int i = 0;
+	for(; i + 16 <= packets; i += 16) {
+		__m128i s[10];
+		for(int k = 0; k < 10; k++)
+			s[k] = _mm_setzero_si128();
+
+		for(int pos = 0; pos < 120; pos++) {
+			const __m128i d = _mm_loadu_si128((const __m128i*) (sf + pos * packets + i));
+			for(int k = 0; k < 10; k++) {
+				const __m128i l = _mm_shuffle_epi8(lo[k], _mm_and_si128(s[k], mask));
+				const __m128i h = _mm_shuffle_epi8(hi[k], _mm_and_si128(_mm_srli_epi16(s[k], 4), mask));
+				s[k] = _mm_xor_si128(_mm_xor_si128(l, h), d);
+			}
+		}
+
+		__m128i any = s[0];
+		for(int k = 1; k < 10; k++)
+			any = _mm_or_si128(any, s[k]);
+		_mm_storeu_si128((__m128i*) (nonzero + i), any);
+	}
+
+	// the remaining packets, there are sf_len / 120 = bitrate / 8 in total
+	syndromes_scalar(tables, sf, packets, i, nonzero);
+}
+#endif
+
+#if defined(__aarch64__)
+static void syndromes_NEON(const RSDecoder::RootTables& tables, const uint8_t *sf, int packets, uint8_t *nonzero) {
+	const uint8x16_t mask = vdupq_n_u8(0x0F);
+	uint8x16_t lo[10], hi[10];
+	for(int k = 0; k < 10; k++) {
+		lo[k] = vld1q_u8(tables.lo[k]);
+		hi[k] = vld1q_u8(tables.hi[k]);
+	}
+
+	int i = 0;
+	for(; i + 16 <= packets; i += 16) {
+		uint8x16_t s[10];
+		for(int k = 0; k < 10; k++)
+			s[k] = vdupq_n_u8(0);
+
+		for(int pos = 0; pos < 120; pos++) {
+			const uint8x16_t d = vld1q_u8(sf + pos * packets + i);
+			for(int k = 0; k < 10; k++) {
+				const uint8x16_t l = vqtbl1q_u8(lo[k], vandq_u8(s[k], mask));
+				const uint8x16_t h = vqtbl1q_u8(hi[k], vshrq_n_u8(s[k], 4));
+				s[k] = veorq_u8(veorq_u8(l, h), d);
+			}
+		}
+
+		uint8x16_t any = s[0];
+		for(int k = 1; k < 10; k++)
+			any = vorrq_u8(any, s[k]);
+		vst1q_u8(nonzero + i, any);
+	}
+
+	// the remaining packets
+	syndromes_scalar(tables, sf, packets, i, nonzero);
+}
+#endif
+
+// the syndromes of the dsp kernel set in use, see dsp::selectKernels;
+// a CPU with SSE4.1 also has SSSE3
+RSDecoder::SyndromeFunction RSDecoder::SelectSyndromeFunction() {
+	switch(dsp::kernelSetOf(dsp::FastPath::RSSyndromes)) {
+#if defined(__x86_64__) || defined(__i386__)
+	case dsp::KernelSet::SSE4:
+	case dsp::KernelSet::AVX2:
+		return syndromes_SSSE3;
+#elif defined(__aarch64__)
+	case dsp::KernelSet::NEON:
+		return syndromes_NEON;
+#endif
+	default:
+		return syndromes_generic;
+	}
+}
+
 RSDecoder::RSDecoder() {
 	rs_handle = init_rs_char(8, 0x11D, 0, 1, 10, 135);
 	if(!rs_handle)
 		throw std::runtime_error("RSDecoder: error while init_rs_char");
+
+	uint8_t root = 1;	// alpha^0, FCR 0 and PRIM 1
+	for(int k = 0; k < 10; k++) {
+		for(int n = 0; n < 16; n++) {
+			root_tables.lo[k][n] = gf_mul(n, root);
+			root_tables.hi[k][n] = gf_mul(n << 4, root);
+		}
+		root = gf_mul(root, 2);
+	}
 }
 
 RSDecoder::~RSDecoder() {
@@ -333,8 +590,15 @@ void RSDecoder::DecodeSuperframe(uint8_t *sf, size_t sf_len, int& total_corr_cou
 	total_corr_count = 0;
 	uncorr_errors = false;
 
-	// process all RS packets
+	const SyndromeFunction syndromes = SelectSyndromeFunction();
+	nonzero_syndromes.resize(subch_index);
+	syndromes(root_tables, sf, subch_index, nonzero_syndromes.data());
+
+	// process all RS packets with errors
 	for(int i = 0; i < subch_index; i++) {
+		if(!nonzero_syndromes[i])
+			continue;
+
 		for(int pos = 0; pos < 120; pos++)
 			rs_packet[pos] = sf[pos * subch_index + i];
 
@@ -361,10 +625,17 @@ void RSDecoder::DecodeSuperframe(uint8_t *sf, size_t sf_len, int& total_corr_cou
 
 
 // --- AACDecoder -----------------------------------------------------------------
+std::atomic<AACBackend> AACDecoder::backend(AACBackend::Auto);
+std::mutex AACDecoder::trial_results_mutex;
+std::map<uint8_t, AACBackend> AACDecoder::trial_results;
+
 AACDecoder::AACDecoder(std::string decoder_name, SubchannelSinkObserver* observer, SuperframeFormat sf_format) {
 	fprintf(stderr, "AACDecoder: using decoder '%s'\n", decoder_name.c_str());
 
 	this->observer = observer;
+	output_sr = 0;
+	output_ch = 0;
+	output_float32 = false;
 
 	/* AudioSpecificConfig structure (the only way to select 960 transform here!)
 	 *
@@ -408,6 +679,94 @@ AACDecoder::AACDecoder(std::string decoder_name, SubchannelSinkObserver* observe
 	}
 }
 
+void AACDecoder::StartAudio(int samplerate, int channels, bool float32) {
+	output_sr = samplerate;
+	output_ch = channels;
+	output_float32 = float32;
+	observer->StartAudio(samplerate, channels, float32);
+}
+
+void AACDecoder::Attach(SubchannelSinkObserver* observer) {
+	this->observer = observer;
+	observer->StartAudio(output_sr, output_ch, output_float32);
+}
+
+void AACDecoder::SetBackend(AACBackend backend) {
+	AACDecoder::backend = backend;
+}
+
+bool AACDecoder::IsAvailable(AACBackend backend) {
+	switch(backend) {
+#ifdef DABLIN_AAC_FAAD2
+	case AACBackend::FAAD2:
+		return true;
+#endif
+#ifdef DABLIN_AAC_FDKAAC
+	case AACBackend::FDKAAC:
+		return true;
+#endif
+#if defined(DABLIN_AAC_FAAD2) && defined(DABLIN_AAC_FDKAAC)
+	case AACBackend::Auto:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+const char* AACDecoder::BackendName(AACBackend backend) {
+	switch(backend) {
+	case AACBackend::FAAD2:
+		return "faad2";
+	case AACBackend::FDKAAC:
+		return "fdk-aac";
+	default:
+		return "auto";
+	}
+}
+
+AACBackend AACDecoder::BackendFromString(const std::string& name) {
+	if(name == "auto")
+		return AACBackend::Auto;
+	else if(name == "faad2")
+		return AACBackend::FAAD2;
+	else if(name == "fdk-aac")
+		return AACBackend::FDKAAC;
+	throw std::invalid_argument("Unknown AAC decoder " + name);
+}
+
+AACBackend AACDecoder::SelectBackend(uint8_t sf_format_raw) {
+	const AACBackend selected = backend;
+	if(selected != AACBackend::Auto && IsAvailable(selected))
+		return selected;
+	if(!IsAvailable(AACBackend::Auto))
+		return IsAvailable(AACBackend::FAAD2) ? AACBackend::FAAD2 : AACBackend::FDKAAC;
+
+	std::lock_guard<std::mutex> lock(trial_results_mutex);
+	auto result = trial_results.find(sf_format_raw);
+	return result != trial_results.end() ? result->second : AACBackend::Auto;
+}
+
+void AACDecoder::SetTrialResult(uint8_t sf_format_raw, AACBackend backend) {
+	std::lock_guard<std::mutex> lock(trial_results_mutex);
+	trial_results[sf_format_raw] = backend;
+}
+
+AACDecoder* AACDecoder::Create(AACBackend backend, SubchannelSinkObserver* observer, SuperframeFormat sf_format, bool float32) {
+	switch(backend) {
+#ifdef DABLIN_AAC_FAAD2
+	case AACBackend::FAAD2:
+		return new AACDecoderFAAD2(observer, sf_format, float32);
+#endif
+#ifdef DABLIN_AAC_FDKAAC
+	case AACBackend::FDKAAC:
+		return new AACDecoderFDKAAC(observer, sf_format, float32);
+#endif
+	default:
+		throw std::runtime_error("AACDecoder: backend " + std::string(BackendName(backend)) + " not compiled in");
+	}
+}
+
 
 #ifdef DABLIN_AAC_FAAD2
 // --- AACDecoderFAAD2 -----------------------------------------------------------------
@@ -441,7 +800,7 @@ AACDecoderFAAD2::AACDecoderFAAD2(SubchannelSinkObserver* observer, SuperframeFor
 	if(init_result != 0)
 		throw std::runtime_error("AACDecoderFAAD2: error while NeAACDecInit2: " + std::string(NeAACDecGetErrorMessage(-init_result)));
 
-	observer->StartAudio(output_sr, output_ch, float32);
+	StartAudio(output_sr, output_ch, float32);
 }
 
 AACDecoderFAAD2::~AACDecoderFAAD2() {
@@ -468,7 +827,9 @@ void AACDecoderFAAD2::DecodeFrame(uint8_t *data, size_t len) {
 
 #ifdef DABLIN_AAC_FDKAAC
 // --- AACDecoderFDKAAC -----------------------------------------------------------------
-AACDecoderFDKAAC::AACDecoderFDKAAC(SubchannelSinkObserver* observer, SuperframeFormat sf_format) : AACDecoder("FDK-AAC", observer, sf_format) {
+AACDecoderFDKAAC::AACDecoderFDKAAC(SubchannelSinkObserver* observer, SuperframeFormat sf_format, bool float32) : AACDecoder("FDK-AAC", observer, sf_format) {
+	this->float32 = float32;
+
 	handle = aacDecoder_Open(TT_MP4_RAW, 1);
 	if(!handle)
 		throw std::runtime_error("AACDecoderFDKAAC: error while aacDecoder_Open");
@@ -507,7 +868,11 @@ AACDecoderFDKAAC::AACDecoderFDKAAC(SubchannelSinkObserver* observer, SuperframeF
 	output_frame_len = 960 * 2 * channels * (sf_format.sbr_flag ? 2 : 1);
 	output_frame = new uint8_t[output_frame_len];
 
-	observer->StartAudio(sf_format.dac_rate ? 48000 : 32000, channels, false);
+	// the library only outputs 16 bit, converted in DecodeFrame
+	if(float32)
+		float_frame.resize(output_frame_len / 2);
+
+	StartAudio(sf_format.dac_rate ? 48000 : 32000, channels, float32);
 }
 
 AACDecoderFDKAAC::~AACDecoderFDKAAC() {
@@ -530,11 +895,18 @@ void AACDecoderFDKAAC::DecodeFrame(uint8_t *data, size_t len) {
 
 	// decode audio
 	result = aacDecoder_DecodeFrame(handle, (short int*) output_frame, output_frame_len / 2, 0);
-	if(result != AAC_DEC_OK)
-		observer->AudioWarning("AAC");
+	observer->ACCFrameError(result != AAC_DEC_OK);
 	if(!IS_OUTPUT_VALID(result))
 		return;
 
+	if(float32) {
+		const int16_t *pcm = (const int16_t*) output_frame;
+		for(size_t i = 0; i < float_frame.size(); i++)
+			float_frame[i] = pcm[i] / 32768.0f;
+		observer->PutAudio((const uint8_t*) float_frame.data(), float_frame.size() * sizeof(float));
+		return;
+	}
+
 	observer->PutAudio(output_frame, output_frame_len);
 }
 #endif
@@ -22,11 +22,16 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
-#if !(defined(DABLIN_AAC_FAAD2) ^ defined(DABLIN_AAC_FDKAAC))
-#error "You must select a AAC decoder by defining either DABLIN_AAC_FAAD2 or DABLIN_AAC_FDKAAC!"
+#if !(defined(DABLIN_AAC_FAAD2) || defined(DABLIN_AAC_FDKAAC))
+#error "You must select a AAC decoder by defining DABLIN_AAC_FAAD2 and/or DABLIN_AAC_FDKAAC!"
 #endif
 
 #ifdef DABLIN_AAC_FAAD2
@@ -41,6 +46,7 @@ extern "C" {
 #include <fec.h>
 }
 
+#include "radio-receiver-options.h"
 #include "subchannel_sink.h"
 #include "tools.h"
 
@@ -72,10 +78,22 @@ struct SuperframeFormat {
 
 // --- RSDecoder -----------------------------------------------------------------
 class RSDecoder {
+public:
+	// the products of the low/high nibbles with the 10 roots alpha^k
+	struct RootTables {
+		uint8_t lo[10][16];
+		uint8_t hi[10][16];
+	};
+	typedef void (*SyndromeFunction)(const RootTables& tables, const uint8_t *sf, int packets, uint8_t *nonzero);
 private:
 	void *rs_handle;
 	uint8_t rs_packet[120];
 	int corr_pos[10];
+
+	RootTables root_tables;
+	std::vector<uint8_t> nonzero_syndromes;
+
+	static SyndromeFunction SelectSyndromeFunction();
 public:
 	RSDecoder();
 	~RSDecoder();
@@ -91,11 +109,36 @@ protected:
 	SubchannelSinkObserver* observer;
 	uint8_t asc[7];
 	size_t asc_len;
+
+	// the output format, as announced to the observer
+	int output_sr;
+	int output_ch;
+	bool output_float32;
+	void StartAudio(int samplerate, int channels, bool float32);
+
+	static std::atomic<AACBackend> backend;
+	// SF format byte -> faster backend, see SuperframeFilter::DecodeTrial
+	static std::mutex trial_results_mutex;
+	static std::map<uint8_t, AACBackend> trial_results;
 public:
 	AACDecoder(std::string decoder_name, SubchannelSinkObserver* observer, SuperframeFormat sf_format);
 	virtual ~AACDecoder() {}
 
 	virtual void DecodeFrame(uint8_t *data, size_t len) = 0;
+
+	// continue the output with another observer, announcing the format again
+	void Attach(SubchannelSinkObserver* observer);
+
+	// process wide, applies to the decoders created afterwards
+	static void SetBackend(AACBackend backend);
+	static bool IsAvailable(AACBackend backend);
+	static const char* BackendName(AACBackend backend);
+	static AACBackend BackendFromString(const std::string& name);
+
+	// the backend to create for a SF format, Auto as long as both have to be compared
+	static AACBackend SelectBackend(uint8_t sf_format_raw);
+	static void SetTrialResult(uint8_t sf_format_raw, AACBackend backend);
+	static AACDecoder* Create(AACBackend backend, SubchannelSinkObserver* observer, SuperframeFormat sf_format, bool float32);
 };
 
 
@@ -119,11 +162,13 @@ public:
 // --- AACDecoderFDKAAC -----------------------------------------------------------------
 class AACDecoderFDKAAC : public AACDecoder {
 private:
+	bool float32;
 	HANDLE_AACDECODER handle;
 	uint8_t *output_frame;
 	size_t output_frame_len;
+	std::vector<float> float_frame;
 public:
-	AACDecoderFDKAAC(SubchannelSinkObserver* observer, SuperframeFormat sf_format);
+	AACDecoderFDKAAC(SubchannelSinkObserver* observer, SuperframeFormat sf_format, bool float32);
 	~AACDecoderFDKAAC();
 
 	void DecodeFrame(uint8_t *data, size_t len);
@@ -132,18 +177,52 @@ public:
 
 
 // --- SuperframeFilter -----------------------------------------------------------------
+// --- AUCapture -----------------------------------------------------------------
+// Keeps the output of a decoder for one AU, to hand it on later
+class AUCapture : public SubchannelSinkObserver {
+private:
+	std::vector<uint8_t> audio;
+	bool has_error;
+	unsigned char error;
+public:
+	AUCapture() : has_error(false), error(0) {}
+
+	void PutAudio(const uint8_t *data, size_t len) { audio.assign(data, data + len); }
+	void ACCFrameError(const unsigned char error) { has_error = true; this->error = error; }
+
+	// hand the kept output to the observer, or drop it if nullptr
+	void Forward(SubchannelSinkObserver *observer);
+};
+
+
 class SuperframeFilter : public SubchannelSink {
 private:
 	bool decode_audio;
 	bool enable_float32;
+	std::atomic<bool> standby;
 
 	RSDecoder rs_dec;
 	AACDecoder *aac_dec;
 
+	// With AACBackend::Auto, the other backend decodes the same AUs
+	// until the faster of both is known. Both decode into a capture
+	// during the trial, so that the timing does not include the delivery
+	// of the audio.
+	AACDecoder *aac_trial;
+	AUCapture trial_capture[2];
+	int trial_aus;
+	std::chrono::nanoseconds trial_time[2];
+
 	size_t frame_len;
 	int frame_count;
 	int sync_frames;
 
+	// sf_raw holds the last 5 frames as a ring, starting at frame_first
+	int frame_first;
+	bool frame_fire_ok[5];
+	bool sf_locked;
+	int hunt_windows;
+
 	uint8_t *sf_raw;
 	uint8_t *sf;
 	size_t sf_len;
@@ -157,14 +236,18 @@ private:
 
 	BitWriter au_bw;
 
+	static bool CheckFireCode(const uint8_t *data);
 	bool CheckSync();
 	void ProcessFormat();
+	void DecodeTrial(uint8_t *data, size_t len);
 	void ProcessUntouchedStream(const uint8_t *data, size_t len);
 	void CheckForPAD(const uint8_t *data, size_t len);
 public:
 	SuperframeFilter(SubchannelSinkObserver* observer, bool decode_audio, bool enable_float32);
 	~SuperframeFilter();
 
+	void SetStandby(bool standby) {this->standby = standby;}
+
 	void Feed(const uint8_t *data, size_t len);
 };
 
@@ -23,18 +23,70 @@
  *
  */
 
+#include <cstring>
 #include <iostream>
 #include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "decoder_adapter.h"
 
+// Duplicate every mono sample into both channels of the interleaved output
+static void upmixToStereo(const int16_t *in, int16_t *out, size_t samples)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 8 <= samples; i += 8) {
+        const __m128i s = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_unpacklo_epi16(s, s));
+        _mm_storeu_si128((__m128i*)(out + 2 * i + 8), _mm_unpackhi_epi16(s, s));
+    }
+#endif
+    for (; i < samples; i++) {
+        out[2 * i] = out[2 * i + 1] = in[i];
+    }
+}
+
+static void upmixToStereo(const float *in, float *out, size_t samples)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= samples; i += 4) {
+        const __m128 s = _mm_loadu_ps(in + i);
+        _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(s, s));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(s, s));
+    }
+#endif
+    for (; i < samples; i++) {
+        out[2 * i] = out[2 * i + 1] = in[i];
+    }
+}
+
+// The decoders deliver interleaved samples in host byte order, from a
+// buffer of their own which is suitably aligned for the sample type.
+template<typename T>
+static void toStereo(const uint8_t *data, size_t len, int channels, std::vector<T>& out)
+{
+    const size_t samples = len / sizeof(T);
+    if (channels == 2) {
+        out.resize(samples);
+        memcpy(out.data(), data, samples * sizeof(T));
+    }
+    else {
+        out.resize(2 * samples);
+        upmixToStereo(reinterpret_cast<const T*>(data), out.data(), samples);
+    }
+}
+
 DecoderAdapter::DecoderAdapter(ProgrammeHandlerInterface &mr, int16_t bitRate, AudioServiceComponentType &dabModus, const std::string &dumpFileName, bool decodeAudio):
     bitRate(bitRate),
+    passthrough(not decodeAudio),
     myInterface(mr),
     padDecoder(this, true)
 {
     if (dabModus == AudioServiceComponentType::DABPlus)
     {
-        decoder = std::make_unique<SuperframeFilter>(this, decodeAudio, false);
+        decoder = std::make_unique<SuperframeFilter>(this, decodeAudio, mr.wantsFloatAudio());
         if (!decodeAudio)
             decoder->AddUntouchedStreamConsumer(&mr);
     }
@@ -54,24 +106,16 @@ DecoderAdapter::DecoderAdapter(ProgrammeHandlerInterface &mr, int16_t bitRate, A
     padDecoder.SetMOTAppType(12);
 }
 
-void DecoderAdapter::addtoFrame(uint8_t *v)
+void DecoderAdapter::addtoFrame(uint8_t *v, const LatencyStamp& stamp)
 {
     const size_t length = 24 * bitRate / 8;
-    std::vector<uint8_t> data(length);
-
-    // Convert 8 bits (stored in one uint8) into one uint8
-    for (size_t i = 0; i < length; i ++) {
-        data[i] = 0;
-        for (int j = 0; j < 8; j ++) {
-            data[i] <<= 1;
-            data[i] |= v[8 * i + j] & 01;
-        }
-    }
+    frameStamp = stamp;
 
-    decoder->Feed(data.data(), length);
+    // The frame comes in packed already
+    decoder->Feed(v, length);
 
     if (dumpFile) {
-        fwrite(data.data(), length, 1, dumpFile.get());
+        fwrite(v, length, 1, dumpFile.get());
     }
 
     myInterface.onFrameErrors(frameErrorCounter);
@@ -85,40 +129,34 @@ void DecoderAdapter::FormatChange(const AUDIO_SERVICE_FORMAT& format)
 
 void DecoderAdapter::StartAudio(int samplerate, int channels, bool float32)
 {
-    if (float32 == true)
-        throw std::runtime_error("DecoderAdapter: Float32 audio samples are not supported");
-
     audioSamplerate = samplerate;
     audioChannels = channels;
+    audioFloat32 = float32;
 }
 
-void DecoderAdapter::PutAudio(const uint8_t *data, size_t len)
+void DecoderAdapter::deliverStamp()
 {
-    // Then len is given in bytes. For stereo it is the double times of mono.
-    // But we need two channels even if we have mono.
-    // Mono: len = len / 2 * 2 We have len to divide by 2 and for two channels we have multiply by two
-    // Stereo: len = len / 2 We just need to divide by 2 because it is stereo
-    size_t bufferSize = audioChannels == 2 ? len/2 : len;
-    std::vector<int16_t> audio(bufferSize);
+    if (not frameStamp.valid()) {
+        return;
+    }
+    frameStamp.decodedNs = LatencyStamp::now();
+    myInterface.onAudioStamp(frameStamp);
+    frameStamp = LatencyStamp();
+}
 
-    // Convert two uint8 into a int16 sample
-    for(size_t i=0; i<len/2; ++i) {
-        int16_t sample =  ((int16_t) data[i * 2 +1] << 8) | ((int16_t) data[i * 2]);
+void DecoderAdapter::PutAudio(const uint8_t *data, size_t len)
+{
+    deliverStamp();
 
-        if (audioChannels == 2) {
-            audio[i] = sample;
-        }
-        else {
-        	// upmix to stereo
-            audio[i*2] = sample;
-            audio[i*2+1] = sample;
-        }
+    // We need two channels even if we have mono
+    if (audioFloat32) {
+        toStereo(data, len, audioChannels, pcmFloatAudio);
+        myInterface.onNewAudioFloat(std::move(pcmFloatAudio), audioSamplerate, audioFormat);
+    }
+    else {
+        toStereo(data, len, audioChannels, pcmAudio);
+        myInterface.onNewAudio(std::move(pcmAudio), audioSamplerate, audioFormat);
     }
-
-    myInterface.onNewAudio(
-        std::move(audio),
-        audioSamplerate,
-        audioFormat);
 }
 
 void DecoderAdapter::ProcessPAD(const uint8_t *xpad_data, size_t xpad_len, bool exact_xpad_len, const uint8_t *fpad_data)
@@ -139,28 +177,67 @@ void DecoderAdapter::ACCFrameError(const unsigned char error)
 
 void DecoderAdapter::FECInfo(int total_corr_count, bool uncorr_errors)
 {
+    // Without the AAC decoder, the AUs follow right after the RS decoder
+    if (passthrough) {
+        deliverStamp();
+    }
     myInterface.onRsErrors(uncorr_errors, total_corr_count);
 }
 
 void DecoderAdapter::PADChangeDynamicLabel(const DL_STATE &dl)
 {
-    if (dl.raw.empty()) {
-        myInterface.onNewDynamicLabel("");
+    const bool labelChanged = not labelDelivered or not dl.SameLabel(lastLabel);
+
+    if (labelChanged) {
+        if (dl.raw.empty()) {
+            myInterface.onNewDynamicLabel("");
+        }
+        else {
+            myInterface.onNewDynamicLabel(
+                    toUtf8StringUsingCharset(
+                        dl.raw.data(),
+                        (CharacterSet)dl.charset,
+                        dl.raw.size()));
+        }
     }
-    else {
-        myInterface.onNewDynamicLabel(
-                toUtf8StringUsingCharset(
-                    dl.raw.data(),
+
+    // The text of the tags is only converted when they change
+    const bool tagsChanged = dl.dl_plus_tags != lastLabel.dl_plus_tags or
+        dl.dl_plus_item_running != lastLabel.dl_plus_item_running;
+
+    if (not dl.dl_plus_tags.empty() and (labelChanged or tagsChanged)) {
+        // Markers count characters, which are two bytes wide in UCS-2
+        const size_t charSize = (CharacterSet)dl.charset == CharacterSet::UnicodeUcs2 ? 2 : 1;
+
+        std::vector<dl_plus_tag_t> tags;
+        for (const auto& tag : dl.dl_plus_tags) {
+            const size_t start = tag.start_marker * charSize;
+            const size_t length = (tag.length_marker + 1) * charSize;
+            if (start + length > dl.raw.size()) {
+                continue;
+            }
+
+            dl_plus_tag_t t;
+            t.content_type = tag.content_type;
+            t.text = toUtf8StringUsingCharset(
+                    dl.raw.data() + start,
                     (CharacterSet)dl.charset,
-                    dl.raw.size()));
+                    length);
+            tags.push_back(std::move(t));
+        }
+        myInterface.onNewDynamicLabelPlus(tags, dl.dl_plus_item_running);
     }
+
+    lastLabel = dl;
+    labelDelivered = true;
 }
 
-void DecoderAdapter::PADChangeSlide(const MOT_FILE &slide)
+void DecoderAdapter::PADChangeSlide(MOT_FILE&& slide)
 {
     mot_file_t mot_file;
 
-    mot_file.data = slide.data;
+    // The slide is handed on without copying it
+    mot_file.data = std::move(slide.data);
     mot_file.content_sub_type = slide.content_sub_type;
     mot_file.content_name = slide.content_name;
     mot_file.click_through_url = slide.click_through_url;
@@ -168,7 +245,7 @@ void DecoderAdapter::PADChangeSlide(const MOT_FILE &slide)
     mot_file.slide_id = slide.slide_id;
     mot_file.category_title = slide.category_title;
 
-    myInterface.onMOT(mot_file);
+    myInterface.onMOT(std::move(mot_file));
 }
 
 void DecoderAdapter::PADLengthError(size_t announced_xpad_len, size_t xpad_len)
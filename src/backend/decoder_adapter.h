@@ -46,7 +46,9 @@ class DecoderAdapter: public DabProcessor, public SubchannelSinkObserver, public
                      const std::string& dumpFileName,
                      bool decodeAudio);
 
-        virtual void addtoFrame(uint8_t *v);
+        virtual void addtoFrame(uint8_t *v, const LatencyStamp& stamp);
+        virtual void setStandby(bool standby) { decoder->SetStandby(standby); }
+        virtual void setSlideshow(bool enabled) { padDecoder.SetMOTEnabled(enabled); }
 
         // SubchannelSinkObserver impl
         virtual void FormatChange(const AUDIO_SERVICE_FORMAT& /*format*/);
@@ -59,11 +61,12 @@ class DecoderAdapter: public DabProcessor, public SubchannelSinkObserver, public
 
         // PADDecoderObserver impl
         virtual void PADChangeDynamicLabel(const DL_STATE& dl);
-        virtual void PADChangeSlide(const MOT_FILE& slide);
+        virtual void PADChangeSlide(MOT_FILE&& slide);
         virtual void PADLengthError(size_t announced_xpad_len, size_t xpad_len);
 
     private:
         int16_t bitRate;
+        const bool passthrough;
         int frameErrorCounter = 0;
         ProgrammeHandlerInterface& myInterface;
         std::unique_ptr<SubchannelSink> decoder;
@@ -74,7 +77,20 @@ class DecoderAdapter: public DabProcessor, public SubchannelSinkObserver, public
 
         int audioSamplerate = 0;
         int audioChannels = 0;
+        bool audioFloat32 = false;
         std::string audioFormat;
+
+        // Last delivered dynamic label, broadcasters repeat it constantly
+        DL_STATE lastLabel;
+        bool labelDelivered = false;
+
+        // Of the frame fed last, handed on with the first audio out of it
+        LatencyStamp frameStamp;
+        void deliverStamp(void);
+
+        // Reused for every frame, see ProgrammeHandlerInterface::onNewAudio
+        std::vector<int16_t> pcmAudio;
+        std::vector<float> pcmFloatAudio;
 };
 #endif // DECODER_ADAPTER_H
 
@@ -29,28 +29,34 @@
 #include <cstring>
 #include <vector>
 #include <stdexcept>
+#include "various/dsp-kernels.h"
 
+// The data is packed, 8 bits per byte with the first bit in the MSB,
+// the PRBS is kept in the same form and applied a vector at a time.
 class EnergyDispersal {
     public:
         void dedisperse(std::vector<uint8_t>& data)
         {
-            if (dispersalVector.size() != data.size()) {
+            dedisperse(data.data(), data.size());
+        }
+
+        void dedisperse(uint8_t *data, size_t size)
+        {
+            if (dispersalVector.size() != size) {
                 std::vector<uint8_t> shiftRegister(9, 1);
 
-                dispersalVector.resize(data.size());
+                dispersalVector.assign(size, 0);
 
-                for (size_t i = 0; i < data.size(); i++) {
+                for (size_t i = 0; i < size * 8; i++) {
                     uint8_t b = shiftRegister[8] ^ shiftRegister[4];
                     for (int j = 8; j > 0; j--)
                         shiftRegister[j] = shiftRegister[j - 1];
                     shiftRegister[0] = b;
-                    dispersalVector[i] ^= b;
+                    dispersalVector[i / 8] |= b << (7 - i % 8);
                 }
             }
 
-            for (size_t i = 0; i < data.size(); i++) {
-                data[i] ^= dispersalVector[i];
-            }
+            dsp::kernels().xorBytes(data, dispersalVector.data(), size);
         }
 
     private:
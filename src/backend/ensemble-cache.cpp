@@ -0,0 +1,348 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+#include "ensemble-cache.h"
+
+static const char cacheMagic[4] = { 'D', 'A', 'B', 'E' };
+static const uint8_t cacheVersion = 1;
+
+// Limits that a sane ensemble never exceeds
+static const size_t maxServices = 64;
+static const size_t maxComponents = 256;
+static const size_t maxSubchannels = 64;
+static const size_t maxStringLength = 1024;
+
+// The CUs of a CIF, and the entries of the UEP table
+static const int32_t cusPerCif = 864;
+static const int16_t uepTableSize = sizeof(ProtLevel) / sizeof(ProtLevel[0]);
+
+namespace {
+
+class Writer {
+    public:
+        template<typename T>
+        void put(T value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "plain values only");
+            const auto *p = reinterpret_cast<const uint8_t*>(&value);
+            data.insert(data.end(), p, p + sizeof(T));
+        }
+
+        void putBytes(const uint8_t *bytes, size_t len)
+        {
+            put<uint16_t>(len);
+            data.insert(data.end(), bytes, bytes + len);
+        }
+
+        void putString(const std::string& s)
+        {
+            putBytes(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+        }
+
+        void putLabel(const DabLabel& label)
+        {
+            put<uint8_t>((uint8_t)label.charset);
+            putString(label.fig1_label);
+            put<uint16_t>(label.fig1_flag);
+
+            put<uint8_t>(label.segments.size());
+            for (const auto& segment : label.segments) {
+                put<uint8_t>(segment.first);
+                putBytes(segment.second.data(), segment.second.size());
+            }
+            put<uint8_t>(label.segment_count);
+            put<uint8_t>((uint8_t)label.extended_label_charset);
+            put<uint8_t>(label.toggle_flag);
+            put<uint8_t>(label.fig2_rfu);
+        }
+
+        std::vector<uint8_t> data;
+};
+
+// Any read beyond the end of the data sets ok to false and returns 0
+class Reader {
+    public:
+        explicit Reader(const std::vector<uint8_t>& data) : data(data) {}
+
+        template<typename T>
+        T get()
+        {
+            T value = T();
+            if (pos + sizeof(T) > data.size()) {
+                ok = false;
+                return value;
+            }
+            memcpy(&value, data.data() + pos, sizeof(T));
+            pos += sizeof(T);
+            return value;
+        }
+
+        std::vector<uint8_t> getBytes()
+        {
+            const size_t len = get<uint16_t>();
+            if (len > maxStringLength or pos + len > data.size()) {
+                ok = false;
+                return {};
+            }
+            std::vector<uint8_t> bytes(data.begin() + pos, data.begin() + pos + len);
+            pos += len;
+            return bytes;
+        }
+
+        std::string getString()
+        {
+            const auto bytes = getBytes();
+            return std::string(bytes.begin(), bytes.end());
+        }
+
+        DabLabel getLabel()
+        {
+            DabLabel label;
+            label.charset = (CharacterSet)get<uint8_t>();
+            label.fig1_label = getString();
+            label.fig1_flag = get<uint16_t>();
+
+            const size_t numSegments = get<uint8_t>();
+            for (size_t i = 0; i < numSegments and ok; i++) {
+                const int index = get<uint8_t>();
+                label.segments[index] = getBytes();
+            }
+            label.segment_count = get<uint8_t>();
+            label.extended_label_charset = (CharacterSet)get<uint8_t>();
+            label.toggle_flag = get<uint8_t>();
+            label.fig2_rfu = get<uint8_t>() != 0;
+            return label;
+        }
+
+        bool atEnd() const { return pos == data.size(); }
+
+        bool ok = true;
+
+    private:
+        const std::vector<uint8_t>& data;
+        size_t pos = 0;
+};
+
+} // namespace
+
+bool saveEnsembleCache(const std::string& fileName, const CachedEnsemble& cached)
+{
+    const EnsembleSnapshot& e = cached.ensemble;
+    Writer w;
+
+    w.data.insert(w.data.end(), cacheMagic, cacheMagic + sizeof(cacheMagic));
+    w.put<uint8_t>(cacheVersion);
+    w.put<int32_t>(cached.coarseCorrector);
+    w.put<int16_t>(cached.fineCorrector);
+
+    w.put<uint16_t>(e.ensembleId);
+    w.put<uint8_t>(e.ensembleEcc);
+    w.putLabel(e.ensembleLabel);
+
+    w.put<uint16_t>(e.services.size());
+    for (const auto& s : e.services) {
+        w.put<uint32_t>(s.serviceId);
+        w.putLabel(s.serviceLabel);
+        w.put<int16_t>(s.language);
+        w.put<int16_t>(s.programType);
+    }
+
+    w.put<uint16_t>(e.components.size());
+    for (const auto& c : e.components) {
+        w.put<int8_t>(c.TMid);
+        w.put<uint32_t>(c.SId);
+        w.put<int16_t>(c.componentNr);
+        w.putLabel(c.componentLabel);
+        w.put<int16_t>(c.ASCTy);
+        w.put<int16_t>(c.PS_flag);
+        w.put<int16_t>(c.subchannelId);
+        w.put<uint16_t>(c.SCId);
+        w.put<uint8_t>(c.CAflag);
+        w.put<int16_t>(c.DSCTy);
+        w.put<uint8_t>(c.DGflag);
+        w.put<int16_t>(c.packetAddress);
+    }
+
+    uint16_t numSubchannels = 0;
+    for (const auto& sub : e.subChannels) {
+        numSubchannels += sub.valid();
+    }
+
+    w.put<uint16_t>(numSubchannels);
+    for (const auto& sub : e.subChannels) {
+        if (not sub.valid()) {
+            continue;
+        }
+        const auto& ps = sub.protectionSettings;
+        w.put<int32_t>(sub.subChId);
+        w.put<int32_t>(sub.startAddr);
+        w.put<int32_t>(sub.length);
+        w.put<uint8_t>(sub.programmeNotData);
+        w.put<uint8_t>(ps.shortForm);
+        w.put<int16_t>(ps.uepTableIndex);
+        w.put<int16_t>(ps.uepLevel);
+        w.put<uint8_t>((uint8_t)ps.eepProfile);
+        w.put<uint8_t>((uint8_t)ps.eepLevel);
+        w.put<int16_t>(sub.language);
+        w.put<int16_t>(sub.fecScheme);
+    }
+
+    // Write a new file and rename it, a concurrent load never sees a
+    // partially written cache
+    const std::string tmpName = fileName + ".tmp";
+    FILE *fd = fopen(tmpName.c_str(), "wb");
+    if (fd == nullptr) {
+        std::clog << "EnsembleCache: cannot write " << tmpName << ": " <<
+            strerror(errno) << std::endl;
+        return false;
+    }
+
+    const bool written = fwrite(w.data.data(), 1, w.data.size(), fd) == w.data.size();
+    const bool closed = fclose(fd) == 0;
+    if (not written or not closed or rename(tmpName.c_str(), fileName.c_str()) != 0) {
+        std::clog << "EnsembleCache: cannot write " << fileName << ": " <<
+            strerror(errno) << std::endl;
+        remove(tmpName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool loadEnsembleCache(const std::string& fileName, CachedEnsemble& cached)
+{
+    FILE *fd = fopen(fileName.c_str(), "rb");
+    if (fd == nullptr) {
+        return false;
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), fd)) > 0) {
+        data.insert(data.end(), buf, buf + len);
+    }
+    fclose(fd);
+
+    Reader r(data);
+    char magic[sizeof(cacheMagic)];
+    for (auto& m : magic) {
+        m = r.get<char>();
+    }
+    if (memcmp(magic, cacheMagic, sizeof(cacheMagic)) != 0 or
+            r.get<uint8_t>() != cacheVersion) {
+        std::clog << "EnsembleCache: ignoring " << fileName <<
+            ", unknown format" << std::endl;
+        return false;
+    }
+
+    CachedEnsemble c;
+    EnsembleSnapshot& e = c.ensemble;
+    c.coarseCorrector = r.get<int32_t>();
+    c.fineCorrector = r.get<int16_t>();
+
+    e.ensembleId = r.get<uint16_t>();
+    e.ensembleEcc = r.get<uint8_t>();
+    e.ensembleLabel = r.getLabel();
+
+    const size_t numServices = r.get<uint16_t>();
+    for (size_t i = 0; i < numServices and i < maxServices and r.ok; i++) {
+        Service s(r.get<uint32_t>());
+        s.serviceLabel = r.getLabel();
+        s.language = r.get<int16_t>();
+        s.programType = r.get<int16_t>();
+        e.serviceIndex.emplace(s.serviceId, e.services.size());
+        e.services.push_back(std::move(s));
+    }
+
+    const size_t numComponents = r.get<uint16_t>();
+    for (size_t i = 0; i < numComponents and i < maxComponents and r.ok; i++) {
+        ServiceComponent sc;
+        sc.TMid = r.get<int8_t>();
+        sc.SId = r.get<uint32_t>();
+        sc.componentNr = r.get<int16_t>();
+        sc.componentLabel = r.getLabel();
+        sc.ASCTy = r.get<int16_t>();
+        sc.PS_flag = r.get<int16_t>();
+        sc.subchannelId = r.get<int16_t>();
+        sc.SCId = r.get<uint16_t>();
+        sc.CAflag = r.get<uint8_t>();
+        sc.DSCTy = r.get<int16_t>();
+        sc.DGflag = r.get<uint8_t>();
+        sc.packetAddress = r.get<int16_t>();
+        e.components.push_back(std::move(sc));
+    }
+
+    e.subChannels.resize(maxSubchannels);
+    const size_t numSubchannels = r.get<uint16_t>();
+    for (size_t i = 0; i < numSubchannels and i < maxSubchannels and r.ok; i++) {
+        Subchannel sub;
+        auto& ps = sub.protectionSettings;
+        sub.subChId = r.get<int32_t>();
+        sub.startAddr = r.get<int32_t>();
+        sub.length = r.get<int32_t>();
+        sub.programmeNotData = r.get<uint8_t>() != 0;
+        ps.shortForm = r.get<uint8_t>() != 0;
+        ps.uepTableIndex = r.get<int16_t>();
+        ps.uepLevel = r.get<int16_t>();
+        ps.eepProfile = (EEPProtectionProfile)r.get<uint8_t>();
+        ps.eepLevel = (EEPProtectionLevel)r.get<uint8_t>();
+        sub.language = r.get<int16_t>();
+        sub.fecScheme = r.get<int16_t>();
+
+        // The subchannel has to fit into the CIF, and the UEP table
+        // index is looked up in the table unchecked
+        if (sub.subChId < 0 or sub.subChId >= (int32_t)maxSubchannels or
+                sub.startAddr < 0 or sub.startAddr > cusPerCif or
+                sub.length < 0 or sub.length > cusPerCif - sub.startAddr or
+                ps.uepTableIndex < 0 or ps.uepTableIndex >= uepTableSize) {
+            r.ok = false;
+            break;
+        }
+        e.subChannels[sub.subChId] = sub;
+    }
+
+    for (const auto& sc : e.components) {
+        if (sc.subchannelId < 0 or sc.subchannelId >= (int16_t)maxSubchannels) {
+            r.ok = false;
+        }
+    }
+
+    if (not r.ok or not r.atEnd()) {
+        std::clog << "EnsembleCache: ignoring " << fileName <<
+            ", file is damaged" << std::endl;
+        return false;
+    }
+
+    cached = std::move(c);
+    return true;
+}
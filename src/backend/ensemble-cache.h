@@ -0,0 +1,50 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef ENSEMBLE_CACHE_H
+#define ENSEMBLE_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include "fib-processor.h"
+
+// What the receiver knew about a channel when it was tuned away from it:
+// the ensemble database and the frequency correctors it was locked to.
+// Loading it on the next tune lets the services be selected, and the MSC
+// be decoded, before the FIC has been received again.
+struct CachedEnsemble {
+    EnsembleSnapshot ensemble;
+    int32_t coarseCorrector = 0;
+    int16_t fineCorrector = 0;
+};
+
+// The cache files are local to the machine, they are stored in native
+// byte order and rejected when their format version differs.
+bool saveEnsembleCache(const std::string& fileName, const CachedEnsemble& cached);
+
+// Returns false if the file does not exist or is not a valid cache
+bool loadEnsembleCache(const std::string& fileName, CachedEnsemble& cached);
+
+#endif // ENSEMBLE_CACHE_H
@@ -0,0 +1,163 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <iostream>
+#include <vector>
+#include "eti-demultiplexer.h"
+#include "thread-config.h"
+#include "tools.h"
+
+static const uint8_t errNone = 0xFF;
+
+EtiDemultiplexer::EtiDemultiplexer(CEtiSource& source,
+        RadioControllerInterface& rci,
+        FicHandler& ficHandler,
+        MscHandler& mscHandler) :
+    source(source),
+    radioInterface(rci),
+    ficHandler(ficHandler),
+    mscHandler(mscHandler)
+{
+}
+
+EtiDemultiplexer::~EtiDemultiplexer()
+{
+    stop();
+}
+
+void EtiDemultiplexer::restart()
+{
+    stop();
+    source.reset();
+    synced = false;
+    running = true;
+    threadHandle = std::thread(&EtiDemultiplexer::run, this);
+}
+
+//  The source returns within a frame period, or its receive timeout
+void EtiDemultiplexer::stop()
+{
+    if (running) {
+        running = false;
+        if (threadHandle.joinable()) {
+            threadHandle.join();
+        }
+    }
+}
+
+EtiDemultiplexer::Stats EtiDemultiplexer::getStats() const
+{
+    Stats s;
+    s.frames = frames;
+    s.framesDropped = framesDropped;
+    s.framesDamaged = framesDamaged;
+    s.syncLosses = source.getSyncLosses();
+    s.synced = synced;
+    return s;
+}
+
+void EtiDemultiplexer::run()
+{
+    threading::ScopedThread threadConfig(ThreadStage::Input, "eti-read");
+    std::vector<uint8_t> frame(CEtiSource::frameSize);
+
+    while (running) {
+        if (not source.readFrame(frame.data())) {
+            if (running) {
+                radioInterface.onMessage(message_level_t::Information,
+                        "End of the ETI input: " + source.getDescription());
+                radioInterface.onInputFailure();
+            }
+            break;
+        }
+
+        const bool valid = processFrame(frame.data());
+        frames++;
+        if (not valid) {
+            framesDropped++;
+        }
+        if (valid != synced) {
+            synced = valid;
+            radioInterface.onSyncChange(valid);
+        }
+    }
+
+    if (synced) {
+        synced = false;
+        radioInterface.onSyncChange(false);
+    }
+}
+
+//  ETSI EN 300 799, section 5: ERR, FSYNC, FC, STC, EOH, MST, EOF, TIST
+bool EtiDemultiplexer::processFrame(const uint8_t *p)
+{
+    const uint8_t fct  = p[4];
+    const bool ficf    = p[5] & 0x80;
+    const size_t nst   = p[5] & 0x7F;
+    const uint8_t mid  = (p[6] >> 3) & 0x03;
+
+    // The header is protected by the CRC of the EOH
+    const size_t eoh = 8 + 4 * nst;
+    if (eoh + 4 > CEtiSource::frameSize) {
+        return false;
+    }
+    const uint16_t headerCrc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(&p[4], eoh + 2 - 4);
+    if (headerCrc != ((p[eoh + 2] << 8) | p[eoh + 3])) {
+        return false;
+    }
+
+    // Mode III carries four FIBs per CIF
+    const size_t mst = eoh + 4;
+    const size_t ficLen = ficf ? (mid == 3 ? 128 : 96) : 0;
+    size_t mstLen = ficLen;
+    for (size_t i = 0; i < nst; i++) {
+        const uint8_t *stc = &p[8 + 4 * i];
+        mstLen += (((stc[2] & 0x03) << 8) | stc[3]) * 8;
+    }
+    if (mst + mstLen + 4 > CEtiSource::frameSize) {
+        return false;
+    }
+
+    const uint16_t mstCrc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(&p[mst], mstLen);
+    if (p[0] != errNone or mstCrc != ((p[mst + mstLen] << 8) | p[mst + mstLen + 1])) {
+        // Still handed on, the FIBs have CRCs of their own and the
+        // superframes are protected by the Reed-Solomon code
+        framesDamaged++;
+    }
+
+    if (ficf) {
+        ficHandler.processFibs(&p[mst], ficLen, fct % 4);
+    }
+
+    size_t pos = mst + ficLen;
+    for (size_t i = 0; i < nst; i++) {
+        const uint8_t *stc = &p[8 + 4 * i];
+        const int16_t subChId = stc[0] >> 2;
+        const size_t len = (((stc[2] & 0x03) << 8) | stc[3]) * 8;
+        mscHandler.processLogicalFrame(subChId, &p[pos], len);
+        pos += len;
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef ETI_DEMULTIPLEXER_H
+#define ETI_DEMULTIPLEXER_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "eti_source.h"
+#include "fic-handler.h"
+#include "msc-handler.h"
+#include "radio-controller.h"
+
+/* The counterpart of the EtiMultiplexer: takes the FIC and the logical
+ * frames of the subchannels out of the ETI frames of a CEtiSource and
+ * hands them to the FicHandler and the MscHandler, in place of the
+ * OFDMProcessor. There is no demodulation, no de-interleaving and no
+ * Viterbi decoding, only the audio of the selected services is decoded.
+ *
+ * The frames are read on a thread of its own. At the end of the input
+ * the RadioControllerInterface gets onInputFailure. */
+class EtiDemultiplexer
+{
+    public:
+        EtiDemultiplexer(CEtiSource& source,
+                RadioControllerInterface& rci,
+                FicHandler& ficHandler,
+                MscHandler& mscHandler);
+        ~EtiDemultiplexer();
+        EtiDemultiplexer(const EtiDemultiplexer&) = delete;
+        EtiDemultiplexer& operator=(const EtiDemultiplexer&) = delete;
+
+        // Start or restart reading the source, from its beginning
+        void restart(void);
+        void stop(void);
+
+        struct Stats {
+            uint64_t frames = 0;
+            // With an invalid header, their content was not used
+            uint64_t framesDropped = 0;
+            // Frames with an error level, or a wrong CRC of their data
+            uint64_t framesDamaged = 0;
+            // The frame sync had to be searched, see CEtiSource
+            uint64_t syncLosses = 0;
+            bool synced = false;
+        };
+        Stats getStats(void) const;
+
+    private:
+        void run(void);
+        bool processFrame(const uint8_t *frame);
+
+        CEtiSource& source;
+        RadioControllerInterface& radioInterface;
+        FicHandler& ficHandler;
+        MscHandler& mscHandler;
+
+        std::thread threadHandle;
+        std::atomic<bool> running = ATOMIC_VAR_INIT(false);
+        std::atomic<bool> synced = ATOMIC_VAR_INIT(false);
+        std::atomic<uint64_t> frames = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> framesDropped = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> framesDamaged = ATOMIC_VAR_INIT(0);
+};
+
+#endif
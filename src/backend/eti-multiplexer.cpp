@@ -0,0 +1,248 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "eti-multiplexer.h"
+#include "tools.h"
+
+// FSYNC alternates between the two words from frame to frame
+static const uint32_t fsyncEven = 0x073AB6;
+static const uint32_t fsyncOdd = 0xF8C549;
+
+// ERR values, no error and the highest error level
+static const uint8_t errNone = 0xFF;
+static const uint8_t errLevel3 = 0x0F;
+
+EtiMultiplexer::EtiMultiplexer(uint8_t dabMode, Output output) :
+    // MID, the mode identity, is 0 for mode IV
+    mid(dabMode & 0x03),
+    output(std::move(output)),
+    frame(frameSize)
+{
+}
+
+void EtiMultiplexer::addFic(const uint8_t *fibs, size_t len)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fics.emplace_back();
+    std::memcpy(fics.back().data(), fibs, std::min(len, ficSize));
+    emitReady();
+}
+
+void EtiMultiplexer::setSubchannels(const std::vector<Subchannel>& subchannels)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::map<int16_t, Stream> next;
+    for (const auto& sub : subchannels) {
+        Stream& stream = next[sub.subChId];
+        auto it = streams.find(sub.subChId);
+        if (it != streams.end() and
+                it->second.sub.startAddr == sub.startAddr and
+                it->second.sub.length == sub.length and
+                it->second.sub.protection() == sub.protection()) {
+            stream = std::move(it->second);
+        }
+        stream.sub = sub;
+    }
+    streams.swap(next);
+    emitReady();
+}
+
+void EtiMultiplexer::addLogicalFrame(int16_t subChId, const uint8_t *data, size_t len)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = streams.find(subChId);
+    if (it == streams.end()) {
+        return;
+    }
+
+    Stream& stream = it->second;
+    // Without FIC, e.g. after a sync loss, the frames are not sent
+    if (stream.frames.size() >= maxLagFrames) {
+        stream.spare.push_back(std::move(stream.frames.front()));
+        stream.frames.pop_front();
+    }
+
+    std::vector<uint8_t> buffer;
+    if (not stream.spare.empty()) {
+        buffer = std::move(stream.spare.back());
+        stream.spare.pop_back();
+    }
+    buffer.assign(data, data + len);
+    stream.frames.push_back(std::move(buffer));
+    stream.started = true;
+    emitReady();
+}
+
+void EtiMultiplexer::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fics.clear();
+    for (auto& s : streams) {
+        s.second.frames.clear();
+        s.second.started = false;
+    }
+}
+
+void EtiMultiplexer::emitReady()
+{
+    while (not fics.empty()) {
+        const bool complete = std::none_of(streams.begin(), streams.end(),
+                [](const std::pair<const int16_t, Stream>& s) {
+                    return s.second.started and s.second.frames.empty();
+                } );
+        if (not complete and fics.size() <= maxLagFrames) {
+            return;
+        }
+        emitFrame();
+        fics.pop_front();
+    }
+}
+
+//  EN 300 799 uses the TPL of ODR-DabMux: 01 and the UEP protection
+//  level, or 1, the option and the level for EEP
+uint8_t EtiMultiplexer::protectionLevel(const ProtectionSettings& ps)
+{
+    if (ps.shortForm) {
+        return 0x10 | ((ps.uepLevel - 1) & 0x07);
+    }
+    const uint8_t option = ps.eepProfile == EEPProtectionProfile::EEP_B ? 1 : 0;
+    return 0x20 | (option << 2) | (((int)ps.eepLevel - 1) & 0x03);
+}
+
+void EtiMultiplexer::emitFrame()
+{
+    // The streams in the order of the CIF
+    std::vector<Stream*> active;
+    for (auto& s : streams) {
+        if (s.second.started) {
+            active.push_back(&s.second);
+        }
+    }
+    std::sort(active.begin(), active.end(),
+            [](const Stream *a, const Stream *b) { return a->sub.startAddr < b->sub.startAddr; });
+
+    // STL, the length of a stream in 64 bit words, and FL, the length of
+    // the frame in 32 bit words from STC to EOF
+    size_t mstSize = ficSize;
+    std::vector<uint16_t> stl;
+    for (Stream *s : active) {
+        const uint16_t words = s->sub.bitrate() * 3 / 8;
+        // The biggest ensemble fits, a broken FIC should not overflow
+        if (12 + 4 * (stl.size() + 1) + mstSize + words * 8 + 8 > frameSize) {
+            break;
+        }
+        stl.push_back(words);
+        mstSize += words * 8;
+    }
+    active.resize(stl.size());
+    const size_t nst = active.size();
+    const uint16_t fl = nst + 1 + mstSize / 4;
+
+    std::fill(frame.begin(), frame.end(), 0x55);
+    uint8_t *p = frame.data();
+
+    // SYNC, ERR is filled in once the streams are known to be complete
+    const uint32_t fsync = (frameCount & 1) ? fsyncOdd : fsyncEven;
+    p[1] = fsync >> 16;
+    p[2] = fsync >> 8;
+    p[3] = fsync;
+
+    // FC
+    p[4] = frameCount % 250;
+    p[5] = 0x80 | nst;                      // FICF, NST
+    p[6] = ((frameCount % 8) << 5) | (mid << 3) | ((fl >> 8) & 0x07);
+    p[7] = fl & 0xFF;
+
+    // STC
+    size_t pos = 8;
+    for (size_t i = 0; i < nst; i++) {
+        const Subchannel& sub = active[i]->sub;
+        const uint8_t tpl = protectionLevel(sub.protectionSettings);
+        p[pos++] = (sub.subChId << 2) | ((sub.startAddr >> 8) & 0x03);
+        p[pos++] = sub.startAddr & 0xFF;
+        p[pos++] = (tpl << 2) | ((stl[i] >> 8) & 0x03);
+        p[pos++] = stl[i] & 0xFF;
+    }
+
+    // EOH, no MNSC
+    p[pos++] = 0xFF;
+    p[pos++] = 0xFF;
+    uint16_t crc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(&p[4], pos - 4);
+    p[pos++] = crc >> 8;
+    p[pos++] = crc & 0xFF;
+
+    // MST
+    const size_t mst = pos;
+    std::memcpy(&p[pos], fics.front().data(), ficSize);
+    pos += ficSize;
+
+    bool complete = true;
+    for (size_t i = 0; i < nst; i++) {
+        Stream& s = *active[i];
+        const size_t len = stl[i] * 8;
+        if (not s.frames.empty() and s.frames.front().size() == len) {
+            std::memcpy(&p[pos], s.frames.front().data(), len);
+        }
+        else {
+            std::memset(&p[pos], 0, len);
+            complete = false;
+        }
+
+        if (not s.frames.empty()) {
+            s.spare.push_back(std::move(s.frames.front()));
+            s.frames.pop_front();
+        }
+        pos += len;
+    }
+
+    // EOF
+    crc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(&p[mst], pos - mst);
+    p[pos++] = crc >> 8;
+    p[pos++] = crc & 0xFF;
+    p[pos++] = 0xFF;                        // RFU
+    p[pos++] = 0xFF;
+
+    // TIST, no time stamp
+    p[pos++] = 0xFF;
+    p[pos++] = 0xFF;
+    p[pos++] = 0xFF;
+    p[pos++] = 0xFF;
+
+    p[0] = complete ? errNone : errLevel3;
+
+    frameCount++;
+    framesWritten++;
+    if (not complete) {
+        framesIncomplete++;
+    }
+
+    if (output) {
+        output(frame.data(), frame.size());
+    }
+}
@@ -0,0 +1,111 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef ETI_MULTIPLEXER_H
+#define ETI_MULTIPLEXER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "dab-constants.h"
+
+/* Packs the FIC and the logical frames of the decoded subchannels into an
+ * ETI(NI) stream, ETSI EN 300 799, one frame of 6144 bytes per CIF. The
+ * logical frames are taken after the time de-interleaver, the Viterbi
+ * decoder and the energy dispersal, which is the data the multiplexer of
+ * the broadcaster put into its ETI, so any ETI decoder can decode the
+ * services from it.
+ *
+ * The decoder tasks deliver the logical frames at their own pace, a frame
+ * is sent once every subchannel contributed its part. A subchannel more
+ * than maxLagFrames behind is sent as zeros, and the frame gets an error
+ * level. A subchannel only joins with its first logical frame, 16 CIFs
+ * after its decoder started, so the MSC of a frame is behind its FIC by
+ * that much.
+ *
+ * The output gets the frames in order, called from the FIC decoder or a
+ * decoder task with the lock of the multiplexer held. It must not block. */
+class EtiMultiplexer
+{
+    public:
+        using Output = std::function<void(const uint8_t *frame, size_t len)>;
+
+        static constexpr size_t frameSize = 6144;
+        static constexpr size_t ficSize = 96;   // 3 FIBs per CIF
+        static constexpr size_t maxLagFrames = 8;
+
+        EtiMultiplexer(uint8_t dabMode, Output output);
+        EtiMultiplexer(const EtiMultiplexer&) = delete;
+        EtiMultiplexer& operator=(const EtiMultiplexer&) = delete;
+
+        // The FIBs of one CIF, after the Viterbi decoder and the energy
+        // dispersal, whatever their CRC
+        void addFic(const uint8_t *fibs, size_t len);
+
+        // The subchannels being decoded, only they are waited for
+        void setSubchannels(const std::vector<Subchannel>& subchannels);
+        void addLogicalFrame(int16_t subChId, const uint8_t *frame, size_t len);
+
+        // Drop what is queued, when the receiver is restarted
+        void reset(void);
+
+        uint64_t getFramesWritten(void) const { return framesWritten; }
+        // Frames with a subchannel sent as zeros
+        uint64_t getFramesIncomplete(void) const { return framesIncomplete; }
+
+    private:
+        struct Stream {
+            Subchannel sub;
+            bool started = false;
+            std::deque<std::vector<uint8_t>> frames;
+            // Buffers of the frames sent, for the next ones
+            std::vector<std::vector<uint8_t>> spare;
+        };
+
+        // With the mutex held
+        void emitReady(void);
+        void emitFrame(void);
+
+        static uint8_t protectionLevel(const ProtectionSettings& ps);
+
+        const uint8_t mid;
+        Output output;
+
+        std::mutex mutex;
+        std::deque<std::array<uint8_t, ficSize>> fics;
+        std::map<int16_t, Stream> streams;
+        std::vector<uint8_t> frame;
+        uint32_t frameCount = 0;
+
+        std::atomic<uint64_t> framesWritten = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> framesIncomplete = ATOMIC_VAR_INIT(0);
+};
+
+#endif
@@ -32,6 +32,35 @@
 #include "charsets.h"
 #include "MathHelper.h"
 
+// Assigns the value and tells if the field was changed by that
+template<typename T, typename V>
+static bool update(T& field, const V& value)
+{
+    if (field == value) {
+        return false;
+    }
+    field = value;
+    return true;
+}
+
+static bool updateLabel(DabLabel& label, uint16_t flag,
+        const char *text, uint8_t charSet)
+{
+    const CharacterSet previousCharset = label.charset;
+    label.setCharset(charSet);
+
+    bool changed = label.charset != previousCharset;
+    changed |= update(label.fig1_flag, flag);
+    changed |= update(label.fig1_label, std::string(text));
+    return changed;
+}
+
+const Service *EnsembleSnapshot::findService(uint32_t sId) const
+{
+    const auto it = serviceIndex.find(sId);
+    return it != serviceIndex.end() ? &services[it->second] : nullptr;
+}
+
 FIBProcessor::FIBProcessor(RadioControllerInterface& mr) :
     myRadioInterface(mr)
 {
@@ -65,7 +94,9 @@ void FIBProcessor::processFIB(uint8_t *p, uint16_t fib)
                 break;
 
             case 7:
-                return;
+                // End marker, the remainder of the FIB is padding
+                processedBytes = 30;
+                continue;
 
             default:
                 //std::clog << "FIG%d present" << FIGtype << std::endl;
@@ -76,6 +107,9 @@ void FIBProcessor::processFIB(uint8_t *p, uint16_t fib)
         processedBytes += getBits_5 (d, 3) + 1;
         d = p + processedBytes * 8;
     }
+
+    publishSnapshot();
+    notifyPending();
 }
 //
 //  Handle ensemble is all through FIG0
@@ -121,9 +155,20 @@ void FIBProcessor::FIG0Extension0 (uint8_t *d)
 
     uint16_t eId  = getBits(d, 16, 16);
 
+    if (preloaded and ensembleId != eId) {
+        std::clog << "fib-processor: cached ensemble " << std::hex <<
+            ensembleId << " replaced by " << eId << std::dec << std::endl;
+        resetDatabase();
+        ensembleLabel = DabLabel();
+        ensembleEcc = 0;
+    }
+    preloaded = false;
+    ensembleReceived = true;
+
     if (ensembleId != eId) {
         ensembleId = eId;
-        myRadioInterface.onNewEnsemble(ensembleId);
+        changed = true;
+        pendingNewEnsemble = true;
     }
 
     changeflag  = getBits_2 (d, 16 + 16);
@@ -179,28 +224,28 @@ int16_t FIBProcessor::HandleFIG0Extension1(
     int16_t bitOffset = offset * 8;
     const int16_t subChId   = getBits_6 (d, bitOffset);
     const int16_t startAdr  = getBits(d, bitOffset + 6, 10);
-    subChannels[subChId].programmeNotData = pd;
-    subChannels[subChId].subChId = subChId;
-    subChannels[subChId].startAddr = startAdr;
+    Subchannel& sub = subChannels[subChId];
+    changed |= update(sub.programmeNotData, pd == 1);
+    changed |= update(sub.subChId, subChId);
+    changed |= update(sub.startAddr, startAdr);
+    auto& ps = sub.protectionSettings;
     if (getBits_1 (d, bitOffset + 16) == 0) {   // UEP, short form
         int16_t tableIx = getBits_6 (d, bitOffset + 18);
-        auto& ps = subChannels[subChId].protectionSettings;
-        ps.uepTableIndex = tableIx;
-        ps.shortForm = true;
-        ps.uepLevel = ProtLevel[tableIx][1];
+        changed |= update(ps.uepTableIndex, tableIx);
+        changed |= update(ps.shortForm, true);
+        changed |= update(ps.uepLevel, ProtLevel[tableIx][1]);
 
-        subChannels[subChId].length = ProtLevel[tableIx][0];
+        changed |= update(sub.length, ProtLevel[tableIx][0]);
         bitOffset += 24;
     }
     else {  // EEP, long form
-        auto& ps = subChannels[subChId].protectionSettings;
-        ps.shortForm  = false;
+        changed |= update(ps.shortForm, false);
         int16_t option = getBits_3(d, bitOffset + 17);
         if (option == 0) {
-            ps.eepProfile = EEPProtectionProfile::EEP_A;
+            changed |= update(ps.eepProfile, EEPProtectionProfile::EEP_A);
         }
         else if (option == 1) {
-            ps.eepProfile = EEPProtectionProfile::EEP_B;
+            changed |= update(ps.eepProfile, EEPProtectionProfile::EEP_B);
         }
 
         if (option == 0 or   // EEP-A protection
@@ -208,16 +253,16 @@ int16_t FIBProcessor::HandleFIG0Extension1(
             int16_t protLevel = getBits_2(d, bitOffset + 20);
             switch (protLevel) {
                 case 0:
-                    ps.eepLevel = EEPProtectionLevel::EEP_1;
+                    changed |= update(ps.eepLevel, EEPProtectionLevel::EEP_1);
                     break;
                 case 1:
-                    ps.eepLevel = EEPProtectionLevel::EEP_2;
+                    changed |= update(ps.eepLevel, EEPProtectionLevel::EEP_2);
                     break;
                 case 2:
-                    ps.eepLevel = EEPProtectionLevel::EEP_3;
+                    changed |= update(ps.eepLevel, EEPProtectionLevel::EEP_3);
                     break;
                 case 3:
-                    ps.eepLevel = EEPProtectionLevel::EEP_4;
+                    changed |= update(ps.eepLevel, EEPProtectionLevel::EEP_4);
                     break;
                 default:
                     std::clog << "Warning, FIG0/1 for " << subChId <<
@@ -227,7 +272,7 @@ int16_t FIBProcessor::HandleFIG0Extension1(
             }
 
             int16_t subChanSize = getBits(d, bitOffset + 22, 10);
-            subChannels[subChId].length = subChanSize;
+            changed |= update(sub.length, subChanSize);
         }
         else {
             std::clog << "Warning, FIG0/1 for " << subChId <<
@@ -237,6 +282,10 @@ int16_t FIBProcessor::HandleFIG0Extension1(
         bitOffset += 32;
     }
 
+    if (not preloadedSubChannels.empty()) {
+        checkPreloadedSubchannel(sub);
+    }
+
     return bitOffset / 8;   // we return bytes
 }
 
@@ -323,7 +372,10 @@ int16_t FIBProcessor::HandleFIG0Extension2(
 
     if (findServiceId(SId) == nullptr and serviceRepeatCount[SId] >= 2) {
         services.emplace_back(SId);
-        myRadioInterface.onServiceDetected(SId);
+        serviceIndex[SId] = services.size() - 1;
+        changed = true;
+        pendingDetectedServices.push_back(SId);
+        timeLastServiceChange = now;
     }
 
     numberofComponents = getBits_4(d, lOffset + 4);
@@ -354,6 +406,17 @@ int16_t FIBProcessor::HandleFIG0Extension2(
         }
         lOffset += 16;
     }
+
+    if (not preloadedComponents.empty()) {
+        dropPreloadedComponents(SId, numberofComponents);
+    }
+
+    // FIG 0/2 carries all components of the service at once
+    if (numberofComponents > 0 and findServiceId(SId) and
+            signalledComponents.insert(SId).second) {
+        pendingCompleteServices.push_back(SId);
+    }
+
     return lOffset / 8;     // in Bytes
 }
 
@@ -386,10 +449,10 @@ int16_t FIBProcessor::HandleFIG0Extension3(uint8_t *d, int16_t used)
 
     used += 56 / 8;
     if (packetComp) {
-        packetComp->subchannelId = SubChId;
-        packetComp->DSCTy = DSCTy;
-        packetComp->DGflag = DGflag;
-        packetComp->packetAddress = packetAddress;
+        changed |= update(packetComp->subchannelId, SubChId);
+        changed |= update(packetComp->DSCTy, DSCTy);
+        changed |= update(packetComp->DGflag, DGflag);
+        changed |= update(packetComp->packetAddress, packetAddress);
     }
     return used;
 }
@@ -414,7 +477,7 @@ int16_t FIBProcessor::HandleFIG0Extension5(uint8_t* d, int16_t offset)
         if (getBits_1 (d, loffset + 1) == 0) {
             subChId = getBits_6 (d, loffset + 2);
             language = getBits_8 (d, loffset + 8);
-            subChannels[subChId].language = language;
+            changed |= update(subChannels[subChId].language, language);
         }
         loffset += 16;
     }
@@ -487,7 +550,7 @@ void FIBProcessor::FIG0Extension9(uint8_t *d)
     dateTime.minuteOffset = (getBits_1 (d, offset + 7) == 1) ? 30 : 0;
     timeOffsetReceived = true;
 
-    ensembleEcc = getBits(d, offset + 8, 8);
+    changed |= update(ensembleEcc, getBits(d, offset + 8, 8));
 }
 
 void FIBProcessor::FIG0Extension10(uint8_t *fig)
@@ -619,7 +682,7 @@ void FIBProcessor::FIG0Extension14 (uint8_t *d)
 
         for (int i = 0; i < 64; i++) {
             if (subChannels[i].subChId == subChId) {
-                subChannels[i].fecScheme = fecScheme;
+                changed |= update(subChannels[i].fecScheme, fecScheme);
             }
         }
 
@@ -642,14 +705,14 @@ void FIBProcessor::FIG0Extension17(uint8_t *d)
         if (L_flag) {       // language field present
             Language = getBits_8 (d, offset + 24);
             if (s) {
-                s->language = Language;
+                changed |= update(s->language, Language);
             }
             offset += 8;
         }
 
         type = getBits_5 (d, offset + 27);
         if (s) {
-            s->programType = type;
+            changed |= update(s->programType, type);
         }
         if (CC_flag) {          // cc flag
             offset += 40;
@@ -790,10 +853,9 @@ void FIBProcessor::process_FIG1(uint8_t *d)
                 }
                 // std::clog << "fib-processor:" << "Ensemblename: " << label << std::endl;
                 if (!oe and EId == ensembleId) {
-                    ensembleLabel.fig1_flag = getBits(d, offset, 16);
-                    ensembleLabel.fig1_label = label;
-                    ensembleLabel.setCharset(charSet);
-                    myRadioInterface.onSetEnsembleLabel(ensembleLabel);
+                    changed |= updateLabel(ensembleLabel,
+                            getBits(d, offset, 16), label, charSet);
+                    pendingEnsembleLabel = true;
                 }
                 break;
             }
@@ -807,9 +869,11 @@ void FIBProcessor::process_FIG1(uint8_t *d)
                     label[i] = getBits_8(d, offset);
                     offset += 8;
                 }
-                service->serviceLabel.fig1_flag = getBits(d, offset, 16);
-                service->serviceLabel.fig1_label = label;
-                service->serviceLabel.setCharset(charSet);
+                if (updateLabel(service->serviceLabel,
+                            getBits(d, offset, 16), label, charSet)) {
+                    changed = true;
+                    pendingServiceLabels.push_back(SId);
+                }
                 // std::clog << "fib-processor:" << "FIG1/1: SId = %4x\t%s\n", SId, label) << std::endl;
             }
             break;
@@ -845,9 +909,8 @@ void FIBProcessor::process_FIG1(uint8_t *d)
 
             component = findComponent(SId, SCidS);
             if (component) {
-                component->componentLabel.fig1_flag = getBits(d, offset, 16);
-                component->componentLabel.setCharset(charSet);
-                component->componentLabel.fig1_label = label;
+                changed |= updateLabel(component->componentLabel,
+                        getBits(d, offset, 16), label, charSet);
             }
             //        std::clog << "fib-processor:" << "FIG1/4: Sid = %8x\tp/d=%d\tSCidS=%1X\tflag=%8X\t%s\n",
             //                          SId, pd_flag, SCidS, flagfield, label) << std::endl;
@@ -863,9 +926,11 @@ void FIBProcessor::process_FIG1(uint8_t *d)
                     label[i] = getBits_8(d, offset);
                     offset += 8;
                 }
-                service->serviceLabel.fig1_flag = getBits(d, offset, 16);
-                service->serviceLabel.fig1_label = label;
-                service->serviceLabel.setCharset(charSet);
+                if (updateLabel(service->serviceLabel,
+                            getBits(d, offset, 16), label, charSet)) {
+                    changed = true;
+                    pendingServiceLabels.push_back(SId);
+                }
 
 #ifdef  MSC_DATA__
                 myRadioInterface.onServiceDetected(SId);
@@ -905,14 +970,17 @@ void FIBProcessor::process_FIG1(uint8_t *d)
     }
 }
 
-static void handle_ext_label_data_field(const uint8_t *f, uint8_t len_bytes,
+// Returns true if the label was changed
+static bool handle_ext_label_data_field(const uint8_t *f, uint8_t len_bytes,
         bool toggle_flag, uint8_t segment_index, uint8_t rfu,
         DabLabel& label)
 {
+    bool changed = false;
     if (label.toggle_flag != toggle_flag) {
         label.segments.clear();
         label.extended_label_charset = CharacterSet::Undefined;
         label.toggle_flag = toggle_flag;
+        changed = true;
     }
 
     size_t len_character_field = len_bytes;
@@ -921,13 +989,13 @@ static void handle_ext_label_data_field(const uint8_t *f, uint8_t len_bytes,
         // Only if it's the first segment
         const uint8_t encoding_flag = (f[0] & 0x80) >> 7;
         const uint8_t segment_count = (f[0] & 0x70) >> 4;
-        label.segment_count = segment_count + 1;
+        changed |= update(label.segment_count, (size_t)segment_count + 1);
 
         if (encoding_flag) {
-            label.extended_label_charset = CharacterSet::UnicodeUcs2;
+            changed |= update(label.extended_label_charset, CharacterSet::UnicodeUcs2);
         }
         else {
-            label.extended_label_charset = CharacterSet::UnicodeUtf8;
+            changed |= update(label.extended_label_charset, CharacterSet::UnicodeUtf8);
         }
 
         if (rfu == 0) {
@@ -953,11 +1021,12 @@ static void handle_ext_label_data_field(const uint8_t *f, uint8_t len_bytes,
             len_character_field -= 1;
         }
 
-        label.fig2_rfu = rfu;
+        changed |= update(label.fig2_rfu, rfu == 1);
     }
 
     std::vector<uint8_t> labelbytes(f, f + len_character_field);
-    label.segments[segment_index] = labelbytes;
+    changed |= update(label.segments[segment_index], labelbytes);
+    return changed;
 }
 
 // UTF-8 or UCS2 Labels
@@ -1016,7 +1085,7 @@ void FIBProcessor::process_FIG2(uint8_t *d)
                     std::clog << "FIG2/0 length error " << (int)figlen << std::endl;
                 }
                 else if (eid == ensembleId) {
-                    handle_ext_label_data_field(figdata, data_len_bytes,
+                    changed |= handle_ext_label_data_field(figdata, data_len_bytes,
                             toggle_flag, segment_index, rfu, ensembleLabel);
                 }
             }
@@ -1030,9 +1099,10 @@ void FIBProcessor::process_FIG2(uint8_t *d)
                 }
                 else {
                     auto *service = findServiceId(sid);
-                    if (service) {
-                        handle_ext_label_data_field(figdata, data_len_bytes,
-                                toggle_flag, segment_index, rfu, service->serviceLabel);
+                    if (service and handle_ext_label_data_field(figdata, data_len_bytes,
+                                toggle_flag, segment_index, rfu, service->serviceLabel)) {
+                        changed = true;
+                        pendingServiceLabels.push_back(sid);
                     }
                 }
             }
@@ -1059,7 +1129,7 @@ void FIBProcessor::process_FIG2(uint8_t *d)
                 else {
                     auto *component = findComponent(sid, SCIdS);
                     if (component) {
-                        handle_ext_label_data_field(figdata, data_len_bytes,
+                        changed |= handle_ext_label_data_field(figdata, data_len_bytes,
                                 toggle_flag, segment_index, rfu, component->componentLabel);
                     }
                 }
@@ -1079,9 +1149,10 @@ void FIBProcessor::process_FIG2(uint8_t *d)
                 }
                 else {
                     auto *service = findServiceId(sid);
-                    if (service) {
-                        handle_ext_label_data_field(figdata, data_len_bytes,
-                                toggle_flag, segment_index, rfu, service->serviceLabel);
+                    if (service and handle_ext_label_data_field(figdata, data_len_bytes,
+                                toggle_flag, segment_index, rfu, service->serviceLabel)) {
+                        changed = true;
+                        pendingServiceLabels.push_back(sid);
                     }
                 }
             }
@@ -1092,41 +1163,115 @@ void FIBProcessor::process_FIG2(uint8_t *d)
 // locate a reference to the entry for the Service serviceId
 Service *FIBProcessor::findServiceId(uint32_t serviceId)
 {
+    const auto it = serviceIndex.find(serviceId);
+    return it != serviceIndex.end() ? &services[it->second] : nullptr;
+}
+
+ServiceComponent *FIBProcessor::findComponent(uint32_t serviceId, int16_t SCIdS)
+{
+    const auto it = componentIndex.find(componentKey(serviceId, SCIdS));
+    return it != componentIndex.end() ? &components[it->second] : nullptr;
+}
+
+ServiceComponent *FIBProcessor::findPacketComponent(int16_t SCId)
+{
+    const auto it = packetComponentIndex.find(SCId);
+    return it != packetComponentIndex.end() ? &components[it->second] : nullptr;
+}
+
+uint64_t FIBProcessor::componentKey(uint32_t SId, int16_t compnr)
+{
+    return ((uint64_t)SId << 16) | (uint16_t)compnr;
+}
+
+// Like the linear search it replaces, the index refers to the first
+// component with a given key
+void FIBProcessor::indexComponent(size_t ix)
+{
+    const ServiceComponent& sc = components[ix];
+    componentIndex.emplace(componentKey(sc.SId, sc.componentNr), ix);
+    if (sc.TMid == 03) {
+        packetComponentIndex.emplace(sc.SCId, ix);
+    }
+}
+
+void FIBProcessor::rebuildIndex()
+{
+    serviceIndex.clear();
+    componentIndex.clear();
+    packetComponentIndex.clear();
+
     for (size_t i = 0; i < services.size(); i++) {
-        if (services[i].serviceId == serviceId) {
-            return &services[i];
-        }
+        serviceIndex.emplace(services[i].serviceId, i);
     }
 
-    return nullptr;
+    for (size_t i = 0; i < components.size(); i++) {
+        indexComponent(i);
+    }
 }
 
-ServiceComponent *FIBProcessor::findComponent(uint32_t serviceId, int16_t SCIdS)
+//  A component of FIG 0/2. A new one is added, a preloaded one is
+//  replaced the first time, the cache may be outdated
+void FIBProcessor::addComponent(const ServiceComponent& live)
 {
-    auto comp = std::find_if(components.begin(), components.end(),
-                [&](const ServiceComponent& sc) {
-                    return sc.SId == serviceId && sc.componentNr == SCIdS;
-                });
+    const uint64_t key = componentKey(live.SId, live.componentNr);
+    const auto it = componentIndex.find(key);
+    if (it == componentIndex.end()) {
+        components.push_back(live);
+        indexComponent(components.size() - 1);
+        changed = true;
+        timeLastServiceChange = std::chrono::steady_clock::now();
+        return;
+    }
 
-    if (comp == components.end()) {
-        return nullptr;
+    if (preloadedComponents.erase(key) == 0) {
+        return;
     }
-    else {
-        return &(*comp);
+
+    ServiceComponent& cached = components[it->second];
+    const bool same =
+        cached.TMid == live.TMid and
+        cached.PS_flag == live.PS_flag and
+        (live.TMid == 3 ?
+            cached.SCId == live.SCId and cached.CAflag == live.CAflag :
+            cached.subchannelId == live.subchannelId and
+            cached.ASCTy == live.ASCTy and cached.DSCTy == live.DSCTy);
+    if (same) {
+        return;
     }
+
+    std::clog << "fib-processor: cached component " << live.componentNr <<
+        " of service " << std::hex << live.SId << std::dec <<
+        " is outdated" << std::endl;
+
+    // The label is kept, the packet parameters come with FIG 0/3 again
+    DabLabel label = std::move(cached.componentLabel);
+    cached = live;
+    cached.componentLabel = std::move(label);
+    rebuildIndex();
+    changed = true;
+    timeLastServiceChange = std::chrono::steady_clock::now();
 }
 
-ServiceComponent *FIBProcessor::findPacketComponent(int16_t SCId)
+//  FIG 0/2 lists all components of a service, the preloaded ones it
+//  does not list are gone
+void FIBProcessor::dropPreloadedComponents(uint32_t SId, int16_t numComponents)
 {
-    for (auto& component : components) {
-        if (component.TMid != 03) {
-            continue;
-        }
-        if (component.SCId == SCId) {
-            return &component;
-        }
+    const size_t before = components.size();
+    components.erase(std::remove_if(components.begin(), components.end(),
+                [&](const ServiceComponent& c) {
+                    return c.SId == SId and c.componentNr >= numComponents and
+                        preloadedComponents.erase(componentKey(c.SId, c.componentNr)) > 0;
+                }
+                ), components.end());
+
+    if (components.size() != before) {
+        std::clog << "fib-processor: dropped " << before - components.size() <<
+            " cached component(s) of service " << std::hex << SId << std::dec << std::endl;
+        rebuildIndex();
+        changed = true;
+        timeLastServiceChange = std::chrono::steady_clock::now();
     }
-    return nullptr;
 }
 
 //  bindAudioService is the main processor for - what the name suggests -
@@ -1142,21 +1287,16 @@ void FIBProcessor::bindAudioService(
     Service *s = findServiceId(SId);
     if (!s) return;
 
-    if (std::find_if(components.begin(), components.end(),
-                [&](const ServiceComponent& sc) {
-                    return sc.SId == s->serviceId && sc.componentNr == compnr;
-                }) == components.end()) {
-        ServiceComponent newcomp;
-        newcomp.TMid         = TMid;
-        newcomp.componentNr  = compnr;
-        newcomp.SId          = SId;
-        newcomp.subchannelId = subChId;
-        newcomp.PS_flag      = ps_flag;
-        newcomp.ASCTy        = ASCTy;
-        components.push_back(newcomp);
-
-        //  std::clog << "fib-processor:" << "service %8x (comp %d) is audio\n", SId, compnr) << std::endl;
-    }
+    ServiceComponent newcomp;
+    newcomp.TMid         = TMid;
+    newcomp.componentNr  = compnr;
+    newcomp.SId          = SId;
+    newcomp.subchannelId = subChId;
+    newcomp.PS_flag      = ps_flag;
+    newcomp.ASCTy        = ASCTy;
+    addComponent(newcomp);
+
+    //  std::clog << "fib-processor:" << "service %8x (comp %d) is audio\n", SId, compnr) << std::endl;
 }
 
 void FIBProcessor::bindDataStreamService(
@@ -1170,21 +1310,16 @@ void FIBProcessor::bindDataStreamService(
     Service *s = findServiceId(SId);
     if (!s) return;
 
-    if (std::find_if(components.begin(), components.end(),
-                [&](const ServiceComponent& sc) {
-                    return sc.SId == s->serviceId && sc.componentNr == compnr;
-                }) == components.end()) {
-        ServiceComponent newcomp;
-        newcomp.TMid         = TMid;
-        newcomp.SId          = SId;
-        newcomp.subchannelId = subChId;
-        newcomp.componentNr  = compnr;
-        newcomp.PS_flag      = ps_flag;
-        newcomp.DSCTy        = DSCTy;
-        components.push_back(newcomp);
-
-        //  std::clog << "fib-processor:" << "service %8x (comp %d) is packet\n", SId, compnr) << std::endl;
-    }
+    ServiceComponent newcomp;
+    newcomp.TMid         = TMid;
+    newcomp.SId          = SId;
+    newcomp.subchannelId = subChId;
+    newcomp.componentNr  = compnr;
+    newcomp.PS_flag      = ps_flag;
+    newcomp.DSCTy        = DSCTy;
+    addComponent(newcomp);
+
+    //  std::clog << "fib-processor:" << "service %8x (comp %d) is packet\n", SId, compnr) << std::endl;
 }
 
 //      bindPacketService is the main processor for - what the name suggests -
@@ -1201,21 +1336,16 @@ void FIBProcessor::bindPacketService(
     Service *s = findServiceId(SId);
     if (!s) return;
 
-    if (std::find_if(components.begin(), components.end(),
-                [&](const ServiceComponent& sc) {
-                    return sc.SId == s->serviceId && sc.componentNr == compnr;
-                }) == components.end()) {
-        ServiceComponent newcomp;
-        newcomp.TMid        = TMid;
-        newcomp.SId         = SId;
-        newcomp.componentNr = compnr;
-        newcomp.SCId        = SCId;
-        newcomp.PS_flag     = ps_flag;
-        newcomp.CAflag      = CAflag;
-        components.push_back(newcomp);
-
-        //  std::clog << "fib-processor:" << "service %8x (comp %d) is packet\n", SId, compnr) << std::endl;
-    }
+    ServiceComponent newcomp;
+    newcomp.TMid        = TMid;
+    newcomp.SId         = SId;
+    newcomp.componentNr = compnr;
+    newcomp.SCId        = SCId;
+    newcomp.PS_flag     = ps_flag;
+    newcomp.CAflag      = CAflag;
+    addComponent(newcomp);
+
+    //  std::clog << "fib-processor:" << "service %8x (comp %d) is packet\n", SId, compnr) << std::endl;
 }
 
 void FIBProcessor::dropService(uint32_t SId)
@@ -1223,6 +1353,9 @@ void FIBProcessor::dropService(uint32_t SId)
     std::stringstream ss;
     ss << "Dropping service " << SId;
 
+    const size_t numServices = services.size();
+    const size_t numComponents = components.size();
+
     services.erase(std::remove_if(services.begin(), services.end(),
                 [&](const Service& s) {
                     return s.serviceId == SId;
@@ -1254,51 +1387,251 @@ void FIBProcessor::dropService(uint32_t SId)
         if (drop) {
             ss << ", subch " << sub.subChId;
             sub.subChId = -1;
+            changed = true;
         }
     }
 
+    if (services.size() != numServices or components.size() != numComponents) {
+        changed = true;
+    }
+    rebuildIndex();
+
     std::clog << ss.str() << std::endl;
 }
 
+void FIBProcessor::resetDatabase()
+{
+    components.clear();
+    subChannels.assign(64, Subchannel());
+    services.clear();
+    rebuildIndex();
+    serviceRepeatCount.clear();
+    signalledLabels.clear();
+    signalledComponents.clear();
+    timeLastServiceChange = std::chrono::steady_clock::now();
+    changed = true;
+}
+
 void FIBProcessor::clearEnsemble()
 {
     std::lock_guard<std::mutex> lock(mutex);
     components.clear();
     subChannels.resize(64);
     services.clear();
+    rebuildIndex();
     serviceRepeatCount.clear();
     timeLastServiceDecrement = std::chrono::steady_clock::now();
     timeLastFCT0Frame = std::chrono::system_clock::now();
+
+    pendingDetectedServices.clear();
+    pendingNewEnsemble = false;
+    pendingEnsembleLabel = false;
+    pendingSubchannelChanges.clear();
+    pendingServiceLabels.clear();
+    pendingCompleteServices.clear();
+    signalledLabels.clear();
+    signalledComponents.clear();
+    ensembleCompleteSignalled = false;
+    preloadedSubChannels.clear();
+    preloadedComponents.clear();
+    preloaded = false;
+    ensembleReceived = false;
+
+    changed = true;
+    publishSnapshot();
 }
 
-std::vector<Service> FIBProcessor::getServiceList() const
+void FIBProcessor::preloadEnsemble(const EnsembleSnapshot& cached)
 {
     std::lock_guard<std::mutex> lock(mutex);
-    return services;
+    resetDatabase();
+
+    ensembleId = cached.ensembleId;
+    ensembleEcc = cached.ensembleEcc;
+    ensembleLabel = cached.ensembleLabel;
+    services = cached.services;
+    components = cached.components;
+    for (const auto& sub : cached.subChannels) {
+        if (sub.valid() and sub.subChId < (int32_t)subChannels.size()) {
+            subChannels[sub.subChId] = sub;
+        }
+    }
+    rebuildIndex();
+
+    // The services have to be signalled again before they are dropped
+    for (const auto& s : services) {
+        serviceRepeatCount[s.serviceId] = 2;
+        pendingDetectedServices.push_back(s.serviceId);
+        pendingServiceLabels.push_back(s.serviceId);
+        if (componentIndex.count(componentKey(s.serviceId, 0))) {
+            signalledComponents.insert(s.serviceId);
+            pendingCompleteServices.push_back(s.serviceId);
+        }
+    }
+    timeLastServiceDecrement = std::chrono::steady_clock::now();
+
+    preloadedSubChannels = subChannels;
+    for (const auto& sc : components) {
+        preloadedComponents.insert(componentKey(sc.SId, sc.componentNr));
+    }
+    preloaded = true;
+    pendingNewEnsemble = true;
+    pendingEnsembleLabel = not ensembleLabel.fig1_label.empty();
+
+    publishSnapshot();
+    notifyPending();
 }
 
-Service FIBProcessor::getService(uint32_t sId) const
+void FIBProcessor::setSubchannelChangedCallback(SubchannelChangedCallback callback)
 {
     std::lock_guard<std::mutex> lock(mutex);
+    subchannelChanged = std::move(callback);
+}
 
-    auto srv = std::find_if(services.begin(), services.end(),
-                [&](const Service& s) {
-                    return s.serviceId == sId;
-                });
+bool FIBProcessor::isEnsembleReceived() const
+{
+    return ensembleReceived;
+}
 
-    if (srv != services.end()) {
-        return *srv;
+bool FIBProcessor::isEnsembleCompleteSignalled() const
+{
+    return ensembleCompleteSignalled;
+}
+
+// The first FIG 0/1 of a preloaded subchannel tells if the cache was right
+void FIBProcessor::checkPreloadedSubchannel(const Subchannel& sub)
+{
+    Subchannel& cached = preloadedSubChannels[sub.subChId];
+    if (not cached.valid()) {
+        return;
     }
-    else {
-        return Service(0);
+
+    const bool same =
+        cached.startAddr == sub.startAddr and
+        cached.length == sub.length and
+        cached.bitrate() == sub.bitrate() and
+        cached.protection() == sub.protection();
+
+    if (not same) {
+        std::clog << "fib-processor: cached subchannel " << sub.subChId <<
+            " is outdated" << std::endl;
+        pendingSubchannelChanges.push_back(sub);
+    }
+
+    cached.subChId = -1;
+}
+
+// Copying the database is only needed when it changed, which is rare
+// once the ensemble has been received completely. The FIB cache in the
+// FicHandler keeps most of the unchanged FIBs away from us anyway.
+void FIBProcessor::publishSnapshot()
+{
+    if (not changed) {
+        return;
+    }
+
+    auto s = std::make_shared<EnsembleSnapshot>();
+    s->version = ++version;
+    s->ensembleId = ensembleId;
+    s->ensembleEcc = ensembleEcc;
+    s->ensembleLabel = ensembleLabel;
+    s->services = services;
+    s->components = components;
+    s->subChannels = subChannels;
+    s->serviceIndex = serviceIndex;
+
+    std::atomic_store(&snapshot, std::shared_ptr<const EnsembleSnapshot>(std::move(s)));
+    changed = false;
+}
+
+void FIBProcessor::notifyPending()
+{
+    if (pendingNewEnsemble) {
+        pendingNewEnsemble = false;
+        myRadioInterface.onNewEnsemble(ensembleId);
+    }
+
+    if (pendingEnsembleLabel) {
+        pendingEnsembleLabel = false;
+        myRadioInterface.onSetEnsembleLabel(ensembleLabel);
+    }
+
+    for (const uint32_t SId : pendingDetectedServices) {
+        myRadioInterface.onServiceDetected(SId);
+    }
+    pendingDetectedServices.clear();
+
+    // Only a label that reads differently is signalled again
+    for (const uint32_t SId : pendingServiceLabels) {
+        const Service *s = findServiceId(SId);
+        if (s == nullptr) {
+            continue;
+        }
+
+        std::string label = s->serviceLabel.utf8_label();
+        std::string& signalled = signalledLabels[SId];
+        if (not label.empty() and label != signalled) {
+            signalled = std::move(label);
+            myRadioInterface.onServiceLabel(SId, s->serviceLabel);
+        }
+    }
+    pendingServiceLabels.clear();
+
+    for (const uint32_t SId : pendingCompleteServices) {
+        myRadioInterface.onServiceComponentsComplete(SId);
     }
+    pendingCompleteServices.clear();
+
+    if (not ensembleCompleteSignalled and isEnsembleComplete()) {
+        ensembleCompleteSignalled = true;
+        myRadioInterface.onEnsembleComplete(ensembleId);
+    }
+
+    for (const auto& sub : pendingSubchannelChanges) {
+        if (subchannelChanged) {
+            subchannelChanged(sub);
+        }
+    }
+    pendingSubchannelChanges.clear();
+}
+
+bool FIBProcessor::isEnsembleComplete() const
+{
+    if (services.empty() or ensembleLabel.fig1_label.empty() or
+            std::chrono::steady_clock::now() - timeLastServiceChange < ensembleCompleteDelay) {
+        return false;
+    }
+
+    for (const auto& s : services) {
+        if (signalledLabels.count(s.serviceId) == 0 or
+                signalledComponents.count(s.serviceId) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<const EnsembleSnapshot> FIBProcessor::getEnsembleSnapshot() const
+{
+    return std::atomic_load(&snapshot);
+}
+
+std::vector<Service> FIBProcessor::getServiceList() const
+{
+    return getEnsembleSnapshot()->services;
+}
+
+Service FIBProcessor::getService(uint32_t sId) const
+{
+    const auto s = getEnsembleSnapshot();
+    const Service *srv = s->findService(sId);
+    return srv ? *srv : Service(0);
 }
 
 std::list<ServiceComponent> FIBProcessor::getComponents(const Service& s) const
 {
     std::list<ServiceComponent> c;
-    std::lock_guard<std::mutex> lock(mutex);
-    for (const auto& component : components) {
+    for (const auto& component : getEnsembleSnapshot()->components) {
         if (component.SId == s.serviceId) {
             c.push_back(component);
         }
@@ -1309,30 +1642,25 @@ std::list<ServiceComponent> FIBProcessor::getComponents(const Service& s) const
 
 Subchannel FIBProcessor::getSubchannel(const ServiceComponent& sc) const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return subChannels.at(sc.subchannelId);
+    return getEnsembleSnapshot()->subChannels.at(sc.subchannelId);
 }
 
 uint16_t FIBProcessor::getEnsembleId() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return ensembleId;
+    return getEnsembleSnapshot()->ensembleId;
 }
 
 uint8_t FIBProcessor::getEnsembleEcc() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return ensembleEcc;
+    return getEnsembleSnapshot()->ensembleEcc;
 }
 
 DabLabel FIBProcessor::getEnsembleLabel() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return ensembleLabel;
+    return getEnsembleSnapshot()->ensembleLabel;
 }
 
 std::chrono::system_clock::time_point FIBProcessor::getTimeLastFCT0Frame() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
     return timeLastFCT0Frame;
 }
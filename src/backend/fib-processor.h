@@ -28,14 +28,37 @@
 #include <vector>
 #include <list>
 #include <unordered_map>
+#include <unordered_set>
 #include <chrono>
 #include <array>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <cstdint>
 #include <cstdio>
+#include <functional>
 #include "msc-handler.h"
 #include "radio-controller.h"
 
+// Immutable state of the ensemble database. The FIBProcessor publishes a
+// new snapshot whenever a FIB changed the database, so readers never
+// block the FIC decoding and never see a half updated ensemble.
+struct EnsembleSnapshot {
+    uint64_t version = 0;
+    uint16_t ensembleId = 0;
+    uint8_t ensembleEcc = 0;
+    DabLabel ensembleLabel;
+    std::vector<Service> services;
+    std::vector<ServiceComponent> components;
+    std::vector<Subchannel> subChannels;
+
+    // SId -> index into services
+    std::unordered_map<uint32_t, size_t> serviceIndex;
+
+    // Returns nullptr if the service is unknown
+    const Service *findService(uint32_t sId) const;
+};
+
 class FIBProcessor {
     public:
         FIBProcessor(RadioControllerInterface& mr);
@@ -44,7 +67,28 @@ class FIBProcessor {
         void processFIB(uint8_t *p, uint16_t fib);
         void clearEnsemble();
 
-        // Called from the frontend
+        /* Start with the database of an earlier reception of the channel,
+         * so that the services can be selected before the FIC has been
+         * received completely. The live FIGs override the preloaded data:
+         * the first FIG 0/2 of a service replaces the cached bindings of
+         * its components and drops the ones it does not list. When FIG 0/1 signals a subchannel differently than the cache
+         * did, subchannelChanged is called from the decoder thread, so
+         * that a decoder started with the cached parameters can be
+         * reconfigured. A different EId discards the preloaded data. */
+        void preloadEnsemble(const EnsembleSnapshot& cached);
+        using SubchannelChangedCallback = std::function<void(const Subchannel& sub)>;
+        void setSubchannelChangedCallback(SubchannelChangedCallback callback);
+
+        // True once the FIC of the tuned ensemble (FIG 0/0) was received
+        bool isEnsembleReceived() const;
+
+        // True once onEnsembleComplete was called for the tuned ensemble
+        bool isEnsembleCompleteSignalled() const;
+
+        // Called from the frontend, none of them block the decoder.
+        // The snapshot is the cheapest way to access several fields
+        // consistently, it only costs a reference count increment.
+        std::shared_ptr<const EnsembleSnapshot> getEnsembleSnapshot() const;
         uint16_t getEnsembleId() const;
         uint8_t getEnsembleEcc() const;
         DabLabel getEnsembleLabel() const;
@@ -84,8 +128,19 @@ class FIBProcessor {
                 int16_t ps_flag,
                 int16_t CAflag);
 
+        void addComponent(const ServiceComponent& live);
+        void dropPreloadedComponents(uint32_t SId, int16_t numComponents);
         void dropService(uint32_t SId);
 
+        static uint64_t componentKey(uint32_t SId, int16_t compnr);
+        void indexComponent(size_t ix);
+        void rebuildIndex();
+        void resetDatabase();
+        void checkPreloadedSubchannel(const Subchannel& sub);
+        bool isEnsembleComplete() const;
+        void publishSnapshot();
+        void notifyPending();
+
         void process_FIG0(uint8_t *);
         void process_FIG1(uint8_t *);
         void process_FIG2(uint8_t *);
@@ -122,16 +177,57 @@ class FIBProcessor {
 
         bool timeOffsetReceived = false;
         dab_date_time_t dateTime = {};
-        mutable std::mutex mutex;
+
+        // The working copy of the database, only touched by the FIC
+        // decoder (and clearEnsemble) with the mutex held.
+        std::mutex mutex;
         uint16_t ensembleId = 0;
         uint8_t ensembleEcc = 0;
         DabLabel ensembleLabel;
         std::vector<Subchannel> subChannels;
         std::vector<ServiceComponent> components;
         std::vector<Service> services;
+        std::unordered_map<uint32_t, size_t> serviceIndex;
+        std::unordered_map<uint64_t, size_t> componentIndex;
+        std::unordered_map<uint16_t, size_t> packetComponentIndex;
         std::unordered_map<uint32_t, uint8_t> serviceRepeatCount;
         std::chrono::steady_clock::time_point timeLastServiceDecrement;
-        std::chrono::system_clock::time_point timeLastFCT0Frame;
+        std::atomic<std::chrono::system_clock::time_point> timeLastFCT0Frame;
+
+        // Set when the working copy differs from the published snapshot
+        bool changed = false;
+        uint64_t version = 0;
+        std::shared_ptr<const EnsembleSnapshot> snapshot;
+
+        // Notifications are deferred until the snapshot is published,
+        // so that the receivers of the callbacks see the new state.
+        std::vector<uint32_t> pendingDetectedServices;
+        bool pendingNewEnsemble = false;
+        bool pendingEnsembleLabel = false;
+        std::vector<Subchannel> pendingSubchannelChanges;
+        std::vector<uint32_t> pendingServiceLabels;
+        std::vector<uint32_t> pendingCompleteServices;
+
+        // What the readiness callbacks were called for already
+        std::unordered_map<uint32_t, std::string> signalledLabels;
+        std::unordered_set<uint32_t> signalledComponents;
+        std::atomic<bool> ensembleCompleteSignalled = ATOMIC_VAR_INIT(false);
+
+        // The ensemble is complete once no service or component was
+        // added for this long, the FIG 0/2 carousel takes about a second
+        static constexpr std::chrono::seconds ensembleCompleteDelay =
+            std::chrono::seconds(2);
+        std::chrono::steady_clock::time_point timeLastServiceChange;
+
+        // The subchannels of the preloaded ensemble, not yet confirmed
+        // by a FIG 0/1. Empty if nothing was preloaded.
+        std::vector<Subchannel> preloadedSubChannels;
+        // The components of the preloaded ensemble, not yet confirmed by
+        // a FIG 0/2, see componentKey
+        std::unordered_set<uint64_t> preloadedComponents;
+        bool preloaded = false;
+        std::atomic<bool> ensembleReceived = ATOMIC_VAR_INIT(false);
+        SubchannelChangedCallback subchannelChanged;
 };
 
 #endif
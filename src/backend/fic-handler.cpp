@@ -26,6 +26,7 @@
 #include "fic-handler.h"
 #include "msc-handler.h"
 #include "protTables.h"
+#include "tools.h"
 
 //  The 3072 bits of the serial motherword shall be split into
 //  24 blocks of 128 bits each.
@@ -50,25 +51,27 @@ uint8_t PI_X [24] = {
   *     The data is sent through to the fic processor
   */
 FicHandler::FicHandler(RadioControllerInterface& mr) :
-    Viterbi(768),
     fibProcessor(mr),
     myRadioInterface(mr),
-    bitBuffer_out(768),
-    ofdm_input(2304),
-    viterbiBlock(3072 + 24)
+    viterbi(768),
+    ofdm_input(2304)
 {
-    PI_15 = getPCodes(15 - 1);
-    PI_16 = getPCodes(16 - 1);
-    std::vector<uint8_t> shiftRegister(9, 1);
-
-    for (int i = 0; i < 768; i++) {
-        PRBS[i] = shiftRegister[8] ^ shiftRegister[4];
-        for (int j = 8; j > 0; j--) {
-            shiftRegister[j] = shiftRegister[j - 1];
-        }
-
-        shiftRegister[0] = PRBS[i];
+    for (int i = 0; i < maxFicsPerFrame; i++) {
+        ficBytes[i].resize(768 / 8);
+        viterbiBlock[i].resize(3072 + 24);
     }
+
+    /**
+     * a block of 2304 bits is considered to be a codeword
+     * In the first step we have 21 blocks with puncturing according to PI_16
+     * In the second step we have 3 blocks with puncturing according to PI_15
+     * followed by the final block of 24 bits, all (but the last) 128 bit
+     * blocks contain 4 subblocks of 32 bits on which the given puncturing
+     * is applied
+     */
+    depunctureTable.addBlocks(21, getPCodes(16 - 1));
+    depunctureTable.addBlocks(3, getPCodes(15 - 1));
+    depunctureTable.addTail();
 }
 
 /**
@@ -106,7 +109,8 @@ void FicHandler::setBitsperBlock(int16_t b)
  * Note that Mode III is NOT supported
  * 
  * The function is called with a blkno. This should be 1, 2 or 3
- * for each time 2304 bits are in, we call processFicInput
+ * for each time 2304 bits are in, we depuncture them. The codewords
+ * of a frame are complete with block 3, they are deconvolved together.
  */
 void FicHandler::processFicBlock(const softbit_t *data, int16_t blkno)
 {
@@ -119,11 +123,18 @@ void FicHandler::processFicBlock(const softbit_t *data, int16_t blkno)
         for (int i = 0; i < bitsperBlock; i ++) {
             ofdm_input[index ++] = data[i];
             if (index >= 2304) {
-                processFicInput(ofdm_input.data(), ficno);
+                if (ficno < maxFicsPerFrame) {
+                    depunctureFicInput(ofdm_input.data(), ficno);
+                    ficno++;
+                }
                 index = 0;
-                ficno++;
             }
         }
+
+        if (blkno == 3) {
+            processFicInputs(ficno);
+            ficno = 0;
+        }
     }
     else {
         fprintf(stderr, "You should not call ficBlock here\n");
@@ -133,91 +144,85 @@ void FicHandler::processFicBlock(const softbit_t *data, int16_t blkno)
 }
 
 /**
- * \brief processFicInput
+ * \brief depunctureFicInput
  * we have a vector of 2304 (0 .. 2303) soft bits that has
- * to be de-punctured and de-conv-ed into a block of 768 bits
- * In this approach we first create the full 3072 block (i.e.
- * we first depuncture, and then we apply the deconvolution
- * In the next coding step, we will combine this function with the
- * one above
+ * to be de-punctured into the full 3072 block of codeword ficno
+ * (plus the 24 bits of the register). The deconvolution into a
+ * block of 768 bits is done in processFicInputs.
  */
-void FicHandler::processFicInput(const softbit_t *ficblock, int16_t ficno)
+void FicHandler::depunctureFicInput(const softbit_t *ficblock, int16_t ficno)
 {
-    int16_t input_counter = 0;
-    int16_t i, k;
-    int32_t local         = 0;
-
-    memset(viterbiBlock.data(), 0, viterbiBlock.size() * sizeof(*viterbiBlock.data()));
-
-    /**
-     * a block of 2304 bits is considered to be a codeword
-     * In the first step we have 21 blocks with puncturing according to PI_16
-     * each 128 bit block contains 4 subblocks of 32 bits
-     * on which the given puncturing is applied
-     */
-    for (i = 0; i < 21; i ++) {
-        for (k = 0; k < 32 * 4; k ++) {
-            if (PI_16 [k % 32] != 0) {
-                viterbiBlock[local] = ficblock[input_counter ++];
-            }
-            local ++;
-        }
+    depunctureTable.depuncture(ficblock, viterbiBlock[ficno].data());
+    if (tapCodewords) {
+        myRadioInterface.onFicCodeword(viterbiBlock[ficno].data(),
+                viterbiBlock[ficno].size());
     }
+}
 
-    /**
-     * In the second step
-     * we have 3 blocks with puncturing according to PI_15
-     * each 128 bit block contains 4 subblocks of 32 bits
-     * on which the given puncturing is applied
-     */
-    for (i = 0; i < 3; i ++) {
-        for (k = 0; k < 32 * 4; k ++) {
-            if (PI_15 [k % 32] != 0) {
-                viterbiBlock[local] = ficblock[input_counter ++];
-            }
-            local++;
-        }
+/**
+ * \brief processFicInputs
+ * The count codewords of the frame are ready for deconvolution,
+ * deconvolution is according to DAB standard section 11.2
+ * All of them run through the trellis at once.
+ */
+void FicHandler::processFicInputs(int16_t count)
+{
+    if (count == 0) {
+        return;
     }
 
-    /**
-     * we have a final block of 24 bits  with puncturing according to PI_X
-     * This block constitutes the 6 * 4 bits of the register itself.
-     */
-    for (k = 0; k < 24; k ++) {
-        if (PI_X [k] != 0) {
-            viterbiBlock[local] = ficblock[input_counter++];
-        }
-        local ++;
+    const softbit_t *inputs[maxFicsPerFrame] = {};
+    uint8_t *outputs[maxFicsPerFrame] = {};
+    for (int16_t n = 0; n < count; n++) {
+        inputs[n] = viterbiBlock[n].data();
+        outputs[n] = ficBytes[n].data();
     }
+    viterbi.deconvolve(inputs, outputs, count);
 
-    /**
-     * Now we have the full word ready for deconvolution
-     * deconvolution is according to DAB standard section 11.2
-     */
-    deconvolve(viterbiBlock.data(), bitBuffer_out.data());
+    for (int16_t n = 0; n < count; n++) {
+        processFicOutput(ficBytes[n], n);
+    }
+}
 
+void FicHandler::processFicOutput(std::vector<uint8_t>& ficBytes, int16_t ficno)
+{
     /**
      * if everything worked as planned, we now have a
-     * 768 bit vector containing three FIB's
+     * 768 bit (96 byte) vector containing three FIB's
      *
      * first step: energy dispersal according to the DAB standard
-     * We use a predefined vector PRBS
      */
-    for (i = 0; i < 768; i ++) {
-        bitBuffer_out[i] ^= PRBS[i];
-    }
+    energyDispersal.dedisperse(ficBytes);
+    processFibs(ficBytes.data(), ficBytes.size(), ficno);
+}
 
+void FicHandler::processFibs(const uint8_t *fibs, size_t len, int16_t ficno)
+{
     /**
      * each of the fib blocks is protected by a crc
      * (we know that there are three fib blocks each time we are here
      * we keep track of the successrate
+     * The crc is checked on the bytes, the fib processor gets the bits
      */
-    for (i = ficno * 3; i < ficno * 3 + 3; i ++) {
-        uint8_t *p = &bitBuffer_out[(i % 3) * 256];
-        const bool crcvalid = check_CRC_bits(p, 256);
+    for (size_t i = 0; i < len / 32; i ++) {
+        const uint8_t *fib = &fibs[i * 32];
+        const bool crcvalid = CalcCRC::CalcCRC_CRC16_CCITT.Calc(fib, 30) ==
+            ((fib[30] << 8) | fib[31]);
+
+        uint8_t *p = bitBuffer_out;
+        for (int16_t j = 0; j < 256; j ++) {
+            p[j] = (fib[j >> 3] >> (7 - (j & 07))) & 01;
+        }
+
         myRadioInterface.onFIBDecodeSuccess(crcvalid, p);
+        fib_count.fetch_add(1, std::memory_order_relaxed);
+        if (not crcvalid) {
+            fib_crc_errors.fetch_add(1, std::memory_order_relaxed);
+        }
         if (crcvalid) {
-            fibProcessor.processFIB(p, ficno);
+            if (not isRepeatedFib(fib)) {
+                fibProcessor.processFIB(p, ficno);
+            }
 
             if (fic_decode_success_ratio < 10) {
                 fic_decode_success_ratio++;
@@ -227,11 +232,73 @@ void FicHandler::processFicInput(const softbit_t *ficblock, int16_t ficno)
             fic_decode_success_ratio--;
         }
     }
+
+    const auto tap = std::atomic_load(&fibTap);
+    if (tap) {
+        (*tap)(fibs, len);
+    }
+}
+
+void FicHandler::setFibTap(std::shared_ptr<const FibTap> tap)
+{
+    std::atomic_store(&fibTap, std::move(tap));
+}
+
+/**
+ * \brief isRepeatedFib
+ * Checks the FIB (in bytes) against the FIBs recently given to the
+ * FIB processor. FIBs with the dynamic FIG 0/0 (CIF counter) or
+ * FIG 0/10 (date and time) are always processed.
+ */
+bool FicHandler::isRepeatedFib(const uint8_t *fib)
+{
+    if (fibCacheInvalid.exchange(false)) {
+        for (auto& entry : fibCache) {
+            entry = FibCacheEntry();
+        }
+    }
+
+    int16_t offset = 0;
+    while (offset < 30 and fib[offset] != 0xFF) {
+        const uint8_t FIGtype = fib[offset] >> 5;
+        if (FIGtype == 0 and offset + 1 < 30) {
+            const uint8_t extension = fib[offset + 1] & 0x1F;
+            if (extension == 0 or extension == 10) {
+                return false;
+            }
+        }
+        offset += (fib[offset] & 0x1F) + 1;
+    }
+
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    for (int16_t j = 0; j < 30; j ++) {
+        hash = (hash ^ fib[j]) * 0x100000001b3;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    FibCacheEntry& entry = fibCache[hash % fibCacheSize];
+    if (entry.hash == hash and now < entry.lastProcessed + fibRepeatInterval) {
+        return true;
+    }
+
+    entry.hash = hash;
+    entry.lastProcessed = now;
+
+    std::lock_guard<std::mutex> lock(signatureMutex);
+    if (signatureCrcs.size() < maxSignatureCrcs) {
+        signatureCrcs.insert((fib[30] << 8) | fib[31]);
+    }
+    return false;
 }
 
 void FicHandler::clearEnsemble()
 {
     fibProcessor.clearEnsemble();
+    fibCacheInvalid = true;
+
+    std::lock_guard<std::mutex> lock(signatureMutex);
+    signatureCrcs.clear();
 }
 
 int FicHandler::getFicDecodeRatioPercent()
@@ -239,3 +306,19 @@ int FicHandler::getFicDecodeRatioPercent()
     return fic_decode_success_ratio * 10;
 }
 
+uint64_t FicHandler::getFibCount() const
+{
+    return fib_count.load(std::memory_order_relaxed);
+}
+
+uint64_t FicHandler::getFibCrcErrors() const
+{
+    return fib_crc_errors.load(std::memory_order_relaxed);
+}
+
+std::vector<uint16_t> FicHandler::getFibSignature() const
+{
+    std::lock_guard<std::mutex> lock(signatureMutex);
+    return std::vector<uint16_t>(signatureCrcs.begin(), signatureCrcs.end());
+}
+
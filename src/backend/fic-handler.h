@@ -28,14 +28,22 @@
 #ifndef __FIC_HANDLER
 #define __FIC_HANDLER
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <vector>
 #include <cstdio>
 #include <cstdint>
 #include "viterbi.h"
+#include "protection.h"
+#include "energy_dispersal.h"
 #include "fib-processor.h"
 #include "radio-controller.h"
 
-class FicHandler: public Viterbi
+class FicHandler
 {
     public:
         FicHandler(RadioControllerInterface& mr);
@@ -44,24 +52,80 @@ class FicHandler: public Viterbi
         void    clearEnsemble();
         int     getFicDecodeRatioPercent();
 
+        /* Hand the depunctured codewords to onFicCodeword. Set by the
+         * OfdmDecoder for every frame, from the thread that calls
+         * processFicBlock. */
+        void    setSoftBitTap(bool enable) { tapCodewords = enable; }
+
+        /* Called with the three FIBs of every CIF once they went to the
+         * FIBProcessor, whatever their CRCs, from the thread that calls
+         * processFicBlock. Set from any thread, nullptr removes it. */
+        using FibTap = std::function<void(const uint8_t *fibs, size_t len)>;
+        void    setFibTap(std::shared_ptr<const FibTap> tap);
+
+        /* FIBs decoded elsewhere, e.g. taken from an ETI stream, len / 32
+         * of them. They are checked and processed like the ones of
+         * processFicBlock, ficno is the FIC of the frame they belong to. */
+        void    processFibs(const uint8_t *fibs, size_t len, int16_t ficno);
+
+        // FIBs received so far, and the ones with a CRC error among them
+        uint64_t getFibCount(void) const;
+        uint64_t getFibCrcErrors(void) const;
+
+        /* The CRCs of the static FIBs received since clearEnsemble(), as
+         * opposed to the ones with FIG 0/0 or FIG 0/10, which change all
+         * the time. With the EId they identify the multiplex
+         * configuration, one frame of it usually repeats some of them. */
+        std::vector<uint16_t> getFibSignature(void) const;
+
         FIBProcessor fibProcessor;
 
     private:
         RadioControllerInterface& myRadioInterface;
-        void        processFicInput(const softbit_t *ficblock, int16_t ficno);
-        const int8_t *PI_15;
-        const int8_t *PI_16;
-        std::vector<uint8_t> bitBuffer_out;
+        void        depunctureFicInput(const softbit_t *ficblock, int16_t ficno);
+        void        processFicInputs(int16_t count);
+        void        processFicOutput(std::vector<uint8_t>& ficBytes, int16_t ficno);
+        bool        isRepeatedFib(const uint8_t *fib);
+        // Mode I gives four FIC codewords per frame
+        static const int maxFicsPerFrame = 4;
+        ViterbiBatch viterbi;
+        DepunctureTable depunctureTable;
+        EnergyDispersal energyDispersal;
+        std::vector<uint8_t> ficBytes[maxFicsPerFrame];
+        uint8_t     bitBuffer_out[256];
         std::vector<softbit_t> ofdm_input;
-        std::vector<softbit_t> viterbiBlock;
+        std::vector<softbit_t> viterbiBlock[maxFicsPerFrame];
         int16_t     index = 0;
         int16_t     bitsperBlock = 2 * 1536;
         int16_t     ficno = 0;
-        uint8_t     PRBS[768];
+        bool        tapCodewords = false;
+        std::shared_ptr<const FibTap> fibTap;
+
+        // Most FIBs repeat the same FIGs of the carousel over and over.
+        // A FIB seen within fibRepeatInterval is not parsed again. The
+        // interval is well below the one second the FIBProcessor needs
+        // to see a service again before it drops it.
+        struct FibCacheEntry {
+            uint64_t hash = 0;
+            std::chrono::steady_clock::time_point lastProcessed;
+        };
+        static const int fibCacheSize = 64;
+        static constexpr std::chrono::milliseconds fibRepeatInterval =
+            std::chrono::milliseconds(250);
+        FibCacheEntry fibCache[fibCacheSize];
+        std::atomic<bool> fibCacheInvalid = ATOMIC_VAR_INIT(false);
+
+        // Added to whenever a static FIB is processed
+        static const size_t maxSignatureCrcs = 1024;
+        mutable std::mutex signatureMutex;
+        std::set<uint16_t> signatureCrcs;
 
         // Saturating up/down-counter in range [0, 10] corresponding
         // to the number of FICs with correct CRC
         int         fic_decode_success_ratio = 0;
+
+        std::atomic<uint64_t> fib_count = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> fib_crc_errors = ATOMIC_VAR_INIT(0);
 };
 
 #endif
@@ -24,6 +24,7 @@
 #include    <stdint.h>
 #include    <stdio.h>
 #include    "freq-interleaver.h"
+#include    "mode-i.h"
 
 /**
   * \brief createMapper
@@ -81,6 +82,18 @@ FrequencyInterleaver::FrequencyInterleaver(const DABParams& param)
                     255, 128, 128 + param.K);
             break;
     }
+
+    if (param.dabMode == 1) {
+        // The same, computed at compile time
+        gather.assign(modeI::gatherTable.begin(), modeI::gatherTable.end());
+        return;
+    }
+
+    gather.resize(param.K);
+    for (int16_t i = 0; i < param.K; i++) {
+        const int16_t index = permTable[i];
+        gather[i] = index < 0 ? index + param.T_u : index;
+    }
 }
 
 //  according to the standard, the map is a function from
@@ -25,10 +25,37 @@
 
 #ifndef __FREQ_INTERLEAVER__
 #define __FREQ_INTERLEAVER__
+#include <array>
 #include <cstdint>
 #include <vector>
 #include "dab-constants.h"
 
+/* FrequencyInterleaver::gatherTable() of the mode with FFT size T_u and
+ * K carriers, computed at compile time. The parameters of section 14.6
+ * follow from T_u and K in all modes. */
+template<int16_t T_u, int16_t K>
+constexpr std::array<int32_t, K> frequencyInterleaverGatherTable()
+{
+    constexpr int32_t V1 = T_u / 4 - 1;
+    constexpr int32_t lwb = (T_u - K) / 2;
+    constexpr int32_t upb = lwb + K;
+
+    std::array<int32_t, K> gather{};
+    size_t index = 0;
+    int32_t pi = 0;
+    for (int32_t i = 0; i < T_u; i++) {
+        if (i > 0) {
+            pi = (13 * pi + V1) % T_u;
+        }
+        if (pi == T_u / 2 or pi < lwb or pi > upb) {
+            continue;
+        }
+        const int32_t k = pi - T_u / 2;
+        gather[index++] = k < 0 ? k + T_u : k;
+    }
+    return gather;
+}
+
 /**
  * \class FrequencyInterleaver
  * Implements frequency interleaving according to section 14.6
@@ -40,8 +67,14 @@ class FrequencyInterleaver
         FrequencyInterleaver(const DABParams& param);
         int16_t mapIn(int16_t);
 
+        /* mapIn() for all K carriers, already converted to the index of
+         * the bin in the (not shifted) FFT output, i.e. in 0 .. T_u - 1.
+         * Carrier i of the de-interleaved symbol is bin gatherTable()[i]. */
+        const int32_t *gatherTable() const { return gather.data(); }
+
     private:
         std::vector<int16_t> permTable;
+        std::vector<int32_t> gather;
 };
 
 #endif
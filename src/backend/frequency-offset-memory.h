@@ -0,0 +1,91 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef FREQUENCY_OFFSET_MEMORY_H
+#define FREQUENCY_OFFSET_MEMORY_H
+
+#include <cmath>
+#include <cstdint>
+#include <map>
+
+/* The frequency corrections a receiver locked to, per channel, to start
+ * the next reception of the same device where the last one ended,
+ * instead of searching for the offset again.
+ * Most of the offset is the error of the tuner crystal, which is stable
+ * and proportional to the frequency. A channel that was never received
+ * starts at the error of the last locked one, scaled to its frequency.
+ * The known channels keep their own values, which also covers the
+ * temperature drift between them. */
+class FrequencyOffsetMemory {
+    public:
+        // carrierDiff of the transmission mode, the step of the coarse corrector
+        explicit FrequencyOffsetMemory(int32_t carrierDiff) :
+            carrierDiff(carrierDiff) {}
+
+        void store(int frequency, int32_t coarse, int16_t fine)
+        {
+            if (frequency <= 0) {
+                return;
+            }
+            perChannel[frequency] = { coarse, fine };
+            ppm = 1e6 * (coarse + fine) / frequency;
+            havePpm = true;
+        }
+
+        // Returns false as long as nothing is known about the device
+        bool lookup(int frequency, int32_t& coarse, int16_t& fine) const
+        {
+            const auto it = perChannel.find(frequency);
+            if (it != perChannel.end()) {
+                coarse = it->second.coarse;
+                fine = it->second.fine;
+                return true;
+            }
+
+            if (not havePpm or frequency <= 0) {
+                return false;
+            }
+
+            const int32_t offset = std::lround(ppm * frequency / 1e6);
+            coarse = std::lround((double)offset / carrierDiff) * carrierDiff;
+            fine = offset - coarse;
+            return true;
+        }
+
+    private:
+        struct Correctors {
+            int32_t coarse;
+            int16_t fine;
+        };
+
+        const int32_t carrierDiff;
+        std::map<int, Correctors> perChannel;
+
+        // Of the last stored channel
+        double ppm = 0;
+        bool havePpm = false;
+};
+
+#endif // FREQUENCY_OFFSET_MEMORY_H
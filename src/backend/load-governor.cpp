@@ -0,0 +1,72 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "load-governor.h"
+
+bool LoadGovernor::update(float load)
+{
+    if (load > highLoad) {
+        lowFrames = 0;
+        if (++highFrames >= degradeFrames and current < maxLevel) {
+            current = static_cast<Level>(static_cast<int>(current) + 1);
+            highFrames = 0;
+            return true;
+        }
+    }
+    else if (load < lowLoad) {
+        highFrames = 0;
+        if (++lowFrames >= restoreFrames and current > Level::Full) {
+            current = static_cast<Level>(static_cast<int>(current) - 1);
+            lowFrames = 0;
+            return true;
+        }
+    }
+    else {
+        // In between, the current level is just right
+        highFrames = 0;
+        lowFrames = 0;
+    }
+    return false;
+}
+
+void LoadGovernor::reset()
+{
+    current = Level::Full;
+    highFrames = 0;
+    lowFrames = 0;
+}
+
+const char *LoadGovernor::levelName(Level l)
+{
+    switch (l) {
+        case Level::Full: return "full";
+        case Level::NoTII: return "no TII";
+        case Level::NoDiagnostics: return "no diagnostics";
+        case Level::ReducedSNR: return "reduced SNR";
+        case Level::NoBackgroundSlideshow: return "no background slideshow";
+        case Level::NoWarmStandby: return "no warm standby";
+    }
+    return "unknown";
+}
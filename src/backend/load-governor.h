@@ -0,0 +1,75 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef LOAD_GOVERNOR_H
+#define LOAD_GOVERNOR_H
+
+#include <cstdint>
+
+/* Decides how much of the optional processing the receiver can afford.
+ * It is fed the decode load of every frame, see
+ * OfdmDecoder::getDecodeLoad, and gives up one extra after the other while
+ * the load stays high, in the order of the levels below. Once the load
+ * has been low for a while, the extras come back one by one, the last one
+ * given up first. Audio is never touched. Only used by the thread of the
+ * OFDMProcessor. */
+class LoadGovernor
+{
+    public:
+        enum class Level {
+            Full = 0,
+            NoTII,                  // the TII decoder is not fed
+            NoDiagnostics,          // no constellation, impulse response, null symbol
+            ReducedSNR,             // the SNR is estimated every snrInterval frames
+            NoBackgroundSlideshow,  // only the foreground services decode the MOT
+            NoWarmStandby,          // removed services are not kept decoding
+        };
+        static const Level maxLevel = Level::NoWarmStandby;
+
+        // Above highLoad for degradeFrames frames in a row, one step
+        // down. Below lowLoad for restoreFrames frames, one step up.
+        static constexpr float highLoad = 0.85f;
+        static constexpr float lowLoad = 0.5f;
+        static const int degradeFrames = 10;
+        static const int restoreFrames = 100;
+
+        static const int snrInterval = 8;
+
+        // Returns true when the level changed
+        bool update(float load);
+        void reset(void);
+
+        Level level(void) const { return current; }
+        bool atLeast(Level l) const { return current >= l; }
+
+        static const char *levelName(Level l);
+
+    private:
+        Level current = Level::Full;
+        int highFrames = 0;
+        int lowFrames = 0;
+};
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef MODE_I_H
+#define MODE_I_H
+
+#include <array>
+#include <complex>
+#include <cstdint>
+#include "freq-interleaver.h"
+#include "phasetable.h"
+
+/* Transmission mode I, the only mode in use, with everything known at
+ * compile time. The modes II to IV go through the run time DABParams. */
+namespace modeI {
+
+constexpr int16_t L = 76;
+constexpr int16_t K = 1536;
+constexpr int16_t T_null = 2656;
+constexpr int32_t T_F = 196608;
+constexpr int16_t T_s = 2552;
+constexpr int16_t T_u = 2048;
+constexpr int16_t guardLength = T_s - T_u;
+constexpr int16_t carrierDiff = 1000;
+
+// Carrier i of the de-interleaved symbol is FFT bin gatherTable[i]
+inline constexpr std::array<int32_t, K> gatherTable =
+    frequencyInterleaverGatherTable<T_u, K>();
+
+/* The carriers of the phase reference symbol by FFT bin, all of them
+ * are one of 1, j, -1 and -j. Unused bins are 0. */
+constexpr std::array<std::complex<float>, T_u> makePrsCarriers()
+{
+    std::array<std::complex<float>, T_u> prs{};
+    const std::complex<float> quadrants[4] = { {1, 0}, {0, 1}, {-1, 0}, {0, -1} };
+    for (int32_t k = 1; k <= K / 2; k++) {
+        prs[k] = quadrants[phaseTableQuadrant(modeI_table, k) % 4];
+        prs[T_u - k] = quadrants[phaseTableQuadrant(modeI_table, -k) % 4];
+    }
+    return prs;
+}
+
+inline constexpr std::array<std::complex<float>, T_u> prsCarriers = makePrsCarriers();
+
+} // namespace modeI
+
+#endif // MODE_I_H
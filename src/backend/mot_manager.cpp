@@ -17,6 +17,7 @@
  */
 
 #include <string>
+#include <algorithm>
 #include <iostream>
 #include "mot_manager.h"
 
@@ -26,12 +27,44 @@ void MOTEntity::AddSeg(int seg_number, bool last_seg, const uint8_t* data, size_
 	if(last_seg)
 		last_seg_number = seg_number;
 
-	if(segs.find(seg_number) != segs.end())
+	if((size_t) seg_number < received.size() && received[seg_number])
 		return;
 
-	// copy data
-	segs[seg_number] = seg_t(len);
-	memcpy(&segs[seg_number][0], data, len);
+	if(!last_seg && seg_size && len != seg_size) {
+		// the entity changed, start anew
+		Reset();
+		return AddSeg(seg_number, last_seg, data, len);
+	}
+
+	if(!seg_size) {
+		if(last_seg && seg_number > 0) {
+			// offset unknown until another segment arrives
+			pending_last_seg.assign(data, data + len);
+			return;
+		}
+		seg_size = len;
+	}
+
+	Store(seg_number, data, len);
+
+	if(!pending_last_seg.empty()) {
+		Store(last_seg_number, &pending_last_seg[0], pending_last_seg.size());
+		pending_last_seg.clear();
+	}
+}
+
+void MOTEntity::Store(int seg_number, const uint8_t* seg_data, size_t len) {
+	const size_t offset = seg_number * seg_size;
+	if(offset + len > MAX_SIZE)
+		return;
+	if(data.size() < offset + len)
+		data.resize(offset + len);
+	memcpy(&data[offset], seg_data, len);
+
+	if(received.size() <= (size_t) seg_number)
+		received.resize(seg_number + 1);
+	received[seg_number] = true;
+	received_segs++;
 	size += len;
 }
 
@@ -40,24 +73,7 @@ bool MOTEntity::IsFinished() {
 		return false;
 
 	// check if all segments are available
-	for(int i = 0; i <= last_seg_number; i++)
-		if(segs.find(i) == segs.end())
-			return false;
-	return true;
-}
-
-std::vector<uint8_t> MOTEntity::GetData() {
-	std::vector<uint8_t> result(size);
-	size_t offset = 0;
-
-	// concatenate all segments
-	for(int i = 0; i <= last_seg_number; i++) {
-		seg_t& seg = segs[i];
-		memcpy(&result[offset], &seg[0], seg.size());
-		offset += seg.size();
-	}
-
-	return result;
+	return received_segs == (size_t) last_seg_number + 1;
 }
 
 
@@ -68,7 +84,7 @@ void MOTObject::AddSeg(bool dg_type_header, int seg_number, bool last_seg, const
 
 bool MOTObject::ParseCheckHeader(MOT_FILE& target_file) {
 	MOT_FILE file = target_file;
-	std::vector<uint8_t> data = header.GetData();
+	const std::vector<uint8_t>& data = header.GetData();
 
 	// parse/check header core
 	if(data.size() < 7)
@@ -178,6 +194,7 @@ bool MOTObject::ParseCheckHeader(MOT_FILE& target_file) {
 	if(!header_update) {
 		// ensure actual header is processed only once
 		header_received = true;
+		body.Reserve(file.body_size);
 	} else {
 		// ensure matching content name
 		if(new_content_name != old_content_name)
@@ -211,7 +228,7 @@ bool MOTObject::IsToBeShown() {
 		return false;
 
 	// add body data
-	result_file.data = body.GetData();
+	result_file.data = body.TakeData();
 
 	shown = true;
 	return true;
@@ -224,11 +241,31 @@ MOTManager::MOTManager() {
 }
 
 void MOTManager::Reset() {
-	object = MOTObject();
-	current_transport_id = -1;
+	objects.clear();
+	use_counter = 0;
+	finished_file = MOT_FILE();
+}
+
+MOTObject& MOTManager::GetObject(int transport_id) {
+	use_counter++;
+	for(TransportObject& entry : objects) {
+		if(entry.transport_id == transport_id) {
+			entry.last_used = use_counter;
+			return entry.object;
+		}
+	}
+
+	// replace the least recently used object, if needed
+	if(objects.size() == MAX_OBJECTS) {
+		auto lru = std::min_element(objects.begin(), objects.end(),
+				[](const TransportObject& a, const TransportObject& b) {return a.last_used < b.last_used;});
+		objects.erase(lru);
+	}
+	objects.push_back(TransportObject {transport_id, use_counter, MOTObject()});
+	return objects.back().object;
 }
 
-bool MOTManager::ParseCheckDataGroupHeader(const std::vector<uint8_t>& dg, size_t& offset, int& dg_type) {
+bool MOTManager::ParseCheckDataGroupHeader(const DG_SPAN& dg, size_t& offset, int& dg_type) {
 	// parse/check Data Group header
 	if(dg.size() < (offset + 2))
 		return false;
@@ -252,7 +289,7 @@ bool MOTManager::ParseCheckDataGroupHeader(const std::vector<uint8_t>& dg, size_
 	return true;
 }
 
-bool MOTManager::ParseCheckSessionHeader(const std::vector<uint8_t>& dg, size_t& offset, bool& last_seg, int& seg_number, int& transport_id) {
+bool MOTManager::ParseCheckSessionHeader(const DG_SPAN& dg, size_t& offset, bool& last_seg, int& seg_number, int& transport_id) {
 	// parse/check session header
 	if(dg.size() < (offset + 3))
 		return false;
@@ -278,7 +315,7 @@ bool MOTManager::ParseCheckSessionHeader(const std::vector<uint8_t>& dg, size_t&
 	return true;
 }
 
-bool MOTManager::ParseCheckSegmentationHeader(const std::vector<uint8_t>& dg, size_t& offset, size_t& seg_size) {
+bool MOTManager::ParseCheckSegmentationHeader(const DG_SPAN& dg, size_t& offset, size_t& seg_size) {
 	// parse/check segmentation header (MOT)
 	if(dg.size() < (offset + 2))
 		return false;
@@ -293,7 +330,7 @@ bool MOTManager::ParseCheckSegmentationHeader(const std::vector<uint8_t>& dg, si
 	return true;
 }
 
-bool MOTManager::HandleMOTDataGroup(const std::vector<uint8_t>& dg) {
+bool MOTManager::HandleMOTDataGroup(const DG_SPAN& dg) {
 	size_t offset = 0;
 
 	// parse/check headers
@@ -311,15 +348,14 @@ bool MOTManager::HandleMOTDataGroup(const std::vector<uint8_t>& dg) {
 		return false;
 
 
-	// add segment to MOT object (reset if necessary)
-	if(current_transport_id != transport_id) {
-		current_transport_id = transport_id;
-		object = MOTObject();
-	}
+	// add segment to the MOT object of the transport ID
+	MOTObject& object = GetObject(transport_id);
 	object.AddSeg(dg_type == 3, seg_number, last_seg, &dg[offset], seg_size);
 
 	// check if object shall be shown
 	bool display = object.IsToBeShown();
+	if(display)
+		finished_file = object.TakeFile();
 //	fprintf(stderr, "dg_type: %d, seg_number: %2d%s, transport_id: %5d, size: %4zu; display: %s\n",
 //			dg_type, seg_number, last_seg ? " (LAST)" : "", transport_id, seg_size, display ? "true" : "false");
 
@@ -30,6 +30,19 @@
 #include "tools.h"
 
 
+// --- DG_SPAN -----------------------------------------------------------------
+// non-owning view of a data group, which stays in the decoder's buffer
+struct DG_SPAN {
+	const uint8_t *data;
+	size_t len;
+
+	DG_SPAN(const uint8_t *data, size_t len) : data(data), len(len) {}
+
+	size_t size() const {return len;}
+	const uint8_t& operator[](size_t i) const {return data[i];}
+};
+
+
 // --- MOT_FILE -----------------------------------------------------------------
 struct MOT_FILE {
 	std::vector<uint8_t> data;
@@ -64,27 +77,43 @@ struct MOT_FILE {
 };
 
 
-typedef std::vector<uint8_t> seg_t;
-typedef std::map<int,seg_t> segs_t;
-
 // --- MOTEntity -----------------------------------------------------------------
+/*	All segments of an entity but the last one have the same size (EN 301 234,
+ *	5.1), so each segment is copied straight to its final position. A last
+ *	segment received before the segment size is known is kept aside.
+ */
 class MOTEntity {
 private:
-	segs_t segs;
+	// far beyond any slide, against runaway segment numbers
+	static const size_t MAX_SIZE = 16 * 1024 * 1024;
+
+	std::vector<uint8_t> data;
+	std::vector<bool> received;
+	size_t seg_size;
 	int last_seg_number;
+	size_t received_segs;
 	size_t size;
+	std::vector<uint8_t> pending_last_seg;
+
+	void Store(int seg_number, const uint8_t* seg_data, size_t len);
 public:
 	MOTEntity() {Reset();}
 	void Reset() {
-		segs.clear();
+		data.clear();
+		received.clear();
+		seg_size = 0;
 		last_seg_number = -1;
+		received_segs = 0;
 		size = 0;
+		pending_last_seg.clear();
 	}
 
+	void Reserve(size_t total_size) {data.reserve(total_size);}
 	void AddSeg(int seg_number, bool last_seg, const uint8_t* data, size_t len);
 	bool IsFinished();
 	size_t GetSize() {return size;}
-	std::vector<uint8_t> GetData();
+	const std::vector<uint8_t>& GetData() const {return data;}
+	std::vector<uint8_t> TakeData() {return std::move(data);}
 };
 
 
@@ -104,25 +133,35 @@ public:
 
 	void AddSeg(bool dg_type_header, int seg_number, bool last_seg, const uint8_t* data, size_t len);
 	bool IsToBeShown();
-	MOT_FILE GetFile() {return result_file;}
+	MOT_FILE TakeFile() {return std::move(result_file);}
 };
 
 
 // --- MOTManager -----------------------------------------------------------------
 class MOTManager {
 private:
-	MOTObject object;
-	int current_transport_id;
-
-	bool ParseCheckDataGroupHeader(const std::vector<uint8_t>& dg, size_t& offset, int& dg_type);
-	bool ParseCheckSessionHeader(const std::vector<uint8_t>& dg, size_t& offset, bool& last_seg, int& seg_number, int& transport_id);
-	bool ParseCheckSegmentationHeader(const std::vector<uint8_t>& dg, size_t& offset, size_t& seg_size);
+	// Carousels may interleave the segments of several objects
+	static const size_t MAX_OBJECTS = 4;
+	struct TransportObject {
+		int transport_id;
+		uint64_t last_used;
+		MOTObject object;
+	};
+	std::vector<TransportObject> objects;
+	uint64_t use_counter;
+	MOT_FILE finished_file;
+
+	MOTObject& GetObject(int transport_id);
+
+	bool ParseCheckDataGroupHeader(const DG_SPAN& dg, size_t& offset, int& dg_type);
+	bool ParseCheckSessionHeader(const DG_SPAN& dg, size_t& offset, bool& last_seg, int& seg_number, int& transport_id);
+	bool ParseCheckSegmentationHeader(const DG_SPAN& dg, size_t& offset, size_t& seg_size);
 public:
 	MOTManager();
 
 	void Reset();
-	bool HandleMOTDataGroup(const std::vector<uint8_t>& dg);
-	MOT_FILE GetFile() {return object.GetFile();}
+	bool HandleMOTDataGroup(const DG_SPAN& dg);
+	MOT_FILE TakeFile() {return std::move(finished_file);}
 };
 
 #endif /* MOT_MANAGER_H_ */
@@ -22,8 +22,12 @@
  *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 #include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
 #include "dab-constants.h"
 #include "msc-handler.h"
+#include "eti-multiplexer.h"
 #include "dab-virtual.h"
 #include "dab-audio.h"
 
@@ -39,6 +43,8 @@ MscHandler::MscHandler(
         const DABParams& p,
         bool show_crcErrors) :
     bitsperBlock(2 * p.K),
+    T_u(p.T_u),
+    T_s(p.T_s),
     show_crcErrors(show_crcErrors),
     cifVector(864 * CUSize)
 {
@@ -56,6 +62,12 @@ MscHandler::MscHandler(
                 numberofblocksperCIF = 18;
         }
     }
+
+    receivedBlocks.resize(numberofblocksperCIF);
+
+    auto streams = std::make_shared<StreamSet>();
+    streams->activeBlocks.resize(numberofblocksperCIF);
+    currentStreams = streams;
 }
 
 bool MscHandler::addSubchannel(
@@ -63,27 +75,106 @@ bool MscHandler::addSubchannel(
         AudioServiceComponentType ascty,
         const std::string& dumpFileName,
         const Subchannel& sub,
-        bool decodeAudio)
+        bool decodeAudio,
+        OverflowPolicy overflow)
 {
     std::lock_guard<std::mutex> lock(mutex);
 
+    auto streams = copyStreams();
+    bool changed = expireStandby(*streams);
+    bool pinned = false;
+
     // check not already in list
-    for (const auto& stream : streams) {
-        if (stream.subCh.subChId == sub.subChId) {
+    for (auto it = streams->streams.begin(); it != streams->streams.end(); ++it) {
+        auto& stream = *it;
+        if (stream->subCh.subChId != sub.subChId) {
+            continue;
+        }
+
+        if (not stream->standby) {
+            // Decoded for another handler already, this one observes it
+            if (not stream->router.isAttached(handler)) {
+                if (stream->router.attached() == nullptr) {
+                    stream->router.attach(&handler);
+                }
+                else {
+                    stream->router.addObserver(handler);
+                }
+                applySlideshow(*stream);
+            }
+            if (changed) {
+                publishStreams(std::move(streams));
+            }
             return true;
         }
+
+        const bool sameDecoding =
+            stream->audioType == ascty and
+            stream->decodeAudio == decodeAudio and
+            stream->floatAudio == handler.wantsFloatAudio() and
+            stream->subCh.startAddr == sub.startAddr and
+            stream->subCh.length == sub.length and
+            stream->subCh.bitrate() == sub.bitrate() and
+            stream->subCh.protection() == sub.protection();
+
+        if (sameDecoding) {
+            // Hand the running decoder over to the new handler
+            stream->router.attach(&handler);
+            applySlideshow(*stream);
+            stream->dabHandler->setStandby(false);
+            stream->standby = false;
+            if (changed) {
+                publishStreams(std::move(streams));
+            }
+            return true;
+        }
+
+        // The subchannel was reconfigured, or is decoded differently
+        pinned = stream->pinned;
+        streams->streams.erase(it);
+        break;
     }
 
-    SelectedStream s(handler, ascty, dumpFileName, sub);
+    streams->streams.push_back(
+            createStream(&handler, ascty, dumpFileName, sub, decodeAudio, overflow));
+    streams->streams.back()->pinned = pinned;
+    // The new decoder may push the standby ones out of the budget
+    expireStandby(*streams);
+    publishStreams(std::move(streams));
+    return true;
+}
+
+std::shared_ptr<MscHandler::SelectedStream> MscHandler::createStream(
+        ProgrammeHandlerInterface *handler,
+        AudioServiceComponentType ascty,
+        const std::string& dumpFileName,
+        const Subchannel& sub,
+        bool decodeAudio,
+        OverflowPolicy overflow)
+{
+    auto s = std::make_shared<SelectedStream>(*this, handler, ascty, dumpFileName, sub, decodeAudio, overflow);
+
+    if (memoryBudget > 0) {
+        overflow.queuedFragments = std::min(overflow.queuedFragments, budgetQueuedFragments);
+    }
 
-    s.dabHandler = std::make_shared<DabAudio>(
+    s->dabHandler = std::make_shared<DabAudio>(
                 ascty,
                 sub.length * CUSize,
                 sub.bitrate(),
                 sub.protectionSettings,
-                handler,
+                s->router,
                 dumpFileName,
-                decodeAudio);
+                decodeAudio,
+                overflow,
+                counters,
+                packedSoftbits);
+    if (handler == nullptr) {
+        s->dabHandler->setStandby(true);
+        s->standby = true;
+        s->standbySince = std::chrono::steady_clock::now();
+    }
+    applySlideshow(*s);
 
      /* TODO dealing with data
       s.dabHandler = std::make_shared<DabData>(radioInterface,
@@ -98,27 +189,247 @@ bool MscHandler::addSubchannel(
                                   show_crcErrors);
       */
 
-    streams.push_back(std::move(s));
+    return s;
+}
+
+bool MscHandler::removeSubchannel(const Subchannel& sub)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto streams = copyStreams();
+    auto it = std::find_if(streams->streams.begin(), streams->streams.end(),
+            [&](const std::shared_ptr<SelectedStream>& stream) {
+                return stream->subCh.subChId == sub.subChId;
+            } );
 
-    work_to_be_done = true;
+    if (it == streams->streams.end()) {
+        return false;
+    }
+
+    removeStream(std::move(streams), it);
     return true;
 }
 
-bool MscHandler::removeSubchannel(const Subchannel& sub)
+bool MscHandler::removeSubchannel(const Subchannel& sub, ProgrammeHandlerInterface& handler)
 {
     std::lock_guard<std::mutex> lock(mutex);
 
-    auto it = std::find_if(streams.begin(), streams.end(),
-            [&](const SelectedStream& stream) {
-                return stream.subCh.subChId == sub.subChId;
+    auto streams = copyStreams();
+    auto it = std::find_if(streams->streams.begin(), streams->streams.end(),
+            [&](const std::shared_ptr<SelectedStream>& stream) {
+                return stream->subCh.subChId == sub.subChId;
             } );
 
-    if (it != streams.end()) {
-        streams.erase(it);
+    if (it == streams->streams.end() or not (*it)->router.isAttached(handler)) {
+        return false;
+    }
+
+    SelectedStream& stream = **it;
+    if (stream.router.removeObserver(handler)) {
+        applySlideshow(stream);
         return true;
     }
 
-    return false;
+    // The first handler leaves, the observers keep the decoder
+    if (stream.router.hasObservers()) {
+        stream.router.attach(nullptr);
+        applySlideshow(stream);
+        return true;
+    }
+
+    removeStream(std::move(streams), it);
+    return true;
+}
+
+//  called with the mutex held, with the set the stream is part of
+void MscHandler::removeStream(std::shared_ptr<StreamSet> streams,
+        std::vector<std::shared_ptr<SelectedStream>>::iterator it)
+{
+    if (standbyStreams() > 0 or (*it)->pinned) {
+        SelectedStream& stream = **it;
+        stream.router.attach(nullptr);
+        stream.router.removeObservers();
+        stream.dabHandler->setStandby(true);
+        stream.standby = true;
+        stream.standbySince = std::chrono::steady_clock::now();
+
+        if (expireStandby(*streams)) {
+            publishStreams(std::move(streams));
+        }
+    }
+    else {
+        streams->streams.erase(it);
+        publishStreams(std::move(streams));
+    }
+}
+
+void MscHandler::updateSubchannel(const Subchannel& sub)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto streams = copyStreams();
+    bool changed = false;
+    for (auto it = streams->streams.begin(); it != streams->streams.end(); ++it) {
+        auto& stream = *it;
+        if (stream->subCh.subChId != sub.subChId) {
+            continue;
+        }
+
+        ProgrammeHandlerInterface *handler = stream->router.attached();
+        const bool observed = stream->router.hasObservers();
+        if (stream->standby and stream->pinned) {
+            stream = createStream(nullptr, stream->audioType,
+                    stream->dumpFileName, sub, stream->decodeAudio,
+                    stream->overflow);
+            stream->pinned = true;
+        }
+        else if (stream->standby or (handler == nullptr and not observed)) {
+            streams->streams.erase(it);
+        }
+        else {
+            std::clog << "MSC: subchannel " << sub.subChId <<
+                " reconfigured, restarting its decoder" << std::endl;
+            const bool pinned = stream->pinned;
+            auto restarted = createStream(handler, stream->audioType,
+                    stream->dumpFileName, sub, stream->decodeAudio,
+                    stream->overflow);
+            restarted->router.takeObservers(stream->router);
+            if (handler == nullptr) {
+                // Observed only, createStream took it for a standby one
+                restarted->dabHandler->setStandby(false);
+                restarted->standby = false;
+            }
+            applySlideshow(*restarted);
+            restarted->pinned = pinned;
+            stream = restarted;
+        }
+        changed = true;
+        break;
+    }
+
+    if (changed) {
+        publishStreams(std::move(streams));
+    }
+}
+
+void MscHandler::setWarmStandby(size_t maxStreams, std::chrono::seconds timeout)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    maxStandbyStreams = maxStreams;
+    standbyTimeout = timeout;
+
+    auto streams = copyStreams();
+    if (expireStandby(*streams)) {
+        publishStreams(std::move(streams));
+    }
+}
+
+void MscHandler::setBackgroundSlideshow(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (backgroundSlideshow == enabled) {
+        return;
+    }
+    backgroundSlideshow = enabled;
+    for (const auto& stream : currentStreams->streams) {
+        applySlideshow(*stream);
+    }
+}
+
+void MscHandler::updateForeground()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& stream : currentStreams->streams) {
+        applySlideshow(*stream);
+    }
+}
+
+void MscHandler::applySlideshow(SelectedStream& stream)
+{
+    stream.dabHandler->setSlideshow(backgroundSlideshow or stream.router.isForeground());
+}
+
+void MscHandler::limitWarmStandby(size_t limit)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    standbyLimit = limit;
+
+    auto streams = copyStreams();
+    if (expireStandby(*streams)) {
+        publishStreams(std::move(streams));
+    }
+}
+
+void MscHandler::setMemoryBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    memoryBudget = bytes;
+
+    auto streams = copyStreams();
+    if (expireStandby(*streams)) {
+        publishStreams(std::move(streams));
+    }
+}
+
+void MscHandler::setPackedSoftbits(bool packed)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    packedSoftbits = packed;
+}
+
+void MscHandler::expireStandby()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto streams = copyStreams();
+    if (expireStandby(*streams)) {
+        publishStreams(std::move(streams));
+    }
+}
+
+//  called with the mutex held. Returns if streams were dropped
+bool MscHandler::expireStandby(StreamSet& streams)
+{
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<SelectedStream>> standby;
+    for (const auto& stream : streams.streams) {
+        if (stream->standby and not stream->pinned) {
+            standby.push_back(stream);
+        }
+    }
+
+    // most recently used first
+    std::sort(standby.begin(), standby.end(),
+            [](const std::shared_ptr<SelectedStream>& a, const std::shared_ptr<SelectedStream>& b) {
+                return a->standbySince > b->standbySince;
+            } );
+
+    bool dropped = false;
+    for (size_t i = 0; i < standby.size(); i++) {
+        if (i >= standbyStreams() or now - standby[i]->standbySince >= standbyTimeout) {
+            streams.streams.erase(std::find(streams.streams.begin(), streams.streams.end(), standby[i]));
+            standby[i].reset();
+            dropped = true;
+        }
+    }
+
+    if (memoryBudget == 0) {
+        return dropped;
+    }
+
+    size_t used = 0;
+    for (const auto& stream : streams.streams) {
+        used += stream->dabHandler->getMemoryBytes();
+    }
+
+    // least recently used first
+    for (auto it = standby.rbegin(); it != standby.rend() and used > memoryBudget; ++it) {
+        if (*it) {
+            used -= (*it)->dabHandler->getMemoryBytes();
+            streams.streams.erase(std::find(streams.streams.begin(), streams.streams.end(), *it));
+            dropped = true;
+        }
+    }
+    return dropped;
 }
 
 //  add blocks. First is (should be) block 5, last is (should be) 76
@@ -127,18 +438,21 @@ bool MscHandler::removeSubchannel(const Subchannel& sub)
 //  gui thread
 //
 //  Any change in the selected service will only be active
-//  during te next processMscBlock call.
+//  during te next processMscBlock call. The stream set is loaded
+//  without taking the mutex, so adding or removing a subchannel never
+//  waits for the CIF being dispatched, nor the other way round.
 void MscHandler::processMscBlock(const softbit_t *fbits, int16_t blkno)
 {
-    std::lock_guard<std::mutex> lock(mutex);
-
-    if (!work_to_be_done)
-        return;
+    const auto streams = std::atomic_load(&currentStreams);
 
     int16_t currentblk = (blkno - 4) % numberofblocksperCIF;
 
     //  and the normal operation is:
-    memcpy(&cifVector[currentblk * bitsperBlock], fbits, bitsperBlock * sizeof(softbit_t));
+    const bool keep = fbits and not streams->streams.empty();
+    if (keep) {
+        memcpy(&cifVector[currentblk * bitsperBlock], fbits, bitsperBlock * sizeof(softbit_t));
+    }
+    receivedBlocks[currentblk] = keep;
 
     if (currentblk < numberofblocksperCIF - 1)
         return;
@@ -147,22 +461,489 @@ void MscHandler::processMscBlock(const softbit_t *fbits, int16_t blkno)
     blkCount = 0;
     cifCount = (cifCount + 1) & 03;
 
-    for (auto& stream : streams) {
-        softbit_t *myBegin = &cifVector[stream.subCh.startAddr * CUSize];
+    // Symbol n of the frame ends at T_u + n * T_s
+    LatencyStamp stamp = frameStamp.at(T_u + (int32_t)blkno * T_s - 1);
+    if (stamp.valid()) {
+        stamp.demodulatedNs = LatencyStamp::now();
+    }
+
+    for (const auto& stream : streams->streams) {
+        //  A subchannel selected in the middle of the CIF starts
+        //  with the next one
+        int16_t first, last;
+        blockRange(stream->subCh, first, last);
+        if (std::find(&receivedBlocks[first], &receivedBlocks[last] + 1, 0) !=
+                &receivedBlocks[last] + 1) {
+            continue;
+        }
+
+        softbit_t *myBegin = &cifVector[stream->subCh.startAddr * CUSize];
 
-        if (stream.dabHandler) {
-            (void)stream.dabHandler->process(myBegin, stream.subCh.length * CUSize);
+        if (stream->dabHandler) {
+            (void)stream->dabHandler->process(myBegin, stream->subCh.length * CUSize, stamp);
         }
         else {
             throw std::logic_error("No dabHandler!");
         }
     }
+
+    std::fill(receivedBlocks.begin(), receivedBlocks.end(), 0);
+}
+
+void MscHandler::processLogicalFrame(int16_t subChId, const uint8_t *frame, size_t len)
+{
+    const auto streams = std::atomic_load(&currentStreams);
+
+    for (const auto& stream : streams->streams) {
+        if (stream->subCh.subChId == subChId) {
+            (void)stream->dabHandler->processFrame(frame, len);
+            return;
+        }
+    }
+}
+
+void MscHandler::setEtiMultiplexer(std::shared_ptr<EtiMultiplexer> eti)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::atomic_store(&etiMultiplexer, std::move(eti));
+    announceSubchannels(*currentStreams);
+}
+
+void MscHandler::pinSubchannels(const std::vector<PinnedSubchannel>& subs, bool decodeAudio)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto streams = copyStreams();
+    bool changed = false;
+    for (const auto& stream : streams->streams) {
+        const bool pinned = std::any_of(subs.begin(), subs.end(),
+                [&](const PinnedSubchannel& pin) { return pin.sub.subChId == stream->subCh.subChId; } );
+        changed |= stream->pinned != pinned;
+        stream->pinned = pinned;
+    }
+
+    for (const auto& pin : subs) {
+        auto it = std::find_if(streams->streams.begin(), streams->streams.end(),
+                [&](const std::shared_ptr<SelectedStream>& stream) {
+                    return stream->subCh.subChId == pin.sub.subChId;
+                } );
+        // Reconfigured to another audio coding, nobody listens to the
+        // old decoder
+        if (it != streams->streams.end() and (*it)->standby and
+                (*it)->audioType != pin.audioType) {
+            streams->streams.erase(it);
+            it = streams->streams.end();
+            changed = true;
+        }
+        if (it == streams->streams.end()) {
+            streams->streams.push_back(createStream(nullptr, pin.audioType,
+                        "", pin.sub, decodeAudio, OverflowPolicy()));
+            streams->streams.back()->pinned = true;
+            changed = true;
+        }
+    }
+
+    // The ones not pinned any more are subject to the standby limits again
+    expireStandby(*streams);
+    if (changed) {
+        publishStreams(std::move(streams));
+    }
 }
 
 void MscHandler::stopProcessing()
 {
     std::lock_guard<std::mutex> lock(mutex);
-    work_to_be_done = false;
-    streams.clear();
+    auto streams = copyStreams();
+    streams->streams.clear();
+    publishStreams(std::move(streams));
+}
+
+void MscHandler::HandlerSwitch::attach(ProgrammeHandlerInterface *handler)
+{
+    // Asked outside of the lock, like the decoder did before
+    const bool wantsFrames = handler and handler->wantsLogicalFrames();
+    std::lock_guard<std::mutex> lock(mutex);
+    target = handler;
+    targetWantsFrames = wantsFrames;
+}
+
+ProgrammeHandlerInterface *MscHandler::HandlerSwitch::attached()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return target;
+}
+
+void MscHandler::HandlerSwitch::addObserver(ProgrammeHandlerInterface& handler)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    observers.push_back(std::make_unique<Observer>(handler, observerDroppedEvents));
+    observerCount = observers.size();
+}
+
+bool MscHandler::HandlerSwitch::removeObserver(ProgrammeHandlerInterface& handler)
+{
+    std::unique_ptr<Observer> removed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = std::find_if(observers.begin(), observers.end(),
+                [&](const std::unique_ptr<Observer>& o) { return &o->handler == &handler; });
+        if (it == observers.end()) {
+            return false;
+        }
+        removed = std::move(*it);
+        observers.erase(it);
+        observerCount = observers.size();
+    }
+    // Waits for a delivery in progress, without blocking the decoder
+    removed.reset();
+    return true;
+}
+
+void MscHandler::HandlerSwitch::removeObservers()
+{
+    std::vector<std::unique_ptr<Observer>> removed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        removed.swap(observers);
+        observerCount = 0;
+    }
+}
+
+void MscHandler::HandlerSwitch::takeObservers(HandlerSwitch& other)
+{
+    std::scoped_lock lock(mutex, other.mutex);
+    observers = std::move(other.observers);
+    other.observers.clear();
+    observerCount = observers.size();
+    other.observerCount = 0;
+    // The drops of the observers go on being counted where they were
+    std::atomic_store(&observerDroppedEvents, other.observerDroppedEvents);
+}
+
+bool MscHandler::HandlerSwitch::hasObservers()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return not observers.empty();
+}
+
+bool MscHandler::HandlerSwitch::isAttached(ProgrammeHandlerInterface& handler)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (target == &handler) {
+        return true;
+    }
+    for (const auto& observer : observers) {
+        if (&observer->handler == &handler) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void MscHandler::HandlerSwitch::notify(Observer::Event&& event)
+{
+    if (observers.size() == 1) {
+        observers.front()->post(std::move(event));
+        return;
+    }
+    for (const auto& observer : observers) {
+        observer->post(Observer::Event(event));
+    }
+}
+
+void MscHandler::Observer::post(Event&& event)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (events.size() >= observerQueueLength) {
+            events.pop_front();
+            droppedEvents->fetch_add(1, std::memory_order_relaxed);
+        }
+        events.push_back(std::move(event));
+    }
+    WorkerPool::shared().schedule(*this);
+}
+
+void MscHandler::Observer::runTask()
+{
+    while (true) {
+        Event event;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (events.empty()) {
+                return;
+            }
+            event = std::move(events.front());
+            events.pop_front();
+        }
+        event(handler);
+    }
+}
+
+void MscHandler::HandlerSwitch::onFrameErrors(int frameErrors)
+{
+    audioUnitErrors.fetch_add(frameErrors, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mutex);
+    notify([=](ProgrammeHandlerInterface& h) { h.onFrameErrors(frameErrors); });
+    if (target) target->onFrameErrors(frameErrors);
+}
+
+void MscHandler::HandlerSwitch::onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (not observers.empty()) {
+        notify([audioData, sampleRate, mode](ProgrammeHandlerInterface& h) mutable {
+                h.onNewAudio(std::move(audioData), sampleRate, mode); });
+    }
+    if (target) target->onNewAudio(std::move(audioData), sampleRate, mode);
+}
+
+void MscHandler::HandlerSwitch::onNewAudioFloat(std::vector<float>&& audioData, int sampleRate, const std::string& mode)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (not observers.empty()) {
+        notify([audioData, sampleRate, mode](ProgrammeHandlerInterface& h) mutable {
+                h.onNewAudioFloat(std::move(audioData), sampleRate, mode); });
+    }
+    if (target) target->onNewAudioFloat(std::move(audioData), sampleRate, mode);
+}
+
+void MscHandler::HandlerSwitch::onAudioStamp(const LatencyStamp& stamp)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    notify([stamp](ProgrammeHandlerInterface& h) { h.onAudioStamp(stamp); });
+    if (target) {
+        latency.add(stamp);
+        target->onAudioStamp(stamp);
+    }
+}
+
+bool MscHandler::HandlerSwitch::wantsFloatAudio()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return target ? target->wantsFloatAudio() : false;
+}
+
+void MscHandler::HandlerSwitch::onLogicalFrame(const uint8_t *frame, size_t len)
+{
+    const auto eti = std::atomic_load(&owner.etiMultiplexer);
+    if (eti) {
+        eti->addLogicalFrame(subChId, frame, len);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& observer : observers) {
+        if (observer->wantsFrames) {
+            observer->post([copy = std::vector<uint8_t>(frame, frame + len)](ProgrammeHandlerInterface& h) {
+                    h.onLogicalFrame(copy.data(), copy.size()); });
+        }
+    }
+    if (target and targetWantsFrames) target->onLogicalFrame(frame, len);
+}
+
+bool MscHandler::HandlerSwitch::isForeground()
+{
+    // Foreground if any of the handlers is
+    std::lock_guard<std::mutex> lock(mutex);
+    if (target and target->isForeground()) {
+        return true;
+    }
+    for (const auto& observer : observers) {
+        if (observer->handler.isForeground()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void MscHandler::HandlerSwitch::onRsErrors(bool uncorrectedErrors, int numCorrectedErrors)
+{
+    superframes.fetch_add(1, std::memory_order_relaxed);
+    rsCorrectedErrors.fetch_add(numCorrectedErrors, std::memory_order_relaxed);
+    if (uncorrectedErrors) {
+        rsUncorrectableSuperframes.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    notify([=](ProgrammeHandlerInterface& h) { h.onRsErrors(uncorrectedErrors, numCorrectedErrors); });
+    if (target) target->onRsErrors(uncorrectedErrors, numCorrectedErrors);
+}
+
+void MscHandler::HandlerSwitch::onAacErrors(int aacErrors)
+{
+    // Called for every frame, with the error code of the decoder
+    this->aacFrames.fetch_add(1, std::memory_order_relaxed);
+    if (aacErrors) {
+        this->aacErrors.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    notify([=](ProgrammeHandlerInterface& h) { h.onAacErrors(aacErrors); });
+    if (target) target->onAacErrors(aacErrors);
+}
+
+void MscHandler::HandlerSwitch::onNewDynamicLabel(const std::string& label)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    notify([label](ProgrammeHandlerInterface& h) { h.onNewDynamicLabel(label); });
+    if (target) target->onNewDynamicLabel(label);
+}
+
+void MscHandler::HandlerSwitch::onNewDynamicLabelPlus(const std::vector<dl_plus_tag_t>& tags, bool itemRunning)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    notify([tags, itemRunning](ProgrammeHandlerInterface& h) { h.onNewDynamicLabelPlus(tags, itemRunning); });
+    if (target) target->onNewDynamicLabelPlus(tags, itemRunning);
+}
+
+void MscHandler::HandlerSwitch::onMOT(mot_file_t&& mot_file)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (not observers.empty()) {
+        notify([mot_file](ProgrammeHandlerInterface& h) mutable { h.onMOT(std::move(mot_file)); });
+    }
+    if (target) target->onMOT(std::move(mot_file));
+}
+
+void MscHandler::HandlerSwitch::onPADLengthError(size_t announced_xpad_len, size_t xpad_len)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    notify([=](ProgrammeHandlerInterface& h) { h.onPADLengthError(announced_xpad_len, xpad_len); });
+    if (target) target->onPADLengthError(announced_xpad_len, xpad_len);
+}
+
+void MscHandler::HandlerSwitch::ProcessUntouchedStream(const uint8_t *data, size_t len, size_t duration_ms)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (not observers.empty()) {
+        notify([copy = std::vector<uint8_t>(data, data + len), duration_ms](ProgrammeHandlerInterface& h) {
+                h.ProcessUntouchedStream(copy.data(), copy.size(), duration_ms); });
+    }
+    if (target) target->ProcessUntouchedStream(data, len, duration_ms);
+}
+
+//  The blocks of a CIF holding the CUs of the subchannel
+void MscHandler::blockRange(const Subchannel& sub, int16_t& first, int16_t& last) const
+{
+    const int32_t begin = sub.startAddr * CUSize;
+    const int32_t end = (sub.startAddr + sub.length) * CUSize;
+    first = std::min<int32_t>(begin / bitsperBlock, numberofblocksperCIF - 1);
+    last = std::min<int32_t>((end - 1) / bitsperBlock, numberofblocksperCIF - 1);
+}
+
+//  called with the mutex held, the set to modify and publish
+std::shared_ptr<MscHandler::StreamSet> MscHandler::copyStreams() const
+{
+    return std::make_shared<StreamSet>(*currentStreams);
+}
+
+//  called with the mutex held, whenever the list of streams changes
+void MscHandler::publishStreams(std::shared_ptr<StreamSet> streams)
+{
+    std::fill(streams->activeBlocks.begin(), streams->activeBlocks.end(), 0);
+    for (const auto& stream : streams->streams) {
+        int16_t first, last;
+        blockRange(stream->subCh, first, last);
+        std::fill(&streams->activeBlocks[first], &streams->activeBlocks[last] + 1, 1);
+    }
+
+    announceSubchannels(*streams);
+    std::shared_ptr<const StreamSet> retired =
+        std::atomic_exchange(&currentStreams, std::shared_ptr<const StreamSet>(std::move(streams)));
+
+    //  The decoder thread may still dispatch a CIF to the old set.
+    //  Wait until it is done, so the decoders of removed subchannels
+    //  are destroyed here, and not on the decoder thread.
+    while (retired.use_count() > 1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+//  called with the mutex held
+void MscHandler::announceSubchannels(const StreamSet& streams)
+{
+    const auto eti = std::atomic_load(&etiMultiplexer);
+    if (not eti) {
+        return;
+    }
+
+    std::vector<Subchannel> subs;
+    for (const auto& stream : streams.streams) {
+        subs.push_back(stream->subCh);
+    }
+    eti->setSubchannels(subs);
+}
+
+void MscHandler::HandlerSwitch::getStats(SubchannelStats& stats) const
+{
+    stats.superframes = superframes.load(std::memory_order_relaxed);
+    stats.rsCorrectedErrors = rsCorrectedErrors.load(std::memory_order_relaxed);
+    stats.rsUncorrectableSuperframes = rsUncorrectableSuperframes.load(std::memory_order_relaxed);
+    stats.audioUnitErrors = audioUnitErrors.load(std::memory_order_relaxed);
+    stats.aacFrames = aacFrames.load(std::memory_order_relaxed);
+    stats.aacErrors = aacErrors.load(std::memory_order_relaxed);
+
+    stats.observers = observerCount.load(std::memory_order_relaxed);
+    stats.observerDroppedEvents = std::atomic_load(&observerDroppedEvents)->load(std::memory_order_relaxed);
+    stats.latency = latency.snapshot();
+}
+
+bool MscHandler::hasSubchannels() const
+{
+    return not std::atomic_load(&currentStreams)->streams.empty();
+}
+
+uint64_t MscHandler::getDecodedBytes() const
+{
+    return counters.decodedBytes;
+}
+
+uint64_t MscHandler::getDroppedFragments() const
+{
+    return counters.droppedFragments;
+}
+
+uint64_t MscHandler::getDroppedFragments(const Subchannel& sub)
+{
+    const auto streams = std::atomic_load(&currentStreams);
+
+    for (const auto& stream : streams->streams) {
+        if (stream->subCh.subChId == sub.subChId) {
+            return stream->dabHandler->getDroppedFragments();
+        }
+    }
+    return 0;
+}
+
+std::vector<SubchannelStats> MscHandler::getSubchannelStats()
+{
+    // For the standby flags, the decoder thread does not take it
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const auto streams = std::atomic_load(&currentStreams);
+    std::vector<SubchannelStats> stats;
+    for (const auto& stream : streams->streams) {
+        SubchannelStats s;
+        s.subChId = stream->subCh.subChId;
+        s.standby = stream->standby;
+        stream->dabHandler->getBufferStats(s);
+        stream->router.getStats(s);
+        stats.push_back(s);
+    }
+    return stats;
+}
+
+size_t MscHandler::getMemoryBytes() const
+{
+    const auto streams = std::atomic_load(&currentStreams);
+    size_t bytes = 0;
+    for (const auto& stream : streams->streams) {
+        bytes += stream->dabHandler->getMemoryBytes();
+    }
+    return bytes;
+}
+
+void MscHandler::getActiveBlocks(std::vector<char>& active)
+{
+    const auto streams = std::atomic_load(&currentStreams);
+    active.assign(streams->activeBlocks.begin(), streams->activeBlocks.end());
 }
 
@@ -30,8 +30,12 @@
 #ifndef MSC_HANDLER
 #define MSC_HANDLER
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <mutex>
-#include <list>
 #include <memory>
 #include <vector>
 #include <cstdio>
@@ -40,8 +44,10 @@
 #include "dab-constants.h"
 #include "ringbuffer.h"
 #include "radio-controller.h"
+#include "dab-virtual.h"
+#include "worker-pool.h"
 
-class DabVirtual;
+class EtiMultiplexer;
 
 class MscHandler
 {
@@ -51,50 +57,313 @@ class MscHandler
         // Stop processing and remove all subchannels
         void stopProcessing(void);
 
+        /* Adding a subchannel which is decoded already for another
+         * handler makes the new one an observer of the same decoder: it
+         * gets the same callbacks, queued and delivered on the WorkerPool,
+         * so a slow observer holds up neither the decoder nor the other
+         * handlers. The first handler chose the decoding, decodeAudio
+         * and overflow of the observers are ignored. */
         bool addSubchannel(
                 ProgrammeHandlerInterface& handler,
                 AudioServiceComponentType ascty,
                 const std::string& dumpFileName,
                 const Subchannel& sub,
-                bool decodeAudio);
+                bool decodeAudio,
+                OverflowPolicy overflow = OverflowPolicy());
 
+        /* With a warm standby, a removed subchannel stays de-interleaved
+         * and superframe synchronised, without decoding the audio, for
+         * up to timeout. Adding it again hands the running decoder to the
+         * new handler, which gets audio with the next superframe. At most
+         * maxStreams subchannels are kept, the least recently used one is
+         * dropped first. maxStreams 0 disables the standby. */
+        void setWarmStandby(size_t maxStreams, std::chrono::seconds timeout);
+
+        // Drop the standby subchannels that timed out
+        void expireStandby(void);
+
+        /* Switches for the LoadGovernor. Without background slideshow,
+         * only the subchannels of foreground handlers decode the MOT, see
+         * ProgrammeHandlerInterface::isForeground. The standby limit caps
+         * the maxStreams of setWarmStandby, without changing it. */
+        void setBackgroundSlideshow(bool enabled);
+        void limitWarmStandby(size_t limit);
+
+        // Ask the handlers again for isForeground, after one changed
+        void updateForeground(void);
+
+        /* Keep the buffers of all subchannels, the standby ones included,
+         * within bytes: the subchannels added from now on queue at most
+         * budgetQueuedFragments CIFs, and standby subchannels are dropped,
+         * least recently used first, while the total is above the budget.
+         * The decoded subchannels are never dropped. 0 removes the limit. */
+        void setMemoryBudget(size_t bytes);
+        static const int16_t budgetQueuedFragments = 4;
+
+        /* The subchannels added from now on keep their softbits packed,
+         * 4 bits each, from the demodulator to the Viterbi decoder, see
+         * packedsoftbits. */
+        void setPackedSoftbits(bool packed);
+
+        // Removes the subchannel with all its handlers
         bool removeSubchannel(const Subchannel& sub);
 
+        /* Removes one handler of the subchannel. The subchannel keeps
+         * decoding while another one is left, otherwise this is
+         * removeSubchannel. */
+        bool removeSubchannel(const Subchannel& sub, ProgrammeHandlerInterface& handler);
+
+        // The callbacks an observer may fall behind by, the oldest are dropped
+        static const size_t observerQueueLength = 256;
+
+        /* The subchannel got reconfigured, or the parameters it was
+         * added with turned out to be wrong. Its decoder is replaced by
+         * one for the new parameters, a standby decoder is dropped. */
+        void updateSubchannel(const Subchannel& sub);
+
+        // Whether any subchannel is selected, standby ones included
+        bool hasSubchannels(void) const;
+
+        // The bytes of logical frames decoded by all subchannels so far
+        uint64_t getDecodedBytes(void) const;
+
+        // The CIFs dropped by all subchannels, or by the given one
+        uint64_t getDroppedFragments(void) const;
+        uint64_t getDroppedFragments(const Subchannel& sub);
+
+        // One entry per selected subchannel, standby ones included
+        std::vector<SubchannelStats> getSubchannelStats(void);
+
+        // See DabVirtual::getMemoryBytes, of all selected subchannels
+        size_t getMemoryBytes(void) const;
+
+        /* Hand the logical frames of all subchannels, standby ones
+         * included, to the multiplexer, and tell it which subchannels
+         * are decoded. nullptr stops it. */
+        void setEtiMultiplexer(std::shared_ptr<EtiMultiplexer> eti);
+
+        // A subchannel to pin, with the audio type of its component
+        struct PinnedSubchannel {
+            Subchannel sub;
+            AudioServiceComponentType audioType;
+        };
+
+        /* Keep these subchannels decoding, in standby while no handler
+         * selected them, e.g. for the ETI output. The standby limits do
+         * not apply to them. The subchannels missing from the list are
+         * not pinned any more. */
+        void pinSubchannels(const std::vector<PinnedSubchannel>& subs, bool decodeAudio);
+
     private:
         friend class OfdmDecoder;
+        friend class EtiDemultiplexer;
+        /* fbits is nullptr for a block that the OfdmDecoder did not
+         * demodulate, because it holds no CU of a selected subchannel. */
         void processMscBlock(const softbit_t *fbits, int16_t blkno);
 
+        /* The stamp of the first sample of the frame whose blocks follow,
+         * the CIFs are stamped with the last sample of their last block. */
+        void setFrameStamp(const LatencyStamp& stamp) { frameStamp = stamp; }
+
+        /* The logical frame of the subchannel as carried by an ETI
+         * stream, dropped unless the subchannel is selected. */
+        void processLogicalFrame(int16_t subChId, const uint8_t *frame, size_t len);
+
+        /* Copy the flags telling which of the numberofblocksperCIF blocks
+         * of a CIF hold CUs of the selected subchannels into active. */
+        void getActiveBlocks(std::vector<char>& active);
+
+        void blockRange(const Subchannel& sub, int16_t& first, int16_t& last) const;
+
+        // An additional handler of a subchannel, with its own queue of
+        // callbacks. Destroying it waits for a delivery in progress.
+        class Observer : public WorkerPool::Task {
+            public:
+                using Event = std::function<void(ProgrammeHandlerInterface&)>;
+
+                Observer(ProgrammeHandlerInterface& handler,
+                        std::shared_ptr<std::atomic<uint64_t>> droppedEvents) :
+                    handler(handler), wantsFrames(handler.wantsLogicalFrames()),
+                    droppedEvents(droppedEvents) {}
+                ~Observer() { WorkerPool::shared().cancel(*this); }
+
+                void post(Event&& event);
+                void runTask(void) override;
+
+                ProgrammeHandlerInterface& handler;
+                const bool wantsFrames;
+
+            private:
+                // Shared by the observers of the subchannel
+                std::shared_ptr<std::atomic<uint64_t>> droppedEvents;
+                std::mutex mutex;
+                std::deque<Event> events;
+        };
+
+        // Forwards the callbacks of a decoder to the handler attached
+        // to it, if any, so a standby decoder can change its handler.
+        class HandlerSwitch : public ProgrammeHandlerInterface {
+            public:
+                HandlerSwitch(ProgrammeHandlerInterface *handler, MscHandler& owner, int16_t subChId) :
+                    owner(owner), subChId(subChId) { attach(handler); }
+
+                // Waits for a callback in progress, the previous handler
+                // is not called any more once this returns.
+                void attach(ProgrammeHandlerInterface *handler);
+                ProgrammeHandlerInterface *attached(void);
+
+                // The observers get the callbacks after the attached
+                // handler, which may be none while observers are left.
+                void addObserver(ProgrammeHandlerInterface& handler);
+                // Returns false if the handler is none of the observers
+                bool removeObserver(ProgrammeHandlerInterface& handler);
+                void removeObservers(void);
+                // Hands the observers of the other switch over to this one
+                void takeObservers(HandlerSwitch& other);
+                bool hasObservers(void);
+                bool isAttached(ProgrammeHandlerInterface& handler);
+
+                void onFrameErrors(int frameErrors) override;
+                void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode) override;
+                void onNewAudioFloat(std::vector<float>&& audioData, int sampleRate, const std::string& mode) override;
+                bool wantsFloatAudio(void) override;
+                // Traced while a handler is attached
+                void onAudioStamp(const LatencyStamp& stamp) override;
+                // The frames are always taken, for the ETI output
+                void onLogicalFrame(const uint8_t *frame, size_t len) override;
+                bool wantsLogicalFrames(void) override { return true; }
+                bool isForeground(void) override;
+                void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) override;
+                void onAacErrors(int aacErrors) override;
+                void onNewDynamicLabel(const std::string& label) override;
+                void onNewDynamicLabelPlus(const std::vector<dl_plus_tag_t>& tags, bool itemRunning) override;
+                void onMOT(mot_file_t&& mot_file) override;
+                void onPADLengthError(size_t announced_xpad_len, size_t xpad_len) override;
+                void ProcessUntouchedStream(const uint8_t *data, size_t len, size_t duration_ms) override;
+
+                // Adds the counts of the decoder callbacks seen so far
+                void getStats(SubchannelStats& stats) const;
+
+            private:
+                // With the mutex held
+                void notify(Observer::Event&& event);
+
+                MscHandler& owner;
+                const int16_t subChId;
+                std::mutex mutex;
+                ProgrammeHandlerInterface *target = nullptr;
+                bool targetWantsFrames = false;
+                std::vector<std::unique_ptr<Observer>> observers;
+                // For getStats, which does not wait for a callback in progress
+                std::atomic<size_t> observerCount = ATOMIC_VAR_INIT(0);
+                // Handed over with the observers, loaded with std::atomic_load
+                std::shared_ptr<std::atomic<uint64_t>> observerDroppedEvents =
+                    std::make_shared<std::atomic<uint64_t>>(0);
+
+                // Counted before the handler is called, as a standby
+                // decoder has none. Written by the decoder task only.
+                std::atomic<uint64_t> superframes = ATOMIC_VAR_INIT(0);
+                std::atomic<uint64_t> rsCorrectedErrors = ATOMIC_VAR_INIT(0);
+                std::atomic<uint64_t> rsUncorrectableSuperframes = ATOMIC_VAR_INIT(0);
+                std::atomic<uint64_t> audioUnitErrors = ATOMIC_VAR_INIT(0);
+                std::atomic<uint64_t> aacFrames = ATOMIC_VAR_INIT(0);
+                std::atomic<uint64_t> aacErrors = ATOMIC_VAR_INIT(0);
+                LatencyTrace latency;
+        };
+
         struct SelectedStream {
             SelectedStream(
-                ProgrammeHandlerInterface& handler,
+                MscHandler& owner,
+                ProgrammeHandlerInterface *handler,
                 AudioServiceComponentType ascty,
                 const std::string& dumpFileName,
-                const Subchannel& subCh) :
-                    handler(handler),
+                const Subchannel& subCh,
+                bool decodeAudio,
+                OverflowPolicy overflow) :
+                    router(handler, owner, subCh.subChId),
                     audioType(ascty),
                     dumpFileName(dumpFileName),
-                    subCh(subCh) {}
+                    subCh(subCh),
+                    decodeAudio(decodeAudio),
+                    floatAudio(handler and handler->wantsFloatAudio()),
+                    overflow(overflow) {}
 
-            ProgrammeHandlerInterface& handler;
+            // Declared first, the decoder holds a reference to it
+            HandlerSwitch router;
 
             AudioServiceComponentType audioType;
             const std::string dumpFileName;
             const Subchannel subCh;
+            const bool decodeAudio;
+            const bool floatAudio;
+            const OverflowPolicy overflow;
+
+            // Only changed with the mutex held
+            bool standby = false;
+            bool pinned = false;
+            std::chrono::steady_clock::time_point standbySince;
 
             std::shared_ptr<DabVirtual> dabHandler;
         };
 
+        // The selected streams and the blocks they need. A set is never
+        // modified once published, adding or removing a subchannel
+        // publishes a new one. The decoder thread only loads the current
+        // set, with std::atomic_load.
+        struct StreamSet {
+            std::vector<std::shared_ptr<SelectedStream>> streams;
+            std::vector<char> activeBlocks;
+        };
+
+        // A pinned stream starts in standby, without handler
+        std::shared_ptr<SelectedStream> createStream(
+                ProgrammeHandlerInterface *handler,
+                AudioServiceComponentType ascty,
+                const std::string& dumpFileName,
+                const Subchannel& sub,
+                bool decodeAudio,
+                OverflowPolicy overflow);
+
+        // With the mutex held, drops the stream or puts it into standby
+        void removeStream(std::shared_ptr<StreamSet> streams,
+                std::vector<std::shared_ptr<SelectedStream>>::iterator it);
+
+        std::shared_ptr<StreamSet> copyStreams(void) const;
+        void publishStreams(std::shared_ptr<StreamSet> streams);
+
+        // Serialises the changes of the stream set
         std::mutex mutex;
-        std::list<SelectedStream> streams;
+        std::shared_ptr<const StreamSet> currentStreams;
+        DecoderCounters counters;
+
+        // Drops the standby streams beyond the limits, with the mutex held
+        bool expireStandby(StreamSet& streams);
+        size_t standbyStreams(void) const { return std::min(maxStandbyStreams, standbyLimit); }
+        size_t maxStandbyStreams = 0;
+        size_t standbyLimit = SIZE_MAX;
+        size_t memoryBudget = 0;
+        bool packedSoftbits = false;
+
+        // Loaded by the HandlerSwitches without the mutex
+        std::shared_ptr<EtiMultiplexer> etiMultiplexer;
+        void announceSubchannels(const StreamSet& streams);
+
+        // With the mutex held
+        void applySlideshow(SelectedStream& stream);
+        bool backgroundSlideshow = true;
+        std::chrono::seconds standbyTimeout = std::chrono::seconds(0);
 
         const int16_t bitsperBlock;
+        const int16_t T_u;
+        const int16_t T_s;
         int16_t numberofblocksperCIF;
         bool show_crcErrors;
 
         std::vector<softbit_t> cifVector;
+        std::vector<char> receivedBlocks;
         int16_t cifCount = 0; // msc blocks in CIF
         int16_t blkCount = 0;
-        bool work_to_be_done = false;
+        LatencyStamp frameStamp;
 };
 
 #endif
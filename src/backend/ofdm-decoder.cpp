@@ -27,9 +27,16 @@
  *  its invocation results in 2 * Tu bits
  */
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <numeric>
+#include <ctime>
 #include "ofdm-decoder.h"
+#include "mode-i.h"
+#include "various/dsp-kernels.h"
 #include "various/profiling.h"
+#include "various/thread-config.h"
 #include <iostream>
 
 /**
@@ -43,19 +50,56 @@ OfdmDecoder::OfdmDecoder(
         const DABParams& p,
         RadioControllerInterface& mr,
         FicHandler& ficHandler,
-        MscHandler& mscHandler) :
+        MscHandler& mscHandler,
+        int numThreads,
+        size_t pooledFrames) :
     params(p),
     radioInterface(mr),
     ficHandler(ficHandler),
     mscHandler(mscHandler),
-    pending_symbols(params.L),
-    phaseReference(params.T_u),
-    fft_handler(p.T_u),
+    pooled_frames(std::min(pooledFrames, frameBuffers)),
+    symbol_needed(p.L),
+    bins_needed(p.L),
+    symbolFFT(p.T_u, 1, p.T_u),
+    frame_bins(p.L * p.T_u),
     interleaver(p),
-    ibits(2 * params.K)
+    frame_bits(p.L * 2 * p.K)
 {
-    T_g = params.T_s - params.T_u;
-    fft_buffer = fft_handler.getVector();
+    // One buffer per queue slot, plus the one being filled by the
+    // OFDMProcessor and the one being decoded
+    for (size_t i = 0; i < pooled_frames; i++) {
+        free_frames.push(fft::AlignedVector<DSPCOMPLEX>(params.L * params.T_s));
+    }
+    allocated_frames = pooled_frames;
+
+    // Every partition has to start on a 64 byte boundary of the frame,
+    // so that its FFT sees the same alignment as the shared plan
+    const int32_t step = 8 / std::gcd(params.T_s, 8);
+    const int32_t partitions = std::max(1, std::min(numThreads, params.L / step));
+
+    partitionStart.push_back(0);
+    for (int32_t k = 1; k < partitions; k++) {
+        const int32_t start = (params.L * k / partitions) / step * step;
+        partitionStart.push_back(std::max(start, partitionStart.back()));
+    }
+    partitionStart.push_back(params.L);
+
+    for (int32_t k = 0; k < partitions; k++) {
+        const int32_t count = partitionStart[k + 1] - partitionStart[k];
+        partitionFFT.emplace_back(count > 0 ?
+                new fft::ForwardBatch(params.T_u, count, params.T_s) : nullptr);
+    }
+
+    partition_done.resize(partitions);
+    partition_complete.resize(partitions);
+    partitionScratch.resize(partitions, fft::AlignedVector<DSPCOMPLEX>(params.T_u));
+    for (int32_t k = 1; k < partitions; k++) {
+        demodulators.emplace_back(&OfdmDecoder::demodulatorThread, this, k);
+    }
+
+    if (partitions > 1) {
+        std::clog << "OFDM-decoder: " << "demodulating in " << partitions << " threads" << std::endl;
+    }
 
     /**
      * When implemented in a thread, the thread controls the
@@ -68,74 +112,517 @@ OfdmDecoder::OfdmDecoder(
 OfdmDecoder::~OfdmDecoder()
 {
     running = false;
-    pending_symbols_cv.notify_all();
+    queued_frames.wake();
+    futexWake(stream_progress);
     if (thread.joinable()) {
         thread.join();
     }
+
+    {
+        std::lock_guard<std::mutex> lock(stage_mutex);
+        stop_demodulators = true;
+    }
+    stage_cv.notify_all();
+    for (auto& t : demodulators) {
+        t.join();
+    }
 }
 
 void OfdmDecoder::reset()
 {
     running = false;
-    pending_symbols_cv.notify_all();
+    queued_frames.wake();
+    futexWake(stream_progress);
     if (thread.joinable()) {
         thread.join();
     }
 
+    // The decoder thread is stopped, so this thread is the consumer now
+    dropQueuedFrames();
+
     thread = std::thread(&OfdmDecoder::workerthread, this);
 }
 
+void OfdmDecoder::flush()
+{
+    const uint32_t request = flush_requested.fetch_add(1, std::memory_order_acq_rel) + 1;
+    queued_frames.wake();
+
+    uint32_t done;
+    while ((done = flush_done.load(std::memory_order_acquire)) != request and running) {
+        futexWait(flush_done, done, std::chrono::milliseconds(100));
+    }
+}
+
+void OfdmDecoder::returnFrameBuffer(fft::AlignedVector<DSPCOMPLEX>&& frame)
+{
+    if (spare_frame.size() == 0) {
+        spare_frame = std::move(frame);
+    }
+    else if (frame.size() > 0) {
+        fft::AlignedVector<DSPCOMPLEX>().swap(frame);
+        allocated_frames--;
+    }
+}
+
+// Consumer side
+void OfdmDecoder::dropQueuedFrames()
+{
+    QueuedFrame frame;
+    while (queued_frames.pop(frame)) {
+        recycleFrame(std::move(frame.samples));
+    }
+}
+
 /**
  * The code in the thread executes a simple loop,
- * waiting for the next symbols and executing the interpretation
- * operation for that symbols.
+ * waiting for the next frame and decoding all its symbols.
  */
 void OfdmDecoder::workerthread()
 {
-    int currentSym = 0;
+    threading::ScopedThread threadConfig(ThreadStage::OfdmDecoder, "dab-ofdm");
 
     running = true;
 
     while (running) {
-        std::unique_lock<std::mutex> lock(mutex);
-        pending_symbols_cv.wait_for(lock, std::chrono::milliseconds(100));
+        const uint32_t flush = flush_requested.load(std::memory_order_acquire);
+        if (flush != flush_done.load(std::memory_order_relaxed)) {
+            dropQueuedFrames();
+            flush_done.store(flush, std::memory_order_release);
+            futexWake(flush_done);
+        }
 
-        if (currentSym == 0) {
-            constellationPoints.clear();
-            constellationPoints.reserve(
-                    (params.L-1) * params.K / constellationDecimation);
+        // Parks on a futex when there is no frame, the timeout is only
+        // a safety net for noticing that running was cleared
+        QueuedFrame frame;
+        if (not popFrame(frame)) {
+            queued_frames.waitForData(std::chrono::milliseconds(100));
+            continue;
+        }
+        current_frame = std::move(frame.samples);
+        PROFILE_FLOW_END(Frame, frame.number);
+        mscHandler.setFrameStamp(frame.stamp);
+
+        selectSymbols();
+
+        const diagnostics_request_t diagnostics = radioInterface.getDiagnosticsRequest();
+        captureConstellation = diagnostics.constellation and diagnostics_enabled;
+        captureSoftBits = diagnostics.softBits;
+        ficHandler.setSoftBitTap(captureSoftBits);
+        if (captureConstellation) {
+            constellationDecimation = std::max(diagnostics.constellationDecimation, 1);
+            constellationPerSymbol =
+                (params.K + constellationDecimation - 1) / constellationDecimation;
+            constellationPoints.resize((params.L - 1) * constellationPerSymbol);
         }
 
-        while (num_pending_symbols > 0 && running) {
+        int64_t busyNs;
+        if (frame.stream) {
+            // Most of the time goes into waiting for the symbols, only
+            // the CPU time of the thread is busy
+            const int64_t started = threadCpuTimeNs();
+            decodeStreamedFrame(frame.stream);
+            busyNs = threadCpuTimeNs() - started;
+        }
+        else {
+            const auto started = std::chrono::steady_clock::now();
+            decodeFrame();
+            busyNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - started).count();
+            frame_decode_time.add(busyNs);
+        }
+        updateDecodeLoad(busyNs);
 
-            if (currentSym == 0)
-                processPRS();
-            else
-                decodeDataSymbol(currentSym);
+        if (running and captureConstellation) {
+            radioInterface.onConstellationPoints(
+                    std::vector<DSPCOMPLEX>(constellationPoints));
+        }
+    }
 
-            currentSym = (currentSym + 1) % (params.L);
-            num_pending_symbols -= 1;
+    std::clog << "OFDM-decoder:" <<  "closing down now" << std::endl;
+}
 
-            if (currentSym == 0) {
-                radioInterface.onConstellationPoints(
-                        std::move(constellationPoints));
-                constellationPoints.clear();
-                constellationPoints.reserve(
-                        (params.L-1) * params.K / constellationDecimation);
-            }
+/* All symbols of the frame are in, the partitions transform and
+ * demodulate them in parallel */
+void OfdmDecoder::decodeFrame()
+{
+    PROFILE(FrameFFT);
+    startStage(Stage::FFT);
+    runPartition(Stage::FFT, 0);
+    for (size_t k = 1; k < partition_done.size(); k++) {
+        waitForPartition(k);
+    }
+
+    // The time domain samples are not needed anymore
+    recycleFrame(std::move(current_frame));
+
+    processPRS();
+
+    startStage(Stage::Demodulate);
+    runPartition(Stage::Demodulate, 0);
+    for (size_t k = 0; k < partition_done.size(); k++) {
+        if (k > 0) {
+            waitForPartition(k);
+        }
+
+        for (int32_t sym = std::max(partitionStart[k], 1);
+                sym < partitionStart[k + 1] and running; sym++) {
+            deliverSymbol(sym);
         }
     }
+}
 
-    std::clog << "OFDM-decoder:" <<  "closing down now" << std::endl;
+/* The symbols are transformed and demodulated one by one, as soon as
+ * the OFDMProcessor received them */
+void OfdmDecoder::decodeStreamedFrame(uint32_t generation)
+{
+    auto& scratch = partitionScratch[0];
+
+    for (int32_t sym = 0; sym < params.L and running; sym++) {
+        if (not waitForSymbol(generation, sym)) {
+            // Given up by the OFDMProcessor, the rest of the frame is missing
+            break;
+        }
+
+        if (bins_needed[sym]) {
+            std::copy_n(&current_frame[sym * params.T_s], params.T_u,
+                    scratch.begin());
+            symbolFFT.do_FFT(scratch.data(), &frame_bins[sym * params.T_u]);
+        }
+
+        if (sym == 0) {
+            processPRS();
+            continue;
+        }
+
+        if (symbol_needed[sym]) {
+            demodulateSymbol(sym);
+        }
+        deliverSymbol(sym);
+    }
+
+    // The OFDMProcessor does not write to the buffer anymore, it only
+    // takes a new one after endFrame
+    recycleFrame(std::move(current_frame));
+}
+
+bool OfdmDecoder::waitForSymbol(uint32_t generation, int32_t sym)
+{
+    while (true) {
+        const uint32_t progress = stream_progress.load(std::memory_order_acquire);
+        if ((progress >> 8) != generation) {
+            // The OFDMProcessor already moved on to the next frame
+            return not wasAborted(generation);
+        }
+
+        const uint32_t count = progress & 0xFF;
+        if (count == 0xFF) {
+            return false;
+        }
+        if ((int32_t)count > sym) {
+            return true;
+        }
+        if (not running) {
+            return false;
+        }
+
+        stream_parked.store(1, std::memory_order_seq_cst);
+        if (stream_progress.load(std::memory_order_seq_cst) == progress) {
+            futexWait(stream_progress, progress, std::chrono::milliseconds(100));
+        }
+        stream_parked.store(0, std::memory_order_relaxed);
+    }
+}
+
+void OfdmDecoder::selectSymbols()
+{
+    mscHandler.getActiveBlocks(active_blocks);
+    const int32_t blocksPerCIF = active_blocks.size();
+
+    // The PRS and the FIC symbols are always needed
+    for (int32_t sym = 0; sym < params.L; sym++) {
+        symbol_needed[sym] = sym < 4 or
+            active_blocks[(sym - 4) % blocksPerCIF];
+    }
+
+    // A symbol is also the phase reference of the next one
+    for (int32_t sym = 0; sym < params.L; sym++) {
+        bins_needed[sym] = symbol_needed[sym] or
+            (sym + 1 < params.L and symbol_needed[sym + 1]);
+    }
+
+    for (size_t k = 0; k < partition_complete.size(); k++) {
+        partition_complete[k] = std::find(&bins_needed[partitionStart[k]],
+                &bins_needed[0] + partitionStart[k + 1], 0) ==
+            &bins_needed[0] + partitionStart[k + 1];
+    }
+}
+
+void OfdmDecoder::startStage(Stage stage)
+{
+    if (demodulators.empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stage_mutex);
+        current_stage = stage;
+        std::fill(partition_done.begin(), partition_done.end(), 0);
+        stage_generation++;
+    }
+    stage_cv.notify_all();
+}
+
+void OfdmDecoder::waitForPartition(size_t partition)
+{
+    std::unique_lock<std::mutex> lock(stage_mutex);
+    partition_done_cv.wait(lock, [&] { return partition_done[partition] != 0; });
+}
+
+void OfdmDecoder::demodulatorThread(size_t partition)
+{
+    const std::string threadName = "dab-demod-" + std::to_string(partition);
+    threading::ScopedThread threadConfig(ThreadStage::Demodulator, threadName.c_str());
+
+    uint64_t seen_generation = 0;
+
+    std::unique_lock<std::mutex> lock(stage_mutex);
+    while (true) {
+        stage_cv.wait(lock, [&] {
+                return stop_demodulators or stage_generation != seen_generation; });
+        if (stop_demodulators) {
+            break;
+        }
+
+        seen_generation = stage_generation;
+        const Stage stage = current_stage;
+
+        lock.unlock();
+        runPartition(stage, partition);
+        lock.lock();
+
+        partition_done[partition] = 1;
+        partition_done_cv.notify_all();
+    }
+}
+
+void OfdmDecoder::runPartition(Stage stage, size_t partition)
+{
+    const int32_t first = partitionStart[partition];
+    const int32_t last = partitionStart[partition + 1];
+    if (first == last) {
+        return;
+    }
+
+    switch (stage) {
+        case Stage::FFT:
+            if (partition_complete[partition] and
+                    not dsp::isReferenceForced(dsp::FastPath::BatchedFFT)) {
+                partitionFFT[partition]->do_FFT(&current_frame[first * params.T_s],
+                        &frame_bins[first * params.T_u]);
+                break;
+            }
+
+            for (int32_t sym = first; sym < last; sym++) {
+                if (bins_needed[sym]) {
+                    auto& scratch = partitionScratch[partition];
+                    std::copy_n(&current_frame[sym * params.T_s], params.T_u,
+                            scratch.begin());
+                    symbolFFT.do_FFT(scratch.data(), &frame_bins[sym * params.T_u]);
+                }
+            }
+            break;
+        case Stage::Demodulate:
+            for (int32_t sym = std::max(first, 1); sym < last; sym++) {
+                if (symbol_needed[sym]) {
+                    demodulateSymbol(sym);
+                }
+            }
+            break;
+    }
+}
+
+// Consumer side: the decoder thread
+bool OfdmDecoder::popFrame(QueuedFrame& frame)
+{
+    // Drop the oldest frames the decoder fell behind on. Only the newest
+    // one can still be streaming.
+    while (queued_frames.size() > frameQueueDepth and queued_frames.pop(frame)) {
+        countDroppedFrame();
+        recycleFrame(std::move(frame.samples));
+    }
+
+    return queued_frames.pop(frame);
+}
+
+int64_t OfdmDecoder::threadCpuTimeNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void OfdmDecoder::updateDecodeLoad(int64_t busyNs)
+{
+    const double framePeriodNs = 1e9 * params.T_F / INPUT_RATE;
+    const float load = busyNs / framePeriodNs;
+    const float previous = decode_load.load(std::memory_order_relaxed);
+    decode_load.store(previous + decodeLoadAlpha * (load - previous),
+            std::memory_order_relaxed);
+}
+
+void OfdmDecoder::countDroppedFrame()
+{
+    const size_t dropped = frames_dropped++;
+    if (dropped % 100 == 0) {
+        std::clog << "OFDM-decoder: " << "decoder too slow, " <<
+            dropped + 1 << " frame(s) dropped" << std::endl;
+    }
+}
+
+void OfdmDecoder::recycleFrame(fft::AlignedVector<DSPCOMPLEX>&& frame)
+{
+    // Buffers allocated beyond the pool are freed when the pool is full
+    if (frame.size() == 0) {
+        return;
+    }
+    if (free_frames.size() >= pooled_frames or not free_frames.push(std::move(frame))) {
+        fft::AlignedVector<DSPCOMPLEX>().swap(frame);
+        allocated_frames--;
+    }
+}
+
+// Producer side: the OFDMProcessor thread
+void OfdmDecoder::updateMaxQueued()
+{
+    // Only the producer writes it
+    const size_t queued = queued_frames.size();
+    if (queued > max_queued.load(std::memory_order_relaxed)) {
+        max_queued.store(queued, std::memory_order_relaxed);
+    }
+}
+
+fft::AlignedVector<DSPCOMPLEX> OfdmDecoder::getFrameBuffer()
+{
+    fft::AlignedVector<DSPCOMPLEX> frame;
+
+    if (spare_frame.size() > 0) {
+        frame = std::move(spare_frame);
+    }
+    else if (not free_frames.pop(frame)) {
+        // The decoder fell behind by more frames than are pooled, or a
+        // buffer was taken out of the pool for good, e.g. when the
+        // OFDMProcessor restarted
+        frame = fft::AlignedVector<DSPCOMPLEX>(params.L * params.T_s);
+        allocated_frames++;
+    }
+    return frame;
+}
+
+void OfdmDecoder::pushFrame(fft::AlignedVector<DSPCOMPLEX>&& frame, const LatencyStamp& stamp)
+{
+    QueuedFrame queued;
+    queued.samples = std::move(frame);
+    queued.number = ++frames_pushed;
+    queued.stamp = stamp;
+    PROFILE_FLOW_BEGIN(Frame, queued.number);
+    if (not queued_frames.push(std::move(queued))) {
+        // The decoder did not even get to drop its backlog, this frame
+        // is lost and its buffer filled again
+        countDroppedFrame();
+        spare_frame = std::move(queued.samples);
+        return;
+    }
+
+    updateMaxQueued();
+}
+
+void OfdmDecoder::beginFrame(fft::AlignedVector<DSPCOMPLEX>&& frame, const LatencyStamp& stamp)
+{
+    // 24 bits of generation, 0 stands for complete frames
+    stream_generation = (stream_generation + 1) & 0xFFFFFF;
+    if (stream_generation == 0) {
+        stream_generation = 1;
+    }
+    stream_progress.store(stream_generation << 8, std::memory_order_release);
+
+    QueuedFrame queued;
+    queued.samples = std::move(frame);
+    queued.stream = stream_generation;
+    queued.number = ++frames_pushed;
+    queued.stamp = stamp;
+    PROFILE_FLOW_BEGIN(Frame, queued.number);
+    if (not queued_frames.push(std::move(queued))) {
+        countDroppedFrame();
+        spare_frame = std::move(queued.samples);
+        streaming = false;
+        return;
+    }
+    streaming = true;
+
+    updateMaxQueued();
+}
+
+void OfdmDecoder::symbolsReady(int32_t count)
+{
+    if (not streaming) {
+        return;
+    }
+
+    stream_progress.store((stream_generation << 8) | (uint32_t)count,
+            std::memory_order_seq_cst);
+    if (stream_parked.load(std::memory_order_seq_cst)) {
+        futexWake(stream_progress);
+    }
+}
+
+void OfdmDecoder::endFrame(bool complete)
+{
+    if (not streaming) {
+        return;
+    }
+    streaming = false;
+
+    if (complete) {
+        recordOutcome(false);
+        symbolsReady(params.L);
+        return;
+    }
+
+    recordOutcome(true);
+    stream_progress.store((stream_generation << 8) | 0xFF, std::memory_order_seq_cst);
+    futexWake(stream_progress);
 }
 
-void OfdmDecoder::pushAllSymbols(std::vector<std::vector<DSPCOMPLEX> >&& syms)
+bool OfdmDecoder::wasAborted(uint32_t generation) const
 {
-    std::unique_lock<std::mutex> lock(mutex);
+    const uint64_t outcomes = stream_outcomes.load(std::memory_order_acquire);
+    const uint32_t behind = ((uint32_t)(outcomes >> 32) - generation) & 0xFFFFFF;
+    // Too far behind to tell, the frame is given up rather than decoded
+    // from a buffer already written again
+    return behind >= 32 or ((outcomes >> behind) & 1);
+}
+
+void OfdmDecoder::recordOutcome(bool aborted)
+{
+    // Only the OFDMProcessor writes it
+    const uint64_t outcomes = stream_outcomes.load(std::memory_order_relaxed);
+    const uint32_t ahead = (stream_generation - (uint32_t)(outcomes >> 32)) & 0xFFFFFF;
+    // The generations in between were dropped before they were queued
+    uint32_t mask = ahead < 32 ? ((uint32_t)outcomes << ahead) | ((1u << ahead) - 1) : UINT32_MAX;
+    mask = aborted ? mask | 1 : mask & ~1u;
+    stream_outcomes.store(((uint64_t)stream_generation << 32) | mask, std::memory_order_release);
+}
+
+OfdmDecoder::FrameQueueStats OfdmDecoder::getFrameQueueStats() const
+{
+    return FrameQueueStats{queued_frames.size(), max_queued.load(), frames_dropped.load()};
+}
 
-    pending_symbols = std::move(syms);
-    num_pending_symbols = pending_symbols.size();
-    pending_symbols_cv.notify_one();
+size_t OfdmDecoder::getMemoryBytes() const
+{
+    return allocated_frames.load(std::memory_order_relaxed) * params.L * params.T_s * sizeof(DSPCOMPLEX) +
+        frame_bins.size() * sizeof(DSPCOMPLEX);
 }
 
 /**
@@ -144,87 +631,139 @@ void OfdmDecoder::pushAllSymbols(std::vector<std::vector<DSPCOMPLEX> >&& syms)
 void OfdmDecoder::processPRS()
 {
     PROFILE(ProcessPRS);
-    memcpy (fft_buffer,
-            pending_symbols[0].data(),
-            params.T_u * sizeof(DSPCOMPLEX));
-    fft_handler.do_FFT ();
     /**
      * The SNR is determined by looking at a segment of bins
      * within the signal region and bits outside.
      * It is just an indication
      */
-    snr = 0.7 * snr + 0.3 * get_snr(fft_buffer, 1);
+    if (++snrSkipped >= snr_interval.load(std::memory_order_relaxed)) {
+        snr = 0.7 * snr + 0.3 * get_snr(frame_bins.data(), 1);
+        snrSkipped = 0;
+    }
     if (++snrCount > 10) {
         radioInterface.onSNR(snr);
+        reported_snr.store(snr, std::memory_order_relaxed);
         snrCount = 0;
     }
-    /**
-     * we are now in the frequency domain, and we keep the carriers
-     * as coming from the FFT as phase reference.
-     */
-    memcpy(phaseReference.data(), fft_buffer, params.T_u * sizeof (DSPCOMPLEX));
 }
 
 /**
- * For the other symbols, the first step is to go from
- * time to frequency domain, to get the carriers.
+ * decoding is computing the phase difference between
+ * carriers with the same index in subsequent symbols,
+ * r = cur * conj(ref). Both halves of the softbits are written
+ * in the same pass, without any branch in the loop.
+ * With FixedK, the number of carriers and the gather table are known
+ * at compile time, otherwise K and gather are used.
+ */
+template<int32_t FixedK>
+static inline void demodulateCarriers(
+        const float * __restrict cur,
+        const float * __restrict ref,
+        const int32_t * __restrict gather,
+        int32_t K,
+        softbit_t * __restrict ibits_re,
+        softbit_t * __restrict ibits_im)
+{
+    if (FixedK != 0) {
+        K = FixedK;
+        gather = modeI::gatherTable.data();
+    }
+
+    for (int32_t i = 0; i < K; i++) {
+        const int32_t bin = 2 * gather[i];
+        const float re = cur[bin] * ref[bin] + cur[bin + 1] * ref[bin + 1];
+        const float im = cur[bin + 1] * ref[bin] - cur[bin] * ref[bin + 1];
+        const float ab = -127.0f / (std::fabs(re) + std::fabs(im));
+
+        ibits_re[i] = (softbit_t)(re * ab);
+        ibits_im[i] = (softbit_t)(im * ab);
+    }
+}
+
+/**
+ * The FFT of all symbols of the frame is already done, the carriers of
+ * symbol sym_ix are mapped onto softbits.
  *
- * \brief decodeDataSymbol
- * do the transforms and hand over the result to the fichandler or mschandler
+ * \brief demodulateSymbol
+ * May run on any of the demodulator threads
  */
-void OfdmDecoder::decodeDataSymbol(int32_t sym_ix)
+void OfdmDecoder::demodulateSymbol(int32_t sym_ix)
 {
     PROFILE(ProcessSymbol);
-    memcpy (fft_buffer,
-            pending_symbols[sym_ix].data() + T_g,
-            params.T_u * sizeof (DSPCOMPLEX));
-    //fftlabel:
     /**
-     * first step: do the FFT
+     * we are in the frequency domain, and the carriers of the previous
+     * symbol, as coming from the FFT, are the phase reference.
+     * The bins are read as interleaved re/im floats, so that the
+     * compiler does not have to care for the inf/nan semantics of
+     * the std::complex multiplication.
      */
-    fft_handler.do_FFT();
+    const float * __restrict cur = reinterpret_cast<const float*>(
+            &frame_bins[sym_ix * params.T_u]);
+    const float * __restrict ref = reinterpret_cast<const float*>(
+            &frame_bins[(sym_ix - 1) * params.T_u]);
+    const int32_t * __restrict gather = interleaver.gatherTable();
 
-    /**
-     * a little optimization: we do not interchange the
-     * positive/negative frequencies to their right positions.
-     * The de-interleaving understands this
-     */
+    softbit_t * __restrict ibits_re = &frame_bits[sym_ix * 2 * params.K];
+    softbit_t * __restrict ibits_im = ibits_re + params.K;
 
     PROFILE(Deinterleaver);
     /**
      * Note that from here on, we are only interested in the
-     * K useful carriers of the FFT output
+     * K useful carriers of the FFT output. The gather table maps the
+     * de-interleaved carrier onto its bin, so that we do not have to
+     * interchange the positive/negative frequencies.
      */
-    for (int16_t i = 0; i < params.K; i ++) {
-        int16_t index = interleaver.mapIn(i);
-        if (index < 0)
-            index += params.T_u;
-        /**
-         * decoding is computing the phase difference between
-         * carriers with the same index in subsequent symbols.
-         * The carrier of a symbols is the reference for the carrier
-         * on the same position in the next symbols
-         */
-        const DSPCOMPLEX r1 = fft_buffer[index] * conj (phaseReference[index]);
-        phaseReference[index] = fft_buffer[index];
-        const DSPFLOAT ab1 = 127.0f / l1_norm(r1);
-        /// split the real and the imaginary part and scale it
-
-        ibits[i]            = -real (r1) * ab1;
-        ibits[params.K + i] = -imag (r1) * ab1;
-
-        if (i % constellationDecimation == 0) {
-            constellationPoints.push_back(r1);
-        }
+    if (params.dabMode == 1) {
+        demodulateCarriers<modeI::K>(cur, ref, gather, params.K, ibits_re, ibits_im);
+    }
+    else {
+        demodulateCarriers<0>(cur, ref, gather, params.K, ibits_re, ibits_im);
+    }
+
+    if (captureConstellation) {
+        storeConstellationPoints(sym_ix);
+    }
+}
+
+/**
+ * keep every constellationDecimation-th of the demodulated carriers
+ * of symbol sym_ix for display
+ */
+void OfdmDecoder::storeConstellationPoints(int32_t sym_ix)
+{
+    const DSPCOMPLEX *fft_buffer = &frame_bins[sym_ix * params.T_u];
+    const DSPCOMPLEX *phaseReference = &frame_bins[(sym_ix - 1) * params.T_u];
+    const int32_t *gather = interleaver.gatherTable();
+
+    DSPCOMPLEX *constellation = &constellationPoints[
+        (sym_ix - 1) * constellationPerSymbol];
+
+    for (int32_t i = 0; i < params.K; i += constellationDecimation) {
+        const int32_t bin = gather[i];
+        constellation[i / constellationDecimation] =
+            fft_buffer[bin] * conj(phaseReference[bin]);
+    }
+}
+
+/**
+ * hand over the softbits of a symbol to the fichandler or mschandler,
+ * in symbol order and from the decoder thread only
+ */
+void OfdmDecoder::deliverSymbol(int32_t sym_ix)
+{
+    softbit_t *ibits = &frame_bits[sym_ix * 2 * params.K];
+
+    if (captureSoftBits and (sym_ix < 4 or symbol_needed[sym_ix])) {
+        radioInterface.onSoftBits(sym_ix, ibits, 2 * params.K);
     }
 
     if (sym_ix < 4) {
         PROFILE(FICHandler);
-        ficHandler.processFicBlock(ibits.data(), sym_ix);
+        ficHandler.processFicBlock(ibits, sym_ix);
     }
     else {
         PROFILE(MSCHandler);
-        mscHandler.processMscBlock(ibits.data(), sym_ix);
+        mscHandler.processMscBlock(symbol_needed[sym_ix] ? ibits : nullptr, sym_ix);
     }
     PROFILE(SymbolProcessed);
 }
@@ -237,9 +776,8 @@ void OfdmDecoder::decodeDataSymbol(int32_t sym_ix)
  * method:  0 Jans method. This method are originally developed by Jan and is not working if neighbor channels are used because it uses occupied bins for the noise calculation
  *          1 New method. This method is working also if neighbor channels are used
  */
-int16_t OfdmDecoder::get_snr(DSPCOMPLEX *v, uint8_t method)
+int16_t OfdmDecoder::get_snr(const DSPCOMPLEX *v, uint8_t method)
 {
-    int16_t i;
     DSPFLOAT    noise   = 0;
     DSPFLOAT    signal  = 0;
     const auto T_u = params.T_u;
@@ -247,17 +785,25 @@ int16_t OfdmDecoder::get_snr(DSPCOMPLEX *v, uint8_t method)
     int16_t low = T_u / 2 -  K / 2;
     int16_t high    = low + K;
 
+    // Sum of the magnitudes of v[(T_u / 2 + i) % T_u] for i in [from, to[
+    const auto sumBins = [&](int32_t from, int32_t to) {
+        const int32_t length = to - from;
+        if (length <= 0) {
+            return 0.0f;
+        }
+        const int32_t start = (T_u / 2 + from) % T_u;
+        const int32_t first = std::min(length, T_u - start);
+        return dsp::kernels().sumMagnitude(v + start, first) +
+            dsp::kernels().sumMagnitude(v, length - first);
+    };
+
     if(method)
     {
-        for (i = 70; i < low - 20; i ++) // low - 90 samples
-            noise += abs (v[(T_u / 2 + i) % T_u]);
-
-        for (i = high + 20; i < high + 120; i ++) // 100 samples
-            noise += abs (v[(T_u / 2 + i) % T_u]);
+        noise += sumBins(70, low - 20); // low - 90 samples
+        noise += sumBins(high + 20, high + 120); // 100 samples
 
         noise   /= (low - 90 + 100);
-        for (i = T_u / 2 - K / 4;  i < T_u / 2 + K / 4; i ++)
-            signal += abs (v[(T_u / 2 + i) % T_u]);
+        signal = sumBins(T_u / 2 - K / 4, T_u / 2 + K / 4);
 
         const auto dB_signal_new = get_db_over_256(signal / (K / 2));
         const auto dB_noise_new = get_db_over_256(noise);
@@ -266,17 +812,11 @@ int16_t OfdmDecoder::get_snr(DSPCOMPLEX *v, uint8_t method)
     }
     else
     {
-        noise   = 0;
-        signal  = 0;
-        for (i = 10; i < low - 20; i ++)
-            noise += abs (v[(T_u / 2 + i) % T_u]);
-
-        for (i = high + 20; i < T_u - 10; i ++)
-            noise += abs (v[(T_u / 2 + i) % T_u]);
+        noise += sumBins(10, low - 20);
+        noise += sumBins(high + 20, T_u - 10);
 
         noise   /= (low - 30 + T_u - high - 30);
-        for (i = T_u / 2 - K / 4;  i < T_u / 2 + K / 4; i ++)
-            signal += abs (v[(T_u / 2 + i) % T_u]);
+        signal = sumBins(T_u / 2 - K / 4, T_u / 2 + K / 4);
 
         const auto dB_signal_old = get_db_over_256(signal / (K / 2));
         const auto dB_noise_old = get_db_over_256(noise);
@@ -24,6 +24,7 @@
 #ifndef __OFDM_DECODER
 #define __OFDM_DECODER
 
+#include <algorithm>
 #include <cstddef>
 #include <vector>
 #include <thread>
@@ -31,7 +32,10 @@
 #include <mutex>
 #include <atomic>
 #include <cstdint>
+#include <memory>
 #include "fft.h"
+#include "spsc-queue.h"
+#include "latency-histogram.h"
 #include "dab-constants.h"
 #include "freq-interleaver.h"
 #include "radio-controller.h"
@@ -45,12 +49,84 @@ class OfdmDecoder
                 const DABParams& p,
                 RadioControllerInterface& mr,
                 FicHandler& ficHandler,
-                MscHandler& mscHandler);
+                MscHandler& mscHandler,
+                int numThreads = 1,
+                size_t pooledFrames = SIZE_MAX);
         ~OfdmDecoder();
-        void    pushAllSymbols(std::vector<std::vector<DSPCOMPLEX> >&& sym);
+        /* The frame holds the PRS followed by the L-1 data symbols, such
+         * that the useful part of symbol n starts at n * T_s.
+         * The frame is queued for decoding. If the decoder falls behind by
+         * more than frameQueueDepth frames, it drops the oldest queued
+         * frames. Never blocks; must always be called from the same thread
+         * as getFrameBuffer. stamp is the one of the first sample of the
+         * PRS, handed on to the MscHandler. */
+        void    pushFrame(fft::AlignedVector<DSPCOMPLEX>&& frame,
+                        const LatencyStamp& stamp = LatencyStamp());
+
+        /* Get a buffer for the next frame out of the pool of frame buffers.
+         * The buffers are recycled between the OFDMProcessor and the decoder
+         * thread, so that there is no allocation per frame. */
+        fft::AlignedVector<DSPCOMPLEX> getFrameBuffer();
+
+        /* Symbol streaming, instead of pushFrame: beginFrame queues the
+         * frame as soon as its PRS is in, and the decoder transforms and
+         * demodulates every symbol once symbolsReady announced it, while
+         * the following ones are still being received. The samples are
+         * written through the pointer taken before beginFrame, and not
+         * touched anymore after endFrame. complete is false if the frame
+         * was given up half way. Same thread as pushFrame. */
+        void    beginFrame(fft::AlignedVector<DSPCOMPLEX>&& frame,
+                        const LatencyStamp& stamp = LatencyStamp());
+        void    symbolsReady(int32_t count);
+        void    endFrame(bool complete);
+
         void    reset();
+
+        /* Drop the frames still queued, and wait until the decoder thread
+         * is done with the one it decodes, such that nothing of the
+         * channel received so far reaches the FIC and MSC handlers
+         * anymore. Only while the OFDMProcessor is stopped. */
+        void    flush();
+
+        /* The buffer the OFDMProcessor holds when it stops, kept for its
+         * next getFrameBuffer. Same thread as pushFrame. */
+        void    returnFrameBuffer(fft::AlignedVector<DSPCOMPLEX>&& frame);
+
+        struct FrameQueueStats {
+            size_t queued;      // frames waiting for the decoder
+            size_t maxQueued;   // highest number of waiting frames seen
+            size_t dropped;     // frames dropped because the queue was full
+        };
+        FrameQueueStats getFrameQueueStats() const;
+
+        /* The frame buffers allocated, pooled and in use, and the frame
+         * of carriers. At most pooledFrames buffers are kept in the pool,
+         * the others are only allocated while the decoder falls behind. */
+        size_t getMemoryBytes() const;
+
+        // The SNR last reported by onSNR, in dB
+        float getSnr() const { return reported_snr.load(std::memory_order_relaxed); }
+
+        /* The time from taking a complete frame off the queue until its
+         * FIC and MSC bits are handed on. Frames streamed per symbol are
+         * not included, they wait for the reception. */
+        const LatencyHistogram& getFrameDecodeTime() const { return frame_decode_time; }
+
+        /* The time the decoder is busy with a frame, divided by the frame
+         * period, as a moving average over about ten frames. Above 1, it
+         * does not keep up with the signal. */
+        float getDecodeLoad() const { return decode_load.load(std::memory_order_relaxed); }
+
+        /* Switches for the LoadGovernor, any thread. Without diagnostics,
+         * no constellation is captured, whatever the radio controller
+         * requests. The SNR is estimated on every snrInterval-th frame
+         * only, and reported as often as before. */
+        void setDiagnosticsEnabled(bool enabled) { diagnostics_enabled = enabled; }
+        void setSnrInterval(int interval) { snr_interval = std::max(interval, 1); }
+
+        static const size_t frameQueueDepth = 3;
     private:
-        int16_t get_snr(DSPCOMPLEX *, uint8_t method);
+        int16_t get_snr(const DSPCOMPLEX *, uint8_t method);
 
         const DABParams& params;
         RadioControllerInterface& radioInterface;
@@ -58,34 +134,138 @@ class OfdmDecoder
         MscHandler& mscHandler;
         std::atomic<bool> running = ATOMIC_VAR_INIT(false);
 
-        std::condition_variable pending_symbols_cv;
-        std::mutex mutex;
-        int num_pending_symbols = 0;
-        std::vector<std::vector<DSPCOMPLEX> > pending_symbols;
+        /* The frames travel from the OFDMProcessor to the decoder thread
+         * and back through two single producer single consumer queues,
+         * so that neither ever waits for the other. One slot more than
+         * frameQueueDepth lets the producer push while the decoder is
+         * about to drop the oldest frame. */
+        static constexpr size_t frameQueueCapacity = frameQueueDepth + 1;
+        static constexpr size_t frameBuffers = frameQueueCapacity + 2;
+        struct QueuedFrame {
+            fft::AlignedVector<DSPCOMPLEX> samples;
+            // Generation of a streamed frame, 0 for a complete one
+            uint32_t stream = 0;
+            // Number of the frame, for the trace of the Profiler
+            uint64_t number = 0;
+            LatencyStamp stamp;
+        };
+        SpscQueue<QueuedFrame, frameQueueCapacity> queued_frames;
+        SpscQueue<fft::AlignedVector<DSPCOMPLEX>, 8> free_frames;
+        static_assert(frameBuffers <= 8, "free_frames must hold all frame buffers");
+        const size_t pooled_frames;
+        std::atomic<size_t> allocated_frames = ATOMIC_VAR_INIT(0);
+
+        // Producer side only: a frame that did not fit into the queue
+        fft::AlignedVector<DSPCOMPLEX> spare_frame;
+
+        std::atomic<size_t> max_queued = ATOMIC_VAR_INIT(0);
+        std::atomic<size_t> frames_dropped = ATOMIC_VAR_INIT(0);
+
+        /* (generation << 8) | number of symbols available of the frame
+         * being streamed. A generation ends with endFrame, and the
+         * consumer tells aborted ones by stream_outcomes: the generation
+         * ended last << 32 | a bit for it and each of the 31 before,
+         * set if that frame was aborted. A consumer some frames behind
+         * still finds its own frame in there. */
+        std::atomic<uint32_t> stream_progress = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> stream_outcomes = ATOMIC_VAR_INIT(0);
+        std::atomic<uint32_t> stream_parked = ATOMIC_VAR_INIT(0);
+        uint32_t stream_generation = 0;     // producer side
+        uint64_t frames_pushed = 0;         // producer side
+        bool streaming = false;             // producer side
+
+        // flush() counts up the request, the decoder thread acknowledges
+        std::atomic<uint32_t> flush_requested = ATOMIC_VAR_INIT(0);
+        std::atomic<uint32_t> flush_done = ATOMIC_VAR_INIT(0);
+
+        bool popFrame(QueuedFrame& frame);
+        void dropQueuedFrames(void);
+        bool waitForSymbol(uint32_t generation, int32_t sym);
+        bool wasAborted(uint32_t generation) const;
+        void recordOutcome(bool aborted);
+        void decodeFrame(void);
+        void decodeStreamedFrame(uint32_t generation);
+        void countDroppedFrame();
+        void updateDecodeLoad(int64_t busyNs);
+        static int64_t threadCpuTimeNs(void);
+        void updateMaxQueued();
+        void recycleFrame(fft::AlignedVector<DSPCOMPLEX>&& frame);
 
         std::thread thread;
         void workerthread(void);
         void processPRS();
-        void decodeDataSymbol(int32_t n);
+        void demodulateSymbol(int32_t n);
+        void storeConstellationPoints(int32_t n);
+        void deliverSymbol(int32_t n);
+
+        /* The symbols of a frame are split into one partition per thread.
+         * The FFT of all partitions is done first, because the demodulation
+         * of the first symbol of a partition needs the bins of the last
+         * symbol of the previous one. Partition 0 is done by the decoder
+         * thread itself, which then hands all softbits over to the FIC and
+         * MSC handlers in symbol order. */
+        enum class Stage { FFT, Demodulate };
+        void runPartition(Stage stage, size_t partition);
+        void startStage(Stage stage);
+        void waitForPartition(size_t partition);
+        void demodulatorThread(size_t partition);
 
-        int32_t T_g;
-        std::vector<DSPCOMPLEX> phaseReference;
-        fft::Forward fft_handler;
-        DSPCOMPLEX   *fft_buffer;
+        std::vector<int32_t> partitionStart; // partitions + 1 entries
+        std::vector<std::unique_ptr<fft::ForwardBatch> > partitionFFT;
+
+        /* Only the MSC symbols holding CUs of the selected subchannels are
+         * transformed and demodulated, together with the symbol in front
+         * of each of them, which is its phase reference. When a partition
+         * is not needed completely, or the batched FFT is forced to the
+         * reference code, its symbols are transformed one by one, from a
+         * copy in the aligned scratch buffer of the partition. */
+        void selectSymbols();
+        std::vector<char> active_blocks;    // per MSC block of a CIF
+        std::vector<char> symbol_needed;    // demodulate symbol n
+        std::vector<char> bins_needed;      // transform symbol n
+        std::vector<char> partition_complete;
+        fft::ForwardBatch symbolFFT;
+        std::vector<fft::AlignedVector<DSPCOMPLEX> > partitionScratch;
+        std::vector<std::thread> demodulators;
+
+        fft::AlignedVector<DSPCOMPLEX> current_frame;
+
+        std::mutex stage_mutex;
+        std::condition_variable stage_cv;
+        std::condition_variable partition_done_cv;
+        uint64_t stage_generation = 0;
+        Stage current_stage = Stage::FFT;
+        std::vector<char> partition_done;
+        bool stop_demodulators = false;
+
+        // All symbols of a frame are transformed into frame_bins,
+        // T_u bins per symbol. The bins of the previous symbol are the
+        // phase reference of the next.
+        fft::AlignedVector<DSPCOMPLEX> frame_bins;
         FrequencyInterleaver interleaver;
 
-        std::vector<softbit_t> ibits;
+        // 2 * K softbits per symbol
+        std::vector<softbit_t> frame_bits;
         int16_t snrCount = 0;
+        int16_t snrSkipped = 0;
         float snr = 0;
+        std::atomic<int> snr_interval = ATOMIC_VAR_INIT(1);
+        std::atomic<bool> diagnostics_enabled = ATOMIC_VAR_INIT(true);
+        std::atomic<float> reported_snr = ATOMIC_VAR_INIT(0.0f);
+        LatencyHistogram frame_decode_time;
+        static constexpr float decodeLoadAlpha = 0.1f;
+        std::atomic<float> decode_load = ATOMIC_VAR_INIT(0.0f);
 
         const double mer_alpha = 1e-7;
         std::atomic<double> mer = ATOMIC_VAR_INIT(0.0);
 
-    public:
-        // Plotting all points is too costly, we decimate the number of points.
-        // The decimation factor should divide K for all transmission modes.
-        static const size_t constellationDecimation = 96;
-    private:
+        // Plotting all points is too costly, only every
+        // constellationDecimation-th carrier is kept. Both are taken from
+        // the diagnostics request of the radio controller for every frame.
+        bool captureConstellation = false;
+        bool captureSoftBits = false;
+        int32_t constellationDecimation = 1;
+        int32_t constellationPerSymbol = 0;
         std::vector<DSPCOMPLEX> constellationPoints;
 };
 
@@ -30,9 +30,13 @@
  *
  */
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include "ofdm-processor.h"
+#include "various/dsp-kernels.h"
 #include "various/profiling.h"
+#include "various/thread-config.h"
 #include <iostream>
 //
 #define SEARCH_RANGE        (2 * 36)
@@ -63,14 +67,16 @@ OFDMProcessor::OFDMProcessor(
     input(inputInterface),
     params(params),
     ficHandler(fic),
+    mscHandler(msc),
+    nullSymbol(params.T_null),
     tiiDecoder(params, ri),
     T_null(params.T_null),
     T_u(params.T_u),
     T_s(params.T_s),
     T_F(params.T_F),
-    oscillatorTable(INPUT_RATE),
     phaseRef(params, rro.fftPlacementMethod),
-    ofdmDecoder(params, ri, fic, msc),
+    ofdmDecoder(params, ri, fic, msc, rro.demodulatorThreads,
+            rro.memoryBudget > 0 ? budgetPooledFrames : SIZE_MAX),
     fft_handler(params.T_u),
     fft_buffer(fft_handler.getVector())
 {
@@ -89,18 +95,17 @@ OFDMProcessor::OFDMProcessor(
      * the decoded symbols
      */
 
-    for (int i = 0; i < INPUT_RATE; i ++)
-        oscillatorTable[i] = DSPCOMPLEX(cos(2.0 * M_PI * i / INPUT_RATE),
-                sin(2.0 * M_PI * i / INPUT_RATE));
-
     //  and for the correlation
     refArg.resize(CORRELATION_LENGTH);
-    for (int i = 0; i < CORRELATION_LENGTH; i ++)  {
-        refArg[i] = arg(phaseRef[(T_u + i) % T_u] *
-                conj(phaseRef[(T_u + i + 1) % T_u]));
+    std::vector<DSPCOMPLEX> refCarriers(CORRELATION_LENGTH + 1);
+    for (int i = 0; i <= CORRELATION_LENGTH; i ++)  {
+        refCarriers[i] = phaseRef[i % T_u];
     }
+    dsp::kernels().phaseDifference(refCarriers.data(), refArg.data(), CORRELATION_LENGTH);
 
     correlationVector.resize(SEARCH_RANGE + CORRELATION_LENGTH);
+    // the carriers around the center, for both coarse methods
+    searchCarriers.resize(SEARCH_RANGE + CORRELATION_LENGTH + 1);
 }
 
 OFDMProcessor::~OFDMProcessor()
@@ -121,10 +126,14 @@ void OFDMProcessor::restart()
         threadHandle.join();
     }
 
-    coarseCorrector    = 0;
-    fineCorrector      = 0;
+    coarseCorrector    = initialCoarseCorrector;
+    fineCorrector      = initialFineCorrector;
+    lastValidCorrectors = false;
+    synced = false;
     syncBufferIndex    = 0;
     sLevel             = 0;
+    pendingSamples.clear();
+    pendingOffset      = 0;
     localPhase         = 0;
     input.restart();
     running            = true;
@@ -134,69 +143,103 @@ void OFDMProcessor::restart()
 class InputFailure { };
 class NotRunningAnymore { };
 
+// Upper bound for a single wait on the input, so that a stop request
+// is noticed even if the device delivers no samples at all.
+static constexpr auto INPUT_WAIT_TIMEOUT = std::chrono::milliseconds(50);
+
 /**
- * \brief getSample
- * Profiling shows that getting a sample, together
- * with the frequency shift, is a real performance killer.
- * we therefore distinguish between getting a single sample
- * and getting a vector full of samples
+ * \brief mixSamples
+ * Shift n samples by -phase Hz and update the long term level sLevel.
+ * Instead of a table covering one second of oscillator phases, a bank
+ * of MIX_LANES phasors, each MIX_LANES samples apart, is rotated per
+ * block. The inner loops are free of dependencies and are vectorised
+ * by the compiler. The phasors are rebuilt from the integer localPhase
+ * on every call, so no rounding error accumulates across calls.
  */
-
-DSPCOMPLEX OFDMProcessor::getSample(int32_t phase)
+void OFDMProcessor::mixSamples(DSPCOMPLEX *v, int32_t n, int32_t phase)
 {
-    DSPCOMPLEX temp;
-    if (!running)
-        throw NotRunningAnymore();
-    /// bufferContent is an indicator for the value of ...->Samples ()
-    if (bufferContent == 0) {
-        bufferContent = input.getSamplesToRead ();
-        while ((bufferContent == 0) && running) {
-            if (not input.is_ok()) {
-                throw InputFailure();
-            }
-            std::this_thread::sleep_for(std::chrono::microseconds(10));
-            bufferContent = input.getSamplesToRead ();
-        }
+    constexpr int MIX_LANES = 16;
+    constexpr double a = 0.00001; // sLevel IIR coefficient
+
+    const int32_t lanes = std::min<int32_t>(n, MIX_LANES);
+    float rotRe[MIX_LANES];
+    float rotIm[MIX_LANES];
+    for (int k = 0; k < lanes; k++) {
+        const int64_t p = (int64_t)localPhase - (int64_t)(k + 1) * phase;
+        const double w = 2.0 * M_PI * p / INPUT_RATE;
+        rotRe[k] = cos(w);
+        rotIm[k] = sin(w);
     }
 
-    if (!running)
-        throw NotRunningAnymore();
-    //
-    //  so here, bufferContent > 0
-    input.getSamples (&temp, 1);
-    bufferContent --;
+    const double wStep = -2.0 * M_PI * (double)MIX_LANES * phase / INPUT_RATE;
+    const float stepRe = cos(wStep);
+    const float stepIm = sin(wStep);
+
+    float *samples = reinterpret_cast<float*>(v);
+    float level = 0;
+
+    for (int32_t i = 0; i < n; i += MIX_LANES) {
+        const int32_t m = std::min<int32_t>(MIX_LANES, n - i);
+        float *s = samples + 2 * i;
+        for (int k = 0; k < m; k++) {
+            const float re = s[2 * k] * rotRe[k] - s[2 * k + 1] * rotIm[k];
+            const float im = s[2 * k] * rotIm[k] + s[2 * k + 1] * rotRe[k];
+            s[2 * k] = re;
+            s[2 * k + 1] = im;
+            level += std::abs(re) + std::abs(im);
+        }
 
-    //
-    //  OK, we have a sample!!
-    //  first: adjust frequency. We need Hz accuracy
-    localPhase  -= phase;
-    localPhase  = (localPhase + INPUT_RATE) % INPUT_RATE;
-    temp        *= oscillatorTable[localPhase];
-    sLevel      = 0.00001 * l1_norm(temp) + (1 - 0.00001) * sLevel;
-#define N   5
-    sampleCnt   ++;
-    if (++ sampleCnt > INPUT_RATE / N) {
-        radioInterface.onFrequencyCorrectorChange(
-                fineCorrector, coarseCorrector);
-        sampleCnt = 0;
+        for (int k = 0; k < lanes; k++) {
+            const float re = rotRe[k] * stepRe - rotIm[k] * stepIm;
+            rotIm[k] = rotRe[k] * stepIm + rotIm[k] * stepRe;
+            rotRe[k] = re;
+        }
     }
-    return temp;
+
+    localPhase = ((int64_t)localPhase - (int64_t)n * phase) % INPUT_RATE;
+    if (localPhase < 0)
+        localPhase += INPUT_RATE;
+
+    // Closed form of n steps of sLevel = a * l1_norm + (1 - a) * sLevel,
+    // taking the mean level of the block as input
+    const float decay = pow(1 - a, n);
+    sLevel = decay * sLevel + (1 - decay) * level / n;
 }
 
+/**
+ * \brief getSamples
+ * Profiling shows that getting a sample, together
+ * with the frequency shift, is a real performance killer.
+ * All samples are therefore read in blocks, also during
+ * synchronisation.
+ */
 void OFDMProcessor::getSamples(DSPCOMPLEX *v, int16_t n, int32_t phase)
 {
-    int32_t     i;
-
     if (!running)
         throw NotRunningAnymore();
+
+    // Samples given back by the null detector are already mixed
+    const int32_t pending = std::min<int32_t>(n, pendingSamples.size() - pendingOffset);
+    if (pending > 0) {
+        std::copy(pendingSamples.begin() + pendingOffset,
+                pendingSamples.begin() + pendingOffset + pending, v);
+        pendingOffset += pending;
+        if (pendingOffset == pendingSamples.size()) {
+            pendingSamples.clear();
+            pendingOffset = 0;
+        }
+        v += pending;
+        n -= pending;
+        if (n == 0)
+            return;
+    }
     if (n > bufferContent) {
         bufferContent = input.getSamplesToRead ();
         while ((bufferContent < n) && running) {
             if (not input.is_ok()) {
                 throw InputFailure();
             }
-            std::this_thread::sleep_for(std::chrono::microseconds(10));
-            bufferContent = input.getSamplesToRead();
+            bufferContent = input.waitForSamples(n, INPUT_WAIT_TIMEOUT);
         }
     }
     if (!running)
@@ -208,13 +251,9 @@ void OFDMProcessor::getSamples(DSPCOMPLEX *v, int16_t n, int32_t phase)
 
     //  OK, we have samples!!
     //  first: adjust frequency. We need Hz accuracy
-    for (i = 0; i < n; i ++) {
-        localPhase  -= phase;
-        localPhase   = (localPhase + INPUT_RATE) % INPUT_RATE;
-        v[i]    *= oscillatorTable[localPhase];
-        sLevel   = 0.00001 * l1_norm(v[i]) + (1 - 0.00001) * sLevel;
-    }
+    mixSamples(v, n, phase);
 
+#define N   5
     sampleCnt += n;
     if (sampleCnt > INPUT_RATE / N) {
         radioInterface.onFrequencyCorrectorChange(
@@ -224,6 +263,33 @@ void OFDMProcessor::getSamples(DSPCOMPLEX *v, int16_t n, int32_t phase)
 }
 
 
+/**
+ * \brief pushBackSamples
+ * Return the tail of a block that was read too far, it will be
+ * delivered again by the next getSamples() call.
+ */
+void OFDMProcessor::pushBackSamples(const DSPCOMPLEX *v, int32_t n)
+{
+    if (n <= 0)
+        return;
+
+    pendingSamples.erase(pendingSamples.begin(),
+            pendingSamples.begin() + pendingOffset);
+    pendingOffset = 0;
+    pendingSamples.insert(pendingSamples.begin(), v, v + n);
+}
+
+/**
+ * \brief frameStamp
+ * The input stamps the sample it returned last, the samples pushed
+ * back are older than that and read again first.
+ */
+LatencyStamp OFDMProcessor::frameStamp(int32_t last)
+{
+    const int64_t pending = pendingSamples.size() - pendingOffset;
+    return input.getReadStamp().at(-pending - last);
+}
+
 /***
  *    \brief run
  *    The main thread, reading samples,
@@ -234,24 +300,63 @@ void OFDMProcessor::getSamples(DSPCOMPLEX *v, int16_t n, int32_t phase)
  */
 void OFDMProcessor::run()
 {
+    threading::ScopedThread threadConfig(ThreadStage::Sync, "dab-sync");
+
     int32_t startIndex;
     int32_t i;
     int32_t counter;
-    float currentStrength;
+    float currentStrength = 0;
     constexpr int32_t syncBufferSize  = 32768;
     constexpr int32_t syncBufferMask  = syncBufferSize - 1;
     float envBuffer[syncBufferSize];
 
-    std::vector<DSPCOMPLEX> ofdmBuffer(params.L * params.T_s);
-    std::vector<std::vector<DSPCOMPLEX> > allSymbols;
+    // The whole frame, handed over to the OfdmDecoder as is
+    fft::AlignedVector<DSPCOMPLEX> ofdmBuffer = ofdmDecoder.getFrameBuffer();
+
+    // The null detector works on blocks of syncBlockSize samples
+    constexpr int32_t syncBlockSize = 256;
+    std::vector<DSPCOMPLEX> syncBlock(syncBlockSize);
+    std::vector<DSPCOMPLEX> nullCandidate;
+    std::vector<DSPCOMPLEX> acquiredNull;
+
+    /**
+     * Feed the first n samples of syncBlock through the moving sum
+     * over the last 50 samples, as long as the sum stays above
+     * (whileAbove) or below the threshold. Returns the number of
+     * samples consumed. hopeless is set if counter exceeds maxCount.
+     */
+    auto scanEnvelope = [&](int32_t n, bool whileAbove, float threshold,
+            int32_t maxCount, bool& hopeless) -> int32_t {
+        float env[syncBlockSize];
+        dsp::kernels().l1Norm(syncBlock.data(), env, n);
+
+        hopeless = false;
+        for (int32_t k = 0; k < n; k++) {
+            const float level = currentStrength / 50;
+            if (whileAbove ? level <= threshold : level >= threshold) {
+                return k;
+            }
+
+            envBuffer [syncBufferIndex] = env[k];
+            //  update the levels
+            currentStrength += envBuffer [syncBufferIndex] -
+                envBuffer [(syncBufferIndex - 50) & syncBufferMask];
+            syncBufferIndex = (syncBufferIndex + 1) & syncBufferMask;
+            if (++counter > maxCount) {
+                hopeless = true;
+                return k + 1;
+            }
+        }
+        return n;
+    };
 
     try {
 
         //Initing:
         /// first, we need samples to get a reasonable sLevel
         sLevel   = 0;
-        for (i = 0; i < T_F / 2; i ++) {
-            l1_norm(getSample (0));
+        for (i = 0; i < T_F / 2; i += syncBlockSize) {
+            getSamples(syncBlock.data(), std::min(syncBlockSize, T_F / 2 - i), 0);
         }
 notSynced:
         PROFILE(NotSynced);
@@ -266,9 +371,9 @@ notSynced:
         //  read in T_s samples for a next attempt;
         syncBufferIndex = 0;
         currentStrength  = 0;
+        getSamples(syncBlock.data(), 50, 0);
+        dsp::kernels().l1Norm(syncBlock.data(), envBuffer, 50);
         for (i = 0; i < 50; i ++) {
-            DSPCOMPLEX sample         = getSample (0);
-            envBuffer [syncBufferIndex]   = l1_norm(sample);
             currentStrength           += envBuffer [syncBufferIndex];
             syncBufferIndex ++;
         }
@@ -281,20 +386,28 @@ notSynced:
          * here we start looking for the null level, i.e. a dip
          */
         counter  = 0;
+        if (synced) {
+            syncLosses.fetch_add(1, std::memory_order_relaxed);
+            synced = false;
+        }
         radioInterface.onSyncChange(false);
-        while (currentStrength / 50  > 0.50 * sLevel) {
-            DSPCOMPLEX sample =
-                getSample (coarseCorrector + fineCorrector);
-            envBuffer [syncBufferIndex] = l1_norm(sample);
-            //  update the levels
-            currentStrength += envBuffer [syncBufferIndex] -
-                envBuffer [(syncBufferIndex - 50) & syncBufferMask];
-            syncBufferIndex = (syncBufferIndex + 1) & syncBufferMask;
-            counter ++;
-            if (counter > T_F) { // hopeless
+        nullCandidate.clear();
+        while (true) {
+            bool hopeless;
+            getSamples(syncBlock.data(), syncBlockSize, coarseCorrector + fineCorrector);
+            const int32_t used = scanEnvelope(syncBlockSize, true, 0.50 * sLevel, T_F, hopeless);
+            pushBackSamples(&syncBlock[used], syncBlockSize - used);
+            if (hopeless) {
                 //           fprintf (stderr, "%f %f\n", currentStrength / 50, sLevel);
                 goto notSynced;
             }
+            if (used > 0) {
+                // Keep the samples leading into the dip for the TII decoder
+                nullCandidate.assign(syncBlock.begin(), syncBlock.begin() + used);
+            }
+            if (used < syncBlockSize) {
+                break;
+            }
         }
         /**
          * It seemed we found a dip that started app 65/100 * 50 samples earlier.
@@ -303,26 +416,37 @@ notSynced:
         counter  = 0;
         //SyncOnEndNull:
         PROFILE(SyncOnEndNull);
-        while (currentStrength / 50 < 0.75 * sLevel) {
-            DSPCOMPLEX sample = getSample (coarseCorrector + fineCorrector);
-            envBuffer [syncBufferIndex] = l1_norm(sample);
-            //  update the levels
-            currentStrength += envBuffer [syncBufferIndex] -
-                envBuffer [(syncBufferIndex - 50) & syncBufferMask];
-            syncBufferIndex = (syncBufferIndex + 1) & syncBufferMask;
-            counter   ++;
-            //
-            if (counter > T_null + 50) { // hopeless
+        while (true) {
+            bool hopeless;
+            getSamples(syncBlock.data(), syncBlockSize, coarseCorrector + fineCorrector);
+            const int32_t used = scanEnvelope(syncBlockSize, false, 0.75 * sLevel, T_null + 50, hopeless);
+            nullCandidate.insert(nullCandidate.end(), syncBlock.begin(), syncBlock.begin() + used);
+            pushBackSamples(&syncBlock[used], syncBlockSize - used);
+            if (hopeless) {
                 std::clog << "ofdm-processor: " << "SyncOnEndNull failed" << std::endl;
                 goto notSynced;
             }
+            if (used < syncBlockSize) {
+                break;
+            }
         }
         /**
          * The end of the null period is identified, probably about 40
          * samples earlier.
+         * Keep the T_null samples before that point, so that the TII
+         * can already be decoded from the first frame after acquisition.
          */
+        {
+            const int32_t nullEnd = std::max<int32_t>(0, nullCandidate.size() - 40);
+            const int32_t nullLength = std::min(nullEnd, T_null);
+            acquiredNull.assign(T_null, DSPCOMPLEX(0, 0));
+            std::copy(nullCandidate.begin() + nullEnd - nullLength,
+                    nullCandidate.begin() + nullEnd,
+                    acquiredNull.end() - nullLength);
+        }
 SyncOnPhase:
         PROFILE(SyncOnPhase);
+        frameArena.reset();
         /**
          * We now have to find the exact first sample of the non-null period.
          * We use a correlation that will find the first sample after the
@@ -338,14 +462,45 @@ SyncOnPhase:
         //
         /// and then, call upon the phase synchronizer to verify/compute
         /// the real "first" sample
-        startIndex = phaseRef.findIndex(ofdmBuffer.data(),
-                impulseResponseBuffer);
+        {
+            diagnostics_request_t diagnostics = radioInterface.getDiagnosticsRequest();
+            if (governor.atLeast(LoadGovernor::Level::NoDiagnostics)) {
+                diagnostics.impulseResponse = false;
+                diagnostics.nullSymbol = false;
+            }
+            nullSymbolRequested = diagnostics.nullSymbol;
+
+            // Once locked, it is enough to follow the known peak. The
+            // impulse response is only available from the full search.
+            startIndex = -1;
+            if (not diagnostics.impulseResponse and
+                    ficHandler.getFicDecodeRatioPercent() >= trackingFicRatio) {
+                startIndex = phaseRef.trackIndex(ofdmBuffer.data());
+            }
+
+            if (startIndex < 0) {
+                // impulseResponseBuffer is kept, so that findIndex does not
+                // have to allocate it again for the next frame
+                startIndex = phaseRef.findIndex(ofdmBuffer.data(),
+                        impulseResponseBuffer, frameArena);
+
+                if (diagnostics.impulseResponse) {
+                    const size_t step = std::max(diagnostics.impulseResponseDecimation, 1);
+                    const float scale = 1.0f / T_u;
+                    std::vector<float> impulseResponse;
+                    impulseResponse.reserve((impulseResponseBuffer.size() + step - 1) / step);
+                    for (size_t k = 0; k < impulseResponseBuffer.size(); k += step) {
+                        impulseResponse.push_back(impulseResponseBuffer[k] * scale);
+                    }
+                    radioInterface.onNewImpulseResponse(std::move(impulseResponse));
+                }
+            }
+        }
         PROFILE(FindIndex);
-        radioInterface.onNewImpulseResponse(std::move(impulseResponseBuffer));
-        impulseResponseBuffer.clear();
 
         if (startIndex < 0) { // no sync, try again
             std::clog << "ofdm-processor: " << "SyncOnPhase failed" << std::endl;
+            acquireCoarseCorrector(ofdmBuffer.data());
             goto notSynced;
         }
         if (scanMode) {
@@ -368,6 +523,7 @@ SyncOnPhase:
          * first data symbol.
          * We read the missing samples in the ofdm buffer
          */
+        synced = true;
         radioInterface.onSyncChange(true);
         getSamples(&ofdmBuffer[ofdmBufferIndex],
                 T_u - ofdmBufferIndex,
@@ -378,12 +534,24 @@ SyncOnPhase:
             std::lock_guard<std::mutex> lock(receiver_options_mutex);
             rro = receiver_options;
         }
+        if (governor.atLeast(LoadGovernor::Level::NoTII)) {
+            rro.decodeTII = false;
+        }
+        const bool idleFrame = skipIdleFrame(rro);
+        if (idleFrame) {
+            rro.decodeTII = false;
+        }
 
-        std::vector<complexf> prs;
+        // ofdmBuffer goes to the OfdmDecoder before the NULL arrives
+        auto prs = frameArena.makeVector<complexf>();
         if (rro.decodeTII) {
-            prs.resize(T_u);
-            std::copy(ofdmBuffer.begin(), ofdmBuffer.begin() + T_u, prs.begin());
+            prs.assign(ofdmBuffer.begin(), ofdmBuffer.begin() + T_u);
         }
+        if (rro.decodeTII and not acquiredNull.empty()) {
+            // The null symbol found by the detector precedes this PRS
+            tiiDecoder.pushSymbols(acquiredNull, prs.data(), prs.size());
+        }
+        acquiredNull.clear();
 
         //  Here we look only at the PRS when we need a coarse
         //  frequency synchronization.
@@ -396,6 +564,7 @@ SyncOnPhase:
         //  be off.
         if (!rro.disableCoarseCorrector and ficHandler.getFicDecodeRatioPercent() < 50) {
             if (!coarseSyncCounter) {
+                coarseSyncLosses.fetch_add(1, std::memory_order_relaxed);
                 std::clog << "ofdm-processor: " << "Lost coarse sync (coarseCorrector: " << lastValidCoarseCorrector << "; fineCorrector: " <<  lastValidFineCorrector << ")" << std::endl;
             }
 
@@ -415,12 +584,9 @@ SyncOnPhase:
 
             lastValidFineCorrector = fineCorrector;
             lastValidCoarseCorrector = coarseCorrector;
+            lastValidCorrectors = true;
         }
 
-        allSymbols.resize(params.L);
-        allSymbols[0] = move(ofdmBuffer);
-        ofdmBuffer.resize(params.L * params.T_s);
-
         /**
          * after symbol 0, we will just read in the other (params.L - 1) symbols
          */
@@ -431,23 +597,51 @@ SyncOnPhase:
          * symbols.  We immediately start with building up an average of the
          * phase difference between the samples in the cyclic prefix and the
          * corresponding samples in the datapart.
+         * The symbols are read in right behind the PRS, so that the useful
+         * part of every symbol starts at a multiple of T_s.
          */
+        DSPCOMPLEX *frame = ofdmBuffer.data();
+        if (idleFrame) {
+            // Read for the fine corrector only, the buffer is kept
+            rro.streamSymbols = false;
+        }
+        else if (rro.streamSymbols) {
+            // The decoder starts on the PRS while we read the data symbols
+            ofdmDecoder.beginFrame(move(ofdmBuffer), frameStamp(T_u - 1));
+            ofdmDecoder.symbolsReady(1);
+        }
+
         DSPCOMPLEX FreqCorr = DSPCOMPLEX(0, 0);
         for (int sym = 1; sym < params.L; sym ++) {
-            auto& buf = allSymbols[sym];
-            buf.resize(T_s);
-            getSamples(buf.data(), T_s, coarseCorrector + fineCorrector);
+            DSPCOMPLEX *buf = &frame[T_u + (sym - 1) * T_s];
+            getSamples(buf, T_s, coarseCorrector + fineCorrector);
             for (int i = T_u; i < T_s; i ++)
                 FreqCorr += buf[i] * conj(buf[i - T_u]);
+
+            if (rro.streamSymbols) {
+                ofdmDecoder.symbolsReady(sym + 1);
+            }
         }
 
         PROFILE(PushAllSymbols);
-        ofdmDecoder.pushAllSymbols(move(allSymbols));
+        if (idleFrame) {
+            framesIdle.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            if (rro.streamSymbols) {
+                ofdmDecoder.endFrame(true);
+            }
+            else {
+                ofdmDecoder.pushFrame(move(ofdmBuffer),
+                        frameStamp(T_u + (params.L - 1) * T_s - 1));
+            }
+            ofdmBuffer = ofdmDecoder.getFrameBuffer();
+        }
 
         //NewOffset:
         /// we integrate the newly found frequency error with the
         /// existing frequency error.
-        fineCorrector += 0.1 * arg(FreqCorr) / M_PI *
+        fineCorrector += 0.1 * dsp::arg(FreqCorr) / M_PI *
             (params.carrierDiff / 2);
         //
         /**
@@ -459,14 +653,15 @@ SyncOnPhase:
 
         PROFILE(DecodeTII);
         // The NULL is interesting to save because it carries the TII.
-        std::vector<DSPCOMPLEX> nullSymbol(T_null);
         getSamples(nullSymbol.data(), T_null, coarseCorrector + fineCorrector);
         if (rro.decodeTII) {
-            tiiDecoder.pushSymbols(nullSymbol, prs);
+            tiiDecoder.pushSymbols(nullSymbol, prs.data(), prs.size());
         }
 
         PROFILE(OnNewNull);
-        radioInterface.onNewNullSymbol(std::move(nullSymbol));
+        if (nullSymbolRequested) {
+            radioInterface.onNewNullSymbol(std::vector<DSPCOMPLEX>(nullSymbol));
+        }
 
         /**
          * The first sample to be found for the next frame should be T_g
@@ -487,6 +682,10 @@ SyncOnPhase:
         //ReadyForNewFrame:
         /// and off we go, up to the next frame
         PROFILE_FRAME_DECODED();
+        if (not idleFrame) {
+            framesProcessed.fetch_add(1, std::memory_order_relaxed);
+        }
+        governLoad(rro.loadGovernor);
         goto SyncOnPhase;
     }
     catch (const NotRunningAnymore&) {
@@ -497,9 +696,60 @@ SyncOnPhase:
         running = false; //Needed before onInputFailure, because subsequent calls will call OFDMProcessor::stop()
         radioInterface.onInputFailure();
     }
+    // The decoder must not wait for the rest of a frame being streamed
+    ofdmDecoder.endFrame(false);
+    ofdmDecoder.returnFrameBuffer(move(ofdmBuffer));
     running = false;
 }
 
+bool OFDMProcessor::skipIdleFrame(const RadioReceiverOptions& rro)
+{
+    // A subchannel added in the meantime gets this frame decoded
+    const bool idleNow = rro.idleFicInterval > 0 and not scanMode and
+        not idleInhibited and not mscHandler.hasSubchannels() and
+        ficHandler.fibProcessor.isEnsembleCompleteSignalled();
+
+    if (idleNow != idle) {
+        std::clog << "OFDM-processor: " << (idleNow ? "idle, decoding the FIC of every " +
+                std::to_string(rro.idleFicInterval) + ". frame" : "decoding every frame") << std::endl;
+        idle = idleNow;
+        idleFrameCount = 0;
+    }
+
+    if (not idleNow) {
+        return false;
+    }
+    return idleFrameCount++ % rro.idleFicInterval != 0;
+}
+
+void OFDMProcessor::governLoad(bool enabled)
+{
+    using Level = LoadGovernor::Level;
+    const Level previous = governor.level();
+    if (enabled) {
+        governor.update(ofdmDecoder.getDecodeLoad());
+    }
+    else {
+        governor.reset();
+    }
+
+    const Level level = governor.level();
+    if (level == previous) {
+        return;
+    }
+
+    std::clog << "OFDM-processor: decode load " << ofdmDecoder.getDecodeLoad() <<
+        ", processing level " << LoadGovernor::levelName(level) << std::endl;
+
+    // TII and the diagnostics of the OFDMProcessor follow the level
+    // with the next frame
+    ofdmDecoder.setDiagnosticsEnabled(not governor.atLeast(Level::NoDiagnostics));
+    ofdmDecoder.setSnrInterval(governor.atLeast(Level::ReducedSNR) ? LoadGovernor::snrInterval : 1);
+    mscHandler.setBackgroundSlideshow(not governor.atLeast(Level::NoBackgroundSlideshow));
+    mscHandler.limitWarmStandby(governor.atLeast(Level::NoWarmStandby) ? 0 : SIZE_MAX);
+    degradationLevel = static_cast<int>(level);
+}
+
 void OFDMProcessor::stop()
 {
     if (running) {
@@ -515,6 +765,42 @@ void OFDMProcessor::resetCoarseCorrector()
     coarseCorrector = 0;
 }
 
+void OFDMProcessor::flushPipeline()
+{
+    ofdmDecoder.flush();
+    tiiDecoder.reset();
+}
+
+void OFDMProcessor::setInitialCorrectors(int32_t coarse, int16_t fine)
+{
+    initialCoarseCorrector = abs(coarse) > kHz(35) ? 0 : coarse;
+    initialFineCorrector = fine;
+}
+
+bool OFDMProcessor::getLastValidCorrectors(int32_t& coarse, int16_t& fine) const
+{
+    coarse = lastValidCoarseCorrector;
+    fine = lastValidFineCorrector;
+    return lastValidCorrectors;
+}
+
+OFDMProcessor::Stats OFDMProcessor::getStats() const
+{
+    return Stats{
+        framesProcessed.load(std::memory_order_relaxed),
+        framesIdle.load(std::memory_order_relaxed),
+        idle.load(std::memory_order_relaxed),
+        syncLosses.load(std::memory_order_relaxed),
+        coarseSyncLosses.load(std::memory_order_relaxed),
+        ofdmDecoder.getFrameQueueStats(),
+        synced.load(std::memory_order_relaxed),
+        ofdmDecoder.getSnr(),
+        ofdmDecoder.getFrameDecodeTime().snapshot(),
+        ofdmDecoder.getDecodeLoad(),
+        degradationLevel.load(std::memory_order_relaxed),
+        ofdmDecoder.getMemoryBytes() };
+}
+
 void OFDMProcessor::setReceiverOptions(const RadioReceiverOptions rro)
 {
     std::unique_lock<std::mutex> lock(receiver_options_mutex);
@@ -533,6 +819,51 @@ void OFDMProcessor::set_scanMode(bool b)
     scanMode = b;
 }
 
+void OFDMProcessor::inhibitIdle(bool inhibit)
+{
+    idleInhibited = inhibit;
+}
+
+/**
+ * After a failed timing acquisition, a large frequency offset is the
+ * likely reason, because the PRS correlation does not work any more when
+ * the carriers are off by more than a fraction of the carrier spacing.
+ * The coarse offset is estimated from the samples at hand, such that
+ * the next attempt is made with the right corrector, instead of moving
+ * the corrector by processPRS() one frame at a time.
+ */
+void OFDMProcessor::acquireCoarseCorrector(const DSPCOMPLEX *v)
+{
+    {
+        std::lock_guard<std::mutex> lock(receiver_options_mutex);
+        if (receiver_options.disableCoarseCorrector) {
+            return;
+        }
+    }
+
+    if (ficHandler.getFicDecodeRatioPercent() >= 50) {
+        return;
+    }
+
+    int32_t offset = 0;
+    const int32_t maxOffset = kHz(35) / params.carrierDiff;
+    if (phaseRef.estimateCarrierOffset(v, maxOffset, offset) and offset != 0) {
+        coarseCorrector += offset * params.carrierDiff;
+        if (abs(coarseCorrector) > kHz(35))
+            coarseCorrector = 0;
+        std::clog << "ofdm-processor: " << "coarse offset of " << offset <<
+            " carriers, coarseCorrector: " << coarseCorrector << std::endl;
+    }
+}
+
+//  searchCarriers[i] = fft_buffer[(first + i) % T_u]
+void OFDMProcessor::gatherCarriers(int16_t first, int16_t count)
+{
+    for (int16_t i = 0; i < count; i ++) {
+        searchCarriers[i] = fft_buffer[(first + i) % T_u];
+    }
+}
+
 #define RANGE 36
 int16_t OFDMProcessor::processPRS(DSPCOMPLEX *v, const FreqsyncMethod& freqsyncMethod)
 {
@@ -557,12 +888,9 @@ int16_t OFDMProcessor::processPRS(DSPCOMPLEX *v, const FreqsyncMethod& freqsyncM
             //  It seems to work pretty well
             //
             //  The phase differences are computed once
-            for (i = 0; i < SEARCH_RANGE + CORRELATION_LENGTH; i ++) {
-                int16_t baseIndex = T_u - SEARCH_RANGE / 2 + i;
-                correlationVector[i] =
-                    arg(fft_buffer[baseIndex % T_u] *
-                    conj(fft_buffer[(baseIndex + 1) % T_u]));
-            }
+            gatherCarriers(T_u - SEARCH_RANGE / 2, SEARCH_RANGE + CORRELATION_LENGTH + 1);
+            dsp::kernels().phaseDifference(searchCarriers.data(),
+                    correlationVector.data(), SEARCH_RANGE + CORRELATION_LENGTH);
 
             float    MMax    = 0;
             for (i = 0; i < SEARCH_RANGE; i ++) {
@@ -583,26 +911,25 @@ int16_t OFDMProcessor::processPRS(DSPCOMPLEX *v, const FreqsyncMethod& freqsyncM
         {
             //  An alternative way is to look at a special pattern consisting
             //  of zeros in the row of args between successive carriers.
+            //  The phase differences of the successive carriers i + 1 ..
+            //  i + 22 of all i are computed once, as d[i + 1 - first]
             float Mmin   = 1000;
+            const int16_t first = T_u - SEARCH_RANGE / 2 + 1;
+            gatherCarriers(first, SEARCH_RANGE + 22);
+            float *d = correlationVector.data();
+            dsp::kernels().phaseDifference(searchCarriers.data(), d, SEARCH_RANGE + 21);
             for (i = T_u - SEARCH_RANGE / 2; i < T_u + SEARCH_RANGE / 2; i ++) {
-                float a1  =  abs (abs (arg (fft_buffer [(i + 1) % T_u] *
-                                conj (fft_buffer [(i + 2) % T_u])) / M_PI) - 1);
-                float a2  =  abs (abs (arg (fft_buffer [(i + 2) % T_u] *
-                                conj (fft_buffer [(i + 3) % T_u])) / M_PI) - 1);
-                float a3   = abs (arg (fft_buffer [(i + 3) % T_u] *
-                            conj (fft_buffer [(i + 4) % T_u])));
-                float a4   = abs (arg (fft_buffer [(i + 4) % T_u] *
-                            conj (fft_buffer [(i + 5) % T_u])));
-                float a5   = abs (arg (fft_buffer [(i + 5) % T_u] *
-                            conj (fft_buffer [(i + 6) % T_u])));
-                float b1   = abs (abs (arg (fft_buffer [(i + 16 + 1) % T_u] *
-                                conj (fft_buffer [(i + 16 + 3) % T_u])) / M_PI) - 1);
-                float b2   = abs (arg (fft_buffer [(i + 16 + 3) % T_u] *
-                            conj (fft_buffer [(i + 16 + 4) % T_u])));
-                float b3   = abs (arg (fft_buffer [(i + 16 + 4) % T_u] *
-                            conj (fft_buffer [(i + 16 + 5) % T_u])));
-                float b4   = abs (arg (fft_buffer [(i + 16 + 5) % T_u] *
-                            conj (fft_buffer [(i + 16 + 6) % T_u])));
+                const int16_t o = i + 1 - first;
+                float a1  =  abs (abs (d [o] / M_PI) - 1);
+                float a2  =  abs (abs (d [o + 1] / M_PI) - 1);
+                float a3   = abs (d [o + 2]);
+                float a4   = abs (d [o + 3]);
+                float a5   = abs (d [o + 4]);
+                float b1   = abs (abs (dsp::arg (searchCarriers [o + 16] *
+                                conj (searchCarriers [o + 18])) / M_PI) - 1);
+                float b2   = abs (d [o + 18]);
+                float b3   = abs (d [o + 19]);
+                float b4   = abs (d [o + 20]);
                 float sum = a1 + a2 + a3 + a4 + a5 + b1 + b2 + b3 + b4;
                 if (sum < Mmin) {
                     Mmin = sum;
@@ -43,10 +43,12 @@
 #include "tii-decoder.h"
 #include "virtual_input.h"
 #include "fft.h"
+#include "frame-arena.h"
 #include "radio-controller.h"
 #include "radio-receiver-options.h"
 #include "fic-handler.h"
 #include "msc-handler.h"
+#include "load-governor.h"
 
 class OFDMProcessor
 {
@@ -65,9 +67,42 @@ class OFDMProcessor
 
         void stop();
         void resetCoarseCorrector();
+
+        /* Forget the frames and TII measurements of the channel received
+         * so far, before restart() on another one. The threads and buffers
+         * are kept. Only while stopped. */
+        void flushPipeline();
+
+        /* Start the frequency correction at the values the receiver had
+         * locked to on an earlier reception, see restart() */
+        void setInitialCorrectors(int32_t coarse, int16_t fine);
+
+        /* The correctors of the last frame with a good FIC, only
+         * meaningful while the processor is stopped. Returns false if
+         * there was none since the last restart(). */
+        bool getLastValidCorrectors(int32_t& coarse, int16_t& fine) const;
         void setReceiverOptions(const RadioReceiverOptions rro);
         void set_scanMode(bool);
 
+        // Keeps every frame decoded, see RadioReceiverOptions::idleFicInterval
+        void inhibitIdle(bool inhibit);
+
+        struct Stats {
+            uint64_t framesProcessed;   // frames handed to the OfdmDecoder
+            uint64_t framesIdle;        // frames only synchronised to, while idle
+            bool idle;
+            uint64_t syncLosses;        // times the time synchronisation was lost
+            uint64_t coarseSyncLosses;  // times the coarse corrector had to search
+            OfdmDecoder::FrameQueueStats frameQueue;
+            bool synced;
+            float snr;
+            LatencyHistogram::Snapshot frameDecodeTime;
+            float decodeLoad;           // see OfdmDecoder::getDecodeLoad
+            int degradationLevel;       // see LoadGovernor::Level
+            size_t memoryBytes;         // see OfdmDecoder::getMemoryBytes
+        };
+        Stats getStats(void) const;
+
     private:
         std::mutex receiver_options_mutex;
         RadioReceiverOptions receiver_options;
@@ -78,9 +113,33 @@ class OFDMProcessor
         InputInterface& input;
         const DABParams& params;
         FicHandler& ficHandler;
+        MscHandler& mscHandler;
         std::vector<float> impulseResponseBuffer;
+        // Temporary buffers of one frame, reset when the next one starts
+        FrameArena frameArena{64 * 1024};
+        std::vector<DSPCOMPLEX> nullSymbol;     // of size T_null
+        bool nullSymbolRequested = true;
+
+        // PhaseReference::trackIndex replaces the full timing acquisition
+        // while at least this percentage of the FICs is decoded
+        static const int trackingFicRatio = 80;
+
+        // Under a memory budget, the OfdmDecoder keeps a single spare frame
+        // buffer, about 1.5 MB in mode I, instead of one per queue slot
+        static constexpr size_t budgetPooledFrames = 1;
         TIIDecoder tiiDecoder;
 
+        // Fed once per frame, if enabled by the receiver options
+        LoadGovernor governor;
+        std::atomic<int> degradationLevel = ATOMIC_VAR_INIT(0);
+        void governLoad(bool enabled);
+
+        // Whether the frame is skipped, updates idle
+        bool skipIdleFrame(const RadioReceiverOptions& rro);
+        std::atomic<bool> idleInhibited = ATOMIC_VAR_INIT(false);
+        std::atomic<bool> idle = ATOMIC_VAR_INIT(false);
+        int idleFrameCount = 0;
+
         std::atomic<bool> running = ATOMIC_VAR_INIT(false);
 
         int32_t T_null;
@@ -89,7 +148,12 @@ class OFDMProcessor
         int32_t T_F;
         int32_t coarseSyncCounter = 0;
 
-        std::vector<DSPCOMPLEX> oscillatorTable;
+        // For getStats(), only written by the processing thread
+        std::atomic<bool> synced = ATOMIC_VAR_INIT(false);
+        std::atomic<uint64_t> framesProcessed = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> framesIdle = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> syncLosses = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> coarseSyncLosses = ATOMIC_VAR_INIT(0);
 
         int32_t localPhase = 0;
 
@@ -98,27 +162,41 @@ class OFDMProcessor
 
         int16_t lastValidFineCorrector = 0;
         int32_t lastValidCoarseCorrector = 0;
+        bool lastValidCorrectors = false;
         int16_t fineCorrector = 0;
         int32_t coarseCorrector = 0;
+        int16_t initialFineCorrector = 0;
+        int32_t initialCoarseCorrector = 0;
 
         uint32_t ofdmBufferIndex = 0;
         PhaseReference phaseRef;
         OfdmDecoder ofdmDecoder;
         std::vector<float> correlationVector;
         std::vector<float> refArg;
+        // Contiguous copies of the PRS carriers for the phase kernels
+        std::vector<DSPCOMPLEX> searchCarriers;
+        void gatherCarriers(int16_t first, int16_t count);
 
         bool scanMode = false;
         int attempts = 0;
 
         int32_t bufferContent = 0;
 
+        // Read ahead by the null detector, delivered first by getSamples()
+        std::vector<DSPCOMPLEX> pendingSamples;
+        size_t pendingOffset = 0;
+
         fft::Forward fft_handler;
         DSPCOMPLEX *fft_buffer; // of size T_u
 
-        DSPCOMPLEX getSample(int32_t);
         void getSamples(DSPCOMPLEX *, int16_t, int32_t);
+        void pushBackSamples(const DSPCOMPLEX *v, int32_t n);
+        // Of the first sample of the frame, the last one got is at offset last
+        LatencyStamp frameStamp(int32_t last);
+        void mixSamples(DSPCOMPLEX *v, int32_t n, int32_t phase);
         void run(void);
         int16_t processPRS(DSPCOMPLEX *v, const FreqsyncMethod& freqsyncMethod);
+        void acquireCoarseCorrector(const DSPCOMPLEX *v);
         int16_t getMiddle(DSPCOMPLEX *);
 };
 #endif
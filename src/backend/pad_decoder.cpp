@@ -163,10 +163,10 @@ void PADDecoder::Process(const uint8_t *xpad_data, size_t xpad_len, bool exact_x
 					mot_decoder.SetLen(dgli_len);
 
 				// if new Data Group available, append it
-				if(mot_decoder.ProcessDataSubfield(start, xpad + xpad_offset, xpad_ci.len)) {
+				if(mot_enabled && mot_decoder.ProcessDataSubfield(start, xpad + xpad_offset, xpad_ci.len)) {
 					// if new slide available, show it
 					if(mot_manager.HandleMOTDataGroup(mot_decoder.GetMOTDataGroup())) {
-						const MOT_FILE new_slide = mot_manager.GetFile();
+						MOT_FILE new_slide = mot_manager.TakeFile();
 
 						// check file type
 						bool show_slide = true;
@@ -181,7 +181,7 @@ void PADDecoder::Process(const uint8_t *xpad_data, size_t xpad_len, bool exact_x
 						}
 
 						if(show_slide)
-							observer->PADChangeSlide(new_slide);
+							observer->PADChangeSlide(std::move(new_slide));
 					}
 				}
 
@@ -295,6 +295,7 @@ void DynamicLabelDecoder::Reset() {
 
 	dl_sr.Reset();
 	label.Reset();
+	dl_plus_raw.clear();
 }
 
 bool DynamicLabelDecoder::DecodeDataGroup() {
@@ -302,6 +303,7 @@ bool DynamicLabelDecoder::DecodeDataGroup() {
 
 	size_t field_len = 0;
 	bool cmd_remove_label = false;
+	bool cmd_dl_plus = false;
 
 	// handle command/segment
 	if(command) {
@@ -309,6 +311,10 @@ bool DynamicLabelDecoder::DecodeDataGroup() {
 		case 0x01:	// remove label
 			cmd_remove_label = true;
 			break;
+		case 0x02:	// DL Plus
+			cmd_dl_plus = true;
+			field_len = (dg_raw[1] & 0x0F) + 1;
+			break;
 		default:
 			// ignore command
 			DataGroup::Reset();
@@ -332,78 +338,139 @@ bool DynamicLabelDecoder::DecodeDataGroup() {
 	// on Remove Label command, display empty label
 	if(cmd_remove_label) {
 		label.Reset();
+		dl_plus_raw.clear();
 		return true;
 	}
 
+	if(cmd_dl_plus) {
+		bool result = DecodeDLPlusCommand(&dg_raw[2], field_len);
+		DataGroup::Reset();
+		return result;
+	}
+
 	// create new segment
 	DL_SEG dl_seg;
 	memcpy(dl_seg.prefix, &dg_raw[0], 2);
-	dl_seg.chars.insert(dl_seg.chars.begin(), dg_raw.begin() + 2, dg_raw.begin() + 2 + field_len);
+	memcpy(dl_seg.chars, &dg_raw[2], field_len);
+	dl_seg.chars_len = field_len;
 
 	DataGroup::Reset();
 
-//	fprintf(stderr, "DynamicLabelDecoder: segnum %d, toggle: %s, chars_len: %2d%s\n", dl_seg.SegNum(), dl_seg.Toggle() ? "Y" : "N", dl_seg.chars.size(), dl_seg.Last() ? " [LAST]" : "");
+//	fprintf(stderr, "DynamicLabelDecoder: segnum %d, toggle: %s, chars_len: %2zu%s\n", dl_seg.SegNum(), dl_seg.Toggle() ? "Y" : "N", dl_seg.chars_len, dl_seg.Last() ? " [LAST]" : "");
 
 	// try to add segment
 	if(!dl_sr.AddSegment(dl_seg))
 		return false;
 
 	// append new label
+	int charset = dl_sr.dl_segs[0].prefix[1] >> 4;
+	if(label.raw == dl_sr.label_raw && label.charset == charset)
+		return false;
+
 	label.raw = dl_sr.label_raw;
-	label.charset = dl_sr.dl_segs[0].prefix[1] >> 4;
+	label.charset = charset;
+
+	// DL Plus tags of the previous label no longer apply; the repeated command is parsed again
+	label.ResetDLPlus();
+	dl_plus_raw.clear();
+	return true;
+}
+
+bool DynamicLabelDecoder::DecodeDLPlusCommand(const uint8_t *data, size_t len) {
+	// the command is usually repeated unchanged along with the label; parse it only once
+	if(dl_plus_raw.size() == len && std::equal(data, data + len, dl_plus_raw.begin()))
+		return false;
+	dl_plus_raw.assign(data, data + len);
+
+	// only DL Plus tags command supported (CId 0)
+	if((data[0] >> 4) != 0x0)
+		return false;
+
+	size_t tags = (data[0] & 0x03) + 1;
+	if(len < 1 + tags * 3)
+		return false;
+
+	dl_plus_tags_t dl_plus_tags;
+	for(size_t i = 0; i < tags; i++) {
+		const uint8_t *tag = data + 1 + i * 3;
+		int content_type = tag[0] & 0x7F;
+
+		// skip dummy tags
+		if(content_type == 0)
+			continue;
+		dl_plus_tags.emplace_back(content_type, tag[1] & 0x7F, tag[2] & 0x7F);
+	}
+
+	bool item_toggle = data[0] & 0x08;
+	bool item_running = data[0] & 0x04;
+
+	if(dl_plus_tags == label.dl_plus_tags && item_toggle == label.dl_plus_item_toggle && item_running == label.dl_plus_item_running)
+		return false;
+
+	label.dl_plus_tags = std::move(dl_plus_tags);
+	label.dl_plus_item_toggle = item_toggle;
+	label.dl_plus_item_running = item_running;
 	return true;
 }
 
 
 // --- DL_SEG_REASSEMBLER -----------------------------------------------------------------
 void DL_SEG_REASSEMBLER::Reset() {
-	dl_segs.clear();
+	for(bool& present : dl_segs_present)
+		present = false;
+	dl_segs_count = 0;
 	label_raw.clear();
 }
 
 bool DL_SEG_REASSEMBLER::AddSegment(DL_SEG &dl_seg) {
-	dl_segs_t::const_iterator it;
-
 	// if there are already segments with other toggle value in cache, first clear it
-	it = dl_segs.cbegin();
-	if(it != dl_segs.cend() && it->second.Toggle() != dl_seg.Toggle())
-		dl_segs.clear();
+	if(dl_segs_count) {
+		for(int i = 0; i < MAX_SEGS; i++) {
+			if(dl_segs_present[i]) {
+				if(dl_segs[i].Toggle() != dl_seg.Toggle()) {
+					for(bool& present : dl_segs_present)
+						present = false;
+					dl_segs_count = 0;
+				}
+				break;
+			}
+		}
+	}
 
 	// if the segment is already there, abort
-	it = dl_segs.find(dl_seg.SegNum());
-	if(it != dl_segs.cend())
+	int seg_num = dl_seg.SegNum();
+	if(dl_segs_present[seg_num])
 		return false;
 
 	// add segment
-	dl_segs[dl_seg.SegNum()] = dl_seg;
+	dl_segs[seg_num] = dl_seg;
+	dl_segs_present[seg_num] = true;
+	dl_segs_count++;
 
 	// check for complete label
 	return CheckForCompleteLabel();
 }
 
 bool DL_SEG_REASSEMBLER::CheckForCompleteLabel() {
-	dl_segs_t::const_iterator it;
-
 	// check if all segments are in cache
 	int segs = 0;
-	for(int i = 0; i < 8; i++) {
-		it = dl_segs.find(i);
-		if(it == dl_segs.cend())
+	for(int i = 0; i < MAX_SEGS; i++) {
+		if(!dl_segs_present[i])
 			return false;
 
 		segs++;
 
-		if(it->second.Last())
+		if(dl_segs[i].Last())
 			break;
 
-		if(i == 7)
+		if(i == MAX_SEGS - 1)
 			return false;
 	}
 
 	// append complete label
 	label_raw.clear();
 	for(int i = 0; i < segs; i++)
-		label_raw.insert(label_raw.end(), dl_segs[i].chars.begin(), dl_segs[i].chars.end());
+		label_raw.insert(label_raw.end(), dl_segs[i].chars, dl_segs[i].chars + dl_segs[i].chars_len);
 
 //	std::string label((const char*) &label_raw[0], label_raw.size());
 //	fprintf(stderr, "DL_SEG_REASSEMBLER: new label: '%s'\n", label.c_str());
@@ -437,9 +504,3 @@ bool MOTDecoder::DecodeDataGroup() {
 
 	return true;
 }
-
-std::vector<uint8_t> MOTDecoder::GetMOTDataGroup() {
-	std::vector<uint8_t> result(mot_len);
-	memcpy(&result[0], &dg_raw[0], mot_len);
-	return result;
-}
@@ -22,8 +22,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <atomic>
-#include <list>
-#include <map>
+#include <utility>
 #include <string>
 #include <vector>
 
@@ -34,8 +33,11 @@
 
 // --- DL_SEG -----------------------------------------------------------------
 struct DL_SEG {
+	static const size_t MAX_CHARS = 16;
+
 	uint8_t prefix[2];
-	std::vector<uint8_t> chars;
+	uint8_t chars[MAX_CHARS];
+	size_t chars_len;
 
 	bool Toggle() const {return prefix[0] & 0x80;}
 	bool First() const {return prefix[0] & 0x40;}
@@ -80,29 +82,65 @@ public:
 };
 
 
-typedef std::map<int,DL_SEG> dl_segs_t;
-
 // --- DL_SEG_REASSEMBLER -----------------------------------------------------------------
 struct DL_SEG_REASSEMBLER {
-	dl_segs_t dl_segs;
+	static const int MAX_SEGS = 8;
+
+	// fixed slots indexed by segment number, so that no segment allocates
+	DL_SEG dl_segs[MAX_SEGS];
+	bool dl_segs_present[MAX_SEGS];
+	size_t dl_segs_count;
 	std::vector<uint8_t> label_raw;
 
+	DL_SEG_REASSEMBLER() {
+		label_raw.reserve(MAX_SEGS * DL_SEG::MAX_CHARS);
+		Reset();
+	}
+
 	bool AddSegment(DL_SEG &dl_seg);
 	bool CheckForCompleteLabel();
 	void Reset();
 };
 
 
+// --- DL_PLUS_TAG -----------------------------------------------------------------
+struct DL_PLUS_TAG {
+	int content_type;
+	size_t start_marker;
+	size_t length_marker;
+
+	DL_PLUS_TAG() : content_type(0), start_marker(0), length_marker(0) {}
+	DL_PLUS_TAG(int content_type, size_t start_marker, size_t length_marker) : content_type(content_type), start_marker(start_marker), length_marker(length_marker) {}
+
+	bool operator==(const DL_PLUS_TAG& other) const {return content_type == other.content_type && start_marker == other.start_marker && length_marker == other.length_marker;}
+	bool operator!=(const DL_PLUS_TAG& other) const {return !(*this == other);}
+};
+
+typedef std::vector<DL_PLUS_TAG> dl_plus_tags_t;
+
+
 // --- DL_STATE -----------------------------------------------------------------
 struct DL_STATE {
 	std::vector<uint8_t> raw;
 	int charset;
 
+	// DL Plus (ETSI TS 102 980), refers to the label above
+	dl_plus_tags_t dl_plus_tags;
+	bool dl_plus_item_toggle;
+	bool dl_plus_item_running;
+
 	DL_STATE() {Reset();}
 	void Reset() {
 		raw.clear();
 		charset = -1;
+		ResetDLPlus();
 	}
+	void ResetDLPlus() {
+		dl_plus_tags.clear();
+		dl_plus_item_toggle = false;
+		dl_plus_item_running = false;
+	}
+	bool SameLabel(const DL_STATE& other) const {return charset == other.charset && raw == other.raw;}
 };
 
 
@@ -111,15 +149,17 @@ class DynamicLabelDecoder : public DataGroup {
 private:
 	DL_SEG_REASSEMBLER dl_sr;
 	DL_STATE label;
+	std::vector<uint8_t> dl_plus_raw;	// last parsed DL Plus command, repeated by most broadcasters
 
 	size_t GetInitialNeededSize() {return 2 + CalcCRC::CRCLen;}	// at least prefix + CRC
 	bool DecodeDataGroup();
+	bool DecodeDLPlusCommand(const uint8_t *data, size_t len);
 public:
 	DynamicLabelDecoder() : DataGroup(2 + 16 + CalcCRC::CRCLen) {Reset();}
 
 	void Reset();
 
-	DL_STATE GetLabel() {return label;}
+	const DL_STATE& GetLabel() const {return label;}
 };
 
 
@@ -137,7 +177,8 @@ public:
 
 	void SetLen(size_t mot_len) {this->mot_len = mot_len;}
 
-	std::vector<uint8_t> GetMOTDataGroup();
+	// valid until the next Data Subfield is processed
+	DG_SPAN GetMOTDataGroup() const {return DG_SPAN(&dg_raw[0], mot_len);}
 };
 
 
@@ -161,7 +202,25 @@ struct XPAD_CI {
 	}
 };
 
-typedef std::list<XPAD_CI> xpad_cis_t;
+// --- XPAD_CIS -----------------------------------------------------------------
+// at most four CIs per X-PAD, kept in place instead of a list
+struct XPAD_CIS {
+	static const size_t MAX_CIS = 4;
+
+	XPAD_CI cis[MAX_CIS];
+	size_t count;
+
+	XPAD_CIS() : count(0) {}
+
+	bool empty() const {return count == 0;}
+	const XPAD_CI* begin() const {return cis;}
+	const XPAD_CI* end() const {return cis + count;}
+	void push_back(const XPAD_CI& xpad_ci) {cis[count++] = xpad_ci;}
+	template<typename... Args>
+	void emplace_back(Args&&... args) {cis[count++] = XPAD_CI(std::forward<Args>(args)...);}
+};
+
+typedef XPAD_CIS xpad_cis_t;
 
 
 // --- PADDecoderObserver -----------------------------------------------------------------
@@ -170,7 +229,7 @@ public:
 	virtual ~PADDecoderObserver() {}
 
 	virtual void PADChangeDynamicLabel(const DL_STATE& /*dl*/) {}
-	virtual void PADChangeSlide(const MOT_FILE& /*slide*/) {}
+	virtual void PADChangeSlide(MOT_FILE&& /*slide*/) {}
 
 	virtual void PADLengthError(size_t /*announced_xpad_len*/, size_t /*xpad_len*/) {}
 };
@@ -182,6 +241,7 @@ private:
 	PADDecoderObserver *observer;
 	bool loose;
 	std::atomic<int> mot_app_type;
+	std::atomic<bool> mot_enabled;
 
 	uint8_t xpad[196];	// longest possible X-PAD
 	XPAD_CI last_xpad_ci;
@@ -191,9 +251,11 @@ private:
 	MOTDecoder mot_decoder;
 	MOTManager mot_manager;
 public:
-	PADDecoder(PADDecoderObserver *observer, bool loose) : observer(observer), loose(loose), mot_app_type(-1) {}
+	PADDecoder(PADDecoderObserver *observer, bool loose) : observer(observer), loose(loose), mot_app_type(-1), mot_enabled(true) {}
 
 	void SetMOTAppType(int mot_app_type) {this-> mot_app_type = mot_app_type;}
+	// while disabled, the MOT data subfields are skipped
+	void SetMOTEnabled(bool mot_enabled) {this->mot_enabled = mot_enabled;}
 	void Process(const uint8_t *xpad_data, size_t xpad_len, bool exact_xpad_len, const uint8_t* fpad_data);
 	void Reset();
 };
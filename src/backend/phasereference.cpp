@@ -20,6 +20,8 @@
  */
 #include    "phasereference.h"
 #include    "string.h"
+#include    "mode-i.h"
+#include    "various/dsp-kernels.h"
 #include <algorithm>
 #include <vector>
 #include <iostream>
@@ -42,12 +44,38 @@ PhaseReference::PhaseReference(const DABParams& p, FFTPlacementMethod fft_placem
     fft_buffer = fft_processor.getVector();
     res_buffer = res_processor.getVector();
 
-    for (int i = 1; i <= p.K / 2; i ++) {
-        phi_k = get_Phi(i);
-        refTable[i] = DSPCOMPLEX(cos(phi_k), sin(phi_k));
+    if (p.dabMode == 1) {
+        // Exact, without the rounding errors of cos and sin
+        std::copy(modeI::prsCarriers.begin(), modeI::prsCarriers.end(), refTable.begin());
+    }
+    else {
+        for (int i = 1; i <= p.K / 2; i ++) {
+            phi_k = get_Phi(i);
+            refTable[i] = DSPCOMPLEX(cos(phi_k), sin(phi_k));
 
-        phi_k = get_Phi(-i);
-        refTable[p.T_u - i] = DSPCOMPLEX(cos(phi_k), sin(phi_k));
+            phi_k = get_Phi(-i);
+            refTable[p.T_u - i] = DSPCOMPLEX(cos(phi_k), sin(phi_k));
+        }
+    }
+
+    std::copy(refTable.begin(), refTable.end(), res_buffer);
+    res_processor.do_IFFT();
+
+    trackReference.resize(p.T_u / 4);
+    for (size_t k = 0; k < trackReference.size(); k++) {
+        trackReference[k] = conj(res_buffer[k]);
+        trackReferenceEnergy += norm(res_buffer[k]);
+    }
+    trackWindow = std::max(p.T_u / 128, 4);
+
+    // The carrier next to an unused one does not form a difference
+    for (int i = 0; i < p.T_u; i++) {
+        fft_buffer[i] = refTable[i] * conj(refTable[(i + 1) % p.T_u]);
+    }
+    fft_processor.do_FFT();
+    refDiffSpectrum.resize(p.T_u);
+    for (int i = 0; i < p.T_u; i++) {
+        refDiffSpectrum[i] = conj(fft_buffer[i]);
     }
 }
 
@@ -71,11 +99,9 @@ void PhaseReference::selectFFTWindowPlacement(FFTPlacementMethod new_fft_placeme
  * looking for.
  */
 int32_t PhaseReference::findIndex(DSPCOMPLEX *v,
-        std::vector<float>& impulseResponseBuffer)
+        std::vector<float>& impulseResponseBuffer,
+        FrameArena& scratch)
 {
-    int32_t maxIndex = -1;
-    float   sum = 0;
-
     size_t Tu = refTable.size();
 
     memcpy(fft_buffer, v, Tu * sizeof(DSPCOMPLEX));
@@ -86,10 +112,139 @@ int32_t PhaseReference::findIndex(DSPCOMPLEX *v,
     for (size_t i = 0; i < Tu; i++)
         res_buffer[i] = fft_buffer[i] * conj(refTable[i]);
 
-    //  and, again, back into the time domain
-    res_processor.do_IFFT();
+    //  and, again, back into the time domain.
+    //  All placement methods compare the correlation against its own
+    //  average, the 1/Tu scaling is not needed
+    res_processor.do_IFFT(false);
 
     impulseResponseBuffer.resize(Tu);
+    dsp::kernels().magnitude(res_buffer, impulseResponseBuffer.data(), Tu);
+
+    const int32_t peak = std::max_element(impulseResponseBuffer.begin(),
+            impulseResponseBuffer.end()) - impulseResponseBuffer.begin();
+
+    const int32_t index = placeFFTWindow(impulseResponseBuffer, scratch);
+
+    trackedPeak = index >= 0 ? peak : -1;
+    trackedIndex = index;
+    framesTracked = 0;
+    return index;
+}
+
+/**
+ * \brief trackIndex
+ * the time domain correlation is done for trackWindow samples on either
+ * side of the last peak only, with the first T_u / 4 samples of the PRS.
+ */
+int32_t PhaseReference::trackIndex(const DSPCOMPLEX *v)
+{
+    const int32_t Tu = refTable.size();
+    const int32_t S = trackReference.size();
+
+    if (trackedPeak < 0 or ++framesTracked > framesBetweenAcquisitions or
+            trackedPeak - trackWindow < 0 or
+            trackedPeak + trackWindow + S > Tu) {
+        return -1;
+    }
+
+    const float * __restrict ref = reinterpret_cast<const float*>(trackReference.data());
+
+    int32_t bestLag = 0;
+    float bestPower = -1;
+    for (int32_t lag = -trackWindow; lag <= trackWindow; lag++) {
+        const float * __restrict in = reinterpret_cast<const float*>(
+                v + trackedPeak + lag);
+
+        float re = 0, im = 0;
+        for (int32_t k = 0; k < 2 * S; k += 2) {
+            re += in[k] * ref[k] - in[k + 1] * ref[k + 1];
+            im += in[k] * ref[k + 1] + in[k + 1] * ref[k];
+        }
+
+        const float power = re * re + im * im;
+        if (power > bestPower) {
+            bestPower = power;
+            bestLag = lag;
+        }
+    }
+
+    // A peak on the edge of the window is moving faster than we track
+    if (std::abs(bestLag) == trackWindow) {
+        return -1;
+    }
+
+    // Normalised correlation, noise alone gives about 1 / S
+    float energy = 0;
+    for (int32_t k = 0; k < S; k++) {
+        energy += norm(v[trackedPeak + bestLag + k]);
+    }
+
+    const float requiredCorrelation = 0.05;
+    if (bestPower < requiredCorrelation * energy * trackReferenceEnergy) {
+        return -1;
+    }
+
+    const int32_t index = trackedIndex + bestLag;
+    if (index < 0 or index >= Tu) {
+        return -1;
+    }
+
+    trackedPeak += bestLag;
+    trackedIndex = index;
+    return index;
+}
+
+/**
+ * \brief estimateCarrierOffset
+ * A shift of the FFT window rotates the difference of all neighbouring
+ * carriers by the same phase, so the sum over all K carriers stays
+ * coherent. The cross correlation for all shifts is done with an FFT.
+ */
+bool PhaseReference::estimateCarrierOffset(const DSPCOMPLEX *v,
+        int32_t maxOffset, int32_t& offset)
+{
+    const int32_t Tu = refTable.size();
+
+    memcpy(fft_buffer, v, Tu * sizeof(DSPCOMPLEX));
+    fft_processor.do_FFT();
+
+    // Differences between neighbouring carriers, computed in place
+    const DSPCOMPLEX first = fft_buffer[0];
+    for (int32_t i = 0; i < Tu - 1; i++) {
+        fft_buffer[i] = fft_buffer[i] * conj(fft_buffer[i + 1]);
+    }
+    fft_buffer[Tu - 1] = fft_buffer[Tu - 1] * conj(first);
+
+    fft_processor.do_FFT();
+    for (int32_t i = 0; i < Tu; i++) {
+        res_buffer[i] = fft_buffer[i] * refDiffSpectrum[i];
+    }
+    res_processor.do_IFFT(false);
+
+    //  res_buffer[s] now is the correlation with the PRS shifted
+    //  by s carriers
+    float peak = 0;
+    float sum = 0;
+    for (int32_t s = -maxOffset; s <= maxOffset; s++) {
+        const float value = abs(res_buffer[(s + Tu) % Tu]);
+        sum += value;
+        if (value > peak) {
+            peak = value;
+            offset = s;
+        }
+    }
+
+    const float required_peak_over_average = 4;
+    return peak > required_peak_over_average * sum / (2 * maxOffset + 1);
+}
+
+int32_t PhaseReference::placeFFTWindow(const std::vector<float>& impulseResponseBuffer,
+        FrameArena& scratch)
+{
+    int32_t maxIndex = -1;
+    float   sum = 0;
+
+    size_t Tu = refTable.size();
 
     switch (fft_placement) {
         case FFTPlacementMethod::StrongestPeak:
@@ -100,12 +255,11 @@ int32_t PhaseReference::findIndex(DSPCOMPLEX *v,
              * We compute the average signal value ...
              */
             for (size_t i = 0; i < Tu; i++)
-                sum += abs(res_buffer[i]);
+                sum += impulseResponseBuffer[i];
 
             DSPFLOAT max = -10000;
             for (size_t i = 0; i < Tu; i++) {
-                const float value = abs(res_buffer[i]);
-                impulseResponseBuffer[i] = value;
+                const float value = impulseResponseBuffer[i];
 
                 if (value > max) {
                     maxIndex = i;
@@ -139,17 +293,18 @@ int32_t PhaseReference::findIndex(DSPCOMPLEX *v,
                 float value = 0;
             };
 
-            vector<peak_t> bins;
-            float mean = 0;
-
             constexpr int bin_size = 20;
             constexpr size_t num_bins_to_keep = 4;
+
+            auto bins = scratch.makeVector<peak_t>();
+            bins.reserve(Tu / bin_size);
+            float mean = 0;
+
             for (size_t i = 0; i + bin_size < Tu; i += bin_size) {
                 peak_t peak;
                 for (size_t j = 0; j < bin_size; j++) {
-                    const float value = abs(res_buffer[i + j]);
+                    const float value = impulseResponseBuffer[i + j];
                     mean += value;
-                    impulseResponseBuffer[i + j] = value;
 
                     if (value > peak.value) {
                         peak.value = value;
@@ -212,14 +367,12 @@ int32_t PhaseReference::findIndex(DSPCOMPLEX *v,
             using namespace std;
 
             for (size_t i = 0; i < Tu; i++) {
-                const float v = abs(res_buffer[i]);
-                impulseResponseBuffer[i] = v;
-                sum += v;
+                sum += impulseResponseBuffer[i];
             }
 
             const size_t windowsize = 100;
 
-            vector<float> peak_averages(Tu);
+            auto peak_averages = scratch.makeVector<float>(Tu);
             float global_max = -10000;
             for (size_t i = 0; i + windowsize < Tu; i++) {
                 float max = -10000;
@@ -24,6 +24,7 @@
 #define __PHASEREFERENCE
 
 #include    "fft.h"
+#include    "frame-arena.h"
 #include    <vector>
 #include    <memory>
 #include    <cstdio>
@@ -36,16 +37,58 @@ class PhaseReference : public PhaseTable
 {
     public:
         PhaseReference(const DABParams& p, FFTPlacementMethod fft_placement_method);
+        /* The temporary buffers of the window placement are taken
+         * from scratch */
         int32_t findIndex(DSPCOMPLEX *v,
-                std::vector<float>& impulseResponseBuffer);
+                std::vector<float>& impulseResponseBuffer,
+                FrameArena& scratch);
+
+        /* Cheap replacement for findIndex once the receiver is locked.
+         * Instead of the full correlation, the strongest peak found by the
+         * last findIndex is searched for in a small window using a time
+         * domain correlation, and the FFT window is moved along with it.
+         * Returns -1 if the peak was not found, or if a full acquisition
+         * is due anyway. The caller then has to use findIndex. */
+        int32_t trackIndex(const DSPCOMPLEX *v);
+
+        /* Estimate the offset of the signal in v in whole carriers, in the
+         * range -maxOffset .. maxOffset, from a single PRS. The phase
+         * differences between neighbouring carriers are correlated with
+         * those of the PRS for all offsets at once, which does not depend
+         * on the position of the FFT window. v need not be aligned to the
+         * start of the PRS, as long as most of it holds PRS samples.
+         * Returns false if there is no clear correlation peak. */
+        bool estimateCarrierOffset(const DSPCOMPLEX *v, int32_t maxOffset,
+                int32_t& offset);
 
         DSPCOMPLEX operator[](size_t ix);
 
         void selectFFTWindowPlacement(FFTPlacementMethod new_fft_placement);
 
     private:
+        int32_t placeFFTWindow(const std::vector<float>& impulseResponseBuffer,
+                FrameArena& scratch);
+
         std::vector<DSPCOMPLEX> refTable;
 
+        // The first T_u / 4 samples of the PRS in the time domain,
+        // conjugated, for trackIndex
+        std::vector<DSPCOMPLEX> trackReference;
+        float trackReferenceEnergy = 0;
+        int32_t trackWindow;
+
+        // Spectrum of the conjugated phase differences of the PRS
+        std::vector<DSPCOMPLEX> refDiffSpectrum;
+
+        // Result of the last successful search, -1 if there is none
+        int32_t trackedPeak = -1;
+        int32_t trackedIndex = -1;
+        int32_t framesTracked = 0;
+
+        // Full acquisitions between the tracked frames, to follow
+        // changes of the channel the small window would not see
+        static const int32_t framesBetweenAcquisitions = 32;
+
         FFTPlacementMethod fft_placement;
 
         fft::Forward fft_processor;
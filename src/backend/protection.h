@@ -25,15 +25,78 @@
 #define __PROTECTION
 
 #include <cstdint>
+#include <vector>
 #include "dab-constants.h"
+#include "softbit-packing.h"
 
 extern uint8_t PI_X[];
 
+/*  The positions in the depunctured block of all softbits of a
+ *  punctured codeword, built once from the (L, PI) tuples of the
+ *  protection profile. Depuncturing is then a plain scatter, the
+ *  punctured positions of the block are zero from the start and never
+ *  written.
+ */
+class DepunctureTable
+{
+    public:
+        //  blocks of 128 bits, with puncturing (per 32 bits) according to PI
+        void addBlocks(int16_t blocks, const int8_t *PI) {
+            for (int16_t i = 0; i < blocks; i++) {
+                for (int16_t j = 0; j < 128; j++) {
+                    if (PI[j % 32] != 0)
+                        positions.push_back(blockSize);
+                    blockSize++;
+                }
+            }
+        }
+
+        //  the final block of 24 bits with puncturing according to PI_X,
+        //  the 6 * 4 bits of the register itself.
+        void addTail() {
+            for (int16_t i = 0; i < 24; i++) {
+                if (PI_X[i] != 0)
+                    positions.push_back(blockSize);
+                blockSize++;
+            }
+        }
+
+        void depuncture(const softbit_t *v, softbit_t *block) const {
+            const int32_t *pos = positions.data();
+            const int32_t count = positions.size();
+            for (int32_t i = 0; i < count; i++)
+                block[pos[i]] = v[i];
+        }
+
+        //  as depuncture, the softbits are unpacked on the way
+        void depuncturePacked(const uint8_t *packed, softbit_t *block) const {
+            const int32_t *pos = positions.data();
+            const int32_t count = positions.size();
+            for (int32_t i = 0; i + 1 < count; i += 2) {
+                const uint8_t pair = packed[i / 2];
+                block[pos[i]] = packedsoftbits::expand(pair & 0x0F);
+                block[pos[i + 1]] = packedsoftbits::expand(pair >> 4);
+            }
+            if (count & 1)
+                block[pos[count - 1]] = packedsoftbits::get(packed, count - 1);
+        }
+
+        int32_t inputSize() const { return positions.size(); }
+        int32_t outputSize() const { return blockSize; }
+
+    private:
+        std::vector<int32_t> positions;
+        int32_t blockSize = 0;
+};
+
 class Protection
 {
     public:
         virtual ~Protection() = default;
+        // The output is packed, 8 bits per byte with the first bit in the MSB
         virtual bool deconvolve(const softbit_t *, int32_t, uint8_t *) = 0;
+        // The same, for softbits packed by packedsoftbits::pack
+        virtual bool deconvolvePacked(const uint8_t *, int32_t, uint8_t *) = 0;
 };
 #endif
 
@@ -34,10 +34,13 @@
 #define RADIOCONTROLLER_H
 
 #include <cstddef>
+#include <chrono>
+#include <thread>
 #include <vector>
 #include <string>
 #include <complex>
 #include "dab-constants.h"
+#include "latency-trace.h"
 #include "backend/subchannel_sink.h"
 
 struct dab_date_time_t {
@@ -74,8 +77,35 @@ struct mot_file_t {
     std::string category_title;
 };
 
+/* A DL Plus tag (ETSI TS 102 980), text is the utf-8 encoded
+ * part of the dynamic label the tag points to. content_type is
+ * the DL Plus content type, e.g. 1 for ITEM.TITLE, 4 for ITEM.ARTIST */
+struct dl_plus_tag_t {
+    int content_type = 0;
+    std::string text;
+};
+
 enum class message_level_t { Information, Error };
 
+/* The diagnostic callbacks of the RadioControllerInterface a controller
+ * consumes. The backend does not compute, allocate or move the data
+ * of the others. */
+struct diagnostics_request_t {
+    bool impulseResponse = true;
+    bool constellation = true;
+    bool nullSymbol = true;
+
+    // Only every constellationDecimation-th carrier of the data symbols
+    // and every impulseResponseDecimation-th sample of the impulse
+    // response are delivered.
+    int constellationDecimation = 96;
+    int impulseResponseDecimation = 1;
+
+    // The soft bits of onSoftBits and onFicCodeword, for comparing the
+    // decoder against captured output. Several MB per second.
+    bool softBits = false;
+};
+
 /* Definition of the interface all radio controllers must implement.
  * The RadioController handles events that are common to all programmes
  * being listened to.
@@ -107,6 +137,17 @@ class RadioControllerInterface {
         /* When the ensemble label changes */
         virtual void onSetEnsembleLabel(DabLabel& label) = 0;
 
+        /* The label of the service sId is known, or changed */
+        virtual void onServiceLabel(uint32_t sId, const DabLabel& label) { (void)sId; (void)label; }
+
+        /* The components of the service sId are known, it can be
+         * selected from now on. Sent once per service. */
+        virtual void onServiceComponentsComplete(uint32_t sId) { (void)sId; }
+
+        /* All services of the ensemble have their label and components,
+         * and no new service appeared for a while. Sent once per tune. */
+        virtual void onEnsembleComplete(uint16_t eId) { (void)eId; }
+
         virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) = 0;
 
         /* For every FIB, tell if the CRC check passed. fib points to a bit-vector with 256 bits of FIB data  */
@@ -116,13 +157,24 @@ class RadioControllerInterface {
         virtual void onNewImpulseResponse(std::vector<float>&& data) = 0;
 
         /* When new constellation points are available. data contains
-         * (L-1) * K / OfdmDecoder::constellationDecimation points. */
+         * ceil(K / constellationDecimation) points for each of the L-1
+         * data symbols. */
         virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& data) = 0;
 
         /* When a new null symbol vector was received.
          * Data contains the samples of the complete NULL symbol. */
         virtual void onNewNullSymbol(std::vector<DSPCOMPLEX>&& data) = 0;
 
+        /* The soft bits of data symbol sym (1 .. L-1) as handed to the
+         * FIC and MSC handlers, 2 * K of them. Only with the softBits
+         * diagnostics, and only for the symbols that are decoded. */
+        virtual void onSoftBits(int32_t sym, const softbit_t *bits, size_t n) { (void)sym; (void)bits; (void)n; }
+
+        /* A depunctured FIC codeword, the input of the Viterbi decoder.
+         * Only with the softBits diagnostics. The output is the FIBs
+         * of onFIBDecodeSuccess. */
+        virtual void onFicCodeword(const softbit_t *bits, size_t n) { (void)bits; (void)n; }
+
         /* When TII information for a comb/pattern pair is available */
         virtual void onTIIMeasurement(tii_measurement_t&& m) = 0;
 
@@ -131,6 +183,11 @@ class RadioControllerInterface {
 
         /* The receiver has shutdown due to a failure in the input device */
         virtual void onInputFailure(void) { };
+
+        /* Tell which of the diagnostic callbacks above are consumed.
+         * The backend asks once per frame, from the OFDMProcessor and the
+         * OfdmDecoder threads, so the request may change at any time. */
+        virtual diagnostics_request_t getDiagnosticsRequest(void) { return diagnostics_request_t(); }
 };
 
 /* A Programme Handler is associated to each tuned programme in the ensemble.
@@ -147,6 +204,36 @@ class ProgrammeHandlerInterface: public UntouchedStreamConsumer {
          * used.  */
         virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode) = 0;
 
+        /* Same as onNewAudio, for handlers that asked for float samples
+         * in the range [-1, 1] by wantsFloatAudio. Decoders without float
+         * output (FDK-AAC) still deliver through onNewAudio.
+         * For both, the buffer is reused for the next frame unless the
+         * handler moves it away, so copying out of it is allocation free. */
+        virtual void onNewAudioFloat(std::vector<float>&& audioData, int sampleRate, const std::string& mode) {
+            (void)audioData; (void)sampleRate; (void)mode;
+        }
+
+        /* Asked once when the service is (re)subscribed. */
+        virtual bool wantsFloatAudio(void) { return false; }
+
+        /* The logical frames of the subchannel after deconvolution and
+         * energy dispersal, bitrate * 3 bytes every 24 ms. Only if
+         * wantsLogicalFrames, which is asked once on subscription. */
+        virtual void onLogicalFrame(const uint8_t *frame, size_t len) { (void)frame; (void)len; }
+        virtual bool wantsLogicalFrames(void) { return false; }
+
+        /* Whether somebody is looking at the slides of this programme.
+         * Under load, only foreground programmes decode the MOT. Asked
+         * on subscription and whenever the load changes that. */
+        virtual bool isForeground(void) { return true; }
+
+        /* Called right before the first audio out of a logical frame,
+         * onNewAudio or ProcessUntouchedStream, with the times the newest
+         * sample of the frame passed the stages. The audio after it up
+         * to the next call comes from the same frame. Only for inputs
+         * with a sample clock, see InputInterface::getReadStamp. */
+        virtual void onAudioStamp(const LatencyStamp& stamp) { (void)stamp; }
+
         /* (DAB+ only) Reed-Solomon decoding error indicator, and
          * number of corrected errors.
          * The function will also be called in the absence of errors,
@@ -160,10 +247,18 @@ class ProgrammeHandlerInterface: public UntouchedStreamConsumer {
          * label is utf-8 encoded. */
         virtual void onNewDynamicLabel(const std::string& label) = 0;
 
+        /* The DL Plus tags of the current dynamic label changed.
+         * itemRunning tells whether the tagged item (e.g. the song) is
+         * still on air. Called after onNewDynamicLabel it refers to. */
+        virtual void onNewDynamicLabelPlus(const std::vector<dl_plus_tag_t>& tags, bool itemRunning) {
+            (void)tags; (void)itemRunning;
+        }
+
         /* A slide was decoded. data contains the raw bytes, and subtype
          * defines the data format:
-         * 0x01 for JPEG, 0x03 for PNG */
-        virtual void onMOT(const mot_file_t& mot_file) = 0;
+         * 0x01 for JPEG, 0x03 for PNG
+         * The handler may keep the data, it is not used afterwards. */
+        virtual void onMOT(mot_file_t&& mot_file) = 0;
 
         /* Called when the PAD decoder notices a mismatch between announced
          * and effective X-PAD length.
@@ -176,9 +271,33 @@ enum class DeviceParam {
     SoapySDRAntenna,
     SoapySDRDriverArgs,
     SoapySDRClockSource,
+    SampleRate,
+    // Latency, in ms, the sample buffer of the device holds. Only
+    // accepted before the device is started for the first time.
+    BufferMs,
+    // Number and size in bytes of the USB transfers the device queues,
+    // see UsbTransferConfig, and 1 to receive them into the sample
+    // buffer in place. Only accepted while the device is stopped.
+    UsbTransfers,
+    UsbTransferBytes,
+    UsbZeroCopy,
 };
 
 /* Definition of the interface all input devices must implement */
+struct InputStats {
+    // Samples waiting for the receiver, and the room for them, 0 if unknown
+    int32_t bufferedSamples = 0;
+    int32_t bufferSize = 0;
+    // The most samples ever buffered
+    int32_t maxBufferedSamples = 0;
+    // Samples lost because the receiver did not read them in time, and
+    // the number of times that started
+    uint64_t droppedSamples = 0;
+    uint64_t overruns = 0;
+    // Bytes allocated for the sample buffers, 0 if unknown
+    size_t memoryBytes = 0;
+};
+
 class InputInterface {
 public:
     virtual ~InputInterface() {}
@@ -191,6 +310,16 @@ public:
     virtual int32_t getSamples(DSPCOMPLEX* buffer, int32_t size) = 0;
     virtual std::vector<DSPCOMPLEX> getSpectrumSamples(int size) = 0;
     virtual int32_t getSamplesToRead(void) = 0;
+
+    /* Block until at least count samples can be read, or until the timeout
+     * expires. Returns the number of samples available, like getSamplesToRead().
+     * The default implementation only sleeps briefly, devices that receive
+     * their samples from a callback should signal the waiter from there. */
+    virtual int32_t waitForSamples(int32_t count, std::chrono::milliseconds timeout) {
+        (void)count; (void)timeout;
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+        return getSamplesToRead();
+    }
     virtual float setGain(int gain) = 0;
     virtual float getGain(void) const = 0;
     virtual int getGainCount(void) = 0;
@@ -206,6 +335,20 @@ public:
         (void)param; (void)value;
         return false;
     }
+
+    /* Cheap enough to be polled, the devices count with relaxed atomics */
+    virtual InputStats getInputStats(void) {
+        InputStats stats;
+        stats.bufferedSamples = getSamplesToRead();
+        return stats;
+    }
+
+    /* When the sample returned last by getSamples was captured and read.
+     * Devices without a SampleClock return an invalid stamp, and the
+     * latency of their audio is not traced. */
+    virtual LatencyStamp getReadStamp(void) {
+        return LatencyStamp();
+    }
 };
 
 #endif
@@ -32,6 +32,10 @@
 
 #pragma once
 
+#include <chrono>
+#include <string>
+#include "various/thread-config.h"
+
 // see OFDMProcessor::processPRS() for more information about these methods
 enum class FreqsyncMethod { GetMiddle = 0, CorrelatePRS = 1, PatternOfZeros = 2 };
 
@@ -62,6 +66,11 @@ enum class FFTPlacementMethod {
 // Default uses the old algorithm until the issues of the new one are solved.
 constexpr auto DEFAULT_FFT_PLACEMENT = FFTPlacementMethod::ThresholdBeforePeak;
 
+// The library decoding the AAC audio of DAB+, see AACDecoder. Auto
+// compares the compiled in backends on the first AUs of every audio
+// format, and keeps the faster one for it.
+enum class AACBackend { Auto, FAAD2, FDKAAC };
+
 // Configuration for the backend
 struct RadioReceiverOptions {
     // Select the algorithm used in the OFDMProcessor PRS sync logic
@@ -81,5 +90,73 @@ struct RadioReceiverOptions {
     // Which method to use for the freqsyncmethod used in the coarse corrector.
     // Has no effect when coarse corrector is disabled.
     FreqsyncMethod freqsyncMethod = FreqsyncMethod::PatternOfZeros;
+
+    // Number of threads sharing the FFT and demodulation of the OFDM
+    // symbols of a frame. Only taken into account when the receiver is
+    // created.
+    int demodulatorThreads = 1;
+
+    // Hand every OFDM symbol to the decoder as soon as it is received,
+    // instead of the complete frame. This gets the FIC and the audio out
+    // almost a frame (~90 ms in mode I) earlier and spreads the decoding
+    // over the frame. The symbols are then demodulated on the decoder
+    // thread alone, demodulatorThreads only applies to whole frames.
+    bool streamSymbols = false;
+
+    // Number of removed services whose subchannels are kept decoding in
+    // standby for warmStandbyTimeout, so that adding them again produces
+    // audio without waiting for the de-interleaver and the superframe
+    // sync. 0 disables it. Only taken into account when the receiver is
+    // created.
+    int warmStandbyServices = 0;
+    std::chrono::seconds warmStandbyTimeout = std::chrono::seconds(120);
+
+    // Give up the optional processing while the decoder does not keep
+    // up with the signal, and bring it back once it does again, see
+    // LoadGovernor. Audio decoding is never affected.
+    bool loadGovernor = false;
+
+    // While no subchannel is decoded and the ensemble is complete, only
+    // every idleFicInterval-th frame is demodulated, for the FIC. The
+    // frames in between only keep the time and frequency sync, from the
+    // PRS and the cyclic prefixes, without TII and diagnostics. The
+    // frame after a subchannel was added is decoded completely again.
+    // Never while scanning or with the ETI output. 0 disables it.
+    int idleFicInterval = 0;
+
+    // File holding what was received on the channel the last time. It
+    // is loaded when the receiver is (re)started outside of scan mode,
+    // so that services can be decoded before the FIC is complete, and
+    // saved when the receiver is stopped. Empty disables the cache.
+    // Only taken into account when the receiver is created.
+    std::string ensembleCacheFile;
+
+    // Bytes the receiver may allocate for its buffers, 0 for no limit.
+    // Under a budget, the OFDM decoder keeps fewer spare frames, the
+    // subchannels queue fewer CIFs, and the subchannels in warm standby
+    // are dropped, least recently used first, while the subchannels take
+    // more than what is left of it, see MscHandler::setMemoryBudget. The
+    // input devices size their buffers themselves, see
+    // DeviceParam::BufferMs. Only taken into account when the receiver is
+    // created.
+    size_t memoryBudget = 0;
+
+    // Keep the softbits of the subchannels quantised to 4 bits and packed
+    // two per byte, in the CIF queue and the time de-interleaver. Halves
+    // their memory and cache traffic, which adds up when decoding many
+    // subchannels, for a barely measurable loss of the Viterbi decoder.
+    // Only taken into account when the receiver is created.
+    bool packedSoftbits = false;
+
+    // Backend of the AAC decoders, process wide like the threading. A
+    // backend that is not compiled in falls back to Auto. Applied to the
+    // decoders started after the receiver was created.
+    AACBackend aacBackend = AACBackend::Auto;
+
+    // Names, CPU affinity and scheduling of the pipeline threads. The
+    // device threads and the audio decoder pool are shared, so this is
+    // applied process wide, to the running and the future threads, when
+    // the receiver is created.
+    ThreadingOptions threading;
 };
 
@@ -30,10 +30,14 @@
  *
  */
 
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <memory>
 #include "radio-receiver.h"
+#include "dabplus_decoder.h"
+#include "ensemble-cache.h"
+#include "worker-pool.h"
 
 using namespace std;
 
@@ -72,21 +76,128 @@ RadioReceiver::RadioReceiver(
     params(transmission_mode),
     mscHandler(params, false),
     ficHandler(rci),
-    ofdmProcessor(input,
+    ofdmProcessor(new OFDMProcessor(input,
         params,
         rci,
         mscHandler,
         ficHandler,
-        rro),
-        decodeAudio(decode)
-{ }
+        rro)),
+        decodeAudio(decode),
+        ensembleCacheFile(rro.ensembleCacheFile)
+{
+    configureDecoders(rro);
+}
+
+RadioReceiver::RadioReceiver(
+                RadioControllerInterface& rci,
+                CEtiSource& source,
+                RadioReceiverOptions rro,
+                bool decode) :
+    params(1),
+    mscHandler(params, false),
+    ficHandler(rci),
+    etiDemultiplexer(new EtiDemultiplexer(source, rci, ficHandler, mscHandler)),
+    decodeAudio(decode),
+    ensembleCacheFile(rro.ensembleCacheFile)
+{
+    configureDecoders(rro);
+}
+
+void RadioReceiver::configureDecoders(const RadioReceiverOptions& rro)
+{
+    threading::configure(rro.threading);
+    mscHandler.setWarmStandby(std::max(rro.warmStandbyServices, 0), rro.warmStandbyTimeout);
+    mscHandler.setPackedSoftbits(rro.packedSoftbits);
+    AACDecoder::SetBackend(rro.aacBackend);
+    if (rro.memoryBudget > 0) {
+        // The frames are allocated by now, the subchannels get the rest
+        const size_t frames = ofdmProcessor ? ofdmProcessor->getStats().memoryBytes : 0;
+        mscHandler.setMemoryBudget(rro.memoryBudget > frames ? rro.memoryBudget - frames : 1);
+    }
+
+    // A decoder started with the parameters of the cache is fixed once
+    // the live FIC tells otherwise
+    ficHandler.fibProcessor.setSubchannelChangedCallback(
+            [this](const Subchannel& sub) { mscHandler.updateSubchannel(sub); });
+}
+
+RadioReceiver::~RadioReceiver()
+{
+    stopInput();
+    storeEnsemble();
+}
+
+void RadioReceiver::stopInput()
+{
+    if (ofdmProcessor) {
+        ofdmProcessor->stop();
+    }
+    else {
+        etiDemultiplexer->stop();
+    }
+}
 
 void RadioReceiver::restart(bool doScan)
 {
-    ofdmProcessor.set_scanMode(doScan);
+    if (ofdmProcessor) {
+        ofdmProcessor->set_scanMode(doScan);
+    }
     mscHandler.stopProcessing();
     ficHandler.clearEnsemble();
-    ofdmProcessor.restart();
+    if (const auto eti = std::atomic_load(&etiMultiplexer)) {
+        eti->reset();
+        etiPinnedVersion = UINT64_MAX;
+    }
+    if (not doScan) {
+        preloadEnsemble();
+    }
+    if (not ofdmProcessor) {
+        etiDemultiplexer->restart();
+        return;
+    }
+    if (haveInitialCorrectors) {
+        ofdmProcessor->setInitialCorrectors(initialCoarseCorrector, initialFineCorrector);
+        haveInitialCorrectors = false;
+    }
+    ofdmProcessor->restart();
+}
+
+void RadioReceiver::preloadEnsemble()
+{
+    CachedEnsemble cached;
+    if (ensembleCacheFile.empty() or
+            not loadEnsembleCache(ensembleCacheFile, cached)) {
+        return;
+    }
+
+    clog << "RadioReceiver: preloading ensemble " << hex <<
+        cached.ensemble.ensembleId << dec << " with " <<
+        cached.ensemble.services.size() << " services from " <<
+        ensembleCacheFile << endl;
+    if (ofdmProcessor) {
+        ofdmProcessor->setInitialCorrectors(cached.coarseCorrector, cached.fineCorrector);
+    }
+    ficHandler.fibProcessor.preloadEnsemble(cached.ensemble);
+}
+
+// Only what was confirmed by the FIC is worth saving
+void RadioReceiver::storeEnsemble()
+{
+    if (ensembleCacheFile.empty() or
+            not ficHandler.fibProcessor.isEnsembleReceived()) {
+        return;
+    }
+
+    CachedEnsemble cached;
+    cached.ensemble = *ficHandler.fibProcessor.getEnsembleSnapshot();
+    if (cached.ensemble.services.empty()) {
+        return;
+    }
+
+    if (ofdmProcessor) {
+        ofdmProcessor->getLastValidCorrectors(cached.coarseCorrector, cached.fineCorrector);
+    }
+    saveEnsembleCache(ensembleCacheFile, cached);
 }
 
 void RadioReceiver::restart_decoder()
@@ -97,11 +208,97 @@ void RadioReceiver::restart_decoder()
 
 void RadioReceiver::stop()
 {
-    ofdmProcessor.stop();
+    stopInput();
+    storeEnsemble();
     mscHandler.stopProcessing();
     ficHandler.clearEnsemble();
 }
 
+void RadioReceiver::retune(bool doScan, const std::string& newEnsembleCacheFile)
+{
+    stop();
+    if (ofdmProcessor) {
+        ofdmProcessor->flushPipeline();
+    }
+    ensembleCacheFile = newEnsembleCacheFile;
+    restart(doScan);
+}
+
+void RadioReceiver::setInitialCorrectors(int32_t coarse, int16_t fine)
+{
+    initialCoarseCorrector = coarse;
+    initialFineCorrector = fine;
+    haveInitialCorrectors = true;
+}
+
+bool RadioReceiver::getLastValidCorrectors(int32_t& coarse, int16_t& fine) const
+{
+    return ofdmProcessor and ofdmProcessor->getLastValidCorrectors(coarse, fine);
+}
+
+void RadioReceiver::setEtiOutput(EtiMultiplexer::Output output, bool allSubchannels)
+{
+    ficHandler.setFibTap(nullptr);
+    mscHandler.setEtiMultiplexer(nullptr);
+    if (etiAllSubchannels) {
+        mscHandler.pinSubchannels({}, decodeAudio);
+    }
+    std::atomic_store(&etiMultiplexer, std::shared_ptr<EtiMultiplexer>());
+    etiAllSubchannels = false;
+    // The multiplexer needs the FIC of every frame
+    if (ofdmProcessor) {
+        ofdmProcessor->inhibitIdle(bool(output));
+    }
+
+    if (not output) {
+        return;
+    }
+
+    // A FIC decoded while replacing it goes to the multiplexer it was
+    // tapped for
+    auto eti = make_shared<EtiMultiplexer>(params.dabMode, std::move(output));
+    std::atomic_store(&etiMultiplexer, eti);
+    etiAllSubchannels = allSubchannels;
+    etiPinnedVersion = UINT64_MAX;
+    mscHandler.setEtiMultiplexer(eti);
+    ficHandler.setFibTap(make_shared<const FicHandler::FibTap>(
+                [this, eti](const uint8_t *fibs, size_t len) { onFibs(*eti, fibs, len); }));
+}
+
+void RadioReceiver::onFibs(EtiMultiplexer& eti, const uint8_t *fibs, size_t len)
+{
+    eti.addFic(fibs, len);
+
+    if (not etiAllSubchannels) {
+        return;
+    }
+
+    // Follow the reconfigurations of the ensemble
+    const auto ensemble = ficHandler.fibProcessor.getEnsembleSnapshot();
+    if (ensemble->version == etiPinnedVersion) {
+        return;
+    }
+    etiPinnedVersion = ensemble->version;
+
+    vector<MscHandler::PinnedSubchannel> subs;
+    for (const auto& sub : ensemble->subChannels) {
+        if (not sub.valid() or sub.length <= 0) {
+            continue;
+        }
+        // Decoded like the audio component carried in it, if any
+        auto audioType = AudioServiceComponentType::Unknown;
+        for (const auto& sc : ensemble->components) {
+            if (sc.subchannelId == sub.subChId and
+                    sc.transportMode() == TransportMode::Audio) {
+                audioType = sc.audioType();
+                break;
+            }
+        }
+        subs.push_back({ sub, audioType });
+    }
+    mscHandler.pinSubchannels(subs, decodeAudio);
+}
+
 void RadioReceiver::setReceiverOptions(const RadioReceiverOptions rro)
 {
     string fsm;
@@ -114,21 +311,44 @@ void RadioReceiver::setReceiverOptions(const RadioReceiverOptions rro)
     clog << "New Receiver Options: " <<
         "TII: " << rro.decodeTII <<
         " disable coarse corr: " << rro.disableCoarseCorrector <<
+        " load governor: " << rro.loadGovernor <<
         " freqsync: " << fsm <<
         " fft placement: " << fftPlacementMethodToString(rro.fftPlacementMethod) << endl;
-    ofdmProcessor.setReceiverOptions(rro);
+    if (ofdmProcessor) {
+        ofdmProcessor->setReceiverOptions(rro);
+    }
 }
 
 bool RadioReceiver::playSingleProgramme(ProgrammeHandlerInterface& handler,
         const std::string& dumpFileName, const Service& s)
 {
-    return playProgramme(handler, s, dumpFileName, true);
+    return playProgramme(handler, s, dumpFileName, true, decodeAudio);
 }
 
 bool RadioReceiver::addServiceToDecode(ProgrammeHandlerInterface& handler,
         const std::string& dumpFileName, const Service& s)
 {
-    return playProgramme(handler, s, dumpFileName, false);
+    return playProgramme(handler, s, dumpFileName, false, decodeAudio);
+}
+
+bool RadioReceiver::addServiceToDecode(ProgrammeHandlerInterface& handler,
+        const std::string& dumpFileName, const Service& s, bool decodeAudio,
+        OverflowPolicy overflow)
+{
+    return playProgramme(handler, s, dumpFileName, false, decodeAudio, overflow);
+}
+
+uint64_t RadioReceiver::getDroppedFragments(const Service& s)
+{
+    for (const auto& sc : ficHandler.fibProcessor.getComponents(s)) {
+        if (sc.transportMode() == TransportMode::Audio) {
+            const auto& subch = ficHandler.fibProcessor.getSubchannel(sc);
+            if (subch.valid()) {
+                return mscHandler.getDroppedFragments(subch);
+            }
+        }
+    }
+    return 0;
 }
 
 bool RadioReceiver::removeServiceToDecode(const Service& s)
@@ -145,8 +365,22 @@ bool RadioReceiver::removeServiceToDecode(const Service& s)
     return false;
 }
 
+bool RadioReceiver::removeServiceToDecode(const Service& s, ProgrammeHandlerInterface& handler)
+{
+    for (const auto& sc : ficHandler.fibProcessor.getComponents(s)) {
+        if (sc.transportMode() == TransportMode::Audio) {
+            const auto& subch = ficHandler.fibProcessor.getSubchannel(sc);
+            if (subch.valid()) {
+                return mscHandler.removeSubchannel(subch, handler);
+            }
+        }
+    }
+    return false;
+}
+
 bool RadioReceiver::playProgramme(ProgrammeHandlerInterface& handler,
-        const Service& s, const std::string& dumpFileName, bool unique)
+        const Service& s, const std::string& dumpFileName, bool unique,
+        bool decodeAudio, OverflowPolicy overflow)
 {
     const auto comps = ficHandler.fibProcessor.getComponents(s);
     for (const auto& sc : comps) {
@@ -160,7 +394,8 @@ bool RadioReceiver::playProgramme(ProgrammeHandlerInterface& handler,
 
                 if (sc.audioType() == AudioServiceComponentType::DABPlus) {
                     mscHandler.addSubchannel(
-                            handler, sc.audioType(), dumpFileName, subch, decodeAudio);
+                            handler, sc.audioType(), dumpFileName, subch, decodeAudio,
+                            overflow);
                     return true;
                 }
             }
@@ -170,11 +405,26 @@ bool RadioReceiver::playProgramme(ProgrammeHandlerInterface& handler,
     return false;
 }
 
+std::shared_ptr<const EnsembleSnapshot> RadioReceiver::getEnsembleSnapshot(void) const
+{
+    return ficHandler.fibProcessor.getEnsembleSnapshot();
+}
+
 uint16_t RadioReceiver::getEnsembleId(void) const
 {
     return ficHandler.fibProcessor.getEnsembleId();
 }
 
+bool RadioReceiver::isEnsembleReceived(void) const
+{
+    return ficHandler.fibProcessor.isEnsembleReceived();
+}
+
+std::vector<uint16_t> RadioReceiver::getFibSignature(void) const
+{
+    return ficHandler.getFibSignature();
+}
+
 uint8_t RadioReceiver::getEnsembleEcc(void) const
 {
     return ficHandler.fibProcessor.getEnsembleEcc();
@@ -222,9 +472,61 @@ DABParams& RadioReceiver::getParams()
     return params;
 }
 
-RadioReceiverStats RadioReceiver::getReceiverStats() const
+void RadioReceiver::expireStandbyServices()
+{
+    mscHandler.expireStandby();
+}
+
+void RadioReceiver::updateForeground()
+{
+    mscHandler.updateForeground();
+}
+
+RadioReceiverStats RadioReceiver::getReceiverStats()
 {
     RadioReceiverStats s;
     s.timeLastFCT0Frame = ficHandler.fibProcessor.getTimeLastFCT0Frame();
+    s.decodedBytes = mscHandler.getDecodedBytes();
+    s.droppedFragments = mscHandler.getDroppedFragments();
+
+    if (etiDemultiplexer) {
+        const EtiDemultiplexer::Stats eti = etiDemultiplexer->getStats();
+        s.framesProcessed = eti.frames;
+        s.framesDropped = eti.framesDropped;
+        s.syncLosses = eti.syncLosses;
+        s.synced = eti.synced;
+    }
+    else {
+        const OFDMProcessor::Stats ofdm = ofdmProcessor->getStats();
+        s.framesProcessed = ofdm.framesProcessed;
+        s.framesIdle = ofdm.framesIdle;
+        s.idle = ofdm.idle;
+        s.framesDropped = ofdm.frameQueue.dropped;
+        s.frameQueueDepth = ofdm.frameQueue.queued;
+        s.maxFrameQueueDepth = ofdm.frameQueue.maxQueued;
+        s.syncLosses = ofdm.syncLosses;
+        s.coarseSyncLosses = ofdm.coarseSyncLosses;
+        s.synced = ofdm.synced;
+        s.snr = ofdm.snr;
+        s.frameDecodeTime = ofdm.frameDecodeTime;
+        s.decodeLoad = ofdm.decodeLoad;
+        s.degradationLevel = ofdm.degradationLevel;
+        s.demodulatorMemoryBytes = ofdm.memoryBytes;
+    }
+
+    s.fibCount = ficHandler.getFibCount();
+    s.fibCrcErrors = ficHandler.getFibCrcErrors();
+    s.ficDecodeRatioPercent = ficHandler.getFicDecodeRatioPercent();
+
+    if (const auto eti = std::atomic_load(&etiMultiplexer)) {
+        s.etiFrames = eti->getFramesWritten();
+        s.etiFramesIncomplete = eti->getFramesIncomplete();
+    }
+
+    s.decoderQueueDepth = WorkerPool::shared().queuedTasks();
+    s.subchannels = mscHandler.getSubchannelStats();
+    for (const auto& sub : s.subchannels) {
+        s.subchannelMemoryBytes += sub.memoryBytes;
+    }
     return s;
 }
@@ -41,12 +41,52 @@
 #include "fic-handler.h"
 #include "msc-handler.h"
 #include "ofdm-processor.h"
+#include "eti-multiplexer.h"
+#include "eti-demultiplexer.h"
 
 const char* fftPlacementMethodToString(FFTPlacementMethod fft_placement);
 const char* freqSyncMethodToString(FreqsyncMethod method);
 
 struct RadioReceiverStats {
     std::chrono::system_clock::time_point timeLastFCT0Frame;
+    // The bytes of logical frames decoded by all services so far
+    uint64_t decodedBytes = 0;
+    // The CIFs dropped because a service decoder could not keep up
+    uint64_t droppedFragments = 0;
+
+    // Demodulation, see OFDMProcessor::Stats
+    uint64_t framesProcessed = 0;
+    uint64_t framesIdle = 0;
+    bool idle = false;
+    uint64_t framesDropped = 0;
+    size_t frameQueueDepth = 0;
+    size_t maxFrameQueueDepth = 0;
+    uint64_t syncLosses = 0;
+    uint64_t coarseSyncLosses = 0;
+    bool synced = false;
+    float snr = 0;
+    LatencyHistogram::Snapshot frameDecodeTime;
+    // Decode time / frame period, see OfdmDecoder::getDecodeLoad
+    float decodeLoad = 0;
+    // The optional processing given up, see LoadGovernor::Level
+    int degradationLevel = 0;
+    // Bytes of the buffers, see OfdmDecoder::getMemoryBytes and
+    // DabVirtual::getMemoryBytes. Those of the input are in InputStats.
+    size_t demodulatorMemoryBytes = 0;
+    size_t subchannelMemoryBytes = 0;
+
+    // See RadioReceiver::setEtiOutput
+    uint64_t etiFrames = 0;
+    uint64_t etiFramesIncomplete = 0;
+
+    uint64_t fibCount = 0;
+    uint64_t fibCrcErrors = 0;
+    int ficDecodeRatioPercent = 0;
+
+    // Subchannel decoders of all receivers waiting for a worker
+    size_t decoderQueueDepth = 0;
+
+    std::vector<SubchannelStats> subchannels;
 };
 
 class RadioReceiver {
@@ -57,6 +97,17 @@ class RadioReceiver {
                 RadioReceiverOptions rro,
                 int transmission_mode = 1,
                 bool decodeAudio = true);
+        /* Decode the ensemble of an ETI stream instead, see
+         * EtiDemultiplexer. Only the options of the decoders apply,
+         * the ETI frames are counted as framesProcessed. */
+        RadioReceiver(
+                RadioControllerInterface& rci,
+                CEtiSource& source,
+                RadioReceiverOptions rro,
+                bool decodeAudio = true);
+        ~RadioReceiver();
+        RadioReceiver(const RadioReceiver&) = delete;
+        RadioReceiver& operator=(const RadioReceiver&) = delete;
 
         /* Restart the receiver, and specify if we want
          * to scan or receive. */
@@ -68,6 +119,30 @@ class RadioReceiver {
 
         void stop();
 
+        /* Receive another channel, once the input has been tuned to it.
+         * Stops the receiver if that did not happen yet. Unlike deleting
+         * the receiver and creating another one, the threads, FFT plans
+         * and buffers are kept, only the state of the channel received
+         * so far is dropped. ensembleCacheFile replaces
+         * RadioReceiverOptions::ensembleCacheFile. */
+        void retune(bool doScan, const std::string& ensembleCacheFile);
+
+        /* Start the next restart() or retune() with these frequency
+         * correctors instead of searching the offset from zero. They
+         * take precedence over the ones of the ensemble cache. */
+        void setInitialCorrectors(int32_t coarse, int16_t fine);
+
+        /* The correctors the receiver was locked to while it had a good
+         * FIC. Only meaningful while stopped, returns false if there was
+         * no lock since the last restart. */
+        bool getLastValidCorrectors(int32_t& coarse, int16_t& fine) const;
+
+        /* Send the ensemble as ETI(NI) stream to output, see
+         * EtiMultiplexer, or stop it with an empty output. The ETI holds
+         * the subchannels being decoded, with allSubchannels all of the
+         * ensemble, decoded in standby for that purpose. */
+        void setEtiOutput(EtiMultiplexer::Output output, bool allSubchannels);
+
         /* Update the currently running receiver with new configuration */
         void setReceiverOptions(const RadioReceiverOptions rro);
 
@@ -79,9 +154,43 @@ class RadioReceiver {
         bool addServiceToDecode(ProgrammeHandlerInterface& handler,
                 const std::string& dumpFileName, const Service& s);
 
+        /* As above, but decodeAudio overrides the setting of the receiver
+         * for this service: PCM audio or the untouched AAC stream.
+         * overflow tells what to do when its decoder falls behind. */
+        bool addServiceToDecode(ProgrammeHandlerInterface& handler,
+                const std::string& dumpFileName, const Service& s,
+                bool decodeAudio,
+                OverflowPolicy overflow = OverflowPolicy());
+
+        /* The CIFs the decoder of the service dropped so far */
+        uint64_t getDroppedFragments(const Service& s);
+
+        /* With RadioReceiverOptions::warmStandbyServices, the removed
+         * service keeps decoding in standby until it times out. */
         bool removeServiceToDecode(const Service& s);
 
+        /* Remove one of the handlers added for the service. Each further
+         * handler of a service observes the decoder of the first one,
+         * which keeps decoding until the last of them is removed. */
+        bool removeServiceToDecode(const Service& s, ProgrammeHandlerInterface& handler);
+
+        /* Stop the standby decoding of the services that timed out. This
+         * also happens whenever a service is added or removed. */
+        void expireStandbyServices(void);
+
+        /* ProgrammeHandlerInterface::isForeground of a handler changed,
+         * only asked when a handler is added or removed otherwise */
+        void updateForeground(void);
+
+        /* The ensemble database as decoded so far. Cheap to get and
+         * consistent, the getters below copy the parts out of it. */
+        std::shared_ptr<const EnsembleSnapshot> getEnsembleSnapshot(void) const;
+
         uint16_t getEnsembleId(void) const;
+        // True once the EId came from the FIC (FIG 0/0), not the cache
+        bool isEnsembleReceived(void) const;
+        // See FicHandler::getFibSignature
+        std::vector<uint16_t> getFibSignature(void) const;
         uint8_t getEnsembleEcc(void) const;
         DabLabel getEnsembleLabel(void) const;
         std::vector<Service> getServiceList(void) const;
@@ -101,20 +210,49 @@ class RadioReceiver {
 
         DABParams& getParams();
 
-        RadioReceiverStats getReceiverStats() const;
+        /* Only reads counters, polling it does not slow down the
+         * receiver. The subchannels are listed with the stream set
+         * mutex held. */
+        RadioReceiverStats getReceiverStats();
 
     private:
         bool playProgramme(ProgrammeHandlerInterface& handler,
                 const Service& s,
                 const std::string& dumpFileName,
-                bool unique);
+                bool unique,
+                bool decodeAudio,
+                OverflowPolicy overflow = OverflowPolicy());
+
+        // Shared by the constructors
+        void configureDecoders(const RadioReceiverOptions& rro);
+        void stopInput(void);
+
+        // Load and save RadioReceiverOptions::ensembleCacheFile
+        void preloadEnsemble(void);
+        void storeEnsemble(void);
+
+        // Called by the FIC decoder for every CIF
+        void onFibs(EtiMultiplexer& eti, const uint8_t *fibs, size_t len);
 
         DABParams params; // Defaults to TM1 parameters
 
         MscHandler mscHandler;
         FicHandler ficHandler;
-        OFDMProcessor ofdmProcessor;
+        // One of them, depending on the input
+        std::unique_ptr<OFDMProcessor> ofdmProcessor;
+        std::unique_ptr<EtiDemultiplexer> etiDemultiplexer;
         bool decodeAudio;
+        std::string ensembleCacheFile;
+
+        // From setInitialCorrectors(), applied once by restart()
+        bool haveInitialCorrectors = false;
+        int32_t initialCoarseCorrector = 0;
+        int16_t initialFineCorrector = 0;
+
+        std::shared_ptr<EtiMultiplexer> etiMultiplexer;
+        std::atomic<bool> etiAllSubchannels = ATOMIC_VAR_INIT(false);
+        // The ensemble version the subchannels were last pinned for
+        std::atomic<uint64_t> etiPinnedVersion = ATOMIC_VAR_INIT(UINT64_MAX);
 };
 
 #endif
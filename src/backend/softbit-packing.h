@@ -0,0 +1,75 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef SOFTBIT_PACKING_H
+#define SOFTBIT_PACKING_H
+
+#include <cstdint>
+#include "dab-constants.h"
+
+/* Softbits quantised to 4 bits and packed two per byte, softbit 2n in
+ * the low and 2n + 1 in the high nibble. The demodulator delivers
+ * -127..127, the 16 levels keep the sign and 3 bits of confidence,
+ * which costs the Viterbi decoder next to nothing. Packing halves
+ * what the subchannels keep between the demodulation and the Viterbi
+ * decoder, the 16 CIFs of the time de-interleaver above all. */
+namespace packedsoftbits {
+
+    inline uint8_t quantise(softbit_t v)
+    {
+        return (uint8_t)(v >> 4) & 0x0F;
+    }
+
+    // Back to the middle of the quantisation step, never 0, which
+    // stands for a punctured bit
+    inline softbit_t expand(uint8_t nibble)
+    {
+        const int q = (int)(nibble ^ 0x08) - 0x08;
+        return (softbit_t)(q * 16 + 8);
+    }
+
+    // Bytes taking count softbits, count is even for all subchannels
+    inline int32_t bytes(int32_t count)
+    {
+        return (count + 1) / 2;
+    }
+
+    inline void pack(const softbit_t *v, int32_t count, uint8_t *out)
+    {
+        for (int32_t i = 0; i + 1 < count; i += 2) {
+            out[i / 2] = quantise(v[i]) | (uint8_t)(quantise(v[i + 1]) << 4);
+        }
+        if (count & 1) {
+            out[count / 2] = quantise(v[count - 1]);
+        }
+    }
+
+    inline softbit_t get(const uint8_t *packed, int32_t i)
+    {
+        return expand((packed[i / 2] >> ((i & 1) * 4)) & 0x0F);
+    }
+}
+
+#endif // SOFTBIT_PACKING_H
@@ -86,6 +86,8 @@ public:
 	virtual ~SubchannelSink() {}
 
 	virtual void Feed(const uint8_t *data, size_t len) = 0;
+	// keep in sync with the stream, but do not decode it
+	virtual void SetStandby(bool /*standby*/) {}
 	std::string GetUntouchedStreamFileExtension() {return untouched_stream_file_extension;}
 	void AddUntouchedStreamConsumer(UntouchedStreamConsumer* consumer) {
 		std::lock_guard<std::mutex> lock(uscs_mutex);
@@ -23,10 +23,12 @@
 #include <stdexcept>
 #include <iostream>
 #include "tii-decoder.h"
+#include "various/dsp-kernels.h"
+#include "various/thread-config.h"
 
 using namespace std;
 
-static const int tii_pattern[70][8] = { // {{{
+static constexpr int tii_pattern[70][8] = { // {{{
     {0,0,0,0,1,1,1,1},
     {0,0,0,1,0,1,1,1},
     {0,0,0,1,1,0,1,1},
@@ -98,28 +100,61 @@ static const int tii_pattern[70][8] = { // {{{
     {1,1,1,0,1,0,0,0},
     {1,1,1,1,0,0,0,0} }; // }}}
 
+// One carrier pair mask per comb and pattern, see tii_carrier_mask_t
+struct CombPatternMasks {
+    tii_carrier_mask_t masks[24][70];
+};
+
+static constexpr CombPatternMasks generateCombPatternMasks()
+{
+    CombPatternMasks m{};
+    for (int c = 0; c < 24; c++) {
+        for (int p = 0; p < 70; p++) {
+            for (int b = 0; b < 8; b++) {
+                if (tii_pattern[p][b]) {
+                    // k = 1 + 2*c + 48*b is the first carrier of pair c + 24*b
+                    const size_t pair = c + 24*b;
+                    m.masks[c][p][pair / 64] |= uint64_t(1) << (pair % 64);
+                }
+            }
+        }
+    }
+    return m;
+}
+
+static constexpr CombPatternMasks cp_masks = generateCombPatternMasks();
+
+static int countCommonCarriers(const tii_carrier_mask_t& a, const tii_carrier_mask_t& b)
+{
+    int count = 0;
+    for (size_t w = 0; w < a.size(); w++) {
+        count += __builtin_popcountll(a[w] & b[w]);
+    }
+    return count;
+}
+
 bool operator==(const CombPattern& lhs, const CombPattern& rhs)
 {
     return lhs.comb == rhs.comb and lhs.pattern == rhs.pattern;
 }
 
-std::vector<carrier_t> CombPattern::generateCarriers() const
+FrameArena::vector<carrier_t> CombPattern::generateCarriers(
+        std::pmr::memory_resource *mr) const
 {
-    std::vector<carrier_t> carriers;
+    FrameArena::vector<carrier_t> carriers(mr);
     carriers.reserve(32);
 
-    for (carrier_t k = 0; k < 384; k++) {
-        for (int b = 0; b < 8; b++) {
-            if (k == 1 + 2*comb + 48*b and tii_pattern[pattern][b]) {
-                carriers.push_back(k - 769);
-                carriers.push_back(k - 769 + 1);
-                carriers.push_back(k - 385);
-                carriers.push_back(k - 385 + 1);
-                carriers.push_back(k);
-                carriers.push_back(k + 1);
-                carriers.push_back(k + 384);
-                carriers.push_back(k + 384 + 1);
-            }
+    for (int b = 0; b < 8; b++) {
+        if (tii_pattern[pattern][b]) {
+            const carrier_t k = 1 + 2*comb + 48*b;
+            carriers.push_back(k - 769);
+            carriers.push_back(k - 769 + 1);
+            carriers.push_back(k - 385);
+            carriers.push_back(k - 385 + 1);
+            carriers.push_back(k);
+            carriers.push_back(k + 1);
+            carriers.push_back(k + 384);
+            carriers.push_back(k + 384 + 1);
         }
     }
 
@@ -138,25 +173,14 @@ TIIDecoder::TIIDecoder(const DABParams& params, RadioControllerInterface& ri) :
     m_radioInterface(ri),
     m_params(params),
     m_fft_null(params.T_u),
-    m_fft_prs(params.T_u)
+    m_fft_prs(params.T_u),
+    m_ifft_delay(params.T_u)
 {
     if (m_params.dabMode != 1) {
         clog << "TII decoder does not support mode " << m_params.dabMode << endl;
         return;
     }
 
-    for (int c = 0; c < 24; c++) {
-        for (int p = 0; p < 70; p++) {
-            for (carrier_t k = 0; k < 384; k++) {
-                for (int b = 0; b < 8; b++) {
-                    if (k == 1 + 2*c + 48*b and tii_pattern[p][b]) {
-                        m_cp_per_carrier[k].emplace(c, p);
-                    }
-                }
-            }
-        }
-    }
-
     m_thread = thread(&TIIDecoder::run, this);
 }
 
@@ -174,11 +198,12 @@ TIIDecoder::~TIIDecoder()
 
 void TIIDecoder::pushSymbols(
         const std::vector<complexf>& null,
-        const std::vector<complexf>& prs)
+        const complexf *prs, size_t prsSize)
 {
     unique_lock<mutex> lock(m_state_mutex);
     if (m_state == State::Idle) {
-        m_prs = prs;
+        // Both keep their capacity from the previous frame
+        m_prs.assign(prs, prs + prsSize);
         m_null = null;
         m_state = State::NullPrsReady;
     }
@@ -186,8 +211,17 @@ void TIIDecoder::pushSymbols(
     m_state_changed.notify_all();
 }
 
+void TIIDecoder::reset()
+{
+    // The measurements belong to the thread, it clears them
+    lock_guard<mutex> lock(m_state_mutex);
+    m_reset_requested = true;
+}
+
 void TIIDecoder::run()
 {
+    threading::ScopedThread threadConfig(ThreadStage::Tii, "dab-tii");
+
     const size_t spacing = m_params.T_u;
     const size_t nullsize = m_params.T_null;
 
@@ -202,6 +236,11 @@ void TIIDecoder::run()
             break;
         }
 
+        if (m_reset_requested) {
+            m_error_per_correction.clear();
+            m_reset_requested = false;
+        }
+
         lock.unlock();
         // We are in NullPrsReady state, and the state will not change now
 
@@ -238,8 +277,8 @@ void TIIDecoder::run()
          * correlate, whereas noise will not correlate. Also, we accumulate the
          * measurements over the four blocks.
          */
-        vector<complexf> blocks_multiplied(192);
-        vector<float> prs_power_sq(192);
+        array<complexf, TII_CARRIER_PAIRS> blocks_multiplied{};
+        array<float, TII_CARRIER_PAIRS> prs_power_sq{};
 
         /* Equivalent numpy code
         blocks = [null_fft[-768:-384], null_fft[-384:], null_fft[1:385], null_fft[385:769]]
@@ -267,47 +306,40 @@ void TIIDecoder::run()
             }
         }
 
-        auto ix_to_k = [](int ix) -> carrier_t {
-            if (ix <= 1024)
-                return ix;
-            else
-                return ix - 2048; };
-
         const float threshold_factor = 0.4f;
 
-        vector<carrier_t> carriers;
+        tii_carrier_mask_t detected{};
         for (size_t i = 0; i < 192; i++) {
             const float threshold = prs_power_sq[i] * threshold_factor;
             if (abs(blocks_multiplied[i]) > threshold) {
-                // Convert back from "pair index" to k
-                const carrier_t k = ix_to_k(i*2 + 1);
-                carriers.push_back(k);
-            }
-        }
-
-        unordered_map<CombPattern, int> cp_count;
-        for (const carrier_t k : carriers) {
-            if (m_cp_per_carrier.count(k)) {
-                for (const auto& cps : m_cp_per_carrier[k]) {
-                    cp_count[cps]++;
-                }
+                detected[i / 64] |= uint64_t(1) << (i % 64);
             }
         }
 
+        // A comb pattern is likely present if at least four of its
+        // carrier pairs were detected
+        constexpr size_t max_likely_cps = 10;
+        array<CombPattern, max_likely_cps> likely_cps;
         size_t num_likely_cps = 0;
-        for (const auto& cp : cp_count) {
-            if (cp.second >= 4) {
-                num_likely_cps++;
+
+        const int num_detected = countCommonCarriers(detected, detected);
+        for (int c = 0; c < 24 and num_detected >= 4; c++) {
+            for (int p = 0; p < 70; p++) {
+                if (countCommonCarriers(detected, cp_masks.masks[c][p]) >= 4) {
+                    if (num_likely_cps < max_likely_cps) {
+                        likely_cps[num_likely_cps] = CombPattern(c, p);
+                    }
+                    num_likely_cps++;
+                }
             }
         }
 
         // Sometimes the number of likely CPs is huge because
         // the threshold is wrong. Skip these cases.
-        if (num_likely_cps < 10) {
-            for (const auto& cp : cp_count) {
-                if (cp.second >= 4) {
-                    analyse_phase(cp.first);
-                }
+        if (num_likely_cps < max_likely_cps) {
+            for (size_t i = 0; i < num_likely_cps; i++) {
+                analyse_phase(likely_cps[i]);
+                m_scratch.reset();
             }
         }
 
@@ -318,68 +350,126 @@ void TIIDecoder::run()
     }
 }
 
+static int k_to_ix(carrier_t k)
+{
+    if (k < 0)
+        return 2048 + k;
+    else
+        return k;
+}
+
+float TIIDecoder::phase_error(const FrameArena::vector<carrier_t>& carriers,
+        const FrameArena::vector<float>& phases_prs, int delay)
+{
+    const complexf *n = m_fft_null.getVector();
+
+    // The rotated carriers first, for the phase kernel
+    auto rotated = m_scratch.makeVector<complexf>(carriers.size());
+    for (size_t j = 0; j < carriers.size(); j++) {
+        const int ix = k_to_ix(carriers[j]);
+        constexpr float pi = M_PI;
+        complexf rotator = polar(1.0f, 2.0f * pi * delay * carriers[j] / 2048.0f);
+        rotated[j] = n[ix] * rotator;
+    }
+    auto phases = m_scratch.makeVector<float>(carriers.size());
+    dsp::kernels().phase(rotated.data(), phases.data(), carriers.size());
+
+    float abs_err = 0;
+    for (size_t j = 0; j < carriers.size(); j++) {
+        float delta = phases[j] - phases_prs[j];
+        abs_err += abs(delta);
+    }
+    return abs_err;
+}
+
 void TIIDecoder::analyse_phase(const CombPattern& cp)
 {
-    const auto carriers = cp.generateCarriers();
+    const auto carriers = cp.generateCarriers(m_scratch.resource());
 
     const complexf *n = m_fft_null.getVector();
     const complexf *p = m_fft_prs.getVector();
 
-    auto k_to_ix = [](carrier_t k) -> int {
-        if (k < 0)
-            return 2048 + k;
-        else
-            return k; };
-
     // Both TII carriers take the phase from the first PRS frequency of the pair.
     // This assumes carriers is sorted.
-    vector<float> phases_prs(carriers.size());
+    auto phases_prs = m_scratch.makeVector<float>(carriers.size());
+
+    /* A delay of d samples rotates carrier k by -2 pi d k / 2048 relative
+     * to the PRS. Placing the normalised phase differences into their bins,
+     * the IFFT evaluates their coherent sum for all delays at once, and it
+     * peaks at d. */
+    complexf *delay_spectrum = m_ifft_delay.getVector();
+    fill(delay_spectrum, delay_spectrum + 2048, complexf(0, 0));
 
     for (size_t i = 0; i < carriers.size(); i += 2) {
-        const int ix = k_to_ix(carriers[i]);
+        const int ix_prs = k_to_ix(carriers[i]);
+
+        phases_prs[i] = dsp::arg(p[ix_prs]);
+        phases_prs[i+1] = phases_prs[i];
 
-        phases_prs[i] = arg(p[ix]);
-        phases_prs[i+1] = arg(p[ix]);
+        for (size_t j = i; j < i + 2; j++) {
+            const int ix = k_to_ix(carriers[j]);
+            const complexf z = n[ix] * conj(p[ix_prs]);
+            const float mag = abs(z);
+            if (mag > 0) {
+                delay_spectrum[ix] += z / mag;
+            }
+        }
     }
 
-    auto& meas = m_error_per_correction[cp];
+    m_ifft_delay.do_IFFT(false);
 
-    for (int err = -4; err < 500; err++) {
-        float abs_err = 0;
+    int best_delay = 0;
+    float best_power = -1;
+    for (int d = min_delay; d < max_delay; d++) {
+        const float power = norm(delay_spectrum[k_to_ix(d)]);
+        if (power > best_power) {
+            best_power = power;
+            best_delay = d;
+        }
+    }
 
-        for (size_t j = 0; j < carriers.size(); j++) {
-            const int ix = k_to_ix(carriers[j]);
-            constexpr float pi = M_PI;
-            complexf rotator = polar(1.0f, 2.0f * pi * err * carriers[j] / 2048.0f);
-            float delta = arg(n[ix] * rotator) - phases_prs[j];
-            abs_err += abs(delta);
+    // Refine on the phase error metric around the peak, the pairs of
+    // equal phase make the IFFT peak a bit wider than one sample
+    float best_error = phase_error(carriers, phases_prs, best_delay);
+    const int peak = best_delay;
+    for (int d = max(min_delay, peak - 1); d <= min(max_delay - 1, peak + 1); d++) {
+        if (d == peak)
+            continue;
+
+        const float error = phase_error(carriers, phases_prs, d);
+        if (error < best_error) {
+            best_error = error;
+            best_delay = d;
         }
-        meas.error_per_correction[err] += abs_err;
     }
 
+    auto& meas = m_error_per_correction[cp];
+    meas.count[best_delay - min_delay]++;
+    meas.error_sum[best_delay - min_delay] += best_error;
     meas.num_measurements++;
 
     if (meas.num_measurements >= 5) {
-        auto best = min_element(
-                meas.error_per_correction.begin(),
-                meas.error_per_correction.end(),
-                [](const pair<float, int>& lhs,
-                    const pair<float, int>& rhs) {
-                return lhs.second < rhs.second;
-                });
-
-        if (best != meas.error_per_correction.end()) {
-            tii_measurement_t m;
-            m.error = best->second;
-            m.delay_samples = best->first;
-            m.comb = cp.comb;
-            m.pattern = cp.pattern;
-
-            m_radioInterface.onTIIMeasurement(move(m));
+        // The most frequent delay wins, ties go to the smaller error
+        size_t best = 0;
+        for (size_t i = 1; i < num_delays; i++) {
+            if (meas.count[i] > meas.count[best] or
+                    (meas.count[i] == meas.count[best] and
+                     meas.count[i] > 0 and
+                     meas.error_sum[i] < meas.error_sum[best])) {
+                best = i;
+            }
         }
 
-        meas.error_per_correction.clear();
+        tii_measurement_t m;
+        m.error = meas.error_sum[best] / meas.count[best];
+        m.delay_samples = (int)best + min_delay;
+        m.comb = cp.comb;
+        m.pattern = cp.pattern;
+
+        m_radioInterface.onTIIMeasurement(move(m));
+
+        meas.count.fill(0);
+        meas.error_sum.fill(0);
         meas.num_measurements = 0;
     }
 }
-
@@ -18,10 +18,11 @@
  *    along with welle.io; if not, write to the Free Software
  *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include "dab-constants.h"
 #include <unordered_map>
-#include <unordered_set>
 #include <list>
 #include <vector>
 #include <mutex>
@@ -29,6 +30,7 @@
 #include <condition_variable>
 #include <complex>
 #include "fft.h"
+#include "frame-arena.h"
 #include "radio-controller.h"
 
 using complexf = std::complex<float>;
@@ -44,9 +46,16 @@ struct CombPattern {
     int comb = 0; // From 0 to 24
     int pattern = 0; // From 0 to 70
 
-    std::vector<carrier_t> generateCarriers(void) const;
+    FrameArena::vector<carrier_t> generateCarriers(
+            std::pmr::memory_resource *mr = std::pmr::get_default_resource()) const;
 };
 
+// The detected TII carriers as a bitmask over the 192 carrier pairs of one
+// 384 carrier block. Bit i stands for the pair starting at k = 2i + 1, all
+// four blocks are accumulated into it.
+constexpr size_t TII_CARRIER_PAIRS = 192;
+using tii_carrier_mask_t = std::array<uint64_t, TII_CARRIER_PAIRS / 64>;
+
 // Make CombPattern satisfy Hash and Compare
 bool operator==(const CombPattern& lhs, const CombPattern& rhs);
 
@@ -68,13 +77,19 @@ class TIIDecoder {
         TIIDecoder(const TIIDecoder& other) = delete;
         TIIDecoder& operator=(const TIIDecoder& other) = delete;
 
+        // Both are copied, prs must hold at least T_u samples
         void pushSymbols(
                 const std::vector<complexf>& null,
-                const std::vector<complexf>& prs);
+                const complexf *prs, size_t prsSize);
+
+        // Forget the measurements, e.g. on another channel
+        void reset(void);
 
     private:
         void run(void);
         void analyse_phase(const CombPattern& cp);
+        float phase_error(const FrameArena::vector<carrier_t>& carriers,
+                const FrameArena::vector<float>& phases_prs, int delay);
 
         RadioControllerInterface& m_radioInterface;
         const DABParams& m_params;
@@ -82,21 +97,30 @@ class TIIDecoder {
         std::vector<complexf> m_null;
         std::vector<complexf> m_prs;
 
-        std::unordered_map<carrier_t, std::unordered_set<CombPattern> >
-            m_cp_per_carrier;
-
         enum class State { Idle, NullPrsReady, Abort };
 
         std::thread m_thread;
         std::mutex m_state_mutex;
         std::condition_variable m_state_changed;
         State m_state = State::Idle;
+        bool m_reset_requested = false;
+
+        // Buffers of the analysis of one NULL symbol
+        FrameArena m_scratch;
 
         fft::Forward m_fft_null;
         fft::Forward m_fft_prs;
+        fft::Backward m_ifft_delay;
+
+        // Delays we look for, in samples
+        static constexpr int min_delay = -4;
+        static constexpr int max_delay = 500;
+        static constexpr size_t num_delays = max_delay - min_delay;
 
+        // Histogram of the per frame delay estimates
         struct cp_error_measurement_t {
-            std::unordered_map<float, uint64_t> error_per_correction;
+            std::array<uint32_t, num_delays> count{};
+            std::array<float, num_delays> error_sum{};
             size_t num_measurements = 0;
         };
 
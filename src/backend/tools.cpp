@@ -57,16 +57,33 @@ void CalcCRC::FillLUT() {
 				crc = crc << 1;
 		}
 
-		crc_lut[value] = crc;
+		crc_lut[0][value] = crc;
 	}
+
+	for(int k = 1; k < 8; k++)
+		for(int value = 0; value < 256; value++)
+			crc_lut[k][value] = (crc_lut[k - 1][value] << 8) ^ crc_lut[0][crc_lut[k - 1][value] >> 8];
+}
+
+void CalcCRC::ProcessBytes(uint16_t& crc, const uint8_t *data, size_t len) {
+	// 8 bytes at once
+	for(; len >= 8; len -= 8, data += 8) {
+		const uint16_t high = crc ^ ((data[0] << 8) | data[1]);
+		crc =	crc_lut[7][high >> 8] ^ crc_lut[6][high & 0xFF] ^
+			crc_lut[5][data[2]] ^ crc_lut[4][data[3]] ^
+			crc_lut[3][data[4]] ^ crc_lut[2][data[5]] ^
+			crc_lut[1][data[6]] ^ crc_lut[0][data[7]];
+	}
+
+	for(size_t offset = 0; offset < len; offset++)
+		ProcessByte(crc, data[offset]);
 }
 
 uint16_t CalcCRC::Calc(const uint8_t *data, size_t len) {
 	uint16_t crc;
 	Initialize(crc);
 
-	for(size_t offset = 0; offset < len; offset++)
-		ProcessByte(crc, data[offset]);
+	ProcessBytes(crc, data, len);
 
 	Finalize(crc);
 	return crc;
@@ -78,8 +95,7 @@ void CalcCRC::ProcessBits(uint16_t& crc, const uint8_t *data, size_t len) {
 	size_t bytes = len / 8;
 	size_t bits = len % 8;
 
-	for(size_t offset = 0; offset < bytes; offset++)
-		ProcessByte(crc, data[offset]);
+	ProcessBytes(crc, data, bytes);
 	for(size_t bit = 0; bit < bits; bit++)
 		ProcessBit(crc, data[bytes] & (0x80 >> bit));
 }
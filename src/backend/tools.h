@@ -44,7 +44,8 @@ private:
 	bool final_invert;
 	uint16_t gen_polynom;
 
-	uint16_t crc_lut[256];
+	// slice-by-8: crc_lut[k] is the CRC of a byte followed by k zero bytes
+	uint16_t crc_lut[8][256];
 	void FillLUT();
 public:
 	CalcCRC(bool initial_invert, bool final_invert, uint16_t gen_polynom);
@@ -56,6 +57,7 @@ public:
 	// modular API
 	void Initialize(uint16_t& crc);
 	void ProcessByte(uint16_t& crc, const uint8_t data);
+	void ProcessBytes(uint16_t& crc, const uint8_t *data, size_t len);
 	void ProcessBit(uint16_t& crc, const bool data);
 	void ProcessBits(uint16_t& crc, const uint8_t *data, size_t len);
 	void Finalize(uint16_t& crc);
@@ -73,7 +75,7 @@ inline void CalcCRC::Initialize(uint16_t& crc) {
 
 inline void CalcCRC::ProcessByte(uint16_t& crc, const uint8_t data) {
 	// use LUT
-	crc = (crc << 8) ^ crc_lut[(crc >> 8) ^ data];
+	crc = (crc << 8) ^ crc_lut[0][(crc >> 8) ^ data];
 }
 
 inline void CalcCRC::ProcessBit(uint16_t& crc, const bool data) {
@@ -132,7 +134,7 @@ public:
 	void Reset();
 	void AddBits(int data_new, size_t count);
 	void AddBytes(const uint8_t *data, size_t len);
-	const std::vector<uint8_t> GetData() {return data;}
+	const std::vector<uint8_t>& GetData() const {return data;}
 
 	void WriteAudioMuxLengthBytes();	// needed for LATM
 };
@@ -164,77 +164,39 @@ UEPProtection::UEPProtection(
         PI4 = getPCodes(profileTable[index].PI4 -1);
     else
         PI4 = nullptr;
-}
 
-bool UEPProtection::deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer)
-{
-    int16_t i, j;
-    int16_t inputCounter    = 0;
-    int32_t viterbiCounter  = 0;
-    (void)size;         // currently unused
+    if (L4 > 0 and PI4 == nullptr) {
+        throw std::logic_error("Invalid usage of NULL PI4");
+    }
 
     //  according to the standard we process the logical frame
     //  with a pair of tuples
     //  (L1, PI1), (L2, PI2), (L3, PI3), (L4, PI4)
-
-    /// clear the bits in the viterbiBlock,
-    /// only the non-punctured ones are set
-    memset(viterbiBlock.data(), 0, (outSize * 4 + 24) * sizeof(softbit_t));
-
-    for (i = 0; i < L1; i ++) {
-        for (j = 0; j < 128; j ++) {
-            if (PI1[j % 32] != 0) {
-                viterbiBlock[viterbiCounter] = v[inputCounter ++];
-            }
-            viterbiCounter++;
-        }
-    }
-
-    for (i = 0; i < L2; i ++) {
-        for (j = 0; j < 128; j ++) {
-            if (PI2[j % 32] != 0) {
-                viterbiBlock[viterbiCounter] = v[inputCounter ++];
-            }
-            viterbiCounter++;
-        }
-    }
-
-    for (i = 0; i < L3; i ++) {
-        for (j = 0; j < 128; j ++) {
-            if (PI3[j % 32] != 0) {
-                viterbiBlock[viterbiCounter] = v[inputCounter ++];
-            }
-            viterbiCounter++;
-        }
-    }
-
-    for (i = 0; i < L4; i ++) {
-        if (PI4 == nullptr) {
-            throw std::logic_error("Invalid usage of NULL PI4");
-        }
-
-        for (j = 0; j < 128; j ++) {
-            if (PI4[j % 32] != 0) {
-                viterbiBlock[viterbiCounter] = v[inputCounter ++];
-            }
-            viterbiCounter++;
-        }
+    //  only the non-punctured bits of the viterbiBlock are ever set
+    depunctureTable.addBlocks(L1, PI1);
+    depunctureTable.addBlocks(L2, PI2);
+    depunctureTable.addBlocks(L3, PI3);
+    if (L4 > 0) {
+        depunctureTable.addBlocks(L4, PI4);
     }
+    depunctureTable.addTail();
+}
 
-    /**
-     * we have a final block of 24 bits  with puncturing according to PI_X
-     * This block constitutes the 6 * 4 bits of the register itself.
-     */
-    for (i = 0; i < 24; i ++) {
-        if (PI_X[i] != 0) {
-            viterbiBlock[viterbiCounter] = v[inputCounter ++];
-        }
-        viterbiCounter++;
-    }
+bool UEPProtection::deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer)
+{
+    (void)size;         // currently unused
+    depunctureTable.depuncture(v, viterbiBlock.data());
 
     /// The actual deconvolution is done by the viterbi decoder
 
-    Viterbi::deconvolve(viterbiBlock.data(), outBuffer);
+    Viterbi::deconvolvePacked(viterbiBlock.data(), outBuffer);
     return true;
 }
 
+bool UEPProtection::deconvolvePacked(const uint8_t *v, int32_t size, uint8_t *outBuffer)
+{
+    (void)size;         // currently unused
+    depunctureTable.depuncturePacked(v, viterbiBlock.data());
+    Viterbi::deconvolvePacked(viterbiBlock.data(), outBuffer);
+    return true;
+}
@@ -33,7 +33,9 @@ class UEPProtection: public Protection, public Viterbi
     public:
         UEPProtection(int16_t bitRate, int16_t protLevel);
         bool deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer);
+        bool deconvolvePacked(const uint8_t *v, int32_t size, uint8_t *outBuffer);
     private:
+        DepunctureTable depunctureTable;
         int16_t L1;
         int16_t L2;
         int16_t L3;
@@ -21,7 +21,15 @@
 #include    <stdio.h>
 #include    <stdlib.h>
 #include    "viterbi.h"
+#include    "dsp-kernels.h"
 #include    <cstring>
+#include    <iostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#elif defined(__aarch64__)
+#  include <arm_neon.h>
+#endif
 
 #ifdef  __MINGW32__
 #  include <intrin.h>
@@ -119,6 +127,253 @@ void renormalize(COMPUTETYPE* X, COMPUTETYPE threshold)
     }
 }
 
+/*  SIMD versions of update_viterbi_blk_GENERIC, one butterfly per lane.
+ *  They give bit exact the same decisions and metrics as BFLY:
+ *  the metrics stay far below 32768 thanks to renormalize(), so the
+ *  signed 16 bit compare and min instructions can be used, and
+ *  "decision ? m1 : m0" is the minimum of both.
+ *  The survivors of butterfly i go to the states 2i and 2i + 1, which
+ *  is an interleave of the two result vectors, the decisions are
+ *  interleaved the same way and then packed into one bit per state.
+ */
+#define BRANCHMAX (RATE * 255)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VITERBI_SIMD_X86
+
+__attribute__((target("sse2")))
+static void update_viterbi_blk_SSE2(
+        struct v *vp,
+        const COMPUTETYPE *branchtab,
+        const COMPUTETYPE *syms,
+        int16_t nbits)
+{
+    const __m128i max = _mm_set1_epi16(BRANCHMAX);
+
+    for (int32_t s = 0; s < nbits; s++) {
+        const COMPUTETYPE *old = vp->old_metrics->t;
+        COMPUTETYPE *nw = vp->new_metrics->t;
+        uint32_t *dw = vp->decisions[s].w;
+
+        const __m128i sym0 = _mm_set1_epi16(syms[s * RATE + 0]);
+        const __m128i sym1 = _mm_set1_epi16(syms[s * RATE + 1]);
+        const __m128i sym2 = _mm_set1_epi16(syms[s * RATE + 2]);
+        const __m128i sym3 = _mm_set1_epi16(syms[s * RATE + 3]);
+
+        for (int32_t b = 0; b < NUMSTATES / 16; b++) {
+            const COMPUTETYPE *bt = branchtab + 8 * b;
+            __m128i metric = _mm_xor_si128(_mm_load_si128((const __m128i*)(bt + 0 * NUMSTATES / 2)), sym0);
+            metric = _mm_add_epi16(metric, _mm_xor_si128(_mm_load_si128((const __m128i*)(bt + 1 * NUMSTATES / 2)), sym1));
+            metric = _mm_add_epi16(metric, _mm_xor_si128(_mm_load_si128((const __m128i*)(bt + 2 * NUMSTATES / 2)), sym2));
+            metric = _mm_add_epi16(metric, _mm_xor_si128(_mm_load_si128((const __m128i*)(bt + 3 * NUMSTATES / 2)), sym3));
+            const __m128i inverse = _mm_sub_epi16(max, metric);
+
+            const __m128i lo = _mm_load_si128((const __m128i*)(old + 8 * b));
+            const __m128i hi = _mm_load_si128((const __m128i*)(old + NUMSTATES / 2 + 8 * b));
+
+            const __m128i m0 = _mm_add_epi16(lo, metric);
+            const __m128i m1 = _mm_add_epi16(hi, inverse);
+            const __m128i m2 = _mm_add_epi16(lo, inverse);
+            const __m128i m3 = _mm_add_epi16(hi, metric);
+
+            const __m128i decision0 = _mm_cmpgt_epi16(m0, m1);
+            const __m128i decision1 = _mm_cmpgt_epi16(m2, m3);
+            const __m128i survivor0 = _mm_min_epi16(m0, m1);
+            const __m128i survivor1 = _mm_min_epi16(m2, m3);
+
+            _mm_store_si128((__m128i*)(nw + 16 * b), _mm_unpacklo_epi16(survivor0, survivor1));
+            _mm_store_si128((__m128i*)(nw + 16 * b + 8), _mm_unpackhi_epi16(survivor0, survivor1));
+
+            const uint32_t bits = _mm_movemask_epi8(_mm_packs_epi16(
+                        _mm_unpacklo_epi16(decision0, decision1),
+                        _mm_unpackhi_epi16(decision0, decision1)));
+            if (b & 1)
+                dw[b / 2] |= bits << 16;
+            else
+                dw[b / 2] = bits;
+        }
+
+        if (nw[0] > RENORMALIZE_THRESHOLD) {
+            __m128i min = _mm_load_si128((const __m128i*)nw);
+            for (int32_t i = 8; i < NUMSTATES; i += 8)
+                min = _mm_min_epi16(min, _mm_load_si128((const __m128i*)(nw + i)));
+            min = _mm_min_epi16(min, _mm_shuffle_epi32(min, _MM_SHUFFLE(1, 0, 3, 2)));
+            min = _mm_min_epi16(min, _mm_shuffle_epi32(min, _MM_SHUFFLE(2, 3, 0, 1)));
+            min = _mm_min_epi16(min, _mm_shufflelo_epi16(min, _MM_SHUFFLE(2, 3, 0, 1)));
+            min = _mm_shufflelo_epi16(min, 0);
+            min = _mm_unpacklo_epi64(min, min);
+            for (int32_t i = 0; i < NUMSTATES; i += 8) {
+                __m128i *x = (__m128i*)(nw + i);
+                _mm_store_si128(x, _mm_sub_epi16(_mm_load_si128(x), min));
+            }
+        }
+
+        metric_t *tmp = vp->old_metrics;
+        vp->old_metrics = vp->new_metrics;
+        vp->new_metrics = tmp;
+    }
+}
+
+__attribute__((target("avx2")))
+static void update_viterbi_blk_AVX2(
+        struct v *vp,
+        const COMPUTETYPE *branchtab,
+        const COMPUTETYPE *syms,
+        int16_t nbits)
+{
+    const __m256i max = _mm256_set1_epi16(BRANCHMAX);
+
+    for (int32_t s = 0; s < nbits; s++) {
+        const COMPUTETYPE *old = vp->old_metrics->t;
+        COMPUTETYPE *nw = vp->new_metrics->t;
+        uint32_t *dw = vp->decisions[s].w;
+
+        const __m256i sym0 = _mm256_set1_epi16(syms[s * RATE + 0]);
+        const __m256i sym1 = _mm256_set1_epi16(syms[s * RATE + 1]);
+        const __m256i sym2 = _mm256_set1_epi16(syms[s * RATE + 2]);
+        const __m256i sym3 = _mm256_set1_epi16(syms[s * RATE + 3]);
+
+        for (int32_t b = 0; b < NUMSTATES / 32; b++) {
+            const COMPUTETYPE *bt = branchtab + 16 * b;
+            __m256i metric = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(bt + 0 * NUMSTATES / 2)), sym0);
+            metric = _mm256_add_epi16(metric, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(bt + 1 * NUMSTATES / 2)), sym1));
+            metric = _mm256_add_epi16(metric, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(bt + 2 * NUMSTATES / 2)), sym2));
+            metric = _mm256_add_epi16(metric, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(bt + 3 * NUMSTATES / 2)), sym3));
+            const __m256i inverse = _mm256_sub_epi16(max, metric);
+
+            const __m256i lo = _mm256_loadu_si256((const __m256i*)(old + 16 * b));
+            const __m256i hi = _mm256_loadu_si256((const __m256i*)(old + NUMSTATES / 2 + 16 * b));
+
+            const __m256i m0 = _mm256_add_epi16(lo, metric);
+            const __m256i m1 = _mm256_add_epi16(hi, inverse);
+            const __m256i m2 = _mm256_add_epi16(lo, inverse);
+            const __m256i m3 = _mm256_add_epi16(hi, metric);
+
+            const __m256i decision0 = _mm256_cmpgt_epi16(m0, m1);
+            const __m256i decision1 = _mm256_cmpgt_epi16(m2, m3);
+            const __m256i survivor0 = _mm256_min_epi16(m0, m1);
+            const __m256i survivor1 = _mm256_min_epi16(m2, m3);
+
+            // The unpack instructions work within the 128 bit lanes
+            const __m256i slo = _mm256_unpacklo_epi16(survivor0, survivor1);
+            const __m256i shi = _mm256_unpackhi_epi16(survivor0, survivor1);
+            _mm256_storeu_si256((__m256i*)(nw + 32 * b), _mm256_permute2x128_si256(slo, shi, 0x20));
+            _mm256_storeu_si256((__m256i*)(nw + 32 * b + 16), _mm256_permute2x128_si256(slo, shi, 0x31));
+
+            const __m256i dlo = _mm256_unpacklo_epi16(decision0, decision1);
+            const __m256i dhi = _mm256_unpackhi_epi16(decision0, decision1);
+            const __m256i packed = _mm256_packs_epi16(
+                    _mm256_permute2x128_si256(dlo, dhi, 0x20),
+                    _mm256_permute2x128_si256(dlo, dhi, 0x31));
+            dw[b] = _mm256_movemask_epi8(_mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+
+        if (nw[0] > RENORMALIZE_THRESHOLD) {
+            __m256i min = _mm256_loadu_si256((const __m256i*)nw);
+            for (int32_t i = 16; i < NUMSTATES; i += 16)
+                min = _mm256_min_epi16(min, _mm256_loadu_si256((const __m256i*)(nw + i)));
+            __m128i min128 = _mm_min_epi16(_mm256_castsi256_si128(min), _mm256_extracti128_si256(min, 1));
+            min128 = _mm_minpos_epu16(min128);
+            const __m256i minv = _mm256_broadcastw_epi16(min128);
+            for (int32_t i = 0; i < NUMSTATES; i += 16) {
+                __m256i *x = (__m256i*)(nw + i);
+                _mm256_storeu_si256(x, _mm256_sub_epi16(_mm256_loadu_si256(x), minv));
+            }
+        }
+
+        metric_t *tmp = vp->old_metrics;
+        vp->old_metrics = vp->new_metrics;
+        vp->new_metrics = tmp;
+    }
+}
+#endif
+
+#if defined(__aarch64__)
+#define VITERBI_SIMD_NEON
+
+static void update_viterbi_blk_NEON(
+        struct v *vp,
+        const COMPUTETYPE *branchtab,
+        const COMPUTETYPE *syms,
+        int16_t nbits)
+{
+    const uint16x8_t max = vdupq_n_u16(BRANCHMAX);
+    const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t bitWeights = vld1q_u8(weights);
+
+    for (int32_t s = 0; s < nbits; s++) {
+        const COMPUTETYPE *old = vp->old_metrics->t;
+        COMPUTETYPE *nw = vp->new_metrics->t;
+        uint32_t *dw = vp->decisions[s].w;
+
+        const uint16x8_t sym0 = vdupq_n_u16(syms[s * RATE + 0]);
+        const uint16x8_t sym1 = vdupq_n_u16(syms[s * RATE + 1]);
+        const uint16x8_t sym2 = vdupq_n_u16(syms[s * RATE + 2]);
+        const uint16x8_t sym3 = vdupq_n_u16(syms[s * RATE + 3]);
+
+        for (int32_t b = 0; b < NUMSTATES / 16; b++) {
+            const COMPUTETYPE *bt = branchtab + 8 * b;
+            uint16x8_t metric = veorq_u16(vld1q_u16(bt + 0 * NUMSTATES / 2), sym0);
+            metric = vaddq_u16(metric, veorq_u16(vld1q_u16(bt + 1 * NUMSTATES / 2), sym1));
+            metric = vaddq_u16(metric, veorq_u16(vld1q_u16(bt + 2 * NUMSTATES / 2), sym2));
+            metric = vaddq_u16(metric, veorq_u16(vld1q_u16(bt + 3 * NUMSTATES / 2), sym3));
+            const uint16x8_t inverse = vsubq_u16(max, metric);
+
+            const uint16x8_t lo = vld1q_u16(old + 8 * b);
+            const uint16x8_t hi = vld1q_u16(old + NUMSTATES / 2 + 8 * b);
+
+            const uint16x8_t m0 = vaddq_u16(lo, metric);
+            const uint16x8_t m1 = vaddq_u16(hi, inverse);
+            const uint16x8_t m2 = vaddq_u16(lo, inverse);
+            const uint16x8_t m3 = vaddq_u16(hi, metric);
+
+            const uint16x8x2_t survivors = vzipq_u16(vminq_u16(m0, m1), vminq_u16(m2, m3));
+            vst1q_u16(nw + 16 * b, survivors.val[0]);
+            vst1q_u16(nw + 16 * b + 8, survivors.val[1]);
+
+            const uint16x8x2_t decisions = vzipq_u16(vcgtq_u16(m0, m1), vcgtq_u16(m2, m3));
+            const uint8x16_t masked = vandq_u8(bitWeights, vcombine_u8(
+                        vmovn_u16(decisions.val[0]), vmovn_u16(decisions.val[1])));
+            const uint32_t bits = vaddv_u8(vget_low_u8(masked)) |
+                (vaddv_u8(vget_high_u8(masked)) << 8);
+            if (b & 1)
+                dw[b / 2] |= bits << 16;
+            else
+                dw[b / 2] = bits;
+        }
+
+        if (nw[0] > RENORMALIZE_THRESHOLD) {
+            uint16x8_t min = vld1q_u16(nw);
+            for (int32_t i = 8; i < NUMSTATES; i += 8)
+                min = vminq_u16(min, vld1q_u16(nw + i));
+            const uint16x8_t minv = vdupq_n_u16(vminvq_u16(min));
+            for (int32_t i = 0; i < NUMSTATES; i += 8)
+                vst1q_u16(nw + i, vsubq_u16(vld1q_u16(nw + i), minv));
+        }
+
+        metric_t *tmp = vp->old_metrics;
+        vp->old_metrics = vp->new_metrics;
+        vp->new_metrics = tmp;
+    }
+}
+#endif
+
+//  The butterflies of the dsp kernel set in use, see dsp::selectKernels,
+//  nullptr for the generic code. The set is only selected if the CPU
+//  supports it, SSE4 implies SSE2.
+Viterbi::UpdateFunction Viterbi::selectUpdateFunction()
+{
+    switch (dsp::kernelSetOf(dsp::FastPath::Viterbi)) {
+#if defined(VITERBI_SIMD_X86)
+        case dsp::KernelSet::AVX2: return update_viterbi_blk_AVX2;
+        case dsp::KernelSet::SSE4: return update_viterbi_blk_SSE2;
+#elif defined(VITERBI_SIMD_NEON)
+        case dsp::KernelSet::NEON: return update_viterbi_blk_NEON;
+#endif
+        default: return nullptr;
+    }
+}
+
 //  The main use of the viterbi decoder is in handling the FIC blocks
 //  There are (in mode 1) 3 ofdm blocks, giving 4 FIC blocks
 //  There all have a predefined length. In that case we use the
@@ -225,6 +480,21 @@ uint8_t getbit (uint8_t v, int32_t o)
 //  we have to map that onto 0 .. 255
 
 void Viterbi::deconvolve(softbit_t *input, uint8_t *output)
+{
+    decode (input, data);
+
+    for (uint32_t i = 0; i < (uint16_t)frameBits; i ++)
+        output[i] = getbit (data[i >> 3], i & 07);
+}
+
+//  The chainback already delivers packed bytes, with the first bit in
+//  the MSB
+void Viterbi::deconvolvePacked(softbit_t *input, uint8_t *output)
+{
+    decode (input, output);
+}
+
+void Viterbi::decode(softbit_t *input, uint8_t *packed)
 {
     uint32_t    i;
 
@@ -236,12 +506,13 @@ void Viterbi::deconvolve(softbit_t *input, uint8_t *output)
         symbols[i] = temp;
     }
 
-    update_viterbi_blk_GENERIC (&vp, symbols, frameBits + (K - 1));
+    const UpdateFunction update = selectUpdateFunction();
+    if (update)
+        update (&vp, Branchtab, symbols, frameBits + (K - 1));
+    else
+        update_viterbi_blk_GENERIC (&vp, symbols, frameBits + (K - 1));
 
-    chainback_viterbi (&vp, data, frameBits, 0);
-
-    for (i = 0; i < (uint16_t)frameBits; i ++)
-        output[i] = getbit (data[i >> 3], i & 07);
+    chainback_viterbi (&vp, packed, frameBits, 0);
 }
 
 /* C-language butterfly */
@@ -309,6 +580,193 @@ void Viterbi::update_viterbi_blk_GENERIC(
 }
 
 //
+/*  The lanes of ViterbiBatch are codewords, not states. Every operation
+ *  of BFLY is done for all codewords at once, on vectors of 8 metrics of
+ *  16 bit. The decisions of a state are collected in one byte, with one
+ *  bit per codeword.
+ */
+/*  The reference lanes, a plain loop per operation. The SIMD lanes below
+ *  compute exactly the same, they are used unless the scalar dsp kernels
+ *  were selected.
+ */
+struct ReferenceLanes {
+    struct type { COMPUTETYPE v[ViterbiBatch::lanes]; };
+#define LANES_OP(expr) \
+    type r; for (int l = 0; l < ViterbiBatch::lanes; l++) r.v[l] = (expr); return r;
+    static inline type load(const COMPUTETYPE *p) { LANES_OP(p[l]) }
+    static inline void store(COMPUTETYPE *p, type a) { for (int l = 0; l < ViterbiBatch::lanes; l++) p[l] = a.v[l]; }
+    static inline type add(type a, type b) { LANES_OP(a.v[l] + b.v[l]) }
+    static inline type sub(type a, type b) { LANES_OP(a.v[l] - b.v[l]) }
+    static inline type min(type a, type b) { LANES_OP(std::min(a.v[l], b.v[l])) }
+    static inline type greater(type a, type b) { LANES_OP(a.v[l] > b.v[l] ? 0xFFFF : 0) }
+    static inline type bitAnd(type a, type b) { LANES_OP(a.v[l] & b.v[l]) }
+    static inline type set(COMPUTETYPE x) { LANES_OP(x) }
+#undef LANES_OP
+    static inline uint8_t mask(type a) {
+        uint8_t mask = 0;
+        for (int l = 0; l < ViterbiBatch::lanes; l++) mask |= (a.v[l] & 1) << l;
+        return mask;
+    }
+};
+
+#if defined(__SSE2__)
+struct SimdLanes {
+    typedef __m128i type;
+    static inline type load(const COMPUTETYPE *p) { return _mm_loadu_si128((const __m128i*)p); }
+    static inline void store(COMPUTETYPE *p, type a) { _mm_storeu_si128((__m128i*)p, a); }
+    static inline type add(type a, type b) { return _mm_add_epi16(a, b); }
+    static inline type sub(type a, type b) { return _mm_sub_epi16(a, b); }
+    static inline type min(type a, type b) { return _mm_min_epi16(a, b); }
+    static inline type greater(type a, type b) { return _mm_cmpgt_epi16(a, b); }
+    static inline type bitAnd(type a, type b) { return _mm_and_si128(a, b); }
+    static inline type set(COMPUTETYPE x) { return _mm_set1_epi16(x); }
+    static inline uint8_t mask(type a) {
+        return _mm_movemask_epi8(_mm_packs_epi16(a, a)) & 0xFF;
+    }
+};
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+struct SimdLanes {
+    typedef uint16x8_t type;
+    static inline type load(const COMPUTETYPE *p) { return vld1q_u16(p); }
+    static inline void store(COMPUTETYPE *p, type a) { vst1q_u16(p, a); }
+    static inline type add(type a, type b) { return vaddq_u16(a, b); }
+    static inline type sub(type a, type b) { return vsubq_u16(a, b); }
+    static inline type min(type a, type b) { return vminq_u16(a, b); }
+    static inline type greater(type a, type b) { return vcgtq_u16(a, b); }
+    static inline type bitAnd(type a, type b) { return vandq_u16(a, b); }
+    static inline type set(COMPUTETYPE x) { return vdupq_n_u16(x); }
+    static inline uint8_t mask(type a) {
+        const uint16_t weights[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+        const uint16x8_t bits = vandq_u16(a, vld1q_u16(weights));
+        uint16x4_t sum = vpadd_u16(vget_low_u16(bits), vget_high_u16(bits));
+        sum = vpadd_u16(sum, sum);
+        sum = vpadd_u16(sum, sum);
+        return vget_lane_u16(sum, 0);
+    }
+};
+#else
+typedef ReferenceLanes SimdLanes;
+#endif
+
+ViterbiBatch::ViterbiBatch(int16_t wordlength) :
+    frameBits(wordlength),
+    symbols((wordlength + (K - 1)) * RATE * lanes),
+    metrics1(NUMSTATES * lanes),
+    metrics2(NUMSTATES * lanes),
+    decisions((wordlength + (K - 1)) * NUMSTATES)
+{
+    int polys[RATE] = POLYS;
+
+    for (int state = 0; state < NUMSTATES / 2; state++) {
+        branchCodes[state] = 0;
+        for (int i = 0; i < RATE; i++) {
+            const int x = (2 * state) & abs(polys[i]);
+            const int bit = (polys[i] < 0) ^ (Partab[(x ^ (x >> 8)) & 0xFF]);
+            branchCodes[state] |= bit << i;
+        }
+    }
+}
+
+void ViterbiBatch::deconvolve(const softbit_t *const *inputs,
+        uint8_t *const *outputs, int count)
+{
+    const int32_t nbits = frameBits + (K - 1);
+
+    //  Unused lanes decode zeros
+    for (int32_t i = 0; i < nbits * RATE; i++) {
+        for (int l = 0; l < lanes; l++) {
+            int16_t temp = l < count ? ((int16_t)inputs[l][i]) + 127 : 127;
+            if (temp < 0) temp = 0;
+            if (temp > 255) temp = 255;
+            symbols[i * lanes + l] = temp;
+        }
+    }
+
+    if (dsp::kernelSetOf(dsp::FastPath::Viterbi) == dsp::KernelSet::Scalar)
+        trellis<ReferenceLanes>(nbits);
+    else
+        trellis<SimdLanes>(nbits);
+
+    for (int l = 0; l < count; l++)
+        chainback(l, outputs[l]);
+}
+
+//  The add-compare-select steps of all lanes, L is one of the lane types
+template<class L>
+void ViterbiBatch::trellis(int32_t nbits)
+{
+    typedef typename L::type lanes_t;
+
+    COMPUTETYPE *old_metrics = metrics1.data();
+    COMPUTETYPE *new_metrics = metrics2.data();
+    for (int i = 0; i < NUMSTATES * lanes; i++)
+        old_metrics[i] = i < lanes ? 0 : 63;
+
+    const lanes_t threshold = L::set(RENORMALIZE_THRESHOLD);
+
+    for (int32_t s = 0; s < nbits; s++) {
+        //  The branch metric of all 16 combinations of the branch bits,
+        //  the one of the inverted bits is (RATE * 255) - metric
+        lanes_t branch[1 << RATE];
+        const COMPUTETYPE *sym = &symbols[s * RATE * lanes];
+        for (int code = 0; code < (1 << RATE); code++) {
+            lanes_t metric = L::set(0);
+            for (int j = 0; j < RATE; j++) {
+                lanes_t x = L::load(sym + j * lanes);
+                if (code & (1 << j))
+                    x = L::sub(L::set(255), x);
+                metric = L::add(metric, x);
+            }
+            branch[code] = metric;
+        }
+
+        uint8_t *d = &decisions[s * NUMSTATES];
+        for (int i = 0; i < NUMSTATES / 2; i++) {
+            const lanes_t metric = branch[branchCodes[i]];
+            const lanes_t inverse = branch[branchCodes[i] ^ ((1 << RATE) - 1)];
+            const lanes_t lo = L::load(old_metrics + i * lanes);
+            const lanes_t hi = L::load(old_metrics + (i + NUMSTATES / 2) * lanes);
+
+            const lanes_t m0 = L::add(lo, metric);
+            const lanes_t m1 = L::add(hi, inverse);
+            const lanes_t m2 = L::add(lo, inverse);
+            const lanes_t m3 = L::add(hi, metric);
+
+            L::store(new_metrics + 2 * i * lanes, L::min(m0, m1));
+            L::store(new_metrics + (2 * i + 1) * lanes, L::min(m2, m3));
+            d[2 * i] = L::mask(L::greater(m0, m1));
+            d[2 * i + 1] = L::mask(L::greater(m2, m3));
+        }
+
+        //  renormalize, for the lanes where state 0 is above the threshold
+        const lanes_t first = L::load(new_metrics);
+        lanes_t min = first;
+        for (int i = 1; i < NUMSTATES; i++)
+            min = L::min(min, L::load(new_metrics + i * lanes));
+        min = L::bitAnd(min, L::greater(first, threshold));
+        for (int i = 0; i < NUMSTATES; i++)
+            L::store(new_metrics + i * lanes,
+                    L::sub(L::load(new_metrics + i * lanes), min));
+
+        std::swap(old_metrics, new_metrics);
+    }
+}
+
+//  chainback_viterbi for one lane, with the terminal state 0
+void ViterbiBatch::chainback(int lane, uint8_t *packed)
+{
+    uint32_t endstate = 0;
+
+    const uint8_t *d = &decisions[(K - 1) * NUMSTATES];
+    int32_t nbits = frameBits;
+    while (nbits-- != 0) {
+        const int k = (d[nbits * NUMSTATES + (endstate >> ADDSHIFT)] >> lane) & 1;
+        endstate = (endstate >> 1) | (k << (K - 2 + ADDSHIFT));
+        packed[nbits >> 3] = endstate >> SUBSHIFT;
+    }
+}
+
 /* Viterbi chainback */
 void Viterbi::chainback_viterbi(
         struct v *vp,
@@ -5,6 +5,7 @@
  */
 #include    "dab-constants.h"
 #include    "MathHelper.h"
+#include    <vector>
 
 //  For our particular viterbi decoder, we have
 #define RATE    4
@@ -43,8 +44,12 @@ class Viterbi
         Viterbi(const Viterbi& other) = delete;
         Viterbi& operator=(const Viterbi& other) = delete;
         void deconvolve(softbit_t *input, uint8_t *output);
+        // As deconvolve, but the output holds 8 bits per byte, MSB first.
+        // The output has to hold wordlength / 8 bytes.
+        void deconvolvePacked(softbit_t *input, uint8_t *output);
 
     private:
+        void decode(softbit_t *input, uint8_t *packed);
         struct v    vp;
         COMPUTETYPE Branchtab   [NUMSTATES / 2 * RATE] __attribute__ ((aligned (16)));
         //  int parityb     (uint8_t);
@@ -53,6 +58,12 @@ class Viterbi
         //  uint8_t Partab  [256];
         void init_viterbi(struct v *, int16_t starting_state);
 
+        typedef void (*UpdateFunction)(struct v *vp,
+                                       const COMPUTETYPE *branchtab,
+                                       const COMPUTETYPE *syms,
+                                       int16_t nbits);
+        static UpdateFunction selectUpdateFunction(void);
+
         void update_viterbi_blk_GENERIC( struct v *vp,
                                          COMPUTETYPE *syms,
                                          int16_t nbits);
@@ -69,5 +80,42 @@ class Viterbi
         int16_t frameBits;
 };
 
+/* Decodes up to ViterbiBatch::lanes codewords of the same length at once,
+ * the codewords are in the lanes of one SIMD trellis. The output of each
+ * codeword is bit exact the output of Viterbi::deconvolvePacked.
+ * Useful where several codewords are ready at the same time, like the
+ * FIC codewords of a frame.
+ */
+class ViterbiBatch
+{
+    public:
+        static const int lanes = 8;
+
+        ViterbiBatch(int16_t wordlength);
+        ViterbiBatch(const ViterbiBatch& other) = delete;
+        ViterbiBatch& operator=(const ViterbiBatch& other) = delete;
+
+        /* Decode count <= lanes codewords, inputs[n] holds the
+         * RATE * (wordlength + K - 1) softbits of codeword n, outputs[n]
+         * receives its wordlength bits, packed into wordlength / 8 bytes. */
+        void deconvolve(const softbit_t *const *inputs,
+                uint8_t *const *outputs, int count);
+
+    private:
+        template<class L> void trellis(int32_t nbits);
+        void chainback(int lane, uint8_t *packed);
+
+        int16_t frameBits;
+        // Per state, the codes of the 4 branch bits
+        uint8_t branchCodes[NUMSTATES / 2];
+        // [step][RATE][lane]
+        std::vector<COMPUTETYPE> symbols;
+        // [state][lane], old and new
+        std::vector<COMPUTETYPE> metrics1;
+        std::vector<COMPUTETYPE> metrics2;
+        // [step][state], bit n is the decision of lane n
+        std::vector<uint8_t> decisions;
+};
+
 #endif
 
@@ -0,0 +1,115 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <iostream>
+#include "worker-pool.h"
+#include "various/thread-config.h"
+
+WorkerPool& WorkerPool::shared()
+{
+    // Never destroyed, the decoders may outlive the static objects
+    static WorkerPool *pool = new WorkerPool(
+            std::max(1u, std::thread::hardware_concurrency()));
+    return *pool;
+}
+
+WorkerPool::WorkerPool(unsigned int workers)
+{
+    std::clog << "WorkerPool: " << workers << " decoder threads" << std::endl;
+
+    for (unsigned int i = 0; i < workers; i++) {
+        threads.emplace_back(&WorkerPool::work, this);
+    }
+}
+
+void WorkerPool::schedule(Task& task)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (task.cancelled) {
+        return;
+    }
+
+    switch (task.state) {
+        case Task::State::Idle:
+            task.state = Task::State::Queued;
+            queue.push_back(&task);
+            queueLength.store(queue.size(), std::memory_order_relaxed);
+            taskQueued.notify_one();
+            break;
+        case Task::State::Running:
+            task.state = Task::State::Rerun;
+            break;
+        case Task::State::Queued:
+        case Task::State::Rerun:
+            break;
+    }
+}
+
+void WorkerPool::cancel(Task& task)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    task.cancelled = true;
+    if (task.state == Task::State::Queued) {
+        queue.erase(std::find(queue.begin(), queue.end(), &task));
+        queueLength.store(queue.size(), std::memory_order_relaxed);
+        task.state = Task::State::Idle;
+    }
+
+    taskDone.wait(lock, [&]() { return task.state == Task::State::Idle; });
+}
+
+void WorkerPool::work()
+{
+    threading::ScopedThread threadConfig(ThreadStage::AudioDecoder, "dab-decoder");
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        taskQueued.wait(lock, [&]() { return not queue.empty(); });
+
+        Task *task = queue.front();
+        queue.pop_front();
+        queueLength.store(queue.size(), std::memory_order_relaxed);
+        task->state = Task::State::Running;
+
+        lock.unlock();
+        task->runTask();
+        lock.lock();
+
+        if (task->state == Task::State::Rerun and not task->cancelled) {
+            task->state = Task::State::Queued;
+            queue.push_back(task);
+            queueLength.store(queue.size(), std::memory_order_relaxed);
+            taskQueued.notify_one();
+        }
+        else {
+            task->state = Task::State::Idle;
+            taskDone.notify_all();
+        }
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ *  A process wide pool of decoder threads, one per core, shared by the
+ *  decoders of all subchannels. The work is done by tasks: a task is
+ *  scheduled whenever it has new input and then runs on one of the
+ *  workers until that input is consumed. A task never runs on two
+ *  workers at once, so every task sees its input in order.
+ */
+class WorkerPool
+{
+    public:
+        class Task {
+            public:
+                virtual ~Task() = default;
+                // Consume the pending input
+                virtual void runTask(void) = 0;
+
+            private:
+                friend class WorkerPool;
+                enum class State { Idle, Queued, Running, Rerun };
+                State state = State::Idle;
+                bool cancelled = false;
+        };
+
+        static WorkerPool& shared(void);
+
+        // Run the task on a worker. If it is running already, it is
+        // run once more after it returns.
+        void schedule(Task& task);
+
+        // Remove the task from the pool, waits until it has returned
+        // if it is running. The task is not scheduled again.
+        void cancel(Task& task);
+
+        // Tasks waiting for a worker, without taking the lock
+        size_t queuedTasks(void) const {
+            return queueLength.load(std::memory_order_relaxed); }
+
+    private:
+        WorkerPool(unsigned int workers);
+        void work(void);
+
+        std::mutex mutex;
+        std::condition_variable taskQueued;
+        std::condition_variable taskDone;
+        std::deque<Task*> queue;
+        std::atomic<size_t> queueLength = ATOMIC_VAR_INIT(0);
+        std::vector<std::thread> threads;
+};
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,745 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* dabd, the receiver as a native daemon: it owns one device, tunes it,
+ * decodes any number of services of the channel and serves their audio
+ * over HTTP, without a Python interpreter in the process. It is
+ * controlled by one line commands on a Unix socket, each answered by one
+ * line of JSON:
+ *
+ *   scan                   channels with a DAB signal, while not tuned
+ *   tune <channel>         receive the channel, e.g. 5C
+ *   stop                   stop receiving
+ *   services               the ensemble and its services
+ *   subscribe <sid>        decode a service, its audio is served at
+ *                          http://<host>:<port>/<channel>/<sid>
+ *   unsubscribe <sid>
+ *   label <sid>            the dynamic label of a subscribed service
+ *   stats                  receiver and input statistics
+ *   quit                   terminate the daemon
+ *
+ * The sids are in hex, as in the ensemble, e.g. d210. With --eti, the
+ * whole ensemble of the tuned channel is served as ETI(NI) stream at
+ * http://<host>:<port>/<channel>/eti, e.g. for dablin on another host.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "backend/channel-probe.h"
+#include "backend/dabplus_decoder.h"
+#include "backend/radio-receiver.h"
+#include "input/input_factory.h"
+#include "various/channels.h"
+#include "various/http-stream-server.h"
+#include "various/locked-memory.h"
+#include "various/wav-header.h"
+
+using namespace std::chrono;
+
+static std::atomic<bool> terminating = ATOMIC_VAR_INIT(false);
+
+static void onSignal(int)
+{
+    terminating = true;
+}
+
+static std::string jsonString(const std::string& s)
+{
+    std::string out = "\"";
+    for (const char c : s) {
+        if (c == '"' or c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+            out += escaped;
+        }
+        else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static std::string error(const std::string& reason)
+{
+    return "{\"ok\":false,\"error\":" + jsonString(reason) + "}";
+}
+
+static std::string sidString(uint32_t sId)
+{
+    char sid[16];
+    snprintf(sid, sizeof(sid), "%x", sId);
+    return sid;
+}
+
+// Sends the audio of a service to the clients of its HTTP stream
+class ServiceStream : public ProgrammeHandlerInterface {
+    public:
+        explicit ServiceStream(std::shared_ptr<HttpStreamServer::Stream> stream) :
+            stream(std::move(stream)) {}
+
+        void onFrameErrors(int) override {}
+        void onRsErrors(bool, int) override {}
+        void onAacErrors(int) override {}
+        void onMOT(mot_file_t&&) override {}
+        void onPADLengthError(size_t, size_t) override {}
+
+        void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string&) override
+        {
+            if (sampleRate != headerRate) {
+                stream->setHeader(wavHeader(sampleRate, false));
+                headerRate = sampleRate;
+            }
+
+            // The chunk keeps the samples until all clients sent them
+            auto samples = std::make_shared<std::vector<int16_t>>(std::move(audioData));
+            HttpStreamServer::Chunk chunk;
+            chunk.data = reinterpret_cast<const uint8_t*>(samples->data());
+            chunk.size = samples->size() * sizeof(int16_t);
+            chunk.duration = milliseconds(sampleRate ? samples->size() / 2 * 1000 / sampleRate : 0);
+            chunk.owner = std::move(samples);
+            stream->push(std::move(chunk));
+        }
+
+        void ProcessUntouchedStream(const uint8_t *data, size_t len, size_t duration_ms) override
+        {
+            auto frame = std::make_shared<std::vector<uint8_t>>(data, data + len);
+            HttpStreamServer::Chunk chunk;
+            chunk.data = frame->data();
+            chunk.size = frame->size();
+            chunk.duration = milliseconds(duration_ms);
+            chunk.owner = std::move(frame);
+            stream->push(std::move(chunk));
+        }
+
+        void onNewDynamicLabel(const std::string& newLabel) override
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            label = newLabel;
+        }
+
+        std::string getLabel(void)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return label;
+        }
+
+        const std::shared_ptr<HttpStreamServer::Stream> stream;
+
+    private:
+        int headerRate = 0; // decoder thread only
+        std::mutex mutex;
+        std::string label;
+};
+
+class Daemon : public RadioControllerInterface {
+    public:
+        struct Options {
+            std::string device = "auto";
+            int gain = -1;
+            bool decodeAudio = true;
+            int httpPort = 8864;
+            std::string controlSocket = "/run/dabd/control";
+            bool eti = false;
+            UsbTransferConfig usbTransfers;
+            bool usbZeroCopy = false;
+            RadioReceiverOptions rro;
+        };
+
+        explicit Daemon(const Options& options) :
+            options(options),
+            streams(options.httpPort, [](const std::string&) {}) {}
+
+        ~Daemon()
+        {
+            stopReceiver();
+            streams.stop();
+            if (listenFd != -1) {
+                ::close(listenFd);
+                unlink(options.controlSocket.c_str());
+            }
+        }
+
+        bool start(void);
+        void run(void);
+
+        // RadioControllerInterface
+        void onSNR(float) override {}
+        void onFrequencyCorrectorChange(int, int) override {}
+        void onSyncChange(char isSync) override { synced = isSync; }
+        void onSignalPresence(bool) override {}
+        void onServiceDetected(uint32_t) override {}
+        void onNewEnsemble(uint16_t) override {}
+        void onSetEnsembleLabel(DabLabel&) override {}
+        void onDateTimeUpdate(const dab_date_time_t&) override {}
+        void onFIBDecodeSuccess(bool, const uint8_t*) override {}
+        void onNewImpulseResponse(std::vector<float>&&) override {}
+        void onConstellationPoints(std::vector<DSPCOMPLEX>&&) override {}
+        void onNewNullSymbol(std::vector<DSPCOMPLEX>&&) override {}
+        void onTIIMeasurement(tii_measurement_t&&) override {}
+
+        void onMessage(message_level_t level, const std::string& text, const std::string& text2) override
+        {
+            (level == message_level_t::Error ? std::cerr : std::clog) <<
+                "dabd: " << text << text2 << std::endl;
+        }
+
+        void onInputFailure(void) override
+        {
+            inputFailed = true;
+        }
+
+        diagnostics_request_t getDiagnosticsRequest(void) override
+        {
+            diagnostics_request_t request;
+            request.impulseResponse = false;
+            request.constellation = false;
+            request.nullSymbol = false;
+            return request;
+        }
+
+    private:
+        std::string execute(const std::string& command);
+        std::string scan(void);
+        std::string tune(const std::string& channel);
+        std::string listServices(void);
+        std::string subscribe(uint32_t sId);
+        std::string unsubscribe(uint32_t sId);
+        std::string label(uint32_t sId);
+        std::string stats(void);
+        std::string record(const std::string& fileName);
+        void stopReceiver(void);
+
+        const Options options;
+        std::unique_ptr<CVirtualInput> device;
+        std::unique_ptr<RadioReceiver> rx;
+        std::string channel;
+        std::map<uint32_t, std::unique_ptr<ServiceStream>> services;
+        HttpStreamServer streams;
+        std::shared_ptr<HttpStreamServer::Stream> etiStream;
+
+        std::atomic<bool> synced = ATOMIC_VAR_INIT(false);
+        std::atomic<bool> inputFailed = ATOMIC_VAR_INIT(false);
+
+        int listenFd = -1;
+        struct Client {
+            int fd;
+            std::string received;
+        };
+        std::vector<Client> clients;
+};
+
+bool Daemon::start()
+{
+    device.reset(CInputFactory::GetDevice(*this, options.device));
+    if (not device or device->getID() == CDeviceID::NULLDEVICE) {
+        std::cerr << "dabd: no device " << options.device << std::endl;
+        return false;
+    }
+    if (options.gain == -1) {
+        device->setAgc(true);
+    }
+    else {
+        device->setGain(options.gain);
+    }
+    if (not device->setUsbTransfers(options.usbTransfers, options.usbZeroCopy)) {
+        std::cerr << "dabd: " << options.device << " does not take the USB transfer settings" << std::endl;
+    }
+
+    if (not streams.start()) {
+        std::cerr << "dabd: cannot serve the audio on port " << options.httpPort << std::endl;
+        return false;
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (options.controlSocket.size() >= sizeof(address.sun_path)) {
+        std::cerr << "dabd: control socket path too long" << std::endl;
+        return false;
+    }
+    strncpy(address.sun_path, options.controlSocket.c_str(), sizeof(address.sun_path) - 1);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(options.controlSocket.c_str());
+    if (listenFd == -1 or
+            bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 or
+            listen(listenFd, 4) == -1) {
+        std::cerr << "dabd: cannot listen on " << options.controlSocket << ": " <<
+            strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::clog << "dabd: " << device->getDescription() << ", control " << options.controlSocket <<
+        ", audio on port " << options.httpPort << std::endl;
+    return true;
+}
+
+void Daemon::run()
+{
+    while (not terminating) {
+        std::vector<pollfd> fds;
+        fds.push_back(pollfd{listenFd, POLLIN, 0});
+        for (const auto& client : clients) {
+            fds.push_back(pollfd{client.fd, POLLIN, 0});
+        }
+
+        // The timeout is for noticing the signals and the input failures
+        if (poll(fds.data(), fds.size(), 500) < 0 and errno != EINTR) {
+            std::cerr << "dabd: poll failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        if (inputFailed.exchange(false) and rx) {
+            std::cerr << "dabd: input failed, stopped receiving " << channel << std::endl;
+            stopReceiver();
+        }
+        if (rx) {
+            rx->expireStandbyServices();
+        }
+
+        for (size_t i = fds.size() - 1; i > 0; i--) {
+            if (not (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            Client& client = clients[i - 1];
+            char buffer[1024];
+            const ssize_t received = read(client.fd, buffer, sizeof(buffer));
+            if (received > 0) {
+                client.received.append(buffer, received);
+            }
+
+            bool failed = false;
+            size_t newline;
+            while (not failed and (newline = client.received.find('\n')) != std::string::npos) {
+                std::string command = client.received.substr(0, newline);
+                client.received.erase(0, newline + 1);
+                if (not command.empty() and command.back() == '\r') {
+                    command.pop_back();
+                }
+                const std::string response = execute(command) + "\n";
+                failed = write(client.fd, response.data(), response.size()) < 0;
+            }
+
+            if (received <= 0 or failed or client.received.size() > 4096) {
+                ::close(client.fd);
+                clients.erase(clients.begin() + (i - 1));
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            const int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd != -1) {
+                clients.push_back(Client{fd, ""});
+            }
+        }
+    }
+
+    for (const auto& client : clients) {
+        ::close(client.fd);
+    }
+    clients.clear();
+}
+
+std::string Daemon::execute(const std::string& command)
+{
+    std::istringstream words(command);
+    std::string verb, argument;
+    words >> verb >> argument;
+
+    if (verb == "scan") {
+        return scan();
+    }
+    else if (verb == "tune" and not argument.empty()) {
+        return tune(argument);
+    }
+    else if (verb == "stop") {
+        stopReceiver();
+        return "{\"ok\":true}";
+    }
+    else if (verb == "services") {
+        return listServices();
+    }
+    else if (verb == "stats") {
+        return stats();
+    }
+    else if (verb == "record" and not argument.empty()) {
+        return record(argument);
+    }
+    else if (verb == "quit") {
+        terminating = true;
+        return "{\"ok\":true}";
+    }
+    else if ((verb == "subscribe" or verb == "unsubscribe" or verb == "label") and not argument.empty()) {
+        char *end = nullptr;
+        const uint32_t sId = strtoul(argument.c_str(), &end, 16);
+        if (*end != '\0') {
+            return error("invalid service id " + argument);
+        }
+        if (verb == "subscribe") {
+            return subscribe(sId);
+        }
+        return verb == "unsubscribe" ? unsubscribe(sId) : label(sId);
+    }
+    return error("unknown command: " + command);
+}
+
+std::string Daemon::scan()
+{
+    if (rx) {
+        return error("receiving " + channel + ", stop first");
+    }
+
+    // The channels without a null symbol are not worth a receiver
+    Channels channels;
+    DABParams params(1);
+    std::string found;
+    std::string name = channels.getCurrentChannel();
+    for (int i = 0; i < NUMBEROFCHANNELS and not terminating; i++) {
+        device->setFrequency(channels.getFrequency(name));
+        if (device->is_ok()) {
+            device->reset();
+            if (device->restart()) {
+                ChannelProbe probe(*device, params);
+                if (probe.signalPresent(milliseconds(500))) {
+                    found += (found.empty() ? "" : ",") + jsonString(name);
+                }
+                device->stop();
+            }
+        }
+        name = channels.getNextChannel();
+    }
+    return "{\"ok\":true,\"channels\":[" + found + "]}";
+}
+
+std::string Daemon::tune(const std::string& newChannel)
+{
+    Channels channels;
+    int frequency;
+    try {
+        frequency = channels.getFrequency(newChannel);
+    }
+    catch (const std::out_of_range&) {
+        return error("unknown channel " + newChannel);
+    }
+
+    stopReceiver();
+    device->setFrequency(frequency);
+    if (not device->is_ok()) {
+        return error("the device cannot receive " + newChannel);
+    }
+    device->reset();
+
+    rx.reset(new RadioReceiver(*this, *device, options.rro, 1, options.decodeAudio));
+    channel = newChannel;
+    inputFailed = false;
+    if (options.eti) {
+        auto stream = streams.addStream("/" + channel + "/eti", "application/octet-stream", false);
+        rx->setEtiOutput([stream](const uint8_t *frame, size_t len) {
+                    auto copy = std::make_shared<std::vector<uint8_t>>(frame, frame + len);
+                    HttpStreamServer::Chunk chunk;
+                    chunk.data = copy->data();
+                    chunk.size = copy->size();
+                    chunk.duration = milliseconds(24);
+                    chunk.owner = std::move(copy);
+                    stream->push(std::move(chunk));
+                }, true);
+        etiStream = std::move(stream);
+    }
+    rx->restart(false);
+    return "{\"ok\":true}";
+}
+
+void Daemon::stopReceiver()
+{
+    if (not rx) {
+        return;
+    }
+
+    rx->stop();
+    device->stop();
+    rx.reset();
+    for (const auto& service : services) {
+        streams.removeStream(service.second->stream->path);
+    }
+    services.clear();
+    if (etiStream) {
+        streams.removeStream(etiStream->path);
+        etiStream.reset();
+    }
+    channel.clear();
+    synced = false;
+}
+
+std::string Daemon::listServices()
+{
+    if (not rx) {
+        return error("not tuned");
+    }
+
+    std::string list;
+    for (const auto& s : rx->getServiceList()) {
+        list += list.empty() ? "" : ",";
+        list += "{\"sid\":" + jsonString(sidString(s.serviceId)) +
+            ",\"name\":" + jsonString(s.serviceLabel.utf8_label()) +
+            ",\"audio\":" + (rx->serviceHasAudioComponent(s) ? "true" : "false") +
+            ",\"subscribed\":" + (services.count(s.serviceId) ? "true" : "false") + "}";
+    }
+
+    return "{\"ok\":true,\"channel\":" + jsonString(channel) +
+        ",\"ensemble\":" + jsonString(rx->getEnsembleLabel().utf8_label()) +
+        ",\"synced\":" + (synced ? "true" : "false") +
+        ",\"services\":[" + list + "]}";
+}
+
+std::string Daemon::subscribe(uint32_t sId)
+{
+    if (not rx) {
+        return error("not tuned");
+    }
+
+    const std::string path = "/" + channel + "/" + sidString(sId);
+    if (services.count(sId) == 0) {
+        const Service service = rx->getService(sId);
+        if (service.serviceId == 0 or not rx->serviceHasAudioComponent(service)) {
+            return error("no audio service " + sidString(sId) + " in " + channel);
+        }
+
+        auto stream = streams.addStream(path,
+                options.decodeAudio ? "audio/wav" : "audio/aac", options.decodeAudio);
+        auto handler = std::make_unique<ServiceStream>(stream);
+        if (not rx->addServiceToDecode(*handler, "", service)) {
+            streams.removeStream(path);
+            return error("cannot decode " + sidString(sId));
+        }
+        services[sId] = std::move(handler);
+    }
+
+    return "{\"ok\":true,\"path\":" + jsonString(path) +
+        ",\"port\":" + std::to_string(streams.getPort()) + "}";
+}
+
+std::string Daemon::unsubscribe(uint32_t sId)
+{
+    auto it = services.find(sId);
+    if (not rx or it == services.end()) {
+        return error("not subscribed to " + sidString(sId));
+    }
+
+    // The decoder does not call the handler anymore once this returns
+    rx->removeServiceToDecode(rx->getService(sId));
+    streams.removeStream(it->second->stream->path);
+    services.erase(it);
+    return "{\"ok\":true}";
+}
+
+std::string Daemon::label(uint32_t sId)
+{
+    auto it = services.find(sId);
+    if (it == services.end()) {
+        return error("not subscribed to " + sidString(sId));
+    }
+    return "{\"ok\":true,\"label\":" + jsonString(it->second->getLabel()) + "}";
+}
+
+// The raw samples of the device, until "record stop"
+std::string Daemon::record(const std::string& fileName)
+{
+    if (fileName == "stop") {
+        device->stopRecording();
+        return "{\"ok\":true}";
+    }
+    if (not device->startRecording(fileName)) {
+        return error("cannot record to " + fileName);
+    }
+    return "{\"ok\":true}";
+}
+
+std::string Daemon::stats()
+{
+    const InputStats input = device->getInputStats();
+    std::ostringstream out;
+    out << "{\"ok\":true,\"input\":{\"buffered_samples\":" << input.bufferedSamples <<
+        ",\"dropped_samples\":" << input.droppedSamples <<
+        ",\"overruns\":" << input.overruns <<
+        ",\"locked_bytes\":" << lockedmemory::getStats().lockedBytes <<
+        ",\"unlocked_bytes\":" << lockedmemory::getStats().unlockedBytes;
+    if (device->isRecording()) {
+        const IQRecorder::Stats recording = device->getRecordingStats();
+        out << ",\"recorded_bytes\":" << recording.writtenBytes <<
+            ",\"recording_dropped_bytes\":" << recording.droppedBytes <<
+            ",\"recording_failed\":" << (recording.failed ? "true" : "false");
+    }
+    out << "}";
+    if (rx) {
+        const RadioReceiverStats s = rx->getReceiverStats();
+        out << ",\"channel\":" << jsonString(channel) <<
+            ",\"synced\":" << (s.synced ? "true" : "false") <<
+            ",\"snr\":" << s.snr <<
+            ",\"fic_decode_ratio\":" << s.ficDecodeRatioPercent / 100.0 <<
+            ",\"frames_processed\":" << s.framesProcessed <<
+            ",\"frames_idle\":" << s.framesIdle <<
+            ",\"frames_dropped\":" << s.framesDropped <<
+            ",\"decode_load\":" << s.decodeLoad <<
+            ",\"dropped_fragments\":" << s.droppedFragments;
+        if (options.eti) {
+            out << ",\"eti_frames\":" << s.etiFrames <<
+                ",\"eti_incomplete_frames\":" << s.etiFramesIncomplete;
+        }
+    }
+    out << "}";
+    return out.str();
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --device <name>         input device, default auto\n"
+            "  --gain <gain>           gain index, default AGC\n"
+            "  --aac                   serve the AAC stream instead of decoding it\n"
+            "  --port <port>           HTTP port of the audio streams, default 8864\n"
+            "  --control <path>        control socket, default /run/dabd/control\n"
+            "  --warm-standby <n>      removed services kept decoding in standby\n"
+            "  --stream-symbols        demodulate every symbol as soon as it is received\n"
+            "  --load-governor         give up optional processing under load\n"
+            "  --idle-fic-interval <n> demodulate every nth frame while nothing is played\n"
+            "  --eti                   serve the ensemble as ETI stream at /<channel>/eti\n"
+            "  --packed-softbits       keep the softbits of the subchannels in 4 bits\n"
+            "  --aac-decoder <name>    auto, faad2 or fdk-aac\n"
+            "  --usb-transfers <spec>  default, low-latency, robust or <count>x<bytes>\n"
+            "  --usb-zero-copy         receive the USB transfers into the sample buffer\n"
+            "  --lock-memory <mode>    off, lock or hugepages, for the real-time buffers\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    Daemon::Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool haveValue = i + 1 < argc;
+        if (arg == "--device" and haveValue) {
+            options.device = argv[++i];
+        }
+        else if (arg == "--gain" and haveValue) {
+            options.gain = atoi(argv[++i]);
+        }
+        else if (arg == "--aac") {
+            options.decodeAudio = false;
+        }
+        else if (arg == "--port" and haveValue) {
+            options.httpPort = atoi(argv[++i]);
+        }
+        else if (arg == "--control" and haveValue) {
+            options.controlSocket = argv[++i];
+        }
+        else if (arg == "--warm-standby" and haveValue) {
+            options.rro.warmStandbyServices = atoi(argv[++i]);
+        }
+        else if (arg == "--stream-symbols") {
+            options.rro.streamSymbols = true;
+        }
+        else if (arg == "--load-governor") {
+            options.rro.loadGovernor = true;
+        }
+        else if (arg == "--idle-fic-interval" and haveValue) {
+            options.rro.idleFicInterval = atoi(argv[++i]);
+        }
+        else if (arg == "--eti") {
+            options.eti = true;
+        }
+        else if (arg == "--packed-softbits") {
+            options.rro.packedSoftbits = true;
+        }
+        else if (arg == "--usb-transfers" and haveValue) {
+            try {
+                options.usbTransfers = UsbTransferConfig::fromString(argv[++i]);
+            }
+            catch (const std::invalid_argument&) {
+                usage(argv[0]);
+                return 2;
+            }
+        }
+        else if (arg == "--usb-zero-copy") {
+            options.usbZeroCopy = true;
+        }
+        else if (arg == "--aac-decoder" and haveValue) {
+            try {
+                options.rro.aacBackend = AACDecoder::BackendFromString(argv[++i]);
+            }
+            catch (const std::invalid_argument&) {
+                usage(argv[0]);
+                return 2;
+            }
+        }
+        else if (arg == "--lock-memory" and haveValue) {
+            try {
+                lockedmemory::configure(lockedmemory::modeFromString(argv[++i]));
+            }
+            catch (const std::invalid_argument&) {
+                usage(argv[0]);
+                return 2;
+            }
+        }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    struct sigaction action{};
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    Daemon daemon(options);
+    if (not daemon.start()) {
+        return 1;
+    }
+    daemon.run();
+    return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "eti_source.h"
+
+// Timeouts for connecting, in s, and for a single recv(), in ms. The
+// server sends a frame every 24 ms.
+static const int CONNECT_TIMEOUT_S = 5;
+static const int RECV_TIMEOUT_MS = 1000;
+
+// ERR, then FSYNC, which alternates between the frames
+bool CEtiSource::isFrameStart(const uint8_t *p)
+{
+    const uint32_t fsync = (p[1] << 16) | (p[2] << 8) | p[3];
+    return fsync == 0x073AB6 or fsync == 0xF8C549;
+}
+
+bool CEtiSource::readFrame(uint8_t *frame)
+{
+    if (not read(frame, frameSize)) {
+        return false;
+    }
+
+    while (not isFrameStart(frame)) {
+        syncLosses++;
+
+        // Move the next candidate to the start, and fill up the frame
+        size_t offset = 1;
+        while (offset + 4 <= frameSize and not isFrameStart(frame + offset)) {
+            offset++;
+        }
+        if (offset + 4 > frameSize) {
+            // A sync may start in the last three bytes
+            offset = frameSize - 3;
+        }
+        memmove(frame, frame + offset, frameSize - offset);
+        if (not read(frame + frameSize - offset, offset)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+CEtiSource* CEtiSource::fromArgs(const std::string& args)
+{
+    const std::string tcp = "tcp://";
+    const std::string http = "http://";
+    if (args.compare(0, tcp.size(), tcp) == 0 or args.compare(0, http.size(), http) == 0) {
+        const bool isHttp = args.compare(0, http.size(), http) == 0;
+        const std::string address = args.substr(isHttp ? http.size() : tcp.size());
+        const size_t slash = address.find('/');
+        const std::string hostPort = address.substr(0, slash);
+        const size_t colon = hostPort.rfind(':');
+        if (colon == std::string::npos) {
+            throw std::runtime_error("ETI: no port in " + args);
+        }
+        const std::string path = slash == std::string::npos ? "/" : address.substr(slash);
+        return new CEtiTcpClient(hostPort.substr(0, colon), std::stoi(hostPort.substr(colon + 1)),
+                isHttp ? path : "");
+    }
+
+    const size_t comma = args.find(',');
+    const std::string fileName = args.substr(0, comma);
+    bool realTime = true;
+    if (comma != std::string::npos) {
+        const std::string option = args.substr(comma + 1);
+        if (option == "fast")
+            realTime = false;
+        else if (option != "realtime")
+            throw std::runtime_error("ETI: unknown option \"" + option + "\"");
+    }
+    return new CEtiFile(fileName, realTime);
+}
+
+CEtiFile::CEtiFile(const std::string& fileName, bool realTime) :
+    fileName(fileName),
+    realTime(realTime)
+{
+    fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("ETI: cannot open " + fileName + ": " + strerror(errno));
+    }
+    std::clog << "ETI: replaying " << fileName << ", " <<
+        (realTime ? "real-time" : "as fast as possible") << std::endl;
+}
+
+CEtiFile::~CEtiFile()
+{
+    if (fd != -1) {
+        ::close(fd);
+    }
+}
+
+void CEtiFile::reset()
+{
+    lseek(fd, 0, SEEK_SET);
+    started = false;
+}
+
+std::string CEtiFile::getDescription()
+{
+    return "ETI file " + fileName;
+}
+
+bool CEtiFile::read(uint8_t *buffer, size_t len)
+{
+    if (realTime) {
+        const auto now = std::chrono::steady_clock::now();
+        if (not started) {
+            nextFrame = now;
+            started = true;
+        }
+        // Pace the reads of whole frames, the resync reads are short
+        if (len == frameSize) {
+            std::this_thread::sleep_until(nextFrame);
+            nextFrame += std::chrono::milliseconds(24);
+        }
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        const ssize_t ret = ::read(fd, buffer + done, len - done);
+        if (ret < 0 and errno == EINTR) {
+            continue;
+        }
+        else if (ret <= 0) {
+            return false;
+        }
+        done += ret;
+    }
+    return true;
+}
+
+CEtiTcpClient::CEtiTcpClient(const std::string& host, int port, const std::string& httpPath) :
+    host(host),
+    port(port),
+    httpPath(httpPath)
+{
+}
+
+void CEtiTcpClient::reset()
+{
+    // Join the stream again, instead of continuing where it stopped
+    sock.close();
+}
+
+std::string CEtiTcpClient::getDescription()
+{
+    return "ETI from " + host + ":" + std::to_string(port) + httpPath;
+}
+
+bool CEtiTcpClient::open_connection()
+{
+    std::clog << "ETI: connect to " << host << ":" << port << httpPath << std::endl;
+
+    if (not sock.connect(host, port, CONNECT_TIMEOUT_S)) {
+        std::clog << "ETI: cannot connect to " << host << ":" << port << std::endl;
+        return false;
+    }
+    sock.setReceiveTimeout(RECV_TIMEOUT_MS);
+
+    if (httpPath.empty()) {
+        return true;
+    }
+
+    const std::string request = "GET " + httpPath + " HTTP/1.0\r\nHost: " + host + "\r\n\r\n";
+    if (sock.send(request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size()) {
+        sock.close();
+        return false;
+    }
+
+    // The frames follow the header right away, read it byte by byte
+    std::string header;
+    while (header.size() < 4096 and
+            (header.size() < 4 or header.compare(header.size() - 4, 4, "\r\n\r\n") != 0)) {
+        char c;
+        if (sock.recv(&c, 1, 0) != 1) {
+            sock.close();
+            return false;
+        }
+        header += c;
+    }
+
+    if (header.compare(0, 9, "HTTP/1.0 ") != 0 and header.compare(0, 9, "HTTP/1.1 ") != 0) {
+        std::clog << "ETI: " << host << " is not an HTTP server" << std::endl;
+        sock.close();
+        return false;
+    }
+    if (header.compare(9, 3, "200") != 0) {
+        std::clog << "ETI: " << host << httpPath << ": " << header.substr(9, header.find('\r') - 9) << std::endl;
+        sock.close();
+        return false;
+    }
+    return true;
+}
+
+bool CEtiTcpClient::read(uint8_t *buffer, size_t len)
+{
+    if (not sock.valid() and not open_connection()) {
+        return false;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        const ssize_t ret = sock.recv(buffer + done, len - done, 0);
+        if (ret < 0 and errno == EINTR) {
+            continue;
+        }
+        else if (ret <= 0) {
+            // Also after RECV_TIMEOUT_MS without data
+            std::clog << "ETI: connection to " << host << " lost" << std::endl;
+            sock.close();
+            return false;
+        }
+        done += ret;
+    }
+    return true;
+}
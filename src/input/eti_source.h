@@ -0,0 +1,117 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef ETI_SOURCE_H
+#define ETI_SOURCE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "Socket.h"
+
+// A source of ETI(NI) frames, ETSI EN 300 799, read by the
+// EtiDemultiplexer instead of demodulating I/Q samples. The frames are
+// the raw ones of 6144 bytes, as sent by the EtiMultiplexer, dabd --eti
+// and the raw output of ODR-DabMux. Unlike a CVirtualInput, the source
+// is not tuned, it carries one ensemble.
+class CEtiSource {
+public:
+    static const size_t frameSize = 6144;
+
+    virtual ~CEtiSource(void) {}
+
+    // Blocks for the next frame, and searches the frame sync if the
+    // stream is not aligned to it. Returns false at the end of the
+    // input, or when it failed.
+    bool readFrame(uint8_t *frame);
+
+    // Start again, from the beginning of a file
+    virtual void reset(void) {}
+    virtual std::string getDescription(void) = 0;
+
+    // The times the frame sync had to be searched
+    uint64_t getSyncLosses(void) const { return syncLosses; }
+
+    // Parse "<file>[,realtime|fast]", "tcp://<host>:<port>" or
+    // "http://<host>:<port>/<path>", the latter e.g. for dabd --eti
+    static CEtiSource* fromArgs(const std::string& args);
+
+protected:
+    // Blocks for exactly len bytes
+    virtual bool read(uint8_t *buffer, size_t len) = 0;
+
+private:
+    static bool isFrameStart(const uint8_t *p);
+    std::atomic<uint64_t> syncLosses = ATOMIC_VAR_INIT(0);
+};
+
+// Replays a recorded ETI file, one frame every 24 ms in real-time mode,
+// otherwise as fast as the receiver takes them.
+class CEtiFile : public CEtiSource {
+public:
+    CEtiFile(const std::string& fileName, bool realTime = true);
+    ~CEtiFile(void);
+    CEtiFile(const CEtiFile&) = delete;
+    void operator=(const CEtiFile&) = delete;
+
+    void reset(void) override;
+    std::string getDescription(void) override;
+
+protected:
+    bool read(uint8_t *buffer, size_t len) override;
+
+private:
+    const std::string fileName;
+    const bool realTime;
+    int fd = -1;
+    bool started = false;
+    std::chrono::steady_clock::time_point nextFrame;
+};
+
+// Receives the ETI from a TCP server, with httpPath from an HTTP stream
+// server. Connects again on the next read after the connection failed.
+class CEtiTcpClient : public CEtiSource {
+public:
+    CEtiTcpClient(const std::string& host, int port, const std::string& httpPath = "");
+    CEtiTcpClient(const CEtiTcpClient&) = delete;
+    void operator=(const CEtiTcpClient&) = delete;
+
+    void reset(void) override;
+    std::string getDescription(void) override;
+
+protected:
+    bool read(uint8_t *buffer, size_t len) override;
+
+private:
+    bool open_connection(void);
+
+    const std::string host;
+    const int port;
+    const std::string httpPath;
+    Socket sock;
+};
+
+#endif // ETI_SOURCE_H
@@ -30,6 +30,9 @@
 
 #include "input_factory.h"
 #include "null_device.h"
+#include "raw_file.h"
+#include "rtl_tcp.h"
+#include "wideband_frontend.h"
 
 #ifdef HAVE_RTLSDR
 #include "rtl_sdr.h"
@@ -71,6 +74,7 @@ CVirtualInput *CInputFactory::GetDevice(RadioControllerInterface &radioControlle
 #ifdef HAVE_RTLSDR
         case CDeviceID::RTL_SDR: InputDevice = new CRTL_SDR(radioController); break;
 #endif
+        case CDeviceID::RTL_TCP: InputDevice = new CRTL_TCP_Client(radioController, "localhost", 1234); break;
         case CDeviceID::NULLDEVICE: InputDevice = new CNullDevice(); break;
         default: throw std::runtime_error("unknown device ID " + std::string(__FILE__) +":"+ std::to_string(__LINE__));
         }
@@ -90,6 +94,19 @@ CVirtualInput *CInputFactory::GetDevice(RadioControllerInterface &radioControlle
     return InputDevice;
 }
 
+std::vector<std::string> CInputFactory::GetDeviceNames()
+{
+    std::vector<std::string> names;
+
+#ifdef HAVE_RTLSDR
+    for (const auto& id : CRTL_SDR::getDeviceIds()) {
+        names.push_back("rtl_sdr:" + id);
+    }
+#endif
+
+    return names;
+}
+
 CVirtualInput* CInputFactory::GetAutoDevice(RadioControllerInterface& radioController)
 {
     (void)radioController;
@@ -121,15 +138,35 @@ CVirtualInput* CInputFactory::GetManualDevice(RadioControllerInterface& radioCon
 {
     CVirtualInput *InputDevice = nullptr;
 
+    const std::string rawFilePrefix = "rawfile:";
+    const std::string rtlTcpPrefix = "rtl_tcp:";
+    const std::string rtlSdrPrefix = "rtl_sdr:";
+    const std::string widebandPrefix = "wideband:";
+
     try {
+        if (device.compare(0, rawFilePrefix.size(), rawFilePrefix) == 0)
+            InputDevice = CRAWFile::fromDeviceArgs(radioController, device.substr(rawFilePrefix.size()));
+        else if (device.compare(0, rtlTcpPrefix.size(), rtlTcpPrefix) == 0)
+            InputDevice = CRTL_TCP_Client::fromDeviceArgs(radioController, device.substr(rtlTcpPrefix.size()));
+        else if (device == "rtl_tcp")
+            InputDevice = new CRTL_TCP_Client(radioController, "localhost", 1234);
+        else if (device.compare(0, widebandPrefix.size(), widebandPrefix) == 0)
+            InputDevice = CChannelInput::fromDeviceArgs(radioController, device.substr(widebandPrefix.size()));
+        else
 #ifdef HAVE_RTLSDR
         if (device == "rtl_sdr")
             InputDevice = new CRTL_SDR(radioController);
+        else if (device.compare(0, rtlSdrPrefix.size(), rtlSdrPrefix) == 0)
+            InputDevice = new CRTL_SDR(radioController, device.substr(rtlSdrPrefix.size()));
         else
 #endif
             std::clog << "InputFactory:"
                 "Unknown device \"" << device << "\"." << std::endl;
     }
+    catch (const std::exception& e) {
+        std::clog << "InputFactory:"
+            "Error while opening device \"" << device << "\": " << e.what() << std::endl;
+    }
     catch (...) {
         std::clog << "InputFactory:"
             "Error while opening device \"" << device << "\"." << std::endl;
@@ -30,6 +30,7 @@
 #define CINPUTFACTORY_H
 
 #include <string>
+#include <vector>
 
 #include "virtual_input.h"
 #include "radio-controller.h"
@@ -40,6 +41,9 @@ public:
     static CVirtualInput* GetDevice(RadioControllerInterface& radioController, const std::string& Device);
     static CVirtualInput* GetDevice(RadioControllerInterface& radioController, const CDeviceID deviceId);
 
+    // Names of all connected devices, to be used with GetDevice()
+    static std::vector<std::string> GetDeviceNames(void);
+
 private:
     static CVirtualInput* GetAutoDevice(RadioControllerInterface& radioController);
     static CVirtualInput* GetManualDevice(RadioControllerInterface& radioController, const std::string& Device);
@@ -0,0 +1,178 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "iq_recorder.h"
+#include "thread-config.h"
+
+// O_DIRECT wants the buffer, the offset and the size aligned to the blocks
+// of the device, 4096 covers all of them
+static constexpr size_t directAlignment = 4096;
+
+static uint32_t ringSize(size_t bytes)
+{
+    uint32_t size = directAlignment;
+    while (size < bytes and size < (1u << 31)) {
+        size *= 2;
+    }
+    return size;
+}
+
+IQRecorder::IQRecorder(const std::string& fileName, const Options& options) :
+    fileName(fileName),
+    blockBytes(std::max(directAlignment, options.blockBytes / directAlignment * directAlignment)),
+    directIO(options.directIO),
+    ring(ringSize(std::max(options.bufferBytes, 2 * blockBytes)))
+{
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    if (directIO) {
+        fd = ::open(fileName.c_str(), flags | O_DIRECT, 0644);
+        if (fd == -1 and errno == EINVAL) {
+            std::clog << "IQRecorder: " << fileName << " does not support O_DIRECT, writing through the page cache" << std::endl;
+        }
+    }
+    if (fd == -1) {
+        directIO = false;
+        fd = ::open(fileName.c_str(), flags, 0644);
+    }
+    if (fd == -1) {
+        throw std::runtime_error("IQRecorder: cannot create " + fileName + ": " + strerror(errno));
+    }
+
+    if (posix_memalign(reinterpret_cast<void**>(&block), directAlignment, blockBytes) != 0) {
+        ::close(fd);
+        throw std::runtime_error("IQRecorder: cannot allocate the write buffer");
+    }
+
+    thread = std::thread(&IQRecorder::run, this);
+}
+
+IQRecorder::~IQRecorder()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    dataAvailable.notify_one();
+    thread.join();
+
+    free(block);
+    ::close(fd);
+}
+
+void IQRecorder::write(const uint8_t *data, uint32_t size)
+{
+    if (failed.load(std::memory_order_relaxed)) {
+        droppedBytes.fetch_add(size, std::memory_order_relaxed);
+        return;
+    }
+
+    const int32_t written = ring.putDataIntoBuffer(data, size);
+    if ((uint32_t)written < size) {
+        droppedBytes.fetch_add(size - written, std::memory_order_relaxed);
+    }
+}
+
+IQRecorder::Stats IQRecorder::getStats()
+{
+    Stats stats;
+    stats.writtenBytes = writtenBytes.load(std::memory_order_relaxed);
+    stats.droppedBytes = droppedBytes.load(std::memory_order_relaxed);
+    stats.bufferedBytes = ring.GetRingBufferReadAvailable();
+    stats.failed = failed.load(std::memory_order_relaxed);
+    return stats;
+}
+
+// The sample thread is never woken up for the writer, which looks at the
+// ring often enough to keep it from filling up
+void IQRecorder::run()
+{
+    threading::ScopedThread threadConfig(ThreadStage::Output, "iq-recorder");
+
+    bool stop = false;
+    while (not stop) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            dataAvailable.wait_for(lock, std::chrono::milliseconds(50), [this]() { return stopping; });
+            stop = stopping;
+        }
+
+        while (not failed and ring.GetRingBufferReadAvailable() >= (int32_t)blockBytes) {
+            ring.getDataFromBuffer(block, blockBytes);
+            writeBlock(blockBytes);
+        }
+    }
+
+    // Less than a block is left, which O_DIRECT cannot write
+    const int32_t rest = ring.getDataFromBuffer(block, blockBytes);
+    if (rest > 0 and not failed) {
+        if (directIO) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            directIO = false;
+        }
+        writeBlock(rest);
+    }
+}
+
+bool IQRecorder::writeBlock(size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t n = ::write(fd, block + done, size - done);
+        if (n == -1 and errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            std::clog << "IQRecorder: writing " << fileName << " failed: " << strerror(errno) << std::endl;
+            failed = true;
+            return false;
+        }
+        done += n;
+    }
+
+    if (not directIO) {
+        // Start the write back of this block, wait for the one before
+        // and drop it from the page cache
+        sync_file_range(fd, fileOffset, size, SYNC_FILE_RANGE_WRITE);
+        if (fileOffset >= blockBytes) {
+            const off_t previous = fileOffset - blockBytes;
+            sync_file_range(fd, previous, blockBytes,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(fd, previous, blockBytes, POSIX_FADV_DONTNEED);
+        }
+    }
+
+    fileOffset += size;
+    writtenBytes.fetch_add(size, std::memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,102 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef IQ_RECORDER_H
+#define IQ_RECORDER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "ringbuffer.h"
+
+/* Writes the raw samples of a device to a file while they are received.
+ * The sample thread only copies them into a bounded ring, a thread of
+ * the recorder writes them out in large blocks, so a recording of any
+ * length takes bufferBytes of memory. The file has the native format of
+ * the device, for a rtl-sdr u8 I/Q as replayed by CRAWFile.
+ * Samples that do not fit into the ring because the disk does not keep
+ * up are dropped and counted, the device is never held up. */
+class IQRecorder {
+public:
+    struct Options {
+        // The ring between the sample thread and the writer, a power of two
+        size_t bufferBytes = 16 << 20;
+        // Written at once, a multiple of 4096
+        size_t blockBytes = 1 << 20;
+        // Bypass the page cache with O_DIRECT, where the file system
+        // supports it. Otherwise the written blocks are dropped from the
+        // cache, so the recording does not push out other pages.
+        bool directIO = false;
+    };
+
+    struct Stats {
+        uint64_t writtenBytes = 0;
+        uint64_t droppedBytes = 0;
+        // Waiting in the ring
+        size_t bufferedBytes = 0;
+        // The file could not be written, the recording stopped
+        bool failed = false;
+    };
+
+    // Throws std::runtime_error if the file cannot be created
+    IQRecorder(const std::string& fileName, const Options& options);
+    // Writes what is left in the ring
+    ~IQRecorder();
+    IQRecorder(const IQRecorder&) = delete;
+    IQRecorder& operator=(const IQRecorder&) = delete;
+
+    // From the sample thread, never blocks
+    void write(const uint8_t *data, uint32_t size);
+
+    Stats getStats(void);
+    const std::string& getFileName(void) const { return fileName; }
+
+private:
+    void run(void);
+    bool writeBlock(size_t size);
+
+    const std::string fileName;
+    const size_t blockBytes;
+    int fd = -1;
+    bool directIO;
+    uint8_t *block = nullptr;
+
+    RingBuffer<uint8_t> ring;
+    std::atomic<uint64_t> writtenBytes = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> droppedBytes = ATOMIC_VAR_INIT(0);
+    std::atomic<bool> failed = ATOMIC_VAR_INIT(false);
+    uint64_t fileOffset = 0; // writer thread only
+
+    std::mutex mutex;
+    std::condition_variable dataAvailable;
+    bool stopping = false;
+    std::thread thread;
+};
+
+#endif // IQ_RECORDER_H
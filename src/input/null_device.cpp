@@ -79,6 +79,15 @@ int32_t CNullDevice::getSamplesToRead()
     return 0;
 }
 
+int32_t CNullDevice::waitForSamples(int32_t count, std::chrono::milliseconds timeout)
+{
+    (void) count;
+
+    // There will never be any samples, don't wake up more than necessary
+    std::this_thread::sleep_for(timeout);
+    return 0;
+}
+
 float CNullDevice::getGain() const
 {
     return 0;
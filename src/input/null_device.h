@@ -42,6 +42,7 @@ public:
     int32_t getSamples(DSPCOMPLEX* Buffer, int32_t Size);
     std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
     int32_t getSamplesToRead(void);
+    int32_t waitForSamples(int32_t count, std::chrono::milliseconds timeout);
     float getGain(void) const;
     float setGain(int Gain);
     int getGainCount(void);
@@ -0,0 +1,330 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "raw_file.h"
+
+CRAWFile::CRAWFile(RadioControllerInterface& radioController,
+        const std::string& fileName,
+        CRAWFileFormat format,
+        bool realTime) :
+    radioController(radioController),
+    fileName(fileName),
+    format(format),
+    realTime(realTime)
+{
+    switch (format) {
+        case CRAWFileFormat::U8:   bytesPerSample = 2 * sizeof(uint8_t); break;
+        case CRAWFileFormat::CS16: bytesPerSample = 2 * sizeof(int16_t); break;
+        case CRAWFileFormat::CF32: bytesPerSample = sizeof(DSPCOMPLEX); break;
+        default: throw std::runtime_error("RAWFile: unknown sample format");
+    }
+
+    fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("RAWFile: cannot open " + fileName + ": " + strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 or st.st_size < (off_t)bytesPerSample) {
+        ::close(fd);
+        throw std::runtime_error("RAWFile: " + fileName + " is empty or unreadable");
+    }
+
+    mappedSize = st.st_size;
+    void *map = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("RAWFile: mmap failed for " + fileName + ": " + strerror(errno));
+    }
+
+    // The file is read front to back exactly once per pass
+    madvise(map, mappedSize, MADV_SEQUENTIAL);
+
+    data = static_cast<const uint8_t*>(map);
+    totalSamples = mappedSize / bytesPerSample;
+
+    std::clog << "RAWFile: " << fileName << " mapped, " << totalSamples <<
+        " samples (" << (double)totalSamples / INPUT_RATE << " s), " <<
+        (realTime ? "real-time" : "as fast as possible") << std::endl;
+}
+
+CRAWFile::~CRAWFile()
+{
+    if (data) {
+        munmap(const_cast<uint8_t*>(data), mappedSize);
+    }
+
+    if (fd != -1) {
+        ::close(fd);
+    }
+}
+
+void CRAWFile::setFrequency(int Frequency)
+{
+    frequency = Frequency;
+}
+
+int CRAWFile::getFrequency() const
+{
+    return frequency;
+}
+
+bool CRAWFile::restart()
+{
+    // Every (re)start replays the recording from the beginning
+    position = 0;
+    endOfFile = false;
+    startPosition = 0;
+    startTime = std::chrono::steady_clock::now();
+    running = true;
+    return true;
+}
+
+bool CRAWFile::is_ok()
+{
+    return not endOfFile;
+}
+
+void CRAWFile::stop()
+{
+    running = false;
+}
+
+void CRAWFile::reset()
+{
+    restart();
+}
+
+void CRAWFile::convert(size_t fromSample, DSPCOMPLEX *buffer, int32_t size) const
+{
+    const uint8_t *src = data + fromSample * bytesPerSample;
+
+    switch (format) {
+        case CRAWFileFormat::U8:
+            convertU8ToComplex(src, buffer, size);
+            break;
+        case CRAWFileFormat::CS16:
+            {
+                const int16_t *s16 = reinterpret_cast<const int16_t*>(src);
+                for (int32_t i = 0; i < size; i++) {
+                    buffer[i] = DSPCOMPLEX(
+                            s16[2 * i] / 32768.0f,
+                            s16[2 * i + 1] / 32768.0f);
+                }
+            }
+            break;
+        case CRAWFileFormat::CF32:
+            // Same memory layout as DSPCOMPLEX, no conversion needed
+            memcpy(buffer, src, size * sizeof(DSPCOMPLEX));
+            break;
+        default:
+            break;
+    }
+}
+
+int32_t CRAWFile::getSamples(DSPCOMPLEX *buffer, int32_t size)
+{
+    if (not running) {
+        return 0;
+    }
+
+    const size_t pos = position;
+    const int32_t amount = std::min<size_t>(size, totalSamples - pos);
+
+    convert(pos, buffer, amount);
+    feedSampleTaps(data + pos * bytesPerSample, amount * bytesPerSample);
+    position = pos + amount;
+
+    if (position >= totalSamples and not endOfFile) {
+        endOfFile = true;
+        radioController.onMessage(message_level_t::Information, "End of file reached: " + fileName);
+    }
+
+    return amount;
+}
+
+std::vector<DSPCOMPLEX> CRAWFile::getSpectrumSamples(int size)
+{
+    std::vector<DSPCOMPLEX> sampleBuffer(size);
+
+    const size_t pos = position;
+    const size_t from = pos >= (size_t)size ? pos - size : 0;
+    const int32_t amount = std::min<size_t>(size, totalSamples - from);
+    convert(from, sampleBuffer.data(), amount);
+
+    return sampleBuffer;
+}
+
+int32_t CRAWFile::getSamplesToRead()
+{
+    if (not running) {
+        return 0;
+    }
+
+    const size_t pos = position;
+    size_t available = totalSamples - pos;
+
+    if (realTime) {
+        using namespace std::chrono;
+        const auto elapsed = duration_cast<microseconds>(steady_clock::now() - startTime);
+        const size_t due = startPosition + (size_t)((uint64_t)elapsed.count() * sampleRate / 1000000);
+        available = std::min(available, due > pos ? due - pos : 0);
+    }
+
+    if (available == 0 and pos >= totalSamples) {
+        endOfFile = true;
+    }
+
+    return (int32_t)std::min<size_t>(available, INT32_MAX);
+}
+
+int32_t CRAWFile::waitForSamples(int32_t count, std::chrono::milliseconds timeout)
+{
+    using namespace std::chrono;
+
+    int32_t available = getSamplesToRead();
+    if (available >= count or endOfFile) {
+        return available;
+    }
+
+    auto wakeup = steady_clock::now() + timeout;
+    if (running and realTime) {
+        // Sleep until the missing samples are due
+        const size_t due = position + count - startPosition;
+        wakeup = std::min(wakeup, startTime + microseconds((uint64_t)due * 1000000 / sampleRate + 1));
+    }
+    else if (running) {
+        // Replaying as fast as possible, the file is empty or stopped
+        return available;
+    }
+
+    std::this_thread::sleep_until(wakeup);
+    return getSamplesToRead();
+}
+
+float CRAWFile::getGain() const
+{
+    return 0;
+}
+
+float CRAWFile::setGain(int gain)
+{
+    (void) gain;
+    return 0;
+}
+
+int CRAWFile::getGainCount()
+{
+    return 0;
+}
+
+void CRAWFile::setAgc(bool AGC)
+{
+    (void) AGC;
+}
+
+std::string CRAWFile::getDescription()
+{
+    return "Raw file " + fileName;
+}
+
+CDeviceID CRAWFile::getID()
+{
+    return CDeviceID::RAWFILE;
+}
+
+bool CRAWFile::setDeviceParam(DeviceParam param, int value)
+{
+    switch (param) {
+        case DeviceParam::SampleRate:
+            // The recording is replayed at the rate it was captured with
+            sampleRate = value;
+            return true;
+        default:
+            return false;
+    }
+}
+
+CRAWFileFormat CRAWFile::formatFromString(const std::string& format)
+{
+    if (format == "u8")
+        return CRAWFileFormat::U8;
+    else if (format == "cs16" or format == "s16")
+        return CRAWFileFormat::CS16;
+    else if (format == "cf32" or format == "fc32")
+        return CRAWFileFormat::CF32;
+    return CRAWFileFormat::Unknown;
+}
+
+CRAWFile* CRAWFile::fromDeviceArgs(RadioControllerInterface& radioController,
+        const std::string& args)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (true) {
+        const size_t comma = args.find(',', start);
+        parts.push_back(args.substr(start, comma - start));
+        if (comma == std::string::npos)
+            break;
+        start = comma + 1;
+    }
+
+    const std::string& fileName = parts[0];
+    CRAWFileFormat format = CRAWFileFormat::Unknown;
+    bool realTime = true;
+
+    for (size_t i = 1; i < parts.size(); i++) {
+        if (parts[i] == "realtime")
+            realTime = true;
+        else if (parts[i] == "fast")
+            realTime = false;
+        else if (formatFromString(parts[i]) != CRAWFileFormat::Unknown)
+            format = formatFromString(parts[i]);
+        else
+            throw std::runtime_error("RAWFile: unknown option \"" + parts[i] + "\"");
+    }
+
+    if (format == CRAWFileFormat::Unknown) {
+        const size_t dot = fileName.rfind('.');
+        if (dot != std::string::npos)
+            format = formatFromString(fileName.substr(dot + 1));
+    }
+
+    // rtl-sdr recordings (.raw, .iq, .bin) are u8
+    if (format == CRAWFileFormat::Unknown)
+        format = CRAWFileFormat::U8;
+
+    return new CRAWFile(radioController, fileName, format, realTime);
+}
@@ -0,0 +1,112 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CRAWFILE_H
+#define CRAWFILE_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "virtual_input.h"
+#include "dab-constants.h"
+#include "radio-controller.h"
+
+enum class CRAWFileFormat {
+    U8,     // Unsigned 8 bit I/Q, as delivered by rtl-sdr and writeRecordBufferToFile
+    CS16,   // Signed 16 bit I/Q, native endianness
+    CF32,   // 32 bit float I/Q, same layout as DSPCOMPLEX
+    Unknown
+};
+
+// Replays a recorded I/Q file. The file is mapped into memory, so the
+// samples are read straight out of the page cache without intermediate
+// buffering. In real-time mode the samples are released at INPUT_RATE,
+// otherwise the decoder consumes them as fast as it can, which is what
+// we want for throughput measurements.
+// When the end of the file is reached, is_ok() returns false and the
+// OFDMProcessor reports an input failure.
+class CRAWFile : public CVirtualInput {
+public:
+    CRAWFile(RadioControllerInterface& radioController,
+            const std::string& fileName,
+            CRAWFileFormat format,
+            bool realTime = true);
+    ~CRAWFile(void);
+    CRAWFile(const CRAWFile&) = delete;
+    void operator=(const CRAWFile&) = delete;
+
+    // Interface methods
+    void setFrequency(int Frequency);
+    int getFrequency(void) const;
+    bool restart(void);
+    bool is_ok(void);
+    void stop(void);
+    void reset(void);
+    int32_t getSamples(DSPCOMPLEX* buffer, int32_t size);
+    std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
+    int32_t getSamplesToRead(void);
+    int32_t waitForSamples(int32_t count, std::chrono::milliseconds timeout);
+    float getGain(void) const;
+    float setGain(int gain);
+    int getGainCount(void);
+    void setAgc(bool AGC);
+    std::string getDescription(void);
+    CDeviceID getID(void);
+    bool setDeviceParam(DeviceParam param, int value);
+
+    // Parse the device argument "<file>[,u8|cs16|cf32][,realtime|fast]".
+    // Without explicit format, it is derived from the file extension.
+    static CRAWFile* fromDeviceArgs(RadioControllerInterface& radioController,
+            const std::string& args);
+    static CRAWFileFormat formatFromString(const std::string& format);
+
+private:
+    void convert(size_t fromSample, DSPCOMPLEX* buffer, int32_t size) const;
+
+    RadioControllerInterface& radioController;
+    std::string fileName;
+    CRAWFileFormat format;
+    bool realTime;
+    int frequency = 0;
+
+    int fd = -1;
+    const uint8_t *data = nullptr;
+    size_t mappedSize = 0;
+    size_t bytesPerSample = 0;
+    size_t totalSamples = 0;
+
+    std::atomic<size_t> position = ATOMIC_VAR_INIT(0);
+    std::atomic<bool> running = ATOMIC_VAR_INIT(false);
+    std::atomic<bool> endOfFile = ATOMIC_VAR_INIT(false);
+
+    // Pacing for real-time mode
+    uint32_t sampleRate = INPUT_RATE;
+    std::chrono::steady_clock::time_point startTime;
+    size_t startPosition = 0;
+};
+
+#endif // CRAWFILE_H
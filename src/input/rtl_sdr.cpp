@@ -32,18 +32,36 @@
 
 #include <iostream>
 #include <exception>
+#include <algorithm>
 
 #include "rtl_sdr.h"
+#include "dsp-kernels.h"
+#include "thread-config.h"
 
 #define READLEN_DEFAULT 8192
 
+// Queued by librtlsdr if not set otherwise
+#define DEFAULT_BUF_NUMBER 15
+
+// Largest transfer accepted, 1 s at 2.048 MS/s
+#define MAX_TRANSFER_BYTES (4 << 20)
+
+// The AGC decides on about 8 ms of samples at 2.048 MS/s
+#define AGC_WINDOW_BYTES (4 * 8192)
+
+// Tolerated share of clipped samples, 1/4096, before the gain is reduced
+#define AGC_CLIP_SHIFT 12
+
 // Fallback if function is not defined in shared lib
 int __attribute__((weak)) rtlsdr_set_bias_tee(rtlsdr_dev_t *dev, int on);
 
-CRTL_SDR::CRTL_SDR(RadioControllerInterface& radioController) :
+CRTL_SDR::CRTL_SDR(RadioControllerInterface& radioController, const std::string& deviceId) :
     radioController(radioController),
+    deviceId(deviceId),
+    // 256 ms at 2.048 MS/s, unless DeviceParam::BufferMs asks otherwise
     sampleBuffer(1024 * 1024),
-    spectrumSampleBuffer(8192)
+    spectrumSampleBuffer(8192),
+    transferBytes(READLEN_DEFAULT)
 {
     open_device();
 }
@@ -64,12 +82,34 @@ void CRTL_SDR::open_device()
         std::clog << "RTL_SDR: " << "Found " << deviceCount << " devices. Uses the first working one" << std::endl;
     }
 
-    //	Iterate over all found rtl-sdr devices and try to open it. Stops if one device is successful opened.
-    for(uint32_t i=0; i<deviceCount; i++) {
-        ret = rtlsdr_open(&device, i);
+    const std::string serialPrefix = "serial=";
+    if (deviceId.empty()) {
+        //	Iterate over all found rtl-sdr devices and try to open it. Stops if one device is successful opened.
+        for(uint32_t i=0; i<deviceCount; i++) {
+            ret = rtlsdr_open(&device, i);
+            if (ret >= 0) {
+                std::clog << "RTL_SDR: " << " Opening rtl-sdr device" << i << std::endl;
+                break;
+            }
+        }
+    }
+    else {
+        int index = -1;
+        if (deviceId.compare(0, serialPrefix.size(), serialPrefix) == 0) {
+            index = rtlsdr_get_index_by_serial(deviceId.substr(serialPrefix.size()).c_str());
+        }
+        else if (deviceId.find_first_not_of("0123456789") == std::string::npos) {
+            index = std::stoi(deviceId);
+        }
+
+        if (index < 0 or (uint32_t)index >= deviceCount) {
+            std::clog << "RTL_SDR: " << "Device " << deviceId << " not found" << std::endl;
+            throw 0;
+        }
+
+        ret = rtlsdr_open(&device, index);
         if (ret >= 0) {
-            std::clog << "RTL_SDR: " << " Opening rtl-sdr device" << i << std::endl;
-            break;
+            std::clog << "RTL_SDR: " << " Opening rtl-sdr device" << index << std::endl;
         }
     }
 
@@ -79,7 +119,7 @@ void CRTL_SDR::open_device()
     }
 
     // Set sample rate
-    ret = rtlsdr_set_sample_rate(device, INPUT_RATE);
+    ret = rtlsdr_set_sample_rate(device, sampleRate);
     if (ret < 0) {
         std::clog << "RTL_SDR: " << " Setting sample rate failed" << std::endl;
         throw 0;
@@ -148,10 +188,11 @@ bool CRTL_SDR::restart(void)
         return false;
 
     rtlsdr_set_center_freq(device, frequency + frequencyOffset);
+    resetLevel();
     rtlsdrRunning = true;
+    rtlsdrStarted = true;
 
     rtlsdrThread = std::thread(&CRTL_SDR::rtlsdr_read_async_wrapper, this);
-    agcThread = std::thread(&CRTL_SDR::agc_timer_thread, this);
 
     return true;
 }
@@ -168,10 +209,6 @@ void CRTL_SDR::stop(void)
 
     rtlsdrRunning = false;
 
-    if (agcThread.joinable()) {
-        agcThread.join();
-    }
-
     rtlsdr_cancel_async(device);
     if (rtlsdrThread.joinable()) {
         rtlsdrThread.join();
@@ -190,17 +227,18 @@ float CRTL_SDR::setGain(int gain_index)
         return 0;
     }
 
+    const int gain = gains[gain_index];
     currentGainIndex = gain_index;
-    currentGain = gains[gain_index];
+    currentGain = gain;
 
-    //std::clog << "RTL_SDR: " << "Set gain to" << currentGain / 10.0 << "db" << std::endl;
+    //std::clog << "RTL_SDR: " << "Set gain to" << gain / 10.0 << "db" << std::endl;
 
-    int ret = rtlsdr_set_tuner_gain(device, currentGain);
+    int ret = rtlsdr_set_tuner_gain(device, gain);
     if (ret != 0) {
         std::clog << "RTL_SDR: " << "Setting gain failed" << std::endl;
     }
 
-    return currentGain / 10.0;
+    return gain / 10.0;
 }
 
 int CRTL_SDR::getGainCount()
@@ -234,12 +272,85 @@ bool CRTL_SDR::setDeviceParam(DeviceParam param, int value)
         }
         return true;
 
+        case DeviceParam::SampleRate:
+        if (rtlsdr_set_sample_rate(device, value) < 0)
+        {
+            std::clog << "RTL_SDR: " << "Setting sample rate " << value << " failed" << std::endl;
+            return false;
+        }
+        std::clog << "RTL_SDR: " << "Set sample rate to " << value << std::endl;
+        sampleRate = value;
+        return true;
+
+        case DeviceParam::BufferMs:
+        {
+            // Once started, the receiver may read the buffer at any time
+            if (rtlsdrStarted or value <= 0)
+                return false;
+
+            // Whole USB transfers, two of them at least
+            const uint64_t bytes = (uint64_t)value * sampleRate / 1000 * 2;
+            uint32_t size = 2 * transferBytes;
+            while (size < bytes and size < (1u << 26)) {
+                size *= 2;
+            }
+            sampleBuffer.Resize(size);
+            std::clog << "RTL_SDR: " << "Sample buffer of " << size / 1024 << " KiB" << std::endl;
+            return true;
+        }
+
+        case DeviceParam::UsbTransfers:
+            if (rtlsdrRunning or value <= 0 or value > 512)
+                return false;
+            transferCount = value;
+            std::clog << "RTL_SDR: " << "Queueing " << value << " USB transfers" << std::endl;
+            return true;
+
+        case DeviceParam::UsbTransferBytes:
+        {
+            // librtlsdr takes multiples of 512, zeroCopy powers of two
+            if (rtlsdrRunning or value < 512 or value > MAX_TRANSFER_BYTES or (value & (value - 1)))
+                return false;
+
+            // The ring is only resized before the first start
+            const uint32_t minSize = 2 * (uint32_t)value;
+            if ((uint32_t)sampleBuffer.GetBufferSize() < minSize) {
+                if (rtlsdrStarted)
+                    return false;
+                sampleBuffer.Resize(minSize);
+            }
+            transferBytes = value;
+            std::clog << "RTL_SDR: " << "USB transfers of " << value << " bytes" << std::endl;
+            return true;
+        }
+
+        case DeviceParam::UsbZeroCopy:
+            if (rtlsdrRunning)
+                return false;
+            zeroCopy = value != 0;
+            return true;
+
         default: std::runtime_error("Unsupported device parameter");
     }
 
     return false;
 }
 
+InputStats CRTL_SDR::getInputStats()
+{
+    InputStats stats;
+    stats.bufferedSamples = getSamplesToRead();
+    stats.bufferSize = sampleBuffer.GetBufferSize() / 2;
+    stats.memoryBytes = sampleBuffer.GetBufferSize() + spectrumSampleBuffer.GetBufferSize();
+    overruns.addTo(stats);
+    return stats;
+}
+
+LatencyStamp CRTL_SDR::getReadStamp()
+{
+    return sampleClock.stamp(getSamplesToRead());
+}
+
 std::string CRTL_SDR::getDescription()
 {
     char manufact[256] = {0};
@@ -262,81 +373,125 @@ CDeviceID CRTL_SDR::getID()
     return CDeviceID::RTL_SDR;
 }
 
-void CRTL_SDR::agc_timer_thread(void)
+std::vector<std::string> CRTL_SDR::getDeviceIds()
 {
-    while (rtlsdrRunning && not rtlsdrUnplugged) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-        if (isAGC) {
-            // Check for overloading
-            if (minAmplitude == 0 || maxAmplitude == 255) {
-                // We have to decrease the gain
-                if (currentGainIndex > 0) {
-                    setGain(currentGainIndex - 1);
-                    //std::clog << "RTL_SDR: " << "Decreased gain to " << (float)currentGain / 10.0f << std::endl;
-                }
-            }
-            else {
-                if (currentGainIndex < ((ssize_t)gains.size() - 1)) {
-                    // Calc if a gain increase overloads the device. Calc it from the gain values
-                    int NewGain = gains[currentGainIndex + 1];
-                    float DeltaGain = ((float) NewGain / 10) - ((float) currentGain / 10);
-                    float LinGain = pow(10, DeltaGain / 20);
-
-                    int NewMaxValue = (float) maxAmplitude * LinGain;
-                    int NewMinValue = (float) minAmplitude / LinGain;
-
-                    // We have to increase the gain
-                    if(NewMinValue >= 0 && NewMaxValue <= 255) {
-                        setGain(currentGainIndex + 1);
-                        //std::clog << "RTL_SDR: " << "Increased gain to " << (float) currentGain / 10 << std::endl;
-                    }
-                }
+    const uint32_t deviceCount = rtlsdr_get_device_count();
+
+    std::vector<std::string> serials(deviceCount);
+    for (uint32_t i = 0; i < deviceCount; i++) {
+        char manufact[256] = {0};
+        char product[256] = {0};
+        char serial[256] = {0};
+        if (rtlsdr_get_device_usb_strings(i, manufact, product, serial) == 0) {
+            serials[i] = serial;
+        }
+    }
+
+    std::vector<std::string> ids;
+    for (uint32_t i = 0; i < deviceCount; i++) {
+        // Many dongles share the same default serial, it is only
+        // usable if it identifies the device
+        const bool unique = not serials[i].empty() and
+            std::count(serials.begin(), serials.end(), serials[i]) == 1;
+        ids.push_back(unique ? "serial=" + serials[i] : std::to_string(i));
+    }
+    return ids;
+}
+
+void CRTL_SDR::resetLevel(void)
+{
+    minAmplitude = 255;
+    maxAmplitude = 0;
+    clippedSamples = 0;
+    levelBytes = 0;
+    // Whatever is still queued was received on the previous frequency
+    settleBlocks = queuedTransfers();
+    pendingGainIndex = -1;
+    overloadReported = false;
+}
+
+void CRTL_SDR::updateLevel(const uint8_t *buf, uint32_t len)
+{
+    if (settleBlocks > 0) {
+        settleBlocks--;
+        return;
+    }
+
+    const dsp::ByteRange range = dsp::kernels().byteRange(buf, len);
+    minAmplitude = std::min(minAmplitude, range.min);
+    maxAmplitude = std::max(maxAmplitude, range.max);
+    clippedSamples += range.clipped;
+    levelBytes += len;
+    if (levelBytes < AGC_WINDOW_BYTES) {
+        return;
+    }
+
+    const bool overloaded = (clippedSamples << AGC_CLIP_SHIFT) > levelBytes;
+
+    if (isAGC) {
+        const int pending = pendingGainIndex;
+        const int gainIndex = pending >= 0 ? pending : currentGainIndex.load();
+        int newGainIndex = gainIndex;
+
+        if (overloaded) {
+            // We have to decrease the gain
+            if (gainIndex > 0) {
+                newGainIndex = gainIndex - 1;
             }
         }
-        else { // AGC is off
-            if (minAmplitude == 0 || maxAmplitude == 255) {
-                std::string Text = "ADC overload. Maybe you are using a too high gain.";
-                std::clog << "RTL_SDR: " << Text << std::endl;
-                radioController.onMessage(message_level_t::Information, Text);
+        else if (gainIndex < ((ssize_t)gains.size() - 1)) {
+            // Calc if a gain increase overloads the device. Calc it from the gain values
+            int NewGain = gains[gainIndex + 1];
+            float DeltaGain = ((float) NewGain / 10) - ((float) gains[gainIndex] / 10);
+            float LinGain = pow(10, DeltaGain / 20);
+
+            int NewMaxValue = (float) maxAmplitude * LinGain;
+            int NewMinValue = (float) minAmplitude / LinGain;
+
+            // We have to increase the gain
+            if (NewMinValue >= 0 && NewMaxValue <= 255) {
+                newGainIndex = gainIndex + 1;
             }
         }
+
+        if (newGainIndex != gainIndex) {
+            pendingGainIndex = newGainIndex;
+            settleBlocks = queuedTransfers();
+        }
     }
+    else if (overloaded and not overloadReported) { // AGC is off
+        std::string Text = "ADC overload. Maybe you are using a too high gain.";
+        std::clog << "RTL_SDR: " << Text << std::endl;
+        radioController.onMessage(message_level_t::Information, Text);
+    }
+    overloadReported = overloaded;
+
+    minAmplitude = 255;
+    maxAmplitude = 0;
+    clippedSamples = 0;
+    levelBytes = 0;
 }
 
 int32_t CRTL_SDR::getSamples(DSPCOMPLEX *buffer, int32_t size)
 {
-    std::vector<uint8_t> tempBuffer(2 * size);
-
-    int32_t amount = sampleBuffer.getDataFromBuffer(tempBuffer.data(), 2 * size);
-
-    // Normalise samples
-    for (int i = 0; i < amount / 2; i++) {
-        buffer[i] = DSPCOMPLEX(
-                (float(tempBuffer[2 * i] - 128)) / 128.0,
-                (float(tempBuffer[2 * i + 1] - 128)) / 128.0);
+    const int gainIndex = pendingGainIndex.exchange(-1);
+    if (gainIndex >= 0 and isAGC) {
+        setGain(gainIndex);
     }
 
-    return amount / 2;
+    return readU8Samples(sampleBuffer, buffer, size);
 }
 
 std::vector<DSPCOMPLEX> CRTL_SDR::getSpectrumSamples(int size)
 {
-    std::vector<uint8_t> tempBuffer(2 * size);
-
-    // Get samples
-    int32_t amount = spectrumSampleBuffer.getDataFromBuffer(
-            tempBuffer.data(), 2 * size);
-
-    std::vector<DSPCOMPLEX> buffer(amount / 2);
-
-    // Convert samples into generic format
-    for (int i = 0; i < amount / 2; i++) {
-        buffer[i] = DSPCOMPLEX(
-                (float(tempBuffer[2 * i] - 128)) / 128.0,
-                (float(tempBuffer[2 * i + 1] - 128)) / 128.0);
+    // The spectrum buffer is only filled once somebody asks for it
+    if (spectrumTapId == -1) {
+        spectrumTapId = addSampleTap([this](const uint8_t *data, uint32_t size) {
+                spectrumSampleBuffer.putDataIntoBuffer(data, size); });
     }
 
+    std::vector<DSPCOMPLEX> buffer(size);
+    buffer.resize(readU8Samples(spectrumSampleBuffer, buffer.data(), size));
     return buffer;
 }
 
@@ -345,55 +500,109 @@ int32_t CRTL_SDR::getSamplesToRead(void)
     return sampleBuffer.GetRingBufferReadAvailable() / 2;
 }
 
+int32_t CRTL_SDR::waitForSamples(int32_t count, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(sampleMutex);
+    samplesWanted = count;
+    samplesAvailable.wait_for(lock, timeout, [&]{
+            return getSamplesToRead() >= count or rtlsdrUnplugged; });
+    samplesWanted = 0;
+
+    return getSamplesToRead();
+}
+
 void CRTL_SDR::reset(void)
 {
     sampleBuffer.FlushRingBuffer();
 }
 
+int CRTL_SDR::queuedTransfers() const
+{
+    if (zeroCopy)
+        return 1;
+    return transferCount > 0 ? transferCount : DEFAULT_BUF_NUMBER;
+}
+
+void CRTL_SDR::onTransfer(const uint8_t *buf, uint32_t len, int32_t written)
+{
+    sampleClock.received(written / 2);
+    if (overruns.count(getSamplesToRead(), (len - written) / 2)) {
+        std::clog << "RTL_SDR: " << "Receiver does not keep up, dropping samples" << std::endl;
+    }
+
+    const int32_t wanted = samplesWanted;
+    if (wanted > 0 and getSamplesToRead() >= wanted) {
+        std::lock_guard<std::mutex> lock(sampleMutex);
+        samplesAvailable.notify_one();
+    }
+
+    feedSampleTaps(buf, len);
+    updateLevel(buf, len);
+}
+
 void CRTL_SDR::rtlsdr_read_callback(uint8_t* buf, uint32_t len, void* ctx)
 {
     if (ctx) {
         CRTL_SDR *rtlsdr = (CRTL_SDR*)ctx;
 
-        if (len != READLEN_DEFAULT) {
+        if (len != rtlsdr->transferBytes) {
             std::clog << "RTL_SDR: " << "Short read" << std::endl;
             return;
         }
 
-        int32_t tmp = rtlsdr->sampleBuffer.putDataIntoBuffer(buf, len);
-        if ((len - tmp) > 0)
-            rtlsdr->sampleCounter += len - tmp;
-
-        rtlsdr->spectrumSampleBuffer.putDataIntoBuffer(buf, len);
-        rtlsdr->putIntoRecordBuffer(*buf, len);
+        const int32_t written = rtlsdr->sampleBuffer.putDataIntoBuffer(buf, len);
+        rtlsdr->onTransfer(buf, len, written);
+    }
+    else {
+        std::clog << "RTL_SDR: " << "ERROR no ctx in RTLSDR callback" << std::endl;
+    }
+}
 
-        // Check if device is overloaded
-        rtlsdr->minAmplitude = 255;
-        rtlsdr->maxAmplitude = 0;
+void CRTL_SDR::rtlsdr_read_sync_loop()
+{
+    // Where a transfer goes while the ring has no room for it, to be dropped
+    std::vector<uint8_t> overflow(transferBytes);
 
-        for (uint32_t i=0;i<len;i++) {
-            if (rtlsdr->minAmplitude > buf[i])
-                rtlsdr->minAmplitude = buf[i];
+    while (rtlsdrRunning) {
+        const auto spans = sampleBuffer.peekWrite(transferBytes);
+        const bool inPlace = spans.size1 == (int32_t)transferBytes;
+        uint8_t *buf = inPlace ? spans.data1 : overflow.data();
 
-            if (rtlsdr->maxAmplitude < buf[i])
-                rtlsdr->maxAmplitude = buf[i];
+        int len = 0;
+        if (rtlsdr_read_sync(device, buf, transferBytes, &len) < 0) {
+            return;
         }
-    }
-    else {
-        std::clog << "RTL_SDR: " << "ERROR no ctx in RTLSDR callback" << std::endl;
+        if (len != (int)transferBytes) {
+            std::clog << "RTL_SDR: " << "Short read" << std::endl;
+            continue;
+        }
+
+        // Dropped as a whole, the ring stays aligned to the transfers
+        if (inPlace)
+            sampleBuffer.commitWrite(len);
+        onTransfer(buf, len, inPlace ? len : 0);
     }
 }
 
 void CRTL_SDR::rtlsdr_read_async_wrapper()
 {
+    threading::ScopedThread threadConfig(ThreadStage::Input, "rtlsdr-read");
     std::clog << "RTL_SDR: " << "Start rtlsdr_read_async_wrapper() thread" << std::endl;
-    rtlsdr_read_async(device,
-                      (rtlsdr_read_async_cb_t)&CRTL_SDR::rtlsdr_read_callback,
-                      (void*)this, 0, READLEN_DEFAULT);
+    if (zeroCopy) {
+        rtlsdr_read_sync_loop();
+    }
+    else {
+        rtlsdr_read_async(device,
+                          (rtlsdr_read_async_cb_t)&CRTL_SDR::rtlsdr_read_callback,
+                          (void*)this, transferCount, transferBytes);
+    }
 
     if(rtlsdrRunning) {
         radioController.onMessage(message_level_t::Error, "RTL-SDR is unplugged.");
         rtlsdrUnplugged = true;
+
+        std::lock_guard<std::mutex> lock(sampleMutex);
+        samplesAvailable.notify_all();
     }
 
     std::clog << "RTL_SDR: " << "End rtlsdr_read_async_wrapper() thread" << std::endl;
@@ -37,6 +37,8 @@
 #include <thread>
 #include <string>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <rtl-sdr.h>
 
 #include "virtual_input.h"
@@ -50,7 +52,9 @@
 // It does not do any processing
 class CRTL_SDR : public CVirtualInput {
 public:
-    CRTL_SDR(RadioControllerInterface& radioController);
+    // deviceId selects the dongle: "" for the first one that can be
+    // opened, "<index>" or "serial=<serial>"
+    CRTL_SDR(RadioControllerInterface& radioController, const std::string& deviceId = "");
     ~CRTL_SDR(void);
     CRTL_SDR(const CRTL_SDR&) = delete;
     void operator=(const CRTL_SDR&) = delete;
@@ -63,6 +67,7 @@ public:
     int32_t getSamples(DSPCOMPLEX *buffer, int32_t size);
     std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
     int32_t getSamplesToRead(void);
+    int32_t waitForSamples(int32_t count, std::chrono::milliseconds timeout);
     void setFrequency(int Frequency);
     int getFrequency(void) const;
     float getGain(void) const;
@@ -71,35 +76,81 @@ public:
     void setAgc(bool AGC);
     std::string getDescription(void);
     bool setDeviceParam(DeviceParam param, int value);
+    InputStats getInputStats(void);
+    LatencyStamp getReadStamp(void);
 
     CDeviceID getID(void);
 
+    // Device ids of all connected dongles, as accepted by the constructor.
+    // The serial is used if it is unique, the index otherwise.
+    static std::vector<std::string> getDeviceIds(void);
+
 private:
-    std::thread agcThread;
     RadioControllerInterface& radioController;
+    std::string deviceId;
     int frequency = kHz(174928);
     int frequencyOffset = 0;
-    int currentGain = 0;
-    bool isAGC = false;
+    uint32_t sampleRate = INPUT_RATE;
+    // Also read by the read callback, for the AGC
+    std::atomic<int> currentGain = ATOMIC_VAR_INIT(0);
+    std::atomic<bool> isAGC = ATOMIC_VAR_INIT(false);
     bool isHwAGC = false;
     std::thread rtlsdrThread;
     void rtlsdr_read_async_wrapper(void);
     std::atomic<bool> rtlsdrRunning = ATOMIC_VAR_INIT(false);
+    // The sample buffer is only resized before the first start
+    bool rtlsdrStarted = false;
     std::atomic<bool> rtlsdrUnplugged = ATOMIC_VAR_INIT(false);
 
     std::vector<int> gains;
-    int currentGainIndex = 0;
+    std::atomic<int> currentGainIndex = ATOMIC_VAR_INIT(0);
+
+    /* Software AGC. The read callback collects the level statistics of
+     * the received blocks and decides on the gain, the reader of the
+     * samples applies it, which keeps the control transfers out of the
+     * libusb event handling. With a fixed gain, only overloads are
+     * reported. */
+    void updateLevel(const uint8_t *buf, uint32_t len);
+    void resetLevel(void);
+    std::atomic<int> pendingGainIndex = ATOMIC_VAR_INIT(-1);
     uint8_t minAmplitude = 255;
     uint8_t maxAmplitude = 0;
-
-    void agc_timer_thread(void);
+    size_t clippedSamples = 0;
+    uint32_t levelBytes = 0;
+    // Blocks still received with the gain before the last change
+    int settleBlocks = 0;
+    bool overloadReported = false;
 
     RingBuffer<uint8_t> sampleBuffer;
+
+    // Wakes up waitForSamples() once samplesWanted samples are buffered
+    std::mutex sampleMutex;
+    std::condition_variable samplesAvailable;
+    std::atomic<int32_t> samplesWanted = ATOMIC_VAR_INIT(0);
     RingBuffer<uint8_t> spectrumSampleBuffer;
+    int spectrumTapId = -1;
     struct rtlsdr_dev *device = nullptr;
-    int32_t sampleCounter = 0;
+    // Samples that did not fit into sampleBuffer any more
+    OverrunCounter overruns;
+    // The capture time of the samples in sampleBuffer
+    SampleClock sampleClock;
+
+    // DeviceParam::UsbTransfers, 0 for the default of librtlsdr
+    uint32_t transferCount = 0;
+    uint32_t transferBytes;
+    /* Without copying: librtlsdr receives every transfer synchronously,
+     * straight into the free space of sampleBuffer. As the transfers are
+     * a power of two, like the ring, they never wrap around its end. Only
+     * one transfer is in flight, so it takes large transfers and a host
+     * that gets back to the dongle in time. */
+    bool zeroCopy = false;
+    // The transfers that are received with the settings of before
+    int queuedTransfers(void) const;
 
     static void rtlsdr_read_callback(uint8_t* buf, uint32_t len, void *ctx);
+    void rtlsdr_read_sync_loop(void);
+    // After a transfer arrived, written bytes of it went into sampleBuffer
+    void onTransfer(const uint8_t *buf, uint32_t len, int32_t written);
     void open_device();
 };
 
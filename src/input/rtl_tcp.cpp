@@ -0,0 +1,474 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "rtl_tcp.h"
+#include "thread-config.h"
+
+// Largest single recv() into the sample ring buffer
+#define RECV_CHUNK (64 * 1024)
+
+// Timeout for connecting and for a single recv(), in ms
+#define CONNECT_TIMEOUT_S 5
+#define RECV_TIMEOUT_MS 100
+
+enum rtl_tcp_tuner_type {
+    TUNER_UNKNOWN = 0,
+    TUNER_E4000,
+    TUNER_FC0012,
+    TUNER_FC0013,
+    TUNER_FC2580,
+    TUNER_R820T,
+    TUNER_R828D
+};
+
+// Gain tables from librtlsdr, in tenths of dB
+static const int e4k_gains[] = { -10, 15, 40, 65, 90, 115, 140, 165, 190, 215,
+    240, 290, 340, 420 };
+static const int fc0012_gains[] = { -99, -40, 71, 179, 192 };
+static const int fc0013_gains[] = { -99, -73, -65, -63, -60, -58, -54, 58, 61,
+    63, 65, 67, 68, 70, 71, 179, 181, 182, 184, 186, 188, 191, 197 };
+static const int r82xx_gains[] = { 0, 9, 14, 27, 37, 77, 87, 125, 144, 157,
+    166, 197, 207, 229, 254, 280, 297, 328, 338, 364, 372, 386, 402, 421,
+    434, 439, 445, 480, 496 };
+
+CRTL_TCP_Client::CRTL_TCP_Client(RadioControllerInterface& radioController,
+        const std::string& host, int port) :
+    radioController(radioController),
+    host(host),
+    port(port),
+    sampleBuffer(1024 * 1024),
+    spectrumSampleBuffer(8192)
+{
+    open_connection();
+}
+
+CRTL_TCP_Client::~CRTL_TCP_Client(void)
+{
+    stop();
+}
+
+void CRTL_TCP_Client::open_connection()
+{
+    std::clog << "RTL_TCP: " << "Connect to " << host << ":" << port << std::endl;
+
+    if (sock.valid()) {
+        sock.close();
+    }
+    if (not sock.connect(host, port, CONNECT_TIMEOUT_S)) {
+        throw std::runtime_error("RTL_TCP: cannot connect to " + host + ":" + std::to_string(port));
+    }
+    sock.setReceiveTimeout(RECV_TIMEOUT_MS * 10);
+
+    // The server starts with "RTL0", tuner type and gain count
+    uint8_t header[12];
+    size_t received = 0;
+    while (received < sizeof(header)) {
+        const ssize_t ret = sock.recv(header + received, sizeof(header) - received, 0);
+        if (ret <= 0) {
+            sock.close();
+            throw std::runtime_error("RTL_TCP: no header received from " + host);
+        }
+        received += ret;
+    }
+
+    if (memcmp(header, "RTL0", 4) != 0) {
+        sock.close();
+        throw std::runtime_error("RTL_TCP: " + host + " is not an rtl_tcp server");
+    }
+
+    tunerType = (header[4] << 24) | (header[5] << 16) | (header[6] << 8) | header[7];
+    tunerGainCount = (header[8] << 24) | (header[9] << 16) | (header[10] << 8) | header[11];
+
+    switch (tunerType) {
+        case TUNER_E4000: gains.assign(std::begin(e4k_gains), std::end(e4k_gains)); break;
+        case TUNER_FC0012: gains.assign(std::begin(fc0012_gains), std::end(fc0012_gains)); break;
+        case TUNER_FC0013: gains.assign(std::begin(fc0013_gains), std::end(fc0013_gains)); break;
+        case TUNER_R820T:
+        case TUNER_R828D: gains.assign(std::begin(r82xx_gains), std::end(r82xx_gains)); break;
+        default: gains.clear(); break;
+    }
+
+    std::clog << "RTL_TCP: " << "Tuner type " << tunerType << ", " << tunerGainCount << " gains" << std::endl;
+
+    sock.setReceiveTimeout(RECV_TIMEOUT_MS);
+
+    sendCommand(Command::SetSampleRate, sampleRate);
+    sendCommand(Command::SetFrequencyCorrection, 0);
+    // Always use manual gain, the AGC is implemented in software
+    sendCommand(Command::SetGainMode, 1);
+    sendCommand(Command::SetAgcMode, 0);
+
+    connected = true;
+
+    // Enable AGC by default
+    setAgc(true);
+}
+
+bool CRTL_TCP_Client::sendCommand(Command cmd, uint32_t param)
+{
+    uint8_t buf[5];
+    buf[0] = static_cast<uint8_t>(cmd);
+    buf[1] = (param >> 24) & 0xff;
+    buf[2] = (param >> 16) & 0xff;
+    buf[3] = (param >> 8) & 0xff;
+    buf[4] = param & 0xff;
+
+    std::lock_guard<std::mutex> lock(sendMutex);
+    if (not sock.valid()) {
+        return false;
+    }
+    return sock.send(buf, sizeof(buf), MSG_NOSIGNAL) == sizeof(buf);
+}
+
+void CRTL_TCP_Client::setFrequency(int Frequency)
+{
+    stop();
+    frequency = Frequency;
+    restart();
+}
+
+int CRTL_TCP_Client::getFrequency(void) const
+{
+    return frequency;
+}
+
+bool CRTL_TCP_Client::restart(void)
+{
+    if (not connected) {
+        stop();
+        try {
+            open_connection();
+        }
+        catch (const std::exception& e) {
+            std::clog << e.what() << std::endl;
+            radioController.onMessage(message_level_t::Error, "Error connecting to rtl_tcp server " + host);
+            return false;
+        }
+    }
+
+    if (running) {
+        return true;
+    }
+
+    sampleBuffer.FlushRingBuffer();
+    spectrumSampleBuffer.FlushRingBuffer();
+    sendCommand(Command::SetFrequency, frequency);
+
+    running = true;
+    receiveThread = std::thread(&CRTL_TCP_Client::receive_thread, this);
+    agcThread = std::thread(&CRTL_TCP_Client::agc_timer_thread, this);
+
+    return true;
+}
+
+bool CRTL_TCP_Client::is_ok(void)
+{
+    return connected;
+}
+
+void CRTL_TCP_Client::stop(void)
+{
+    running = false;
+
+    if (agcThread.joinable()) {
+        agcThread.join();
+    }
+
+    if (receiveThread.joinable()) {
+        receiveThread.join();
+    }
+}
+
+void CRTL_TCP_Client::reset(void)
+{
+    sampleBuffer.FlushRingBuffer();
+}
+
+int32_t CRTL_TCP_Client::getSamples(DSPCOMPLEX *buffer, int32_t size)
+{
+    return readU8Samples(sampleBuffer, buffer, size);
+}
+
+std::vector<DSPCOMPLEX> CRTL_TCP_Client::getSpectrumSamples(int size)
+{
+    // The spectrum buffer is only filled once somebody asks for it
+    if (spectrumTapId == -1) {
+        spectrumTapId = addSampleTap([this](const uint8_t *data, uint32_t size) {
+                spectrumSampleBuffer.putDataIntoBuffer(data, size); });
+    }
+
+    std::vector<DSPCOMPLEX> buffer(size);
+    buffer.resize(readU8Samples(spectrumSampleBuffer, buffer.data(), size));
+    return buffer;
+}
+
+int32_t CRTL_TCP_Client::getSamplesToRead(void)
+{
+    return sampleBuffer.GetRingBufferReadAvailable() / 2;
+}
+
+int32_t CRTL_TCP_Client::waitForSamples(int32_t count, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(sampleMutex);
+    samplesWanted = count;
+    samplesAvailable.wait_for(lock, timeout, [&]{
+            return getSamplesToRead() >= count or not connected; });
+    samplesWanted = 0;
+
+    return getSamplesToRead();
+}
+
+float CRTL_TCP_Client::getGain(void) const
+{
+    const int gainIndex = currentGainIndex;
+    if ((size_t)gainIndex < gains.size())
+        return gains[gainIndex] / 10.0;
+    return gainIndex;
+}
+
+float CRTL_TCP_Client::setGain(int gain_index)
+{
+    if (gain_index < 0 or (uint32_t)gain_index >= tunerGainCount) {
+        std::clog << "RTL_TCP: " << "Unknown gain count" << gain_index << std::endl;
+        return 0;
+    }
+
+    currentGainIndex = gain_index;
+    sendCommand(Command::SetGainByIndex, gain_index);
+
+    return getGain();
+}
+
+int CRTL_TCP_Client::getGainCount(void)
+{
+    return tunerGainCount - 1;
+}
+
+void CRTL_TCP_Client::setAgc(bool AGC)
+{
+    isAGC = AGC;
+    if (not AGC) {
+        setGain(currentGainIndex);
+    }
+}
+
+bool CRTL_TCP_Client::setDeviceParam(DeviceParam param, int value)
+{
+    switch (param) {
+        case DeviceParam::BiasTee:
+            std::clog << "RTL_TCP: " << "Set bias tee to " << value << std::endl;
+            return sendCommand(Command::SetBiasTee, value);
+        case DeviceParam::SampleRate:
+            std::clog << "RTL_TCP: " << "Set sample rate to " << value << std::endl;
+            sampleRate = value;
+            return sendCommand(Command::SetSampleRate, value);
+        default:
+            return false;
+    }
+}
+
+InputStats CRTL_TCP_Client::getInputStats(void)
+{
+    InputStats stats;
+    stats.bufferedSamples = getSamplesToRead();
+    stats.bufferSize = sampleBuffer.GetBufferSize() / 2;
+    stats.memoryBytes = sampleBuffer.GetBufferSize() + spectrumSampleBuffer.GetBufferSize();
+    overruns.addTo(stats);
+    return stats;
+}
+
+std::string CRTL_TCP_Client::getDescription(void)
+{
+    return "rtl_tcp client " + host + ":" + std::to_string(port);
+}
+
+CDeviceID CRTL_TCP_Client::getID(void)
+{
+    return CDeviceID::RTL_TCP;
+}
+
+void CRTL_TCP_Client::receive_thread(void)
+{
+    threading::ScopedThread threadConfig(ThreadStage::Input, "rtltcp-read");
+
+    std::vector<uint8_t> discard;
+    // The I of a sample whose Q is still to be received. Only whole
+    // samples go into the ring, or are dropped, so that I and Q keep
+    // their order after a recv that ended between them.
+    uint8_t carry = 0;
+    bool haveCarry = false;
+
+    while (running) {
+        // Receive straight into the first free region of the ring
+        const auto spans = sampleBuffer.peekWrite(RECV_CHUNK);
+
+        // If the decoder does not keep up, drop samples like CRTL_SDR does
+        uint8_t *dest = spans.data1;
+        int32_t size = spans.size1;
+        bool toRing = true;
+        if (size == 0) {
+            discard.resize(RECV_CHUNK);
+            dest = discard.data();
+            size = RECV_CHUNK;
+            toRing = false;
+        }
+
+        // The space of the ring comes in whole samples, so there is room
+        // for more than the carry
+        const int32_t offset = haveCarry ? 1 : 0;
+        if (haveCarry) {
+            dest[0] = carry;
+        }
+        const ssize_t ret = sock.recv(dest + offset, size - offset, 0);
+        if (ret < 0 and (errno == EAGAIN or errno == EWOULDBLOCK or errno == EINTR)) {
+            continue;
+        }
+        else if (ret <= 0) {
+            if (running) {
+                radioController.onMessage(message_level_t::Error, "Connection to rtl_tcp server lost.");
+            }
+            connected = false;
+            std::lock_guard<std::mutex> lock(sendMutex);
+            sock.close();
+            break;
+        }
+
+        const int32_t received = offset + ret;
+        const int32_t bytes = received & ~1;
+        haveCarry = received & 1;
+        carry = dest[received - 1];
+
+        if (toRing) {
+            sampleBuffer.commitWrite(bytes);
+
+            const int32_t wanted = samplesWanted;
+            if (wanted > 0 and getSamplesToRead() >= wanted) {
+                std::lock_guard<std::mutex> lock(sampleMutex);
+                samplesAvailable.notify_one();
+            }
+        }
+        if (overruns.count(getSamplesToRead(), toRing ? 0 : bytes / 2)) {
+            std::clog << "RTL_TCP: " << "Receiver does not keep up, dropping samples" << std::endl;
+        }
+
+        feedSampleTaps(dest, bytes);
+
+        // Check if device is overloaded
+        uint8_t minValue = 255;
+        uint8_t maxValue = 0;
+        for (int32_t i = 0; i < bytes; i++) {
+            minValue = std::min(minValue, dest[i]);
+            maxValue = std::max(maxValue, dest[i]);
+        }
+        minAmplitude = minValue;
+        maxAmplitude = maxValue;
+    }
+
+    std::lock_guard<std::mutex> lock(sampleMutex);
+    samplesAvailable.notify_all();
+}
+
+void CRTL_TCP_Client::agc_timer_thread(void)
+{
+    threading::ScopedThread threadConfig(ThreadStage::Agc, "rtltcp-agc");
+
+    while (running and connected) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        // Written by the receive thread and setGain, read once per round
+        const uint8_t minLevel = minAmplitude;
+        const uint8_t maxLevel = maxAmplitude;
+        const int gainIndex = currentGainIndex;
+
+        if (isAGC) {
+            // Check for overloading
+            if (minLevel == 0 || maxLevel == 255) {
+                // We have to decrease the gain
+                if (gainIndex > 0) {
+                    setGain(gainIndex - 1);
+                }
+            }
+            else if (gainIndex < (int)tunerGainCount - 1) {
+                // Calc if a gain increase overloads the device. Without gain
+                // table, assume the usual step of about 3 dB.
+                float deltaGain = 3;
+                if ((size_t)gainIndex + 1 < gains.size()) {
+                    deltaGain = (gains[gainIndex + 1] - gains[gainIndex]) / 10.0;
+                }
+                const float linGain = pow(10, deltaGain / 20);
+
+                const int newMaxValue = 128 + (maxLevel - 128) * linGain;
+                const int newMinValue = 128 - (128 - minLevel) * linGain;
+
+                if (newMinValue >= 0 && newMaxValue <= 255) {
+                    setGain(gainIndex + 1);
+                }
+            }
+        }
+        else if (minLevel == 0 || maxLevel == 255) {
+            std::string Text = "ADC overload. Maybe you are using a too high gain.";
+            std::clog << "RTL_TCP: " << Text << std::endl;
+            radioController.onMessage(message_level_t::Information, Text);
+        }
+    }
+}
+
+CRTL_TCP_Client* CRTL_TCP_Client::fromDeviceArgs(RadioControllerInterface& radioController,
+        const std::string& args)
+{
+    std::string host = args;
+    int port = 1234;
+
+    // host, host:port, [ipv6] or [ipv6]:port
+    if (not args.empty() and args[0] == '[') {
+        const size_t close = args.find(']');
+        if (close == std::string::npos) {
+            throw std::runtime_error("RTL_TCP: invalid address " + args);
+        }
+        host = args.substr(1, close - 1);
+        if (close + 1 < args.size() and args[close + 1] == ':') {
+            port = std::stoi(args.substr(close + 2));
+        }
+    }
+    else {
+        const size_t colon = args.find(':');
+        if (colon != std::string::npos and args.find(':', colon + 1) == std::string::npos) {
+            host = args.substr(0, colon);
+            port = std::stoi(args.substr(colon + 1));
+        }
+    }
+
+    if (host.empty()) {
+        host = "localhost";
+    }
+
+    return new CRTL_TCP_Client(radioController, host, port);
+}
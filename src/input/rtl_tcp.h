@@ -0,0 +1,132 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _CRTL_TCP_H
+#define _CRTL_TCP_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "virtual_input.h"
+#include "dab-constants.h"
+#include "MathHelper.h"
+#include "ringbuffer.h"
+#include "radio-controller.h"
+#include "Socket.h"
+
+// Client for a remote rtl_tcp server. The samples are received in
+// large batches directly into the sample ring buffer. Gain handling
+// follows CRTL_SDR: manual tuner gain, with the AGC done in software.
+class CRTL_TCP_Client : public CVirtualInput {
+public:
+    CRTL_TCP_Client(RadioControllerInterface& radioController,
+            const std::string& host, int port);
+    ~CRTL_TCP_Client(void);
+    CRTL_TCP_Client(const CRTL_TCP_Client&) = delete;
+    void operator=(const CRTL_TCP_Client&) = delete;
+
+    // Interface methods
+    bool restart(void);
+    bool is_ok(void);
+    void stop(void);
+    void reset(void);
+    int32_t getSamples(DSPCOMPLEX *buffer, int32_t size);
+    std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
+    int32_t getSamplesToRead(void);
+    int32_t waitForSamples(int32_t count, std::chrono::milliseconds timeout);
+    void setFrequency(int Frequency);
+    int getFrequency(void) const;
+    float getGain(void) const;
+    float setGain(int gain_index);
+    int getGainCount(void);
+    void setAgc(bool AGC);
+    std::string getDescription(void);
+    bool setDeviceParam(DeviceParam param, int value);
+    InputStats getInputStats(void);
+
+    CDeviceID getID(void);
+
+    // Parse the device argument "<host>[:<port>]"
+    static CRTL_TCP_Client* fromDeviceArgs(RadioControllerInterface& radioController,
+            const std::string& args);
+
+private:
+    enum class Command : uint8_t {
+        SetFrequency = 0x01,
+        SetSampleRate = 0x02,
+        SetGainMode = 0x03,
+        SetGain = 0x04,
+        SetFrequencyCorrection = 0x05,
+        SetAgcMode = 0x08,
+        SetGainByIndex = 0x0d,
+        SetBiasTee = 0x0e,
+    };
+
+    void open_connection(void);
+    bool sendCommand(Command cmd, uint32_t param);
+    void receive_thread(void);
+    void agc_timer_thread(void);
+
+    RadioControllerInterface& radioController;
+    std::string host;
+    int port;
+
+    std::mutex sendMutex;
+    Socket sock;
+    uint32_t tunerType = 0;
+    uint32_t tunerGainCount = 0;
+
+    int frequency = kHz(174928);
+    uint32_t sampleRate = INPUT_RATE;
+    std::vector<int> gains; // in tenths of dB, empty for unknown tuners
+    // Shared by the receive thread, the AGC thread and the callers
+    std::atomic<int> currentGainIndex = ATOMIC_VAR_INIT(0);
+    std::atomic<bool> isAGC = ATOMIC_VAR_INIT(false);
+    std::atomic<uint8_t> minAmplitude = ATOMIC_VAR_INIT(255);
+    std::atomic<uint8_t> maxAmplitude = ATOMIC_VAR_INIT(0);
+
+    std::thread receiveThread;
+    std::thread agcThread;
+    std::atomic<bool> running = ATOMIC_VAR_INIT(false);
+    std::atomic<bool> connected = ATOMIC_VAR_INIT(false);
+
+    RingBuffer<uint8_t> sampleBuffer;
+    RingBuffer<uint8_t> spectrumSampleBuffer;
+    int spectrumTapId = -1;
+
+    // Wakes up waitForSamples() once samplesWanted samples are buffered
+    std::mutex sampleMutex;
+    std::condition_variable samplesAvailable;
+    std::atomic<int32_t> samplesWanted = ATOMIC_VAR_INIT(0);
+
+    // Samples received while sampleBuffer was full
+    OverrunCounter overruns;
+};
+
+#endif // _CRTL_TCP_H
@@ -30,69 +30,277 @@
 #ifndef __VIRTUAL_INPUT
 #define __VIRTUAL_INPUT
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
 #include <memory>
-#include <fstream>
+#include <mutex>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
 #include "dab-constants.h"
+#include "iq_recorder.h"
+#include "latency-trace.h"
 #include "radio-controller.h"
 #include "ringbuffer.h"
 
+/* The samples a device had to drop because the receiver did not read
+ * them in time, and the fill of its buffer. Updated by the sample thread
+ * of the device for every block it received, read from any thread. */
+class OverrunCounter {
+public:
+    // Returns true when an overrun starts, i.e. the previous block fit
+    bool count(int32_t bufferedSamples, uint32_t dropped) {
+        if (bufferedSamples > maxBuffered.load(std::memory_order_relaxed)) {
+            maxBuffered.store(bufferedSamples, std::memory_order_relaxed);
+        }
+
+        if (dropped == 0) {
+            overrunning = false;
+            return false;
+        }
+
+        droppedSamples.fetch_add(dropped, std::memory_order_relaxed);
+        if (overrunning) {
+            return false;
+        }
+        overrunning = true;
+        overruns.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Adds the counts to the stats
+    void addTo(InputStats& stats) const {
+        stats.maxBufferedSamples = std::max(stats.maxBufferedSamples,
+                maxBuffered.load(std::memory_order_relaxed));
+        stats.droppedSamples += droppedSamples.load(std::memory_order_relaxed);
+        stats.overruns += overruns.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int32_t> maxBuffered = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> droppedSamples = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> overruns = ATOMIC_VAR_INIT(0);
+    bool overrunning = false; // sample thread only
+};
+
+/* The capture time of the samples in the ring of a device. The sample
+ * thread counts the samples it put into the ring, the newest of them
+ * arrived just now. The samples after it in the ring were captured at
+ * INPUT_RATE before, so the estimate is as good as the arrival time of
+ * a transfer, a fraction of a ms for a rtl-sdr. */
+class SampleClock {
+public:
+    // From the sample thread, for the samples just put into the ring
+    void received(int32_t samples) {
+        if (samples <= 0) {
+            return;
+        }
+        total.store(total.load(std::memory_order_relaxed) + samples, std::memory_order_relaxed);
+        newestNs.store(LatencyStamp::now(), std::memory_order_release);
+    }
+
+    // Of the sample read last, once the reader left buffered samples in the ring
+    LatencyStamp stamp(int32_t buffered) const {
+        LatencyStamp s;
+        const int64_t newest = newestNs.load(std::memory_order_acquire);
+        const uint64_t count = total.load(std::memory_order_relaxed);
+        if (newest == 0 or count <= (uint64_t)buffered) {
+            return s;
+        }
+        s.sampleIndex = count - buffered - 1;
+        s.capturedNs = newest - (int64_t)buffered * 1000000000 / INPUT_RATE;
+        s.readNs = LatencyStamp::now();
+        return s;
+    }
+
+private:
+    std::atomic<uint64_t> total = ATOMIC_VAR_INIT(0);
+    std::atomic<int64_t> newestNs = ATOMIC_VAR_INIT(0);
+};
+
+/* The USB transfers of a device: a callback per transfer, and as many
+ * transfers in flight as the host may fall behind. Few small transfers
+ * get the samples out of the device sooner, many large ones survive a
+ * busy host without overruns. */
+struct UsbTransferConfig {
+    // 0 keeps the default of the device
+    int count = 0;
+    int bytes = 0;
+
+    // "default", "low-latency", "robust" or "<count>x<bytes>"
+    static UsbTransferConfig fromString(const std::string& spec) {
+        UsbTransferConfig config;
+        if (spec == "default" or spec.empty()) {
+            return config;
+        }
+        else if (spec == "low-latency") {
+            // 1 ms per transfer, 8 ms in flight
+            config.count = 8;
+            config.bytes = 4096;
+            return config;
+        }
+        else if (spec == "robust") {
+            // 16 ms per transfer, 512 ms in flight
+            config.count = 32;
+            config.bytes = 65536;
+            return config;
+        }
+
+        const size_t x = spec.find('x');
+        try {
+            if (x != std::string::npos) {
+                config.count = std::stoi(spec.substr(0, x));
+                config.bytes = std::stoi(spec.substr(x + 1));
+            }
+        }
+        catch (const std::exception&) {
+            config.count = 0;
+        }
+        if (config.count <= 0 or config.bytes <= 0) {
+            throw std::invalid_argument("Unknown USB transfers " + spec);
+        }
+        return config;
+    }
+};
+
 enum class CDeviceID {
     UNKNOWN, NULLDEVICE, AIRSPY, RAWFILE, RTL_SDR, RTL_TCP, SOAPYSDR, ANDROID_RTL_SDR, LIMESDR};
 
 class CVirtualInput : public InputInterface {
 public:
-    virtual ~CVirtualInput() {}
+    virtual ~CVirtualInput() { stopRecording(); }
     virtual CDeviceID getID(void) = 0;
 
-    void writeRecordBufferToFile(std::string &fileanme) {
-        if(!recordBuffer)
-            return;
+    /* Record the raw samples into the file until stopRecording, see
+     * IQRecorder. A recording in progress is replaced. Returns false if
+     * the file cannot be created. */
+    bool startRecording(const std::string& fileName,
+            const IQRecorder::Options& options = IQRecorder::Options()) {
+        stopRecording();
+
+        try {
+            recorder.reset(new IQRecorder(fileName, options));
+        }
+        catch (const std::exception& e) {
+            std::clog << "CVirtualInput: " << e.what() << std::endl;
+            return false;
+        }
+
+        IQRecorder *r = recorder.get();
+        recordTapId = addSampleTap([r](const uint8_t *data, uint32_t size) {
+                r->write(data, size); });
+        return true;
+    }
 
-        std::ofstream rawStream(fileanme, std::ios::binary);
+    // Writes out the samples still buffered, and closes the file
+    void stopRecording(void) {
+        if (recordTapId != -1) {
+            removeSampleTap(recordTapId);
+            recordTapId = -1;
+        }
+        recorder.reset();
+    }
 
-        while (1) {
-            uint8_t data_tmp[1024];
-            const auto available = recordBuffer->GetRingBufferReadAvailable();
+    bool isRecording(void) const {
+        return recorder != nullptr;
+    }
 
-            if (available <= 0) {
-                break;
-            }
+    IQRecorder::Stats getRecordingStats(void) {
+        return recorder ? recorder->getStats() : IQRecorder::Stats();
+    }
 
-            const size_t data_tmpSize = std::min(sizeof(data_tmp), (size_t)available);
-            recordBuffer->getDataFromBuffer(data_tmp, data_tmpSize);
-            rawStream.write((char*)data_tmp, data_tmpSize);
+    // Before the device is started. Returns false if the device does not
+    // support (part of) it, or the sizes are not possible.
+    bool setUsbTransfers(const UsbTransferConfig& config, bool zeroCopy = false) {
+        bool accepted = true;
+        if (config.count > 0) {
+            accepted = setDeviceParam(DeviceParam::UsbTransfers, config.count) and accepted;
+        }
+        if (config.bytes > 0) {
+            accepted = setDeviceParam(DeviceParam::UsbTransferBytes, config.bytes) and accepted;
         }
+        if (zeroCopy) {
+            accepted = setDeviceParam(DeviceParam::UsbZeroCopy, 1) and accepted;
+        }
+        return accepted;
+    }
 
-        rawStream.close();
+    // Secondary consumers of the raw samples (spectrum, recorder, I/Q
+    // streaming) have to register a tap. The device only copies its
+    // samples for the taps that exist. Taps get the data in the native
+    // format of the device and are called from its sample thread, so they
+    // must not block.
+    using SampleTap = std::function<void(const uint8_t *data, uint32_t size)>;
+
+    int addSampleTap(SampleTap tap) {
+        std::lock_guard<std::mutex> lock(tapsMutex);
+        const int id = nextTapId++;
+        taps[id] = std::move(tap);
+        numTaps = taps.size();
+        return id;
     }
 
-    void initRecordBuffer(uint32_t size) {
-        // The ring buffer size has to be power of 2
-        uint32_t bitCount = ceil(log2(size));
-        uint32_t bufferSize = pow(2, bitCount);
+    void removeSampleTap(int id) {
+        std::lock_guard<std::mutex> lock(tapsMutex);
+        taps.erase(id);
+        numTaps = taps.size();
+    }
 
-        try {
-            recordBuffer.reset(new RingBuffer<uint8_t>(bufferSize));
+protected:
+    // Convert interleaved unsigned 8 bit I/Q samples to DSPCOMPLEX.
+    // Written as a plain loop over the float view of the output so that
+    // the compiler can vectorise it (SSE2, AVX2, NEON).
+    static void convertU8ToComplex(const uint8_t* __restrict src, DSPCOMPLEX* dst, int32_t samples) {
+        float* __restrict out = reinterpret_cast<float*>(dst);
+        for (int32_t i = 0; i < 2 * samples; i++) {
+            out[i] = (float(src[i]) - 128.0f) * (1.0f / 128.0f);
         }
+    }
+
+    // Convert up to size samples out of a ring buffer holding unsigned
+    // 8 bit I/Q pairs, directly from its read regions.
+    // Both regions always hold complete I/Q pairs, as long as the reader
+    // only reads an even number of bytes.
+    static int32_t readU8Samples(RingBuffer<uint8_t>& ring, DSPCOMPLEX *buffer, int32_t size) {
+        auto spans = ring.peekRead(2 * size);
+        const int32_t amount = spans.size() & ~1;
+        spans.size1 = std::min(spans.size1, amount);
+        spans.size2 = amount - spans.size1;
 
-        catch (const std::bad_alloc& e) {
-                std::clog << "CVirtualInput: recordBuffer allocation failed (size " << bufferSize * sizeof(uint8_t) << " bytes) : " << e.what() << std::endl;
+        convertU8ToComplex(spans.data1, buffer, spans.size1 / 2);
+        if (spans.size2 > 0) {
+            convertU8ToComplex(spans.data2, buffer + spans.size1 / 2, spans.size2 / 2);
         }
+
+        ring.commitRead(amount);
+        return amount / 2;
     }
 
-protected:
-    void putIntoRecordBuffer(uint8_t &data, uint32_t size) {
-        if(!recordBuffer)
+    bool hasSampleTaps(void) const {
+        return numTaps > 0;
+    }
+
+    void feedSampleTaps(const uint8_t *data, uint32_t size) {
+        if (numTaps == 0)
             return;
 
-        recordBuffer->putDataIntoBuffer(&data, static_cast<int>(size));
-        //std::clog << "CVirtualInput: GetRingBufferReadAvailable() " << recordBuffer->GetRingBufferReadAvailable() << std::endl;
+        std::lock_guard<std::mutex> lock(tapsMutex);
+        for (auto& tap : taps) {
+            tap.second(data, size);
+        }
     }
 
 private:
-    std::unique_ptr<RingBuffer<uint8_t>> recordBuffer;
+    std::unique_ptr<IQRecorder> recorder;
+    int recordTapId = -1;
+
+    std::mutex tapsMutex;
+    std::map<int, SampleTap> taps;
+    std::atomic<size_t> numTaps = ATOMIC_VAR_INIT(0);
+    int nextTapId = 0;
 };
 
 #endif
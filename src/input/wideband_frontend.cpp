@@ -0,0 +1,459 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+
+#include "wideband_frontend.h"
+#include "input_factory.h"
+#include "MathHelper.h"
+#include "thread-config.h"
+
+// Half the bandwidth of a DAB block
+static constexpr int BLOCK_HALF_BANDWIDTH = kHz(768);
+
+// The outermost carriers may exceed the capture by this much. They are
+// attenuated by the anti-aliasing filter, which the FEC copes with.
+static constexpr int EDGE_TOLERANCE = kHz(64);
+
+// Nominal spacing of adjacent blocks, e.g. 5C/5D
+static constexpr int BLOCK_SPACING = kHz(1712);
+
+// Wide samples processed per iteration, about 10ms at 3.2 Msps
+static constexpr int32_t CHUNK_SIZE = 32768;
+
+// The oscillator is re-anchored to the exact phase after this many samples
+static constexpr int32_t MIX_BLOCK = 1024;
+
+// Per channel buffer, has to be a power of 2
+static constexpr uint32_t CHANNEL_BUFFER_SIZE = 1 << 19;
+
+static constexpr int TAPS_PER_PHASE = 48;
+
+static constexpr auto DEVICE_WAIT_TIMEOUT = std::chrono::milliseconds(50);
+
+std::mutex CWidebandFrontend::registryMutex;
+std::map<std::string, std::weak_ptr<CWidebandFrontend>> CWidebandFrontend::registry;
+
+CWidebandFrontend::CWidebandFrontend(std::unique_ptr<CVirtualInput> device, uint32_t sampleRate) :
+    device(std::move(device)),
+    sampleRate(sampleRate),
+    channels(MAX_CHANNELS)
+{
+    if (not this->device->setDeviceParam(DeviceParam::SampleRate, sampleRate)) {
+        throw std::runtime_error("Wideband: " + this->device->getDescription() +
+                " does not support a sample rate of " + std::to_string(sampleRate));
+    }
+
+    // Rational resampling ratio from the wide rate down to INPUT_RATE
+    const uint32_t divisor = std::gcd<uint32_t>(INPUT_RATE, sampleRate);
+    const int interpolation = INPUT_RATE / divisor;
+    const int decimation = sampleRate / divisor;
+
+    // Pass the whole block, the neighbouring block is well in the stopband
+    const float cutoff = 0.49f * INPUT_RATE / sampleRate;
+
+    for (auto& c : channels) {
+        c.resampler.reset(new PolyphaseResampler(interpolation, decimation, TAPS_PER_PHASE, cutoff));
+        c.ring.reset(new RingBuffer<DSPCOMPLEX>(CHANNEL_BUFFER_SIZE));
+        c.overruns.reset(new OverrunCounter);
+    }
+
+    std::clog << "Wideband: " << "Capturing at " << sampleRate << " samples/s, resampling " <<
+        interpolation << "/" << decimation << std::endl;
+
+    thread = std::thread(&CWidebandFrontend::run, this);
+}
+
+CWidebandFrontend::~CWidebandFrontend()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    channelsChanged.notify_all();
+    samplesAvailable.notify_all();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    device->stop();
+}
+
+std::shared_ptr<CWidebandFrontend> CWidebandFrontend::get(RadioControllerInterface& radioController,
+        const std::string& deviceName)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    auto frontend = registry[deviceName].lock();
+    if (frontend) {
+        return frontend;
+    }
+
+    std::unique_ptr<CVirtualInput> device(CInputFactory::GetDevice(radioController, deviceName));
+    if (device->getID() == CDeviceID::NULLDEVICE) {
+        throw std::runtime_error("Wideband: cannot open " + deviceName);
+    }
+
+    frontend = std::make_shared<CWidebandFrontend>(std::move(device));
+    registry[deviceName] = frontend;
+    return frontend;
+}
+
+bool CWidebandFrontend::fits(int frequency, int center) const
+{
+    return std::abs(frequency - center) + BLOCK_HALF_BANDWIDTH <=
+        (int)sampleRate / 2 + EDGE_TOLERANCE;
+}
+
+void CWidebandFrontend::updateCenter()
+{
+    for (auto& c : channels) {
+        c.phaseIncrement = -2 * M_PI * (double)(c.frequency - centerFrequency) / sampleRate;
+    }
+}
+
+bool CWidebandFrontend::tune(int channel, int frequency)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Channel& c = channels.at(channel);
+    c.frequency = frequency;
+
+    std::vector<int> wanted = { frequency };
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        if (i != channel and channels[i].active and channels[i].inBand) {
+            wanted.push_back(channels[i].frequency);
+        }
+    }
+
+    auto fitsAll = [&](int center) {
+        return std::all_of(wanted.begin(), wanted.end(),
+                [&](int f) { return fits(f, center); });
+    };
+
+    int center = centerFrequency;
+    if (centerFrequency == 0 or not fitsAll(centerFrequency)) {
+        if (wanted.size() == 1) {
+            // Keep the DC spike out of the block, and leave room for the
+            // next block above
+            center = frequency + std::min(BLOCK_SPACING / 2,
+                    (int)sampleRate / 2 - BLOCK_HALF_BANDWIDTH);
+        }
+        else {
+            const auto range = std::minmax_element(wanted.begin(), wanted.end());
+            center = (*range.first + *range.second) / 2;
+        }
+    }
+
+    c.inBand = fitsAll(center);
+    if (not c.inBand) {
+        std::clog << "Wideband: " << frequency << " Hz does not fit into the capture at " <<
+            centerFrequency << " Hz" << std::endl;
+        return false;
+    }
+
+    if (center != centerFrequency) {
+        std::clog << "Wideband: " << "Tuning to " << center << " Hz" << std::endl;
+        centerFrequency = center;
+        device->setFrequency(center);
+        if (activeChannels == 0) {
+            device->stop();
+        }
+    }
+
+    updateCenter();
+    return true;
+}
+
+int CWidebandFrontend::getFrequency(int channel) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return channels.at(channel).frequency;
+}
+
+bool CWidebandFrontend::isInBand(int channel) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return channels.at(channel).inBand;
+}
+
+void CWidebandFrontend::start(int channel)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        Channel& c = channels.at(channel);
+        if (c.active) {
+            return;
+        }
+
+        c.phase = 0;
+        c.resampler->reset();
+        c.ring->FlushRingBuffer();
+        c.active = true;
+
+        if (activeChannels++ == 0) {
+            device->restart();
+        }
+    }
+    channelsChanged.notify_all();
+}
+
+void CWidebandFrontend::stop(int channel)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        Channel& c = channels.at(channel);
+        if (not c.active) {
+            return;
+        }
+
+        c.active = false;
+
+        if (--activeChannels == 0) {
+            device->stop();
+        }
+    }
+    samplesAvailable.notify_all();
+}
+
+int32_t CWidebandFrontend::getSamples(int channel, DSPCOMPLEX *buffer, int32_t size)
+{
+    RingBuffer<DSPCOMPLEX>& ring = *channels.at(channel).ring;
+    return ring.getDataFromBuffer(buffer, std::min(size, ring.GetRingBufferReadAvailable()));
+}
+
+int32_t CWidebandFrontend::getSamplesToRead(int channel)
+{
+    return channels.at(channel).ring->GetRingBufferReadAvailable();
+}
+
+InputStats CWidebandFrontend::getInputStats(int channel)
+{
+    const Channel& c = channels.at(channel);
+    InputStats stats = device->getInputStats();
+    stats.bufferedSamples = c.ring->GetRingBufferReadAvailable();
+    stats.bufferSize = c.ring->GetBufferSize();
+    stats.maxBufferedSamples = 0;
+    // The buffer of the device is shared, it counts for none of them
+    stats.memoryBytes = c.ring->GetBufferSize() * sizeof(DSPCOMPLEX);
+    c.overruns->addTo(stats);
+    return stats;
+}
+
+int32_t CWidebandFrontend::waitForSamples(int channel, int32_t count, std::chrono::milliseconds timeout)
+{
+    Channel& c = channels.at(channel);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    samplesAvailable.wait_for(lock, timeout, [&] {
+            return c.ring->GetRingBufferReadAvailable() >= count or
+                not c.active or not running; });
+
+    return c.ring->GetRingBufferReadAvailable();
+}
+
+void CWidebandFrontend::mix(Channel& c, const DSPCOMPLEX *in, DSPCOMPLEX *out, int32_t n)
+{
+    const DSPCOMPLEX step = std::polar(1.0f, (float)c.phaseIncrement);
+
+    for (int32_t i = 0; i < n; i += MIX_BLOCK) {
+        const int32_t end = std::min(n, i + MIX_BLOCK);
+
+        DSPCOMPLEX oscillator = std::polar(1.0f, (float)c.phase);
+        for (int32_t j = i; j < end; j++) {
+            out[j] = in[j] * oscillator;
+            oscillator *= step;
+        }
+
+        c.phase = std::fmod(c.phase + (end - i) * c.phaseIncrement, 2 * M_PI);
+    }
+}
+
+void CWidebandFrontend::run()
+{
+    threading::ScopedThread threadConfig(ThreadStage::Input, "wideband");
+
+    std::vector<DSPCOMPLEX> wide(CHUNK_SIZE);
+    std::vector<DSPCOMPLEX> mixed(CHUNK_SIZE);
+
+    while (running) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            channelsChanged.wait(lock, [&] { return activeChannels > 0 or not running; });
+        }
+
+        device->waitForSamples(CHUNK_SIZE, DEVICE_WAIT_TIMEOUT);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (activeChannels == 0) {
+                continue;
+            }
+
+            const int32_t n = device->getSamples(wide.data(), CHUNK_SIZE);
+            if (n <= 0) {
+                continue;
+            }
+
+            for (auto& c : channels) {
+                if (not c.active or not c.inBand) {
+                    continue;
+                }
+
+                mix(c, wide.data(), mixed.data(), n);
+
+                c.output.clear();
+                c.resampler->process(mixed.data(), n, c.output);
+                const int32_t written = c.ring->putDataIntoBuffer(c.output.data(), c.output.size());
+                if (c.overruns->count(c.ring->GetRingBufferReadAvailable(), c.output.size() - written)) {
+                    std::clog << "Wideband: " << "Receiver of channel " << (&c - channels.data()) <<
+                        " does not keep up, dropping samples" << std::endl;
+                }
+            }
+        }
+
+        samplesAvailable.notify_all();
+    }
+}
+
+CChannelInput::CChannelInput(std::shared_ptr<CWidebandFrontend> frontend, int channel) :
+    frontend(std::move(frontend)),
+    channel(channel)
+{
+    if (channel < 0 or channel >= CWidebandFrontend::MAX_CHANNELS) {
+        throw std::runtime_error("Wideband: invalid channel " + std::to_string(channel));
+    }
+}
+
+CChannelInput::~CChannelInput()
+{
+    stop();
+}
+
+void CChannelInput::setFrequency(int Frequency)
+{
+    frontend->tune(channel, Frequency);
+}
+
+int CChannelInput::getFrequency() const
+{
+    return frontend->getFrequency(channel);
+}
+
+bool CChannelInput::restart()
+{
+    frontend->start(channel);
+    return true;
+}
+
+bool CChannelInput::is_ok()
+{
+    return frontend->isInBand(channel) and frontend->getDevice().is_ok();
+}
+
+void CChannelInput::stop()
+{
+    frontend->stop(channel);
+}
+
+void CChannelInput::reset()
+{
+    frontend->getDevice().reset();
+}
+
+int32_t CChannelInput::getSamples(DSPCOMPLEX *buffer, int32_t size)
+{
+    return frontend->getSamples(channel, buffer, size);
+}
+
+std::vector<DSPCOMPLEX> CChannelInput::getSpectrumSamples(int size)
+{
+    // The spectrum of the whole capture
+    return frontend->getDevice().getSpectrumSamples(size);
+}
+
+int32_t CChannelInput::getSamplesToRead()
+{
+    return frontend->getSamplesToRead(channel);
+}
+
+int32_t CChannelInput::waitForSamples(int32_t count, std::chrono::milliseconds timeout)
+{
+    return frontend->waitForSamples(channel, count, timeout);
+}
+
+InputStats CChannelInput::getInputStats()
+{
+    return frontend->getInputStats(channel);
+}
+
+float CChannelInput::getGain() const
+{
+    return frontend->getDevice().getGain();
+}
+
+float CChannelInput::setGain(int gain)
+{
+    return frontend->getDevice().setGain(gain);
+}
+
+int CChannelInput::getGainCount()
+{
+    return frontend->getDevice().getGainCount();
+}
+
+void CChannelInput::setAgc(bool AGC)
+{
+    frontend->getDevice().setAgc(AGC);
+}
+
+std::string CChannelInput::getDescription()
+{
+    return "Channel " + std::to_string(channel) + " of " + frontend->getDevice().getDescription();
+}
+
+CDeviceID CChannelInput::getID()
+{
+    return frontend->getDevice().getID();
+}
+
+CChannelInput* CChannelInput::fromDeviceArgs(RadioControllerInterface& radioController,
+        const std::string& args)
+{
+    const size_t colon = args.find(':');
+    if (colon == std::string::npos or colon == 0) {
+        throw std::runtime_error("Wideband: expected \"<channel>:<device>\", got \"" + args + "\"");
+    }
+
+    const int channel = std::stoi(args.substr(0, colon));
+    return new CChannelInput(CWidebandFrontend::get(radioController, args.substr(colon + 1)), channel);
+}
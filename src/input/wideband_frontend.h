@@ -0,0 +1,160 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef WIDEBAND_FRONTEND_H
+#define WIDEBAND_FRONTEND_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "virtual_input.h"
+#include "dab-constants.h"
+#include "radio-controller.h"
+#include "ringbuffer.h"
+#include "polyphase_resampler.h"
+
+// Captures several adjacent DAB blocks with a single tuner. The parent
+// device runs at a higher sample rate, and every channel is shifted to
+// baseband by its own oscillator and brought down to INPUT_RATE by a
+// polyphase resampler. Each channel feeds one OFDMProcessor through a
+// CChannelInput.
+//
+// At 3.2 Msps, two blocks at the usual 1.712 MHz spacing (e.g. 5C/5D or
+// 11C/11D) fit into one capture, with the outer carriers close to the
+// band edge.
+class CWidebandFrontend {
+public:
+    static constexpr uint32_t WIDEBAND_RATE = 3200000;
+    static constexpr int MAX_CHANNELS = 4;
+
+    CWidebandFrontend(std::unique_ptr<CVirtualInput> device, uint32_t sampleRate = WIDEBAND_RATE);
+    ~CWidebandFrontend(void);
+    CWidebandFrontend(const CWidebandFrontend&) = delete;
+    void operator=(const CWidebandFrontend&) = delete;
+
+    // All channels on the same parent device share one front-end. The
+    // parent is opened on first use, and reports its messages to the
+    // radio controller it was opened with.
+    static std::shared_ptr<CWidebandFrontend> get(RadioControllerInterface& radioController,
+            const std::string& deviceName);
+
+    // Returns false if the channel does not fit into the capture together
+    // with the other active channels.
+    bool tune(int channel, int frequency);
+    int getFrequency(int channel) const;
+    bool isInBand(int channel) const;
+    void start(int channel);
+    void stop(int channel);
+
+    int32_t getSamples(int channel, DSPCOMPLEX *buffer, int32_t size);
+    int32_t getSamplesToRead(int channel);
+    int32_t waitForSamples(int channel, int32_t count, std::chrono::milliseconds timeout);
+    // The ring of the channel, and the overruns of the parent device
+    InputStats getInputStats(int channel);
+
+    CVirtualInput& getDevice(void) { return *device; }
+    uint32_t getSampleRate(void) const { return sampleRate; }
+
+private:
+    struct Channel {
+        int frequency = 0;
+        bool active = false;
+        bool inBand = true;
+
+        double phase = 0;
+        double phaseIncrement = 0;
+
+        std::unique_ptr<PolyphaseResampler> resampler;
+        std::unique_ptr<RingBuffer<DSPCOMPLEX>> ring;
+        std::unique_ptr<OverrunCounter> overruns;
+        std::vector<DSPCOMPLEX> output;
+    };
+
+    bool fits(int frequency, int center) const;
+    void updateCenter(void);
+    void mix(Channel& c, const DSPCOMPLEX *in, DSPCOMPLEX *out, int32_t n);
+    void run(void);
+
+    std::unique_ptr<CVirtualInput> device;
+    const uint32_t sampleRate;
+
+    // Guards the channel configuration and the center frequency
+    mutable std::mutex mutex;
+    std::condition_variable channelsChanged;
+    std::condition_variable samplesAvailable;
+    std::vector<Channel> channels;
+    int centerFrequency = 0;
+    int activeChannels = 0;
+
+    std::atomic<bool> running = ATOMIC_VAR_INIT(true);
+    std::thread thread;
+
+    static std::mutex registryMutex;
+    static std::map<std::string, std::weak_ptr<CWidebandFrontend>> registry;
+};
+
+// One DAB block out of a wideband capture, as seen by the OFDMProcessor.
+// Gain and AGC settings apply to the shared parent device.
+class CChannelInput : public CVirtualInput {
+public:
+    CChannelInput(std::shared_ptr<CWidebandFrontend> frontend, int channel);
+    ~CChannelInput(void);
+
+    // Interface methods
+    void setFrequency(int Frequency);
+    int getFrequency(void) const;
+    bool restart(void);
+    bool is_ok(void);
+    void stop(void);
+    void reset(void);
+    int32_t getSamples(DSPCOMPLEX* buffer, int32_t size);
+    std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
+    int32_t getSamplesToRead(void);
+    int32_t waitForSamples(int32_t count, std::chrono::milliseconds timeout);
+    InputStats getInputStats(void);
+    float getGain(void) const;
+    float setGain(int gain);
+    int getGainCount(void);
+    void setAgc(bool AGC);
+    std::string getDescription(void);
+    CDeviceID getID(void);
+
+    // Parse the device argument "<channel>:<parent device>"
+    static CChannelInput* fromDeviceArgs(RadioControllerInterface& radioController,
+            const std::string& args);
+
+private:
+    std::shared_ptr<CWidebandFrontend> frontend;
+    const int channel;
+};
+
+#endif // WIDEBAND_FRONTEND_H
@@ -50,57 +50,6 @@ static inline float l1_norm(const std::complex<float>& z)
     return std::abs(z.real()) + std::abs(z.imag());
 }
 
-static inline bool check_CRC_bits(const uint8_t *in, int size)
-{
-    static const uint8_t crcPolynome[] = { 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0 }; // MSB .. LSB
-    uint8_t b[16];
-    memset(b, 1, 16);
-
-    for (int i = 0; i < size; i++) {
-        uint8_t d = in[i];
-        if (i >= size - 16) {
-            d ^= 1;
-        }
-
-        if ((b[0] ^ d) == 1) {
-            for (int f = 0; f < 15; f++)
-                b[f] = crcPolynome[f] ^ b[f + 1];
-            b[15] = 1;
-        }
-        else {
-            memmove(&b[0], &b[1], sizeof(uint8_t) * 15); // Shift
-            b[15] = 0;
-        }
-    }
-
-    uint16_t crc = 0;
-    for (int i = 0; i < 16; i++)
-        crc |= b[i] << i;
-    return crc == 0;
-}
-
-static inline bool check_crc_bytes(const uint8_t *msg, int len)
-{
-    uint16_t accumulator = 0xFFFF;
-    const uint16_t genpoly = 0x1021;
-
-    for (int i = 0; i < len; i++) {
-        int16_t data = msg[i] << 8;
-        for (int j = 8; j > 0; j--) {
-            if ((data ^ accumulator) & 0x8000)
-                accumulator = ((accumulator << 1) ^ genpoly) & 0xFFFF;
-            else
-                accumulator = (accumulator << 1) & 0xFFFF;
-            data = (data << 1) & 0xFFFF;
-        }
-    }
-    //
-    // ok, now check with the crc that is contained
-    // in the au
-    uint16_t crc = ~((msg[len] << 8) | msg[len + 1]) & 0xFFFF;
-    return (crc ^ accumulator) == 0;
-}
-
 static inline uint32_t getBits(const uint8_t* d, int16_t offset, uint8_t size)
 {
     if (size > 32) {
@@ -109,6 +109,35 @@ ssize_t Socket::send(const void *buffer, size_t length, int flags)
     return ::send(sock, (const char*)buffer, length, flags);
 }
 
+bool Socket::setReceiveTimeout(int timeout_ms)
+{
+#if defined(_WIN32)
+    DWORD timeout = timeout_ms;
+    return setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout)) == 0;
+#else
+    struct timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    return setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0;
+#endif
+}
+
+bool Socket::setNonBlocking()
+{
+#if defined(_WIN32)
+    unsigned long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    const int flags = fcntl(sock, F_GETFL, 0);
+    return flags != -1 and fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+int Socket::descriptor() const
+{
+    return sock;
+}
+
 bool Socket::bind(int port)
 {
     if (valid()) {
@@ -151,9 +180,9 @@ bool Socket::bind(int port)
     return true;
 }
 
-bool Socket::listen()
+bool Socket::listen(int backlog)
 {
-    const int listen_ret = ::listen(sock, 1);
+    const int listen_ret = ::listen(sock, backlog);
     if (listen_ret == -1) {
         perror("Could not listen");
         return false;
@@ -167,7 +196,7 @@ Socket Socket::accept()
     socklen_t remote_addr_len = sizeof(remote_addr);
     int conn = ::accept(sock, (sockaddr*)&remote_addr, &remote_addr_len);
     if (conn == -1) {
-        if (errno == ECONNABORTED) {
+        if (errno == ECONNABORTED or errno == EAGAIN or errno == EWOULDBLOCK) {
             return {};
         }
         perror("accept failed");
@@ -71,10 +71,17 @@ class Socket {
 
         // Binds to any address
         bool bind(int port);
-        bool listen();
+        bool listen(int backlog = 1);
         Socket accept();
         bool connect(const std::string& address, int port, int timeout);
 
+        // Let recv() return with EAGAIN if no data arrives within timeout_ms
+        bool setReceiveTimeout(int timeout_ms);
+
+        // For sockets served by an event loop like epoll
+        bool setNonBlocking(void);
+        int descriptor(void) const;
+
         ssize_t recv(void *buffer, size_t length, int flags);
         ssize_t send(const void *buffer, size_t length, int flags);
 
@@ -0,0 +1,797 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DSP_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// vsqrtq_f32 only exists on 64 bit ARM, 32 bit builds use the scalar set
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define DSP_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+#include "dsp-kernels.h"
+
+namespace dsp {
+
+/* Scalar reference implementations. They are also used for the
+ * remainder of the vector loops. */
+namespace scalar {
+
+static void scale(DSPCOMPLEX *v, size_t n, float factor)
+{
+    float *f = reinterpret_cast<float*>(v);
+    for (size_t i = 0; i < 2 * n; i++) {
+        f[i] *= factor;
+    }
+}
+
+/* sqrt(re^2 + im^2) instead of std::abs, which goes through hypot.
+ * This is what the vector sets compute, and the signals are far from
+ * the range where hypot makes a difference. */
+static void magnitude(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = std::sqrt(f[2 * i] * f[2 * i] + f[2 * i + 1] * f[2 * i + 1]);
+    }
+}
+
+static float sumMagnitude(const DSPCOMPLEX *in, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    float sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += std::sqrt(f[2 * i] * f[2 * i] + f[2 * i + 1] * f[2 * i + 1]);
+    }
+    return sum;
+}
+
+static void l1Norm(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = std::fabs(f[2 * i]) + std::fabs(f[2 * i + 1]);
+    }
+}
+
+static void xorBytes(uint8_t *data, const uint8_t *pattern, size_t n)
+{
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t d, p;
+        memcpy(&d, data + i, sizeof(d));
+        memcpy(&p, pattern + i, sizeof(p));
+        d ^= p;
+        memcpy(data + i, &d, sizeof(d));
+    }
+
+    for (; i < n; i++) {
+        data[i] ^= pattern[i];
+    }
+}
+
+static ByteRange byteRange(const uint8_t *data, size_t n)
+{
+    ByteRange r = { 255, 0, 0 };
+    for (size_t i = 0; i < n; i++) {
+        r.min = std::min(r.min, data[i]);
+        r.max = std::max(r.max, data[i]);
+        r.clipped += (data[i] == 0 or data[i] == 255);
+    }
+    return r;
+}
+
+// Combine the statistics of two parts of a block
+static ByteRange merge(ByteRange a, ByteRange b)
+{
+    return { std::min(a.min, b.min), std::max(a.max, b.max), a.clipped + b.clipped };
+}
+
+/* atan(a) for 0 <= a <= 1, an odd polynomial of degree 11, less than
+ * 2e-6 rad off. The vector sets evaluate it in the same order. */
+static const float atanCoeffs[] = {
+    0.99997726f, -0.33262347f, 0.19354346f, -0.11643287f, 0.05265332f, -0.01172120f };
+
+/* Keeps 0 / 0 out of the division, the result is 0 then. As the smallest
+ * float above 0, it leaves the ratio of any other z alone. */
+static const float minDivisor = std::numeric_limits<float>::denorm_min();
+
+static inline float atan2(float y, float x)
+{
+    const float ax = std::fabs(x);
+    const float ay = std::fabs(y);
+    const float a = std::min(ax, ay) / std::max(std::max(ax, ay), minDivisor);
+    const float s = a * a;
+    float r = atanCoeffs[5];
+    for (int k = 4; k >= 0; k--) {
+        r = r * s + atanCoeffs[k];
+    }
+    r = r * a;
+    if (ay > ax) {
+        r = (float)M_PI_2 - r;
+    }
+    if (x < 0) {
+        r = (float)M_PI - r;
+    }
+    return std::copysign(r, y);
+}
+
+static void phase(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = atan2(f[2 * i + 1], f[2 * i]);
+    }
+}
+
+static void phaseDifference(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    for (size_t i = 0; i < n; i++) {
+        const float ar = f[2 * i], ai = f[2 * i + 1];
+        const float br = f[2 * i + 2], bi = f[2 * i + 3];
+        out[i] = atan2(ai * br - ar * bi, ar * br + ai * bi);
+    }
+}
+
+static const Kernels kernels = {
+    KernelSet::Scalar, scale, magnitude, sumMagnitude, l1Norm, xorBytes,
+    byteRange, phase, phaseDifference };
+
+} // namespace scalar
+
+#ifdef DSP_KERNELS_X86
+/* The functions are compiled for their instruction set only, the rest
+ * of the library keeps the baseline of the build. */
+namespace sse4 {
+
+#define SSE4_TARGET __attribute__((target("sse4.1")))
+
+SSE4_TARGET static void scale(DSPCOMPLEX *v, size_t n, float factor)
+{
+    float *f = reinterpret_cast<float*>(v);
+    const __m128 k = _mm_set1_ps(factor);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_ps(f + 2 * i, _mm_mul_ps(_mm_loadu_ps(f + 2 * i), k));
+    }
+    scalar::scale(v + i, n - i, factor);
+}
+
+// |z|^2 of four complex values, in order
+SSE4_TARGET static inline __m128 norm4(const float *f)
+{
+    const __m128 a = _mm_loadu_ps(f);
+    const __m128 b = _mm_loadu_ps(f + 4);
+    return _mm_hadd_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b));
+}
+
+SSE4_TARGET static void magnitude(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(out + i, _mm_sqrt_ps(norm4(f + 2 * i)));
+    }
+    scalar::magnitude(in + i, out + i, n - i);
+}
+
+SSE4_TARGET static float sumMagnitude(const DSPCOMPLEX *in, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    __m128 acc = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm_add_ps(acc, _mm_sqrt_ps(norm4(f + 2 * i)));
+    }
+    acc = _mm_hadd_ps(acc, acc);
+    acc = _mm_hadd_ps(acc, acc);
+    return _mm_cvtss_f32(acc) + scalar::sumMagnitude(in + i, n - i);
+}
+
+SSE4_TARGET static void l1Norm(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128 a = _mm_and_ps(_mm_loadu_ps(f + 2 * i), absMask);
+        const __m128 b = _mm_and_ps(_mm_loadu_ps(f + 2 * i + 4), absMask);
+        _mm_storeu_ps(out + i, _mm_hadd_ps(a, b));
+    }
+    scalar::l1Norm(in + i, out + i, n - i);
+}
+
+SSE4_TARGET static void xorBytes(uint8_t *data, const uint8_t *pattern, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(d, p));
+    }
+    scalar::xorBytes(data + i, pattern + i, n - i);
+}
+
+// The smallest and the largest byte of v
+SSE4_TARGET static inline uint8_t hmin(__m128i v)
+{
+    v = _mm_min_epu8(v, _mm_srli_si128(v, 8));
+    v = _mm_min_epu8(v, _mm_srli_si128(v, 4));
+    v = _mm_min_epu8(v, _mm_srli_si128(v, 2));
+    v = _mm_min_epu8(v, _mm_srli_si128(v, 1));
+    return _mm_cvtsi128_si32(v) & 0xff;
+}
+
+SSE4_TARGET static inline uint8_t hmax(__m128i v)
+{
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+    return _mm_cvtsi128_si32(v) & 0xff;
+}
+
+SSE4_TARGET static ByteRange byteRange(const uint8_t *data, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi8((char)0xff);
+    __m128i lo = full;
+    __m128i hi = zero;
+    size_t clipped = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        lo = _mm_min_epu8(lo, d);
+        hi = _mm_max_epu8(hi, d);
+        const __m128i clip = _mm_or_si128(_mm_cmpeq_epi8(d, zero), _mm_cmpeq_epi8(d, full));
+        clipped += __builtin_popcount(_mm_movemask_epi8(clip));
+    }
+
+    const ByteRange r = { hmin(lo), hmax(hi), clipped };
+    return i == n ? r : scalar::merge(r, scalar::byteRange(data + i, n - i));
+}
+
+// scalar::atan2 of four values
+SSE4_TARGET static inline __m128 atan2(__m128 y, __m128 x)
+{
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 ax = _mm_and_ps(x, absMask);
+    const __m128 ay = _mm_and_ps(y, absMask);
+    const __m128 a = _mm_div_ps(_mm_min_ps(ax, ay),
+            _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(scalar::minDivisor)));
+    const __m128 s = _mm_mul_ps(a, a);
+    __m128 r = _mm_set1_ps(scalar::atanCoeffs[5]);
+    for (int k = 4; k >= 0; k--) {
+        r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(scalar::atanCoeffs[k]));
+    }
+    r = _mm_mul_ps(r, a);
+    r = _mm_blendv_ps(r, _mm_sub_ps(_mm_set1_ps((float)M_PI_2), r), _mm_cmpgt_ps(ay, ax));
+    r = _mm_blendv_ps(r, _mm_sub_ps(_mm_set1_ps((float)M_PI), r), _mm_cmplt_ps(x, _mm_setzero_ps()));
+    return _mm_or_ps(r, _mm_andnot_ps(absMask, y));
+}
+
+// The real and imaginary parts of four complex values
+SSE4_TARGET static inline void split4(const float *f, __m128& re, __m128& im)
+{
+    const __m128 a = _mm_loadu_ps(f);
+    const __m128 b = _mm_loadu_ps(f + 4);
+    re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+SSE4_TARGET static void phase(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 re, im;
+        split4(f + 2 * i, re, im);
+        _mm_storeu_ps(out + i, atan2(im, re));
+    }
+    scalar::phase(in + i, out + i, n - i);
+}
+
+SSE4_TARGET static void phaseDifference(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 ar, ai, br, bi;
+        split4(f + 2 * i, ar, ai);
+        split4(f + 2 * i + 2, br, bi);
+        const __m128 re = _mm_add_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+        const __m128 im = _mm_sub_ps(_mm_mul_ps(ai, br), _mm_mul_ps(ar, bi));
+        _mm_storeu_ps(out + i, atan2(im, re));
+    }
+    scalar::phaseDifference(in + i, out + i, n - i);
+}
+
+static const Kernels kernels = {
+    KernelSet::SSE4, scale, magnitude, sumMagnitude, l1Norm, xorBytes,
+    byteRange, phase, phaseDifference };
+
+} // namespace sse4
+
+namespace avx2 {
+
+// Without fma, the products are rounded like in the other sets
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static void scale(DSPCOMPLEX *v, size_t n, float factor)
+{
+    float *f = reinterpret_cast<float*>(v);
+    const __m256 k = _mm256_set1_ps(factor);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_ps(f + 2 * i, _mm256_mul_ps(_mm256_loadu_ps(f + 2 * i), k));
+    }
+    sse4::scale(v + i, n - i, factor);
+}
+
+/* _mm256_hadd_ps works within the 128 bit lanes, which leaves the
+ * pairs of results in the order 0 1 4 5 2 3 6 7 */
+AVX2_TARGET static inline __m256 inOrder(__m256 h)
+{
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(
+                _mm256_castps_pd(h), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+// |z|^2 of eight complex values, in order
+AVX2_TARGET static inline __m256 norm8(const float *f)
+{
+    const __m256 a = _mm256_loadu_ps(f);
+    const __m256 b = _mm256_loadu_ps(f + 8);
+    return inOrder(_mm256_hadd_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b)));
+}
+
+AVX2_TARGET static void magnitude(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_sqrt_ps(norm8(f + 2 * i)));
+    }
+    sse4::magnitude(in + i, out + i, n - i);
+}
+
+AVX2_TARGET static float sumMagnitude(const DSPCOMPLEX *in, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    __m256 acc = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc = _mm256_add_ps(acc, _mm256_sqrt_ps(norm8(f + 2 * i)));
+    }
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    return _mm_cvtss_f32(sum) + sse4::sumMagnitude(in + i, n - i);
+}
+
+AVX2_TARGET static void l1Norm(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 a = _mm256_and_ps(_mm256_loadu_ps(f + 2 * i), absMask);
+        const __m256 b = _mm256_and_ps(_mm256_loadu_ps(f + 2 * i + 8), absMask);
+        _mm256_storeu_ps(out + i, inOrder(_mm256_hadd_ps(a, b)));
+    }
+    sse4::l1Norm(in + i, out + i, n - i);
+}
+
+AVX2_TARGET static void xorBytes(uint8_t *data, const uint8_t *pattern, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pattern + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(d, p));
+    }
+    sse4::xorBytes(data + i, pattern + i, n - i);
+}
+
+AVX2_TARGET static ByteRange byteRange(const uint8_t *data, size_t n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi8((char)0xff);
+    __m256i lo = full;
+    __m256i hi = zero;
+    size_t clipped = 0;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        lo = _mm256_min_epu8(lo, d);
+        hi = _mm256_max_epu8(hi, d);
+        const __m256i clip = _mm256_or_si256(_mm256_cmpeq_epi8(d, zero), _mm256_cmpeq_epi8(d, full));
+        clipped += __builtin_popcount((uint32_t)_mm256_movemask_epi8(clip));
+    }
+
+    const ByteRange r = {
+        sse4::hmin(_mm_min_epu8(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1))),
+        sse4::hmax(_mm_max_epu8(_mm256_castsi256_si128(hi), _mm256_extracti128_si256(hi, 1))),
+        clipped };
+    return i == n ? r : scalar::merge(r, sse4::byteRange(data + i, n - i));
+}
+
+// scalar::atan2 of eight values
+AVX2_TARGET static inline __m256 atan2(__m256 y, __m256 x)
+{
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 ax = _mm256_and_ps(x, absMask);
+    const __m256 ay = _mm256_and_ps(y, absMask);
+    const __m256 a = _mm256_div_ps(_mm256_min_ps(ax, ay),
+            _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(scalar::minDivisor)));
+    const __m256 s = _mm256_mul_ps(a, a);
+    __m256 r = _mm256_set1_ps(scalar::atanCoeffs[5]);
+    for (int k = 4; k >= 0; k--) {
+        r = _mm256_add_ps(_mm256_mul_ps(r, s), _mm256_set1_ps(scalar::atanCoeffs[k]));
+    }
+    r = _mm256_mul_ps(r, a);
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps((float)M_PI_2), r),
+            _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps((float)M_PI), r),
+            _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+    return _mm256_or_ps(r, _mm256_andnot_ps(absMask, y));
+}
+
+// The real and imaginary parts of eight complex values, in order
+AVX2_TARGET static inline void split8(const float *f, __m256& re, __m256& im)
+{
+    const __m256 a = _mm256_loadu_ps(f);
+    const __m256 b = _mm256_loadu_ps(f + 8);
+    re = inOrder(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+    im = inOrder(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+AVX2_TARGET static void phase(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 re, im;
+        split8(f + 2 * i, re, im);
+        _mm256_storeu_ps(out + i, atan2(im, re));
+    }
+    sse4::phase(in + i, out + i, n - i);
+}
+
+AVX2_TARGET static void phaseDifference(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 ar, ai, br, bi;
+        split8(f + 2 * i, ar, ai);
+        split8(f + 2 * i + 2, br, bi);
+        const __m256 re = _mm256_add_ps(_mm256_mul_ps(ar, br), _mm256_mul_ps(ai, bi));
+        const __m256 im = _mm256_sub_ps(_mm256_mul_ps(ai, br), _mm256_mul_ps(ar, bi));
+        _mm256_storeu_ps(out + i, atan2(im, re));
+    }
+    sse4::phaseDifference(in + i, out + i, n - i);
+}
+
+static const Kernels kernels = {
+    KernelSet::AVX2, scale, magnitude, sumMagnitude, l1Norm, xorBytes,
+    byteRange, phase, phaseDifference };
+
+} // namespace avx2
+#endif // DSP_KERNELS_X86
+
+#ifdef DSP_KERNELS_NEON
+namespace neon {
+
+static void scale(DSPCOMPLEX *v, size_t n, float factor)
+{
+    float *f = reinterpret_cast<float*>(v);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        vst1q_f32(f + 2 * i, vmulq_n_f32(vld1q_f32(f + 2 * i), factor));
+    }
+    scalar::scale(v + i, n - i, factor);
+}
+
+// |z|^2 of four complex values, vld2q splits them into re and im
+static inline float32x4_t norm4(const float *f)
+{
+    const float32x4x2_t z = vld2q_f32(f);
+    return vaddq_f32(vmulq_f32(z.val[0], z.val[0]), vmulq_f32(z.val[1], z.val[1]));
+}
+
+static void magnitude(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(out + i, vsqrtq_f32(norm4(f + 2 * i)));
+    }
+    scalar::magnitude(in + i, out + i, n - i);
+}
+
+static float sumMagnitude(const DSPCOMPLEX *in, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    float32x4_t acc = vdupq_n_f32(0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc = vaddq_f32(acc, vsqrtq_f32(norm4(f + 2 * i)));
+    }
+    return vaddvq_f32(acc) + scalar::sumMagnitude(in + i, n - i);
+}
+
+static void l1Norm(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float32x4x2_t z = vld2q_f32(f + 2 * i);
+        vst1q_f32(out + i, vaddq_f32(vabsq_f32(z.val[0]), vabsq_f32(z.val[1])));
+    }
+    scalar::l1Norm(in + i, out + i, n - i);
+}
+
+static void xorBytes(uint8_t *data, const uint8_t *pattern, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i), vld1q_u8(pattern + i)));
+    }
+    scalar::xorBytes(data + i, pattern + i, n - i);
+}
+
+static ByteRange byteRange(const uint8_t *data, size_t n)
+{
+    uint8x16_t lo = vdupq_n_u8(0xff);
+    uint8x16_t hi = vdupq_n_u8(0);
+    size_t clipped = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16_t d = vld1q_u8(data + i);
+        lo = vminq_u8(lo, d);
+        hi = vmaxq_u8(hi, d);
+        const uint8x16_t clip = vorrq_u8(vceqq_u8(d, vdupq_n_u8(0)), vceqq_u8(d, vdupq_n_u8(0xff)));
+        clipped += vaddvq_u8(vshrq_n_u8(clip, 7));
+    }
+
+    const ByteRange r = { vminvq_u8(lo), vmaxvq_u8(hi), clipped };
+    return i == n ? r : scalar::merge(r, scalar::byteRange(data + i, n - i));
+}
+
+// scalar::atan2 of four values
+static inline float32x4_t atan2(float32x4_t y, float32x4_t x)
+{
+    const float32x4_t ax = vabsq_f32(x);
+    const float32x4_t ay = vabsq_f32(y);
+    const float32x4_t a = vdivq_f32(vminq_f32(ax, ay),
+            vmaxq_f32(vmaxq_f32(ax, ay), vdupq_n_f32(scalar::minDivisor)));
+    const float32x4_t s = vmulq_f32(a, a);
+    float32x4_t r = vdupq_n_f32(scalar::atanCoeffs[5]);
+    for (int k = 4; k >= 0; k--) {
+        r = vaddq_f32(vmulq_f32(r, s), vdupq_n_f32(scalar::atanCoeffs[k]));
+    }
+    r = vmulq_f32(r, a);
+    r = vbslq_f32(vcgtq_f32(ay, ax), vsubq_f32(vdupq_n_f32((float)M_PI_2), r), r);
+    r = vbslq_f32(vcltq_f32(x, vdupq_n_f32(0)), vsubq_f32(vdupq_n_f32((float)M_PI), r), r);
+    const uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(y), vdupq_n_u32(0x80000000));
+    return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(r), sign));
+}
+
+static void phase(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float32x4x2_t z = vld2q_f32(f + 2 * i);
+        vst1q_f32(out + i, atan2(z.val[1], z.val[0]));
+    }
+    scalar::phase(in + i, out + i, n - i);
+}
+
+static void phaseDifference(const DSPCOMPLEX *in, float *out, size_t n)
+{
+    const float *f = reinterpret_cast<const float*>(in);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float32x4x2_t a = vld2q_f32(f + 2 * i);
+        const float32x4x2_t b = vld2q_f32(f + 2 * i + 2);
+        const float32x4_t re = vaddq_f32(vmulq_f32(a.val[0], b.val[0]), vmulq_f32(a.val[1], b.val[1]));
+        const float32x4_t im = vsubq_f32(vmulq_f32(a.val[1], b.val[0]), vmulq_f32(a.val[0], b.val[1]));
+        vst1q_f32(out + i, atan2(im, re));
+    }
+    scalar::phaseDifference(in + i, out + i, n - i);
+}
+
+static const Kernels kernels = {
+    KernelSet::NEON, scale, magnitude, sumMagnitude, l1Norm, xorBytes,
+    byteRange, phase, phaseDifference };
+
+} // namespace neon
+#endif // DSP_KERNELS_NEON
+
+float arg(DSPCOMPLEX z)
+{
+    return scalar::atan2(z.imag(), z.real());
+}
+
+bool isSupported(KernelSet set)
+{
+    switch (set) {
+        case KernelSet::Auto:
+        case KernelSet::Scalar:
+            return true;
+#ifdef DSP_KERNELS_X86
+        case KernelSet::SSE4:
+            return __builtin_cpu_supports("sse4.1");
+        case KernelSet::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+#ifdef DSP_KERNELS_NEON
+        case KernelSet::NEON:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+static KernelSet bestSupported()
+{
+    for (KernelSet set : { KernelSet::AVX2, KernelSet::SSE4, KernelSet::NEON }) {
+        if (isSupported(set)) {
+            return set;
+        }
+    }
+    return KernelSet::Scalar;
+}
+
+const Kernels& kernels(KernelSet set)
+{
+    if (set == KernelSet::Auto) {
+        set = bestSupported();
+    }
+
+    if (not isSupported(set)) {
+        throw std::invalid_argument(std::string("DSP kernels ") +
+                kernelSetToString(set) + " are not supported on this CPU");
+    }
+
+    switch (set) {
+#ifdef DSP_KERNELS_X86
+        case KernelSet::SSE4: return sse4::kernels;
+        case KernelSet::AVX2: return avx2::kernels;
+#endif
+#ifdef DSP_KERNELS_NEON
+        case KernelSet::NEON: return neon::kernels;
+#endif
+        default: return scalar::kernels;
+    }
+}
+
+static std::atomic<const Kernels*> activeKernels = ATOMIC_VAR_INIT(nullptr);
+
+const Kernels& kernels()
+{
+    const Kernels *active = activeKernels.load(std::memory_order_acquire);
+    if (active == nullptr) {
+        selectKernels(KernelSet::Auto);
+        active = activeKernels.load(std::memory_order_acquire);
+    }
+    return *active;
+}
+
+void selectKernels(KernelSet set)
+{
+    const Kernels& k = kernels(set);
+    if (activeKernels.exchange(&k, std::memory_order_acq_rel) != &k) {
+        std::clog << "DSP kernels: " << kernelSetToString(k.set) << std::endl;
+    }
+}
+
+KernelSet kernelSetFromString(const std::string& name)
+{
+    if (name == "auto")
+        return KernelSet::Auto;
+    else if (name == "scalar")
+        return KernelSet::Scalar;
+    else if (name == "sse4")
+        return KernelSet::SSE4;
+    else if (name == "avx2")
+        return KernelSet::AVX2;
+    else if (name == "neon")
+        return KernelSet::NEON;
+    throw std::invalid_argument("Unknown DSP kernel set " + name);
+}
+
+const char *kernelSetToString(KernelSet set)
+{
+    switch (set) {
+        case KernelSet::Auto: return "auto";
+        case KernelSet::Scalar: return "scalar";
+        case KernelSet::SSE4: return "sse4";
+        case KernelSet::AVX2: return "avx2";
+        case KernelSet::NEON: return "neon";
+    }
+    return "unknown";
+}
+
+// Bit n is set if FastPath n is forced to the reference code
+static std::atomic<unsigned> forcedPaths = ATOMIC_VAR_INIT(0);
+
+void forceReference(FastPath path, bool reference)
+{
+    const unsigned bit = 1u << static_cast<unsigned>(path);
+    if (reference) {
+        forcedPaths.fetch_or(bit, std::memory_order_relaxed);
+    }
+    else {
+        forcedPaths.fetch_and(~bit, std::memory_order_relaxed);
+    }
+}
+
+bool isReferenceForced(FastPath path)
+{
+    return forcedPaths.load(std::memory_order_relaxed) & (1u << static_cast<unsigned>(path));
+}
+
+KernelSet kernelSetOf(FastPath path)
+{
+    return isReferenceForced(path) ? KernelSet::Scalar : kernels().set;
+}
+
+FastPath fastPathFromString(const std::string& name)
+{
+    if (name == "viterbi")
+        return FastPath::Viterbi;
+    else if (name == "rs")
+        return FastPath::RSSyndromes;
+    else if (name == "fft")
+        return FastPath::BatchedFFT;
+    throw std::invalid_argument("Unknown fast path " + name);
+}
+
+const char *fastPathToString(FastPath path)
+{
+    switch (path) {
+        case FastPath::Viterbi: return "viterbi";
+        case FastPath::RSSyndromes: return "rs";
+        case FastPath::BatchedFFT: return "fft";
+    }
+    return "unknown";
+}
+
+} // namespace dsp
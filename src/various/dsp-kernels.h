@@ -0,0 +1,124 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef DSP_KERNELS_H
+#define DSP_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "dab-constants.h"
+
+namespace dsp {
+
+/* Implementations of the kernels below. One binary carries all sets of
+ * its architecture, the best one the CPU supports is picked at run time,
+ * so that the same wheel runs on x86 servers and on ARM boards. The
+ * butterflies of the Viterbi decoders and the Reed-Solomon syndromes
+ * follow the set too, Scalar runs the reference code everywhere. */
+enum class KernelSet { Auto, Scalar, SSE4, AVX2, NEON };
+
+// Level statistics of a block of unsigned 8 bit samples
+struct ByteRange {
+    uint8_t min;
+    uint8_t max;
+    size_t clipped; // bytes at 0 or 255
+};
+
+/* Small vector loops of the receive chain. All of them work on any
+ * alignment and length. The vectorised sets compute the same as the
+ * scalar one, but accumulate the sums in a different order. */
+struct Kernels {
+    KernelSet set;
+
+    // v[i] *= factor
+    void (*scale)(DSPCOMPLEX *v, size_t n, float factor);
+
+    // out[i] = |in[i]|
+    void (*magnitude)(const DSPCOMPLEX *in, float *out, size_t n);
+
+    // sum of |in[i]|
+    float (*sumMagnitude)(const DSPCOMPLEX *in, size_t n);
+
+    // out[i] = |re(in[i])| + |im(in[i])|
+    void (*l1Norm)(const DSPCOMPLEX *in, float *out, size_t n);
+
+    // data[i] ^= pattern[i]
+    void (*xorBytes)(uint8_t *data, const uint8_t *pattern, size_t n);
+
+    // min, max and clipping of data[], n > 0
+    ByteRange (*byteRange)(const uint8_t *data, size_t n);
+
+    // out[i] = arg(in[i]), see dsp::arg
+    void (*phase)(const DSPCOMPLEX *in, float *out, size_t n);
+
+    // out[i] = arg(in[i] * conj(in[i + 1])), in holds n + 1 values
+    void (*phaseDifference)(const DSPCOMPLEX *in, float *out, size_t n);
+};
+
+/* The phase of z, -pi..pi, with a polynomial atan instead of libm. It is
+ * within 3e-6 rad of std::arg for all z, and 0 for z = 0. The phase
+ * kernels of all sets compute exactly this. */
+float arg(DSPCOMPLEX z);
+
+/* The kernels in use. Unless selectKernels was called, this is the best
+ * set the CPU supports, determined on the first call. */
+const Kernels& kernels();
+
+/* Use the given set from now on, Auto returns to the best supported one.
+ * Throws std::invalid_argument if the CPU or the build does not support
+ * the set. Call it before the receivers are started. */
+void selectKernels(KernelSet set);
+
+/* A particular set, for comparing implementations. Throws
+ * std::invalid_argument if it is not supported. */
+const Kernels& kernels(KernelSet set);
+
+bool isSupported(KernelSet set);
+
+// "auto", "scalar", "sse4", "avx2" or "neon"
+KernelSet kernelSetFromString(const std::string& name);
+const char *kernelSetToString(KernelSet set);
+
+/* Optimised paths outside of the kernels above. The Viterbi butterflies
+ * and the RS syndromes follow the selected set, the symbols of a whole
+ * frame are transformed by one batched FFT. Each of them can be forced
+ * to its reference code on its own, to single out the one that differs
+ * from the golden vectors of welle_bench. */
+enum class FastPath { Viterbi, RSSyndromes, BatchedFFT };
+
+void forceReference(FastPath path, bool reference = true);
+bool isReferenceForced(FastPath path);
+
+// The set a path runs with, Scalar if it is forced to the reference code
+KernelSet kernelSetOf(FastPath path);
+
+// "viterbi", "rs" or "fft"
+FastPath fastPathFromString(const std::string& name);
+const char *fastPathToString(FastPath path);
+
+} // namespace dsp
+
+#endif // DSP_KERNELS_H
@@ -26,24 +26,109 @@
  *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 #include    "fft.h"
+#include    "dsp-kernels.h"
 #include    <cstring>
+#include    <iostream>
+#include    <map>
+#include    <mutex>
+#include    <tuple>
+#include    <utility>
 
 namespace fft {
 
 #ifndef KISSFFT
+
+/* The FFTW planner is not thread-safe, and the plans only depend on the
+ * size and direction. All instances execute the same plan on their own,
+ * equally aligned, vector through the new-array execute interface. */
+static std::mutex plannerMutex;
+static PlannerMode plannerMode = PlannerMode::Estimate;
+static std::string wisdomFile;
+
+struct PlanKey {
+    int32_t fft_size;
+    int sign;
+    int32_t howmany;
+    int32_t idist; // 0 for in-place single transforms
+
+    bool operator<(const PlanKey& other) const {
+        return std::tie(fft_size, sign, howmany, idist) <
+            std::tie(other.fft_size, other.sign, other.howmany, other.idist);
+    }
+};
+static std::map<PlanKey, FFTW_PLAN> plans;
+
+void configurePlanner(PlannerMode mode, const std::string& wisdom)
+{
+    std::lock_guard<std::mutex> lock(plannerMutex);
+
+    plannerMode = mode;
+    wisdomFile = wisdom;
+
+    if (not wisdomFile.empty()) {
+        if (fftwf_import_wisdom_from_filename(wisdomFile.c_str())) {
+            std::clog << "FFT: Loaded wisdom from " << wisdomFile << std::endl;
+        }
+        else {
+            std::clog << "FFT: No wisdom loaded from " << wisdomFile << std::endl;
+        }
+    }
+}
+
+static FFTW_PLAN getPlan(const PlanKey& key)
+{
+    std::lock_guard<std::mutex> lock(plannerMutex);
+
+    FFTW_PLAN& plan = plans[key];
+    if (plan) {
+        return plan;
+    }
+
+    unsigned flags = FFTW_ESTIMATE;
+    switch (plannerMode) {
+        case PlannerMode::Estimate: flags = FFTW_ESTIMATE; break;
+        case PlannerMode::Measure:  flags = FFTW_MEASURE; break;
+        case PlannerMode::Patient:  flags = FFTW_PATIENT; break;
+    }
+
+    // Measuring overwrites the arrays, so plan on scratch vectors
+    if (key.idist == 0) {
+        auto scratch = reinterpret_cast<fftwf_complex*>(
+                FFTW_MALLOC(sizeof(DSPCOMPLEX) * key.fft_size));
+        plan = FFTW_PLAN_DFT_1D(key.fft_size, scratch, scratch, key.sign, flags);
+        FFTW_FREE(scratch);
+    }
+    else {
+        auto in = reinterpret_cast<fftwf_complex*>(
+                FFTW_MALLOC(sizeof(DSPCOMPLEX) * key.idist * key.howmany));
+        auto out = reinterpret_cast<fftwf_complex*>(
+                FFTW_MALLOC(sizeof(DSPCOMPLEX) * key.fft_size * key.howmany));
+        plan = FFTW_PLAN_MANY_DFT(1, &key.fft_size, key.howmany,
+                in, nullptr, 1, key.idist,
+                out, nullptr, 1, key.fft_size,
+                key.sign, flags);
+        FFTW_FREE(in);
+        FFTW_FREE(out);
+    }
+
+    if (plannerMode != PlannerMode::Estimate and not wisdomFile.empty()) {
+        if (not fftwf_export_wisdom_to_filename(wisdomFile.c_str())) {
+            std::clog << "FFT: Could not save wisdom to " << wisdomFile << std::endl;
+        }
+    }
+
+    return plan;
+}
+
 Forward::Forward(int32_t fft_size)
 {
     vector = (DSPCOMPLEX *)FFTW_MALLOC(sizeof (DSPCOMPLEX) * fft_size);
     memset((void*)vector, 0, sizeof(DSPCOMPLEX) * fft_size);
-    plan  = FFTW_PLAN_DFT_1D(fft_size,
-            reinterpret_cast<fftwf_complex*>(vector),
-            reinterpret_cast<fftwf_complex*>(vector),
-            FFTW_FORWARD, FFTW_ESTIMATE);
+    plan = getPlan({fft_size, FFTW_FORWARD, 1, 0});
 }
 
 Forward::~Forward()
 {
-    FFTW_DESTROY_PLAN(plan);
     FFTW_FREE(vector);
 }
 
@@ -54,7 +139,22 @@ DSPCOMPLEX* Forward::getVector()
 
 void Forward::do_FFT()
 {
-    FFTW_EXECUTE (plan);
+    FFTW_EXECUTE_DFT(plan,
+            reinterpret_cast<fftwf_complex*>(vector),
+            reinterpret_cast<fftwf_complex*>(vector));
+}
+
+ForwardBatch::ForwardBatch(int32_t fft_size, int32_t howmany, int32_t idist)
+{
+    plan = getPlan({fft_size, FFTW_FORWARD, howmany, idist});
+}
+
+void ForwardBatch::do_FFT(const DSPCOMPLEX *in, DSPCOMPLEX *out)
+{
+    // Out-of-place complex transforms leave the input untouched
+    FFTW_EXECUTE_DFT(plan,
+            reinterpret_cast<fftwf_complex*>(const_cast<DSPCOMPLEX*>(in)),
+            reinterpret_cast<fftwf_complex*>(out));
 }
 
 Backward::Backward(int32_t fft_size) :
@@ -64,15 +164,11 @@ Backward::Backward(int32_t fft_size) :
     for (int i = 0; i < fft_size; i ++) {
         vector [i] = 0;
     }
-    plan  = FFTW_PLAN_DFT_1D(fft_size,
-            reinterpret_cast<fftwf_complex*>(vector),
-            reinterpret_cast<fftwf_complex*>(vector),
-            FFTW_BACKWARD, FFTW_ESTIMATE);
+    plan = getPlan({fft_size, FFTW_BACKWARD, 1, 0});
 }
 
 Backward::~Backward ()
 {
-    FFTW_DESTROY_PLAN(plan);
     FFTW_FREE(vector);
 }
 
@@ -81,20 +177,29 @@ DSPCOMPLEX* Backward::getVector()
     return vector;
 }
 
-void Backward::do_IFFT()
+void Backward::do_IFFT(bool normalize)
 {
-    FFTW_EXECUTE(plan);
+    FFTW_EXECUTE_DFT(plan,
+            reinterpret_cast<fftwf_complex*>(vector),
+            reinterpret_cast<fftwf_complex*>(vector));
+
+    if (not normalize) {
+        return;
+    }
 
     const DSPFLOAT factor = 1.0 / DSPFLOAT(fft_size);
 
     // scale all entries
-    for (int i = 0; i < fft_size; i++) {
-        vector[i] *= factor;
-    }
+    dsp::kernels().scale(vector, fft_size, factor);
 }
 
 #else // Kiss FFT
 
+void configurePlanner(PlannerMode mode, const std::string& wisdomFile)
+{
+    (void)mode; (void)wisdomFile;
+}
+
 Forward::Forward(int32_t fft_size) :
     fft_size(fft_size)
 {
@@ -149,15 +254,15 @@ DSPCOMPLEX*Backward::getVector()
     return fin;
 }
 
-void Backward::do_IFFT()
+void Backward::do_IFFT(bool normalize)
 {
     const DSPFLOAT factor = 1.0f / DSPFLOAT(fft_size);
 
     kiss_fft(cfg, (kiss_fft_cpx*)fin, (kiss_fft_cpx*)fout);
 
     // Scale all entries
-    for (int i = 0; i < fft_size; i ++) {
-        fout[i] *= factor;
+    if (normalize) {
+        dsp::kernels().scale(reinterpret_cast<DSPCOMPLEX*>(fout), fft_size, factor);
     }
 
     memcpy(fin, fout, fft_size * sizeof(kiss_fft_cpx));
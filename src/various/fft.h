@@ -31,16 +31,44 @@
 #define _COMMON_FFT
 
 #include "dab-constants.h"
+#include "locked-memory.h"
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
 #include <fftw3.h>
 
 namespace fft {
 
 #define FFTW_MALLOC     fftwf_malloc
 #define FFTW_PLAN_DFT_1D    fftwf_plan_dft_1d
+#define FFTW_PLAN_MANY_DFT  fftwf_plan_many_dft
 #define FFTW_DESTROY_PLAN   fftwf_destroy_plan
 #define FFTW_FREE       fftwf_free
 #define FFTW_PLAN       fftwf_plan
 #define FFTW_EXECUTE        fftwf_execute
+#define FFTW_EXECUTE_DFT    fftwf_execute_dft
+
+/* How much effort FFTW spends on finding a fast plan. Measuring takes
+ * seconds per transform size, which is why it is opt-in, and should be
+ * combined with a wisdom file so that only the first start pays for it. */
+enum class PlannerMode { Estimate, Measure, Patient };
+
+/* Select the planner mode for all plans created afterwards. If wisdomFile
+ * is not empty, wisdom is loaded from it, and every newly measured plan is
+ * saved back to it. Call this before the first receiver is created, plans
+ * are shared by all transforms of the same size and direction. */
+void configurePlanner(PlannerMode mode, const std::string& wisdomFile = "");
+
+/* Buffers handed to a shared plan must be aligned like the arrays the
+ * plan was made for, use this allocator for them. The 64 bytes of
+ * lockedmemory are more than FFTW aligns to, and the frame buffers are
+ * locked along with the rings. */
+template <class T>
+using AlignedAllocator = lockedmemory::Allocator<T>;
+
+template <class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T> >;
 
 class Forward {
     public:
@@ -53,7 +81,21 @@ class Forward {
 
     private:
         DSPCOMPLEX *vector;
-        FFTW_PLAN plan;
+        FFTW_PLAN plan; // shared, owned by the plan cache
+};
+
+/* howmany forward transforms in one go. The input transforms are idist
+ * samples apart, the outputs follow each other without gap. Both buffers
+ * have to come from an AlignedAllocator. */
+class ForwardBatch {
+    public:
+        ForwardBatch(int32_t fft_size, int32_t howmany, int32_t idist);
+        ForwardBatch(const ForwardBatch&) = delete;
+        ForwardBatch& operator=(const ForwardBatch&) = delete;
+        void do_FFT(const DSPCOMPLEX *in, DSPCOMPLEX *out);
+
+    private:
+        FFTW_PLAN plan; // shared, owned by the plan cache
 };
 
 class Backward
@@ -64,12 +106,13 @@ class Backward
         Backward(const Backward&) = delete;
         Backward& operator=(const Backward&) = delete;
         DSPCOMPLEX *getVector(void);
-        void do_IFFT(void);
+        // The result is scaled by 1/fft_size, unless normalize is false
+        void do_IFFT(bool normalize = true);
 
     private:
         int32_t fft_size;
         DSPCOMPLEX *vector;
-        FFTW_PLAN plan;
+        FFTW_PLAN plan; // shared, owned by the plan cache
 };
 
 } // namespace fft
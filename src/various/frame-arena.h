@@ -0,0 +1,134 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
+/* Scratch memory for the buffers that only live while one frame is
+ * processed. Allocations just bump a pointer into a preallocated block,
+ * deallocation is a no-op, and reset() makes the whole block available
+ * again at the start of the next frame.
+ *
+ * If a frame needs more than the block holds, the excess comes from the
+ * heap, and the next reset() replaces the block by one that is large
+ * enough. After the first frames, the steady state does not touch the
+ * heap at all.
+ *
+ * Not thread safe, every thread needs an arena of its own. */
+class FrameArena {
+    public:
+        template<typename T>
+        using vector = std::pmr::vector<T>;
+
+        explicit FrameArena(size_t initialSize = 16 * 1024)
+        {
+            allocateBlock(initialSize);
+        }
+        FrameArena(const FrameArena&) = delete;
+        FrameArena& operator=(const FrameArena&) = delete;
+
+        std::pmr::memory_resource *resource() { return &*arena; }
+
+        template<typename T>
+        vector<T> makeVector(size_t size = 0)
+        {
+            return vector<T>(size, resource());
+        }
+
+        // Everything allocated from the arena must be gone by now
+        void reset()
+        {
+            const size_t needed = blockSize + upstream.peak;
+            arena->release();
+            upstream.reset();
+
+            if (needed > blockSize) {
+                // Round up, so that the block does not grow in small steps
+                allocateBlock(needed + needed / 2);
+            }
+        }
+
+        size_t size() const { return blockSize; }
+
+        // How often a frame did not fit into the block
+        size_t overflows() const { return overflowCount; }
+
+    private:
+        // Heap fallback which remembers how much it had to provide
+        class Upstream : public std::pmr::memory_resource {
+            public:
+                size_t allocated = 0;
+                size_t peak = 0;
+
+                void reset() { allocated = 0; peak = 0; }
+
+            private:
+                void *do_allocate(size_t bytes, size_t alignment) override
+                {
+                    allocated += bytes;
+                    if (allocated > peak) {
+                        peak = allocated;
+                    }
+                    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+                }
+
+                void do_deallocate(void *p, size_t bytes, size_t alignment) override
+                {
+                    allocated -= bytes;
+                    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+                }
+
+                bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+                {
+                    return this == &other;
+                }
+        };
+
+        void allocateBlock(size_t size)
+        {
+            if (block) {
+                overflowCount++;
+            }
+            arena.reset();
+            blockSize = size;
+            block = std::make_unique<std::max_align_t[]>(
+                    (size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t));
+            arena.emplace(block.get(), blockSize, &upstream);
+        }
+
+        Upstream upstream;
+        std::unique_ptr<std::max_align_t[]> block;
+        size_t blockSize = 0;
+        size_t overflowCount = 0;
+        std::optional<std::pmr::monotonic_buffer_resource> arena;
+};
+
+#endif // FRAME_ARENA_H
@@ -0,0 +1,552 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+#include "http-stream-server.h"
+#include "thread-config.h"
+
+// Chunks per sendmsg call
+static constexpr int maxIovecs = 64;
+static constexpr size_t maxRequestSize = 8192;
+
+HttpStreamServer::Stream::Stream(HttpStreamServer& server,
+        const std::string& path,
+        const std::string& contentType,
+        bool waitForHeader,
+        std::chrono::milliseconds preroll) :
+    path(path),
+    contentType(contentType),
+    preroll(preroll),
+    server(server),
+    lastClient(std::chrono::steady_clock::now())
+{
+    if (not waitForHeader) {
+        header = std::make_shared<const std::vector<uint8_t>>();
+    }
+}
+
+void HttpStreamServer::Stream::setHeader(const std::vector<uint8_t>& newHeader)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        header = std::make_shared<const std::vector<uint8_t>>(newHeader);
+    }
+    server.wakeUp();
+}
+
+void HttpStreamServer::Stream::push(Chunk&& chunk)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (not header) {
+            return;
+        }
+        queued.push_back(std::move(chunk));
+        if (queued.size() > maxQueuedChunks) {
+            queued.pop_front();
+        }
+    }
+    server.wakeUp();
+}
+
+// Keeps the most recent chunks of at least the pre-roll duration
+void HttpStreamServer::Stream::addToHistory(const std::deque<Chunk>& chunks)
+{
+    if (preroll.count() == 0) {
+        return;
+    }
+
+    for (const Chunk& chunk : chunks) {
+        history.push_back(chunk);
+        historyDuration += chunk.duration;
+    }
+    while (history.size() > 1 and historyDuration - history.front().duration >= preroll) {
+        historyDuration -= history.front().duration;
+        history.pop_front();
+    }
+    // Chunks of unknown duration, limited like the client queues
+    while (history.size() > maxQueuedChunks / 2) {
+        historyDuration -= history.front().duration;
+        history.pop_front();
+    }
+}
+
+HttpStreamServer::HttpStreamServer(int port, IdleCallback onIdle,
+        std::chrono::seconds idleTimeout) :
+    port(port),
+    onIdle(onIdle),
+    idleTimeout(idleTimeout)
+{
+}
+
+HttpStreamServer::~HttpStreamServer()
+{
+    stop();
+}
+
+bool HttpStreamServer::start()
+{
+    if (running) {
+        return false;
+    }
+
+    if (not listenSocket.bind(port) or not listenSocket.listen(64) or
+            not listenSocket.setNonBlocking()) {
+        listenSocket.close();
+        return false;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd == -1 or eventFd == -1) {
+        std::clog << "StreamServer: " << strerror(errno) << std::endl;
+        stop();
+        return false;
+    }
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = listenSocket.descriptor();
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+    ev.data.fd = eventFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+
+    running = true;
+    thread = std::thread(&HttpStreamServer::run, this);
+    std::clog << "StreamServer: listening on port " << port << std::endl;
+    return true;
+}
+
+void HttpStreamServer::stop()
+{
+    if (running) {
+        running = false;
+        wakeUp();
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    clients.clear();
+    if (listenSocket.valid()) {
+        listenSocket.close();
+    }
+    if (eventFd != -1) {
+        ::close(eventFd);
+        eventFd = -1;
+    }
+    if (epollFd != -1) {
+        ::close(epollFd);
+        epollFd = -1;
+    }
+}
+
+std::shared_ptr<HttpStreamServer::Stream> HttpStreamServer::addStream(
+        const std::string& path, const std::string& contentType, bool waitForHeader,
+        std::chrono::milliseconds preroll)
+{
+    auto stream = std::make_shared<Stream>(*this, path, contentType, waitForHeader, preroll);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& entry = streams[path];
+    if (entry) {
+        entry->removed = true;
+    }
+    entry = stream;
+    return stream;
+}
+
+void HttpStreamServer::removeStream(const std::string& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = streams.find(path);
+        if (it == streams.end()) {
+            return;
+        }
+        it->second->removed = true;
+        streams.erase(it);
+    }
+    // its clients are disconnected by the server thread
+    wakeUp();
+}
+
+void HttpStreamServer::wakeUp()
+{
+    if (eventFd != -1) {
+        const uint64_t one = 1;
+        (void)::write(eventFd, &one, sizeof(one));
+    }
+}
+
+void HttpStreamServer::run()
+{
+    threading::ScopedThread threadConfig(ThreadStage::Output, "http-stream");
+
+    epoll_event events[64];
+
+    while (running) {
+        const int n = epoll_wait(epollFd, events, 64, 1000);
+        if (n == -1 and errno != EINTR) {
+            std::clog << "StreamServer: epoll_wait: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            const int fd = events[i].data.fd;
+
+            if (fd == eventFd) {
+                uint64_t count;
+                (void)::read(eventFd, &count, sizeof(count));
+                distribute();
+                continue;
+            }
+
+            if (fd == listenSocket.descriptor()) {
+                accept();
+                continue;
+            }
+
+            auto it = clients.find(fd);
+            if (it == clients.end()) {
+                continue;
+            }
+            Client& client = it->second;
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                closeClient(fd);
+                continue;
+            }
+
+            if (events[i].events & EPOLLIN) {
+                if (not handleRequest(client)) {
+                    closeClient(fd);
+                    continue;
+                }
+            }
+
+            if (events[i].events & EPOLLOUT) {
+                client.writable = true;
+                if (not send(client)) {
+                    closeClient(fd);
+                }
+            }
+        }
+
+        checkIdle();
+    }
+}
+
+void HttpStreamServer::accept()
+{
+    while (true) {
+        Socket socket = listenSocket.accept();
+        if (not socket.valid()) {
+            return;
+        }
+        socket.setNonBlocking();
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = socket.descriptor();
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+            continue;
+        }
+
+        Client client;
+        const int fd = socket.descriptor();
+        client.socket = std::move(socket);
+        clients.emplace(fd, std::move(client));
+    }
+}
+
+// Reads what the client sent. Until the stream is selected, it is the
+// request, afterwards anything but the end of the connection is ignored.
+// Returns false if the client is to be disconnected.
+bool HttpStreamServer::handleRequest(Client& client)
+{
+    char buffer[1024];
+
+    while (true) {
+        const ssize_t received = client.socket.recv(buffer, sizeof(buffer), 0);
+        if (received == 0) {
+            return false;
+        }
+        if (received < 0) {
+            if (errno == EAGAIN or errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        if (not client.stream) {
+            client.request.append(buffer, received);
+        }
+    }
+
+    if (client.stream) {
+        return true;
+    }
+
+    if (client.request.find("\r\n\r\n") == std::string::npos) {
+        return client.request.size() < maxRequestSize;
+    }
+
+    // GET <path> HTTP/1.x
+    std::string path;
+    const size_t pathStart = client.request.find(' ');
+    if (client.request.compare(0, 4, "GET ") == 0) {
+        const size_t pathEnd = client.request.find_first_of(" ?\r", pathStart + 1);
+        path = client.request.substr(pathStart + 1, pathEnd - pathStart - 1);
+    }
+
+    std::shared_ptr<Stream> stream;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = streams.find(path);
+        if (it != streams.end()) {
+            stream = it->second;
+        }
+    }
+
+    if (not stream) {
+        const char notFound[] = "HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n";
+        client.socket.send(notFound, sizeof(notFound) - 1, MSG_NOSIGNAL);
+        return false;
+    }
+
+    client.request.clear();
+    client.stream = stream;
+    stream->clients++;
+    stream->idleReported = false;
+
+    std::shared_ptr<const std::vector<uint8_t>> header;
+    {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        header = stream->header;
+    }
+    if (header) {
+        startClient(client, header);
+        return send(client);
+    }
+    // otherwise distribute starts it, once the header is set
+    return true;
+}
+
+void HttpStreamServer::startClient(Client& client,
+        const std::shared_ptr<const std::vector<uint8_t>>& header)
+{
+    auto head = std::make_shared<const std::string>(
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: " + client.stream->contentType + "\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Connection: close\r\n\r\n");
+
+    Chunk chunk;
+    chunk.data = reinterpret_cast<const uint8_t*>(head->data());
+    chunk.size = head->size();
+    chunk.owner = head;
+    client.pending.push_back(std::move(chunk));
+
+    if (not header->empty()) {
+        Chunk headerChunk;
+        headerChunk.data = header->data();
+        headerChunk.size = header->size();
+        headerChunk.owner = header;
+        client.pending.push_back(std::move(headerChunk));
+    }
+
+    // The history only holds chunks which were distributed already, so a
+    // client starting during distribute does not get them twice
+    const std::deque<Chunk>& history = client.stream->history;
+    client.pending.insert(client.pending.end(), history.begin(), history.end());
+    client.started = true;
+}
+
+// Hands the chunks the decoders queued to the clients of their streams
+void HttpStreamServer::distribute()
+{
+    std::vector<int> disconnected;
+
+    std::map<Stream*, std::deque<Chunk>> chunks;
+    for (auto& entry : clients) {
+        Client& client = entry.second;
+        if (not client.stream) {
+            continue;
+        }
+
+        Stream *stream = client.stream.get();
+        if (stream->removed) {
+            disconnected.push_back(entry.first);
+            continue;
+        }
+
+        auto it = chunks.find(stream);
+        if (it == chunks.end()) {
+            std::lock_guard<std::mutex> lock(stream->mutex);
+            it = chunks.emplace(stream, std::move(stream->queued)).first;
+            stream->queued.clear();
+            if (not client.started and stream->header) {
+                startClient(client, stream->header);
+            }
+        }
+        else if (not client.started) {
+            std::lock_guard<std::mutex> lock(stream->mutex);
+            if (stream->header) {
+                startClient(client, stream->header);
+            }
+        }
+
+        if (not client.started) {
+            continue;
+        }
+
+        // The clients share the chunks, only the references are copied
+        client.pending.insert(client.pending.end(), it->second.begin(), it->second.end());
+        if (client.pending.size() > maxQueuedChunks) {
+            std::clog << "StreamServer: client of " << stream->path <<
+                " too slow, disconnecting" << std::endl;
+            disconnected.push_back(entry.first);
+            continue;
+        }
+
+        if (not send(client)) {
+            disconnected.push_back(entry.first);
+        }
+    }
+
+    // Streams without a client drop their chunks
+    std::vector<std::shared_ptr<Stream>> idle;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& entry : streams) {
+            if (entry.second->clients == 0) {
+                idle.push_back(entry.second);
+            }
+        }
+    }
+    for (const auto& stream : idle) {
+        std::deque<Chunk> dropped;
+        {
+            std::lock_guard<std::mutex> lock(stream->mutex);
+            dropped.swap(stream->queued);
+        }
+        stream->addToHistory(dropped);
+    }
+    for (const auto& entry : chunks) {
+        entry.first->addToHistory(entry.second);
+    }
+
+    for (int fd : disconnected) {
+        closeClient(fd);
+    }
+}
+
+// Sends as much of the pending chunks as the socket takes, in one
+// sendmsg call per maxIovecs chunks. Returns false on errors.
+bool HttpStreamServer::send(Client& client)
+{
+    while (client.writable and not client.pending.empty()) {
+        iovec iov[maxIovecs];
+        int count = 0;
+        for (auto it = client.pending.begin();
+                it != client.pending.end() and count < maxIovecs; ++it, ++count) {
+            const size_t skip = count == 0 ? client.offset : 0;
+            iov[count].iov_base = const_cast<uint8_t*>(it->data + skip);
+            iov[count].iov_len = it->size - skip;
+        }
+
+        msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t sent = sendmsg(client.socket.descriptor(), &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN or errno == EWOULDBLOCK) {
+                client.writable = false;
+                return true;
+            }
+            return false;
+        }
+
+        while (sent > 0) {
+            const size_t left = client.pending.front().size - client.offset;
+            if ((size_t)sent >= left) {
+                sent -= left;
+                client.pending.pop_front();
+                client.offset = 0;
+            }
+            else {
+                client.offset += sent;
+                sent = 0;
+            }
+        }
+    }
+    return true;
+}
+
+void HttpStreamServer::closeClient(int fd)
+{
+    auto it = clients.find(fd);
+    if (it == clients.end()) {
+        return;
+    }
+
+    if (it->second.stream) {
+        Stream& stream = *it->second.stream;
+        if (--stream.clients == 0) {
+            stream.lastClient = std::chrono::steady_clock::now();
+        }
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    clients.erase(it);
+}
+
+void HttpStreamServer::checkIdle()
+{
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<std::string> idle;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& entry : streams) {
+            Stream& stream = *entry.second;
+            if (stream.clients == 0 and not stream.idleReported and
+                    now - stream.lastClient >= idleTimeout) {
+                stream.idleReported = true;
+                idle.push_back(stream.path);
+            }
+        }
+    }
+
+    if (onIdle) {
+        for (const auto& path : idle) {
+            onIdle(path);
+        }
+    }
+}
@@ -0,0 +1,163 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef HTTP_STREAM_SERVER_H
+#define HTTP_STREAM_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "various/Socket.h"
+
+// Serves live audio of the decoded services over HTTP, for clients like
+// MPD or a Chromecast. Every stream has one queue of chunks, which all
+// clients of the stream send from, so a chunk is neither copied per
+// client nor copied into the socket buffers before the kernel does so.
+// The sockets are served by one epoll thread, the decoder threads only
+// queue the chunks. Linux only.
+class HttpStreamServer {
+    public:
+        // A piece of audio, owned by whoever produced it
+        struct Chunk {
+            std::shared_ptr<const void> owner;
+            const uint8_t *data = nullptr;
+            size_t size = 0;
+            std::chrono::milliseconds duration{0}; // for the pre-roll only
+        };
+
+        class Stream {
+            public:
+                Stream(HttpStreamServer& server,
+                        const std::string& path,
+                        const std::string& contentType,
+                        bool waitForHeader,
+                        std::chrono::milliseconds preroll);
+                Stream(const Stream&) = delete;
+                Stream& operator=(const Stream&) = delete;
+
+                // Sent to every client before the first chunk, e.g. the
+                // WAV header once the sample rate is known. Until it is
+                // set, a stream created with waitForHeader accepts no
+                // clients.
+                void setHeader(const std::vector<uint8_t>& header);
+
+                // Called by the decoder threads
+                void push(Chunk&& chunk);
+
+                const std::string path;
+                const std::string contentType;
+                // New clients get this much of the recent audio at once
+                const std::chrono::milliseconds preroll;
+
+            private:
+                friend class HttpStreamServer;
+
+                HttpStreamServer& server;
+                std::mutex mutex;
+                std::deque<Chunk> queued;
+                std::shared_ptr<const std::vector<uint8_t>> header;
+                std::atomic<bool> removed = ATOMIC_VAR_INIT(false);
+
+                // Only used by the server thread
+                void addToHistory(const std::deque<Chunk>& chunks);
+                std::deque<Chunk> history;
+                std::chrono::milliseconds historyDuration{0};
+                size_t clients = 0;
+                std::chrono::steady_clock::time_point lastClient;
+                bool idleReported = false;
+        };
+
+        // Called from the server thread, when a stream had no client for
+        // idleTimeout, either since it was added or since the last client
+        // disconnected. The streams must not outlive the server.
+        using IdleCallback = std::function<void(const std::string& path)>;
+
+        HttpStreamServer(int port, IdleCallback onIdle,
+                std::chrono::seconds idleTimeout = std::chrono::seconds(10));
+        ~HttpStreamServer();
+        HttpStreamServer(const HttpStreamServer&) = delete;
+        HttpStreamServer& operator=(const HttpStreamServer&) = delete;
+
+        bool start(void);
+        void stop(void);
+
+        std::shared_ptr<Stream> addStream(const std::string& path,
+                const std::string& contentType, bool waitForHeader,
+                std::chrono::milliseconds preroll = std::chrono::milliseconds(0));
+        void removeStream(const std::string& path);
+
+        int getPort(void) const { return port; }
+
+    private:
+        // Clients that fall further behind than this are disconnected
+        static constexpr size_t maxQueuedChunks = 256;
+
+        struct Client {
+            Socket socket;
+            std::string request;
+            std::shared_ptr<Stream> stream;
+            bool started = false; // response head sent or queued
+            std::deque<Chunk> pending;
+            size_t offset = 0; // into the first pending chunk
+            bool writable = true;
+        };
+
+        void run(void);
+        void wakeUp(void);
+        void accept(void);
+        bool handleRequest(Client& client);
+        void startClient(Client& client, const std::shared_ptr<const std::vector<uint8_t>>& header);
+        void distribute(void);
+        bool send(Client& client);
+        void closeClient(int fd);
+        void checkIdle(void);
+
+        const int port;
+        IdleCallback onIdle;
+        const std::chrono::seconds idleTimeout;
+
+        Socket listenSocket;
+        int epollFd = -1;
+        int eventFd = -1;
+        std::atomic<bool> running = ATOMIC_VAR_INIT(false);
+        std::thread thread;
+
+        std::mutex mutex;
+        std::map<std::string, std::shared_ptr<Stream>> streams;
+
+        // Only used by the server thread
+        std::map<int, Client> clients;
+};
+
+#endif // HTTP_STREAM_SERVER_H
@@ -0,0 +1,142 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/* Log-linear histogram of durations in ns, four buckets per power of two,
+ * which keeps the percentiles within 25%. Written by one thread only,
+ * read by any: the counts are relaxed atomics, so recording costs a few
+ * plain stores and a reader never takes a lock. */
+class LatencyHistogram
+{
+    public:
+        static constexpr size_t numBuckets = 160; // up to 2^41 ns, half an hour
+
+        // A copy of the counts, which can be merged and evaluated
+        struct Snapshot {
+            std::array<uint64_t, numBuckets> buckets{};
+            uint64_t count = 0;
+            uint64_t sum = 0;
+            uint64_t max = 0;
+
+            void merge(const Snapshot& other) {
+                for (size_t b = 0; b < numBuckets; b++) {
+                    buckets[b] += other.buckets[b];
+                }
+                count += other.count;
+                sum += other.sum;
+                max = std::max(max, other.max);
+            }
+
+            // The durations up to bucketLimit(bucket)
+            uint64_t countUpTo(size_t bucket) const {
+                uint64_t n = 0;
+                for (size_t b = 0; b <= bucket and b < numBuckets; b++) {
+                    n += buckets[b];
+                }
+                return n;
+            }
+
+            // Upper bound of the q-quantile in ns, 0 without samples
+            uint64_t percentile(double q) const {
+                // The counts are read one by one while the histogram goes on
+                const uint64_t total = countUpTo(numBuckets - 1);
+                const uint64_t rank = std::max<uint64_t>(1, std::ceil(q * total));
+                uint64_t seen = 0;
+                for (size_t b = 0; b < numBuckets and total > 0; b++) {
+                    seen += buckets[b];
+                    if (seen >= rank) {
+                        return std::min(bucketLimit(b), max);
+                    }
+                }
+                return max;
+            }
+        };
+
+        void add(uint64_t ns) {
+            // The only writer, no read-modify-write needed
+            auto increment = [](std::atomic<uint64_t>& a, uint64_t v) {
+                a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed); };
+
+            increment(m_buckets[bucketOf(ns)], 1);
+            increment(m_count, 1);
+            increment(m_sum, ns);
+            if (ns > m_max.load(std::memory_order_relaxed)) {
+                m_max.store(ns, std::memory_order_relaxed);
+            }
+        }
+
+        Snapshot snapshot() const {
+            Snapshot s;
+            for (size_t b = 0; b < numBuckets; b++) {
+                s.buckets[b] = m_buckets[b].load(std::memory_order_relaxed);
+            }
+            s.count = m_count.load(std::memory_order_relaxed);
+            s.sum = m_sum.load(std::memory_order_relaxed);
+            s.max = m_max.load(std::memory_order_relaxed);
+            return s;
+        }
+
+        static size_t bucketOf(uint64_t ns) {
+            if (ns < 4) {
+                return ns;
+            }
+
+            const size_t exponent = 63 - __builtin_clzll(ns);
+            const size_t bucket = 4 * (exponent - 1) + ((ns >> (exponent - 2)) & 3);
+            return std::min(bucket, numBuckets - 1);
+        }
+
+        // The largest duration that falls into the bucket
+        static uint64_t bucketLimit(size_t bucket) {
+            if (bucket < 4) {
+                return bucket;
+            }
+
+            const size_t exponent = bucket / 4 + 1;
+            return ((uint64_t)(5 + bucket % 4) << (exponent - 2)) - 1;
+        }
+
+        // The bucket that ends right below 2^exponent ns, exponent >= 2
+        static constexpr size_t powerOfTwoBucket(size_t exponent) {
+            return 4 * (exponent - 1) - 1;
+        }
+
+    private:
+        std::array<std::atomic<uint64_t>, numBuckets> m_buckets{};
+        std::atomic<uint64_t> m_count = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> m_sum = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> m_max = ATOMIC_VAR_INIT(0);
+};
+
+#endif // LATENCY_HISTOGRAM_H
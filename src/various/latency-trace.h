@@ -0,0 +1,152 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef LATENCY_TRACE_H
+#define LATENCY_TRACE_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#include "dab-constants.h"
+#include "latency-histogram.h"
+
+/* When a piece of audio passed the stages of the receiver, in ns of the
+ * monotonic clock (CLOCK_MONOTONIC, python's time.monotonic_ns). The stamp
+ * follows the newest sample that went into the data: the one that
+ * completed the transmission frame, the CIF, the logical frame.
+ * A time of 0 means the stage was not stamped. */
+struct LatencyStamp {
+    // Of the sample, counted from the start of the device
+    uint64_t sampleIndex = 0;
+    // Estimated from the arrival of the USB transfer that held it
+    int64_t capturedNs = 0;
+    // Read out of the input ring by the OFDM processor
+    int64_t readNs = 0;
+    // Its CIF handed to the subchannel decoder
+    int64_t demodulatedNs = 0;
+    // The logical frame out of the time de-interleaver and Viterbi
+    int64_t deinterleavedNs = 0;
+    // Audio out of the Reed-Solomon and AAC decoders
+    int64_t decodedNs = 0;
+
+    bool valid(void) const { return capturedNs != 0; }
+
+    /* The stamp of the sample offset samples later in the stream.
+     * A later sample was still in the ring when this one was read,
+     * it is read later, an earlier one is not read earlier. */
+    LatencyStamp at(int64_t offset) const {
+        LatencyStamp s = *this;
+        if (not valid()) {
+            return s;
+        }
+        const int64_t ns = offset * 1000000000 / INPUT_RATE;
+        s.sampleIndex += offset;
+        s.capturedNs += ns;
+        if (offset > 0 and s.readNs != 0) {
+            s.readNs += ns;
+        }
+        return s;
+    }
+
+    static int64_t now(void) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+// The stages between two stamps, and from capture to python
+enum class LatencyHop {
+    Input,          // captured to read
+    Demodulation,   // read to demodulated
+    Deinterleaver,  // demodulated to deinterleaved
+    AudioDecoder,   // deinterleaved to decoded
+    Handoff,        // decoded to delivered to the handler
+    Total,          // captured to delivered
+};
+
+constexpr size_t numLatencyHops = 6;
+
+inline const char* latencyHopName(LatencyHop hop)
+{
+    switch (hop) {
+        case LatencyHop::Input: return "input";
+        case LatencyHop::Demodulation: return "demodulation";
+        case LatencyHop::Deinterleaver: return "deinterleaver";
+        case LatencyHop::AudioDecoder: return "audio_decoder";
+        case LatencyHop::Handoff: return "handoff";
+        case LatencyHop::Total: return "total";
+    }
+    return "unknown";
+}
+
+/* The latency of every hop, over the stamps added. Written by one thread
+ * only, like the histograms, read by any. */
+class LatencyTrace
+{
+    public:
+        using Snapshot = std::array<LatencyHistogram::Snapshot, numLatencyHops>;
+
+        // The hops stamped at both ends, up to the decoder
+        void add(const LatencyStamp& s) {
+            addHop(LatencyHop::Input, s.capturedNs, s.readNs);
+            addHop(LatencyHop::Demodulation, s.readNs, s.demodulatedNs);
+            addHop(LatencyHop::Deinterleaver, s.demodulatedNs, s.deinterleavedNs);
+            addHop(LatencyHop::AudioDecoder, s.deinterleavedNs, s.decodedNs);
+            last = s;
+        }
+
+        // Additionally the handoff and the total, for audio delivered at ns
+        void add(const LatencyStamp& s, int64_t deliveredNs) {
+            add(s);
+            addHop(LatencyHop::Handoff, s.decodedNs, deliveredNs);
+            addHop(LatencyHop::Total, s.capturedNs, deliveredNs);
+        }
+
+        Snapshot snapshot(void) const {
+            Snapshot s;
+            for (size_t h = 0; h < numLatencyHops; h++) {
+                s[h] = hops[h].snapshot();
+            }
+            return s;
+        }
+
+        // The stamp added last, only for the writer
+        const LatencyStamp& lastStamp(void) const { return last; }
+
+    private:
+        void addHop(LatencyHop hop, int64_t from, int64_t to) {
+            // A stage without stamp, or a clock estimate ahead of time
+            if (from == 0 or to == 0 or to < from) {
+                return;
+            }
+            hops[(size_t)hop].add(to - from);
+        }
+
+        std::array<LatencyHistogram, numLatencyHops> hops;
+        LatencyStamp last;
+};
+
+#endif // LATENCY_TRACE_H
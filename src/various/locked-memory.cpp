@@ -0,0 +1,178 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "locked-memory.h"
+
+namespace lockedmemory {
+
+// In front of every allocation, so that deallocate() knows how to undo it.
+// Its size keeps the alignment of the mapping for the caller.
+struct alignas(64) Header {
+    size_t mappedBytes;     // 0 for operator new
+    uint8_t flags;
+};
+static const uint8_t flagLocked = 1;
+static const uint8_t flagHugePages = 2;
+
+static const size_t hugePageSize = 2 * 1024 * 1024;
+
+static std::atomic<Mode> currentMode = ATOMIC_VAR_INIT(Mode::Off);
+static std::atomic<size_t> lockedBytes = ATOMIC_VAR_INIT(0);
+static std::atomic<size_t> hugePageBytes = ATOMIC_VAR_INIT(0);
+static std::atomic<size_t> unlockedBytes = ATOMIC_VAR_INIT(0);
+static std::atomic<uint64_t> lockFailures = ATOMIC_VAR_INIT(0);
+
+void configure(Mode mode)
+{
+    currentMode = mode;
+}
+
+Mode mode()
+{
+    return currentMode;
+}
+
+Mode modeFromString(const char *name)
+{
+    if (strcmp(name, "off") == 0)
+        return Mode::Off;
+    else if (strcmp(name, "lock") == 0)
+        return Mode::Lock;
+    else if (strcmp(name, "hugepages") == 0)
+        return Mode::HugePages;
+    throw std::invalid_argument(std::string("unknown memory lock mode: ") + name);
+}
+
+Stats getStats()
+{
+    Stats s;
+    s.lockedBytes = lockedBytes;
+    s.hugePageBytes = hugePageBytes;
+    s.unlockedBytes = unlockedBytes;
+    s.lockFailures = lockFailures;
+    return s;
+}
+
+static size_t roundUp(size_t bytes, size_t unit)
+{
+    return (bytes + unit - 1) / unit * unit;
+}
+
+static void *mapLocked(size_t bytes, Mode mode)
+{
+    void *p = MAP_FAILED;
+    uint8_t flags = 0;
+    size_t mapped = 0;
+
+    if (mode == Mode::HugePages and bytes >= hugePageSize) {
+        mapped = roundUp(bytes, hugePageSize);
+        p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (p != MAP_FAILED) {
+            flags |= flagHugePages;
+        }
+    }
+
+    if (p == MAP_FAILED) {
+        mapped = roundUp(bytes, sysconf(_SC_PAGESIZE));
+        p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        if (mode == Mode::HugePages) {
+            madvise(p, mapped, MADV_HUGEPAGE);
+        }
+    }
+
+    if (mlock(p, mapped) == 0) {
+        flags |= flagLocked;
+        lockedBytes += mapped;
+        if (flags & flagHugePages) {
+            hugePageBytes += mapped;
+        }
+    }
+    else {
+        if (lockFailures++ == 0) {
+            std::clog << "lockedmemory: cannot lock " << mapped << " bytes: " <<
+                strerror(errno) << ", raise RLIMIT_MEMLOCK" << std::endl;
+        }
+        unlockedBytes += mapped;
+    }
+
+    Header *header = static_cast<Header*>(p);
+    header->mappedBytes = mapped;
+    header->flags = flags;
+    return header + 1;
+}
+
+void *allocate(size_t bytes)
+{
+    const Mode mode = currentMode;
+    if (mode != Mode::Off) {
+        return mapLocked(bytes + sizeof(Header), mode);
+    }
+
+    Header *header = static_cast<Header*>(
+            ::operator new(bytes + sizeof(Header), std::align_val_t(alignof(Header))));
+    header->mappedBytes = 0;
+    header->flags = 0;
+    return header + 1;
+}
+
+void deallocate(void *p)
+{
+    if (p == nullptr) {
+        return;
+    }
+
+    Header *header = static_cast<Header*>(p) - 1;
+    const size_t mapped = header->mappedBytes;
+    if (mapped == 0) {
+        ::operator delete(header, std::align_val_t(alignof(Header)));
+        return;
+    }
+
+    if (header->flags & flagLocked) {
+        lockedBytes -= mapped;
+        if (header->flags & flagHugePages) {
+            hugePageBytes -= mapped;
+        }
+    }
+    else {
+        unlockedBytes -= mapped;
+    }
+    // munmap unlocks the pages as well
+    munmap(header, mapped);
+}
+
+} // namespace lockedmemory
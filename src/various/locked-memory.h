@@ -0,0 +1,96 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef LOCKED_MEMORY_H
+#define LOCKED_MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+/* Memory for the buffers the real-time threads touch all the time: the
+ * sample rings of the devices, the frame buffers of the demodulator and
+ * the rings and de-interleavers of the subchannel decoders. Without
+ * locking, a page fault on first touch or after the page got swapped out
+ * lands on the USB callback or the OFDM thread, long enough for an
+ * overrun when the host is busy with other services.
+ *
+ * Locked, the buffers are mapped prefaulted and mlock()ed. Locking needs
+ * a large enough RLIMIT_MEMLOCK or CAP_IPC_LOCK, a buffer that cannot be
+ * locked is still allocated and counted as failed. The mode is process
+ * wide and applies to the buffers allocated afterwards. */
+namespace lockedmemory {
+
+enum class Mode {
+    Off,
+    Lock,
+    // As Lock, buffers of 2 MB and more go to explicit huge pages if the
+    // system has any reserved, the others are marked for transparent ones
+    HugePages,
+};
+
+// Call before the devices and receivers are created
+void configure(Mode mode);
+Mode mode(void);
+
+// "off", "lock" or "hugepages", throws std::invalid_argument otherwise
+Mode modeFromString(const char *name);
+
+struct Stats {
+    size_t lockedBytes = 0;
+    size_t hugePageBytes = 0;   // part of lockedBytes
+    // Allocated in a locking mode, but not locked
+    size_t unlockedBytes = 0;
+    uint64_t lockFailures = 0;
+};
+Stats getStats(void);
+
+/* Aligned to 64 bytes in every mode, which covers the SIMD kernels and
+ * FFTW. deallocate() finds out itself how the memory was allocated. */
+void *allocate(size_t bytes);
+void deallocate(void *p);
+
+template <class T>
+struct Allocator {
+    using value_type = T;
+
+    Allocator() = default;
+    template <class U> Allocator(const Allocator<U>&) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T*>(lockedmemory::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t) {
+        lockedmemory::deallocate(p);
+    }
+
+    template <class U> bool operator==(const Allocator<U>&) const { return true; }
+    template <class U> bool operator!=(const Allocator<U>&) const { return false; }
+};
+
+} // namespace lockedmemory
+
+#endif // LOCKED_MEMORY_H
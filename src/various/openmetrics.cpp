@@ -0,0 +1,127 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+
+#include "openmetrics.h"
+
+void OpenMetricsWriter::family(const std::string& name, Type type, const std::string& help)
+{
+    const char *typeName = "gauge";
+    switch (type) {
+        case Type::Gauge: typeName = "gauge"; break;
+        case Type::Counter: typeName = "counter"; break;
+        case Type::Histogram: typeName = "histogram"; break;
+    }
+
+    current = name;
+    text += "# TYPE " + name + " " + typeName + "\n";
+    text += "# HELP " + name + " " + help + "\n";
+}
+
+std::string OpenMetricsWriter::number(double value)
+{
+    if (std::isnan(value)) {
+        return "NaN";
+    }
+    else if (std::isinf(value)) {
+        return value > 0 ? "+Inf" : "-Inf";
+    }
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", value);
+    return buf;
+}
+
+void OpenMetricsWriter::sample(const std::string& suffix, const Labels& labels,
+        const std::string& value, const std::string *le)
+{
+    text += current + suffix;
+
+    if (not labels.empty() or le) {
+        text += "{";
+        bool first = true;
+        auto label = [&](const std::string& name, const std::string& labelValue) {
+            if (not first) {
+                text += ",";
+            }
+            first = false;
+            text += name + "=\"";
+            for (char c : labelValue) {
+                switch (c) {
+                    case '\\': text += "\\\\"; break;
+                    case '"': text += "\\\""; break;
+                    case '\n': text += "\\n"; break;
+                    default: text += c;
+                }
+            }
+            text += "\"";
+        };
+
+        for (const auto& l : labels) {
+            label(l.first, l.second);
+        }
+        if (le) {
+            label("le", *le);
+        }
+        text += "}";
+    }
+
+    text += " " + value + "\n";
+}
+
+void OpenMetricsWriter::gauge(const Labels& labels, double value)
+{
+    sample("", labels, number(value));
+}
+
+void OpenMetricsWriter::counter(const Labels& labels, double value)
+{
+    sample("_total", labels, number(value));
+}
+
+void OpenMetricsWriter::histogram(const Labels& labels, const LatencyHistogram::Snapshot& h,
+        int minExponent, int maxExponent)
+{
+    // All from the one snapshot, so the buckets add up to _count
+    uint64_t total = 0;
+    for (int e = minExponent; e <= maxExponent; e++) {
+        total = h.countUpTo(LatencyHistogram::powerOfTwoBucket(e));
+        const std::string le = number(std::ldexp(1.0, e) / 1e9);
+        sample("_bucket", labels, std::to_string(total), &le);
+    }
+
+    total = h.countUpTo(LatencyHistogram::numBuckets - 1);
+    const std::string inf = "+Inf";
+    sample("_bucket", labels, std::to_string(total), &inf);
+    sample("_count", labels, std::to_string(total));
+    sample("_sum", labels, number(h.sum / 1e9));
+}
+
+std::string OpenMetricsWriter::finish()
+{
+    return text + "# EOF\n";
+}
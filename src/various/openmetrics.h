@@ -0,0 +1,72 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef OPENMETRICS_H
+#define OPENMETRICS_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "latency-histogram.h"
+
+/* Renders metrics in the OpenMetrics text format, which Prometheus
+ * scrapes as well. All samples of a family have to follow its
+ * declaration, so declare a family and add its samples for all sources
+ * before the next one. */
+class OpenMetricsWriter
+{
+    public:
+        using Labels = std::vector<std::pair<std::string, std::string> >;
+
+        enum class Type { Gauge, Counter, Histogram };
+
+        // name without the _total suffix of the counter samples
+        void family(const std::string& name, Type type, const std::string& help);
+
+        void gauge(const Labels& labels, double value);
+        void counter(const Labels& labels, double value);
+
+        /* Buckets at the powers of two from 2^minExponent to
+         * 2^maxExponent ns, in seconds */
+        void histogram(const Labels& labels, const LatencyHistogram::Snapshot& h,
+                int minExponent = 14, int maxExponent = 31);
+
+        // The text so far, terminated by # EOF
+        std::string finish(void);
+
+        static constexpr const char *contentType =
+            "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+    private:
+        void sample(const std::string& suffix, const Labels& labels,
+                const std::string& value, const std::string *le = nullptr);
+        static std::string number(double value);
+
+        std::string current;
+        std::string text;
+};
+
+#endif // OPENMETRICS_H
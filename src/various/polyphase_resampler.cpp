@@ -0,0 +1,79 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <cmath>
+#include "polyphase_resampler.h"
+
+PolyphaseResampler::PolyphaseResampler(int interpolation, int decimation,
+        int tapsPerPhase, float cutoff) :
+    L(interpolation),
+    M(decimation),
+    T(tapsPerPhase),
+    phases(interpolation, std::vector<float>(tapsPerPhase))
+{
+    // Blackman windowed sinc at the upsampled rate, with a gain of L
+    // to compensate for the zero stuffing
+    const int N = L * T;
+    const double fc = cutoff / L;
+    for (int j = 0; j < N; j++) {
+        const double t = j - (N - 1) / 2.0;
+        const double sinc = (t == 0) ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+        const double w = 0.42 - 0.5 * cos(2 * M_PI * j / (N - 1)) +
+            0.08 * cos(4 * M_PI * j / (N - 1));
+        phases[j % L][j / L] = L * sinc * w;
+    }
+
+    reset();
+}
+
+void PolyphaseResampler::reset()
+{
+    buffer.assign(T - 1, DSPCOMPLEX(0, 0));
+    position = (int64_t)(T - 1) * L;
+}
+
+void PolyphaseResampler::process(const DSPCOMPLEX *in, size_t n, std::vector<DSPCOMPLEX>& out)
+{
+    buffer.insert(buffer.end(), in, in + n);
+
+    const int64_t end = (int64_t)buffer.size() * L;
+    for (; position < end; position += M) {
+        const int64_t i = position / L;
+        const std::vector<float>& h = phases[position % L];
+        const DSPCOMPLEX *x = &buffer[i];
+
+        float re = 0, im = 0;
+        for (int k = 0; k < T; k++) {
+            re += h[k] * x[-k].real();
+            im += h[k] * x[-k].imag();
+        }
+        out.emplace_back(re, im);
+    }
+
+    // Keep the last T - 1 samples as history for the next call
+    const size_t consumed = buffer.size() - (T - 1);
+    buffer.erase(buffer.begin(), buffer.begin() + consumed);
+    position -= (int64_t)consumed * L;
+}
@@ -0,0 +1,63 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef POLYPHASE_RESAMPLER_H
+#define POLYPHASE_RESAMPLER_H
+
+#include <vector>
+#include "dab-constants.h"
+
+/**
+ * \class PolyphaseResampler
+ * Rational resampler by interpolation/decimation. The windowed-sinc
+ * lowpass is split into interpolation phases, so that only the taps
+ * contributing to an output sample are evaluated.
+ */
+class PolyphaseResampler
+{
+    public:
+        // cutoff is the passband edge relative to the input sample rate
+        PolyphaseResampler(int interpolation, int decimation,
+                int tapsPerPhase, float cutoff);
+
+        // Resample n input samples, the output is appended to out
+        void process(const DSPCOMPLEX *in, size_t n, std::vector<DSPCOMPLEX>& out);
+        void reset(void);
+
+    private:
+        const int L;
+        const int M;
+        const int T;
+
+        // phases[p][k] is tap p + k * L of the prototype filter
+        std::vector<std::vector<float> > phases;
+        std::vector<DSPCOMPLEX> buffer;
+
+        // Position of the next output sample in the upsampled domain,
+        // relative to the oldest sample in buffer
+        int64_t position;
+};
+
+#endif
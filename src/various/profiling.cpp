@@ -29,6 +29,9 @@
 #include <map>
 #include <utility>
 #include <cmath>
+#include <chrono>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "various/profiling.h"
 
@@ -52,6 +55,7 @@ const char* mark_to_cstr(const ProfilingMark& m) {
         MARK_TO_CSTR_CASE(OnNewNull)
         MARK_TO_CSTR_CASE(DecodeTII)
 
+        MARK_TO_CSTR_CASE(FrameFFT)
         MARK_TO_CSTR_CASE(ProcessPRS)
         MARK_TO_CSTR_CASE(ProcessSymbol)
         MARK_TO_CSTR_CASE(Deinterleaver)
@@ -70,21 +74,71 @@ const char* mark_to_cstr(const ProfilingMark& m) {
     return "unknown";
 }
 
-Profiler::Profiler() {
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &startup_time_cputime);
-    clock_gettime(CLOCK_MONOTONIC, &startup_time_monotonic);
-}
+struct Profiler::TraceEvent {
+    enum Kind : uint8_t { Mark, FlowBegin, FlowEnd };
+
+    uint64_t ns;
+    uint64_t id;        // flow id
+    uint8_t kind;
+    uint8_t what;       // ProfilingMark or ProfilingFlow
+};
 
-struct timespec& operator+=(struct timespec& t1, const struct timespec& t2) {
-    t1.tv_sec += t2.tv_sec;
-    t1.tv_nsec += t2.tv_nsec;
+static const char* flow_to_cstr(ProfilingFlow f) {
+    switch (f) {
+        case ProfilingFlow::Frame: return "frame";
+        case ProfilingFlow::CIF: return "cif";
+    }
+    return "unknown";
+}
 
-    if (t1.tv_nsec >= 1000000000ll) {
-        t1.tv_nsec -= 1000000000ll;
-        t1.tv_sec += 1;
+struct Profiler::ThreadProfile {
+    explicit ThreadProfile(thread::id id) : id(id) {}
+    ThreadProfile(const ThreadProfile&) = delete;
+    ThreadProfile& operator=(const ThreadProfile&) = delete;
+    ~ThreadProfile() {
+        for (auto& h : stages) {
+            delete h.load();
+        }
+        delete[] trace.load();
     }
 
-    return t1;
+    const thread::id id;
+
+    /* The last marks, the mark in the top byte and the ns since the
+     * start of the profiler below, so that a concurrent dump does not
+     * see torn entries. */
+    static constexpr size_t ringSize = 4096;
+    static constexpr int markShift = 56;
+    array<atomic<uint64_t>, ringSize> ring{};
+    atomic<uint64_t> written = ATOMIC_VAR_INIT(0);
+
+    // Durations from mark to mark, allocated when first seen
+    array<atomic<LatencyHistogram*>, numProfilingMarks * numProfilingMarks> stages{};
+
+    bool have_previous = false;
+    ProfilingMark previous = ProfilingMark::NotSynced;
+    uint64_t previous_ns = 0;
+
+    /* The events of the current trace, allocated by the thread with its
+     * first event. The writer of the trace only reads the traced first
+     * ones, of the threads that have seen its generation. */
+    static constexpr size_t traceSize = 1 << 18;
+    atomic<TraceEvent*> trace = ATOMIC_VAR_INIT(nullptr);
+    atomic<size_t> traced = ATOMIC_VAR_INIT(0);
+    atomic<uint32_t> trace_generation = ATOMIC_VAR_INIT(0);
+    char name[16] = "";
+};
+
+static uint64_t nanoseconds_since(const struct timespec& start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000000000ll + (now.tv_nsec - start.tv_nsec);
+}
+
+Profiler::Profiler() {
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &startup_time_cputime);
+    clock_gettime(CLOCK_MONOTONIC, &startup_time_monotonic);
 }
 
 struct timespec operator-(struct timespec t1, struct timespec t2) {
@@ -117,19 +171,35 @@ std::ostream& operator<<(std::ostream& out, const struct timespec& ts)
 }
 
 Profiler::~Profiler() {
+    {
+        lock_guard<mutex> lock(trace_mutex);
+        trace_shutdown = true;
+    }
+    trace_cv.notify_all();
+    if (trace_writer.joinable()) {
+        trace_writer.join();
+    }
+
     struct timespec stop_time_cputime;
     struct timespec stop_time_monotonic;
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stop_time_cputime);
     clock_gettime(CLOCK_MONOTONIC, &stop_time_monotonic);
 
+    lock_guard<mutex> lock(m_threads_mutex);
+
     ofstream dump("profiling_points.csv");
     dump << "thread_id,mark,time_sec,time_ns" << endl;
-    for (const auto tp: m_timepoints) {
-        for (const auto points : tp.second) {
-            dump << tp.first << "," <<
-                mark_to_cstr(points.p) << "," <<
-                points.timestamp.tv_sec << "," <<
-                points.timestamp.tv_nsec << endl;
+    for (const auto& tp : m_threads) {
+        const uint64_t written = tp->written.load();
+        const uint64_t first = written > ThreadProfile::ringSize ? written - ThreadProfile::ringSize : 0;
+        for (uint64_t i = first; i < written; i++) {
+            const uint64_t entry = tp->ring[i % ThreadProfile::ringSize].load();
+            const uint64_t ns = (entry & ((1ull << ThreadProfile::markShift) - 1)) +
+                startup_time_monotonic.tv_nsec;
+            dump << tp->id << "," <<
+                mark_to_cstr((ProfilingMark)(entry >> ThreadProfile::markShift)) << "," <<
+                startup_time_monotonic.tv_sec + ns / 1000000000ll << "," <<
+                ns % 1000000000ll << endl;
         }
     }
 
@@ -142,6 +212,9 @@ Profiler::~Profiler() {
     profiling << "monotonic,diff," << stop_time_monotonic - startup_time_monotonic << endl;
     profiling << "frames,decoded," << num_frames_decoded << endl;
 
+    ofstream latency("profiling_latency.csv");
+    dump_locked(latency);
+
     // See http://www.graphviz.org/documentation/
     ofstream graph("profiling.dot");
 
@@ -149,33 +222,33 @@ Profiler::~Profiler() {
 
     size_t count = 0;
 
-    for (const auto tp: m_timepoints) {
-        if (tp.second.size() < 2) {
-            continue;
-        }
-
-        graph << "subgraph cluster_" << tp.first << " { " << endl;
+    for (const auto& tp : m_threads) {
+        graph << "subgraph cluster_" << tp->id << " { " << endl;
         graph << "colorscheme=\"gnbu8\";" << endl;
         graph << "bgcolor=" << (count % 8) + 1 << ";" << endl;
         count++;
 
-        map<pair<ProfilingMark, ProfilingMark>, struct timespec> from_to_times;
-
-        for (auto it = tp.second.begin(); next(it) != tp.second.end(); ++it) {
-            from_to_times[make_pair(it->p, next(it)->p)] += next(it)->timestamp - it->timestamp;
+        // Total ms spent from mark to mark
+        map<pair<ProfilingMark, ProfilingMark>, uint64_t> from_to_times;
+        for (size_t i = 0; i < tp->stages.size(); i++) {
+            if (const LatencyHistogram *h = tp->stages[i].load()) {
+                from_to_times[make_pair(
+                        (ProfilingMark)(i / numProfilingMarks),
+                        (ProfilingMark)(i % numProfilingMarks))] = h->snapshot().sum / 1000000;
+            }
         }
 
         double maxw = 0;
         for (auto& d : from_to_times) {
-            double w = log10(1 + d.second.tv_sec * 1000 + d.second.tv_nsec / 1000000);
+            double w = log10(1 + d.second);
             if (w > maxw) maxw = w;
         }
 
         for (auto& d : from_to_times) {
-            int w = (d.second.tv_sec * 1000 + d.second.tv_nsec / 1000000);
+            int w = d.second;
 
             char color[16];
-            snprintf(color, 15, "#%02x%02x%02x", (int)(255 * log10(w+1)/maxw), 0, 0);
+            snprintf(color, 15, "#%02x%02x%02x", maxw > 0 ? (int)(255 * log10(w+1)/maxw) : 0, 0, 0);
 
             graph << mark_to_cstr(d.first.first) << " -> " << mark_to_cstr(d.first.second) <<
                 " [color=\"" << color << "\""
@@ -187,14 +260,233 @@ Profiler::~Profiler() {
     graph << "}" << endl;
 }
 
+Profiler::ThreadProfile& Profiler::thread_profile() {
+    thread_local ThreadProfile *profile = nullptr;
+    if (profile == nullptr) {
+        lock_guard<mutex> lock(m_threads_mutex);
+        m_threads.emplace_back(new ThreadProfile(this_thread::get_id()));
+        profile = m_threads.back().get();
+    }
+    return *profile;
+}
+
 void Profiler::save_time(const ProfilingMark m) {
-    const auto id = this_thread::get_id();
+    ThreadProfile& tp = thread_profile();
+    const uint64_t now = nanoseconds_since(startup_time_monotonic);
+
+    const uint64_t written = tp.written.load(memory_order_relaxed);
+    tp.ring[written % ThreadProfile::ringSize].store(
+            ((uint64_t)m << ThreadProfile::markShift) |
+            (now & ((1ull << ThreadProfile::markShift) - 1)), memory_order_relaxed);
+    tp.written.store(written + 1, memory_order_release);
+
+    if (tp.have_previous) {
+        auto& stage = tp.stages[(size_t)tp.previous * numProfilingMarks + (size_t)m];
+        LatencyHistogram *h = stage.load(memory_order_relaxed);
+        if (h == nullptr) {
+            h = new LatencyHistogram();
+            stage.store(h, memory_order_release);
+        }
+        h->add(now - tp.previous_ns);
+    }
 
-    struct timespec now;
-    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    tp.have_previous = true;
+    tp.previous = m;
+    tp.previous_ns = now;
+
+    if (trace_active.load(memory_order_relaxed)) {
+        save_trace_event(tp, now, TraceEvent::Mark, (uint8_t)m, 0);
+    }
+}
+
+void Profiler::save_flow(ProfilingFlow f, uint64_t id, bool begin) {
+    if (trace_active.load(memory_order_relaxed)) {
+        save_trace_event(thread_profile(), nanoseconds_since(startup_time_monotonic),
+                begin ? TraceEvent::FlowBegin : TraceEvent::FlowEnd, (uint8_t)f, id);
+    }
+}
+
+void Profiler::save_trace_event(ThreadProfile& tp, uint64_t now, uint8_t kind, uint8_t what, uint64_t id) {
+    const uint32_t generation = trace_generation.load(memory_order_acquire);
+    if (tp.trace_generation.load(memory_order_relaxed) != generation) {
+        if (tp.trace.load(memory_order_relaxed) == nullptr) {
+            pthread_getname_np(pthread_self(), tp.name, sizeof(tp.name));
+            tp.trace.store(new TraceEvent[ThreadProfile::traceSize], memory_order_relaxed);
+        }
+        tp.traced.store(0, memory_order_relaxed);
+        tp.trace_generation.store(generation, memory_order_release);
+    }
+
+    const size_t n = tp.traced.load(memory_order_relaxed);
+    if (now >= trace_end_ns.load(memory_order_relaxed) or n >= ThreadProfile::traceSize) {
+        return;
+    }
+    tp.trace.load(memory_order_relaxed)[n] = TraceEvent{now, id, kind, what};
+    tp.traced.store(n + 1, memory_order_release);
+}
+
+bool Profiler::start_trace(const std::string& path, double seconds) {
+    lock_guard<mutex> lock(trace_mutex);
+    if (trace_active) {
+        return false;
+    }
+    // The previous trace is written by now, or soon
+    if (trace_writer.joinable()) {
+        trace_writer.join();
+    }
+
+    ofstream out(path);
+    if (not out) {
+        cerr << "Profiler: cannot create trace " << path << endl;
+        return false;
+    }
+
+    trace_start_ns = nanoseconds_since(startup_time_monotonic);
+    trace_end_ns = trace_start_ns + (uint64_t)(max(seconds, 0.0) * 1e9);
+    const uint32_t generation = trace_generation.load() + 1;
+    trace_generation.store(generation, memory_order_release);
+    trace_active = true;
+    trace_writer = thread(&Profiler::write_trace, this, move(out), generation);
+    return true;
+}
+
+static void write_json_string(ostream& out, const char *s) {
+    out << '"';
+    for (; *s; s++) {
+        if (*s == '"' or *s == '\\') {
+            out << '\\';
+        }
+        out << *s;
+    }
+    out << '"';
+}
 
-    lock_guard<mutex> lock(m_mutex);
-    m_timepoints[id].emplace_back(now, m);
+void Profiler::write_trace(std::ofstream out, uint32_t generation) {
+    {
+        unique_lock<mutex> lock(trace_mutex);
+        while (not trace_shutdown) {
+            const uint64_t now = nanoseconds_since(startup_time_monotonic);
+            if (now >= trace_end_ns) {
+                break;
+            }
+            trace_cv.wait_for(lock, chrono::nanoseconds(trace_end_ns - now));
+        }
+    }
+    trace_active = false;
+
+    lock_guard<mutex> lock(m_threads_mutex);
+
+    // In us, as the trace viewers expect them
+    const double start_us = startup_time_monotonic.tv_sec * 1e6 + startup_time_monotonic.tv_nsec / 1e3;
+    const double end_us = start_us + trace_end_ns / 1e3;
+    const int pid = getpid();
+    size_t events = 0;
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << endl;
+    out.precision(3);
+    out << fixed;
+    const char *separator = "";
+    for (size_t tid = 0; tid < m_threads.size(); tid++) {
+        const ThreadProfile& tp = *m_threads[tid];
+        if (tp.trace_generation.load(memory_order_acquire) != generation) {
+            continue;
+        }
+        const size_t n = tp.traced.load(memory_order_acquire);
+        const TraceEvent *trace = tp.trace.load(memory_order_relaxed);
+
+        const string name = tp.name[0] ? tp.name : "thread " + to_string(tid);
+        out << separator << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid <<
+            ",\"tid\":" << tid << ",\"args\":{\"name\":";
+        write_json_string(out, name.c_str());
+        out << "}}";
+        separator = ",\n";
+
+        // Every mark ends the stage of the previous one, and begins its own
+        bool open = false;
+        for (size_t i = 0; i < n; i++) {
+            const TraceEvent& e = trace[i];
+            const double ts = start_us + e.ns / 1e3;
+            switch (e.kind) {
+                case TraceEvent::Mark:
+                    if (open) {
+                        out << separator << "{\"ph\":\"E\",\"pid\":" << pid <<
+                            ",\"tid\":" << tid << ",\"ts\":" << ts << "}";
+                    }
+                    out << separator << "{\"ph\":\"B\",\"name\":\"" <<
+                        mark_to_cstr((ProfilingMark)e.what) << "\",\"pid\":" << pid <<
+                        ",\"tid\":" << tid << ",\"ts\":" << ts << "}";
+                    open = true;
+                    break;
+                case TraceEvent::FlowBegin:
+                case TraceEvent::FlowEnd:
+                    {
+                        const char *flow = flow_to_cstr((ProfilingFlow)e.what);
+                        out << separator << "{\"ph\":\"" <<
+                            (e.kind == TraceEvent::FlowBegin ? "s" : "f") <<
+                            "\",\"bp\":\"e\",\"name\":\"" << flow << "\",\"cat\":\"" << flow <<
+                            "\",\"id\":" << e.id << ",\"pid\":" << pid <<
+                            ",\"tid\":" << tid << ",\"ts\":" << ts << "}";
+                    }
+                    break;
+            }
+        }
+        if (open) {
+            out << separator << "{\"ph\":\"E\",\"pid\":" << pid <<
+                ",\"tid\":" << tid << ",\"ts\":" << end_us << "}";
+        }
+        events += n;
+    }
+    out << endl << "]}" << endl;
+
+    clog << "Profiler: trace of " << events << " events written" << endl;
+}
+
+void Profiler::dump(std::ostream& out) const {
+    lock_guard<mutex> lock(m_threads_mutex);
+    dump_locked(out);
+}
+
+std::vector<Profiler::Stage> Profiler::stages() const {
+    lock_guard<mutex> lock(m_threads_mutex);
+    return stages_locked();
+}
+
+std::vector<Profiler::Stage> Profiler::stages_locked() const {
+    // The same stage in several threads, e.g. the audio decoders, is merged
+    map<pair<ProfilingMark, ProfilingMark>, LatencyHistogram::Snapshot> merged;
+    for (const auto& tp : m_threads) {
+        for (size_t i = 0; i < tp->stages.size(); i++) {
+            if (const LatencyHistogram *h = tp->stages[i].load(memory_order_acquire)) {
+                merged[make_pair(
+                        (ProfilingMark)(i / numProfilingMarks),
+                        (ProfilingMark)(i % numProfilingMarks))].merge(h->snapshot());
+            }
+        }
+    }
+
+    std::vector<Stage> stages;
+    for (const auto& stage : merged) {
+        stages.push_back(Stage{stage.first.first, stage.first.second, stage.second});
+    }
+    return stages;
+}
+
+void Profiler::dump_locked(std::ostream& out) const {
+    out << "from,to,count,mean_us,p50_us,p99_us,max_us" << endl;
+    for (const auto& stage : stages_locked()) {
+        const LatencyHistogram::Snapshot& l = stage.latency;
+        if (l.count == 0) {
+            continue;
+        }
+
+        out << mark_to_cstr(stage.from) << "," <<
+            mark_to_cstr(stage.to) << "," <<
+            l.count << "," <<
+            l.sum / l.count / 1000.0 << "," <<
+            l.percentile(0.5) / 1000.0 << "," <<
+            l.percentile(0.99) / 1000.0 << "," <<
+            l.max / 1000.0 << endl;
+    }
 }
 
 void Profiler::frame_decoded() {
@@ -26,15 +26,25 @@
 
 #if defined(WITH_PROFILING)
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <condition_variable>
 #include <ctime>
-#include <list>
-#include <unordered_map>
-#include <thread>
+#include <fstream>
+#include <memory>
 #include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "latency-histogram.h"
 
 #define PROFILE(m) get_profiler().save_time(ProfilingMark::m)
 #define PROFILE_FRAME_DECODED() get_profiler().frame_decoded()
+#define PROFILE_FLOW_BEGIN(f, id) get_profiler().save_flow(ProfilingFlow::f, id, true)
+#define PROFILE_FLOW_END(f, id) get_profiler().save_flow(ProfilingFlow::f, id, false)
 
 enum class ProfilingMark {
     NotSynced,
@@ -46,6 +56,7 @@ enum class ProfilingMark {
     OnNewNull,
     DecodeTII,
 
+    FrameFFT,
     ProcessPRS,
     ProcessSymbol,
     Deinterleaver,
@@ -61,17 +72,19 @@ enum class ProfilingMark {
     DADone,
 };
 
-struct ProfilingTimepoint {
-    ProfilingTimepoint(
-            struct timespec timestamp,
-            ProfilingMark p) :
-        timestamp(timestamp),
-        p(p) { }
+constexpr size_t numProfilingMarks = (size_t)ProfilingMark::DADone + 1;
 
-    struct timespec timestamp;
-    ProfilingMark p;
+/* Work handed from one thread to another, shown as an arrow from the
+ * stage of the sender to the stage of the receiver in a trace */
+enum class ProfilingFlow {
+    Frame,  // OFDMProcessor to OfdmDecoder, by frame number
+    CIF,    // MscHandler to the audio decoder of a subchannel
 };
 
+/* Records the time of the marks per thread and the durations between
+ * consecutive marks of a thread, the stages. Each thread writes its own
+ * ring buffer of the last marks and its own histograms, without locks.
+ * Only the first mark of a thread takes a mutex, to register it. */
 class Profiler
 {
     public:
@@ -82,21 +95,69 @@ class Profiler
 
         void save_time(const ProfilingMark m);
         void frame_decoded();
+        void save_flow(ProfilingFlow f, uint64_t id, bool begin);
+
+        /* Record the marks and flows of all threads from now on for the
+         * given time, as the stages between the marks. When the time is
+         * up, the trace is written to path in the Chrome trace event
+         * format, for chrome://tracing or ui.perfetto.dev. Returns false
+         * if the file cannot be created or a trace is still recorded. */
+        bool start_trace(const std::string& path, double seconds);
+
+        // Flow ids for work that has no number of its own
+        uint64_t next_flow_id(void) { return ++flow_ids; }
+
+        /* Write the latency of all stages seen so far, as CSV with one
+         * line per stage, p50, p99 and max in microseconds. Can be called
+         * at any time from any thread. */
+        void dump(std::ostream& out) const;
+
+        // The durations from mark to mark, merged over the threads
+        struct Stage {
+            ProfilingMark from;
+            ProfilingMark to;
+            LatencyHistogram::Snapshot latency;
+        };
+        std::vector<Stage> stages(void) const;
+
     private:
-        std::mutex m_mutex;
-        std::unordered_map<
-            std::thread::id,
-            std::list<ProfilingTimepoint> > m_timepoints;
+        struct ThreadProfile;
+        ThreadProfile& thread_profile();
+        void dump_locked(std::ostream& out) const;
+        std::vector<Stage> stages_locked(void) const;
+
+        struct TraceEvent;
+        void save_trace_event(ThreadProfile& tp, uint64_t now, uint8_t kind, uint8_t what, uint64_t id);
+        void write_trace(std::ofstream out, uint32_t generation);
+
+        /* A trace runs from trace_start_ns to trace_end_ns. Each thread
+         * fills its own buffer, and starts over when it sees a new
+         * trace_generation. */
+        std::atomic<bool> trace_active = ATOMIC_VAR_INIT(false);
+        std::atomic<uint32_t> trace_generation = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> trace_end_ns = ATOMIC_VAR_INIT(0);
+        uint64_t trace_start_ns = 0;
+        std::atomic<uint64_t> flow_ids = ATOMIC_VAR_INIT(0);
+        std::mutex trace_mutex;
+        std::condition_variable trace_cv;
+        bool trace_shutdown = false;
+        std::thread trace_writer;
+
+        mutable std::mutex m_threads_mutex;
+        std::vector<std::unique_ptr<ThreadProfile> > m_threads;
 
         struct timespec startup_time_cputime;
         struct timespec startup_time_monotonic;
-        size_t num_frames_decoded = 0;
+        std::atomic<size_t> num_frames_decoded = ATOMIC_VAR_INIT(0);
 };
 
 Profiler& get_profiler(void);
+const char* mark_to_cstr(const ProfilingMark& m);
 
 #else
 # define PROFILE(m)
 # define PROFILE_FRAME_DECODED()
+# define PROFILE_FLOW_BEGIN(f, id)
+# define PROFILE_FLOW_END(f, id)
 #endif // defined(WITH_PROFILING)
 
@@ -74,59 +74,49 @@
 #include    <stdio.h>
 #include    <string.h>
 #include    <stdint.h>
+#include    <algorithm>
+#include    <atomic>
+#include    <chrono>
+#include    <thread>
 #include    <iostream>
+#include    "locked-memory.h"
 
 /*
  *  a simple ringbuffer, lockfree, however only for a
  *  single reader and a single writer.
  *  Mostly used for getting samples from or to the soundcard
+ *
+ *  The writer publishes its data by a release store of the write index,
+ *  the reader hands back space by a release store of the read index.
+ *  The indices live on separate cache lines (the alignment also pads the
+ *  object), so the reader and the writer thread do not invalidate each
+ *  other's line on every update.
+ */
+
+// Size of the destructive interference range, std::hardware_destructive_interference_size
+// is not available with all supported compilers.
+#define RINGBUFFER_CACHE_LINE_SIZE 64
+
+/*
+ *  The two contiguous parts of a region in the buffer. If the region does
+ *  not wrap around, size2 is zero.
  */
-#if defined(__APPLE__)
-#   include <libkern/OSAtomic.h>
-    /* Here are the memory barrier functions. Mac OS X only provides
-       full memory barriers, so the three types of barriers are the same,
-       however, these barriers are superior to compiler-based ones. */
-#   define PaUtil_FullMemoryBarrier()  OSMemoryBarrier()
-#   define PaUtil_ReadMemoryBarrier()  OSMemoryBarrier()
-#   define PaUtil_WriteMemoryBarrier() OSMemoryBarrier()
-#elif defined(__GNUC__)
-    /* GCC >= 4.1 has built-in intrinsics. We'll use those */
-#   if (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1)
-# define PaUtil_FullMemoryBarrier()  __sync_synchronize()
-# define PaUtil_ReadMemoryBarrier()  __sync_synchronize()
-# define PaUtil_WriteMemoryBarrier() __sync_synchronize()
-    /* as a fallback, GCC understands volatile asm and "memory" to mean it
-     * should not reorder memory read/writes */
-#   elif defined( __PPC__ )
-#      define PaUtil_FullMemoryBarrier()  asm volatile("sync":::"memory")
-#      define PaUtil_ReadMemoryBarrier()  asm volatile("sync":::"memory")
-#      define PaUtil_WriteMemoryBarrier() asm volatile("sync":::"memory")
-#   elif defined( __i386__ ) || defined( __i486__ ) || defined( __i586__ ) || defined( __i686__ ) || defined( __x86_64__ )
-#      define PaUtil_FullMemoryBarrier()  asm volatile("mfence":::"memory")
-#      define PaUtil_ReadMemoryBarrier()  asm volatile("lfence":::"memory")
-#      define PaUtil_WriteMemoryBarrier() asm volatile("sfence":::"memory")
-#   else
-#      ifdef ALLOW_SMP_DANGERS
-#         warning Memory barriers not defined on this system or system unknown
-#         warning For SMP safety, you should fix this.
-#         define PaUtil_FullMemoryBarrier()
-#         define PaUtil_ReadMemoryBarrier()
-#         define PaUtil_WriteMemoryBarrier()
-#      else
-#         error Memory barriers are not defined on this system. You can still compile by defining ALLOW_SMP_DANGERS, but SMP safety will not be guaranteed.
-#      endif
-#   endif
-#else
-#   ifdef ALLOW_SMP_DANGERS
-#      warning Memory barriers not defined on this system or system unknown
-#      warning For SMP safety, you should fix this.
-#      define PaUtil_FullMemoryBarrier()
-#      define PaUtil_ReadMemoryBarrier()
-#      define PaUtil_WriteMemoryBarrier()
-#   else
-#      error Memory barriers are not defined on this system. You can still compile by defining ALLOW_SMP_DANGERS, but SMP safety will not be guaranteed.
-#   endif
-#endif
+template <class elementtype>
+struct RingBufferSpans
+{
+    elementtype *data1 = nullptr;
+    int32_t     size1 = 0;
+    elementtype *data2 = nullptr;
+    int32_t     size2 = 0;
+
+    int32_t size(void) const {
+        return size1 + size2;
+    }
+
+    elementtype& operator[](int32_t i) const {
+        return i < size1 ? data1[i] : data2[i - size1];
+    }
+};
 
 // Base implementation
 template <class elementtype>
@@ -134,11 +124,40 @@ class RingBuffer
 {
     private:
         uint32_t    bufferSize;
-        volatile    uint32_t    writeIndex;
-        volatile    uint32_t    readIndex;
         uint32_t    bigMask;
         uint32_t    smallMask;
-        std::vector<char> buffer;
+        // Locked with lockedmemory::Mode::Lock, see locked-memory.h
+        std::vector<elementtype, lockedmemory::Allocator<elementtype>> buffer;
+
+        alignas(RINGBUFFER_CACHE_LINE_SIZE) std::atomic<uint32_t> writeIndex;
+        alignas(RINGBUFFER_CACHE_LINE_SIZE) std::atomic<uint32_t> readIndex;
+        // Start of the elements claimed by claimRead, noHold otherwise
+        std::atomic<uint32_t> holdIndex;
+        static constexpr uint32_t noHold = UINT32_MAX;
+
+        // Where the writer has to stop
+        uint32_t readLimit(void) const {
+            const uint32_t hold = holdIndex.load(std::memory_order_seq_cst);
+            return hold != noHold ? hold : readIndex.load(std::memory_order_acquire);
+        }
+
+        RingBufferSpans<elementtype> spansAt(uint32_t index, uint32_t elementCount) {
+            RingBufferSpans<elementtype> spans;
+            index &= smallMask;
+
+            spans.data1 = &buffer[index];
+            if ((index + elementCount) > bufferSize) {
+                /* The region wraps around the end of the buffer */
+                spans.size1 = bufferSize - index;
+                spans.data2 = &buffer[0];
+                spans.size2 = elementCount - spans.size1;
+            }
+            else {
+                spans.size1 = elementCount;
+            }
+
+            return spans;
+        }
 
     protected:
         void onDroppedData(int32_t droppedElements) {
@@ -152,9 +171,10 @@ class RingBuffer
                 elementCount = 2 * 16384;   /* default  */
 
             bufferSize  = elementCount;
-            buffer.resize(2 * bufferSize * sizeof (elementtype));
+            buffer.resize(bufferSize);
             writeIndex  = 0;
             readIndex   = 0;
+            holdIndex   = noHold;
             smallMask   = (elementCount)- 1;
             bigMask     = (elementCount * 2) - 1;
         }
@@ -163,12 +183,13 @@ class RingBuffer
          *  functions for checking available data for reading and space
          *  for writing
          */
-        int32_t GetBufferSize(void) {
+        int32_t GetBufferSize(void) const {
             return bufferSize;
         }
 
         int32_t GetRingBufferReadAvailable (void) {
-            return (writeIndex - readIndex) & bigMask;
+            return (writeIndex.load(std::memory_order_acquire) -
+                    readIndex.load(std::memory_order_acquire)) & bigMask;
         }
 
         int32_t ReadSpace   (void){
@@ -176,32 +197,145 @@ class RingBuffer
         }
 
         int32_t GetRingBufferWriteAvailable (void) {
-            return  bufferSize - GetRingBufferReadAvailable ();
+            return  bufferSize - ((writeIndex.load(std::memory_order_acquire) -
+                        readLimit()) & bigMask);
         }
 
         int32_t WriteSpace  (void) {
             return GetRingBufferWriteAvailable ();
         }
 
+        /* The space of the writer once the reader released its claim,
+         * which is what skipOldest makes room in */
+        int32_t GetRingBufferUnclaimedSpace (void) {
+            return  bufferSize - ((writeIndex.load(std::memory_order_acquire) -
+                        readIndex.load(std::memory_order_acquire)) & bigMask);
+        }
+
+        /* Neither the reader nor the writer may be active */
         void    FlushRingBuffer () {
-            writeIndex  = 0;
-            readIndex   = 0;
+            writeIndex.store(0, std::memory_order_relaxed);
+            readIndex.store(0, std::memory_order_release);
         }
-        /* ensure that previous writes are seen before we update the write index
-           (write after write)
-           */
-        int32_t AdvanceRingBufferWriteIndex (int32_t elementCount) {
-            PaUtil_WriteMemoryBarrier();
-            return writeIndex = (writeIndex + elementCount) & bigMask;
+
+        /* Reallocates the buffer empty, elementCount has to be a power
+         * of two. Neither the reader nor the writer may be active */
+        void    Resize (uint32_t elementCount) {
+            if (((elementCount - 1) & elementCount) != 0 or elementCount == bufferSize)
+                return;
+
+            std::vector<elementtype, lockedmemory::Allocator<elementtype>>(elementCount).swap(buffer);
+            bufferSize  = elementCount;
+            smallMask   = elementCount - 1;
+            bigMask     = (elementCount * 2) - 1;
+            holdIndex   = noHold;
+            FlushRingBuffer();
         }
 
-        /* ensure that previous reads (copies out of the ring buffer) are
-         * always completed before updating (writing) the read index.
-         * (write-after-read) => full barrier
+        /*
+         *  Zero-copy access. peekWrite() returns the free space, up to
+         *  elementCount elements, for the writer to fill in place.
+         *  commitWrite() then publishes the elements to the reader.
+         *  peekRead() returns the readable data, up to elementCount
+         *  elements, which stays valid until commitRead() hands the space
+         *  back to the writer. Only the writer may call the write functions,
+         *  and only the reader the read functions.
          */
+        RingBufferSpans<elementtype> peekWrite (int32_t elementCount) {
+            const uint32_t index = writeIndex.load(std::memory_order_relaxed);
+            const uint32_t available = bufferSize - ((index - readLimit()) & bigMask);
+            return spansAt(index, std::min<uint32_t>(elementCount, available));
+        }
+
+        void commitWrite (int32_t elementCount) {
+            const uint32_t index = writeIndex.load(std::memory_order_relaxed);
+            writeIndex.store((index + elementCount) & bigMask, std::memory_order_release);
+        }
+
+        RingBufferSpans<elementtype> peekRead (int32_t elementCount) {
+            const uint32_t index = readIndex.load(std::memory_order_relaxed);
+            const uint32_t available =
+                (writeIndex.load(std::memory_order_acquire) - index) & bigMask;
+            return spansAt(index, std::min<uint32_t>(elementCount, available));
+        }
+
+        void commitRead (int32_t elementCount) {
+            const uint32_t index = readIndex.load(std::memory_order_relaxed);
+            readIndex.store((index + elementCount) & bigMask, std::memory_order_release);
+        }
+
+        /* For a reader that competes with a writer dropping the oldest
+         * data instead of waiting, see skipOldest. The reader claims the
+         * elements, reads them in place and releases them, until then
+         * the writer does not overwrite them. Returns no elements if
+         * fewer than elementCount are available. */
+        RingBufferSpans<elementtype> claimRead (int32_t elementCount) {
+            uint32_t index = readIndex.load(std::memory_order_acquire);
+            do {
+                holdIndex.store(index, std::memory_order_seq_cst);
+                const uint32_t available =
+                    (writeIndex.load(std::memory_order_acquire) - index) & bigMask;
+                if (available < (uint32_t)elementCount) {
+                    releaseRead();
+                    return RingBufferSpans<elementtype>();
+                }
+            } while (not readIndex.compare_exchange_weak(index,
+                        (index + elementCount) & bigMask,
+                        std::memory_order_seq_cst, std::memory_order_acquire));
+            return spansAt(index, elementCount);
+        }
+
+        void releaseRead (void) {
+            holdIndex.store(noHold, std::memory_order_release);
+        }
+
+        /* Called by the writer, discard the oldest elementCount elements
+         * as long as the reader did not claim them. The claimed elements
+         * are the oldest ones, so the space only becomes writable when
+         * the reader releases them, see GetRingBufferUnclaimedSpace. */
+        bool skipOldest (int32_t elementCount) {
+            uint32_t index = readIndex.load(std::memory_order_acquire);
+            do {
+                const uint32_t available =
+                    (writeIndex.load(std::memory_order_relaxed) - index) & bigMask;
+                if (available < (uint32_t)elementCount)
+                    return false;
+            } while (not readIndex.compare_exchange_weak(index,
+                        (index + elementCount) & bigMask,
+                        std::memory_order_seq_cst, std::memory_order_acquire));
+            return true;
+        }
+
+        /* Called by the writer, make room for elementCount elements by
+         * discarding the oldest unclaimed units of unitCount elements, and
+         * calls onSkip() for each. Space held by a claim of the reader is
+         * only waited for, up to timeout, it ends with its release.
+         * Returns whether the room is there. */
+        template <class F>
+        bool makeRoom (int32_t elementCount, int32_t unitCount,
+                std::chrono::steady_clock::duration timeout, F onSkip) {
+            while (GetRingBufferUnclaimedSpace() < elementCount and
+                    skipOldest(unitCount)) {
+                onSkip();
+            }
+
+            const auto deadline = std::chrono::steady_clock::now() + timeout;
+            while (GetRingBufferWriteAvailable() < elementCount and
+                    GetRingBufferUnclaimedSpace() >= elementCount and
+                    std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::yield();
+            }
+            return GetRingBufferWriteAvailable() >= elementCount;
+        }
+
+        int32_t AdvanceRingBufferWriteIndex (int32_t elementCount) {
+            commitWrite(elementCount);
+            return writeIndex.load(std::memory_order_relaxed);
+        }
+
         int32_t AdvanceRingBufferReadIndex (int32_t elementCount) {
-            PaUtil_FullMemoryBarrier();
-            return readIndex = (readIndex + elementCount) & bigMask;
+            commitRead(elementCount);
+            return readIndex.load(std::memory_order_relaxed);
         }
 
         /***************************************************************************
@@ -213,33 +347,12 @@ class RingBuffer
         int32_t GetRingBufferWriteRegions (uint32_t elementCount,
                 void **dataPtr1, int32_t *sizePtr1,
                 void **dataPtr2, int32_t *sizePtr2 ) {
-            uint32_t   index;
-            uint32_t   available = GetRingBufferWriteAvailable ();
-
-            if (elementCount > available)
-                elementCount = available;
-
-            /* Check to see if write is not contiguous. */
-            index = writeIndex & smallMask;
-            if ((index + elementCount) > bufferSize ) {
-                /* Write data in two blocks that wrap the buffer. */
-                int32_t   firstHalf = bufferSize - index;
-                *dataPtr1    = &buffer[index * sizeof(elementtype)];
-                *sizePtr1    = firstHalf;
-                *dataPtr2    = &buffer[0];
-                *sizePtr2    = elementCount - firstHalf;
-            }
-            else {      // fits
-                *dataPtr1    = &buffer[index * sizeof(elementtype)];
-                *sizePtr1    = elementCount;
-                *dataPtr2    = NULL;
-                *sizePtr2    = 0;
-            }
-
-            if (available > 0)
-                PaUtil_FullMemoryBarrier(); /* (write-after-read) => full barrier */
-
-            return elementCount;
+            const auto spans = peekWrite(elementCount);
+            *dataPtr1 = spans.data1;
+            *sizePtr1 = spans.size1;
+            *dataPtr2 = spans.data2;
+            *sizePtr2 = spans.size2;
+            return spans.size();
         }
 
         /***************************************************************************
@@ -251,86 +364,46 @@ class RingBuffer
         int32_t GetRingBufferReadRegions (uint32_t elementCount,
                 void **dataPtr1, int32_t *sizePtr1,
                 void **dataPtr2, int32_t *sizePtr2) {
-            uint32_t   index;
-            uint32_t   available = GetRingBufferReadAvailable (); /* doesn't use memory barrier */
-
-            if (elementCount > available)
-                elementCount = available;
-
-            /* Check to see if read is not contiguous. */
-            index = readIndex & smallMask;
-            if ((index + elementCount) > bufferSize) {
-                /* Write data in two blocks that wrap the buffer. */
-                int32_t firstHalf = bufferSize - index;
-                *dataPtr1 = &buffer[index * sizeof(elementtype)];
-                *sizePtr1 = firstHalf;
-                *dataPtr2 = &buffer[0];
-                *sizePtr2 = elementCount - firstHalf;
-            }
-            else {
-                *dataPtr1 = &buffer[index * sizeof(elementtype)];
-                *sizePtr1 = elementCount;
-                *dataPtr2 = NULL;
-                *sizePtr2 = 0;
-            }
-
-            if (available)
-                PaUtil_ReadMemoryBarrier(); /* (read-after-read) => read barrier */
-
-            return elementCount;
+            const auto spans = peekRead(elementCount);
+            *dataPtr1 = spans.data1;
+            *sizePtr1 = spans.size1;
+            *dataPtr2 = spans.data2;
+            *sizePtr2 = spans.size2;
+            return spans.size();
         }
 
         int32_t putDataIntoBuffer (const void *data, int32_t elementCount) {
-            int32_t size1, size2, numWritten;
-            void    *data1;
-            void    *data2;
+            const auto spans = peekWrite(elementCount);
 
-            int32_t freeSpace = GetRingBufferWriteAvailable();
-            int32_t droppedElements = elementCount - freeSpace;
+            int32_t droppedElements = elementCount - spans.size();
             if(droppedElements > 0)
                 onDroppedData(droppedElements);
 
-            numWritten = GetRingBufferWriteRegions (elementCount,
-                    &data1, &size1,
-                    &data2, &size2 );
-            if (size2 > 0) {
-                memcpy (data1, data, size1 * sizeof(elementtype));
-                data = ((char *)data) + size1 * sizeof(elementtype);
-                memcpy (data2, data, size2 * sizeof(elementtype));
-            }
-            else
-                memcpy (data1, data, size1 * sizeof(elementtype));
+            const elementtype *src = static_cast<const elementtype*>(data);
+            memcpy (spans.data1, src, spans.size1 * sizeof(elementtype));
+            if (spans.size2 > 0)
+                memcpy (spans.data2, src + spans.size1, spans.size2 * sizeof(elementtype));
 
-            AdvanceRingBufferWriteIndex (numWritten );
-            return numWritten;
+            commitWrite (spans.size());
+            return spans.size();
         }
 
         int32_t getDataFromBuffer (void *data, int32_t elementCount ) {
-            int32_t size1, size2, numRead;
-            void    *data1;
-            void    *data2;
-
-            numRead = GetRingBufferReadRegions (elementCount,
-                    &data1, &size1,
-                    &data2, &size2 );
-            if (size2 > 0) {
-                memcpy (data, data1, size1 * sizeof(elementtype));
-                data = ((char *)data) + size1 *  sizeof(elementtype);
-                memcpy (data, data2, size2 * sizeof(elementtype));
-            }
-            else
-                memcpy (data, data1, size1 * sizeof(elementtype));
+            const auto spans = peekRead(elementCount);
+
+            elementtype *dst = static_cast<elementtype*>(data);
+            memcpy (dst, spans.data1, spans.size1 * sizeof(elementtype));
+            if (spans.size2 > 0)
+                memcpy (dst + spans.size1, spans.data2, spans.size2 * sizeof(elementtype));
 
-            AdvanceRingBufferReadIndex (numRead );
-            return numRead;
+            commitRead (spans.size());
+            return spans.size();
         }
 
         int32_t skipDataInBuffer (int32_t n_values) {
-            //  ensure that we have the correct read and write indices
-            PaUtil_FullMemoryBarrier ();
             if (n_values > GetRingBufferReadAvailable ())
                 n_values = GetRingBufferReadAvailable ();
-            AdvanceRingBufferReadIndex (n_values);
+            commitRead (n_values);
             return n_values;
         }
 
@@ -0,0 +1,146 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <utility>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Sleep while word holds expected, at most for timeout
+inline void futexWait(std::atomic<uint32_t>& word, uint32_t expected,
+        std::chrono::milliseconds timeout)
+{
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+            "the futex needs a plain 32 bit word");
+
+    struct timespec ts;
+    ts.tv_sec = timeout.count() / 1000;
+    ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word),
+            FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+}
+
+inline void futexWake(std::atomic<uint32_t>& word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word),
+            FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+/* Bounded queue between exactly one producer and one consumer thread.
+ * push() and pop() are wait-free. A consumer finding the queue empty
+ * can park in waitForData(), which sleeps on a futex; the producer only
+ * makes the wake-up syscall when the consumer is actually parked.
+ * The elements are moved in and out, so for vectors only the handles
+ * travel through the queue. */
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity > 0 and (Capacity & (Capacity - 1)) == 0,
+            "Capacity must be a power of two");
+
+    public:
+        // Producer side. Returns false, leaving value untouched, if full.
+        bool push(T&& value)
+        {
+            const uint32_t t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) == Capacity) {
+                return false;
+            }
+
+            slots[t % Capacity] = std::move(value);
+            tail.store(t + 1, std::memory_order_seq_cst);
+
+            if (parked.load(std::memory_order_seq_cst)) {
+                wake();
+            }
+            return true;
+        }
+
+        // Consumer side. Returns false if empty.
+        bool pop(T& value)
+        {
+            const uint32_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            value = std::move(slots[h % Capacity]);
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side. Returns once the queue is not empty, wake() was
+        // called or the timeout expired.
+        void waitForData(std::chrono::milliseconds timeout)
+        {
+            const uint32_t h = head.load(std::memory_order_relaxed);
+            const uint32_t t = tail.load(std::memory_order_acquire);
+            if (h != t) {
+                return;
+            }
+
+            parked.store(1, std::memory_order_seq_cst);
+            // A push between the first check and parking changed tail,
+            // the futex then returns immediately
+            if (tail.load(std::memory_order_seq_cst) == t) {
+                futexWait(tail, t, timeout);
+            }
+            parked.store(0, std::memory_order_relaxed);
+        }
+
+        // Wake a parked consumer, e.g. to make it check for shutdown
+        void wake()
+        {
+            futexWake(tail);
+        }
+
+        // Exact from either side for its own operations, a snapshot otherwise
+        size_t size() const
+        {
+            return tail.load(std::memory_order_acquire) -
+                head.load(std::memory_order_acquire);
+        }
+
+        bool empty() const { return size() == 0; }
+
+        static constexpr size_t capacity() { return Capacity; }
+
+    private:
+        // Producer and consumer index on separate cache lines
+        alignas(64) std::atomic<uint32_t> tail = ATOMIC_VAR_INIT(0);
+        alignas(64) std::atomic<uint32_t> head = ATOMIC_VAR_INIT(0);
+        alignas(64) std::atomic<uint32_t> parked = ATOMIC_VAR_INIT(0);
+        std::array<T, Capacity> slots;
+};
+
+#endif // SPSC_QUEUE_H
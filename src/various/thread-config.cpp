@@ -0,0 +1,202 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "thread-config.h"
+
+namespace threading {
+
+struct RegisteredThread {
+    ThreadStage stage;
+    pthread_t handle;
+    pid_t tid;
+    std::string name;
+};
+
+static std::mutex registryMutex;
+static ThreadingOptions currentOptions;
+static std::list<RegisteredThread> registeredThreads;
+// CPU time of the threads that ended, per stage
+static std::array<double, NUM_THREAD_STAGES> endedCpuTime = {};
+
+static double cpuTime(clockid_t clock)
+{
+    struct timespec ts;
+    if (clock_gettime(clock, &ts) != 0) {
+        return 0;
+    }
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void apply(const RegisteredThread& t, const ThreadSettings& settings)
+{
+    if (not settings.cpus.empty()) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (int cpu : settings.cpus) {
+            if (cpu >= 0 and cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &cpuset);
+            }
+        }
+
+        const int ret = pthread_setaffinity_np(t.handle, sizeof(cpuset), &cpuset);
+        if (ret != 0) {
+            std::clog << "Threading: cannot set the CPU affinity of " << t.name <<
+                ": " << strerror(ret) << std::endl;
+        }
+    }
+
+    struct sched_param param = {};
+    int policy = SCHED_OTHER;
+    if (settings.realtimePriority > 0) {
+        policy = SCHED_FIFO;
+        param.sched_priority = std::min(settings.realtimePriority,
+                sched_get_priority_max(SCHED_FIFO));
+    }
+
+    const int ret = pthread_setschedparam(t.handle, policy, &param);
+    if (ret != 0) {
+        std::clog << "Threading: cannot set the scheduling of " << t.name <<
+            ": " << strerror(ret) << std::endl;
+    }
+
+    // The nice level is per thread on Linux
+    if (policy == SCHED_OTHER and
+            setpriority(PRIO_PROCESS, t.tid, settings.nice) == -1) {
+        std::clog << "Threading: cannot set the nice level of " << t.name <<
+            ": " << strerror(errno) << std::endl;
+    }
+}
+
+static bool isDefault(const ThreadSettings& settings)
+{
+    return settings.cpus.empty() and
+        settings.realtimePriority == 0 and
+        settings.nice == 0;
+}
+
+void configure(const ThreadingOptions& options)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    const ThreadingOptions previous = currentOptions;
+    currentOptions = options;
+
+    for (const auto& t : registeredThreads) {
+        const auto& settings = currentOptions[t.stage];
+        // Leave threads alone nobody ever asked to change
+        if (not isDefault(settings) or not isDefault(previous[t.stage])) {
+            apply(t, settings);
+        }
+    }
+}
+
+ThreadStage stageFromString(const std::string& name)
+{
+    if (name == "input") return ThreadStage::Input;
+    if (name == "agc") return ThreadStage::Agc;
+    if (name == "sync") return ThreadStage::Sync;
+    if (name == "ofdm") return ThreadStage::OfdmDecoder;
+    if (name == "demodulator") return ThreadStage::Demodulator;
+    if (name == "audio") return ThreadStage::AudioDecoder;
+    if (name == "tii") return ThreadStage::Tii;
+    if (name == "output") return ThreadStage::Output;
+    throw std::invalid_argument("unknown pipeline stage: " + name);
+}
+
+const char *stageToString(ThreadStage stage)
+{
+    switch (stage) {
+        case ThreadStage::Input: return "input";
+        case ThreadStage::Agc: return "agc";
+        case ThreadStage::Sync: return "sync";
+        case ThreadStage::OfdmDecoder: return "ofdm";
+        case ThreadStage::Demodulator: return "demodulator";
+        case ThreadStage::AudioDecoder: return "audio";
+        case ThreadStage::Tii: return "tii";
+        case ThreadStage::Output: return "output";
+    }
+    return "unknown";
+}
+
+std::array<double, NUM_THREAD_STAGES> stageCpuTime()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::array<double, NUM_THREAD_STAGES> total = endedCpuTime;
+
+    // A registered thread is alive, it unregisters before it ends
+    for (const auto& t : registeredThreads) {
+        clockid_t clock;
+        if (pthread_getcpuclockid(t.handle, &clock) == 0) {
+            total[(size_t)t.stage] += cpuTime(clock);
+        }
+    }
+    return total;
+}
+
+ScopedThread::ScopedThread(ThreadStage stage, const char *name)
+{
+    // Linux limits thread names to 16 bytes including the terminator
+    char shortName[16];
+    strncpy(shortName, name, sizeof(shortName) - 1);
+    shortName[sizeof(shortName) - 1] = '\0';
+    pthread_setname_np(pthread_self(), shortName);
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registeredThreads.push_back(RegisteredThread{
+            stage, pthread_self(), (pid_t)syscall(SYS_gettid), shortName});
+
+    if (not isDefault(currentOptions[stage])) {
+        apply(registeredThreads.back(), currentOptions[stage]);
+    }
+}
+
+ScopedThread::~ScopedThread()
+{
+    const double used = cpuTime(CLOCK_THREAD_CPUTIME_ID);
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    const pthread_t self = pthread_self();
+    registeredThreads.remove_if([self, used](const RegisteredThread& t) {
+            if (not pthread_equal(t.handle, self)) {
+                return false;
+            }
+            endedCpuTime[(size_t)t.stage] += used;
+            return true; });
+}
+
+} // namespace threading
@@ -0,0 +1,100 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef THREAD_CONFIG_H
+#define THREAD_CONFIG_H
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/* The threads of the receive pipeline, from the device to the
+ * audio decoders. Every thread belongs to one stage, and all threads
+ * of a stage share its settings. */
+enum class ThreadStage {
+    Input,          // Device read threads (rtl-sdr, rtl_tcp, wideband front end)
+    Agc,            // Software AGC timer of rtl_tcp, rtl-sdr runs it on the read thread
+    Sync,           // OFDMProcessor, time and frequency synchronisation
+    OfdmDecoder,    // OfdmDecoder, FIC and MSC hand-off
+    Demodulator,    // Additional FFT/demodulation threads of OfdmDecoder
+    AudioDecoder,   // Shared WorkerPool decoding the subchannels
+    Tii,            // TII decoder
+    Output,         // HTTP stream server, I/Q recorder
+};
+
+constexpr size_t NUM_THREAD_STAGES = (size_t)ThreadStage::Output + 1;
+
+struct ThreadSettings {
+    // CPUs the threads may run on, empty leaves the affinity as it is.
+    std::vector<int> cpus;
+
+    // 1..99 runs the threads with SCHED_FIFO at this priority, which
+    // needs CAP_SYS_NICE or an rtprio limit. 0 keeps SCHED_OTHER.
+    int realtimePriority = 0;
+
+    // Nice level under SCHED_OTHER, negative values need privileges.
+    int nice = 0;
+};
+
+struct ThreadingOptions {
+    std::array<ThreadSettings, NUM_THREAD_STAGES> stages;
+
+    ThreadSettings& operator[](ThreadStage stage) { return stages[(size_t)stage]; }
+    const ThreadSettings& operator[](ThreadStage stage) const { return stages[(size_t)stage]; }
+};
+
+namespace threading {
+
+/* Set the process wide settings. The pipeline threads are shared by
+ * all receivers (the WorkerPool) or belong to the input device, so the
+ * settings apply to the threads running already and the ones started
+ * later. */
+void configure(const ThreadingOptions& options);
+
+/* "input", "agc", "sync", "ofdm", "demodulator", "audio", "tii" or
+ * "output", throws std::invalid_argument otherwise */
+ThreadStage stageFromString(const std::string& name);
+const char *stageToString(ThreadStage stage);
+
+/* The CPU time in seconds used by the threads of each stage so far,
+ * including the threads that ended already. Process wide, like the
+ * stages themselves. */
+std::array<double, NUM_THREAD_STAGES> stageCpuTime(void);
+
+/* Names the calling thread (at most 15 characters are kept) and applies
+ * the settings of its stage for as long as the object lives. Create it
+ * first thing in the thread function. */
+class ScopedThread {
+    public:
+        ScopedThread(ThreadStage stage, const char *name);
+        ~ScopedThread();
+        ScopedThread(const ScopedThread&) = delete;
+        ScopedThread& operator=(const ScopedThread&) = delete;
+};
+
+} // namespace threading
+
+#endif // THREAD_CONFIG_H
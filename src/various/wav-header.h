@@ -0,0 +1,53 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef WAV_HEADER_H
+#define WAV_HEADER_H
+
+#include <cstdint>
+#include <vector>
+
+// The header of 16 bit integer or 32 bit float stereo PCM of unknown
+// length, for streaming the decoded audio
+inline std::vector<uint8_t> wavHeader(uint32_t sampleRate, bool float32)
+{
+    const uint16_t channels = 2;
+    const uint16_t bitsPerSample = float32 ? 32 : 16;
+    const uint16_t blockAlign = channels * bitsPerSample / 8;
+    std::vector<uint8_t> header;
+    auto put = [&header](uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; i++)
+            header.push_back((value >> (8 * i)) & 0xFF);
+    };
+    auto tag = [&header](const char* id) { header.insert(header.end(), id, id + 4); };
+
+    tag("RIFF"); put(0, 4); tag("WAVE");
+    tag("fmt "); put(16, 4); put(float32 ? 3 : 1, 2); put(channels, 2); put(sampleRate, 4);
+    put(sampleRate * blockAlign, 4); put(blockAlign, 2); put(bitsPerSample, 2);
+    tag("data"); put(0, 4);
+    return header;
+}
+
+#endif // WAV_HEADER_H
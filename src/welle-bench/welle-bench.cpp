@@ -0,0 +1,1099 @@
+/*
+ *    Copyright (C) 2024
+ *    Lamarqe
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Benchmarks of the receive chain.
+ *
+ *   welle_bench pipeline <file>[,u8|cs16|cf32] [services]
+ *       Replays a recorded I/Q file as fast as possible into a
+ *       RadioReceiver, with up to <services> audio services decoded
+ *       (default: all), and reports the realtime factor, the frames
+ *       per second and the CPU time of each pipeline stage.
+ *
+ *   welle_bench pipeline <file>.eti [services]
+ *       The same with a recorded ETI stream, which skips the
+ *       demodulation and the Viterbi decoder, for the audio decoding.
+ *
+ *   welle_bench micro
+ *       Times the hot kernels in isolation.
+ *
+ *   welle_bench kernels
+ *       Runs every DSP kernel set the CPU supports against the scalar
+ *       one, and the phase kernels of all of them against std::arg,
+ *       and fails on any difference.
+ *
+ *   welle_bench ring
+ *       Checks that the DropOldest overflow policy on the soft bit ring
+ *       only drops the oldest fragments while the worker holds a claim.
+ *
+ *   welle_bench golden record <file> <dir> [services]
+ *   welle_bench golden verify <file> <dir> [kernels] [tolerance] [paths]
+ *       Captures the soft bits of the OFDM decoder, the FIC before and
+ *       after the Viterbi decoder, the logical frames and the AUs of the
+ *       services into dir, with the reference code everywhere, and
+ *       compares another run against them, by default with the best
+ *       DSP kernels and all fast paths. paths is a comma separated list
+ *       of the fast paths (viterbi, rs, fft) to run the reference code
+ *       of instead. Everything but the soft bits has to be bit exact,
+ *       those may differ by tolerance (default 1).
+ *
+ * Built with -DPROFILING=ON, the pipeline run also prints the latencies
+ * between the profiling marks. */
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "backend/dab-audio.h"
+#include "backend/dabplus_decoder.h"
+#include "backend/phasereference.h"
+#include "backend/radio-receiver.h"
+#include "backend/viterbi.h"
+#include "input/eti_source.h"
+#include "input/raw_file.h"
+#include "various/dsp-kernels.h"
+#include "various/fft.h"
+#include "various/frame-arena.h"
+#include "various/profiling.h"
+#include "various/thread-config.h"
+
+using namespace std::chrono;
+
+class BenchController : public RadioControllerInterface {
+    public:
+        void onSNR(float) override {}
+        void onFrequencyCorrectorChange(int, int) override {}
+        void onSyncChange(char) override {}
+        void onSignalPresence(bool) override {}
+        void onServiceDetected(uint32_t) override {}
+        void onNewEnsemble(uint16_t) override {}
+        void onSetEnsembleLabel(DabLabel&) override {}
+        void onDateTimeUpdate(const dab_date_time_t&) override {}
+        void onFIBDecodeSuccess(bool, const uint8_t*) override {}
+        void onNewImpulseResponse(std::vector<float>&&) override {}
+        void onConstellationPoints(std::vector<DSPCOMPLEX>&&) override {}
+        void onNewNullSymbol(std::vector<DSPCOMPLEX>&&) override {}
+        void onTIIMeasurement(tii_measurement_t&&) override {}
+
+        void onMessage(message_level_t, const std::string& text, const std::string& text2) override
+        {
+            std::clog << "bench: " << text << text2 << std::endl;
+        }
+
+        void onInputFailure(void) override
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ended = true;
+            endOfInput.notify_all();
+        }
+
+        diagnostics_request_t getDiagnosticsRequest(void) override
+        {
+            diagnostics_request_t request;
+            request.impulseResponse = false;
+            request.constellation = false;
+            request.nullSymbol = false;
+            return request;
+        }
+
+        // Returns false on timeout
+        bool waitForEnd(milliseconds timeout)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            return endOfInput.wait_for(lock, timeout, [this] { return ended; });
+        }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable endOfInput;
+        bool ended = false;
+};
+
+class BenchProgrammeHandler : public ProgrammeHandlerInterface {
+    public:
+        void onFrameErrors(int) override {}
+        void onNewAudio(std::vector<int16_t>&& audioData, int, const std::string&) override
+        {
+            samples += audioData.size();
+        }
+        void onRsErrors(bool, int) override {}
+        void onAacErrors(int) override {}
+        void onNewDynamicLabel(const std::string&) override {}
+        void onMOT(mot_file_t&&) override {}
+        void onPADLengthError(size_t, size_t) override {}
+        void ProcessUntouchedStream(const uint8_t*, size_t len, size_t) override
+        {
+            untouchedBytes += len;
+        }
+
+        std::atomic<uint64_t> samples = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> untouchedBytes = ATOMIC_VAR_INIT(0);
+};
+
+/* Receives the input until its end, and subscribes to the audio services
+ * accepted by wanted as they show up. handlerFor creates their handlers,
+ * which have to outlive the receiver. The input is an InputInterface or
+ * a CEtiSource. */
+template<class Input>
+static RadioReceiverStats receive(BenchController& controller, Input& input,
+        bool decodeAudio,
+        std::function<bool(const Service&, size_t subscribed)> wanted,
+        std::function<ProgrammeHandlerInterface&(const Service&)> handlerFor)
+{
+    RadioReceiverOptions rro;
+    RadioReceiver rx(controller, input, rro);
+    rx.restart(false);
+
+    std::map<uint32_t, ProgrammeHandlerInterface*> handlers;
+    std::set<uint32_t> subscribed;
+    while (not controller.waitForEnd(milliseconds(10))) {
+        for (const auto& s : rx.getServiceList()) {
+            if (subscribed.count(s.serviceId) or not rx.serviceHasAudioComponent(s) or
+                    not wanted(s, subscribed.size()))
+                continue;
+            auto& handler = handlers[s.serviceId];
+            if (not handler)
+                handler = &handlerFor(s);
+            if (rx.addServiceToDecode(*handler, "", s, decodeAudio,
+                        { OverflowPolicy::Mode::Block, milliseconds(1000) })) {
+                subscribed.insert(s.serviceId);
+            }
+        }
+    }
+
+    RadioReceiverStats stats = rx.getReceiverStats();
+    rx.stop();
+    return stats;
+}
+
+static int runPipeline(const std::string& args, size_t maxServices)
+{
+    BenchController controller;
+    std::vector<std::unique_ptr<BenchProgrammeHandler> > handlers;
+    auto wanted = [&](const Service&, size_t subscribed) { return subscribed < maxServices; };
+    auto handlerFor = [&](const Service&) -> ProgrammeHandlerInterface& {
+        handlers.emplace_back(new BenchProgrammeHandler);
+        return *handlers.back();
+    };
+
+    const bool eti = args.size() > 4 and args.compare(args.size() - 4, 4, ".eti") == 0;
+    const auto start = steady_clock::now();
+    const auto cpuStart = threading::stageCpuTime();
+    RadioReceiverStats stats;
+    if (eti) {
+        std::unique_ptr<CEtiSource> input(CEtiSource::fromArgs(args + ",fast"));
+        stats = receive(controller, *input, true, wanted, handlerFor);
+    }
+    else {
+        std::unique_ptr<CRAWFile> input(CRAWFile::fromDeviceArgs(controller, args + ",fast"));
+        stats = receive(controller, *input, true, wanted, handlerFor);
+    }
+    const double elapsed = duration<double>(steady_clock::now() - start).count();
+    const auto cpuEnd = threading::stageCpuTime();
+
+    // 96 ms per transmission frame in mode I, an ETI frame is one CIF
+    const double dataDuration = stats.framesProcessed * (eti ? 0.024 : 0.096);
+    uint64_t audioSamples = 0;
+    for (const auto& h : handlers)
+        audioSamples += h->samples;
+
+    printf("elapsed          %.3f s\n", elapsed);
+    printf("frames           %llu (%.1f/s), %llu dropped, %llu sync losses\n",
+            (unsigned long long)stats.framesProcessed, stats.framesProcessed / elapsed,
+            (unsigned long long)stats.framesDropped, (unsigned long long)stats.syncLosses);
+    printf("realtime factor  %.2f\n", dataDuration / elapsed);
+    printf("decode load      %.2f, at most %zu frames queued\n",
+            stats.decodeLoad, stats.maxFrameQueueDepth);
+    printf("services         %zu, %llu audio samples, %llu CIFs dropped\n",
+            handlers.size(), (unsigned long long)audioSamples,
+            (unsigned long long)stats.droppedFragments);
+    printf("FIC              %llu FIBs, %llu CRC errors\n",
+            (unsigned long long)stats.fibCount, (unsigned long long)stats.fibCrcErrors);
+
+    printf("\n%-12s %10s %8s\n", "stage", "cpu [s]", "share");
+    for (size_t i = 0; i < NUM_THREAD_STAGES; i++) {
+        const double cpu = cpuEnd[i] - cpuStart[i];
+        if (cpu > 0) {
+            printf("%-12s %10.3f %7.1f%%\n", threading::stageToString((ThreadStage)i),
+                    cpu, 100 * cpu / elapsed);
+        }
+    }
+
+#if defined(WITH_PROFILING)
+    printf("\n");
+    get_profiler().dump(std::cout);
+#endif
+    return 0;
+}
+
+/* Golden output of the decoding chain. Every stream is a sequence of
+ * records, stored as key, length and bytes. The soft bits are keyed by
+ * frame and symbol, since only the symbols of the subscribed
+ * subchannels are decoded. The services are subscribed at slightly
+ * different times on every run, so their streams are aligned on the
+ * first record they have in common. */
+struct GoldenRecord {
+    uint32_t key;
+    std::vector<uint8_t> data;
+};
+using GoldenStream = std::vector<GoldenRecord>;
+
+static void saveStream(const std::string& fileName, const GoldenStream& stream)
+{
+    std::ofstream out(fileName, std::ios::binary);
+    for (const auto& r : stream) {
+        const uint32_t header[2] = { r.key, (uint32_t)r.data.size() };
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(r.data.data()), r.data.size());
+    }
+    if (not out)
+        throw std::runtime_error("golden: cannot write " + fileName);
+}
+
+static GoldenStream loadStream(const std::string& fileName)
+{
+    std::ifstream in(fileName, std::ios::binary);
+    if (not in)
+        throw std::runtime_error("golden: cannot read " + fileName);
+
+    GoldenStream stream;
+    uint32_t header[2];
+    while (in.read(reinterpret_cast<char*>(header), sizeof(header))) {
+        GoldenRecord r { header[0], std::vector<uint8_t>(header[1]) };
+        if (not in.read(reinterpret_cast<char*>(r.data.data()), header[1]))
+            throw std::runtime_error("golden: " + fileName + " is truncated");
+        stream.push_back(std::move(r));
+    }
+    return stream;
+}
+
+class GoldenController : public BenchController {
+    public:
+        diagnostics_request_t getDiagnosticsRequest(void) override
+        {
+            diagnostics_request_t request = BenchController::getDiagnosticsRequest();
+            request.softBits = true;
+            return request;
+        }
+
+        // All three from the OfdmDecoder thread
+        void onSoftBits(int32_t sym, const softbit_t *bits, size_t n) override
+        {
+            if (sym == 1)
+                frame++;
+            append(softBits, (frame << 8) | sym, bits, n);
+        }
+
+        void onFicCodeword(const softbit_t *bits, size_t n) override
+        {
+            append(ficCodewords, ficCodewords.size(), bits, n);
+        }
+
+        void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t *fib) override
+        {
+            // The bits packed, and the CRC result
+            GoldenRecord r { (uint32_t)fibs.size(), std::vector<uint8_t>(33, 0) };
+            for (int i = 0; i < 256; i++)
+                r.data[i / 8] |= fib[i] << (7 - i % 8);
+            r.data[32] = crcCheckOk;
+            fibs.push_back(std::move(r));
+        }
+
+        GoldenStream softBits;
+        GoldenStream ficCodewords;
+        GoldenStream fibs;
+
+    private:
+        static void append(GoldenStream& stream, uint32_t key, const softbit_t *bits, size_t n)
+        {
+            const uint8_t *bytes = reinterpret_cast<const uint8_t*>(bits);
+            stream.push_back({ key, std::vector<uint8_t>(bytes, bytes + n) });
+        }
+
+        uint32_t frame = 0;
+};
+
+class GoldenServiceHandler : public BenchProgrammeHandler {
+    public:
+        bool wantsLogicalFrames(void) override { return true; }
+
+        void onLogicalFrame(const uint8_t *frame, size_t len) override
+        {
+            frames.push_back({ (uint32_t)frames.size(), std::vector<uint8_t>(frame, frame + len) });
+        }
+
+        // The AUs, in the LATM framing of the decoder
+        void ProcessUntouchedStream(const uint8_t *data, size_t len, size_t) override
+        {
+            aus.push_back({ (uint32_t)aus.size(), std::vector<uint8_t>(data, data + len) });
+        }
+
+        GoldenStream frames;
+        GoldenStream aus;
+};
+
+struct GoldenRun {
+    GoldenController controller;
+    std::map<uint32_t, std::unique_ptr<GoldenServiceHandler> > services;
+    RadioReceiverStats stats;
+};
+
+/* The recording is replayed in real time, so that the decoder never
+ * drops a frame and all runs see the same frames */
+static void goldenReceive(const std::string& args, GoldenRun& run,
+        std::function<bool(const Service&, size_t)> wanted)
+{
+    std::unique_ptr<CRAWFile> input(CRAWFile::fromDeviceArgs(run.controller, args + ",realtime"));
+    run.stats = receive(run.controller, *input, false, wanted,
+            [&](const Service& s) -> ProgrammeHandlerInterface& {
+                auto& handler = run.services[s.serviceId];
+                handler.reset(new GoldenServiceHandler);
+                return *handler;
+            });
+
+    if (run.stats.framesDropped > 0) {
+        throw std::runtime_error("golden: " + std::to_string(run.stats.framesDropped) +
+                " frames dropped, the output is not reproducible");
+    }
+}
+
+static std::string sidToString(uint32_t sId)
+{
+    char sid[16];
+    snprintf(sid, sizeof(sid), "%X", sId);
+    return sid;
+}
+
+static int recordGolden(const std::string& args, const std::string& dir, size_t maxServices)
+{
+    dsp::selectKernels(dsp::KernelSet::Scalar);
+    for (dsp::FastPath path : { dsp::FastPath::Viterbi, dsp::FastPath::RSSyndromes,
+            dsp::FastPath::BatchedFFT })
+        dsp::forceReference(path);
+
+    GoldenRun run;
+    goldenReceive(args, run,
+            [&](const Service&, size_t subscribed) { return subscribed < maxServices; });
+
+    saveStream(dir + "/soft_bits.bin", run.controller.softBits);
+    saveStream(dir + "/fic_codewords.bin", run.controller.ficCodewords);
+    saveStream(dir + "/fibs.bin", run.controller.fibs);
+
+    std::ofstream services(dir + "/services.txt");
+    for (const auto& s : run.services) {
+        const std::string sid = sidToString(s.first);
+        services << sid << "\n";
+        saveStream(dir + "/frames_" + sid + ".bin", s.second->frames);
+        saveStream(dir + "/aus_" + sid + ".bin", s.second->aus);
+    }
+
+    printf("recorded %llu frames, %zu FIBs and %zu service(s) to %s\n",
+            (unsigned long long)run.stats.framesProcessed, run.controller.fibs.size(),
+            run.services.size(), dir.c_str());
+    return 0;
+}
+
+/* The records with the same key have to match, the soft bits may
+ * differ by tolerance, as the vectorised kernels round differently */
+static bool compareKeyed(const char *name, const GoldenStream& golden,
+        const GoldenStream& actual, int tolerance)
+{
+    std::map<uint32_t, const GoldenRecord*> byKey;
+    for (const auto& r : golden)
+        byKey[r.key] = &r;
+
+    size_t compared = 0, differing = 0, failed = 0;
+    int maxDiff = 0;
+    for (const auto& r : actual) {
+        const auto g = byKey.find(r.key);
+        if (g == byKey.end())
+            continue;
+        compared++;
+        if (g->second->data.size() != r.data.size()) {
+            failed++;
+            continue;
+        }
+
+        bool fails = false;
+        for (size_t i = 0; i < r.data.size(); i++) {
+            const int diff = std::abs((int8_t)r.data[i] - (int8_t)g->second->data[i]);
+            if (diff)
+                differing++;
+            maxDiff = std::max(maxDiff, diff);
+            fails |= diff > tolerance;
+        }
+        failed += fails;
+    }
+
+    const bool ok = compared > 0 and failed == 0;
+    printf("%-20s %s: %zu of %zu records compared, %zu failed, %zu values differ, max diff %d\n",
+            name, ok ? "OK  " : "FAIL", compared, golden.size(), failed, differing, maxDiff);
+    return ok;
+}
+
+/* Bit exact, from the first record of the later stream on */
+static bool compareAligned(const std::string& name, const GoldenStream& golden,
+        const GoldenStream& actual)
+{
+    size_t g = 0, a = 0;
+    if (not golden.empty() and not actual.empty()) {
+        const auto inActual = std::find_if(actual.begin(), actual.end(),
+                [&](const GoldenRecord& r) { return r.data == golden.front().data; });
+        const auto inGolden = std::find_if(golden.begin(), golden.end(),
+                [&](const GoldenRecord& r) { return r.data == actual.front().data; });
+        if (inActual != actual.end())
+            a = inActual - actual.begin();
+        else if (inGolden != golden.end())
+            g = inGolden - golden.begin();
+        else
+            g = golden.size();
+    }
+
+    size_t compared = 0, failed = 0;
+    for (; g < golden.size() and a < actual.size(); g++, a++) {
+        compared++;
+        failed += golden[g].data != actual[a].data;
+    }
+
+    const bool ok = compared > 0 and failed == 0;
+    printf("%-20s %s: %zu of %zu records compared, %zu differ\n",
+            name.c_str(), ok ? "OK  " : "FAIL", compared, golden.size(), failed);
+    return ok;
+}
+
+static int verifyGolden(const std::string& args, const std::string& dir, int tolerance)
+{
+    std::set<uint32_t> sids;
+    std::ifstream services(dir + "/services.txt");
+    std::string sid;
+    while (services >> sid)
+        sids.insert(std::stoul(sid, nullptr, 16));
+
+    GoldenRun run;
+    goldenReceive(args, run,
+            [&](const Service& s, size_t) { return sids.count(s.serviceId) > 0; });
+
+    printf("kernels %s", dsp::kernelSetToString(dsp::kernels().set));
+    for (dsp::FastPath path : { dsp::FastPath::Viterbi, dsp::FastPath::RSSyndromes,
+            dsp::FastPath::BatchedFFT }) {
+        if (dsp::isReferenceForced(path))
+            printf(", reference %s", dsp::fastPathToString(path));
+    }
+    printf("\n");
+    bool ok = true;
+    ok &= compareKeyed("soft bits", loadStream(dir + "/soft_bits.bin"),
+            run.controller.softBits, tolerance);
+    ok &= compareKeyed("FIC codewords", loadStream(dir + "/fic_codewords.bin"),
+            run.controller.ficCodewords, tolerance);
+    ok &= compareKeyed("FIBs", loadStream(dir + "/fibs.bin"), run.controller.fibs, 0);
+
+    for (uint32_t sId : sids) {
+        const std::string sid = sidToString(sId);
+        const auto s = run.services.find(sId);
+        if (s == run.services.end()) {
+            printf("service %-12s FAIL: not received\n", sid.c_str());
+            ok = false;
+            continue;
+        }
+        ok &= compareAligned("frames " + sid, loadStream(dir + "/frames_" + sid + ".bin"),
+                s->second->frames);
+        ok &= compareAligned("AUs " + sid, loadStream(dir + "/aus_" + sid + ".bin"),
+                s->second->aus);
+    }
+
+    return ok ? 0 : 1;
+}
+
+/* Runs f until at least minTime passed, and prints the time per call
+ * and the throughput of items per call */
+template<typename F>
+static void bench(const char *name, double items, const char *unit, F f)
+{
+    const auto minTime = milliseconds(500);
+
+    f(); // warm up caches and lazy initialisations
+    size_t calls = 0;
+    const auto start = steady_clock::now();
+    auto now = start;
+    do {
+        for (int i = 0; i < 16; i++)
+            f();
+        calls += 16;
+        now = steady_clock::now();
+    } while (now - start < minTime);
+
+    const double perCall = duration<double>(now - start).count() / calls;
+    printf("%-28s %10.2f us %12.2f M%s/s\n", name, perCall * 1e6, items / perCall / 1e6, unit);
+}
+
+static void benchViterbi(std::mt19937& rng)
+{
+    // A logical frame of a 96 kbit/s subchannel
+    const int16_t wordlength = 24 * 96;
+    std::vector<softbit_t> input(4 * (wordlength + 6));
+    std::uniform_int_distribution<int> softbit(-127, 127);
+    for (auto& s : input)
+        s = softbit(rng);
+    std::vector<uint8_t> output(wordlength);
+
+    Viterbi viterbi(wordlength);
+    bench("Viterbi::deconvolve", wordlength, "bit", [&] {
+            viterbi.deconvolve(input.data(), output.data());
+            });
+}
+
+static void benchFFT(std::mt19937& rng)
+{
+    const DABParams params(1);
+    fft::Forward forward(params.T_u);
+    DSPCOMPLEX *v = forward.getVector();
+    std::normal_distribution<float> noise;
+    std::vector<DSPCOMPLEX> input(params.T_u);
+    for (auto& s : input)
+        s = DSPCOMPLEX(noise(rng), noise(rng));
+
+    bench("fft::Forward 2048", params.T_u, "sample", [&] {
+            std::copy(input.begin(), input.end(), v);
+            forward.do_FFT();
+            });
+}
+
+static void benchRS(std::mt19937& rng)
+{
+    // A superframe of a 96 kbit/s subchannel, 12 interleaved RS packets.
+    // The all zero superframe is a valid codeword.
+    const size_t packets = 96 / 8;
+    const size_t sfLen = packets * 120;
+    std::vector<uint8_t> clean(sfLen, 0);
+    std::vector<uint8_t> errors(clean);
+    std::uniform_int_distribution<size_t> pos(0, 119);
+    for (size_t p = 0; p < packets; p += 2) {
+        for (int e = 0; e < 3; e++)
+            errors[pos(rng) * packets + p] ^= 0x5A;
+    }
+
+    RSDecoder rs;
+    std::vector<uint8_t> sf(sfLen);
+    int corrected;
+    bool uncorrectable;
+    bench("RSDecoder clean", sfLen, "B", [&] {
+            std::copy(clean.begin(), clean.end(), sf.begin());
+            rs.DecodeSuperframe(sf.data(), sfLen, corrected, uncorrectable);
+            });
+    bench("RSDecoder with errors", sfLen, "B", [&] {
+            std::copy(errors.begin(), errors.end(), sf.begin());
+            rs.DecodeSuperframe(sf.data(), sfLen, corrected, uncorrectable);
+            });
+}
+
+static void benchDabAudio(std::mt19937& rng)
+{
+    // 96 kbit/s EEP 3-A, 6 CUs per 8 kbit/s
+    const int16_t bitRate = 96;
+    const int16_t fragmentSize = 6 * bitRate / 8 * CUSize;
+    std::vector<softbit_t> cif(fragmentSize);
+    std::uniform_int_distribution<int> softbit(-127, 127);
+    for (auto& s : cif)
+        s = softbit(rng);
+
+    BenchProgrammeHandler handler;
+    DecoderCounters counters;
+    ProtectionSettings protection;
+    DabAudio audio(AudioServiceComponentType::DABPlus, fragmentSize, bitRate,
+            protection, handler, "", false,
+            { OverflowPolicy::Mode::Block, milliseconds(1000) }, counters);
+
+    // The CIFs are decoded on the worker pool, so time a batch of
+    // them including the wait until the last one is through. The first
+    // 16 CIFs only fill the de-interleaver.
+    const int batch = 64;
+    const uint64_t frameBytes = bitRate * 24 / 8;
+    uint64_t cifs = 0;
+    bench("DabAudio 96 kbit/s CIF", batch * fragmentSize, "softbit", [&] {
+            for (int i = 0; i < batch; i++)
+                audio.process(cif.data(), fragmentSize, LatencyStamp());
+            cifs += batch;
+            while (counters.decodedBytes < (cifs - 16) * frameBytes)
+                std::this_thread::yield();
+            });
+}
+
+static void benchPhaseReference(std::mt19937& rng)
+{
+    const DABParams params(1);
+    PhaseReference phaseRef(params, DEFAULT_FFT_PLACEMENT);
+
+    // The PRS in the time domain, 100 samples late, with noise
+    fft::Backward backward(params.T_u);
+    DSPCOMPLEX *prs = backward.getVector();
+    for (int i = 0; i < params.T_u; i++)
+        prs[i] = phaseRef[i];
+    backward.do_IFFT();
+
+    const int delay = 100;
+    std::normal_distribution<float> noise(0, 0.1f / params.T_u);
+    std::vector<DSPCOMPLEX> v(params.T_u);
+    for (int i = 0; i < params.T_u; i++) {
+        v[i] = prs[(i + params.T_u - delay) % params.T_u] +
+            DSPCOMPLEX(noise(rng), noise(rng));
+    }
+
+    std::vector<float> impulseResponse;
+    FrameArena scratch;
+    bench("PhaseReference::findIndex", 1, "PRS", [&] {
+            phaseRef.findIndex(v.data(), impulseResponse, scratch);
+            scratch.reset();
+            });
+}
+
+static int runMicro(void)
+{
+    std::mt19937 rng(1);
+    benchViterbi(rng);
+    benchFFT(rng);
+    benchRS(rng);
+    benchDabAudio(rng);
+    benchPhaseReference(rng);
+    return 0;
+}
+
+/* Records the first mismatch of a kernel over all lengths and offsets */
+class KernelCheck {
+    public:
+        KernelCheck(const char *name) : name(name) {}
+
+        void expect(bool same, size_t n, size_t offset)
+        {
+            if (not same and ok) {
+                ok = false;
+                failedN = n;
+                failedOffset = offset;
+            }
+        }
+
+        bool report(dsp::KernelSet set) const
+        {
+            if (ok)
+                printf("%-6s %-28s ok\n", dsp::kernelSetToString(set), name);
+            else
+                printf("%-6s %-28s FAIL: n %zu, offset %zu\n",
+                        dsp::kernelSetToString(set), name, failedN, failedOffset);
+            return ok;
+        }
+
+    private:
+        const char *name;
+        bool ok = true;
+        size_t failedN = 0;
+        size_t failedOffset = 0;
+};
+
+// Gaussian noise with every 8th value one of the corner cases of the phase
+static std::vector<DSPCOMPLEX> randomComplex(std::mt19937& rng, size_t n)
+{
+    static const DSPCOMPLEX special[] = {
+        { 0, 0 }, { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 },
+        { -1, -0.0f }, { 1, 1 }, { -1, -1 }, { 1e-30f, -1e-30f },
+    };
+    std::normal_distribution<float> noise;
+    std::uniform_int_distribution<size_t> pick(0, 8 * (sizeof(special) / sizeof(special[0])) - 1);
+    std::vector<DSPCOMPLEX> v(n);
+    for (auto& z : v) {
+        const size_t p = pick(rng);
+        z = p % 8 == 0 ? special[p / 8] : DSPCOMPLEX(noise(rng), noise(rng));
+    }
+    return v;
+}
+
+static bool sameBits(const void *a, const void *b, size_t bytes)
+{
+    return memcmp(a, b, bytes) == 0;
+}
+
+static bool checkKernelSet(const dsp::Kernels& k, std::mt19937& rng)
+{
+    const dsp::Kernels& ref = dsp::kernels(dsp::KernelSet::Scalar);
+    KernelCheck scale("scale"), magnitude("magnitude"), sumMagnitude("sumMagnitude"),
+        l1Norm("l1Norm"), xorBytes("xorBytes"), byteRange("byteRange"),
+        phase("phase"), phaseDifference("phaseDifference");
+
+    // Every length around the vector widths, and some of a whole symbol
+    std::vector<size_t> lengths;
+    for (size_t n = 0; n <= 40; n++)
+        lengths.push_back(n);
+    lengths.push_back(1536);
+    lengths.push_back(2048 + 13);
+
+    const size_t maxOffset = 3;
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (size_t n : lengths) {
+        for (size_t o = 0; o <= maxOffset; o++) {
+            const std::vector<DSPCOMPLEX> in = randomComplex(rng, n + 1 + maxOffset);
+            const DSPCOMPLEX *src = in.data() + o;
+            std::vector<float> out(n + maxOffset), refOut(n + maxOffset);
+            const size_t floatBytes = n * sizeof(float);
+
+            std::vector<DSPCOMPLEX> v(in), refV(in);
+            k.scale(v.data() + o, n, 0.37f);
+            ref.scale(refV.data() + o, n, 0.37f);
+            scale.expect(sameBits(v.data(), refV.data(), v.size() * sizeof(DSPCOMPLEX)), n, o);
+
+            k.magnitude(src, out.data() + o, n);
+            ref.magnitude(src, refOut.data() + o, n);
+            magnitude.expect(sameBits(out.data() + o, refOut.data() + o, floatBytes), n, o);
+
+            // Only the order of the additions differs
+            const float sum = k.sumMagnitude(src, n);
+            const float refSum = ref.sumMagnitude(src, n);
+            sumMagnitude.expect(std::fabs(sum - refSum) <= n * FLT_EPSILON * refSum, n, o);
+
+            k.l1Norm(src, out.data() + o, n);
+            ref.l1Norm(src, refOut.data() + o, n);
+            l1Norm.expect(sameBits(out.data() + o, refOut.data() + o, floatBytes), n, o);
+
+            k.phase(src, out.data() + o, n);
+            ref.phase(src, refOut.data() + o, n);
+            phase.expect(sameBits(out.data() + o, refOut.data() + o, floatBytes), n, o);
+
+            k.phaseDifference(src, out.data() + o, n);
+            ref.phaseDifference(src, refOut.data() + o, n);
+            phaseDifference.expect(sameBits(out.data() + o, refOut.data() + o, floatBytes), n, o);
+
+            // Data and pattern misaligned against each other, with clipping
+            std::vector<uint8_t> data(n + maxOffset), pattern(n + maxOffset);
+            for (size_t i = 0; i < data.size(); i++) {
+                data[i] = i % 11 == 5 ? 255 * (i % 2) : byte(rng);
+                pattern[i] = byte(rng);
+            }
+            std::vector<uint8_t> xored(data), refXored(data);
+            k.xorBytes(xored.data() + o, pattern.data() + maxOffset - o, n);
+            ref.xorBytes(refXored.data() + o, pattern.data() + maxOffset - o, n);
+            xorBytes.expect(xored == refXored, n, o);
+
+            if (n > 0) {
+                const dsp::ByteRange r = k.byteRange(data.data() + o, n);
+                const dsp::ByteRange refR = ref.byteRange(data.data() + o, n);
+                byteRange.expect(r.min == refR.min and r.max == refR.max and
+                        r.clipped == refR.clipped, n, o);
+            }
+        }
+    }
+
+    bool ok = true;
+    for (const KernelCheck *c : { &scale, &magnitude, &sumMagnitude, &l1Norm,
+            &xorBytes, &byteRange, &phase, &phaseDifference })
+        ok &= c->report(k.set);
+    return ok;
+}
+
+/* Worst deviation of a phase kernel from std::arg, and the number of
+ * results that are not bit exact with dsp::arg */
+class PhaseCheck {
+    public:
+        PhaseCheck(const char *name) : name(name) {}
+
+        void expect(DSPCOMPLEX z, float result)
+        {
+            const float exact = dsp::arg(z);
+            if (not sameBits(&result, &exact, sizeof(float)))
+                differentBits++;
+
+            // The phase of 0 is defined as 0, std::arg of -0 says pi
+            const double reference = z == DSPCOMPLEX(0, 0) ?
+                0 : std::arg(std::complex<double>(z.real(), z.imag()));
+            const double error = std::fabs(result - reference);
+            if (error > maxError) {
+                maxError = error;
+                worst = z;
+            }
+        }
+
+        bool report(dsp::KernelSet set, double bound) const
+        {
+            const bool ok = maxError <= bound and differentBits == 0;
+            printf("%-6s %-28s %s, max error %.2g rad at (%g, %g), %zu not as dsp::arg\n",
+                    dsp::kernelSetToString(set), name, ok ? "ok" : "FAIL",
+                    maxError, worst.real(), worst.imag(), differentBits);
+            return ok;
+        }
+
+    private:
+        const char *name;
+        double maxError = 0;
+        DSPCOMPLEX worst = 0;
+        size_t differentBits = 0;
+};
+
+/* The phase kernels against the bound of dsp::arg, over the whole circle
+ * from denormal to huge magnitudes, and on the axes */
+static bool checkPhase(const dsp::Kernels& k, std::mt19937& rng)
+{
+    std::vector<DSPCOMPLEX> in;
+    const int steps = 1 << 14;
+    for (float m : { 1e-44f, 1e-35f, 1e-20f, 1e-3f, 1.0f, 1e3f, 1e15f }) {
+        for (int i = 0; i <= steps; i++) {
+            const double a = M_PI * (2.0 * i / steps - 1);
+            in.emplace_back(m * std::cos(a), m * std::sin(a));
+        }
+        for (float x : { 0.0f, -0.0f, m, -m }) {
+            for (float y : { 0.0f, -0.0f, m, -m })
+                in.emplace_back(x, y);
+        }
+    }
+
+    std::vector<float> out(in.size());
+    PhaseCheck phase("phase vs std::arg");
+    k.phase(in.data(), out.data(), in.size());
+    for (size_t i = 0; i < in.size(); i++)
+        phase.expect(in[i], out[i]);
+
+    // Shuffled, so that the differences cover the circle as well
+    std::shuffle(in.begin(), in.end(), rng);
+    PhaseCheck phaseDifference("phaseDifference vs std::arg");
+    k.phaseDifference(in.data(), out.data(), in.size() - 1);
+    for (size_t i = 0; i + 1 < in.size(); i++) {
+        // Rounded like the kernels do
+        const DSPCOMPLEX a = in[i], b = in[i + 1];
+        const DSPCOMPLEX d(a.real() * b.real() + a.imag() * b.imag(),
+                a.imag() * b.real() - a.real() * b.imag());
+        phaseDifference.expect(d, out[i]);
+    }
+
+    const double bound = 3e-6;
+    bool ok = phase.report(k.set, bound);
+    ok &= phaseDifference.report(k.set, bound);
+    return ok;
+}
+
+/* The Viterbi decoders and the RS syndromes follow the selected set, so
+ * decode the same random input with each and compare the results. */
+struct DecoderResults {
+    std::vector<uint8_t> viterbi;
+    std::vector<uint8_t> viterbiBatch;
+    std::vector<uint8_t> rs;
+    int rsCorrected = 0;
+    bool rsUncorrectable = false;
+};
+
+static DecoderResults runDecoders(dsp::KernelSet set, const std::vector<softbit_t>& softbits,
+        int16_t wordlength, const std::vector<uint8_t>& superframe)
+{
+    dsp::selectKernels(set);
+    DecoderResults r;
+
+    std::vector<softbit_t> input(softbits);
+    r.viterbi.resize(wordlength);
+    Viterbi viterbi(wordlength);
+    viterbi.deconvolve(input.data(), r.viterbi.data());
+
+    // Each lane starts at another place into the softbits
+    const size_t codeword = 4 * (wordlength + 6);
+    const softbit_t *inputs[ViterbiBatch::lanes];
+    uint8_t *outputs[ViterbiBatch::lanes];
+    r.viterbiBatch.resize(ViterbiBatch::lanes * wordlength / 8);
+    for (int l = 0; l < ViterbiBatch::lanes; l++) {
+        inputs[l] = softbits.data() + l * (softbits.size() - codeword) / ViterbiBatch::lanes;
+        outputs[l] = r.viterbiBatch.data() + l * wordlength / 8;
+    }
+    ViterbiBatch batch(wordlength);
+    batch.deconvolve(inputs, outputs, ViterbiBatch::lanes);
+
+    r.rs = superframe;
+    RSDecoder rs;
+    rs.DecodeSuperframe(r.rs.data(), r.rs.size(), r.rsCorrected, r.rsUncorrectable);
+
+    dsp::selectKernels(dsp::KernelSet::Auto);
+    return r;
+}
+
+static int checkKernels(void)
+{
+    std::mt19937 rng(1);
+    bool ok = true;
+
+    const int16_t wordlength = 24 * 96;
+    std::vector<softbit_t> softbits(2 * 4 * (wordlength + 6));
+    std::uniform_int_distribution<int> softbit(-127, 127);
+    for (auto& s : softbits)
+        s = softbit(rng);
+
+    // 12 RS packets, some correctable, one beyond repair
+    const size_t packets = 12;
+    std::vector<uint8_t> superframe(packets * 120, 0);
+    std::uniform_int_distribution<size_t> pos(0, 119);
+    for (size_t p = 0; p < packets; p += 2) {
+        for (size_t e = 0; e < p / 2 + 1; e++)
+            superframe[pos(rng) * packets + p] ^= 0x5A;
+    }
+    for (size_t i = 0; i < 120; i += 4)
+        superframe[i * packets + 1] = 0xFF;
+
+    ok &= checkPhase(dsp::kernels(dsp::KernelSet::Scalar), rng);
+    const DecoderResults ref = runDecoders(dsp::KernelSet::Scalar, softbits, wordlength, superframe);
+    for (dsp::KernelSet set : { dsp::KernelSet::SSE4, dsp::KernelSet::AVX2, dsp::KernelSet::NEON }) {
+        if (not dsp::isSupported(set))
+            continue;
+        ok &= checkKernelSet(dsp::kernels(set), rng);
+        ok &= checkPhase(dsp::kernels(set), rng);
+
+        const DecoderResults r = runDecoders(set, softbits, wordlength, superframe);
+        KernelCheck viterbi("Viterbi"), viterbiBatch("ViterbiBatch"), rs("RSDecoder");
+        viterbi.expect(r.viterbi == ref.viterbi, wordlength, 0);
+        viterbiBatch.expect(r.viterbiBatch == ref.viterbiBatch, wordlength, 0);
+        rs.expect(r.rs == ref.rs and r.rsCorrected == ref.rsCorrected and
+                r.rsUncorrectable == ref.rsUncorrectable, superframe.size(), 0);
+        ok &= viterbi.report(set);
+        ok &= viterbiBatch.report(set);
+        ok &= rs.report(set);
+    }
+
+    return ok ? 0 : 1;
+}
+
+/* The DropOldest policy of DabAudio on a full ring whose oldest fragment
+ * is claimed by the worker: only the oldest queued fragments that are in
+ * the way are skipped, and the new ones are written once the claim is
+ * released. */
+static bool checkDropOldest(int32_t newFragments)
+{
+    const int32_t unit = 16;
+    const int32_t units = 8;
+    RingBuffer<uint8_t> ring(unit * units);
+    std::vector<uint8_t> fragment(unit);
+    auto put = [&](int n) {
+        std::fill(fragment.begin(), fragment.end(), n);
+        ring.putDataIntoBuffer(fragment.data(), unit);
+    };
+    for (int n = 0; n < units; n++)
+        put(n);
+
+    const auto claimed = ring.claimRead(unit);
+    std::thread worker([&] {
+            std::this_thread::sleep_for(milliseconds(5));
+            ring.releaseRead();
+            });
+    int skipped = 0;
+    const bool room = ring.makeRoom(newFragments * unit, unit, milliseconds(1000),
+            [&] { skipped++; });
+    worker.join();
+    for (int n = 0; n < newFragments; n++)
+        put(units + n);
+
+    // Left are the fragments behind the claimed and the skipped ones
+    bool kept = ring.GetRingBufferReadAvailable() == (units - 1 - skipped + newFragments) * unit;
+    for (int n = 1 + skipped; n < units + newFragments and kept; n++) {
+        ring.getDataFromBuffer(fragment.data(), unit);
+        kept = std::all_of(fragment.begin(), fragment.end(), [n](uint8_t b) { return b == n; });
+    }
+
+    const bool ok = claimed.size() == unit and room and skipped == newFragments - 1 and kept;
+    printf("DropOldest, %d new fragment(s)     %s: %d skipped\n",
+            newFragments, ok ? "ok" : "FAIL", skipped);
+    return ok;
+}
+
+static int checkRing(void)
+{
+    bool ok = true;
+    for (int32_t newFragments : { 1, 2, 4 })
+        ok &= checkDropOldest(newFragments);
+    return ok ? 0 : 1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s pipeline <file>[,u8|cs16|cf32] [services]\n"
+            "       %s pipeline <file>.eti [services]\n"
+            "       %s micro\n"
+            "       %s kernels\n"
+            "       %s ring\n"
+            "       %s golden record <file> <dir> [services]\n"
+            "       %s golden verify <file> <dir> [kernels] [tolerance] [viterbi,rs,fft]\n",
+            name, name, name, name, name, name, name);
+}
+
+int main(int argc, char **argv)
+{
+    const std::string mode = argc > 1 ? argv[1] : "";
+
+    try {
+        if (mode == "pipeline" and (argc == 3 or argc == 4)) {
+            const size_t services = argc == 4 ? strtoul(argv[3], nullptr, 0) : SIZE_MAX;
+            return runPipeline(argv[2], services);
+        }
+        else if (mode == "micro" and argc == 2) {
+            return runMicro();
+        }
+        else if (mode == "kernels" and argc == 2) {
+            return checkKernels();
+        }
+        else if (mode == "ring" and argc == 2) {
+            return checkRing();
+        }
+        else if (mode == "golden" and argc >= 5 and argv[2] == std::string("record") and argc <= 6) {
+            const size_t services = argc == 6 ? strtoul(argv[5], nullptr, 0) : SIZE_MAX;
+            return recordGolden(argv[3], argv[4], services);
+        }
+        else if (mode == "golden" and argc >= 5 and argv[2] == std::string("verify") and argc <= 8) {
+            if (argc >= 6)
+                dsp::selectKernels(dsp::kernelSetFromString(argv[5]));
+            const int tolerance = argc >= 7 ? atoi(argv[6]) : 1;
+            if (argc == 8) {
+                std::istringstream paths(argv[7]);
+                std::string path;
+                while (std::getline(paths, path, ','))
+                    dsp::forceReference(dsp::fastPathFromString(path));
+            }
+            return verifyGolden(argv[3], argv[4], tolerance);
+        }
+    }
+    catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    usage(argv[0]);
+    return 2;
+}
@@ -0,0 +1,91 @@
+/* Copyright (C) 2024 Lamarqe
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Native memory which is handed over to python without a copy.
+// Python accesses it through the buffer protocol, as memoryview.
+struct NativeBuffer
+{
+  std::vector<uint8_t> data;
+};
+
+// Recycles the NativeBuffers. A buffer returns to the pool when python
+// releases the last reference to it, so the decoder threads keep reusing
+// the same few allocations.
+class BufferPool
+{
+  public:
+    // Never destroyed, python may release buffers during its shutdown
+    static BufferPool& shared()
+    {
+      static BufferPool* pool = new BufferPool();
+      return *pool;
+    }
+
+    // Fill a buffer from the pool with a copy of the data.
+    // Called from the decoder threads, without holding the GIL.
+    std::shared_ptr<NativeBuffer> acquire(const void* data, size_t size)
+    {
+      std::unique_ptr<NativeBuffer> buffer;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!freeBuffers.empty())
+        {
+          buffer = std::move(freeBuffers.back());
+          freeBuffers.pop_back();
+        }
+      }
+      if (!buffer)
+        buffer = std::make_unique<NativeBuffer>();
+
+      const uint8_t* bytes = static_cast<const uint8_t*>(data);
+      buffer->data.assign(bytes, bytes + size);
+      return std::shared_ptr<NativeBuffer>(buffer.release(),
+                                           [this](NativeBuffer* released) { recycle(released); });
+    }
+
+    // Hand over data that is not needed any more, without a copy.
+    // Such buffers are rare and large, so they are not recycled.
+    static std::shared_ptr<NativeBuffer> adopt(std::vector<uint8_t>&& data)
+    {
+      auto buffer = std::make_shared<NativeBuffer>();
+      buffer->data = std::move(data);
+      return buffer;
+    }
+
+  private:
+    // Enough for the audio a python ServiceController keeps for a few services
+    static constexpr size_t maxFreeBuffers = 64;
+
+    void recycle(NativeBuffer* released)
+    {
+      std::unique_ptr<NativeBuffer> buffer(released);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (freeBuffers.size() < maxFreeBuffers)
+        freeBuffers.push_back(std::move(buffer));
+    }
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<NativeBuffer>> freeBuffers;
+};
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,107 @@
+/* Copyright (C) 2024 Lamarqe
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTROL_THREAD_H
+#define CONTROL_THREAD_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <pthread.h>
+
+// Runs the jobs of a device one after the other, off the asyncio loop.
+// The jobs must not hold python objects, they are destroyed without the GIL.
+// The thread is started with the first job.
+class ControlThread
+{
+  public:
+    using Job = std::function<void()>;
+
+    ControlThread() = default;
+    ControlThread(const ControlThread&) = delete;
+    ControlThread& operator=(const ControlThread&) = delete;
+
+    // Without the GIL, a running job may wait for it
+    ~ControlThread()
+    {
+      stop();
+    }
+
+    // stop calls dropped instead of the job if it did not run by then
+    void post(Job&& job, Job&& dropped = nullptr)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.emplace_back(std::move(job), std::move(dropped));
+      if (!thread.joinable())
+      {
+        stopping = false;
+        thread = std::thread(&ControlThread::run, this);
+      }
+      else
+        wakeup.notify_one();
+    }
+
+    // Finishes the running job, the queued ones are dropped. Their
+    // dropped functions are called once the thread is gone.
+    void stop()
+    {
+      std::deque<std::pair<Job, Job>> queued;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queued.swap(jobs);
+        wakeup.notify_one();
+      }
+      if (thread.joinable())
+        thread.join();
+      for (auto& job : queued)
+      {
+        if (job.second)
+          job.second();
+      }
+    }
+
+  private:
+    void run()
+    {
+      pthread_setname_np(pthread_self(), "dab-control");
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true)
+      {
+        wakeup.wait(lock, [this]() { return stopping || !jobs.empty(); });
+        if (stopping)
+          return;
+        Job job = std::move(jobs.front().first);
+        jobs.pop_front();
+        lock.unlock();
+        job();
+        job = nullptr;
+        lock.lock();
+      }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    // Each with the function called if it is dropped
+    std::deque<std::pair<Job, Job>> jobs;
+    bool stopping = false;
+    std::thread thread;
+};
+
+#endif // CONTROL_THREAD_H
@@ -0,0 +1,99 @@
+/* Copyright (C) 2024 Lamarqe
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <pybind11/pybind11.h>
+
+namespace py = pybind11;
+
+// Collects the events of a handler on the decoder threads, and delivers
+// them in batches on the asyncio loop. Only the first event of a batch
+// takes the GIL, to wake up the loop with call_soon_threadsafe.
+// The events themselves are converted to python objects on the loop.
+class EventQueue
+{
+  public:
+    // Runs on the loop thread, with the GIL held
+    using Event = std::function<void()>;
+
+    explicit EventQueue(py::object loop) :
+      loop(loop),
+      state(std::make_shared<State>())
+    {
+      std::shared_ptr<State> drained = state;
+      drainFunction = py::cpp_function([drained]() { drain(*drained); });
+    }
+
+    // With the GIL held, as it destroys the python objects
+    ~EventQueue()
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->closed = true;
+      state->events.clear();
+    }
+
+    EventQueue(const EventQueue&) = delete;
+    EventQueue& operator=(const EventQueue&) = delete;
+
+    void post(Event&& event)
+    {
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->events.push_back(std::move(event));
+        if (state->wakeupPending)
+          return;
+        state->wakeupPending = true;
+      }
+      py::gil_scoped_acquire gil;
+      loop.attr("call_soon_threadsafe")(drainFunction);
+    }
+
+  private:
+    // Shared with the pending wakeup, which may outlive the queue
+    struct State
+    {
+      std::mutex mutex;
+      std::vector<Event> events;
+      bool wakeupPending = false;
+      bool closed = false;
+    };
+
+    static void drain(State& state)
+    {
+      std::vector<Event> batch;
+      {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.closed)
+          return;
+        batch.swap(state.events);
+        state.wakeupPending = false;
+      }
+      for (const Event& event : batch)
+        event();
+    }
+
+    py::object loop;
+    py::object drainFunction;
+    std::shared_ptr<State> state;
+};
+
+#endif // EVENT_QUEUE_H
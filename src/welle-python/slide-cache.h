@@ -0,0 +1,103 @@
+/* Copyright (C) 2024 Lamarqe
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDE_CACHE_H
+#define SLIDE_CACHE_H
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "buffer-pool.h"
+
+// The recent slides of a service, identified by the hash of their content.
+// Broadcasters repeat their slides in a carousel, so a received slide is
+// mostly one of these. It then replaces nothing, the cached buffer is
+// reused and an unchanged current slide is not passed on at all.
+class SlideCache
+{
+  public:
+    struct Slide
+    {
+      uint64_t hash = 0;
+      std::string mimeType;
+      std::string name;
+      std::shared_ptr<NativeBuffer> data;
+    };
+
+    // Make the slide the current one. Returns false if it already was.
+    bool add(std::vector<uint8_t>&& data, const std::string& mimeType, const std::string& name, Slide& current)
+    {
+      const uint64_t hash = std::hash<std::string_view>()(
+          std::string_view(reinterpret_cast<const char*>(data.data()), data.size()));
+
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto it = recent.begin(); it != recent.end(); ++it)
+      {
+        if (!sameSlide(*it, hash, data, mimeType, name))
+          continue;
+
+        const bool changed = it != recent.begin();
+        if (changed)
+        {
+          Slide known = std::move(*it);
+          recent.erase(it);
+          recent.push_front(std::move(known));
+        }
+        current = recent.front();
+        return changed;
+      }
+
+      Slide slide;
+      slide.hash = hash;
+      slide.mimeType = mimeType;
+      slide.name = name;
+      slide.data = BufferPool::adopt(std::move(data));
+      recent.push_front(slide);
+      if (recent.size() > maxSlides)
+        recent.pop_back();
+      current = std::move(slide);
+      return true;
+    }
+
+    // Most recent first, the current slide is the first one
+    std::vector<Slide> slides() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return std::vector<Slide>(recent.begin(), recent.end());
+    }
+
+  private:
+    static constexpr size_t maxSlides = 8;
+
+    static bool sameSlide(const Slide& slide, uint64_t hash, const std::vector<uint8_t>& data,
+                          const std::string& mimeType, const std::string& name)
+    {
+      return slide.hash == hash && slide.data->data.size() == data.size() &&
+             slide.mimeType == mimeType && slide.name == name &&
+             memcmp(slide.data->data.data(), data.data(), data.size()) == 0;
+    }
+
+    mutable std::mutex mutex;
+    std::deque<Slide> recent;
+};
+
+#endif // SLIDE_CACHE_H
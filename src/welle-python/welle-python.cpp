@@ -13,19 +13,235 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <map>
+#include <shared_mutex>
+
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include "buffer-pool.h"
+#include "control-thread.h"
+#include "event-queue.h"
+#include "slide-cache.h"
+#include "backend/channel-probe.h"
+#include "backend/dabplus_decoder.h"
+#include "backend/frequency-offset-memory.h"
+#include "backend/mode-i.h"
 #include "backend/radio-receiver.h"
+#include "input/eti_source.h"
 #include "input/input_factory.h"
 #include "various/channels.h"
+#include "various/dsp-kernels.h"
+#include "various/fft.h"
+#include "various/http-stream-server.h"
+#include "various/locked-memory.h"
+#include "various/openmetrics.h"
+#include "various/profiling.h"
+#include "various/thread-config.h"
+#include "various/wav-header.h"
 
 namespace py = pybind11;
 
-#define RUN_IN_ASYNC(cname, name, ...)                                                        \
-  py::gil_scoped_acquire gil;                                                                 \
-  py::function method = py::get_override(static_cast<const cname *>(this), name);             \
-  py::module_::import("asyncio").attr("run_coroutine_threadsafe")(method(__VA_ARGS__), loop);
+// Queue a call of the python coroutine. The arguments are captured by value
+// and converted on the asyncio loop, which the EventQueue wakes up once per batch.
+#define RUN_IN_ASYNC(cname, name, ...)                                                    \
+  events.post([=]() {                                                                     \
+    py::function method = py::get_override(static_cast<const cname *>(this), name);       \
+    loop.attr("create_task")(method(__VA_ARGS__));                                        \
+  });
+
+// The native HTTP server for the audio streams. Python only decides which
+// streams exist, their clients are served without the event loop.
+class StreamServer {
+protected:
+  py::object loop;
+  EventQueue events;
+  py::object onIdle;
+
+public:
+  HttpStreamServer server;
+
+  StreamServer(int port, py::object onIdleParam):
+    loop(py::module_::import("asyncio").attr("get_event_loop")()),
+    events(loop),
+    onIdle(onIdleParam),
+    server(port, [this](const std::string& path) {
+      events.post([this, path]() { onIdle(path); });
+    }) {}
+
+  ~StreamServer()
+  {
+    // the server thread takes the GIL to report idle streams
+    py::gil_scoped_release release;
+    server.stop();
+  }
+
+  bool start()
+  {
+    py::gil_scoped_release release;
+    return server.start();
+  }
+
+  void stop()
+  {
+    py::gil_scoped_release release;
+    server.stop();
+  }
+
+  void remove_stream(const std::string& path)
+  {
+    server.removeStream(path);
+  }
+};
+
+// Set by configure_thread, process wide like the threads it applies to
+static ThreadingOptions threadingOptions;
+
+// Set by configure_aac_decoder, process wide like the decoders
+static std::atomic<AACBackend> aacBackend(AACBackend::Auto);
+
+// The content hash of a slide, as python sees it
+static std::string slideId(uint64_t hash)
+{
+  char id[17];
+  snprintf(id, sizeof(id), "%016llx", (unsigned long long)hash);
+  return id;
+}
+
+// The hops with samples, as {hop: {count, mean, p50, p99, max}} in seconds
+static py::dict latencyDict(const LatencyTrace::Snapshot& trace)
+{
+  py::dict hops;
+  for (size_t h = 0; h < numLatencyHops; h++)
+  {
+    const LatencyHistogram::Snapshot& s = trace[h];
+    if (s.count == 0)
+      continue;
+    py::dict hop;
+    hop["count"] = s.count;
+    hop["mean"] = s.sum / 1e9 / s.count;
+    hop["p50"] = s.percentile(0.5) / 1e9;
+    hop["p99"] = s.percentile(0.99) / 1e9;
+    hop["max"] = s.max / 1e9;
+    hops[latencyHopName((LatencyHop)h)] = hop;
+  }
+  return hops;
+}
+
+// A service of an Ensemble. It shares the snapshot of the ensemble, so it
+// stays consistent and valid after the ensemble was updated.
+class EnsembleService {
+public:
+  EnsembleService(std::shared_ptr<const EnsembleSnapshot> ensemble, const Service& service) :
+    ensemble(std::move(ensemble)), service(&service) {}
+
+  uint32_t sid() const { return service->serviceId; }
+  std::string label() const { return service->serviceLabel.utf8_label(); }
+  std::string short_label() const { return service->serviceLabel.fig1_shortlabel_utf8(); }
+  int programme_type() const { return service->programType; }
+  int language() const { return service->language; }
+
+  // Same test as DabDevice::is_audio_service: any of the audio
+  // components is DAB+, not only the primary one
+  bool is_audio() const
+  {
+    for (const ServiceComponent& sc : ensemble->components)
+    {
+      if (sc.SId == service->serviceId &&
+          sc.transportMode() == TransportMode::Audio &&
+          sc.audioType() == AudioServiceComponentType::DABPlus)
+        return true;
+    }
+    return false;
+  }
+
+  // The subchannel of the audio component, None for data only services
+  std::optional<py::dict> subchannel() const
+  {
+    const ServiceComponent* sc = audioComponent();
+    if (!sc)
+      return std::nullopt;
+
+    for (const Subchannel& sub : ensemble->subChannels)
+    {
+      if (sub.subChId != sc->subchannelId || !sub.valid())
+        continue;
+      py::dict info;
+      info["id"] = sub.subChId;
+      info["start_address"] = sub.startAddr;
+      info["length"] = sub.length;
+      info["bitrate"] = sub.bitrate();
+      info["protection"] = sub.protection();
+      return info;
+    }
+    return std::nullopt;
+  }
+
+private:
+  // The primary audio component, any audio component otherwise
+  const ServiceComponent* audioComponent() const
+  {
+    const ServiceComponent* found = nullptr;
+    for (const ServiceComponent& sc : ensemble->components)
+    {
+      if (sc.SId != service->serviceId || sc.transportMode() != TransportMode::Audio)
+        continue;
+      if (sc.PS_flag)
+        return &sc;
+      if (!found)
+        found = &sc;
+    }
+    return found;
+  }
+
+  std::shared_ptr<const EnsembleSnapshot> ensemble;
+  const Service* service;
+};
+
+// The ensemble database as returned by DabDevice::get_ensemble, one
+// immutable snapshot for the python side. Nothing is converted before it
+// is accessed, so listing the SIds does not build all the labels.
+class Ensemble {
+public:
+  explicit Ensemble(std::shared_ptr<const EnsembleSnapshot> snapshot) : snapshot(std::move(snapshot)) {}
+
+  uint64_t version() const { return snapshot->version; }
+  uint16_t id() const { return snapshot->ensembleId; }
+  uint8_t ecc() const { return snapshot->ensembleEcc; }
+  std::string label() const { return snapshot->ensembleLabel.utf8_label(); }
+  size_t size() const { return snapshot->services.size(); }
+  bool contains(uint32_t sId) const { return snapshot->findService(sId) != nullptr; }
+
+  std::vector<uint32_t> service_ids() const
+  {
+    std::vector<uint32_t> ids;
+    ids.reserve(snapshot->services.size());
+    for (const Service& srv : snapshot->services)
+      ids.push_back(srv.serviceId);
+    return ids;
+  }
+
+  std::vector<EnsembleService> services() const
+  {
+    std::vector<EnsembleService> result;
+    result.reserve(snapshot->services.size());
+    for (const Service& srv : snapshot->services)
+      result.emplace_back(snapshot, srv);
+    return result;
+  }
+
+  // None if the service is unknown
+  std::optional<EnsembleService> service(uint32_t sId) const
+  {
+    const Service* srv = snapshot->findService(sId);
+    if (!srv)
+      return std::nullopt;
+    return EnsembleService(snapshot, *srv);
+  }
+
+private:
+  std::shared_ptr<const EnsembleSnapshot> snapshot;
+};
 
 class ServiceEventHandler : public ProgrammeHandlerInterface {
 public:
@@ -34,30 +250,183 @@ public:
   virtual void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) override  {}
   virtual void onAacErrors(int aacErrors) override {}
   virtual void onNewDynamicLabel(const std::string& label) override {}
-  virtual void onMOT(const mot_file_t& mot_file) override {}
+  virtual void onMOT(mot_file_t&& mot_file) override {}
   virtual void onPADLengthError(size_t announced_xpad_len, size_t xpad_len) override {}
   virtual void ProcessUntouchedStream(const uint8_t* /*data*/, size_t /*len*/, size_t /*duration_ms*/) override {}
+  virtual bool wantsFloatAudio() override { return floatAudio; }
+  virtual bool isForeground() override { return foreground; }
+
+  // Audio is delivered in chunks of at least this duration, 0 for every frame
+  int audioChunkMs = 0;
+  // Deliver 32 bit float instead of 16 bit samples, taking effect on the next subscription
+  bool floatAudio = false;
+  // Somebody listens, otherwise the slideshow is given up first under load.
+  // Taken into account on subscription, DabDevice.set_foreground changes it
+  // for a subscribed handler.
+  std::atomic<bool> foreground = ATOMIC_VAR_INIT(true);
+
+  // The recent slides, most recent first, as (id, mime type, name, data)
+  std::vector<std::tuple<std::string, std::string, std::string, py::memoryview>> get_slides()
+  {
+    std::vector<std::tuple<std::string, std::string, std::string, py::memoryview>> result;
+    for (const SlideCache::Slide& slide : slideCache.slides())
+      result.emplace_back(slideId(slide.hash), slide.mimeType, slide.name, py::memoryview(py::cast(slide.data)));
+    return result;
+  }
+
+  // Additionally send the audio to the clients of a native stream.
+  // Unless pythonAudio is set, on_new_audio is not called any more.
+  // New clients start with up to prerollMs of the recent audio.
+  void publish_stream(StreamServer& streamServer, const std::string& path, bool wav, bool pythonAudio, int prerollMs)
+  {
+    auto stream = streamServer.server.addStream(path, wav ? "audio/wav" : "audio/aac", wav,
+        std::chrono::milliseconds(prerollMs));
+    deliverToPython = pythonAudio;
+    std::atomic_store(&nativeStream, stream);
+  }
+
+  void unpublish_stream()
+  {
+    std::atomic_store(&nativeStream, std::shared_ptr<HttpStreamServer::Stream>());
+    deliverToPython = true;
+  }
+
+  // The latency of the audio passed to on_new_audio, from the capture of
+  // its newest sample to the call. The capture time and the index of that
+  // sample of the last chunk tell which audio was received at the same
+  // time by other devices.
+  py::dict get_latency()
+  {
+    py::dict result = latencyDict(latency.snapshot());
+    const LatencyStamp& last = latency.lastStamp();
+    if (last.valid())
+    {
+      result["last_capture_ns"] = last.capturedNs;
+      result["last_sample_index"] = last.sampleIndex;
+    }
+    return result;
+  }
+
+protected:
+  SlideCache slideCache;
+  // Only written on the asyncio loop
+  LatencyTrace latency;
+  std::shared_ptr<HttpStreamServer::Stream> nativeStream;
+  std::atomic<bool> deliverToPython = ATOMIC_VAR_INIT(true);
 };
 
 class PyServiceEventHandler: public ServiceEventHandler {
 protected:
   py::object loop;
+  EventQueue events;
+
+  // The audio collected for the next chunk, only used by the decoder thread
+  std::shared_ptr<NativeBuffer> pendingAudio;
+  size_t pendingAudioMs = 0;
+  int pendingSampleRate = 0;
+  std::string pendingMode;
+  bool pendingFloat = false;
+  // Of the audio added last, and of the newest audio of the chunk
+  LatencyStamp audioStamp;
+  LatencyStamp pendingStamp;
+  std::weak_ptr<HttpStreamServer::Stream> headerSentTo;
 
 public:
-  PyServiceEventHandler(): loop(py::module_::import("asyncio").attr("get_event_loop")())  {}
+  PyServiceEventHandler():
+    loop(py::module_::import("asyncio").attr("get_event_loop")()),
+    events(loop) {}
+
+  // The data is copied into a pooled buffer before taking the GIL.
+  // Python gets a memoryview of it, which aiohttp sends without another copy.
+  static py::memoryview toMemoryview(const std::shared_ptr<NativeBuffer>& buffer)
+  {
+    return py::memoryview(py::cast(buffer));
+  }
+
+  void addAudio(const void* data, size_t len, size_t durationMs, int sampleRate, const std::string& mode, bool isFloat = false)
+  {
+    // Neither a native stream nor python takes the chunks
+    if (!pendingAudio && !std::atomic_load(&nativeStream) && !deliverToPython)
+      return;
+
+    if (pendingAudio && (sampleRate != pendingSampleRate || mode != pendingMode || isFloat != pendingFloat))
+      flushAudio();
+
+    if (!pendingAudio)
+    {
+      pendingAudio = BufferPool::shared().acquire(nullptr, 0);
+      pendingSampleRate = sampleRate;
+      pendingMode = mode;
+      pendingFloat = isFloat;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    pendingAudio->data.insert(pendingAudio->data.end(), bytes, bytes + len);
+    pendingAudioMs += durationMs;
+    pendingStamp = audioStamp;
+
+    if (pendingAudioMs >= (size_t)audioChunkMs)
+      flushAudio();
+  }
+
+  void flushAudio()
+  {
+    std::shared_ptr<NativeBuffer> data = std::move(pendingAudio);
+    const int sampleRate = pendingSampleRate;
+    const std::string mode = pendingMode;
+    const bool isFloat = pendingFloat;
+    const size_t durationMs = pendingAudioMs;
+    const LatencyStamp stamp = pendingStamp;
+    pendingAudio.reset();
+    pendingAudioMs = 0;
+    pendingStamp = LatencyStamp();
+
+    // All clients of the stream send from the same buffer
+    const auto stream = std::atomic_load(&nativeStream);
+    if (stream)
+    {
+      if (sampleRate && headerSentTo.lock() != stream)
+      {
+        stream->setHeader(wavHeader(sampleRate, isFloat));
+        headerSentTo = stream;
+      }
+      HttpStreamServer::Chunk chunk;
+      chunk.data = data->data.data();
+      chunk.size = data->data.size();
+      chunk.owner = data;
+      chunk.duration = std::chrono::milliseconds(durationMs);
+      stream->push(std::move(chunk));
+    }
+
+    if (deliverToPython)
+    {
+      // Handed off once the loop runs the call
+      if (stamp.valid())
+        events.post([this, stamp]() { latency.add(stamp, LatencyStamp::now()); });
+      RUN_IN_ASYNC(ServiceEventHandler, "on_new_audio", toMemoryview(data), sampleRate, mode);
+    }
+  }
+
+  virtual void onAudioStamp(const LatencyStamp& stamp) override
+  {
+    audioStamp = stamp;
+  }
 
   virtual void ProcessUntouchedStream(const uint8_t* audioData, size_t len, size_t duration_ms) override 
   {
-    py::gil_scoped_acquire acquire;
-    py::bytes data((const char*)audioData, len);
-    RUN_IN_ASYNC(ServiceEventHandler, "on_new_audio", data, 0, "aac");    
+    addAudio(audioData, len, duration_ms, 0, "aac");
   }
 
   virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode) override
   {
-    py::gil_scoped_acquire acquire;
-    py::bytes data((const char*)audioData.data(), 2*audioData.size());
-    RUN_IN_ASYNC(ServiceEventHandler, "on_new_audio", data, sampleRate, mode);
+    // interleaved stereo samples
+    const size_t durationMs = sampleRate ? audioData.size() / 2 * 1000 / sampleRate : 0;
+    addAudio(audioData.data(), 2*audioData.size(), durationMs, sampleRate, mode);
+  }
+
+  virtual void onNewAudioFloat(std::vector<float>&& audioData, int sampleRate, const std::string& mode) override
+  {
+    const size_t durationMs = sampleRate ? audioData.size() / 2 * 1000 / sampleRate : 0;
+    addAudio(audioData.data(), 4*audioData.size(), durationMs, sampleRate, mode, true);
   }
 
   virtual void onNewDynamicLabel(const std::string& label) override
@@ -65,7 +434,7 @@ public:
     RUN_IN_ASYNC(ServiceEventHandler, "on_new_dynamic_label", label);
   }
 
-  virtual void onMOT(const mot_file_t& mot_file) override
+  virtual void onMOT(mot_file_t&& mot_file) override
   {
     std::string mime_type;
     switch (mot_file.content_sub_type)
@@ -76,9 +445,11 @@ public:
       case 0x03: mime_type = "image/png";  break;
       default:   mime_type = "unknown";
     }
-    py::gil_scoped_acquire acquire;
-    py::bytes data((const char*)mot_file.data.data(), mot_file.data.size());
-    RUN_IN_ASYNC(ServiceEventHandler, "on_mot", data, mime_type, mot_file.content_name);
+    // Repetitions of the current slide are not passed on
+    SlideCache::Slide slide;
+    if (!slideCache.add(std::move(mot_file.data), mime_type, mot_file.content_name, slide))
+      return;
+    RUN_IN_ASYNC(ServiceEventHandler, "on_mot", toMemoryview(slide.data), slide.mimeType, slide.name, slideId(slide.hash));
   }  
 };
 
@@ -98,6 +469,15 @@ public:
   virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& data) override {}
   virtual void onMessage(message_level_t level, const std::string& text, const std::string& text2 = std::string()) override {}
   virtual void onTIIMeasurement(tii_measurement_t&& m) override {}
+  virtual diagnostics_request_t getDiagnosticsRequest() override
+  {
+    // None of the diagnostics are passed on to python
+    diagnostics_request_t request;
+    request.impulseResponse = false;
+    request.constellation = false;
+    request.nullSymbol = false;
+    return request;
+  }
 };
 
 class DeviceMessageHandler : public NullRadioController {
@@ -120,9 +500,12 @@ class ChannelEventHandler : public NullRadioController {};
 class PyChannelEventHandler : public ChannelEventHandler {
 protected:
   py::object loop;
+  EventQueue events;
 
 public:
-  PyChannelEventHandler(): loop(py::module_::import("asyncio").attr("get_event_loop")())  {}
+  PyChannelEventHandler():
+    loop(py::module_::import("asyncio").attr("get_event_loop")()),
+    events(loop) {}
 
   virtual void onSyncChange(char isSync) override 
   { 
@@ -146,7 +529,24 @@ public:
 
   virtual void onSetEnsembleLabel(DabLabel& label) override
   {
-    RUN_IN_ASYNC(ChannelEventHandler, "on_set_ensemble_label", label.utf8_label());
+    const std::string ensembleLabel = label.utf8_label();
+    RUN_IN_ASYNC(ChannelEventHandler, "on_set_ensemble_label", ensembleLabel);
+  }
+
+  virtual void onServiceLabel(uint32_t sId, const DabLabel& label) override
+  {
+    const std::string serviceLabel = label.utf8_label();
+    RUN_IN_ASYNC(ChannelEventHandler, "on_service_label", sId, serviceLabel);
+  }
+
+  virtual void onServiceComponentsComplete(uint32_t sId) override
+  {
+    RUN_IN_ASYNC(ChannelEventHandler, "on_service_components_complete", sId);
+  }
+
+  virtual void onEnsembleComplete(uint16_t eId) override
+  {
+    RUN_IN_ASYNC(ChannelEventHandler, "on_ensemble_complete", eId);
   }
 
   virtual void onMessage(message_level_t level, const std::string& text, const std::string& text2 = std::string()) override
@@ -159,22 +559,358 @@ public:
 class DabDevice {
   protected:
     RadioReceiver* rx = nullptr;
+    // The receiver reports to the handler it was created with
+    ChannelEventHandler* rxHandler = nullptr;
+
+    std::string ensembleCacheFile(const std::string& channel) const
+    {
+      if (ensembleCacheDir.empty())
+        return "";
+      return ensembleCacheDir + "/" + channel + ".ensemble";
+    }
+
+    // Of this dongle, each DabDevice owns another one
+    FrequencyOffsetMemory frequencyOffsets{modeI::carrierDiff};
+
+    // Call with the receiver stopped and the input still tuned to its channel
+    void rememberFrequencyOffset()
+    {
+      int32_t coarse;
+      int16_t fine;
+      if (rx->getLastValidCorrectors(coarse, fine))
+        frequencyOffsets.store(device->getFrequency(), coarse, fine);
+    }
+
+    void seedFrequencyOffset(int frequency)
+    {
+      int32_t coarse;
+      int16_t fine;
+      if (frequencyOffsets.lookup(frequency, coarse, fine))
+        rx->setInitialCorrectors(coarse, fine);
+    }
+
+    // See publish_eti, kept for the receivers of the next channels
+    std::shared_ptr<HttpStreamServer::Stream> etiStream;
+    bool etiAllSubchannels = true;
+
+    // Held exclusively while the receiver or the device is set up, tuned,
+    // subscribed or deleted, shared by the accessors. Never wait for it with
+    // the GIL held, the receiver threads take the GIL to post their events.
+    std::shared_mutex controlMutex;
+
+    py::object loop;
+    EventQueue events;
+    // The future and the handler of each pending *_async operation, with the GIL held
+    std::map<uint64_t, std::pair<py::object, py::object>> pendingOperations;
+    uint64_t nextOperation = 0;
+    ControlThread controlThread;
+    // The operations stopControlThread dropped, only used by its caller
+    std::vector<uint64_t> droppedOperations;
+
+    // Without the GIL. The futures of the operations that did not run
+    // fail, instead of never completing.
+    void stopControlThread()
+    {
+      controlThread.stop();
+      if (droppedOperations.empty())
+        return;
+
+      py::gil_scoped_acquire acquire;
+      for (uint64_t id : droppedOperations)
+      {
+        const auto pending = pendingOperations.find(id);
+        if (pending == pendingOperations.end())
+          continue;
+        py::object future = pending->second.first;
+        pendingOperations.erase(pending);
+        try
+        {
+          if (!future.attr("done")().cast<bool>())
+            future.attr("set_exception")(py::module_::import("builtins").attr("RuntimeError")(
+                "the device was closed before the operation ran"));
+        }
+        catch (py::error_already_set&)
+        {
+          // e.g. the loop of the future was closed already
+        }
+      }
+      droppedOperations.clear();
+    }
+
+    // Runs the operation on the control thread and returns a future of its
+    // result, None without one. The handler stays alive until it completed.
+    py::object runAsync(py::object handler, std::function<bool()>&& operation, bool hasResult = true)
+    {
+      py::object future = loop.attr("create_future")();
+      const uint64_t id = nextOperation++;
+      pendingOperations[id] = std::make_pair(future, handler);
+      controlThread.post([this, id, operation = std::move(operation), hasResult]()
+        {
+          bool result = false;
+          std::string error;
+          bool invalidArgument = false;
+          try
+          {
+            result = operation();
+          }
+          catch (std::invalid_argument& e)
+          {
+            error = e.what();
+            invalidArgument = true;
+          }
+          catch (std::exception& e)
+          {
+            error = e.what();
+          }
+          events.post([this, id, result, hasResult, error, invalidArgument]()
+            {
+              const auto pending = pendingOperations.find(id);
+              if (pending == pendingOperations.end())
+                return;
+              py::object future = pending->second.first;
+              pendingOperations.erase(pending);
+              // the caller stopped waiting for it
+              if (future.attr("done")().cast<bool>())
+                return;
+              if (!error.empty())
+              {
+                py::object builtins = py::module_::import("builtins");
+                py::object exception = builtins.attr(invalidArgument ? "ValueError" : "RuntimeError");
+                future.attr("set_exception")(exception(error));
+              }
+              else if (hasResult)
+                future.attr("set_result")(result);
+              else
+                future.attr("set_result")(py::none());
+            });
+        },
+        [this, id]() { droppedOperations.push_back(id); });
+      return future;
+    }
+
+    static OverflowPolicy overflowPolicyFromString(const std::string& overflowPolicy, int blockTimeoutMs)
+    {
+      OverflowPolicy overflow;
+      if (overflowPolicy == "drop_oldest")
+        overflow.mode = OverflowPolicy::Mode::DropOldest;
+      else if (overflowPolicy == "drop_newest")
+        overflow.mode = OverflowPolicy::Mode::DropNewest;
+      else if (overflowPolicy == "block")
+        overflow.mode = OverflowPolicy::Mode::Block;
+      else
+        throw std::invalid_argument("unknown overflow policy: " + overflowPolicy);
+      overflow.blockTimeout = std::chrono::milliseconds(blockTimeoutMs);
+      return overflow;
+    }
+
+    // The operations below run without the GIL, on the loop or on the control thread
+
+    void resetChannel()
+    {
+      std::unique_lock<std::shared_mutex> control(controlMutex);
+      resetChannelLocked();
+    }
+
+    void resetChannelLocked()
+    {
+      if (!rx)
+        return;
+      rx->stop();
+      if (device)
+      {
+        device->stop();
+        rememberFrequencyOffset();
+      }
+      delete rx;
+      rx = nullptr;
+      rxHandler = nullptr;
+    }
+
+    bool setChannel(const std::string& channel, ChannelEventHandler& handler, bool isScan,
+                    const ThreadingOptions& threads)
+    {
+      std::unique_lock<std::shared_mutex> control(controlMutex);
+      return setChannelLocked(channel, handler, isScan, threads);
+    }
+
+    bool setChannelLocked(const std::string& channel, ChannelEventHandler& handler, bool isScan,
+                          const ThreadingOptions& threads)
+    {
+      if (rx || !(device || etiSource))
+        return false;
+
+      Channels channels;
+      int freq = 0;
+      if (device)
+      {
+        freq = channels.getFrequency(channel);
+        device->setFrequency(freq);
+        // e.g. a channel outside of the capture of a wideband device
+        if (!device->is_ok())
+          return false;
+        device->reset();
+      }
+      // the ETI source carries the ensemble of its channel only
+      else if (channel != etiChannel)
+        return false;
+
+      RadioReceiverOptions rro;
+      rro.demodulatorThreads = demodulatorThreads;
+      rro.warmStandbyServices = warmStandby;
+      rro.warmStandbyTimeout = std::chrono::seconds(warmStandbyTimeoutS);
+      rro.streamSymbols = streamSymbols;
+      rro.loadGovernor = loadGovernor;
+      rro.memoryBudget = memoryBudget;
+      rro.idleFicInterval = idleFicInterval;
+      rro.packedSoftbits = packedSoftbits;
+      rro.ensembleCacheFile = ensembleCacheFile(channel);
+      rro.threading = threads;
+      rro.aacBackend = aacBackend;
+      if (device)
+        rx = new RadioReceiver(handler, *device, rro, 1, decodeAudio);
+      else
+        rx = new RadioReceiver(handler, *etiSource, rro, decodeAudio);
+      rxHandler = &handler;
+      applyEtiOutput();
+
+      if (device)
+        seedFrequencyOffset(freq);
+      rx->restart(isScan);
+      return true;
+    }
+
+    bool retuneChannel(const std::string& channel, ChannelEventHandler& handler, bool isScan,
+                       const ThreadingOptions& threads)
+    {
+      std::unique_lock<std::shared_mutex> control(controlMutex);
+      // an ETI source is not tuned, its receiver is set up again
+      if (rx && (rxHandler != &handler || etiSource))
+        resetChannelLocked();
+      if (!rx)
+        return setChannelLocked(channel, handler, isScan, threads);
+
+      rx->stop();
+      device->stop();
+      rememberFrequencyOffset();
+      Channels channels;
+      const int freq = channels.getFrequency(channel);
+      device->setFrequency(freq);
+      if (!device->is_ok())
+      {
+        delete rx;
+        rx = nullptr;
+        rxHandler = nullptr;
+        return false;
+      }
+      device->reset();
+
+      seedFrequencyOffset(freq);
+      rx->retune(isScan, ensembleCacheFile(channel));
+      return true;
+    }
+
+    bool subscribeService(ServiceEventHandler& handler, uint32_t sId, bool decodeAudio, OverflowPolicy overflow)
+    {
+      std::unique_lock<std::shared_mutex> control(controlMutex);
+      if (!rx)
+        return false;
+
+      const Service& sadd = rx->getService(sId);
+      return rx->addServiceToDecode(handler, "", sadd, decodeAudio, overflow);
+    }
+
+    // Without handler, the service is removed with all its handlers
+    bool unsubscribeService(uint32_t sId, ServiceEventHandler* handler)
+    {
+      std::unique_lock<std::shared_mutex> control(controlMutex);
+      if (!rx)
+        return false;
+
+      const Service& sremove = rx->getService(sId);
+      if (handler)
+        return rx->removeServiceToDecode(sremove, *handler);
+      rx->removeServiceToDecode(sremove);
+      return true;
+    }
+
+    // With controlMutex held exclusively
+    void applyEtiOutput()
+    {
+      if (!rx)
+        return;
+      const auto stream = etiStream;
+      if (!stream)
+      {
+        rx->setEtiOutput(nullptr, false);
+        return;
+      }
+      rx->setEtiOutput([stream](const uint8_t* frame, size_t len)
+        {
+          const auto buffer = BufferPool::shared().acquire(frame, len);
+          HttpStreamServer::Chunk chunk;
+          chunk.data = buffer->data.data();
+          chunk.size = buffer->data.size();
+          chunk.owner = buffer;
+          chunk.duration = std::chrono::milliseconds(24);
+          stream->push(std::move(chunk));
+        }, etiAllSubchannels);
+    }
   public:
     std::string deviceName;
     int gain;
     bool decodeAudio;
+    int demodulatorThreads;
+    int warmStandby;
+    int warmStandbyTimeoutS;
+    // <channel>.ensemble in this directory caches the ensemble of the channel
+    std::string ensembleCacheDir;
+    bool streamSymbols;
+    bool loadGovernor;
+    // Bytes for the buffers of the device and its receiver, 0 for no limit
+    size_t memoryBudget;
+    // Every Nth frame is demodulated while no service is subscribed, 0 for all
+    int idleFicInterval;
+    bool packedSoftbits;
+    UsbTransferConfig usbTransfers;
+    bool usbZeroCopy;
     DeviceMessageHandler msgHandler;
     CVirtualInput* device = nullptr;
+    // Instead of the device with a device name "eti:<channel>:<source>",
+    // see CEtiSource::fromArgs. The ensemble is that of the channel.
+    CEtiSource* etiSource = nullptr;
+    std::string etiChannel;
     py::object lock;
-    DabDevice(std::string deviceNameParam = "auto", int gainParam = -1, bool decodeAudioParam = true):
+    DabDevice(std::string deviceNameParam = "auto", int gainParam = -1, bool decodeAudioParam = true,
+              int demodulatorThreadsParam = 1, int warmStandbyParam = 0, int warmStandbyTimeoutSParam = 120,
+              std::string ensembleCacheDirParam = "", bool streamSymbolsParam = false,
+              bool loadGovernorParam = false, size_t memoryBudgetParam = 0, int idleFicIntervalParam = 0,
+              bool packedSoftbitsParam = false, const std::string& usbTransfersParam = "default",
+              bool usbZeroCopyParam = false):
+        loop(py::module_::import("asyncio").attr("get_event_loop")()),
+        events(loop),
         deviceName(deviceNameParam),
         gain(gainParam),
         decodeAudio(decodeAudioParam),
+        demodulatorThreads(demodulatorThreadsParam),
+        warmStandby(warmStandbyParam),
+        warmStandbyTimeoutS(warmStandbyTimeoutSParam),
+        ensembleCacheDir(ensembleCacheDirParam),
+        streamSymbols(streamSymbolsParam),
+        loadGovernor(loadGovernorParam),
+        memoryBudget(memoryBudgetParam),
+        idleFicInterval(idleFicIntervalParam),
+        packedSoftbits(packedSoftbitsParam),
+        usbTransfers(UsbTransferConfig::fromString(usbTransfersParam)),
+        usbZeroCopy(usbZeroCopyParam),
         msgHandler(DeviceMessageHandler()),
         lock(py::module_::import("threading").attr("Lock")()) {}
 
     virtual bool initialize()
     {
+      const std::string eti = "eti:";
+      if (deviceName.compare(0, eti.size(), eti) == 0)
+        return initializeEti(deviceName.substr(eti.size()));
+
       device = CInputFactory::GetDevice(msgHandler, deviceName);
       if (device == nullptr)
         return false;
@@ -192,56 +928,201 @@ class DabDevice {
         device->setAgc(true);
       else
         device->setGain(gain);
+
+      // Before the buffer, which holds two transfers at least
+      if (!device->setUsbTransfers(usbTransfers, usbZeroCopy))
+        msgHandler.onMessage(message_level_t::Information, deviceName + " does not take the USB transfer settings");
+
+      // The OFDMProcessor reads the samples as they come, 64 ms are
+      // plenty unless it is starved of CPU
+      if (memoryBudget > 0)
+        device->setDeviceParam(DeviceParam::BufferMs, 64);
+      return true;
+    }
+
+    bool initializeEti(const std::string& args)
+    {
+      const size_t colon = args.find(':');
+      Channels channels;
+      if (colon == std::string::npos || channels.getFrequency(args.substr(0, colon)) == 0)
+      {
+        msgHandler.onMessage(message_level_t::Error, "No channel in " + deviceName);
+        return false;
+      }
+      try
+      {
+        etiSource = CEtiSource::fromArgs(args.substr(colon + 1));
+      }
+      catch (const std::exception& e)
+      {
+        msgHandler.onMessage(message_level_t::Error, e.what());
+        return false;
+      }
+      etiChannel = args.substr(0, colon);
       return true;
     }
 
     virtual ~DabDevice() 
     {
+      // a running operation may wait for the GIL to post its events
+      py::gil_scoped_release release;
+      stopControlThread();
     }
     
     virtual void close_device() 
     {
-      if (device)
+      if (device || etiSource)
       {
         py::gil_scoped_release release;
+        stopControlThread();
+        std::unique_lock<std::shared_mutex> control(controlMutex);
+        resetChannelLocked();
         delete device;
         device = nullptr;
+        delete etiSource;
+        etiSource = nullptr;
       }
     }
 
     virtual void reset_channel()
     {
-      if (rx)
-      {
-        py::gil_scoped_release release;
-        device->stop();
-        delete rx;
-        rx = nullptr;
-      }
+      py::gil_scoped_release release;
+      resetChannel();
     }
 
     virtual bool set_channel(std::string channel, ChannelEventHandler& handler, bool isScan = false)
     {
-      if (rx)
-        return false;
+      // copied under the GIL, configure_thread may change it
+      const ThreadingOptions threads = threadingOptions;
+      py::gil_scoped_release release;
+      return setChannel(channel, handler, isScan, threads);
+    }
 
+    // Switch the receiver to another channel. Unlike reset_channel and
+    // set_channel, this keeps the receiver with its threads, FFT plans
+    // and buffers. Without a receiver for the handler, it is set_channel.
+    virtual bool retune(std::string channel, ChannelEventHandler& handler, bool isScan = false)
+    {
+      const ThreadingOptions threads = threadingOptions;
       py::gil_scoped_release release;
+      return retuneChannel(channel, handler, isScan, threads);
+    }
+
+    // The *_async variants return an asyncio future and leave the event loop
+    // running meanwhile. They run one after the other on the control thread
+    // of the device, in the order they were called. The synchronous calls and
+    // the other methods wait for a running one, the accessors which are used
+    // on the loop skip the receiver instead.
+    virtual py::object reset_channel_async()
+    {
+      return runAsync(py::none(), [this]() { resetChannel(); return true; }, false);
+    }
+
+    virtual py::object set_channel_async(std::string channel, py::object handler, bool isScan = false)
+    {
+      ChannelEventHandler& channelHandler = handler.cast<ChannelEventHandler&>();
+      const ThreadingOptions threads = threadingOptions;
+      return runAsync(handler, [this, channel, &channelHandler, isScan, threads]()
+        {
+          return setChannel(channel, channelHandler, isScan, threads);
+        });
+    }
+
+    virtual py::object retune_async(std::string channel, py::object handler, bool isScan = false)
+    {
+      ChannelEventHandler& channelHandler = handler.cast<ChannelEventHandler&>();
+      const ThreadingOptions threads = threadingOptions;
+      return runAsync(handler, [this, channel, &channelHandler, isScan, threads]()
+        {
+          return retuneChannel(channel, channelHandler, isScan, threads);
+        });
+    }
+    
+    // Send the ensemble of the current and all later channels as ETI(NI)
+    // stream to the clients of the path, e.g. for dablin on another
+    // host. allSubchannels decodes all of them for it, otherwise the ETI
+    // holds the subscribed services only.
+    virtual void publish_eti(StreamServer& streamServer, const std::string& path, bool allSubchannels = true)
+    {
+      const auto stream = streamServer.server.addStream(path, "application/octet-stream", false);
+      py::gil_scoped_release release;
+      std::unique_lock<std::shared_mutex> control(controlMutex);
+      etiStream = stream;
+      etiAllSubchannels = allSubchannels;
+      applyEtiOutput();
+    }
+
+    virtual void unpublish_eti()
+    {
+      py::gil_scoped_release release;
+      std::unique_lock<std::shared_mutex> control(controlMutex);
+      etiStream.reset();
+      applyEtiOutput();
+    }
+
+    // Check for a DAB signal on the channel without setting up a receiver
+    virtual bool probe_channel(std::string channel, int timeoutMs = 500)
+    {
+      py::gil_scoped_release release;
+      std::unique_lock<std::shared_mutex> control(controlMutex);
+      if (!rx && etiSource)
+        return channel == etiChannel;
+      if (rx || !device)
+        return false;
+
       Channels channels;
-      auto freq = channels.getFrequency(channel);
-      device->setFrequency(freq);
+      device->setFrequency(channels.getFrequency(channel));
+      if (!device->is_ok())
+        return false;
       device->reset();
+      if (!device->restart())
+        return false;
 
-      RadioReceiverOptions rro;
-      rx = new RadioReceiver(handler, *device, rro, 1, decodeAudio);
+      DABParams params(1);
+      ChannelProbe probe(*device, params);
+      const bool present = probe.signalPresent(std::chrono::milliseconds(timeoutMs));
+      device->stop();
+      return present;
+    }
 
-      rx->restart(isScan);
-      return true;
+    // The spectrum of each channel the device can tune, as (channel, in-band dB,
+    // edge dB, flatness), see ChannelProbe::measureSpectrum. Only while not tuned.
+    virtual std::vector<std::tuple<std::string, float, float, float>> prescan_channels(
+        const std::vector<std::string>& channelNames, int timeoutMs = 100)
+    {
+      std::vector<std::tuple<std::string, float, float, float>> result;
+      py::gil_scoped_release release;
+      std::unique_lock<std::shared_mutex> control(controlMutex);
+      if (rx || !device)
+        return result;
+
+      Channels channels;
+      DABParams params(1);
+      for (const std::string& channel : channelNames)
+      {
+        device->setFrequency(channels.getFrequency(channel));
+        if (!device->is_ok())
+          continue;
+        device->reset();
+        if (!device->restart())
+          continue;
+
+        ChannelProbe probe(*device, params);
+        SpectrumOccupancy occupancy;
+        if (probe.measureSpectrum(occupancy, std::chrono::milliseconds(timeoutMs)))
+          result.emplace_back(channel, occupancy.inBandDb, occupancy.edgeDb, occupancy.flatness);
+        device->stop();
+      }
+      return result;
     }
-    
+
     virtual std::optional<std::string> get_channel()
     {
-      if (!rx)
+      std::shared_lock<std::shared_mutex> control(controlMutex, std::try_to_lock);
+      if (!control.owns_lock() || !rx)
         return std::nullopt;
+      if (etiSource)
+        return etiChannel;
 
       int frequency = device->getFrequency();
       try
@@ -255,64 +1136,581 @@ class DabDevice {
       }
     }
 
-    virtual bool subscribe_service(ServiceEventHandler& handler, uint32_t sId)
+    virtual bool subscribe_service(ServiceEventHandler& handler, uint32_t sId,
+                                   std::optional<bool> decodeAudio = std::nullopt,
+                                   const std::string& overflowPolicy = "drop_oldest",
+                                   int blockTimeoutMs = 24)
     {
-      if (!rx)
-        return false;
+      const OverflowPolicy overflow = overflowPolicyFromString(overflowPolicy, blockTimeoutMs);
+      py::gil_scoped_release release;
+      return subscribeService(handler, sId, decodeAudio.value_or(this->decodeAudio), overflow);
+    }
+
+    virtual py::object subscribe_service_async(py::object handler, uint32_t sId,
+                                               std::optional<bool> decodeAudio = std::nullopt,
+                                               const std::string& overflowPolicy = "drop_oldest",
+                                               int blockTimeoutMs = 24)
+    {
+      ServiceEventHandler& serviceHandler = handler.cast<ServiceEventHandler&>();
+      const OverflowPolicy overflow = overflowPolicyFromString(overflowPolicy, blockTimeoutMs);
+      const bool decode = decodeAudio.value_or(this->decodeAudio);
+      return runAsync(handler, [this, &serviceHandler, sId, decode, overflow]()
+        {
+          return subscribeService(serviceHandler, sId, decode, overflow);
+        });
+    }
+
+    virtual py::object unsubscribe_service_async(uint32_t sId, py::object handler = py::none())
+    {
+      ServiceEventHandler* serviceHandler = handler.is_none() ? nullptr : handler.cast<ServiceEventHandler*>();
+      return runAsync(handler, [this, sId, serviceHandler]() { return unsubscribeService(sId, serviceHandler); });
+    }
 
+    // The CIFs dropped by the decoder of the service, or by all services
+    virtual uint64_t get_dropped_fragments(std::optional<uint32_t> sId = std::nullopt)
+    {
       py::gil_scoped_release release;
-      const Service& sadd = rx->getService(sId);
-      return rx->addServiceToDecode(handler, "", sadd);
+      std::shared_lock<std::shared_mutex> control(controlMutex);
+      if (!rx)
+        return 0;
+
+      if (sId.has_value())
+        return rx->getDroppedFragments(rx->getService(sId.value()));
+      return rx->getReceiverStats().droppedFragments;
     }
 
-    virtual bool unsubscribe_service(uint32_t sId)
+    // The bytes of logical frames decoded by all subscribed services
+    virtual uint64_t get_decoded_bytes()
     {
+      py::gil_scoped_release release;
+      std::shared_lock<std::shared_mutex> control(controlMutex);
       if (!rx)
+        return 0;
+
+      return rx->getReceiverStats().decodedBytes;
+    }
+
+    // Write the raw samples of the device into the file while they are
+    // received, in its native format, e.g. u8 I/Q for a rtl-sdr. Takes
+    // buffer_mb of memory, however long the recording runs.
+    virtual bool start_recording(const std::string& path, int bufferMb = 16, bool directIO = false)
+    {
+      py::gil_scoped_release release;
+      std::unique_lock<std::shared_mutex> control(controlMutex);
+      if (!device)
         return false;
 
+      IQRecorder::Options options;
+      options.bufferBytes = (size_t)std::max(bufferMb, 1) << 20;
+      options.directIO = directIO;
+      return device->startRecording(path, options);
+    }
+
+    // Writes out the buffered samples and closes the file
+    virtual void stop_recording()
+    {
       py::gil_scoped_release release;
-      const Service& sremove = rx->getService(sId);
-      rx->removeServiceToDecode(sremove);
-      return true;
+      std::unique_lock<std::shared_mutex> control(controlMutex);
+      if (device)
+        device->stopRecording();
     }
 
-    virtual std::optional<std::string> get_service_name(uint32_t sId)
+    struct StatsSnapshot {
+      InputStats input;
+      bool recording = false;
+      IQRecorder::Stats recorder;
+      bool haveReceiver = false;
+      RadioReceiverStats rx;
+      // The service of each decoded subchannel
+      std::map<int16_t, uint32_t> serviceOfSubchannel;
+      // An operation holds the device, the input and the receiver are left out
+      bool busy = false;
+    };
+
+    // Without the GIL, for get_stats and render_metrics
+    StatsSnapshot statsSnapshot()
+    {
+      StatsSnapshot snapshot;
+      std::shared_lock<std::shared_mutex> control(controlMutex, std::try_to_lock);
+      if (!control.owns_lock())
+      {
+        snapshot.busy = true;
+        return snapshot;
+      }
+      if (device)
+      {
+        snapshot.input = device->getInputStats();
+        snapshot.recording = device->isRecording();
+        snapshot.recorder = device->getRecordingStats();
+      }
+      if (rx)
+      {
+        snapshot.haveReceiver = true;
+        snapshot.rx = rx->getReceiverStats();
+        for (const auto& s : rx->getServiceList())
+          for (const auto& sc : rx->getComponents(s))
+            if (sc.transportMode() == TransportMode::Audio)
+              snapshot.serviceOfSubchannel[sc.subchannelId] = s.serviceId;
+      }
+      return snapshot;
+    }
+
+    // Counters and gauges of the device and the receive pipeline. The
+    // receiver part is missing while no channel is set.
+    virtual py::dict get_stats()
     {
+      StatsSnapshot snapshot;
+      std::array<double, NUM_THREAD_STAGES> cpuTime;
+      {
+        py::gil_scoped_release release;
+        snapshot = statsSnapshot();
+        cpuTime = threading::stageCpuTime();
+      }
+      const InputStats& input = snapshot.input;
+      const RadioReceiverStats& rxStats = snapshot.rx;
+      const auto& serviceOfSubchannel = snapshot.serviceOfSubchannel;
+
+      py::dict stats;
+      stats["busy"] = snapshot.busy;
+      py::dict inputDict;
+      inputDict["buffered_samples"] = input.bufferedSamples;
+      inputDict["buffer_size"] = input.bufferSize;
+      inputDict["max_buffered_samples"] = input.maxBufferedSamples;
+      inputDict["dropped_samples"] = input.droppedSamples;
+      inputDict["overruns"] = input.overruns;
+      if (snapshot.recording)
+      {
+        py::dict recording;
+        recording["written_bytes"] = snapshot.recorder.writtenBytes;
+        recording["dropped_bytes"] = snapshot.recorder.droppedBytes;
+        recording["buffered_bytes"] = snapshot.recorder.bufferedBytes;
+        recording["failed"] = snapshot.recorder.failed;
+        inputDict["recording"] = recording;
+      }
+      stats["input"] = inputDict;
+
+      // The bytes allocated for the buffers of each stage
+      py::dict memory;
+      memory["input"] = input.memoryBytes;
+      if (snapshot.haveReceiver)
+      {
+        memory["demodulator"] = rxStats.demodulatorMemoryBytes;
+        memory["subchannels"] = rxStats.subchannelMemoryBytes;
+      }
+      // Process wide, see configure_memory
+      const lockedmemory::Stats locked = lockedmemory::getStats();
+      memory["locked"] = locked.lockedBytes;
+      memory["huge_pages"] = locked.hugePageBytes;
+      memory["unlocked"] = locked.unlockedBytes;
+      memory["lock_failures"] = locked.lockFailures;
+      stats["memory"] = memory;
+
+      py::dict cpuDict;
+      for (size_t i = 0; i < NUM_THREAD_STAGES; i++)
+        cpuDict[threading::stageToString((ThreadStage)i)] = cpuTime[i];
+      stats["cpu_time"] = cpuDict;
+
+      if (!snapshot.haveReceiver)
+        return stats;
+
+      stats["snr"] = rxStats.snr;
+      stats["synced"] = rxStats.synced;
+      stats["idle"] = rxStats.idle;
+
+      py::dict frames;
+      frames["processed"] = rxStats.framesProcessed;
+      frames["idle"] = rxStats.framesIdle;
+      frames["dropped"] = rxStats.framesDropped;
+      frames["queued"] = rxStats.frameQueueDepth;
+      frames["max_queued"] = rxStats.maxFrameQueueDepth;
+      frames["decode_load"] = rxStats.decodeLoad;
+      stats["frames"] = frames;
+      // The share of the frame period the decoder is idle
+      stats["headroom"] = 1.0f - rxStats.decodeLoad;
+      // The optional processing given up for the headroom, 0 for none
+      stats["degradation_level"] = rxStats.degradationLevel;
+
+      py::dict sync;
+      sync["losses"] = rxStats.syncLosses;
+      sync["coarse_losses"] = rxStats.coarseSyncLosses;
+      stats["sync"] = sync;
+
+      py::dict fic;
+      fic["fibs"] = rxStats.fibCount;
+      fic["crc_errors"] = rxStats.fibCrcErrors;
+      fic["decode_ratio_percent"] = rxStats.ficDecodeRatioPercent;
+      stats["fic"] = fic;
+
+      stats["decoded_bytes"] = rxStats.decodedBytes;
+      stats["dropped_fragments"] = rxStats.droppedFragments;
+      stats["decoder_queue_depth"] = rxStats.decoderQueueDepth;
+
+      py::dict eti;
+      eti["frames"] = rxStats.etiFrames;
+      eti["incomplete_frames"] = rxStats.etiFramesIncomplete;
+      stats["eti"] = eti;
+
+      py::list services;
+      for (const auto& sub : rxStats.subchannels)
+      {
+        py::dict service;
+        const auto sId = serviceOfSubchannel.find(sub.subChId);
+        if (sId != serviceOfSubchannel.end())
+          service["sid"] = sId->second;
+        else
+          service["sid"] = py::none();
+        service["subchannel"] = sub.subChId;
+        service["standby"] = sub.standby;
+        service["buffer_fill"] = sub.bufferFill;
+        service["buffer_size"] = sub.bufferSize;
+        service["max_buffer_fill"] = sub.maxBufferFill;
+        service["dropped_fragments"] = sub.droppedFragments;
+        service["memory_bytes"] = sub.memoryBytes;
+        service["superframes"] = sub.superframes;
+        service["rs_corrected_errors"] = sub.rsCorrectedErrors;
+        service["rs_uncorrectable_superframes"] = sub.rsUncorrectableSuperframes;
+        service["au_errors"] = sub.audioUnitErrors;
+        service["aac_frames"] = sub.aacFrames;
+        service["aac_errors"] = sub.aacErrors;
+        service["observers"] = sub.observers;
+        service["observer_dropped_events"] = sub.observerDroppedEvents;
+        service["latency"] = latencyDict(sub.latency);
+        services.append(service);
+      }
+      stats["services"] = services;
+      return stats;
+    }
+
+    // Subscribing a service again with another handler adds it to the same
+    // decoder. With the handler, only that one is unsubscribed.
+    virtual bool unsubscribe_service(uint32_t sId, ServiceEventHandler* handler = nullptr)
+    {
+      py::gil_scoped_release release;
+      return unsubscribeService(sId, handler);
+    }
+
+    // Change ServiceEventHandler.foreground of a subscribed handler
+    virtual void set_foreground(ServiceEventHandler& handler, bool foreground)
+    {
+      py::gil_scoped_release release;
+      std::shared_lock<std::shared_mutex> control(controlMutex);
+      handler.foreground = foreground;
+      if (rx)
+        rx->updateForeground();
+    }
+
+    // Stop decoding the unsubscribed services whose warm standby timed out
+    virtual void expire_standby()
+    {
+      py::gil_scoped_release release;
+      std::unique_lock<std::shared_mutex> control(controlMutex);
       if (!rx)
+        return;
+
+      rx->expireStandbyServices();
+    }
+
+    virtual std::optional<std::string> get_service_name(uint32_t sId)
+    {
+      std::shared_lock<std::shared_mutex> control(controlMutex, std::try_to_lock);
+      if (!control.owns_lock() || !rx)
         return std::nullopt;
 
-      py::gil_scoped_release release;
-      const Service& srv = rx->getService(sId);
+      const auto ensemble = rx->getEnsembleSnapshot();
+      const Service* srv = ensemble->findService(sId);
 
-      if (srv.serviceId != 0) 
-        return srv.serviceLabel.utf8_label();
+      if (srv)
+        return srv->serviceLabel.utf8_label();
       else
         return std::nullopt;
     }
 
     virtual bool is_audio_service(uint32_t sId)
     {
-      py::gil_scoped_release release;
-      const Service& srv = rx->getService(sId);
-      if (srv.serviceId != 0) 
+      // e.g. a late event of a scan that was moved on already
+      std::shared_lock<std::shared_mutex> control(controlMutex, std::try_to_lock);
+      if (!control.owns_lock() || !rx)
+        return false;
+
+      // the snapshot never blocks, no need to release the GIL
+      const auto ensemble = rx->getEnsembleSnapshot();
+      for (const ServiceComponent& sc : ensemble->components)
       {
-        for (const ServiceComponent& sc : rx->getComponents(srv))
-        {
-          if (sc.transportMode() == TransportMode::Audio &&
-              sc.audioType() == AudioServiceComponentType::DABPlus)
-          return true;
-        }
+        if (sc.SId == sId &&
+            sc.transportMode() == TransportMode::Audio &&
+            sc.audioType() == AudioServiceComponentType::DABPlus)
+        return true;
       }
       // service unknown
       return false;
     }
 
+    // The whole ensemble database at once, instead of one call per service.
+    // None while the device is (re)configured.
+    virtual std::optional<Ensemble> get_ensemble()
+    {
+      std::shared_lock<std::shared_mutex> control(controlMutex, std::try_to_lock);
+      if (!control.owns_lock() || !rx)
+        return std::nullopt;
+
+      return Ensemble(rx->getEnsembleSnapshot());
+    }
+
+    // The EId and the CRCs of the static FIBs received since tuning, see
+    // FicHandler::getFibSignature. None until the EId was received, so that
+    // it does not come from the ensemble cache.
+    virtual std::optional<std::tuple<uint16_t, std::vector<uint16_t>>> get_fib_signature()
+    {
+      py::gil_scoped_release release;
+      std::shared_lock<std::shared_mutex> control(controlMutex);
+      if (!rx || !rx->isEnsembleReceived())
+        return std::nullopt;
+
+      return std::make_tuple(rx->getEnsembleId(), rx->getFibSignature());
+    }
+
     const py::object getLock()
     {
       return lock;
     }
 };
 
+void configure_fft_planner(const std::string& mode, const std::string& wisdomFile)
+{
+  if (mode == "estimate")
+    fft::configurePlanner(fft::PlannerMode::Estimate, wisdomFile);
+  else if (mode == "measure")
+    fft::configurePlanner(fft::PlannerMode::Measure, wisdomFile);
+  else if (mode == "patient")
+    fft::configurePlanner(fft::PlannerMode::Patient, wisdomFile);
+  else
+    throw std::invalid_argument("unknown FFT planner mode: " + mode);
+}
+
+void configure_dsp_kernels(const std::string& kernels)
+{
+  dsp::selectKernels(dsp::kernelSetFromString(kernels));
+}
+
+// Raises ValueError if the name is unknown, not for a backend that is
+// not compiled in, which falls back to auto
+void configure_aac_decoder(const std::string& name)
+{
+  aacBackend = AACDecoder::BackendFromString(name);
+  AACDecoder::SetBackend(aacBackend);
+}
+
+// The AAC decoders compiled in
+std::vector<std::string> aac_decoders()
+{
+  std::vector<std::string> names;
+  for (AACBackend backend : {AACBackend::FAAD2, AACBackend::FDKAAC})
+  {
+    if (AACDecoder::IsAvailable(backend))
+      names.push_back(AACDecoder::BackendName(backend));
+  }
+  return names;
+}
+
+void configure_memory(const std::string& mode)
+{
+  lockedmemory::configure(lockedmemory::modeFromString(mode.c_str()));
+}
+
+void configure_thread(const std::string& stage, const std::vector<int>& cpus, int realtimePriority, int nice)
+{
+  ThreadSettings& settings = threadingOptions[threading::stageFromString(stage)];
+  settings.cpus = cpus;
+  settings.realtimePriority = realtimePriority;
+  settings.nice = nice;
+  threading::configure(threadingOptions);
+}
+
+// The metrics of all devices in the OpenMetrics text format, rendered
+// without touching Python objects but the list of devices
+std::string render_metrics(const std::vector<DabDevice*>& devices)
+{
+  std::vector<std::pair<std::string, DabDevice::StatsSnapshot>> snapshots;
+  for (DabDevice *d : devices)
+    snapshots.emplace_back(d->deviceName, DabDevice::StatsSnapshot());
+
+  py::gil_scoped_release release;
+  for (size_t i = 0; i < devices.size(); i++)
+    snapshots[i].second = devices[i]->statsSnapshot();
+  const auto cpuTime = threading::stageCpuTime();
+
+  using Type = OpenMetricsWriter::Type;
+  OpenMetricsWriter out;
+
+  // One sample per device, receiver values only while a channel is set
+  auto perDevice = [&](const std::string& name, Type type, const std::string& help,
+      bool needsReceiver, std::function<double(const DabDevice::StatsSnapshot&)> value)
+  {
+    out.family(name, type, help);
+    for (const auto& s : snapshots)
+    {
+      if (needsReceiver and not s.second.haveReceiver)
+        continue;
+      if (type == Type::Counter)
+        out.counter({{"device", s.first}}, value(s.second));
+      else
+        out.gauge({{"device", s.first}}, value(s.second));
+    }
+  };
+
+  perDevice("dab_input_buffered_samples", Type::Gauge, "Samples waiting for the receiver", false,
+      [](const auto& s) { return s.input.bufferedSamples; });
+  perDevice("dab_input_max_buffered_samples", Type::Gauge, "Most samples ever waiting for the receiver", false,
+      [](const auto& s) { return s.input.maxBufferedSamples; });
+  perDevice("dab_input_dropped_samples", Type::Counter, "Samples lost in input overruns", false,
+      [](const auto& s) { return s.input.droppedSamples; });
+  perDevice("dab_input_overruns", Type::Counter, "Times the receiver fell behind the input", false,
+      [](const auto& s) { return s.input.overruns; });
+  perDevice("dab_recorded_bytes", Type::Counter, "Bytes of raw samples written by the recording", false,
+      [](const auto& s) { return s.recorder.writtenBytes; });
+  perDevice("dab_recording_dropped_bytes", Type::Counter, "Bytes of raw samples the recording could not write in time", false,
+      [](const auto& s) { return s.recorder.droppedBytes; });
+  perDevice("dab_snr_db", Type::Gauge, "Signal to noise ratio", true,
+      [](const auto& s) { return s.rx.snr; });
+  perDevice("dab_synced", Type::Gauge, "1 while the receiver is time synchronised", true,
+      [](const auto& s) { return s.rx.synced; });
+  perDevice("dab_sync_losses", Type::Counter, "Losses of the time synchronisation", true,
+      [](const auto& s) { return s.rx.syncLosses; });
+  perDevice("dab_coarse_sync_losses", Type::Counter, "Searches for the coarse frequency offset", true,
+      [](const auto& s) { return s.rx.coarseSyncLosses; });
+  perDevice("dab_fic_decode_ratio", Type::Gauge, "Share of recent FICs with a valid CRC", true,
+      [](const auto& s) { return s.rx.ficDecodeRatioPercent / 100.0; });
+  perDevice("dab_fib_crc_errors", Type::Counter, "FIBs with a CRC error", true,
+      [](const auto& s) { return s.rx.fibCrcErrors; });
+  perDevice("dab_eti_frames", Type::Counter, "ETI frames sent, see publish_eti", true,
+      [](const auto& s) { return s.rx.etiFrames; });
+  perDevice("dab_eti_incomplete_frames", Type::Counter, "ETI frames sent with a subchannel missing", true,
+      [](const auto& s) { return s.rx.etiFramesIncomplete; });
+  perDevice("dab_frames_processed", Type::Counter, "Transmission frames demodulated", true,
+      [](const auto& s) { return s.rx.framesProcessed; });
+  perDevice("dab_frames_idle", Type::Counter, "Frames only synchronised to while no service is subscribed", true,
+      [](const auto& s) { return s.rx.framesIdle; });
+  perDevice("dab_idle", Type::Gauge, "1 while the receiver is in the idle mode", true,
+      [](const auto& s) { return s.rx.idle ? 1 : 0; });
+  perDevice("dab_frames_dropped", Type::Counter, "Frames dropped because the decoder fell behind", true,
+      [](const auto& s) { return s.rx.framesDropped; });
+  perDevice("dab_frame_queue_depth", Type::Gauge, "Frames waiting for the OFDM decoder", true,
+      [](const auto& s) { return s.rx.frameQueueDepth; });
+  perDevice("dab_frame_queue_max_depth", Type::Gauge, "Most frames ever waiting for the OFDM decoder", true,
+      [](const auto& s) { return s.rx.maxFrameQueueDepth; });
+  perDevice("dab_decode_load", Type::Gauge, "OFDM decode time divided by the frame period", true,
+      [](const auto& s) { return s.rx.decodeLoad; });
+  perDevice("dab_degradation_level", Type::Gauge, "Steps of optional processing given up for the decode load", true,
+      [](const auto& s) { return s.rx.degradationLevel; });
+
+  out.family("dab_frame_decode_seconds", Type::Histogram, "Time to decode a transmission frame");
+  for (const auto& s : snapshots)
+    if (s.second.haveReceiver)
+      out.histogram({{"device", s.first}}, s.second.rx.frameDecodeTime);
+
+#if defined(WITH_PROFILING)
+  out.family("dab_stage_latency_seconds", Type::Histogram, "Time between two profiling marks of a thread");
+  for (const auto& stage : get_profiler().stages())
+    out.histogram({{"from", mark_to_cstr(stage.from)}, {"to", mark_to_cstr(stage.to)}}, stage.latency);
+#endif
+
+  const lockedmemory::Stats locked = lockedmemory::getStats();
+  out.family("dab_locked_memory_bytes", Type::Gauge, "Bytes of the real-time buffers locked into memory");
+  out.gauge({}, locked.lockedBytes);
+  out.family("dab_unlocked_memory_bytes", Type::Gauge, "Bytes of the real-time buffers that could not be locked");
+  out.gauge({}, locked.unlockedBytes);
+
+  out.family("dab_stage_cpu_seconds", Type::Counter, "CPU time of the threads of a pipeline stage");
+  for (size_t i = 0; i < NUM_THREAD_STAGES; i++)
+    out.counter({{"stage", threading::stageToString((ThreadStage)i)}}, cpuTime[i]);
+
+  perDevice("dab_decoder_queue_depth", Type::Gauge, "Subchannel decoders waiting for a worker", true,
+      [](const auto& s) { return s.rx.decoderQueueDepth; });
+
+  out.family("dab_memory_bytes", Type::Gauge, "Bytes allocated for the buffers of a pipeline stage");
+  for (const auto& s : snapshots)
+  {
+    out.gauge({{"device", s.first}, {"stage", "input"}}, s.second.input.memoryBytes);
+    if (not s.second.haveReceiver)
+      continue;
+    out.gauge({{"device", s.first}, {"stage", "demodulator"}}, s.second.rx.demodulatorMemoryBytes);
+    out.gauge({{"device", s.first}, {"stage", "subchannels"}}, s.second.rx.subchannelMemoryBytes);
+  }
+
+  // One sample per decoded subchannel
+  auto perService = [&](const std::string& name, Type type, const std::string& help,
+      std::function<double(const SubchannelStats&)> value)
+  {
+    out.family(name, type, help);
+    for (const auto& s : snapshots)
+      for (const auto& sub : s.second.rx.subchannels)
+      {
+        const auto sId = s.second.serviceOfSubchannel.find(sub.subChId);
+        char sid[16] = "";
+        if (sId != s.second.serviceOfSubchannel.end())
+          snprintf(sid, sizeof(sid), "%X", sId->second);
+        const OpenMetricsWriter::Labels labels = {
+          {"device", s.first}, {"subchannel", std::to_string(sub.subChId)}, {"sid", sid}};
+        if (type == Type::Counter)
+          out.counter(labels, value(sub));
+        else
+          out.gauge(labels, value(sub));
+      }
+  };
+
+  perService("dab_service_buffer_fill_ratio", Type::Gauge, "Fill of the ring in front of the decoder",
+      [](const auto& s) { return s.bufferSize ? (double)s.bufferFill / s.bufferSize : 0.0; });
+  perService("dab_service_buffer_max_fill_ratio", Type::Gauge, "Highest fill of the ring in front of the decoder",
+      [](const auto& s) { return s.bufferSize ? (double)s.maxBufferFill / s.bufferSize : 0.0; });
+  perService("dab_service_dropped_fragments", Type::Counter, "CIFs dropped because the decoder fell behind",
+      [](const auto& s) { return s.droppedFragments; });
+  perService("dab_service_rs_corrected_errors", Type::Counter, "Bytes corrected by Reed-Solomon",
+      [](const auto& s) { return s.rsCorrectedErrors; });
+  perService("dab_service_rs_uncorrectable_superframes", Type::Counter, "Superframes Reed-Solomon could not correct",
+      [](const auto& s) { return s.rsUncorrectableSuperframes; });
+  perService("dab_service_au_errors", Type::Counter, "Access units with a CRC error",
+      [](const auto& s) { return s.audioUnitErrors; });
+  perService("dab_service_aac_errors", Type::Counter, "Frames the AAC decoder failed on",
+      [](const auto& s) { return s.aacErrors; });
+  perService("dab_service_observers", Type::Gauge, "Handlers fed by the decoder besides the first one",
+      [](const auto& s) { return s.observers; });
+  perService("dab_service_observer_dropped_events", Type::Counter, "Callbacks dropped because an observer fell behind",
+      [](const auto& s) { return s.observerDroppedEvents; });
+
+  // Up to the decoded audio, the handoff to python is seen by the handlers only
+  out.family("dab_service_latency_seconds", Type::Histogram, "Time the newest sample of the audio took through a stage");
+  for (const auto& s : snapshots)
+    for (const auto& sub : s.second.rx.subchannels)
+    {
+      const auto sId = s.second.serviceOfSubchannel.find(sub.subChId);
+      char sid[16] = "";
+      if (sId != s.second.serviceOfSubchannel.end())
+        snprintf(sid, sizeof(sid), "%X", sId->second);
+      for (size_t h = 0; h < numLatencyHops; h++)
+        if (sub.latency[h].count > 0)
+          out.histogram({{"device", s.first}, {"subchannel", std::to_string(sub.subChId)}, {"sid", sid},
+              {"hop", latencyHopName((LatencyHop)h)}}, sub.latency[h], 10, 31);
+    }
+
+  return out.finish();
+}
+
+#if defined(WITH_PROFILING)
+// The stage latencies as CSV, see Profiler::dump
+std::string profiling_report()
+{
+  std::ostringstream report;
+  get_profiler().dump(report);
+  return report.str();
+}
+
+// Record the stages of all threads for the next seconds, see Profiler::start_trace
+bool start_trace(const std::string& path, double seconds)
+{
+  return get_profiler().start_trace(path, seconds);
+}
+#endif
+
 std::list<std::string> all_channel_names ()
 {
   Channels chans;
@@ -328,26 +1726,108 @@ std::list<std::string> all_channel_names ()
 
 PYBIND11_MODULE(welle_io, m) 
 {
+  py::class_<NativeBuffer, std::shared_ptr<NativeBuffer>>(m, "NativeBuffer", py::buffer_protocol())
+     .def_buffer([](NativeBuffer& buffer) -> py::buffer_info {
+        return py::buffer_info(buffer.data.data(), 1, py::format_descriptor<uint8_t>::format(), 1,
+                               { buffer.data.size() }, { 1 }, true);
+     });
+
   py::class_<ServiceEventHandler, PyServiceEventHandler>(m, "ServiceEventHandler")
-     .def(py::init<>());
+     .def(py::init<>())
+     .def_readwrite("audio_chunk_ms", &ServiceEventHandler::audioChunkMs)
+     .def_readwrite("float_audio", &ServiceEventHandler::floatAudio)
+     .def_property("foreground", [](const ServiceEventHandler& h) { return h.foreground.load(); },
+                   [](ServiceEventHandler& h, bool foreground) { h.foreground = foreground; })
+     .def("publish_stream", &ServiceEventHandler::publish_stream, py::arg("server"), py::arg("path"),
+          py::arg("wav"), py::arg("python_audio") = false, py::arg("preroll_ms") = 0, py::keep_alive<1, 2>())
+     .def("unpublish_stream", &ServiceEventHandler::unpublish_stream)
+     .def("get_slides", &ServiceEventHandler::get_slides)
+     .def("get_latency", &ServiceEventHandler::get_latency);
+
+  py::class_<EnsembleService>(m, "EnsembleService")
+     .def_property_readonly("sid", &EnsembleService::sid)
+     .def_property_readonly("label", &EnsembleService::label)
+     .def_property_readonly("short_label", &EnsembleService::short_label)
+     .def_property_readonly("programme_type", &EnsembleService::programme_type)
+     .def_property_readonly("language", &EnsembleService::language)
+     .def_property_readonly("is_audio", &EnsembleService::is_audio)
+     .def_property_readonly("subchannel", &EnsembleService::subchannel);
+
+  py::class_<Ensemble>(m, "Ensemble")
+     .def_property_readonly("version", &Ensemble::version)
+     .def_property_readonly("id", &Ensemble::id)
+     .def_property_readonly("ecc", &Ensemble::ecc)
+     .def_property_readonly("label", &Ensemble::label)
+     .def_property_readonly("service_ids", &Ensemble::service_ids)
+     .def_property_readonly("services", &Ensemble::services)
+     .def("service", &Ensemble::service, py::arg("sid"))
+     .def("__len__", &Ensemble::size)
+     .def("__contains__", &Ensemble::contains);
+
+  py::class_<StreamServer>(m, "StreamServer")
+     .def(py::init<int, py::object>(), py::arg("port"), py::arg("on_idle"))
+     .def("start", &StreamServer::start)
+     .def("stop", &StreamServer::stop)
+     .def("remove_stream", &StreamServer::remove_stream);
 
   py::class_<ChannelEventHandler, PyChannelEventHandler>(m, "ChannelEventHandler")
      .def(py::init<>());
 
   py::class_<DabDevice>(m, "DabDevice")
-     .def(py::init<const std::string&, int, bool>(), py::arg("device_name") = "auto", py::arg("gain") = -1, py::kw_only(), py::arg("decode_audio") = true)
+     .def(py::init<const std::string&, int, bool, int, int, int, const std::string&, bool, bool, size_t, int, bool, const std::string&, bool>(), py::arg("device_name") = "auto", py::arg("gain") = -1, py::kw_only(), py::arg("decode_audio") = true, py::arg("demodulator_threads") = 1,
+          py::arg("warm_standby") = 0, py::arg("warm_standby_timeout_s") = 120, py::arg("ensemble_cache_dir") = "",
+          py::arg("stream_symbols") = false, py::arg("load_governor") = false, py::arg("memory_budget") = 0,
+          py::arg("idle_fic_interval") = 0, py::arg("packed_softbits") = false,
+          py::arg("usb_transfers") = "default", py::arg("usb_zero_copy") = false)
      .def("initialize", &DabDevice::initialize)
      .def("close_device", &DabDevice::close_device)
      .def("set_channel", &DabDevice::set_channel, py::arg("channel"), py::arg("handler"), py::arg("isScan") = false)
+     .def("probe_channel", &DabDevice::probe_channel, py::arg("channel"), py::arg("timeout_ms") = 500)
+     .def("prescan_channels", &DabDevice::prescan_channels, py::arg("channels"), py::arg("timeout_ms") = 100)
      .def("get_channel", &DabDevice::get_channel)
      .def("reset_channel", &DabDevice::reset_channel)
-     .def("subscribe_service", &DabDevice::subscribe_service)
-     .def("unsubscribe_service", &DabDevice::unsubscribe_service)
+     .def("retune", &DabDevice::retune, py::arg("channel"), py::arg("handler"), py::arg("isScan") = false)
+     .def("set_channel_async", &DabDevice::set_channel_async, py::arg("channel"), py::arg("handler"), py::arg("isScan") = false)
+     .def("retune_async", &DabDevice::retune_async, py::arg("channel"), py::arg("handler"), py::arg("isScan") = false)
+     .def("reset_channel_async", &DabDevice::reset_channel_async)
+     .def("subscribe_service", &DabDevice::subscribe_service, py::arg("handler"), py::arg("sId"), py::arg("decode_audio") = py::none(),
+          py::arg("overflow_policy") = "drop_oldest", py::arg("block_timeout_ms") = 24)
+     .def("subscribe_service_async", &DabDevice::subscribe_service_async, py::arg("handler"), py::arg("sId"),
+          py::arg("decode_audio") = py::none(), py::arg("overflow_policy") = "drop_oldest", py::arg("block_timeout_ms") = 24)
+     .def("unsubscribe_service", &DabDevice::unsubscribe_service, py::arg("sId"), py::arg("handler") = py::none())
+     .def("unsubscribe_service_async", &DabDevice::unsubscribe_service_async, py::arg("sId"), py::arg("handler") = py::none())
+     .def("set_foreground", &DabDevice::set_foreground, py::arg("handler"), py::arg("foreground"))
+     .def("expire_standby", &DabDevice::expire_standby)
      .def("get_service_name", &DabDevice::get_service_name)
      .def("is_audio_service", &DabDevice::is_audio_service)
+     .def("get_ensemble", &DabDevice::get_ensemble)
+     .def("get_fib_signature", &DabDevice::get_fib_signature)
+     .def("get_decoded_bytes", &DabDevice::get_decoded_bytes)
+     .def("get_dropped_fragments", &DabDevice::get_dropped_fragments, py::arg("sId") = py::none())
+     .def("get_stats", &DabDevice::get_stats)
+     .def("start_recording", &DabDevice::start_recording, py::arg("path"), py::arg("buffer_mb") = 16,
+          py::arg("direct_io") = false)
+     .def("stop_recording", &DabDevice::stop_recording)
+     .def("publish_eti", &DabDevice::publish_eti, py::arg("server"), py::arg("path"), py::arg("all_subchannels") = true)
+     .def("unpublish_eti", &DabDevice::unpublish_eti)
      .def_readonly("device_name", &DabDevice::deviceName)
      .def_readonly("gain", &DabDevice::gain)
+     .def_readonly("warm_standby", &DabDevice::warmStandby)
+     .def_readonly("warm_standby_timeout_s", &DabDevice::warmStandbyTimeoutS)
      .def_property_readonly("lock", &DabDevice::getLock);
 
   m.def("all_channel_names", &all_channel_names);
+  m.def("render_metrics", &render_metrics, py::arg("devices"));
+  m.def("available_devices", &CInputFactory::GetDeviceNames);
+  m.def("configure_fft_planner", &configure_fft_planner, py::arg("mode"), py::arg("wisdom_file") = "");
+  m.def("configure_dsp_kernels", &configure_dsp_kernels, py::arg("kernels") = "auto");
+  m.def("configure_aac_decoder", &configure_aac_decoder, py::arg("decoder") = "auto");
+  m.def("aac_decoders", &aac_decoders);
+  m.def("configure_memory", &configure_memory, py::arg("mode"));
+  m.def("configure_thread", &configure_thread, py::arg("stage"), py::arg("cpus") = std::vector<int>(),
+        py::arg("realtime_priority") = 0, py::arg("nice") = 0);
+#if defined(WITH_PROFILING)
+  m.def("profiling_report", &profiling_report);
+  m.def("start_trace", &start_trace, py::arg("path"), py::arg("seconds") = 10.0);
+#endif
 }